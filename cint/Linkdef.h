@@ -83,6 +83,7 @@ class TTree;
 
 #pragma link C++ class midas::Event::Header+;
 #pragma link C++ class midas::Xml+;
+#pragma link C++ class midas::OdbSnapshot+;
 #pragma link C++ class midas::Odb+;
 #pragma link C++ class midas::Database+;
 #pragma link C++ class mxml_struct+;
@@ -133,11 +134,14 @@ class TTree;
 #pragma link C++ class dragon::Coinc+;
 #pragma link C++ class dragon::Scaler+;
 #pragma link C++ class dragon::Epics+;
+#pragma link C++ class dragon::UnpackedCodes+;
 #pragma link C++ class dragon::Unpacker+;
 #pragma link C++ class dragon::Kin2Body+;
 #pragma link C++ class dragon::LinearFitter+;
+#pragma link C++ class dragon::LinearSums+;
 #pragma link C++ class dragon::MetricPrefix+;
 #pragma link C++ class dragon::TTreeFilter+;
+#pragma link C++ class dragon::FastCutG-;
 #pragma link C++ class dragon::RossumData+;
 #pragma link C++ class dragon::LabCM+;
 #pragma link C++ class dragon::BeamNorm+;
@@ -145,6 +149,8 @@ class TTree;
 #pragma link C++ class dragon::StoppingPowerCalculator+;
 #pragma link C++ class dragon::StoppingPowerCalculator::Measurement_t+;
 #pragma link C++ class dragon::LiveTimeCalculator+;
+#pragma link C++ class dragon::RunSummary+;
+#pragma link C++ class dragon::RunQuery+;
 #pragma link C++ class dragon::ResonanceStrengthCalculator+;
 #pragma link C++ class dragon::CrossSectionCalculator+;
 #pragma link C++ class dragon::ASelector+;
@@ -166,6 +172,7 @@ class TTree;
 #pragma link C++ class midas::CoincEvent+;
 #pragma link C++ class midas::Odb+;
 #pragma link C++ class midas::Xml+;
+#pragma link C++ class midas::OdbSnapshot+;
 #pragma link C++ class mxml_struct+;
 
 // tstamp ns classes
@@ -188,5 +195,6 @@ class TTree;
 
 // Class UDouble_t
 #pragma link C++ class UDouble_t+;
+#pragma link C++ class USample_t+;
 
 #endif // __MAKECINT__
@@ -49,6 +49,7 @@ class TTree;
 #pragma link C++ class midas::Event::Header+;
 
 #pragma link C++ class midas::Xml+;
+#pragma link C++ class midas::OdbSnapshot+;
 #pragma link C++ class midas::Odb+;
 #pragma link C++ class midas::Database+;
 #pragma link C++ class mxml_struct+;
@@ -0,0 +1,126 @@
+// Manual file, wraps dragon::BatchReader for reading chunks of events into NumPy arrays
+
+#include "boost/python.hpp"
+
+#include <numpy/arrayobject.h>
+
+#include "Batch.hxx"
+
+namespace bp = boost::python;
+
+
+namespace dragon { namespace wrappers {
+
+/// Releases the GIL for the lifetime of the instance
+class AllowThreads {
+public:
+	AllowThreads(): fState(PyEval_SaveThread()) { }
+	~AllowThreads() { PyEval_RestoreThread(fState); }
+private:
+	PyThreadState* fState;
+};
+
+/// Capsule destructor, frees the chunk once the last array using it is gone
+void DeleteChunk(PyObject* capsule)
+{
+	delete static_cast<dragon::BatchReader::Chunk*>(PyCapsule_GetPointer(capsule, "dragon.BatchReader.Chunk"));
+}
+
+struct BatchReader : dragon::BatchReader {
+
+	BatchReader(const char* filename, dragon::BatchReader::Source_t source, size_t chunkSize, size_t depth):
+		dragon::BatchReader(filename, source, chunkSize, depth) {  }
+
+	bool Start(const char* odb)
+		{ AllowThreads allow; return dragon::BatchReader::Start(odb); }
+
+	bool StartDefault()
+		{ return Start(0); }
+
+	/// Dict of column name -> NumPy array of the next chunk, None at the end of the file
+	/*!
+	 * The arrays are views of the chunk's memory, not copies: columns of one
+	 * value per event are 1-d, arrays (e.g. "bgo.ecal") are 2-d, one row per
+	 * event. The chunk is owned by a capsule set as the base of every array.
+	 */
+	bp::object Next()
+		{
+			Chunk* chunk;
+			{ AllowThreads allow; chunk = dragon::BatchReader::Next(); }
+			if (!chunk) return bp::object();
+
+			bp::object owner(bp::handle<>(PyCapsule_New(chunk, "dragon.BatchReader.Chunk", DeleteChunk)));
+			bp::dict columns;
+			for (int i = 0; i< chunk->GetNumColumns(); ++i) {
+				npy_intp dims[2] = { npy_intp(chunk->GetNumEvents()), chunk->GetWidth(i) };
+				PyObject* array = PyArray_SimpleNewFromData(dims[1] == 1 ? 1 : 2, dims, NPY_DOUBLE, chunk->GetColumn(i));
+				if (!array) bp::throw_error_already_set();
+				Py_INCREF(owner.ptr());
+				PyArray_SetBaseObject(reinterpret_cast<PyArrayObject*>(array), owner.ptr());
+				columns[GetColumnName(i)] = bp::object(bp::handle<>(array));
+			}
+			return columns;
+		}
+
+	/// Python iterator protocol, as Next() but raising StopIteration at the end
+	bp::object IterNext()
+		{
+			bp::object columns = Next();
+			if (columns.ptr() == Py_None) {
+				PyErr_SetNone(PyExc_StopIteration);
+				bp::throw_error_already_set();
+			}
+			return columns;
+		}
+
+	static bp::list GetColumnNames(dragon::BatchReader::Source_t source)
+		{
+			bp::list names;
+			const std::vector<std::string> paths = dragon::BatchReader::GetColumnNames(source);
+			for (size_t i = 0; i< paths.size(); ++i) names.append(paths[i]);
+			return names;
+		}
+
+};
+
+bp::object Self(bp::object self) { return self; }
+
+} } // namespace dragon::wrappers
+
+
+#if PY_MAJOR_VERSION >= 3
+void* init_numpy() { import_array(); return 0; }
+#else
+void init_numpy() { import_array(); }
+#endif
+
+BOOST_PYTHON_MODULE(batch)
+{
+	init_numpy();
+	PyEval_InitThreads();
+
+	bp::enum_< dragon::BatchReader::Source_t >("Source")
+		.value("kHead",  dragon::BatchReader::kHead)
+		.value("kTail",  dragon::BatchReader::kTail)
+		.value("kCoinc", dragon::BatchReader::kCoinc)
+		;
+
+	bp::class_< dragon::wrappers::BatchReader, boost::noncopyable >
+		("BatchReader", bp::init< const char*, dragon::BatchReader::Source_t, size_t, size_t >
+		 (( bp::arg("filename"), bp::arg("source"), bp::arg("chunkSize") = 65536, bp::arg("depth") = 4 )))
+		.def("IsGood",         &dragon::wrappers::BatchReader::IsGood)
+		.def("Select",         &dragon::wrappers::BatchReader::Select)
+		.def("Start",          &dragon::wrappers::BatchReader::Start)
+		.def("Start",          &dragon::wrappers::BatchReader::StartDefault)
+		.def("Next",           &dragon::wrappers::BatchReader::Next)
+		.def("GetNumColumns",  &dragon::wrappers::BatchReader::GetNumColumns)
+		.def("GetColumnName",  &dragon::wrappers::BatchReader::GetColumnName)
+		.def("GetColumnWidth", &dragon::wrappers::BatchReader::GetColumnWidth)
+		.def("GetNumEvents",   &dragon::wrappers::BatchReader::GetNumEvents)
+		.def("GetColumnNames", &dragon::wrappers::BatchReader::GetColumnNames)
+		.staticmethod("GetColumnNames")
+		.def("__iter__",       &dragon::wrappers::Self)
+		.def("next",           &dragon::wrappers::BatchReader::IterNext)
+		.def("__next__",       &dragon::wrappers::BatchReader::IterNext)
+		;
+}
@@ -0,0 +1,73 @@
+#!/bin/sh
+##
+## \file chunked_convert.sh
+## \brief Converts one MIDAS run on several nodes with mid2root --chunk, then merges the chunks.
+##
+## Usage: chunked_convert.sh [-n <chunks>] [-l local|ssh|slurm] [-H <host>,<host>,...]
+##  [-o <output file>] <input file> [<mid2root options>]
+##
+## The input and output must be on a file system shared by all nodes. The index
+## is built first, so the chunks don't each build it. With "-l ssh", chunk i
+## runs on host i modulo the number of hosts given with -H; with "-l slurm",
+## every chunk is a job step started with srun (inside an allocation, or as a
+## job of its own). Remaining arguments are passed on to every mid2root chunk.
+##
+
+chunks=4
+launcher=local
+hosts=
+output=
+bindir=$(cd "$(dirname "$0")/../bin" && pwd)
+
+while getopts "n:l:H:o:" opt; do
+	case $opt in
+		n) chunks=$OPTARG ;;
+		l) launcher=$OPTARG ;;
+		H) hosts=$(echo "$OPTARG" | tr ',' ' ') ;;
+		o) output=$OPTARG ;;
+		*) echo "usage: $0 [-n <chunks>] [-l local|ssh|slurm] [-H <hosts>] [-o <output>] <input> [<mid2root options>]" >&2
+		   exit 1 ;;
+	esac
+done
+shift $((OPTIND - 1))
+if [ $# -lt 1 ] || [ "$chunks" -lt 1 ]; then
+	echo "usage: $0 [-n <chunks>] [-l local|ssh|slurm] [-H <hosts>] [-o <output>] <input> [<mid2root options>]" >&2
+	exit 1
+fi
+input=$(cd "$(dirname "$1")" && pwd)/$(basename "$1")
+shift
+[ -n "$output" ] || output=$(basename "$input" | sed -e 's/\.gz$//' -e 's/\.mid$//').root
+stem=${output%.root}
+[ "$launcher" != ssh ] || [ -n "$hosts" ] || { echo "$0: -l ssh needs -H <hosts>" >&2; exit 1; }
+
+"$bindir/midasindex" "$input" || exit 1
+
+pids=
+i=0
+while [ $i -lt "$chunks" ]; do
+	cmd="$bindir/mid2root $input --chunk $i/$chunks -o ${stem}_chunk$i.root --overwrite --quiet 1 $*"
+	case $launcher in
+		local) $cmd & ;;
+		ssh)   n=$(echo $hosts | wc -w)
+		       host=$(echo $hosts | cut -d' ' -f$((i % n + 1)))
+		       ssh "$host" "cd $(pwd) && $cmd" & ;;
+		slurm) srun --nodes=1 --ntasks=1 $cmd & ;;
+		*)     echo "$0: unknown launcher '$launcher'" >&2; exit 1 ;;
+	esac
+	pids="$pids $!"
+	i=$((i + 1))
+done
+
+failed=0
+for pid in $pids; do
+	wait "$pid" || failed=1
+done
+[ $failed -eq 0 ] || { echo "$0: a chunk failed, not merging" >&2; exit 1; }
+
+i=0
+parts=
+while [ $i -lt "$chunks" ]; do
+	parts="$parts ${stem}_chunk$i.root"
+	i=$((i + 1))
+done
+"$bindir/mid2root" --merge -o "$output" --overwrite $parts && rm -f $parts
@@ -0,0 +1,453 @@
+///
+/// \file Batch.cxx
+/// \brief Implements Batch.hxx
+///
+#include <memory>
+#include "utils/definitions.h"
+#include "utils/ErrorDragon.hxx"
+#include "utils/Thread.hxx"
+#include "midas/Database.hxx"
+#include "midas/libMidasInterface/TMidasFile.h"
+#include "midas/libMidasInterface/TMidasEvent.h"
+#include "TStamp.hxx"
+#include "Dragon.hxx"
+#include "Unpack.hxx"
+#include "Batch.hxx"
+
+
+namespace {
+
+/// Types of the data members read into columns
+enum Type_t { kDouble, kUnsigned, kInt };
+
+/// One column: a data member of an event object
+struct Column_t {
+	std::string path;
+	std::ptrdiff_t offset; ///< Bytes from the start of the event object
+	int width;             ///< Number of values
+	Type_t type;
+};
+
+inline Type_t type_of(const double*)   { return kDouble; }
+inline Type_t type_of(const uint32_t*) { return kUnsigned; }
+inline Type_t type_of(const int*)      { return kInt; }
+
+/// Adds the columns of one event object to a table
+class ColumnList {
+public:
+	ColumnList(std::vector<Column_t>& columns, const void* base, const std::string& prefix = ""):
+		fColumns(columns), fBase(static_cast<const char*>(base)), fPrefix(prefix) { }
+	/// Add the column \e path at \e member, of \e width values
+	template <class T>
+	void Add(const char* path, const T* member, int width = 1)
+		{
+			Column_t column = { fPrefix + path, reinterpret_cast<const char*>(member) - fBase, width, type_of(member) };
+			fColumns.push_back(column);
+		}
+private:
+	std::vector<Column_t>& fColumns;
+	const char* fBase;
+	std::string fPrefix;
+};
+
+void add_io32(ColumnList& list, const vme::Io32& io32)
+{
+	list.Add("io32.trig_count", &io32.trig_count);
+	list.Add("io32.tstamp", &io32.tstamp);
+	list.Add("io32.trigger_latch", &io32.trigger_latch);
+	list.Add("io32.tsc4.trig_time", &io32.tsc4.trig_time);
+}
+
+void add_head(ColumnList& list, const dragon::Head& head)
+{
+	list.Add("header.serial", &head.header.fSerialNumber);
+	list.Add("header.time", &head.header.fTimeStamp);
+	add_io32(list, head.io32);
+	list.Add("bgo.ecal", head.bgo.ecal, dragon::Bgo::MAX_CHANNELS);
+	list.Add("bgo.tcal", head.bgo.tcal, dragon::Bgo::MAX_CHANNELS);
+	list.Add("bgo.esort", head.bgo.esort, dragon::Bgo::MAX_CHANNELS);
+	list.Add("bgo.sum", &head.bgo.sum);
+	list.Add("bgo.hit0", &head.bgo.hit0);
+	list.Add("bgo.x0", &head.bgo.x0);
+	list.Add("bgo.y0", &head.bgo.y0);
+	list.Add("bgo.z0", &head.bgo.z0);
+	list.Add("bgo.t0", &head.bgo.t0);
+	list.Add("trf.leading", head.trf.leading, dragon::Head::MAX_RF_HITS);
+	list.Add("trf.trailing", head.trf.trailing, dragon::Head::MAX_RF_HITS);
+	list.Add("tcal0", &head.tcal0);
+	list.Add("tcalx", &head.tcalx);
+	list.Add("tcal_rf", &head.tcal_rf);
+}
+
+void add_tail(ColumnList& list, const dragon::Tail& tail)
+{
+	list.Add("header.serial", &tail.header.fSerialNumber);
+	list.Add("header.time", &tail.header.fTimeStamp);
+	add_io32(list, tail.io32);
+#ifndef DRAGON_OMIT_DSSSD
+	list.Add("dsssd.ecal", tail.dsssd.ecal, dragon::Dsssd::MAX_CHANNELS);
+	list.Add("dsssd.efront", &tail.dsssd.efront);
+	list.Add("dsssd.eback", &tail.dsssd.eback);
+	list.Add("dsssd.hit_front", &tail.dsssd.hit_front);
+	list.Add("dsssd.hit_back", &tail.dsssd.hit_back);
+	list.Add("dsssd.tfront", &tail.dsssd.tfront);
+	list.Add("dsssd.tback", &tail.dsssd.tback);
+#endif
+#ifndef DRAGON_OMIT_IC
+	list.Add("ic.anode", tail.ic.anode, dragon::IonChamber::MAX_CHANNELS);
+	list.Add("ic.tcal", tail.ic.tcal, dragon::IonChamber::MAX_TDC);
+	list.Add("ic.sum", &tail.ic.sum);
+#endif
+#ifndef DRAGON_OMIT_NAI
+	list.Add("nai.ecal", tail.nai.ecal, dragon::NaI::MAX_CHANNELS);
+#endif
+#ifndef DRAGON_OMIT_GE
+	list.Add("ge.ecal", &tail.ge.ecal);
+#endif
+	list.Add("mcp.anode", tail.mcp.anode, dragon::Mcp::MAX_CHANNELS);
+	list.Add("mcp.tcal", tail.mcp.tcal, dragon::Mcp::NUM_DETECTORS);
+	list.Add("mcp.esum", &tail.mcp.esum);
+	list.Add("mcp.tac", &tail.mcp.tac);
+	list.Add("mcp.x", &tail.mcp.x);
+	list.Add("mcp.y", &tail.mcp.y);
+	list.Add("sb.ecal", tail.sb.ecal, dragon::SurfaceBarrier::MAX_CHANNELS);
+	list.Add("tof.mcp", &tail.tof.mcp);
+#ifndef DRAGON_OMIT_DSSSD
+	list.Add("tof.mcp_dsssd", &tail.tof.mcp_dsssd);
+#endif
+#ifndef DRAGON_OMIT_IC
+	list.Add("tof.mcp_ic", &tail.tof.mcp_ic);
+#endif
+	list.Add("trf.leading", tail.trf.leading, dragon::Tail::MAX_RF_HITS);
+	list.Add("trf.trailing", tail.trf.trailing, dragon::Tail::MAX_RF_HITS);
+	list.Add("tcal0", &tail.tcal0);
+	list.Add("tcalx", &tail.tcalx);
+	list.Add("tcal_rf", &tail.tcal_rf);
+}
+
+void add_coinc(std::vector<Column_t>& columns, const dragon::Coinc& coinc)
+{
+	ColumnList head(columns, &coinc, "head.");
+	add_head(head, coinc.head);
+	ColumnList tail(columns, &coinc, "tail.");
+	add_tail(tail, coinc.tail);
+	ColumnList list(columns, &coinc);
+	list.Add("xtrig", &coinc.xtrig);
+	list.Add("xtofh", &coinc.xtofh);
+	list.Add("xtoft", &coinc.xtoft);
+}
+
+/// Columns of the events of type \e source, with offsets from the start of \e head, \e tail or \e coinc
+std::vector<Column_t> get_columns(dragon::BatchReader::Source_t source,
+																	const dragon::Head& head, const dragon::Tail& tail, const dragon::Coinc& coinc)
+{
+	std::vector<Column_t> columns;
+	if (source == dragon::BatchReader::kHead) {
+		ColumnList list(columns, &head);
+		add_head(list, head);
+	}
+	else if (source == dragon::BatchReader::kTail) {
+		ColumnList list(columns, &tail);
+		add_tail(list, tail);
+	}
+	else
+		add_coinc(columns, coinc);
+	return columns;
+}
+
+/// Value \e i of the data member at \e offset bytes from \e base, of type \e type
+inline double read_value(const char* base, std::ptrdiff_t offset, int type, int i)
+{
+	const char* member = base + offset;
+	switch (type) {
+	case kUnsigned: return reinterpret_cast<const uint32_t*>(member)[i];
+	case kInt:      return reinterpret_cast<const int*>(member)[i];
+	default:        return reinterpret_cast<const double*>(member)[i];
+	}
+}
+
+/// Copy \e column of the event object at \e base into \e out
+inline void read_column(const char* base, const Column_t& column, double* out)
+{
+	for (int i = 0; i< column.width; ++i)
+		out[i] = read_value(base, column.offset, column.type, i);
+}
+
+} // namespace
+
+
+// ================ class dragon::BatchReader::Worker ================ //
+
+/// Unpacks the file into chunks, in a thread of its own
+class dragon::BatchReader::Worker: public dragon::utils::Thread {
+public:
+	Worker(const char* filename, Source_t source, std::size_t chunkSize, std::size_t depth):
+		fSource(source), fChunkSize(chunkSize > 0 ? chunkSize : 1), fChunks(depth), fChunk(0), fStopped(false),
+		fUnpacker(&fHead, &fTail, &fCoinc, &fEpics, &fHeadScaler, &fTailScaler, &fAuxScaler,
+							&fRunpar, &fDiag, source != kCoinc),
+		fColumns(get_columns(source, fHead, fTail, fCoinc)), fGood(fFile.Open(filename))
+		{
+			if (!fGood)
+				dragon::utils::Error("BatchReader", __FILE__, __LINE__) << "Failed to open MIDAS file \"" << filename << "\"";
+		}
+
+	~Worker()
+		{
+			/*! Closing the queue makes the thread stop at its next Push() */
+			fChunks.Close();
+			Join();
+			Chunk* chunk;
+			while (fChunks.Pop(chunk)) delete chunk;
+			delete fChunk;
+		}
+
+	/// Index of the column at \e path, -1 if there is none
+	int Find(const char* path) const
+		{
+			for (size_t i = 0; i< fColumns.size(); ++i)
+				if (fColumns[i].path == path) return i;
+			return -1;
+		}
+
+	/// Read variables from \e odb and select the columns to read
+	bool Prepare(const char* odb, const std::vector<int>& selected, const std::vector<int>& widths)
+		{
+			fUnpacker.HandleBor(odb);
+			/// - Match coincidences with the window and buffer time of the ODB, as mid2root does
+			if (fSource == kCoinc) {
+				midas::Database db(odb);
+				double window = 10, queueTime = 4;
+				if (!db.IsZombie() &&
+						db.ReadValue("/dragon/coinc/variables/window", window) &&
+						db.ReadValue("/dragon/coinc/variables/buffer_time", queueTime)) {
+					fUnpacker.SetCoincWindow(window);
+					fUnpacker.SetQueueTime(queueTime);
+				}
+			}
+			/// - Calculate only the derived parameters needed for the selected columns
+			int head = 0, tail = 0;
+			for (size_t i = 0; i< selected.size(); ++i) {
+				const char* path = fColumns[selected[i]].path.c_str();
+				switch (fSource) {
+				case kHead: head |= dragon::Head::derived_of(path); break;
+				case kTail: tail |= dragon::Tail::derived_of(path); break;
+				case kCoinc: dragon::Coinc::derived_of(path, head, tail); break;
+				}
+			}
+			fHead.set_derived(head);
+			fTail.set_derived(tail);
+			fCoinc.head.set_derived(head);
+			fCoinc.tail.set_derived(tail);
+
+			fSelected = selected;
+			fWidths = widths;
+			fChunk = new Chunk(fWidths, fChunkSize);
+			return Start();
+		}
+
+	/// Take the next chunk, waiting for it; NULL at the end of the file
+	Chunk* Take()
+		{
+			Chunk* chunk = 0;
+			return fChunks.Pop(chunk) ? chunk : 0;
+		}
+
+	bool IsGood() const { return fGood; }
+	const char* GetFilename() const { return fFile.GetFilename(); }
+	const std::vector<Column_t>& GetColumns() const { return fColumns; }
+
+	/// Unpacker visitor: add an event of the type read to the current chunk
+	void operator() (int32_t code)
+		{
+			const char* base;
+			if      (fSource == kHead  && code == DRAGON_HEAD_EVENT)  base = reinterpret_cast<const char*>(&fHead);
+			else if (fSource == kTail  && code == DRAGON_TAIL_EVENT)  base = reinterpret_cast<const char*>(&fTail);
+			else if (fSource == kCoinc && code == DRAGON_COINC_EVENT) base = reinterpret_cast<const char*>(&fCoinc);
+			else return;
+
+			for (size_t i = 0; i< fSelected.size(); ++i)
+				read_column(base, fColumns[fSelected[i]], &fChunk->fColumns[i][fChunk->fEvents * fWidths[i]]);
+			if (++fChunk->fEvents == fChunkSize) Send();
+		}
+
+protected:
+	/// Unpack the file, as in the serial loop of mid2root
+	void Run()
+		{
+			fStopped = false;
+			while (!fStopped) {
+				TMidasEvent event;
+				if (!fFile.ReadView(&event)) break;
+				if (event.GetEventId() == MIDAS_BOR || event.GetEventId() == MIDAS_EOR) {
+					midas::Database db(event.GetData(), event.GetDataSize());
+					fUnpacker.ClearUnpackedCodes();
+					fUnpacker.UnpackRunParameters(db);
+				}
+				else
+					fUnpacker.Unpack(event.GetEventHeader(), event.GetData(), *this);
+			}
+			if (!fUnpacker.IsSinglesMode()) {
+				while (!fStopped && fUnpacker.FlushQueueIterative())
+					fUnpacker.GetUnpacked().Visit(*this);
+			}
+			if (!fStopped && fChunk->fEvents) Send();
+			fChunks.Close();
+		}
+
+private:
+	/// Hand the current chunk to the reader and start a new one
+	void Send()
+		{
+			for (size_t i = 0; i< fWidths.size(); ++i)
+				fChunk->fColumns[i].resize(fChunk->fEvents * fWidths[i]);
+			if (!fChunks.Push(fChunk)) { // closed by the destructor
+				delete fChunk;
+				fStopped = true;
+			}
+			fChunk = new Chunk(fWidths, fChunkSize);
+		}
+
+private:
+	Source_t fSource;
+	std::size_t fChunkSize;
+	dragon::utils::BoundedQueue<Chunk*> fChunks;
+	Chunk* fChunk;  ///< Chunk being filled
+	bool fStopped;  ///< Queue closed before the end of the file
+
+	dragon::Head fHead;
+	dragon::Tail fTail;
+	dragon::Coinc fCoinc;
+	dragon::Epics fEpics;
+	dragon::Scaler fHeadScaler;
+	dragon::Scaler fTailScaler;
+	dragon::Scaler fAuxScaler;
+	dragon::RunParameters fRunpar;
+	tstamp::Diagnostics fDiag;
+	dragon::Unpacker fUnpacker;
+
+	std::vector<Column_t> fColumns;
+	std::vector<int> fSelected;
+	std::vector<int> fWidths;
+	TMidasFile fFile;
+	bool fGood;
+};
+
+
+// ================ class dragon::BatchReader::Chunk ================ //
+
+dragon::BatchReader::Chunk::Chunk(const std::vector<int>& widths, std::size_t capacity):
+	fEvents(0), fWidths(widths), fColumns(widths.size())
+{
+	/// Allocates \e capacity events for every column
+	for (size_t i = 0; i< fColumns.size(); ++i)
+		fColumns[i].resize(capacity * fWidths[i]);
+}
+
+
+// ================ class dragon::BatchReader::Column ================ //
+
+dragon::BatchReader::Column::Column(Source_t source, const char* path):
+	fPath(path), fOffset(0), fWidth(0), fType(kDouble)
+{
+	/*! Check IsValid() for whether \e path was found; see BatchReader::GetColumnNames() */
+	std::auto_ptr<Coinc> coinc(new Coinc());
+	const std::vector<Column_t> columns = get_columns(source, coinc->head, coinc->tail, *coinc);
+	for (size_t i = 0; i< columns.size(); ++i) {
+		if (columns[i].path != fPath) continue;
+		fOffset = columns[i].offset;
+		fWidth = columns[i].width;
+		fType = columns[i].type;
+		break;
+	}
+}
+
+double dragon::BatchReader::Column::Get(const void* event, int i) const
+{
+	/*!
+	 * \param event Pointer to a dragon::Head, Tail or Coinc, the type given at construction
+	 * \param i Index of the value, less than GetWidth()
+	 */
+	return read_value(static_cast<const char*>(event), fOffset, fType, i);
+}
+
+
+// ================ class dragon::BatchReader ================ //
+
+dragon::BatchReader::BatchReader(const char* filename, Source_t source, std::size_t chunkSize, std::size_t depth):
+	fSource(source), fChunkSize(chunkSize),
+	fWorker(new Worker(filename, source, chunkSize, depth)),
+	fEvents(0), fStarted(false)
+{
+	/// \param filename MIDAS file name (compressed files are read as by TMidasFile)
+	/// \param source Events read
+	/// \param chunkSize Maximum number of events per chunk
+	/// \param depth Maximum number of chunks waiting to be taken by Next()
+}
+
+dragon::BatchReader::~BatchReader()
+{
+	delete fWorker;
+}
+
+bool dragon::BatchReader::IsGood() const
+{
+	return fWorker->IsGood();
+}
+
+bool dragon::BatchReader::Select(const char* path)
+{
+	/*!
+	 * \param path Data member path, see GetColumnNames()
+	 * \returns false (with an error message) if there is no such column, or Start() has been called
+	 */
+	if (fStarted) {
+		dragon::utils::Error("BatchReader::Select") << "Columns must be selected before Start()";
+		return false;
+	}
+	const int column = fWorker->Find(path);
+	if (column < 0) {
+		dragon::utils::Error("BatchReader::Select") << "No column \"" << path << "\"";
+		return false;
+	}
+	fSelected.push_back(column);
+	fWidths.push_back(fWorker->GetColumns()[column].width);
+	return true;
+}
+
+std::vector<std::string> dragon::BatchReader::GetColumnNames(Source_t source)
+{
+	std::auto_ptr<Coinc> coinc(new Coinc());
+	const std::vector<Column_t> columns = get_columns(source, coinc->head, coinc->tail, *coinc);
+	std::vector<std::string> names;
+	for (size_t i = 0; i< columns.size(); ++i) names.push_back(columns[i].path);
+	return names;
+}
+
+const char* dragon::BatchReader::GetColumnName(int i) const
+{
+	return fWorker->GetColumns()[fSelected[i]].path.c_str();
+}
+
+bool dragon::BatchReader::Start(const char* odb)
+{
+	/*!
+	 * \param odb Database (XML file or MIDAS file) to read the variables from, the
+	 *  data file itself (its begin-of-run ODB dump) if NULL
+	 * \returns false if the file is not open, the reader is already started, or
+	 *  the thread could not be created
+	 */
+	if (!IsGood() || fStarted) return false;
+	if (fSelected.empty())
+		dragon::utils::Warning("BatchReader::Start") << "No columns selected, chunks only count events";
+	fStarted = fWorker->Prepare(odb ? odb : fWorker->GetFilename(), fSelected, fWidths);
+	return fStarted;
+}
+
+dragon::BatchReader::Chunk* dragon::BatchReader::Next()
+{
+	/*! \returns The next chunk, which the caller deletes; NULL once all events have been read */
+	if (!fStarted) return 0;
+	Chunk* chunk = fWorker->Take();
+	if (chunk) fEvents += chunk->GetNumEvents();
+	return chunk;
+}
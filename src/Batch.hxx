@@ -0,0 +1,135 @@
+///
+/// \file Batch.hxx
+/// \brief Defines a reader of selected event parameters from a MIDAS file, in chunks of column arrays.
+///
+#ifndef DRAGON_BATCH_HXX
+#define DRAGON_BATCH_HXX
+#include <string>
+#include <vector>
+#include <cstddef>
+
+
+namespace dragon {
+
+/// Reads selected parameters of head, tail or coincidence events into column arrays
+/*!
+ * For array based analysis outside of ROOT, e.g. with NumPy through the py++
+ * bindings. Parameters are selected by their data member path, the same as the
+ * branch names in mid2root trees: "bgo.ecal", "dsssd.efront", "header.serial",
+ * or for coincidence events "head.bgo.sum", "tail.mcp.x", "xtofh". Each column
+ * holds one value per event, or GetColumnWidth() values per event for arrays
+ * (stored event by event), converted to double.
+ *
+ * Start() unpacks the file in a thread of its own, as mid2root does (including
+ * coincidence matching for coincidence events, and calculating only the derived
+ * parameters of the columns selected), and fills chunks of up to \e chunkSize
+ * events, which Next() returns in order. At most \e depth chunks wait to be
+ * taken, so the reader keeps a bounded distance ahead of the caller. Next()
+ * only blocks while waiting for a chunk, so a caller holding an interpreter
+ * lock can release it around the call.
+ */
+class BatchReader {
+public:
+	/// Events read
+	enum Source_t {
+		kHead,  ///< dragon::Head singles
+		kTail,  ///< dragon::Tail singles
+		kCoinc  ///< dragon::Coinc
+	};
+
+private:
+	class Worker;
+
+public:
+	/// Values of the selected columns for consecutive events
+	class Chunk {
+	public:
+		/// Empty chunk of \e widths.size() columns
+		Chunk(const std::vector<int>& widths, std::size_t capacity);
+		/// Number of events
+		std::size_t GetNumEvents() const { return fEvents; }
+		/// Number of columns, in the order selected
+		int GetNumColumns() const { return fWidths.size(); }
+		/// Number of values per event of column \e i
+		int GetWidth(int i) const { return fWidths[i]; }
+		/// Values of column \e i, GetNumEvents() * GetWidth(i) of them
+		const double* GetColumn(int i) const { return fColumns[i].empty() ? 0 : &fColumns[i][0]; }
+		/// Values of column \e i, e.g. to hand them on without copying
+		double* GetColumn(int i) { return fColumns[i].empty() ? 0 : &fColumns[i][0]; }
+
+	private:
+		friend class Worker;
+		std::size_t fEvents;
+		std::vector<int> fWidths;
+		std::vector<std::vector<double> > fColumns;
+	};
+
+	/// One column, read from single event objects
+	/*!
+	 * For per-event selections on the same parameters, e.g. the cuts of
+	 * midskim: Get() reads the column from a dragon::Head, Tail or Coinc of
+	 * the type given at construction.
+	 */
+	class Column {
+	public:
+		/// Look up the column at \e path of events of type \e source
+		Column(Source_t source, const char* path);
+		/// Check if the column exists
+		bool IsValid() const { return fWidth > 0; }
+		/// Data member path
+		const char* GetPath() const { return fPath.c_str(); }
+		/// Number of values per event
+		int GetWidth() const { return fWidth; }
+		/// Value \e i of the column in \e event
+		double Get(const void* event, int i = 0) const;
+
+	private:
+		std::string fPath;
+		std::ptrdiff_t fOffset;
+		int fWidth;
+		int fType;
+	};
+
+public:
+	/// Open \e filename, reading events of type \e source
+	BatchReader(const char* filename, Source_t source, std::size_t chunkSize = 65536, std::size_t depth = 4);
+	/// Stop the reader thread and free the chunks not taken
+	~BatchReader();
+
+	/// Check if the file was opened
+	bool IsGood() const;
+	/// Select the column at data member \e path, returns false if there is none or the reader is started
+	bool Select(const char* path);
+	/// Paths of all columns of events of type \e source
+	static std::vector<std::string> GetColumnNames(Source_t source);
+	/// Number of columns selected
+	int GetNumColumns() const { return fSelected.size(); }
+	/// Path of selected column \e i
+	const char* GetColumnName(int i) const;
+	/// Number of values per event of selected column \e i
+	int GetColumnWidth(int i) const { return fWidths[i]; }
+
+	/// Read the variables and start the reader thread
+	bool Start(const char* odb = 0);
+	/// Next chunk of events, NULL once all have been read; the caller owns it
+	Chunk* Next();
+	/// Number of events returned by Next() so far
+	std::size_t GetNumEvents() const { return fEvents; }
+
+private:
+	BatchReader(const BatchReader&);
+	BatchReader& operator= (const BatchReader&);
+
+	Source_t fSource;
+	std::size_t fChunkSize;
+	Worker* fWorker;          ///< Unpacking state and thread
+	std::vector<int> fSelected; ///< Selected columns, indices in the worker's table
+	std::vector<int> fWidths;   ///< Widths of the selected columns
+	std::size_t fEvents;
+	bool fStarted;
+};
+
+} // namespace dragon
+
+
+#endif
@@ -4,12 +4,16 @@
 /// \brief Implements Dragon.hxx
 ///
 #include <string>
+#include <cstring>
+#include <algorithm>
 #include <sstream>
 #include <iostream>
+#include <strings.h>
 #include "midas/Database.hxx"
 #include "utils/Functions.hxx"
 #include "utils/Valid.hxx"
 #include "utils/ErrorDragon.hxx"
+#include "utils/Profile.hxx"
 #include "utils/definitions.h"
 #include "Defaults.hxx"
 #include "Dragon.hxx"
@@ -21,6 +25,8 @@ namespace dutils = dragon::utils;
 // Helper function for ::variables::set(const char*)
 namespace {
 
+dutils::MessageLimit gEpicsBankLimit("dragon::Epics::unpack: bank length != 2");
+
 //
 // Perform the action of creating a database from it's string name,
 // checking if it's valid, giving error if not, or forwarding on to
@@ -108,6 +114,166 @@ bool odb_set_bank(midas::Bank_t* bank, const midas::Database* db, const char* pa
 	return success;
 }
 
+//
+// Check if a change at ODB path \e path may affect variables read from
+// directory \e dir, i.e. if either contains the other (ODB names are not
+// case sensitive)
+bool touches(const char* path, const char* dir)
+{
+	size_t np = strlen(path);
+	while (np && path[np-1] == '/') --np;
+	if (!np) return true; // root
+	const size_t nd = strlen(dir);
+	if (strncasecmp(path, dir, np < nd ? np : nd)) return false;
+	return np == nd || (np > nd ? path[nd] : dir[np]) == '/';
+}
+
+//
+// Re-read variables from the ODB if they are stored under \e dir, keeping
+// their previous values if any read fails. Returns true if they are.
+template <class V>
+bool reread_if(const char* path, const char* dir, V& variables, const midas::Database* db)
+{
+	if (!touches(path, dir)) return false;
+	V temp(variables);
+	if (temp.set(db)) variables = temp;
+	return true;
+}
+
+//
+// As above, for variables whose set() also takes the directory
+template <class V>
+bool reread_if(const char* path, const char* dir, V& variables, const midas::Database* db, const char* arg)
+{
+	if (!touches(path, dir)) return false;
+	V temp(variables);
+	if (temp.set(db, arg)) variables = temp;
+	return true;
+}
+
+//
+// Set how often repeated V1190 error messages are printed
+void set_message_period(const midas::Database* db, vme::V1190& v1190)
+{
+	dragon::utils::ChangeErrorIgnore dummy(9001);
+	int period = 0;
+	if(db->ReadValue("/dragon/errormessage/v1190/period", period))
+		v1190.fMessagePeriod = period;
+	else
+		v1190.fMessagePeriod = 0;
+}
+
+//
+// Sort hit indices into descending order of value (insertion sort, stable,
+// since there are rarely more than a few hits)
+void sort_hits(int* hits, int nhits, const double* values)
+{
+	for (int i = 1; i< nhits; ++i) {
+		const int hit = hits[i];
+		int j = i;
+		for (; j > 0 && values[hits[j-1]] < values[hit]; --j)
+			hits[j] = hits[j-1];
+		hits[j] = hit;
+	}
+}
+
+//
+// Check if a data member path, e.g. "bgo.esort[0]", is (or is below) member \e name
+bool member_is(const char* path, const char* name)
+{
+	const size_t n = strlen(name);
+	return !strncmp(path, name, n) && (path[n] == '\0' || path[n] == '.' || path[n] == '[');
+}
+
+//
+// The rest of a data member path below member \e name, or NULL if not below it
+const char* member_below(const char* path, const char* name)
+{
+	const size_t n = strlen(name);
+	return (!strncmp(path, name, n) && path[n] == '.') ? path + n + 1 : 0;
+}
+
+//
+// Copy a fixed-size array
+template <class T, int N>
+void copy_array(T (&to)[N], const T (&from)[N])
+{
+	std::copy(from, from + N, to);
+}
+
+//
+// Copy the event data of a detector, but not its variables (see Head::copy_event())
+void copy_data(dragon::Bgo& to, const dragon::Bgo& from)
+{
+	copy_array(to.ecal, from.ecal);
+	copy_array(to.tcal, from.tcal);
+	copy_array(to.esort, from.esort);
+	to.sum = from.sum;
+	to.hit0 = from.hit0;
+	to.x0 = from.x0;
+	to.y0 = from.y0;
+	to.z0 = from.z0;
+	to.t0 = from.t0;
+}
+
+template <int MAX_HITS>
+void copy_data(dragon::TdcChannel<MAX_HITS>& to, const dragon::TdcChannel<MAX_HITS>& from)
+{
+	copy_array(to.leading, from.leading);
+	copy_array(to.trailing, from.trailing);
+}
+
+#ifndef DRAGON_OMIT_DSSSD
+void copy_data(dragon::Dsssd& to, const dragon::Dsssd& from)
+{
+	copy_array(to.ecal, from.ecal);
+	to.efront = from.efront;
+	to.eback = from.eback;
+	to.hit_front = from.hit_front;
+	to.hit_back = from.hit_back;
+	to.tfront = from.tfront;
+	to.tback = from.tback;
+}
+#endif
+
+#ifndef DRAGON_OMIT_IC
+void copy_data(dragon::IonChamber& to, const dragon::IonChamber& from)
+{
+	copy_array(to.anode, from.anode);
+	copy_array(to.tcal, from.tcal);
+	to.sum = from.sum;
+}
+#endif
+
+#ifndef DRAGON_OMIT_NAI
+void copy_data(dragon::NaI& to, const dragon::NaI& from)
+{
+	copy_array(to.ecal, from.ecal);
+}
+#endif
+
+#ifndef DRAGON_OMIT_GE
+void copy_data(dragon::Ge& to, const dragon::Ge& from)
+{
+	to.ecal = from.ecal;
+}
+#endif
+
+void copy_data(dragon::Mcp& to, const dragon::Mcp& from)
+{
+	copy_array(to.anode, from.anode);
+	copy_array(to.tcal, from.tcal);
+	to.esum = from.esum;
+	to.tac = from.tac;
+	to.x = from.x;
+	to.y = from.y;
+}
+
+void copy_data(dragon::SurfaceBarrier& to, const dragon::SurfaceBarrier& from)
+{
+	copy_array(to.ecal, from.ecal);
+}
+
 } // namespace
 
 
@@ -177,7 +343,8 @@ void dragon::Bgo::read_data(const vme::V792& adc, const vme::V1190& tdc)
 	 * \param [in] adc Adc module
 	 * \param [in] tdc Tdc module
 	 */
-	dutils::channel_map(ecal, MAX_CHANNELS, variables.adc.channel, adc);
+	variables.update();
+	variables.adc_plan.gather(ecal, adc);
 	dutils::channel_map(tcal, MAX_CHANNELS, variables.tdc.channel, tdc);
 }
 
@@ -186,30 +353,47 @@ void dragon::Bgo::calculate()
 	/*!
 	 * Does the following:
 	 */
-	/// - Pedestal subtract, zero suppress and calibrate energy values
-	dutils::pedestal_subtract(ecal, MAX_CHANNELS, variables.adc);
-	dutils::zero_suppress1(ecal, MAX_CHANNELS, 10.);
-	dutils::linear_calibrate(ecal, MAX_CHANNELS, variables.adc);
+	/// - Pedestal subtract, zero suppress and calibrate energy values, listing the valid ones
+	int hits[MAX_CHANNELS];
+	const int nhits = variables.adc_plan.calibrate_hits(ecal, hits);
 
 	/// - Calibrate time values
-	dutils::linear_calibrate(tcal, MAX_CHANNELS, variables.tdc);
-
-	/// - Calculate descending-order energy indices and map into \c esort[]
-	int isort[MAX_CHANNELS];
-	dutils::index_sort(ecal, ecal+MAX_CHANNELS, isort, dutils::greater_and_valid<double>());
-	dutils::channel_map_from_array(esort, MAX_CHANNELS, isort, ecal);
-
-	/// - If we have at least one good hit, calculate sum, x0, y0, z0, and t0
-	if(dutils::is_valid(esort[0])) {
-		hit0 = isort[0];
-		sum = dutils::calculate_sum(ecal, ecal + MAX_CHANNELS);
-		x0 = variables.pos.x[ isort[0] ];
-		y0 = variables.pos.y[ isort[0] ];
-		z0 = variables.pos.z[ isort[0] ];
-		t0 = tcal[ isort[0] ];
+	variables.update();
+	variables.tdc_plan.calibrate(tcal);
+
+	/// - Sum the valid energies (in channel order, as calculate_sum() does)
+	double esum = 0.;
+	for (int i = 0; i< nhits; ++i)
+		esum += ecal[ hits[i] ];
+
+	/// - Sort the valid energies only into descending order in \c esort[], followed by invalid values
+	sort_hits(hits, nhits, ecal);
+	for (int i = 0; i< nhits; ++i)
+		esort[i] = ecal[ hits[i] ];
+	dutils::reset_array(MAX_CHANNELS - nhits, esort + nhits);
+
+	/// - If we have at least one good hit, set sum, x0, y0, z0, and t0
+	if(nhits > 0) {
+		hit0 = hits[0];
+		sum = esum;
+		x0 = variables.pos.x[ hits[0] ];
+		y0 = variables.pos.y[ hits[0] ];
+		z0 = variables.pos.z[ hits[0] ];
+		t0 = tcal[ hits[0] ];
 	}
 }
 
+void dragon::Bgo::calibrate()
+{
+	/*!
+	 * Same as the first steps of calculate(); \c esort[], \c sum, \c hit0, \c x0, \c y0,
+	 * \c z0 and \c t0 are not touched.
+	 */
+	variables.update();
+	variables.adc_plan.calibrate(ecal);
+	variables.tdc_plan.calibrate(tcal);
+}
+
 
 // ==================== Class dragon::Bgo::Variables ==================== //
 
@@ -238,6 +422,8 @@ void dragon::Bgo::Variables::reset()
 		pos.y[i] = bgoCoords[i][1];
 		pos.z[i] = bgoCoords[i][2];
 	}
+
+	update();
 }
 
 bool dragon::Bgo::Variables::set(const char* dbfile)
@@ -268,9 +454,22 @@ bool dragon::Bgo::Variables::set(const midas::Database* db)
 	if(success) success = db->ReadArray("/dragon/bgo/variables/position/y",  pos.y, MAX_CHANNELS);
 	if(success) success = db->ReadArray("/dragon/bgo/variables/position/z",  pos.z, MAX_CHANNELS);
 
+	update();
+
 	return success;
 }
 
+void dragon::Bgo::Variables::update()
+{
+	/*!
+	 * Builds the flattened channel map and calibration used by read_data() and calculate(),
+	 * unless they were built from the same values (see dutils::CalibrationPlan::sync()).
+	 * Those call it before each use, so variables written directly take effect on the next event.
+	 */
+	adc_plan.sync(adc, vme::V792::MAX_CHANNELS, true, true, 10.);
+	tdc_plan.sync(tdc);
+}
+
 
 // ================ class dragon::Dsssd ========================= //
 
@@ -294,11 +493,12 @@ void dragon::Dsssd::read_data(const vme::V785 adcs[], const vme::V1190& tdc)
 	 * Copies adc data into \c this->ecal[] with channel and module mapping taken
 	 * from variables.adc.channel and variables.adc.modules
 	 *
-	 * Delegates work to dutils::channel_map()
+	 * Delegates the adc mapping to variables.adc_plan (see dutils::CalibrationPlan)
 	 * \param [in] adcs Array of vme::V785 adc modules from which data can be taken
 	 * \param [in] tdc vme::V1190 tdc module from which data can be read
 	 */
-	dutils::channel_map(ecal, MAX_CHANNELS, variables.adc.channel, variables.adc.module, adcs);
+	variables.update();
+	variables.adc_plan.gather_modules(ecal, adcs);
 	dutils::channel_map(tfront, variables.tdc_front.channel, tdc);
 	dutils::channel_map(tback,  variables.tdc_back.channel,  tdc);
 }
@@ -310,12 +510,10 @@ void dragon::Dsssd::calculate()
 	 * from variables.adc_slope and variables.adc_offset, respectively. Also calibrates the TDC
 	 * signal; calculates efront, hit_front, eback, and hit_back.
 	 *
-	 * Delegates the work to dutils::linear_calibrate
+	 * Delegates the adc calibration to variables.adc_plan (see dutils::CalibrationPlan)
 	 * \note Do we want to add a zero suppression threshold here?
 	 */
-	dutils::linear_calibrate(ecal, MAX_CHANNELS, variables.adc);
-	dutils::linear_calibrate(tfront, variables.tdc_front);
-	dutils::linear_calibrate(tback,  variables.tdc_back);
+	calibrate();
 
 	if(dutils::is_valid_any(ecal, 16)) {
 		const double* const pmax_front = std::max_element(ecal, ecal+16);
@@ -330,6 +528,15 @@ void dragon::Dsssd::calculate()
 	}
 }
 
+void dragon::Dsssd::calibrate()
+{
+	/// ::
+	variables.update();
+	variables.adc_plan.calibrate(ecal);
+	dutils::linear_calibrate(tfront, variables.tdc_front);
+	dutils::linear_calibrate(tback,  variables.tdc_back);
+}
+
 
 // ================ class dragon::Dsssd::Variables ================ //
 
@@ -358,6 +565,8 @@ void dragon::Dsssd::Variables::reset()
 	tdc_back.channel = DSSSD_TDC0 + 1;
 	tdc_back.slope   = 1.;
 	tdc_back.offset  = 0.;
+
+	update();
 }
 
 bool dragon::Dsssd::Variables::set(const char* dbfile)
@@ -388,9 +597,17 @@ bool dragon::Dsssd::Variables::set(const midas::Database* db)
 	if(success) success = db->ReadValue("/dragon/dsssd/variables/tdc_back/slope",   tdc_back.slope);
 	if(success) success = db->ReadValue("/dragon/dsssd/variables/tdc_back/offset",  tdc_back.offset);
 
+	update();
+
 	return success;
 }
 
+void dragon::Dsssd::Variables::update()
+{
+	/// ::
+	adc_plan.sync(adc, vme::V785::MAX_CHANNELS, false);
+}
+
 
 // ================ Class dragon::IonChamber ================ //
 
@@ -414,7 +631,8 @@ void dragon::IonChamber::read_data(const vme::V785 adcs[], const vme::V1190& tdc
 	 * \param modules Heavy-ion module structure
 	 * \param [in] v1190_trigger_ch Channel number of the v1190b trigger
 	 */
-	dutils::channel_map(anode, MAX_CHANNELS, variables.adc.channel, variables.adc.module, adcs);
+	variables.update();
+	variables.adc_plan.gather_modules(anode, adcs);
 	dutils::channel_map(tcal, MAX_TDC, variables.tdc.channel, tdc);
 }
 
@@ -423,14 +641,21 @@ void dragon::IonChamber::calculate()
 	/*!
 	 * Calibrates anode and time signals, calculates anode sum
 	 */
-	dutils::linear_calibrate(anode, MAX_CHANNELS, variables.adc);
-	dutils::linear_calibrate(tcal, MAX_TDC, variables.tdc);
+	calibrate();
 
 	if(dutils::is_valid_any(anode, MAX_CHANNELS)) {
 		sum = dutils::calculate_sum(anode, anode + MAX_CHANNELS);
 	}
 }
 
+void dragon::IonChamber::calibrate()
+{
+	/// ::
+	variables.update();
+	variables.adc_plan.calibrate(anode);
+	variables.tdc_plan.calibrate(tcal);
+}
+
 
 // ================ struct dragon::IonChamber::Variables ================ //
 
@@ -455,6 +680,8 @@ void dragon::IonChamber::Variables::reset()
 	dutils::index_fill(tdc.channel, tdc.channel+MAX_TDC, IC_TDC0);
 	std::fill(tdc.offset, tdc.offset + MAX_TDC, 0.);
 	std::fill(tdc.slope, tdc.slope + MAX_TDC, 1.);
+
+	update();
 }
 
 bool dragon::IonChamber::Variables::set(const char* dbfile)
@@ -481,9 +708,18 @@ bool dragon::IonChamber::Variables::set(const midas::Database* db)
 	if(success) success = db->ReadArray("/dragon/ic/variables/tdc/slope",    tdc.slope,   MAX_TDC);
 	if(success) success = db->ReadArray("/dragon/ic/variables/tdc/offset",   tdc.offset,  MAX_TDC);
 
+	update();
+
 	return success;
 }
 
+void dragon::IonChamber::Variables::update()
+{
+	/// ::
+	adc_plan.sync(adc, vme::V785::MAX_CHANNELS, false);
+	tdc_plan.sync(tdc);
+}
+
 
 // ================ class dragon::Mcp ================ //
 
@@ -506,11 +742,12 @@ void dragon::Mcp::read_data(const vme::V785 adcs[], const vme::V1190& tdc)
 	/*!
 	 * Copies ADC and TDC data into anode, tcal, and tac parameters.
 	 *
-	 * Delegates work to dutils::channel_map()
+	 * Delegates the adc mapping to variables.adc_plan (see dutils::CalibrationPlan)
 	 * \param [in] adcs Array of vme::V785 adc modules from which data can be taken
 	 * \param [in] tdc vme::V1190 tdc module from which data can be read
 	 */
-	dutils::channel_map(anode, MAX_CHANNELS, variables.adc.channel, variables.adc.module, adcs);
+	variables.update();
+	variables.adc_plan.gather_modules(anode, adcs);
 	dutils::channel_map(tcal, NUM_DETECTORS, variables.tdc.channel, tdc);
 	dutils::channel_map(tac, variables.tac_adc.channel, variables.tac_adc.module, adcs);
 }
@@ -526,9 +763,7 @@ void dragon::Mcp::calculate()
 	 * <a href="http://dragon.triumf.ca/docs/Lamey_thesis.pdf">
 	 * dragon.triumf.ca/docs/Lamey_thesis.pdf</a>
 	 */
-	dutils::linear_calibrate(anode, MAX_CHANNELS, variables.adc);
-	dutils::linear_calibrate(tcal, NUM_DETECTORS, variables.tdc);
-	dutils::linear_calibrate(tac, variables.tac_adc);
+	calibrate();
 
 	dutils::calculate_sum(anode, anode + MAX_CHANNELS);
 
@@ -544,6 +779,15 @@ void dragon::Mcp::calculate()
 	}
 }
 
+void dragon::Mcp::calibrate()
+{
+	/// ::
+	variables.update();
+	variables.adc_plan.calibrate(anode);
+	variables.tdc_plan.calibrate(tcal);
+	dutils::linear_calibrate(tac, variables.tac_adc);
+}
+
 
 // ================ class dragon::Mcp::Variables ================ //
 
@@ -575,6 +819,8 @@ void dragon::Mcp::Variables::reset()
 
 	std::fill(tdc.offset, tdc.offset + NUM_DETECTORS, 0.);
 	std::fill(tdc.slope, tdc.slope + NUM_DETECTORS, 1.);
+
+	update();
 }
 
 bool dragon::Mcp::Variables::set(const char* dbfile)
@@ -606,9 +852,18 @@ bool dragon::Mcp::Variables::set(const midas::Database* db)
 	if(success) success = db->ReadArray("/dragon/mcp/variables/tdc/slope",   tdc.slope,   NUM_DETECTORS);
 	if(success) success = db->ReadArray("/dragon/mcp/variables/tdc/offset",  tdc.offset,  NUM_DETECTORS);
 
+	update();
+
 	return success;
 }
 
+void dragon::Mcp::Variables::update()
+{
+	/// ::
+	adc_plan.sync(adc, vme::V785::MAX_CHANNELS, false);
+	tdc_plan.sync(tdc);
+}
+
 
 // ==================== Class dragon::SurfaceBarrier ==================== //
 
@@ -630,10 +885,11 @@ void dragon::SurfaceBarrier::read_data(const vme::V785 adcs[], const vme::V1190&
 	 * Copies adc data into \c this->ecal[] with channel and module mapping taken
 	 * from variables.adc.channel and variables.adc.modules
 	 *
-	 * Delegates work to dutils::channel_map()
+	 * Delegates work to variables.adc_plan (see dutils::CalibrationPlan)
 	 * \param [in] adcs Array of vme::V785 adc modules from which data can be taken
 	 */
-	dutils::channel_map(ecal, MAX_CHANNELS, variables.adc.channel, variables.adc.module, adcs);
+	variables.update();
+	variables.adc_plan.gather_modules(ecal, adcs);
 }
 
 void dragon::SurfaceBarrier::calculate()
@@ -641,9 +897,10 @@ void dragon::SurfaceBarrier::calculate()
 	/*!
 	 * Performs calibration of energies.
 	 *
-	 * Delegates work to dutils::linear_calibrate()
+	 * Delegates work to variables.adc_plan (see dutils::CalibrationPlan)
 	 */
-	dutils::linear_calibrate(ecal, MAX_CHANNELS, variables.adc);
+	variables.update();
+	variables.adc_plan.calibrate(ecal);
 }
 
 
@@ -664,6 +921,8 @@ void dragon::SurfaceBarrier::Variables::reset()
 	std::fill(adc.pedestal, adc.pedestal + MAX_CHANNELS, 0);
 	std::fill(adc.offset, adc.offset + MAX_CHANNELS, 0.);
 	std::fill(adc.slope, adc.slope + MAX_CHANNELS, 1.);
+
+	update();
 }
 
 bool dragon::SurfaceBarrier::Variables::set(const char* dbfile)
@@ -686,9 +945,17 @@ bool dragon::SurfaceBarrier::Variables::set(const midas::Database* db)
 	if(success) success = db->ReadArray("/dragon/sb/variables/adc/slope",    adc.slope,    MAX_CHANNELS);
 	if(success) success = db->ReadArray("/dragon/sb/variables/adc/offset",   adc.offset,   MAX_CHANNELS);
 
+	update();
+
 	return success;
 }
 
+void dragon::SurfaceBarrier::Variables::update()
+{
+	/// ::
+	adc_plan.sync(adc, vme::V785::MAX_CHANNELS, false);
+}
+
 
 // ========================== Class dragon::NaI ========================== //
 
@@ -710,16 +977,18 @@ void dragon::NaI::read_data(const vme::V785 adcs[], const vme::V1190&)
 	 * Copies adc data into \c this->ecal[] with channel and module mapping taken
 	 * from variables.adc.channel and variables.adc.modules
 	 *
-	 * Delegates work to dutils::channel_map()
+	 * Delegates work to variables.adc_plan (see dutils::CalibrationPlan)
 	 * \param [in] adcs Array of vme::V785 adc modules from which data can be taken
 	 */
-	dutils::channel_map(ecal, MAX_CHANNELS, variables.adc.channel, variables.adc.module, adcs);
+	variables.update();
+	variables.adc_plan.gather_modules(ecal, adcs);
 }
 
 void dragon::NaI::calculate()
 {
 	/// Linear calibration of energies
-	dutils::linear_calibrate(ecal, MAX_CHANNELS, variables.adc);
+	variables.update();
+	variables.adc_plan.calibrate(ecal);
 }
 
 
@@ -739,6 +1008,8 @@ void dragon::NaI::Variables::reset()
 	std::fill(adc.pedestal, adc.pedestal + MAX_CHANNELS, 0);
 	std::fill(adc.offset, adc.offset + MAX_CHANNELS, 0.);
 	std::fill(adc.slope, adc.slope + MAX_CHANNELS, 1.);
+
+	update();
 }
 
 bool dragon::NaI::Variables::set(const char* dbfile)
@@ -761,9 +1032,17 @@ bool dragon::NaI::Variables::set(const midas::Database* db)
 	if(success) success = db->ReadArray("/dragon/nai/variables/adc/slope",    adc.slope,    MAX_CHANNELS);
 	if(success) success = db->ReadArray("/dragon/nai/variables/adc/offset",   adc.offset,   MAX_CHANNELS);
 
+	update();
+
 	return success;
 }
 
+void dragon::NaI::Variables::update()
+{
+	/// ::
+	adc_plan.sync(adc, vme::V785::MAX_CHANNELS, false);
+}
+
 
 // ====== class dragon::Ge ====== //
 
@@ -880,7 +1159,8 @@ void dragon::HiTof::calculate(const dragon::Tail* tail)
 
 // ==================== Class dragon::Head ==================== //
 
-dragon::Head::Head()
+dragon::Head::Head():
+	fDerived(ALL_DERIVED)
 {
 	/*!
 	 * Set bank names, resets data to default values
@@ -903,6 +1183,27 @@ void dragon::Head::reset()
 	dutils::reset_data(tcalx, tcal0, tcal_rf);
 }
 
+void dragon::Head::copy_event(const Head& other)
+{
+	/*!
+	 * Copies the MIDAS header, VME modules and calculated data of \e other, but
+	 * not its variables (with their calibration plans) or derived parameter setting,
+	 * which together are larger than the event data.
+	 *
+	 * \note The result is what calculate() gives for this instance only if
+	 * can_copy_event() is true and both instances have the same variable values.
+	 */
+	header = other.header;
+	io32 = other.io32;
+	v792 = other.v792;
+	v1190 = other.v1190;
+	copy_data(bgo, other.bgo);
+	copy_data(trf, other.trf);
+	tcal0 = other.tcal0;
+	tcalx = other.tcalx;
+	tcal_rf = other.tcal_rf;
+}
+
 bool dragon::Head::set_variables(const char* dbfile)
 {
 	/*!
@@ -923,18 +1224,34 @@ bool dragon::Head::set_variables(const midas::Database* db)
 	if(success) success = trf.variables.set(db, "/dragon/head/variables/rf_tdc");
 	if(success) success = this->variables.set(db);
 
-	if(success) {
-		dragon::utils::ChangeErrorIgnore dummy(9001);
-		int period = 0;
-		if(db->ReadValue("/dragon/errormessage/v1190/period", period))
-			v1190.fMessagePeriod = period;
-		else
-			v1190.fMessagePeriod = 0;
-	}
+	if(success) set_message_period(db, v1190);
 
 	return success;
 }
 
+bool dragon::Head::update_variables(const midas::Database* db, const char* path)
+{
+	/*!
+	 * \param [in] db Pointer to the database from which to read the variables.
+	 * \param [in] path ODB path of a changed key or directory.
+	 * \returns true if any variables are stored at or below \e path
+	 *
+	 * Each Variables structure stored there is read again as a whole, and its
+	 * calibration plans rebuilt; if a read fails, it keeps its previous values.
+	 * All other variables are left alone.
+	 */
+	if(!check_db(db, "dragon::Head::update_variables")) return false;
+	bool found = false;
+	found |= reread_if(path, "/dragon/bgo/variables", bgo.variables, db);
+	found |= reread_if(path, "/dragon/head/variables/rf_tdc", trf.variables, db, "/dragon/head/variables/rf_tdc");
+	found |= reread_if(path, "/dragon/head/variables", variables, db);
+	if(touches(path, "/dragon/errormessage/v1190")) {
+		set_message_period(db, v1190);
+		found = true;
+	}
+	return found;
+}
+
 void dragon::Head::unpack(const midas::Event& event)
 {
 	/*!
@@ -950,6 +1267,7 @@ void dragon::Head::unpack(const midas::Event& event)
 	 * \note Recompile with <c> report = true </c> to print warning messages
 	 *  for missing banks
 	 */
+	dutils::ProfileScope profile(dutils::Profile::kHeadUnpack);
 	const bool report = true;
 	io32.unpack (event, variables.bk_io32, report);
 	v792.unpack (event, variables.bk_adc , report);
@@ -968,24 +1286,51 @@ void dragon::Head::calculate()
 	 *
 	 * In the specific implementation, the following are done:
 	 */
-	/// - Read BGO data and calculate (see dragon::Head::Bgo).
+	dutils::ProfileScope profile(dutils::Profile::kHeadCalculate);
+	/// - Read BGO data and calculate (see dragon::Head::Bgo), or only calibrate it if
+	///   the sorted parameters are not needed.
 	bgo.read_data(v792, v1190);
-	bgo.calculate();
+	if (fDerived & kBgoSort) bgo.calculate();
+	else bgo.calibrate();
 
-	trf.read_data(v1190);
-	trf.calculate();
+	/// - Then, for the derived parameters selected by set_derived():
+	if (fDerived & kRf) {
+		trf.read_data(v1190);
+		trf.calculate();
+	}
 
-	/// - Read and calibrate "crossover" TDC channel.
-	dutils::channel_map(tcalx, variables.xtdc.channel, v1190);
-	dutils::linear_calibrate(tcalx, variables.xtdc);
+	if (fDerived & kTdc) {
+		/// - Read and calibrate "crossover" TDC channel.
+		dutils::channel_map(tcalx, variables.xtdc.channel, v1190);
+		dutils::linear_calibrate(tcalx, variables.xtdc);
 
-	/// - Read and calibrate RF TDC channel.
-	dutils::channel_map(tcal_rf, variables.rf_tdc.channel, v1190);
-	dutils::linear_calibrate(tcal_rf, variables.rf_tdc);
+		/// - Read and calibrate RF TDC channel.
+		dutils::channel_map(tcal_rf, variables.rf_tdc.channel, v1190);
+		dutils::linear_calibrate(tcal_rf, variables.rf_tdc);
 
-	/// - Read and calibrate t0 (trigger) channel
-	dutils::channel_map(tcal0, variables.tdc0.channel, v1190);
-	dutils::linear_calibrate(tcal0, variables.tdc0);
+		/// - Read and calibrate t0 (trigger) channel
+		dutils::channel_map(tcal0, variables.tdc0.channel, v1190);
+		dutils::linear_calibrate(tcal0, variables.tdc0);
+	}
+}
+
+int dragon::Head::derived_of(const char* path)
+{
+	/*!
+	 * \param path Path of a data member below dragon::Head, e.g. \c "bgo.esort[0]"
+	 * \returns Derived_t bits of the calculation steps setting it, zero for raw and
+	 *  calibrated values (always calculated)
+	 */
+	if (const char* bgo = member_below(path, "bgo")) {
+		const char* const sorted[] = { "esort", "sum", "hit0", "x0", "y0", "z0", "t0" };
+		for (size_t i = 0; i< sizeof(sorted) / sizeof(sorted[0]); ++i)
+			if (member_is(bgo, sorted[i])) return kBgoSort;
+		return 0;
+	}
+	if (member_is(path, "bgo")) return kBgoSort;
+	if (member_is(path, "trf")) return kRf;
+	if (member_is(path, "tcal0") || member_is(path, "tcalx") || member_is(path, "tcal_rf")) return kTdc;
+	return 0;
 }
 
 
@@ -1056,37 +1401,65 @@ bool dragon::Head::Variables::set(const midas::Database* db)
 
 // ================ Class dragon::Tail ================ //
 
-dragon::Tail::Tail()
+dragon::Tail::Tail():
+	fDetectors(0), fNumSteps(0), fDerived(ALL_DERIVED)
 {
 	/// ::
+	build_pipeline();
 	reset();
 }
 
 void dragon::Tail::reset()
 {
-	/// ::
+	/*!
+	 * Optional detectors which are not installed were reset when they were taken out
+	 * of the pipeline, and are not touched here.
+	 */
 	io32.reset();
 	v1190.reset();
 	for (int i=0; i< NUM_ADC; ++i) {
 		v785[i].reset();
 	}
 	trf.reset();
+	for (int i=0; i< fNumSteps; ++i) {
+		reset_detector(fSteps[i]);
+	}
+	mcp.reset();
+	sb.reset();
+	tof.reset();
+	dutils::reset_data(tcalx, tcal0, tcal_rf);
+}
+
+void dragon::Tail::copy_event(const Tail& other)
+{
+	/*!
+	 * As Head::copy_event(): copies the MIDAS header, VME modules and calculated
+	 * data of \e other, but not its variables, installed detectors or derived
+	 * parameter setting. Optional detectors which are not installed are not touched.
+	 */
+	header = other.header;
+	io32 = other.io32;
+	copy_array(v785, other.v785);
+	v1190 = other.v1190;
 #ifndef DRAGON_OMIT_DSSSD
-	dsssd.reset();
+	if (has_detector(kDsssd)) copy_data(dsssd, other.dsssd);
 #endif
 #ifndef DRAGON_OMIT_IC
-	ic.reset();
+	if (has_detector(kIonChamber)) copy_data(ic, other.ic);
 #endif
 #ifndef DRAGON_OMIT_NAI
-	nai.reset();
+	if (has_detector(kNaI)) copy_data(nai, other.nai);
 #endif
 #ifndef DRAGON_OMIT_GE
-	ge.reset();
+	if (has_detector(kGe)) copy_data(ge, other.ge);
 #endif
-	mcp.reset();
-	sb.reset();
-	tof.reset();
-	dutils::reset_data(tcalx, tcal0, tcal_rf);
+	copy_data(mcp, other.mcp);
+	copy_data(sb, other.sb);
+	tof = other.tof;
+	copy_data(trf, other.trf);
+	tcal_rf = other.tcal_rf;
+	tcal0 = other.tcal0;
+	tcalx = other.tcalx;
 }
 
 void dragon::Tail::unpack(const midas::Event& event)
@@ -1104,6 +1477,7 @@ void dragon::Tail::unpack(const midas::Event& event)
 	 * \note Recompile with <c> report = true </c> to print warning messages
 	 *  for missing banks
 	 */
+	dutils::ProfileScope profile(dutils::Profile::kTailUnpack);
 	const bool report = false;
 	io32.unpack (event, variables.bk_io32, report);
 	for (int i=0; i< NUM_ADC; ++i) {
@@ -1116,54 +1490,67 @@ void dragon::Tail::unpack(const midas::Event& event)
 
 void dragon::Tail::calculate()
 {
-	/// - Read data from VME modules into data structures
-#ifndef DRAGON_OMIT_DSSSD
-	dsssd.read_data(v785, v1190);
-#endif
-#ifndef DRAGON_OMIT_IC
-	ic.read_data(v785, v1190);
-#endif
+	dutils::ProfileScope profile(dutils::Profile::kTailCalculate);
+	/// - Read data from VME modules and calculate each installed optional detector
+	for (int i=0; i< fNumSteps; ++i) {
+		calculate_detector(fSteps[i]);
+	}
+
+	/// - Read data from VME modules into the other detectors
 	mcp.read_data(v785, v1190);
 	sb.read_data(v785, v1190);
-#ifndef DRAGON_OMIT_NAI
-	nai.read_data(v785, v1190);
-#endif
-#ifndef DRAGON_OMIT_GE
-	ge.read_data(v785, v1190);
-#endif
-	trf.read_data(v1190);
 
-	/// - Perform calibrations, higher-order calculations, etc, detector-by-detector
-#ifndef DRAGON_OMIT_DSSSD
-	dsssd.calculate();
-#endif
-#ifndef DRAGON_OMIT_IC
-	ic.calculate();
-#endif
-	mcp.calculate();
+	/// - Perform calibrations, higher-order calculations, etc, detector-by-detector;
+	///   derived parameters are calculated only if selected by set_derived()
+	if (fDerived & kMcpPosition) mcp.calculate();
+	else mcp.calibrate();
 	sb.calculate();
-#ifndef DRAGON_OMIT_NAI
-	nai.calculate();
-#endif
-#ifndef DRAGON_OMIT_GE
-	ge.calculate();
-#endif
-	trf.calculate();
+	if (fDerived & kRf) {
+		trf.read_data(v1190);
+		trf.calculate();
+	}
 
 	/// - Calculate TOF between HI detectors
-	tof.calculate(this);
+	if (fDerived & kTof) tof.calculate(this);
 
-	/// - Map and calibrate "crossover" TDC
-	dutils::channel_map(tcalx, variables.xtdc.channel, v1190);
-	dutils::linear_calibrate(tcalx, variables.xtdc);
+	if (fDerived & kTdc) {
+		/// - Map and calibrate "crossover" TDC
+		dutils::channel_map(tcalx, variables.xtdc.channel, v1190);
+		dutils::linear_calibrate(tcalx, variables.xtdc);
 
-	/// - Map and calibrate RF TDC
-	dutils::channel_map(tcal_rf, variables.rf_tdc.channel, v1190);
-	dutils::linear_calibrate(tcal_rf, variables.rf_tdc);
+		/// - Map and calibrate RF TDC
+		dutils::channel_map(tcal_rf, variables.rf_tdc.channel, v1190);
+		dutils::linear_calibrate(tcal_rf, variables.rf_tdc);
 
-	/// - Map and calibrate "trigger" TDC
-	dutils::channel_map(tcal0, variables.tdc0.channel, v1190);
-	dutils::linear_calibrate(tcal0, variables.tdc0);
+		/// - Map and calibrate "trigger" TDC
+		dutils::channel_map(tcal0, variables.tdc0.channel, v1190);
+		dutils::linear_calibrate(tcal0, variables.tdc0);
+	}
+}
+
+int dragon::Tail::derived_of(const char* path)
+{
+	/*!
+	 * \param path Path of a data member below dragon::Tail, e.g. \c "mcp.x"
+	 * \returns Derived_t bits of the calculation steps setting it, zero for raw and
+	 *  calibrated values (always calculated)
+	 */
+	if (const char* dsssd = member_below(path, "dsssd")) {
+		const char* const maxima[] = { "efront", "eback", "hit_front", "hit_back" };
+		for (size_t i = 0; i< sizeof(maxima) / sizeof(maxima[0]); ++i)
+			if (member_is(dsssd, maxima[i])) return kDsssdMax;
+		return 0;
+	}
+	if (const char* ic = member_below(path, "ic")) return member_is(ic, "sum") ? kIcSum : 0;
+	if (const char* mcp = member_below(path, "mcp"))
+		return (member_is(mcp, "x") || member_is(mcp, "y")) ? kMcpPosition : 0;
+	if (member_is(path, "dsssd")) return kDsssdMax;
+	if (member_is(path, "ic"))    return kIcSum;
+	if (member_is(path, "mcp"))   return kMcpPosition;
+	if (member_is(path, "tof"))   return kTof;
+	if (member_is(path, "trf"))   return kRf;
+	if (member_is(path, "tcal0") || member_is(path, "tcalx") || member_is(path, "tcal_rf")) return kTdc;
+	return 0;
 }
 
 bool dragon::Tail::set_variables(const char* dbfile)
@@ -1182,40 +1569,147 @@ bool dragon::Tail::set_variables(const midas::Database* db)
 	 */
 	bool success = check_db(db, "dragon::Tail::set_variables");
 
+	/// Tail variables are read first, to know which optional detectors are installed;
+	/// variables of the others are not read.
+	if(success) success = this->variables.set(db);
+	if(success) build_pipeline();
+
 #ifndef DRAGON_OMIT_DSSSD
-	if(success) success = dsssd.variables.set(db);
+	if(success && has_detector(kDsssd)) success = dsssd.variables.set(db);
 #endif
 
 #ifndef DRAGON_OMIT_IC
-	if(success) success = ic.variables.set(db);
+	if(success && has_detector(kIonChamber)) success = ic.variables.set(db);
 #endif
 
 	if(success) success = mcp.variables.set(db);
 	if(success) success = sb.variables.set(db);
 
 #ifndef DRAGON_OMIT_NAI
-	if(success) success = nai.variables.set(db);
+	if(success && has_detector(kNaI)) success = nai.variables.set(db);
 #endif
 
 #ifndef DRAGON_OMIT_GE
-	if(success) success = ge.variables.set(db);
+	if(success && has_detector(kGe)) success = ge.variables.set(db);
 #endif
 
 	if(success) success = trf.variables.set(db, "/dragon/tail/variables/rf_tdc");
-	if(success) success = this->variables.set(db);
 
-	if(success) {
-		dragon::utils::ChangeErrorIgnore dummy(9001);
-		int period = 0;
-		if(db->ReadValue("/dragon/errormessage/v1190/period", period))
-			v1190.fMessagePeriod = period;
-		else
-			v1190.fMessagePeriod = 0;
-	}
+	if(success) set_message_period(db, v1190);
 
 	return success;
 }
 
+bool dragon::Tail::update_variables(const midas::Database* db, const char* path)
+{
+	/*!
+	 * \param [in] db Pointer to the database from which to read the variables.
+	 * \param [in] path ODB path of a changed key or directory.
+	 * \returns true if any variables are stored at or below \e path
+	 *
+	 * As dragon::Head::update_variables(), for the tail detectors. If the set of installed
+	 * detectors changes, all variables are read again, as by set_variables().
+	 */
+	if(!check_db(db, "dragon::Tail::update_variables")) return false;
+	bool found = false;
+#ifndef DRAGON_OMIT_DSSSD
+	if(has_detector(kDsssd))
+		found |= reread_if(path, "/dragon/dsssd/variables", dsssd.variables, db);
+#endif
+#ifndef DRAGON_OMIT_IC
+	if(has_detector(kIonChamber))
+		found |= reread_if(path, "/dragon/ic/variables", ic.variables, db);
+#endif
+	found |= reread_if(path, "/dragon/mcp/variables", mcp.variables, db);
+	found |= reread_if(path, "/dragon/sb/variables", sb.variables, db);
+#ifndef DRAGON_OMIT_NAI
+	if(has_detector(kNaI))
+		found |= reread_if(path, "/dragon/nai/variables", nai.variables, db);
+#endif
+#ifndef DRAGON_OMIT_GE
+	if(has_detector(kGe))
+		found |= reread_if(path, "/dragon/ge/variables", ge.variables, db);
+#endif
+	found |= reread_if(path, "/dragon/tail/variables/rf_tdc", trf.variables, db, "/dragon/tail/variables/rf_tdc");
+	found |= reread_if(path, "/dragon/tail/variables", variables, db);
+	if((variables.detectors & ALL_DETECTORS) != fDetectors)
+		set_variables(db);
+	if(touches(path, "/dragon/errormessage/v1190")) {
+		set_message_period(db, v1190);
+		found = true;
+	}
+	return found;
+}
+
+void dragon::Tail::build_pipeline()
+{
+	/*!
+	 * Detectors left out are reset here, once, and keep their "no data" values
+	 * afterwards, since they are skipped by reset() and calculate().
+	 */
+	const int optional[MAX_DETECTORS] = { kDsssd, kIonChamber, kNaI, kGe };
+	fDetectors = variables.detectors & ALL_DETECTORS;
+	fNumSteps = 0;
+	for (int i=0; i< MAX_DETECTORS; ++i) {
+		if (fDetectors & optional[i]) fSteps[fNumSteps++] = optional[i];
+		else reset_detector(optional[i]);
+	}
+}
+
+void dragon::Tail::reset_detector(int detector)
+{
+	/// ::
+	switch (detector) {
+#ifndef DRAGON_OMIT_DSSSD
+	case kDsssd:      dsssd.reset(); break;
+#endif
+#ifndef DRAGON_OMIT_IC
+	case kIonChamber: ic.reset();    break;
+#endif
+#ifndef DRAGON_OMIT_NAI
+	case kNaI:        nai.reset();   break;
+#endif
+#ifndef DRAGON_OMIT_GE
+	case kGe:         ge.reset();    break;
+#endif
+	default: break;
+	}
+}
+
+void dragon::Tail::calculate_detector(int detector)
+{
+	/// ::
+	switch (detector) {
+#ifndef DRAGON_OMIT_DSSSD
+	case kDsssd:
+		dsssd.read_data(v785, v1190);
+		if (fDerived & kDsssdMax) dsssd.calculate();
+		else dsssd.calibrate();
+		break;
+#endif
+#ifndef DRAGON_OMIT_IC
+	case kIonChamber:
+		ic.read_data(v785, v1190);
+		if (fDerived & kIcSum) ic.calculate();
+		else ic.calibrate();
+		break;
+#endif
+#ifndef DRAGON_OMIT_NAI
+	case kNaI:
+		nai.read_data(v785, v1190);
+		nai.calculate();
+		break;
+#endif
+#ifndef DRAGON_OMIT_GE
+	case kGe:
+		ge.read_data(v785, v1190);
+		ge.calculate();
+		break;
+#endif
+	default: break;
+	}
+}
+
 // ================ Class dragon::Tail::Variables ================ //
 
 dragon::Tail::Variables::Variables()
@@ -1244,6 +1738,8 @@ void dragon::Tail::Variables::reset()
 	tdc0.channel = TAIL_RF_TDC + 1;
 	tdc0.slope  = 1.;
 	tdc0.offset = 0.;
+
+	detectors = ALL_DETECTORS;
 }
 
 bool dragon::Tail::Variables::set(const char* dbfile)
@@ -1278,6 +1774,23 @@ bool dragon::Tail::Variables::set(const midas::Database* db)
 	if(success) success = db->ReadValue("/dragon/tail/variables/tdc0/slope",   tdc0.slope);
 	if(success) success = db->ReadValue("/dragon/tail/variables/tdc0/offset",  tdc0.offset);
 
+	/// Optional detectors are installed unless turned off by
+	/// <tt>/dragon/tail/variables/detectors/{dsssd,ic,nai,ge}</tt> (which may be missing).
+	if(success) {
+		const char* const paths[] = {
+			"/dragon/tail/variables/detectors/dsssd",
+			"/dragon/tail/variables/detectors/ic",
+			"/dragon/tail/variables/detectors/nai",
+			"/dragon/tail/variables/detectors/ge" };
+		const int bits[] = { kDsssd, kIonChamber, kNaI, kGe };
+		dragon::utils::ChangeErrorIgnore dummy(9001);
+		detectors = ALL_DETECTORS;
+		for (int i=0; i< 4; ++i) {
+			bool installed = true;
+			if (db->ReadValue(paths[i], installed) && !installed) detectors &= ~bits[i];
+		}
+	}
+
 	return success;
 }
 
@@ -1315,6 +1828,18 @@ bool dragon::Scaler::set_variables(const midas::Database* db, const char* dir)
 	return variables.set(db, dir);
 }
 
+bool dragon::Scaler::update_variables(const midas::Database* db, const char* path, const char* dir)
+{
+	/*!
+	 * \param [in] db Pointer to the database from which to read the variables.
+	 * \param [in] path ODB path of a changed key or directory.
+	 * \param [in] dir Scaler subdirectory, as for set_variables()
+	 * \returns true if the variables are stored at or below \e path
+	 */
+	const std::string odbDir = variables.odb_path + dir;
+	return reread_if(path, odbDir.c_str(), variables, db, dir);
+}
+
 namespace {
 inline bool check_bank_len(int expected, int gotten, const char* bkname)
 {
@@ -1477,11 +2002,30 @@ bool dragon::Coinc::set_variables(const midas::Database* db)
 	return success;
 }
 
+bool dragon::Coinc::update_variables(const midas::Database* db, const char* path)
+{
+	/*!
+	 * \param [in] db Pointer to the database from which to read the variables.
+	 * \param [in] path ODB path of a changed key or directory.
+	 * \returns true if any variables (including those of \c head and \c tail)
+	 *  are stored at or below \e path
+	 */
+	if(!check_db(db, "dragon::Coinc::update_variables")) return false;
+	bool found = head.update_variables(db, path);
+	found |= tail.update_variables(db, path);
+	found |= reread_if(path, "/dragon/coinc/variables", variables, db);
+	return found;
+}
+
 void dragon::Coinc::compose_event(const dragon::Head& head_, const dragon::Tail& tail_)
 {
 	/*!
 	 * \param [in] head_ Head (gamma-ray) event
 	 * \param [in] tail_ Tail (heavy-ion) event
+	 *
+	 * The copies re-use the storage held by \c head and \c tail from earlier
+	 * events (the TDC hit and FIFO vectors keep their capacity), so composing
+	 * does not allocate memory once the largest events have been seen.
 	 */
 	head = head_;
 	tail = tail_;
@@ -1504,11 +2048,35 @@ void dragon::Coinc::calculate()
 	 */
 	head.calculate();
 	tail.calculate();
+	calculate_coinc();
+}
+
+void dragon::Coinc::calculate_coinc()
+{
+	/*!
+	 * For \c head and \c tail filled from events already calculated as singles,
+	 * e.g. with compose_event().
+	 */
 	xtrig = dutils::calculate_tof(tail.io32.tsc4.trig_time, head.io32.tsc4.trig_time);
 	xtoft = dutils::calculate_tof(tail.tcal0, tail.tcalx);
 	xtofh = dutils::calculate_tof(head.tcalx, head.tcal0);
 }
 
+void dragon::Coinc::derived_of(const char* path, int& head_derived, int& tail_derived)
+{
+	/*!
+	 * \param path Path of a data member below dragon::Coinc, e.g. \c "head.bgo.sum"
+	 * \param [in,out] head_derived Head::Derived_t bits needed for \e path are added to this
+	 * \param [in,out] tail_derived Tail::Derived_t bits needed for \e path are added to this
+	 */
+	if (const char* h = member_below(path, "head")) head_derived |= Head::derived_of(h);
+	else if (const char* t = member_below(path, "tail")) tail_derived |= Tail::derived_of(t);
+	else if (member_is(path, "head")) head_derived |= Head::ALL_DERIVED;
+	else if (member_is(path, "tail")) tail_derived |= Tail::ALL_DERIVED;
+	else if (member_is(path, "xtofh")) head_derived |= Head::kTdc;
+	else if (member_is(path, "xtoft")) tail_derived |= Tail::kTdc;
+}
+
 
 // ==================== Class dragon::Coinc::Variables ==================== //
 
@@ -1577,6 +2145,19 @@ bool dragon::Epics::set_variables(const midas::Database* db)
 	return variables.set(db);
 }
 
+bool dragon::Epics::update_variables(const midas::Database* db, const char* path)
+{
+	/*!
+	 * \param [in] db Pointer to the database from which to read the variables.
+	 * \param [in] path ODB path of a changed key or directory.
+	 * \returns true if any of the variables are stored at or below \e path
+	 */
+	if(!touches(path, "/Equipment/Epics/Settings") && !touches(path, "/dragon/epics")) return false;
+	Variables temp(variables);
+	if(temp.set(db)) variables = temp;
+	return true;
+}
+
 void dragon::Epics::unpack(const midas::Event& event)
 {
 	/// ::
@@ -1588,9 +2169,9 @@ void dragon::Epics::unpack(const midas::Event& event)
 	if(bank_len == 2) {
 		ch  = static_cast<int32_t>(*pch++);
 		val = *pch++;
-	} else {
+	} else if (gEpicsBankLimit.Check()) {
 		dutils::Error("Epics::unpack", __FILE__, __LINE__)
-			<< "Bank len != 2, skipping!";
+			<< "Bank len != 2, skipping!" << gEpicsBankLimit.Note();
 	}
 
 	/// - Copy event header
@@ -83,6 +83,8 @@ namespace dragon {
 		void read_data(const vme::V792& adc, const vme::V1190& tdc);
 		/// Do higher-level parameter calculations
 		void calculate();
+		/// Calibrate energy and time values only (no sorting or sum)
+		void calibrate();
 
 	public: // Data
 		/// Calibrated energies
@@ -118,6 +120,8 @@ namespace dragon {
 			bool set(const char* dbfile);
 			///  Set data values from a constructed database
 			bool set(const midas::Database* db);
+			/// Rebuild calibration plans if the variable values changed (done before each use)
+			void update();
 
 		public: // Data
 			/// Adc variables
@@ -126,6 +130,10 @@ namespace dragon {
 			dragon::utils::TdcVariables<MAX_CHANNELS> tdc;
 			/// Detector positions in space
 			dragon::utils::PositionVariables<MAX_CHANNELS> pos;
+			/// Adc mapping and calibration (built from \c adc by update())
+			dragon::utils::CalibrationPlan<MAX_CHANNELS> adc_plan; //!
+			/// Tdc calibration (built from \c tdc by update())
+			dragon::utils::CalibrationPlan<MAX_CHANNELS> tdc_plan; //!
 		};
 
 	public: // Subclass instances
@@ -150,6 +158,8 @@ namespace dragon {
 		void read_data(const vme::V785 adcs[], const vme::V1190& tdc);
 		/// Performs energy and time calibrations
 		void calculate();
+		/// Performs energy and time calibrations only (no front and back maxima)
+		void calibrate();
 
 	public:
 		/// Calibrated energy signals
@@ -181,6 +191,8 @@ namespace dragon {
 			bool set(const midas::Database* db);
 			/// Reset all variable values to defaults
 			void reset();
+			/// Rebuild calibration plans if the variable values changed (done before each use)
+			void update();
 
 		public: // Data
 			/// Adc variables for the energy signals
@@ -189,6 +201,8 @@ namespace dragon {
 			dragon::utils::TdcVariables<1> tdc_front;
 			/// Tdc variables (back strips)
 			dragon::utils::TdcVariables<1> tdc_back;
+			/// Adc mapping and calibration (built from \c adc by update())
+			dragon::utils::CalibrationPlan<32> adc_plan; //!
 		};
 
 	public: // Subclass instances
@@ -215,6 +229,8 @@ namespace dragon {
 		void read_data(const vme::V785 adcs[], const vme::V1190& tdc);
 		/// Calculate higher-level parameters
 		void calculate();
+		/// Calibrate anode and time signals only (no sum)
+		void calibrate();
 
 	public: // Data
 		/// Calibrated anode signals
@@ -238,12 +254,18 @@ namespace dragon {
 			bool set(const char* dbfile);
 			///  Set data values from a constructed database
 			bool set(const midas::Database* db);
+			/// Rebuild calibration plans if the variable values changed (done before each use)
+			void update();
 
 		public: // Data
 			/// Anode variables
 			dragon::utils::AdcVariables<MAX_CHANNELS> adc;
 			/// Tdc variables
 			dragon::utils::TdcVariables<MAX_TDC> tdc;
+			/// Anode mapping and calibration (built from \c adc by update())
+			dragon::utils::CalibrationPlan<MAX_CHANNELS> adc_plan; //!
+			/// Tdc calibration (built from \c tdc by update())
+			dragon::utils::CalibrationPlan<MAX_TDC> tdc_plan; //!
 		};
 
 	public: // Subclass instances
@@ -270,6 +292,8 @@ namespace dragon {
 		void read_data(const vme::V785 adcs[], const vme::V1190& tdc);
 		/// Calibrate ADC/TDC signals, calculate x and y positions
 		void calculate();
+		/// Calibrate ADC/TDC signals only (no positions)
+		void calibrate();
 
 	public: // Data
 		/// Anode signals
@@ -299,6 +323,8 @@ namespace dragon {
 			bool set(const char* dbfile);
 			///  Set data values from a constructed database
 			bool set(const midas::Database* db);
+			/// Rebuild calibration plans if the variable values changed (done before each use)
+			void update();
 
 		public: // Data
 			/// Adc variables for the anode signals
@@ -307,6 +333,10 @@ namespace dragon {
 			dragon::utils::AdcVariables<1> tac_adc;
 			/// Tdc variables
 			dragon::utils::TdcVariables<NUM_DETECTORS> tdc;
+			/// Anode mapping and calibration (built from \c adc by update())
+			dragon::utils::CalibrationPlan<MAX_CHANNELS> adc_plan; //!
+			/// Tdc calibration (built from \c tdc by update())
+			dragon::utils::CalibrationPlan<NUM_DETECTORS> tdc_plan; //!
 		};
 
 	public: // Subclass instances
@@ -336,10 +366,14 @@ namespace dragon {
 			bool set(const char* dbfile);
 			///  Set data values from a constructed database
 			bool set(const midas::Database* db);
+			/// Rebuild calibration plans if the variable values changed (done before each use)
+			void update();
 
 		public: // Data
 			/// Adc variables
 			dragon::utils::AdcVariables<MAX_CHANNELS> adc;
+			/// Adc mapping and calibration (built from \c adc by update())
+			dragon::utils::CalibrationPlan<MAX_CHANNELS> adc_plan; //!
 		};
 
 	public: // Methods
@@ -395,10 +429,14 @@ namespace dragon {
 			bool set(const char* dbfile);
 			///  Set data values from a constructed database
 			bool set(const midas::Database* db);
+			/// Rebuild calibration plans if the variable values changed (done before each use)
+			void update();
 
 		public: // Data
 			/// Adc variables
 			dragon::utils::AdcVariables<MAX_CHANNELS> adc;
+			/// Adc mapping and calibration (built from \c adc by update())
+			dragon::utils::CalibrationPlan<MAX_CHANNELS> adc_plan; //!
 		};
 
 	public: // Subclass instances
@@ -528,20 +566,39 @@ namespace dragon {
 	public: // Constants
 		/// Max number of RF hits to store
 		static const int MAX_RF_HITS = 5;
+		/// Derived parameters which calculate() can skip (see set_derived())
+		enum Derived_t {
+			kBgoSort = 1 << 0, ///< bgo.esort, hit0, sum, x0, y0, z0, t0
+			kRf      = 1 << 1, ///< trf
+			kTdc     = 1 << 2, ///< tcal0, tcalx, tcal_rf
+			ALL_DERIVED = (1 << 3) - 1
+		};
 
 	public: // Methods
 		/// Initializes data values
 		Head();
 		/// Sets all data values to vme::NONE or other defaults
 		void reset();
+		/// Copy the event data (not the variables) of another instance
+		void copy_event(const Head& other);
+		/// Check if another instance calculates the same derived parameters, so its events can be copied
+		bool can_copy_event(const Head& other) const { return fDerived == other.fDerived; }
 		///  Reads all variable values from an database (file or online)
 		bool set_variables(const char* dbfile);
 		///  Reads all variable values from a constructed database
 		bool set_variables(const midas::Database* db);
+		/// Re-reads only the variables stored at or below an ODB path
+		bool update_variables(const midas::Database* db, const char* path);
 		/// Unpack raw data into VME modules
 		void unpack(const midas::Event& event);
 		/// Calculate higher-level data for each detector, or across detectors
 		void calculate();
+		/// Set the derived parameters (Derived_t bits) calculated, default ALL_DERIVED
+		void set_derived(int derived) { fDerived = derived; }
+		/// Derived parameters (Derived_t bits) calculated
+		int get_derived() const { return fDerived; }
+		/// Derived parameters (Derived_t bits) needed for a data member path, e.g. "bgo.sum"
+		static int derived_of(const char* path);
 
 	public: // Data
 		/// Midas event header
@@ -606,6 +663,10 @@ namespace dragon {
 	public: // Subclass instances
 		/// Variables instance
 		Head::Variables variables; //!
+
+	private:
+		/// Derived parameters calculated
+		int fDerived; //!
 	};
 
 	///
@@ -617,20 +678,67 @@ namespace dragon {
 		static const int NUM_ADC = 2;
 		/// Max number of RF hits to store
 		static const int MAX_RF_HITS = 5;
+		/// Optional detectors, as bits of Variables::detectors
+		enum Detector_t {
+			kDsssd      = 1 << 0, ///< DSSSD
+			kIonChamber = 1 << 1, ///< Ionization chamber
+			kNaI        = 1 << 2, ///< NaI detectors
+			kGe         = 1 << 3  ///< Germanium detector
+		};
+		/// Optional detectors compiled in (not removed by the DRAGON_OMIT_* macros)
+		static const int ALL_DETECTORS = 0
+#ifndef DRAGON_OMIT_DSSSD
+			| kDsssd
+#endif
+#ifndef DRAGON_OMIT_IC
+			| kIonChamber
+#endif
+#ifndef DRAGON_OMIT_NAI
+			| kNaI
+#endif
+#ifndef DRAGON_OMIT_GE
+			| kGe
+#endif
+			;
+		/// Derived parameters which calculate() can skip (see set_derived())
+		enum Derived_t {
+			kDsssdMax    = 1 << 0, ///< dsssd.efront, eback, hit_front, hit_back
+			kIcSum       = 1 << 1, ///< ic.sum
+			kMcpPosition = 1 << 2, ///< mcp.x, mcp.y
+			kTof         = 1 << 3, ///< tof
+			kRf          = 1 << 4, ///< trf
+			kTdc         = 1 << 5, ///< tcal0, tcalx, tcal_rf
+			ALL_DERIVED = (1 << 6) - 1
+		};
 
 	public: // Methods
 		/// Initializes data values
 		Tail();
 		/// Sets all data values to vme::NONE or other defaults
 		void reset();
+		/// Copy the event data (not the variables) of another instance
+		void copy_event(const Tail& other);
+		/// Check if another instance calculates the same detectors and derived parameters, so its events can be copied
+		bool can_copy_event(const Tail& other) const
+			{ return fDetectors == other.fDetectors && fDerived == other.fDerived; }
 		///  Reads all variable values from an database (file or online)
 		bool set_variables(const char* dbfile);
 		///  Reads all variable values from a constructed database
 		bool set_variables(const midas::Database* db);
+		/// Re-reads only the variables stored at or below an ODB path
+		bool update_variables(const midas::Database* db, const char* path);
 		/// Unpack raw data into VME modules
 		void unpack(const midas::Event& event);
 		/// Calculate higher-level data for each detector, or across detectors
 		void calculate();
+		/// Check if an optional detector (Detector_t) is installed, i.e. unpacked and calculated
+		bool has_detector(int detector) const { return (fDetectors & detector) != 0; }
+		/// Set the derived parameters (Derived_t bits) calculated, default ALL_DERIVED
+		void set_derived(int derived) { fDerived = derived; }
+		/// Derived parameters (Derived_t bits) calculated
+		int get_derived() const { return fDerived; }
+		/// Derived parameters (Derived_t bits) needed for a data member path, e.g. "mcp.x"
+		static int derived_of(const char* path);
 
 	public: // Class data
 		/// Midas event header
@@ -699,6 +807,8 @@ namespace dragon {
 			dragon::utils::TdcVariables<1> rf_tdc;
 			/// Trigger TDC channel variables
 			dragon::utils::TdcVariables<1> tdc0;
+			/// Installed optional detectors (Detector_t bits), default ALL_DETECTORS
+			int detectors;
 
 		public: // Methods
 			/// Sets data to defaults
@@ -714,6 +824,26 @@ namespace dragon {
 	public: // Subclass instances
 		/// Variables instance
 		Variables variables; //!
+
+	private: // Methods
+		/// Rebuild the list of optional detectors processed per event from variables.detectors
+		void build_pipeline();
+		/// Reset one optional detector
+		void reset_detector(int detector);
+		/// Read and calculate one optional detector
+		void calculate_detector(int detector);
+
+	private: // Detector pipeline
+		/// Maximum number of optional detectors
+		static const int MAX_DETECTORS = 4;
+		/// Optional detectors in the pipeline
+		int fDetectors; //!
+		/// Pipeline: the optional detectors processed per event, in order
+		int fSteps[MAX_DETECTORS]; //!
+		/// Length of the pipeline
+		int fNumSteps; //!
+		/// Derived parameters calculated
+		int fDerived; //!
 	};
 
 	///
@@ -753,12 +883,18 @@ namespace dragon {
 		bool set_variables(const char* dbfile);
 		///  Reads all variable values from a constructed database
 		bool set_variables(const midas::Database* db);
+		/// Re-reads only the variables stored at or below an ODB path
+		bool update_variables(const midas::Database* db, const char* path);
 		/// Copy data from head and tail coincidence events
 		void compose_event(const Head& head_, const Tail& tail_);
 		/// Unpack raw data from a midas::CoincEvent
 		void unpack(const midas::CoincEvent& coincEvent);
 		/// Calculates both singles and coincidence parameters
 		void calculate();
+		/// Calculates coincidence parameters only, from calculated head and tail events
+		void calculate_coinc();
+		/// Add the derived parameters of head and tail needed for a data member path, e.g. "xtofh"
+		static void derived_of(const char* path, int& head_derived, int& tail_derived);
 
 	public: // Data
 		/// Head (gamma-ray) part of the event
@@ -798,6 +934,8 @@ namespace dragon {
 		bool set_variables(const char* dbfile, const char* dir);
 		///  Reads all variable values from a constructed database
 		bool set_variables(const midas::Database* db, const char* dir);
+		/// Re-reads the variables if they are stored at or below an ODB path
+		bool update_variables(const midas::Database* db, const char* path, const char* dir);
 		/// Set branch alises in a ROOT TTree.
 		template <class T>
 		void set_aliases(T* t, bool print = false) const;
@@ -864,6 +1002,8 @@ namespace dragon {
 		bool set_variables(const char* dbfile);
 		///  Reads all variable values from a constructed database
 		bool set_variables(const midas::Database* db);
+		/// Re-reads only the variables stored at or below an ODB path
+		bool update_variables(const midas::Database* db, const char* path);
 		/// Set branch alises in a ROOT TTree.
 		template <class T>
 		void set_aliases(T* t) const;
@@ -5,13 +5,789 @@
  */
 #include <ctime>
 #include <cassert>
+#include <deque>
+#include <new>
 #include <algorithm>
 #include "TStamp.hxx"
 #include "utils/ErrorDragon.hxx"
+#include "utils/Profile.hxx"
+
+
+// ========= Class tstamp::EventBuffer ========= //
+
+namespace {
+
+/// Recycling store of midas::Event objects
+/*!
+ * Events are allocated in slabs and never freed until the pool is destroyed.
+ * Since a recycled midas::Event keeps its data and fifo storage, re-using one
+ * for an event of similar size does not allocate any memory, so once the pool
+ * has grown to the steady-state queue depth no further allocations take place.
+ */
+class EventPool {
+private:
+	/// Number of events per slab
+	static const size_t kSlabSize = 256;
+
+	/// Allocated slabs (arrays of kSlabSize events)
+	std::vector<midas::Event*> fSlabs;
+
+	/// Events available for use
+	std::vector<midas::Event*> fFree;
+
+public:
+	EventPool() { }
+
+	~EventPool()
+		{
+			for (size_t i = 0; i< fSlabs.size(); ++i) delete[] fSlabs[i];
+		}
+
+	/// Get an unused event
+	midas::Event* Acquire()
+		{
+			if (fFree.empty()) Grow();
+			midas::Event* event = fFree.back();
+			fFree.pop_back();
+			return event;
+		}
+
+	/// Return an event to the pool
+	void Release(midas::Event* event)
+		{ fFree.push_back(event); }
+
+private:
+	/// Allocate a new slab
+	void Grow()
+		{
+			midas::Event* slab = new midas::Event[kSlabSize];
+			fSlabs.push_back(slab);
+			fFree.reserve(fSlabs.size()*kSlabSize);
+			for (size_t i = kSlabSize; i > 0; --i) fFree.push_back(slab + i - 1);
+		}
+
+	/// Disallow copy
+	EventPool(const EventPool&);
+
+	/// Disallow assign
+	EventPool& operator= (const EventPool&);
+};
+
+/// Recycling store of fixed-size memory blocks, such as the nodes of a std::multiset
+/*!
+ * Like EventPool, blocks are allocated in slabs and kept until the pool is
+ * destroyed, so a container which inserts and erases at a steady rate stops
+ * allocating once it has reached its largest size. The block size is set by
+ * the first request; requests of any other size go to operator new.
+ */
+class NodePool {
+private:
+	/// Number of blocks per slab
+	static const size_t kSlabSize = 256;
+
+	/// Block size, rounded up to keep blocks aligned (0 until the first request)
+	size_t fSize;
+
+	/// Head of the list of unused blocks, linked through their first word
+	void* fFree;
+
+	/// Allocated slabs
+	std::vector<char*> fSlabs;
+
+public:
+	NodePool(): fSize(0), fFree(0) { }
+
+	~NodePool()
+		{
+			for (size_t i = 0; i< fSlabs.size(); ++i) delete[] fSlabs[i];
+		}
+
+	/// Get a block of \e size bytes
+	void* Allocate(size_t size)
+		{
+			if (fSize == 0) fSize = Round(size);
+			if (Round(size) != fSize) return ::operator new(size);
+			if (!fFree) Grow();
+			void* block = fFree;
+			fFree = *static_cast<void**>(block);
+			return block;
+		}
+
+	/// Return a block obtained from Allocate(\e size)
+	void Deallocate(void* block, size_t size)
+		{
+			if (Round(size) != fSize) { ::operator delete(block); return; }
+			*static_cast<void**>(block) = fFree;
+			fFree = block;
+		}
+
+private:
+	/// Round up to a multiple of 16 bytes (the alignment of operator new on 64-bit systems), and at least a pointer
+	static size_t Round(size_t size)
+		{ return size < sizeof(void*) ? 16 : (size + 15) & ~size_t(15); }
+
+	/// Allocate a new slab
+	void Grow()
+		{
+			char* slab = new char[kSlabSize*fSize];
+			fSlabs.push_back(slab);
+			for (size_t i = kSlabSize; i > 0; --i) {
+				void* block = slab + (i - 1)*fSize;
+				*static_cast<void**>(block) = fFree;
+				fFree = block;
+			}
+		}
+
+	/// Disallow copy
+	NodePool(const NodePool&);
+
+	/// Disallow assign
+	NodePool& operator= (const NodePool&);
+};
+
+/// Standard library allocator drawing single objects from a NodePool
+/*!
+ * For node-based containers, all of whose allocations are of one node at a time.
+ * The pool is not owned, and must outlive the container.
+ */
+template <class T>
+class PoolAllocator {
+public:
+	typedef T value_type;
+	typedef T* pointer;
+	typedef const T* const_pointer;
+	typedef T& reference;
+	typedef const T& const_reference;
+	typedef size_t size_type;
+	typedef ptrdiff_t difference_type;
+	template <class U> struct rebind { typedef PoolAllocator<U> other; };
+
+	/// The pool blocks are drawn from
+	NodePool* fPool;
+
+	explicit PoolAllocator(NodePool* pool): fPool(pool) { }
+
+	template <class U>
+	PoolAllocator(const PoolAllocator<U>& other): fPool(other.fPool) { }
+
+	pointer allocate(size_type n, const void* = 0)
+		{ return static_cast<pointer>(n == 1 ? fPool->Allocate(sizeof(T)) : ::operator new(n*sizeof(T))); }
+
+	void deallocate(pointer p, size_type n)
+		{ if (n == 1) fPool->Deallocate(p, sizeof(T)); else ::operator delete(p); }
+
+	void construct(pointer p, const T& value)
+		{ new (p) T(value); }
+
+	void destroy(pointer p)
+		{ p->~T(); }
+
+	pointer address(reference r) const
+		{ return &r; }
+
+	const_pointer address(const_reference r) const
+		{ return &r; }
+
+	size_type max_size() const
+		{ return size_type(-1) / sizeof(T); }
+
+	template <class U>
+	bool operator== (const PoolAllocator<U>& other) const
+		{ return fPool == other.fPool; }
+
+	template <class U>
+	bool operator!= (const PoolAllocator<U>& other) const
+		{ return fPool != other.fPool; }
+};
+
+}
+
+/// Abstract interface to the storage engines used by tstamp::Queue
+/*!
+ * Implementations hold handles (pointers) to events owned by an internal EventPool,
+ * ordered in trigger time, and are able to locate every event coincident with the
+ * earliest one. Events are filled in place with Acquire(), handed over with Insert()
+ * and given back to the pool when removed.
+ */
+class tstamp::EventBuffer {
+protected:
+	/// Storage for the buffered events
+	EventPool fPool;
+
+public:
+	/// Empty
+	virtual ~EventBuffer() { }
+
+	/// Get an unused event from the pool, to be filled and passed to Insert()
+	midas::Event* Acquire()
+		{ return fPool.Acquire(); }
+
+	/// Return an event obtained from Acquire() without inserting it
+	void Release(midas::Event* event)
+		{ fPool.Release(event); }
+
+	/// Insert an event obtained from Acquire()
+	/*! On exception the event is left unowned; the caller must Release() it. */
+	virtual void Insert(midas::Event* event) = 0;
+
+	/// Returns the number of stored events
+	virtual size_t Size() const = 0;
+
+	/// Returns the maximum number of storable events
+	virtual size_t MaxSize() const = 0;
+
+	/// Returns the earliest event; buffer must not be empty
+	virtual const midas::Event& Front() = 0;
+
+	/// Returns the latest event; buffer must not be empty
+	virtual const midas::Event& Back() = 0;
+
+	/// Find all events coincident with Front(), in time order
+	/*!
+	 * \param [out] matches Appended with pointers to every event,
+	 *  other than Front() itself, which is in coincidence with Front().
+	 */
+	virtual void FindMatches(std::vector<const midas::Event*>& matches) = 0;
+
+	/// Remove the earliest event, releasing it to the pool
+	virtual void PopFront() = 0;
+
+	/// Remove all events, releasing them to the pool
+	virtual void Clear() = 0;
+
+	/// Check if Front() is ready to be handed on, with a queue time of \e maxDelta
+	/*!
+	 * By default, once the latest event is more than \e maxDelta later than
+	 * Front(). Buffer must not be empty.
+	 */
+	virtual bool IsFinal(double maxDelta)
+		{ return Back().TimeDiff(Front()) > maxDelta; }
+
+	/// Check if there are no events stored
+	bool Empty() const { return Size() == 0; }
+};
+
+
+namespace {
+
+/// EventBuffer implementation using a std::multiset
+class MultiSetBuffer: public tstamp::EventBuffer {
+private:
+	/// Applies the midas::Event fuzzy operator< to event handles
+	struct Compare {
+		bool operator() (const midas::Event* lhs, const midas::Event* rhs) const
+			{ return *lhs < *rhs; }
+	};
+
+	/// Set of event handles, with nodes recycled through fNodes
+	typedef std::multiset<midas::Event*, Compare, PoolAllocator<midas::Event*> > Set_t;
+
+	/// Storage for the nodes of fSet (declared first, to be destroyed last)
+	NodePool fNodes;
+
+	/// Events sorted by the midas::Event fuzzy operator<
+	Set_t fSet;
+
+public:
+	MultiSetBuffer():
+		fSet(Compare(), PoolAllocator<midas::Event*>(&fNodes)) { }
+
+	~MultiSetBuffer()
+		{ Clear(); }
+
+	void Insert(midas::Event* event)
+		{ fSet.insert(event); }
+
+	size_t Size() const
+		{ return fSet.size(); }
+
+	size_t MaxSize() const
+		{ return fSet.max_size(); }
+
+	const midas::Event& Front()
+		{ return **fSet.begin(); }
+
+	const midas::Event& Back()
+		{ return **fSet.rbegin(); }
+
+	void FindMatches(std::vector<const midas::Event*>& matches)
+		{
+			std::pair<Set_t::iterator, Set_t::iterator> range = fSet.equal_range(*fSet.begin());
+			for (Set_t::iterator it = range.first; it != range.second; ++it) {
+				if (it != fSet.begin()) matches.push_back(*it);
+			}
+		}
+
+	void PopFront()
+		{
+			Release(*fSet.begin());
+			fSet.erase(fSet.begin());
+		}
+
+	void Clear()
+		{
+			for (Set_t::iterator it = fSet.begin(); it != fSet.end(); ++it) Release(*it);
+			fSet.clear();
+		}
+};
+
+
+/// EventBuffer implementation using a calendar queue
+/*!
+ * Events are hashed into a power-of-two number of buckets ("days") by
+ * their trigger time, with slot number <tt>floor(TriggerTime() / width)</tt>
+ * and bucket index <tt>slot % nbuckets</tt>. Each bucket is kept sorted in
+ * trigger time, so the earliest event is found by scanning forward from the
+ * bucket of the last known earliest event, and coincidence matches are found
+ * by looking only at the buckets covering <tt>[t0, t0 + window]</tt>.
+ *
+ * The number of buckets follows the number of stored events, and the bucket
+ * width is re-calibrated from the mean event spacing whenever the buckets are
+ * resized, so that insertion and removal cost O(1) amortized.
+ */
+class CalendarBuffer: public tstamp::EventBuffer {
+private:
+	/// Bucket of events, sorted in trigger time
+	typedef std::vector<midas::Event*> Bucket_t;
+
+	/// Smallest allowed number of buckets
+	static const size_t kMinBuckets = 16;
+
+	/// Smallest allowed bucket width (uSec)
+	static const double kMinWidth;
+
+	/// Buckets
+	std::vector<Bucket_t> fBuckets;
+
+	/// Number of buckets - 1
+	size_t fMask;
+
+	/// Bucket width in uSec
+	double fWidth;
+
+	/// Number of stored events
+	size_t fSize;
+
+	/// Slot number such that no stored event has a smaller slot
+	uint64_t fCurrent;
+
+	/// Cached earliest event (NULL if unknown)
+	midas::Event* fFront;
+
+	/// Cached latest event (NULL if unknown)
+	midas::Event* fBack;
+
+public:
+	CalendarBuffer():
+		fBuckets(kMinBuckets), fMask(kMinBuckets - 1), fWidth(0.),
+		fSize(0), fCurrent(0), fFront(0), fBack(0) { }
+
+	~CalendarBuffer()
+		{ Clear(); }
+
+	void Insert(midas::Event* event);
+
+	size_t Size() const
+		{ return fSize; }
+
+	size_t MaxSize() const
+		{ return Bucket_t().max_size(); }
+
+	const midas::Event& Front()
+		{
+			if (!fFront) fFront = FindFront();
+			return *fFront;
+		}
+
+	const midas::Event& Back()
+		{
+			if (!fBack) fBack = FindBack();
+			return *fBack;
+		}
+
+	void FindMatches(std::vector<const midas::Event*>& matches);
+
+	void PopFront();
+
+	void Clear();
+
+private:
+	/// Slot number of a trigger time
+	uint64_t Slot(double t) const
+		{ return t > 0. ? static_cast<uint64_t>(t / fWidth) : 0; }
+
+	/// Bucket containing a slot
+	Bucket_t& BucketOf(uint64_t slot)
+		{ return fBuckets[slot & fMask]; }
+
+	/// Insert an (owned) event pointer into its bucket, keeping the bucket sorted
+	void DoInsert(midas::Event* event);
+
+	/// Search for the earliest event, updating fCurrent
+	midas::Event* FindFront();
+
+	/// Search for the latest event
+	midas::Event* FindBack() const;
+
+	/// Change the number of buckets and re-calibrate the width
+	void Resize(size_t nbuckets);
+
+	/// Compare trigger times
+	static bool CompareTime(const midas::Event* lhs, const midas::Event* rhs)
+		{ return lhs->TriggerTime() < rhs->TriggerTime(); }
+};
+
+const double CalendarBuffer::kMinWidth = 1e-3;
+
+void CalendarBuffer::Insert(midas::Event* p)
+{
+	if (fWidth == 0.) {
+		fWidth = p->GetCoincWindow() > kMinWidth ? p->GetCoincWindow() : 1.;
+	}
+	if (fSize >= 2*fBuckets.size()) {
+		Resize(2*fBuckets.size());
+	}
+	DoInsert(p);
+
+	uint64_t slot = Slot(p->TriggerTime());
+	if (fSize == 0 || slot < fCurrent) fCurrent = slot;
+	if (fFront && p->TriggerTime() < fFront->TriggerTime()) fFront = p;
+	if (fSize == 0 || (fBack && p->TriggerTime() >= fBack->TriggerTime())) fBack = p;
+	++fSize;
+}
+
+void CalendarBuffer::DoInsert(midas::Event* event)
+{
+	Bucket_t& bucket = BucketOf(Slot(event->TriggerTime()));
+	if (bucket.empty() || !CompareTime(event, bucket.back())) { // usual case: time ordered
+		bucket.push_back(event);
+	}
+	else {
+		bucket.insert(std::upper_bound(bucket.begin(), bucket.end(), event, CompareTime), event);
+	}
+}
+
+midas::Event* CalendarBuffer::FindFront()
+{
+	assert(fSize > 0);
+	for (size_t i = 0; i< fBuckets.size(); ++i) {
+		uint64_t slot = fCurrent + i;
+		Bucket_t& bucket = BucketOf(slot);
+		if (!bucket.empty() && Slot(bucket.front()->TriggerTime()) == slot) {
+			fCurrent = slot;
+			return bucket.front();
+		}
+	}
+
+	// Nothing within one "year" of fCurrent; direct search of the bucket fronts
+	midas::Event* front = 0;
+	for (size_t i = 0; i< fBuckets.size(); ++i) {
+		if (fBuckets[i].empty()) continue;
+		if (!front || CompareTime(fBuckets[i].front(), front)) front = fBuckets[i].front();
+	}
+	assert(front);
+	fCurrent = Slot(front->TriggerTime());
+	return front;
+}
+
+midas::Event* CalendarBuffer::FindBack() const
+{
+	assert(fSize > 0);
+	midas::Event* back = 0;
+	for (size_t i = 0; i< fBuckets.size(); ++i) {
+		if (fBuckets[i].empty()) continue;
+		if (!back || !CompareTime(fBuckets[i].back(), back)) back = fBuckets[i].back();
+	}
+	return back;
+}
+
+void CalendarBuffer::FindMatches(std::vector<const midas::Event*>& matches)
+{
+	const midas::Event& front = Front();
+	const double tmax = front.TriggerTime() + front.GetCoincWindow();
+	const uint64_t last = Slot(tmax);
+	const size_t nslots = last - fCurrent < fBuckets.size() ? last - fCurrent + 1 : fBuckets.size();
+	const size_t first = matches.size();
+
+	for (size_t i = 0; i< nslots; ++i) {
+		Bucket_t& bucket = BucketOf(fCurrent + i);
+		for (Bucket_t::iterator it = bucket.begin(); it != bucket.end(); ++it) {
+			if ((*it)->TriggerTime() >= tmax) break;
+			if (*it != &front && front.IsCoinc(**it)) matches.push_back(*it);
+		}
+	}
+	if (nslots == fBuckets.size()) { // window spans every bucket, restore time order
+		std::stable_sort(matches.begin() + first, matches.end(), CompareTime);
+	}
+}
+
+void CalendarBuffer::PopFront()
+{
+	midas::Event* front = const_cast<midas::Event*>(&Front());
+	Bucket_t& bucket = BucketOf(fCurrent);
+	assert(!bucket.empty() && bucket.front() == front);
+	bucket.erase(bucket.begin());
+
+	if (fBack == front) fBack = 0;
+	fFront = 0;
+	Release(front);
+	--fSize;
+
+	if (fBuckets.size() > kMinBuckets && fSize < fBuckets.size() / 4) {
+		Resize(fBuckets.size() / 2);
+	}
+}
+
+void CalendarBuffer::Resize(size_t nbuckets)
+{
+	Bucket_t all;
+	all.reserve(fSize);
+	midas::Event* front = 0;
+	for (size_t i = 0; i< fBuckets.size(); ++i) {
+		for (Bucket_t::iterator it = fBuckets[i].begin(); it != fBuckets[i].end(); ++it) {
+			if (!front || CompareTime(*it, front)) front = *it;
+			all.push_back(*it);
+		}
+	}
+
+	// Re-calibrate to ~3 events per slot
+	if (front && all.size() > 1) {
+		double span = Back().TriggerTime() - front->TriggerTime();
+		double width = 3. * span / all.size();
+		if (width > kMinWidth) fWidth = width;
+	}
+
+	std::vector<Bucket_t> (nbuckets).swap(fBuckets);
+	fMask = nbuckets - 1;
+	for (Bucket_t::iterator it = all.begin(); it != all.end(); ++it) {
+		DoInsert(*it);
+	}
+
+	fFront = front;
+	fCurrent = front ? Slot(front->TriggerTime()) : 0;
+}
+
+void CalendarBuffer::Clear()
+{
+	for (size_t i = 0; i< fBuckets.size(); ++i) {
+		for (Bucket_t::iterator it = fBuckets[i].begin(); it != fBuckets[i].end(); ++it) {
+			Release(*it);
+		}
+	}
+	std::vector<Bucket_t> (kMinBuckets).swap(fBuckets);
+	fMask = kMinBuckets - 1;
+	fSize = 0;
+	fCurrent = 0;
+	fFront = 0;
+	fBack = 0;
+}
+
+
+/// EventBuffer implementation matching two time-ordered streams
+/*!
+ * Each DAQ stream (here, head and tail events) is read out in trigger time
+ * order, so instead of ordering all events together, each stream is kept in
+ * a FIFO of its own, and the earliest event is the earlier of the two FIFO
+ * fronts. Its coincidence matches are the events of the other stream, from the
+ * front of its FIFO up to the end of the window; events of the same stream are
+ * never matched (they would not make a head + tail coincidence).
+ *
+ * The earliest event is final (and handed on by the push) as soon as the other stream has
+ * delivered an event later than the end of its coincidence window. If the other
+ * stream is quiet, it is final once the latest event of either stream is later
+ * than the end of the window by more than twice the largest lag seen so far
+ * (how much earlier than the latest event pushed before it any event has been),
+ * so that the buffering follows the actual skew between the streams. The queue
+ * time remains the upper limit, and is the only one until both streams have
+ * been seen.
+ *
+ * The stream of an event is its id: the id of the first event pushed is one
+ * stream, any other id the other one.
+ */
+class MergeJoinBuffer: public tstamp::EventBuffer {
+private:
+	/// FIFO of one stream, in trigger time order
+	typedef std::deque<midas::Event*> Fifo_t;
+
+	/// The two streams
+	Fifo_t fFifo[2];
+
+	/// Event id of stream 0, -1 before the first event
+	int32_t fId0;
+
+	/// Latest trigger time pushed into each stream
+	double fLatest[2];
+
+	/// Has each stream been seen
+	bool fSeen[2];
+
+	/// Largest lag of an event behind the latest one pushed before it
+	double fMaxLag;
+
+public:
+	MergeJoinBuffer():
+		fId0(-1), fMaxLag(0.)
+		{
+			fLatest[0] = fLatest[1] = 0.;
+			fSeen[0] = fSeen[1] = false;
+		}
+
+	~MergeJoinBuffer()
+		{ Clear(); }
+
+	void Insert(midas::Event* event);
+
+	size_t Size() const
+		{ return fFifo[0].size() + fFifo[1].size(); }
+
+	size_t MaxSize() const
+		{ return fFifo[0].max_size(); }
+
+	const midas::Event& Front()
+		{ return *fFifo[FrontStream()].front(); }
+
+	const midas::Event& Back()
+		{
+			if (fFifo[0].empty()) return *fFifo[1].back();
+			if (fFifo[1].empty()) return *fFifo[0].back();
+			return *(CompareTime(fFifo[0].back(), fFifo[1].back()) ? fFifo[1].back() : fFifo[0].back());
+		}
+
+	void FindMatches(std::vector<const midas::Event*>& matches)
+		{
+			const int s = FrontStream();
+			const midas::Event& front = *fFifo[s].front();
+			const double tmax = front.TriggerTime() + front.GetCoincWindow();
+			const Fifo_t& other = fFifo[1 - s];
+			for (Fifo_t::const_iterator it = other.begin(); it != other.end() && (*it)->TriggerTime() < tmax; ++it) {
+				if (front.IsCoinc(**it)) matches.push_back(*it);
+			}
+		}
+
+	void PopFront()
+		{
+			Fifo_t& fifo = fFifo[FrontStream()];
+			Release(fifo.front());
+			fifo.pop_front();
+		}
+
+	void Clear()
+		{
+			for (int s = 0; s< 2; ++s) {
+				for (Fifo_t::iterator it = fFifo[s].begin(); it != fFifo[s].end(); ++it) Release(*it);
+				fFifo[s].clear();
+			}
+		}
+
+	bool IsFinal(double maxDelta);
+
+private:
+	/// Stream holding the earliest event; buffer must not be empty
+	int FrontStream() const
+		{
+			if (fFifo[0].empty()) return 1;
+			if (fFifo[1].empty()) return 0;
+			return CompareTime(fFifo[1].front(), fFifo[0].front()) ? 1 : 0;
+		}
+
+	/// Compare trigger times
+	static bool CompareTime(const midas::Event* lhs, const midas::Event* rhs)
+		{ return lhs->TriggerTime() < rhs->TriggerTime(); }
+};
+
+void MergeJoinBuffer::Insert(midas::Event* event)
+{
+	if (fId0 < 0) fId0 = event->GetEventId();
+	const int s = event->GetEventId() == fId0 ? 0 : 1;
+	const double t = event->TriggerTime();
+
+	if (fSeen[0] || fSeen[1]) {
+		const double latest = std::max(fSeen[0] ? fLatest[0] : t, fSeen[1] ? fLatest[1] : t);
+		if (latest - t > fMaxLag) fMaxLag = latest - t;
+	}
+
+	Fifo_t& fifo = fFifo[s];
+	if (fifo.empty() || !CompareTime(event, fifo.back())) { // usual case: time ordered
+		fifo.push_back(event);
+	}
+	else {
+		fifo.insert(std::upper_bound(fifo.begin(), fifo.end(), event, CompareTime), event);
+	}
+	if (!fSeen[s] || t > fLatest[s]) fLatest[s] = t;
+	fSeen[s] = true;
+}
+
+bool MergeJoinBuffer::IsFinal(double maxDelta)
+{
+	const int s = FrontStream();
+	const midas::Event& front = *fFifo[s].front();
+	const double tmax = front.TriggerTime() + front.GetCoincWindow();
+	if (fSeen[1 - s] && fLatest[1 - s] >= tmax) return true; // the other stream has passed the window
+	if (fSeen[0] && fSeen[1] && std::max(fLatest[0], fLatest[1]) > tmax + 2.*fMaxLag) return true;
+	return Back().TimeDiff(front) > maxDelta;
+}
+
+} // namespace
 
 
 // ========= Class tstamp::Queue ========= //
 
+tstamp::Queue::Queue(double deltaMax, Engine_t engine):
+	fMaxDelta (deltaMax), fEvents(0), fEngine(engine),
+	fDiagEvents(0), fDiagSeconds(1), fDiagCount(0), fDiagTime(0)
+{
+	/*!
+	 * \param [in] deltaMax Maximum difference between timestamps before emptying
+	 * \param [in] engine Storage engine to use for the buffered events
+	 * \note \e deltaMax should be set large enough to cover any potential timstamp overlaps,
+	 * but without taking up too much memory
+	 */
+	switch (engine) {
+	case kCalendar:
+		fEvents = new CalendarBuffer();
+		break;
+	case kMultiSet:
+		fEvents = new MultiSetBuffer();
+		break;
+	case kMergeJoin:
+		fEvents = new MergeJoinBuffer();
+		break;
+	default:
+		dragon::utils::Warning("tstamp::Queue::Queue", __FILE__, __LINE__)
+			<< "Unknown engine " << engine << ", using kMultiSet";
+		fEngine = kMultiSet;
+		fEvents = new MultiSetBuffer();
+		break;
+	}
+}
+
+tstamp::Queue::~Queue()
+{
+	/*! Deletes (without handling) any events remaining in the queue */
+	delete fEvents;
+}
+
+size_t tstamp::Queue::Size() const
+{
+	return fEvents->Size();
+}
+
+void tstamp::Queue::Clear()
+{
+	fEvents->Clear();
+}
+
+bool tstamp::Queue::IsFull() const
+{
+	return !fEvents->Empty() && fEvents->IsFinal(fMaxDelta);
+}
+
+double tstamp::Queue::MaxTimeDiff() const
+{
+	if (fEvents->Empty()) return 0.;
+	return fEvents->Back().TimeDiff(fEvents->Front());
+}
+
 void tstamp::Queue::HandleCoinc(const midas::Event& event1,
 																const midas::Event& event2) const
 {
@@ -46,17 +822,87 @@ void tstamp::Queue::HandleDiagnostics(tstamp::Diagnostics* d) const
 	std::cout << std::endl;
 }
 
+void tstamp::Queue::SetDiagnosticsSampling(uint32_t events, uint32_t seconds)
+{
+	/*!
+	 * The counters of the Diagnostics instance passed to Push() and the flushing
+	 * functions are updated for every event; HandleDiagnostics() is called (and the
+	 * rates calculated) only once \e events events have been counted or \e seconds
+	 * seconds of event (MIDAS header) time have passed since it was last called,
+	 * whichever comes first, and once more when a flush empties the queue.
+	 *
+	 * \param events Maximum number of events between samples, 0 for no limit
+	 * \param seconds Maximum event time between samples, 0 for no limit
+	 * \note The default is one sample per second of event time. Setting both to
+	 *  zero hands the diagnostics on after every event.
+	 */
+	fDiagEvents = events;
+	fDiagSeconds = seconds;
+	fDiagCount = 0;
+}
+
 void tstamp::Queue::Push(const midas::Event& event, tstamp::Diagnostics* diagnostics)
 {
 	/*!
-	 * First the function inserts \e event into the internal container. Then,
-	 * it calls Pop() until the container size (time difference) is no longer
-	 * larger than the maximum.
+	 * Copies \e event into an event recycled from the internal pool, then inserts
+	 * it into the queue (see DoPush()).
 	 * \param [in] event Event to insert into the queue.
 	 * \param [in] diagnostics Optional pointer to a Diagnostics class instance,
 	 *  to be filled with information from the push
-	 * \note The function does attempt to handle exceptions thrown by the
-	 * std::multiset::insert() function. Most likely these would result from
+	 */
+	const uint64_t profileStart = dragon::utils::Profile::Begin(dragon::utils::Profile::kQueuePush);
+	midas::Event* pooled = fEvents->Acquire();
+	try {
+		*pooled = event;
+	}
+	catch (std::exception&) {
+		fEvents->Release(pooled);
+		throw;
+	}
+	DoPush(pooled, diagnostics, profileStart);
+}
+
+void tstamp::Queue::Push(const void* header, const void* data, int size, const midas::Bank_t tsbank,
+												 double coinc_window, tstamp::Diagnostics* diagnostics)
+{
+	/*!
+	 * Constructs the event directly in storage recycled from the internal pool
+	 * (see midas::Event::Reset()), avoiding an intermediate copy, then inserts it into the
+	 * queue (see DoPush()). Arguments are the same as for the equivalent midas::Event constructor.
+	 * \param [in] diagnostics Optional pointer to a Diagnostics class instance,
+	 *  to be filled with information from the push
+	 * \throws std::invalid_argument if the TSC bank \e tsbank is not present
+	 */
+	const uint64_t profileStart = dragon::utils::Profile::Begin(dragon::utils::Profile::kQueuePush);
+	midas::Event* pooled = fEvents->Acquire();
+	try {
+		pooled->Reset(header, data, size, tsbank, coinc_window);
+	}
+	catch (std::exception&) {
+		fEvents->Release(pooled);
+		throw;
+	}
+	DoPush(pooled, diagnostics, profileStart);
+}
+
+void tstamp::Queue::DoPush(midas::Event* event, tstamp::Diagnostics* diagnostics, uint64_t profileStart)
+{
+	/*!
+	 * First the function inserts \e event into the internal container. Then,
+	 * if the earliest event is final (with the default engines, once the container
+	 * time difference is larger than the maximum), it calls Pop() once.
+	 * \note At most one event is handed on per push, also with kMergeJoin when
+	 *  several are final: callers such as dragon::Unpacker keep one head, tail and
+	 *  coincidence per Push() (see dragon::UnpackedCodes), so further events would
+	 *  overwrite the first. The others are handed on by later pushes, or Flush().
+	 * \param [in] event Event obtained from EventBuffer::Acquire(); ownership
+	 *  passes to the internal container.
+	 * \param [in] diagnostics Optional pointer to a Diagnostics class instance,
+	 *  to be filled with information from the push
+	 * \param [in] profileStart Start of the push, from dragon::utils::Profile::Begin(); the
+	 *  push is timed up to (not including) the Pop() calls
+	 * \note The function does attempt to handle exceptions thrown when inserting
+	 * into the internal container. Most likely these would result from
 	 * making the set size too large, so we empty the queue and try again
 	 * (w/ error mesage). If it still fails, give up and rethrow the exception
 	 * (causing program termination).  If other exceptions start to show up, then
@@ -64,12 +910,12 @@ void tstamp::Queue::Push(const midas::Event& event, tstamp::Diagnostics* diagnos
 	 */
 
 	try { // insert event into the queue
-		fEvents.insert(event);
+		fEvents->Insert(event);
 	}
 	catch (std::exception& e) { // try to handle exception gracefully
 		dragon::utils::Error("tstamp::Queue::Push", __FILE__, __LINE__)
-			<< "Caught an exception from std::multiset::insert: " << e.what()
-			<< " (note: size = " << Size() << ", max size = " << fEvents.max_size()
+			<< "Caught an exception from EventBuffer::Insert: " << e.what()
+			<< " (note: size = " << Size() << ", max size = " << fEvents->MaxSize()
 			<< "). Clearing the Queue and trying again... WARNING: that this could cause "
 			<< "coincidences to be missed!";
 
@@ -77,30 +923,31 @@ void tstamp::Queue::Push(const midas::Event& event, tstamp::Diagnostics* diagnos
 
 		try { // try again to insert
 
-			fEvents.insert(event);
+			fEvents->Insert(event);
 		}
 		catch (std::exception& e) { // give up
 			dragon::utils::Error("tstamp::Queue::Push", __FILE__, __LINE__)
-				<< "Caught a second exception from std::multiset::insert: " << e.what()
+				<< "Caught a second exception from EventBuffer::Insert: " << e.what()
 				<< ". Not sure what to do: rethrowing (likely fatal!)";
+			fEvents->Release(event);
 			throw (e);
 		}
 	}
 
 	// Erase event from the front of the queue, but first collect some
-	// diagnostic info
+	// diagnostic info (note that Pop() may release 'event' itself)
 
-	assert(fEvents.size() > 0);
+	assert(fEvents->Size() > 0);
 	bool haveCoinc = false;
 	int32_t singlesId = -1;
-	double tdiff = event.TimeDiff(*fEvents.begin());
+	double tdiff = event->TimeDiff(fEvents->Front());
+	uint32_t evtTime = event->GetTimeStamp();
+	dragon::utils::Profile::End(dragon::utils::Profile::kQueuePush, profileStart);
 	if (IsFull()) Pop(singlesId, haveCoinc);
 
-	/// Update diagnostic info in diagnostics != NULL
-	if(diagnostics) {
-		FillDiagnostics(diagnostics, tdiff, haveCoinc, singlesId, event.GetTimeStamp());
-		HandleDiagnostics(diagnostics);
-	}
+	/// Update diagnostic info in diagnostics != NULL, handing it on if a sample is due
+	if(diagnostics) FillDiagnostics(diagnostics, tdiff, haveCoinc, singlesId, evtTime);
+	if(diagnostics && DiagnosticsDue(evtTime)) EmitDiagnostics(diagnostics, evtTime);
 }
 
 
@@ -120,20 +967,22 @@ void tstamp::Queue::Pop(int32_t& singles_id, bool& found_coinc)
 	 */
 	singles_id = -1;
 	found_coinc = false;
-	if (fEvents.empty()) return;
-
-	EqualRange_t matches = fEvents.equal_range(*fEvents.begin());
-	MultiSet_t::iterator itMatch;
-	for (itMatch = matches.first; itMatch != matches.second; ++itMatch) {
-		if (itMatch != fEvents.begin()) {
-			found_coinc = true;
-			HandleCoinc(*fEvents.begin(), *itMatch);
-		}
+	if (fEvents->Empty()) return;
+
+	dragon::utils::ProfileScope profile(dragon::utils::Profile::kQueueMatch);
+	fMatches.clear();
+	fEvents->FindMatches(fMatches);
+	profile.Stop();
+	const midas::Event& front = fEvents->Front();
+	std::vector<const midas::Event*>::iterator itMatch;
+	for (itMatch = fMatches.begin(); itMatch != fMatches.end(); ++itMatch) {
+		found_coinc = true;
+		HandleCoinc(front, **itMatch);
 	}
 
-	singles_id = fEvents.begin()->GetEventId();
-	HandleSingle(*fEvents.begin());
-	fEvents.erase(fEvents.begin());
+	singles_id = front.GetEventId();
+	HandleSingle(front);
+	fEvents->PopFront();
 }
 
 void tstamp::Queue::Flush(int max_time, tstamp::Diagnostics* diagnostics)
@@ -147,13 +996,13 @@ void tstamp::Queue::Flush(int max_time, tstamp::Diagnostics* diagnostics)
 	 *  to be filled with information from the flushed event
 	 */
 	time_t t_begin = time(0);
-	while (!fEvents.empty()) {
+	while (!fEvents->Empty()) {
 		if ( max_time < 0 || (difftime(time(0), t_begin) < max_time) ) {
 			DoFlushEvent(diagnostics);
 		}
 		else {
 			FlushTimeoutMessage(max_time);
-			fEvents.clear();
+			fEvents->Clear();
 		}
 	}
 }
@@ -167,7 +1016,7 @@ size_t tstamp::Queue::FlushIterative(tstamp::Diagnostics* diagnostics)
 	 *  to be filled with information from the flushed event
 	 * \returns The size of the internal queue \e before performing a flush.
 	 */
-	size_t qsize = fEvents.size();
+	size_t qsize = fEvents->Size();
 	if(qsize > 0) DoFlushEvent(diagnostics);
 	return qsize;
 }
@@ -177,13 +1026,14 @@ void tstamp::Queue::DoFlushEvent(tstamp::Diagnostics* diagnostics)
 	/// Call Pop() on the front event
 	int32_t singlesId = -1;
 	bool haveCoinc = false;
-	uint32_t tfirst = fEvents.rbegin()->GetTimeStamp();
+	uint32_t tfirst = fEvents->Back().GetTimeStamp();
 	Pop(singlesId, haveCoinc);
 
-	/// Update diagnostic info if diagnostics != NULL
+	/// Update diagnostic info if diagnostics != NULL, handing it on if a sample
+	/// is due or the queue is now empty
 	if(diagnostics) {
 		FillDiagnostics(diagnostics, 0., haveCoinc, singlesId, tfirst);
-		HandleDiagnostics(diagnostics);
+		if (DiagnosticsDue(tfirst) || fEvents->Empty()) EmitDiagnostics(diagnostics, tfirst);
 	}
 }
 
@@ -197,7 +1047,7 @@ void tstamp::Queue::FlushTimeoutMessage(int max_time) const
 	 */
 	dragon::utils::Warning("tstamp::Queue::Flush()", __FILE__, __LINE__)
 		<< "Maximum timeout of " << max_time << " seconds reached. Clearing event queue (skipping "
-		<< fEvents.size() << " events...).";
+		<< fEvents->Size() << " events...).";
 }
 
 void tstamp::Queue::FillDiagnostics(tstamp::Diagnostics* d, double tdiff, bool have_coinc,
@@ -206,6 +1056,7 @@ void tstamp::Queue::FillDiagnostics(tstamp::Diagnostics* d, double tdiff, bool h
 	if(!d) return;
 	d->size = Size();
 	d->time_diff = tdiff;
+	d->n_errors = dragon::utils::MessageLimit::GetTotal();
 	if(have_coinc) d->n_coinc += 1;
 	if(singles_id >= 0 && singles_id < Diagnostics::MAX_TYPES) {
 		d->n_singles[singles_id] += 1;
@@ -216,18 +1067,33 @@ void tstamp::Queue::FillDiagnostics(tstamp::Diagnostics* d, double tdiff, bool h
 			<< ", types = " << Diagnostics::MAX_TYPES;
 	}
 
-	// rates
 	if(d->fTime0 == 0)	d->fTime0 = evt_time;
+}
+
+bool tstamp::Queue::DiagnosticsDue(uint32_t evt_time)
+{
+	++fDiagCount;
+	if (fDiagEvents == 0 && fDiagSeconds == 0) return true;
+	if (fDiagEvents > 0 && fDiagCount >= fDiagEvents) return true;
+	return fDiagSeconds > 0 && evt_time - fDiagTime >= fDiagSeconds;
+}
+
+void tstamp::Queue::EmitDiagnostics(tstamp::Diagnostics* d, uint32_t evt_time)
+{
+	/*! Rates are averages since the first event of the run. */
 	uint32_t time = evt_time - d->fTime0;
 	if(time > 0) {
 		d->coinc_rate = d->n_coinc / (double)time;
 		for(int i=0; i< Diagnostics::MAX_TYPES; ++i)
-			d->singles_rate[i] = d->n_singles[i] / time;
+			d->singles_rate[i] = d->n_singles[i] / (double)time;
 	}
 	else {
 		d->coinc_rate = 0.;
 		std::fill(d->singles_rate, d->singles_rate + Diagnostics::MAX_TYPES, 0.);
 	}
+	fDiagCount = 0;
+	fDiagTime = evt_time;
+	HandleDiagnostics(d);
 }
 
 
@@ -252,6 +1118,7 @@ void tstamp::Diagnostics::reset()
 	size = 0;
 	n_coinc = 0;
 	time_diff = 0.;
+	n_errors = 0;
 	coinc_rate = 0.;
 	std::fill(n_singles, n_singles + MAX_TYPES, 0);
 	std::fill(singles_rate, singles_rate + MAX_TYPES, 0.);
@@ -7,6 +7,7 @@
 #define DRAGON_TSTAMP_HXX
 #include "utils/IntTypes.h"
 #include <set>
+#include <vector>
 #include "midas/Event.hxx"
 
 
@@ -14,6 +15,7 @@
 namespace tstamp {
 
 class Diagnostics;
+class EventBuffer;
 
 /// Class to manage coincidence/singles ID.
 /*!
@@ -27,9 +29,27 @@ class Diagnostics;
  * set how coincidence and singles events should be handled, the class provides the private
  * virtual functions HandleCoinc() and HandleSingle(). In the base class, these simply
  * print some information about the arguments to stdout.
+ *
+ * Storage of the buffered events is delegated to an internal "engine", chosen at construction
+ * time (see Engine_t). The default engine is the `std::multiset` described in MultiSet_t; one
+ * alternative is a calendar queue (time-bucketed ring buffer) keyed on midas::Event::TriggerTime(),
+ * which has O(1) amortized insertion and removal and only scans neighbouring buckets when
+ * searching for coincidence matches. The other is a merge-join of the head and tail streams,
+ * each of which is in trigger time order: it hands every event on as soon as no event still
+ * to come can be coincident with it, rather than after the full queue time, so it buffers
+ * only as much as the actual skew between the streams. Every engine stores only handles to
+ * events recycled from an internal pool, so that once the pool has grown to the working queue
+ * depth, pushing and popping events does not copy into newly allocated memory.
  */
 class Queue {
 public:
+	/// Available storage engines
+	enum Engine_t {
+		kMultiSet = 0, ///< Red-black tree (`std::multiset`) ordered by the fuzzy operator<
+		kCalendar = 1, ///< Calendar queue with buckets in trigger time
+		kMergeJoin = 2 ///< One FIFO per (time-ordered) stream, events handed on once final
+	};
+
 	/// Internal container type used to store events.
 	/*!
 	 * Performance testing has indicated that a `std::multiset` is the optimal container
@@ -61,28 +81,45 @@ private:
 	double fMaxDelta;
 
 	/// Internal container of events waiting to be matched
-	MultiSet_t fEvents;
+	EventBuffer* fEvents; //!
+
+	/// Storage engine used by fEvents
+	Engine_t fEngine;
+
+	/// Coincidence matches found by Pop(), kept to avoid reallocation
+	std::vector<const midas::Event*> fMatches; //!
+
+	/// Hand diagnostics on after this many events (0 = no event limit)
+	uint32_t fDiagEvents;
+
+	/// Hand diagnostics on after this many seconds of event time (0 = no time limit)
+	uint32_t fDiagSeconds;
+
+	/// Events since diagnostics were last handed on
+	uint32_t fDiagCount;
+
+	/// Event time (seconds) when diagnostics were last handed on
+	uint32_t fDiagTime;
 
 public:
-	/// Sets the maximum container size (fMaxDelta)
-	/*!
-	 * \param [in] deltaMax Maximum difference between timestamps before emptying
-	 * \note \e deltaMax should be set large enough to cover any potential timstamp overlaps,
-	 * but without taking up too much memory
-	 */
-	Queue(double deltaMax): fMaxDelta (deltaMax) { }
+	/// Sets the maximum container size (fMaxDelta) and storage engine
+	Queue(double deltaMax, Engine_t engine = kMultiSet);
 
-	/// Destructor, empty
+	/// Frees the internal container
 	/*!
 	 * \warning It may be tempting to put a call to Flush() into the destructor; however, this
 	 * is a bad idea since Flush() will make calls to the virtual function HandleSingle() and maybe
 	 * HandleCoinc().
 	 */
-	virtual ~Queue() { }
+	virtual ~Queue();
 
-	/// Insert an element into the queue
+	/// Insert a copy of an event into the queue
 	virtual void Push(const midas::Event&, tstamp::Diagnostics* diagnostics = 0);
 
+	/// Insert an event into the queue, constructing it in place from raw MIDAS data
+	virtual void Push(const void* header, const void* data, int size, const midas::Bank_t tsbank,
+										double coinc_window, tstamp::Diagnostics* diagnostics = 0);
+
 	/// Erase the earliest event in the queue, first searching for coincidences.
 	virtual void Pop(int32_t& singles_id, bool& found_coinc);
 
@@ -93,7 +130,7 @@ public:
 	virtual size_t FlushIterative(tstamp::Diagnostics* diagnostics = 0);
 
 	/// Returns total number of entries in the queue
-	size_t Size() const { return fEvents.size(); }
+	size_t Size() const;
 
 	/// Set the maximum queue time to a new value
 	void SetMaxDelta(double delta) { fMaxDelta = delta; }
@@ -105,22 +142,30 @@ public:
 	virtual void FlushTimeoutMessage(int max_time) const;
 
 	/// Manually clear the event buffer
-	void Clear() { fEvents.clear(); }
+	void Clear();
+
+	/// Returns the storage engine in use
+	Engine_t GetEngine() const { return fEngine; }
+
+	/// Set how often diagnostics are handed to HandleDiagnostics()
+	void SetDiagnosticsSampling(uint32_t events, uint32_t seconds);
 
 protected:
-	/// Check whether the maximum size has been reached
-	bool IsFull() const { return MaxTimeDiff() > fMaxDelta; }
+	/// Check whether the earliest event is ready to be handled (by default, the maximum size has been reached)
+	bool IsFull() const;
 
 	/// Get trigger time difference between earliest and latest event
-	double MaxTimeDiff() const
-		{
-			if (fEvents.empty()) return 0.;
-			return fEvents.rbegin()->TimeDiff(*fEvents.begin());
-		}
+	double MaxTimeDiff() const;
 
 	/// Fill diagnostic information after a push.
 	void FillDiagnostics(tstamp::Diagnostics* d, double tdiff, bool have_coinc, int32_t singles_id, uint32_t evt_time);
 
+	/// Count an event towards the next diagnostics sample, returns true if it is due
+	bool DiagnosticsDue(uint32_t evt_time);
+
+	/// Calculate the rates and call HandleDiagnostics()
+	void EmitDiagnostics(tstamp::Diagnostics* d, uint32_t evt_time);
+
 private:
 	/// What to do in case of a coincidence event
 	virtual void HandleCoinc(const midas::Event& e1, const midas::Event& e2) const;
@@ -131,8 +176,17 @@ private:
 	/// What to do with a diagnostics event
 	virtual void HandleDiagnostics(tstamp::Diagnostics* diagnostics) const;
 
+	/// Internal helper function for pushing routines
+	void DoPush(midas::Event* event, tstamp::Diagnostics* diagnostics, uint64_t profileStart);
+
 	/// Internal helper function for flushing routines
 	void DoFlushEvent(tstamp::Diagnostics*);
+
+	/// Disallow copy
+	Queue(const Queue&);
+
+	/// Disallow assign
+	Queue& operator= (const Queue&);
 };
 
 
@@ -156,9 +210,9 @@ private:
 	T& fOwner;
 
 public:
-	/// Calls base constructor with maxDelta argument; sets fOwner
-	OwnedQueue(double maxDelta, T* owner):
-		tstamp::Queue(maxDelta), fOwner(*owner) { }
+	/// Calls base constructor with maxDelta and engine arguments; sets fOwner
+	OwnedQueue(double maxDelta, T* owner, Queue::Engine_t engine = Queue::kMultiSet):
+		tstamp::Queue(maxDelta, engine), fOwner(*owner) { }
 
 	/// Empty
 	~OwnedQueue() { }
@@ -179,13 +233,13 @@ private:
 
 /// "Creation" function for OwnedQueue<T>
 template <class T>
-inline OwnedQueue<T>* NewOwnedQueue(double maxDelta, T* owner)
+inline OwnedQueue<T>* NewOwnedQueue(double maxDelta, T* owner, Queue::Engine_t engine = Queue::kMultiSet)
 {
 	/*!
 	 * Allows one to create a \c new instance of OwnedQueue<T>
 	 * without having to explicitly specify the template parameter.
 	 */
-	return new OwnedQueue<T> (maxDelta, owner);
+	return new OwnedQueue<T> (maxDelta, owner, engine);
 }
 
 
@@ -203,6 +257,10 @@ class Diagnostics {
  * processed will be reflected in the state of the Diagnostics instance.
  * Information is also updated when flushing from the queue, but here
  * tims_diff is set to zero since no new events are incoming.
+ *
+ * \note The counters are updated for every event, but the rates only when
+ * the queue hands the diagnostics on, at the cadence set by
+ * Queue::SetDiagnosticsSampling().
  */
 public:
 	/// Initial event time (begin of run)
@@ -233,6 +291,10 @@ public:
 	 *  time difference specified for the queue. */
 	double time_diff;
 
+	/// Number of rate-limited error and warning messages since the start of the run
+	/*! Counted whether or not they were printed, see dragon::utils::MessageLimit */
+	uint64_t n_errors;
+
 public:
 	/// Set all data to defaults
 	Diagnostics();
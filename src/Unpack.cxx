@@ -4,17 +4,55 @@
 /// \brief Implements Unpack.hxx
 ///
 #include "utils/definitions.h"
+#include "utils/EventCache.hxx"
 #include "midas/Event.hxx"
 #include "midas/Database.hxx"
 #include "TStamp.hxx"
 #include "Dragon.hxx"
+#include "Sonik.hxx"
 #include "Unpack.hxx"
 
 
 
 
+// ============ class dragon::UnpackedCodes ================ //
+
+std::vector<int32_t> dragon::UnpackedCodes::GetCodes() const
+{
+	std::vector<int32_t> codes;
+	for (int32_t code = 0; code< kMaxCode; ++code)
+		if (Test(code)) codes.push_back(code);
+	return codes;
+}
+
+
 // ============ class dragon::Unpacker ================ //
 
+namespace {
+
+dragon::utils::MessageLimit gUnknownIdLimit("dragon::Unpacker: unknown event id");
+dragon::utils::MessageLimit gBadCoincLimit("dragon::Unpacker: invalid coincidence event");
+
+// Fill 'out' from the cached calculation of 'event' or, if there is none,
+// calculate it and store it in the cache for 'single' to take. Events are
+// only shared if 'single' calculates the same parameters as 'out'.
+template <class T>
+void unpack_shared(dragon::utils::EventCache<T>& cache, const midas::Event& event, T& out, const T& single)
+{
+	const bool share = single.can_copy_event(out);
+	const T* cached = share ? cache.Find(event.GetSerialNumber()) : 0;
+	if (cached) {
+		out.copy_event(*cached);
+		return;
+	}
+	out.reset();
+	out.unpack(event);
+	out.calculate();
+	if (share) cache.Put(event.GetSerialNumber(), out);
+}
+
+}
+
 dragon::Unpacker::Unpacker(dragon::Head* head,
 						   dragon::Tail* tail,
 						   dragon::Coinc* coinc,
@@ -35,7 +73,11 @@ dragon::Unpacker::Unpacker(dragon::Head* head,
 	fTailScaler(sctail),
 	fAuxScaler(scaux),
 	fRunpar(runpar),
-	fDiag(tsdiag)
+	fDiag(tsdiag),
+	fDelegate(0),
+	fSonik(0),
+	fHeadCache(new utils::EventCache<Head>()),
+	fTailCache(new utils::EventCache<Tail>())
 {
 	if(!singlesMode)
 		fQueue.reset(new tstamp::OwnedQueue<dragon::Unpacker>(kQueueTimeDefault*1e6, this));
@@ -54,7 +96,7 @@ void dragon::Unpacker::FlushQueue(int flushTime)
 size_t dragon::Unpacker::FlushQueueIterative()
 {
 	/// \returns The size of the queue after removing the front event
-	fUnpacked.clear();
+	fUnpacked.Clear();
 	return fQueue->FlushIterative(fDiag);
 }
 
@@ -66,6 +108,10 @@ void dragon::Unpacker::HandleBor(const char* dbname)
 	fAuxScaler->reset();
 	fRunpar->reset();
 	fDiag->reset();
+	utils::MessageLimit::ResetAll(); /// - Restart the counts of rate-limited messages.
+	fHeadCache->Clear();
+	fTailCache->Clear();
+	if (fSonik) fSonik->reset();
 
 	/// - Read variables from the database corresponding to \e dbname (skip if dbname is NULL)
 	if (dbname) {
@@ -81,68 +127,123 @@ void dragon::Unpacker::HandleBor(const char* dbname)
 			// Set sux scaler only if it's in the file
 			if(db.CheckPath("/Equipment/AuxScaler/Settings/Route"))
 				fAuxScaler->set_variables (&db, "aux" );
+
+			// Likewise SONIK, which keeps its defaults otherwise
+			if(fSonik && db.CheckPath("/sonik/variables"))
+				fSonik->set_variables(&db);
 		}
 	}
 }
 
 void dragon::Unpacker::UnpackHead(const midas::Event& event)
 {
-	fHead->reset();       /// - Reset the class to default values.
-	fHead->unpack(event); /// - Read raw data from the MIDAS event.
-	fHead->calculate();   /// - Calculate abstract parameters.
-	fUnpacked.push_back(DRAGON_HEAD_EVENT);
+	if (fDelegate) {      /// - Forward to the delegate, if set; otherwise:
+		fDelegate->UnpackHead(event);
+		fUnpacked.Set(DRAGON_HEAD_EVENT);
+		return;
+	}
+	/// - Take the event calculated already for a coincidence, if any; otherwise:
+	if (!fHeadCache->Take(event.GetSerialNumber(), *fHead)) {
+		fHead->reset();       /// - Reset the class to default values.
+		fHead->unpack(event); /// - Read raw data from the MIDAS event.
+		fHead->calculate();   /// - Calculate abstract parameters.
+	}
+	fUnpacked.Set(DRAGON_HEAD_EVENT);
 }
 
 void dragon::Unpacker::UnpackTail(const midas::Event& event)
 {
-	fTail->reset();       /// - Reset the class to default values.
-	fTail->unpack(event); /// - Read raw data from the MIDAS event.
-	fTail->calculate();   /// - Calculate abstract parameters.
-	fUnpacked.push_back(DRAGON_TAIL_EVENT);
+	if (fDelegate) {      /// - Forward to the delegate, if set; otherwise:
+		fDelegate->UnpackTail(event);
+		fUnpacked.Set(DRAGON_TAIL_EVENT);
+		if (fSonik) fUnpacked.Set(DRAGON_SONIK_EVENT);
+		return;
+	}
+	/// - Take the event calculated already for a coincidence, if any; otherwise:
+	if (!fTailCache->Take(event.GetSerialNumber(), *fTail)) {
+		fTail->reset();       /// - Reset the class to default values.
+		fTail->unpack(event); /// - Read raw data from the MIDAS event.
+		fTail->calculate();   /// - Calculate abstract parameters.
+	}
+	fUnpacked.Set(DRAGON_TAIL_EVENT);
+
+	/// - If enabled, calculate the SONIK event from the tail's VME modules.
+	if (fSonik) {
+		fSonik->reset();
+		fSonik->read_data(fTail->v785, fTail->v1190);
+		fSonik->calculate();
+		fUnpacked.Set(DRAGON_SONIK_EVENT);
+	}
 }
 
 void dragon::Unpacker::UnpackCoinc(const midas::CoincEvent& event)
 {
-	fCoinc->reset();       /// - Reset the class to default values.
-	fCoinc->unpack(event); /// - Read raw data from the MIDAS event.
-	fCoinc->calculate();   /// - Calculate abstract parameters.
-	fUnpacked.push_back(DRAGON_COINC_EVENT);
+	if (fDelegate) {       /// - Forward to the delegate, if set; otherwise:
+		fDelegate->UnpackCoinc(event);
+		fUnpacked.Set(DRAGON_COINC_EVENT);
+		return;
+	}
+	/// - Calculate the head and tail parts, or reuse them if calculated for an earlier
+	///   coincidence; they are kept until handled as singles.
+	unpack_shared(*fHeadCache, *event.fGamma, fCoinc->head, *fHead);
+	unpack_shared(*fTailCache, *event.fHeavyIon, fCoinc->tail, *fTail);
+	fCoinc->calculate_coinc(); /// - Calculate coincidence parameters.
+	fUnpacked.Set(DRAGON_COINC_EVENT);
 }
 
 void dragon::Unpacker::UnpackEpics(const midas::Event& event)
 {
 	fEpics->reset();       /// - Reset the class to default values.
 	fEpics->unpack(event); /// - Read raw data from the MIDAS event.
-	fUnpacked.push_back(DRAGON_EPICS_EVENT);
+	fUnpacked.Set(DRAGON_EPICS_EVENT);
 }
 
 void dragon::Unpacker::UnpackHeadScaler(const midas::Event& event)
 {
 	fHeadScaler->unpack(event); /// - Read scaler data from the midas event
-	fUnpacked.push_back(DRAGON_HEAD_SCALER);
+	fUnpacked.Set(DRAGON_HEAD_SCALER);
 }
 
 void dragon::Unpacker::UnpackTailScaler(const midas::Event& event)
 {
 	fTailScaler->unpack(event); /// - Read scaler data from the midas event
-	fUnpacked.push_back(DRAGON_TAIL_SCALER);
+	fUnpacked.Set(DRAGON_TAIL_SCALER);
 }
 
 void dragon::Unpacker::UnpackAuxScaler(const midas::Event& event)
 {
 	fAuxScaler->unpack(event); /// - Read scaler data from the midas event
-	fUnpacked.push_back(DRAGON_AUX_SCALER);
+	fUnpacked.Set(DRAGON_AUX_SCALER);
 }
 
 void dragon::Unpacker::UnpackRunParameters(const midas::Database& db)
 {
 	fRunpar->read_data(&db); /// - Calculate run parameters from an ODB dump event
-	fUnpacked.push_back(DRAGON_RUN_PARAMETERS);
+	fUnpacked.Set(DRAGON_RUN_PARAMETERS);
+}
+
+const char* const* dragon::Unpacker::GetOdbSubtrees()
+{
+	/*!
+	 * Everything the analysis classes read from the ODB: the run parameters, the
+	 * variables in /dragon and /sonik and the equipment settings (EPICS channel
+	 * names, aux scaler routing). Reading only these from a dump skips the bulk
+	 * of it (e.g. equipment variables and statistics, programs, history).
+	 */
+	static const char* const subtrees[] = {
+		"/Runinfo",
+		"/Experiment/Run Parameters",
+		"/dragon",
+		"/sonik",
+		"/Equipment/*/Settings",
+		0
+	};
+	return subtrees;
 }
 
-std::vector<int32_t> dragon::Unpacker::UnpackMidasEvent(void* header, char* data)
+const dragon::UnpackedCodes& dragon::Unpacker::Unpack(void* header, char* data)
 {
-	fUnpacked.clear();
+	fUnpacked.Clear();
 	midas::Event::Header* evtHeader = reinterpret_cast<midas::Event::Header*>(header);
 	switch (evtHeader->fEventId)
 		{
@@ -153,8 +254,7 @@ std::vector<int32_t> dragon::Unpacker::UnpackMidasEvent(void* header, char* data
 					UnpackHead(event);
 				}
 				else {
-					midas::Event event(header, data, evtHeader->fDataSize, fHead->variables.bk_tsc, GetCoincWindow());
-					fQueue->Push(event, fDiag);
+					fQueue->Push(header, data, evtHeader->fDataSize, fHead->variables.bk_tsc, GetCoincWindow(), fDiag);
 				}
 				break;
 			}
@@ -165,8 +265,7 @@ std::vector<int32_t> dragon::Unpacker::UnpackMidasEvent(void* header, char* data
 					UnpackTail(event);
 				}
 				else {
-					midas::Event event(header, data, evtHeader->fDataSize, fTail->variables.bk_tsc, GetCoincWindow());
-					fQueue->Push(event, fDiag);
+					fQueue->Push(header, data, evtHeader->fDataSize, fTail->variables.bk_tsc, GetCoincWindow(), fDiag);
 				}
 				break;
 			}
@@ -200,25 +299,21 @@ std::vector<int32_t> dragon::Unpacker::UnpackMidasEvent(void* header, char* data
 				break;
 			}
 		case MIDAS_BOR:
-			{
-				midas::Database db(data, evtHeader->fDataSize);
-				UnpackRunParameters(db);
-				break;
-			}
 		case MIDAS_EOR:
 			{
-				midas::Database db(data, evtHeader->fDataSize);
+				midas::Database db(data, evtHeader->fDataSize, GetOdbSubtrees());
 				UnpackRunParameters(db);
 				break;
 			}
 		default:
 			{
-				utils::Warning("UnpackBuffer", __FILE__, __LINE__)
-					<< "Unkonwn event ID: " << evtHeader->fEventId;
+				if (gUnknownIdLimit.Check())
+					utils::Warning("UnpackBuffer", __FILE__, __LINE__)
+						<< "Unkonwn event ID: " << evtHeader->fEventId << gUnknownIdLimit.Note();
 				break;
 			}
 		}
-	/// \returns The result of GetUnpackedCodes() after this event
+	/// \returns The set of codes unpacked from this event (also available from GetUnpacked())
 	return fUnpacked;
 }
 
@@ -236,8 +331,9 @@ void dragon::Unpacker::Process(const midas::Event& event)
 			break;
 
 		default:
-			utils::Error("utils::Unpacker::Process", __FILE__, __LINE__)
-				<< "Unknown event id: " << event.GetEventId() << ", skipping...\n";
+			if (gUnknownIdLimit.Check())
+				utils::Error("utils::Unpacker::Process", __FILE__, __LINE__)
+					<< "Unknown event id: " << event.GetEventId() << ", skipping..." << gUnknownIdLimit.Note() << "\n";
 			break;
 		}
 }
@@ -247,8 +343,9 @@ void dragon::Unpacker::Process(const midas::Event& event1, const midas::Event& e
 	midas::CoincEvent coincEvent(event1, event2);
 
 	if (coincEvent.fHeavyIon == 0 || coincEvent.fGamma == 0) {
-		dragon::utils::Error("utils::unpacker::Process", __FILE__, __LINE__)
-			<< "Invalid coincidence event, skipping...\n";
+		if (gBadCoincLimit.Check())
+			dragon::utils::Error("utils::unpacker::Process", __FILE__, __LINE__)
+				<< "Invalid coincidence event, skipping..." << gBadCoincLimit.Note() << "\n";
 		return;
 	}
 
@@ -257,5 +354,5 @@ void dragon::Unpacker::Process(const midas::Event& event1, const midas::Event& e
 
 void dragon::Unpacker::Process(tstamp::Diagnostics*)
 {
-	fUnpacked.push_back(DRAGON_TSTAMP_DIAGNOSTICS);
+	fUnpacked.Set(DRAGON_TSTAMP_DIAGNOSTICS);
 }
@@ -18,14 +18,87 @@ class Coinc;
 class Epics;
 class Scaler;
 class RunParameters;
+namespace utils { template <class T> class EventCache; }
 }
+class Sonik;
 
 namespace dragon {
 
+///
+/// Set of event codes filled by one call to Unpacker::UnpackMidasEvent()
+/*!
+ * Stored as a bitmask over the event codes 0 - 31 (all of the codes defined in
+ * definitions.h except MIDAS_BOR/EOR, which are never reported), so recording
+ * and testing a code are O(1) and no memory is allocated per event.
+ */
+class UnpackedCodes {
+public:
+	/// One more than the largest event code that can be stored
+	static const int32_t kMaxCode = 32;
+	///
+	/// Empty set
+	UnpackedCodes(): fMask(0) { }
+	///
+	/// Remove all codes
+	void Clear() { fMask = 0; }
+	///
+	/// Add an event code (ignored if outside [0, kMaxCode))
+	void Set(int32_t code)
+		{ if (code >= 0 && code < kMaxCode) fMask |= (1u << code); }
+	///
+	/// Check if an event code is present
+	bool Test(int32_t code) const
+		{ return code >= 0 && code < kMaxCode && (fMask & (1u << code)); }
+	///
+	/// Check if no codes are present
+	bool Empty() const { return fMask == 0; }
+	///
+	/// Returns the raw bitmask (bit \e n set if code \e n is present)
+	uint32_t GetMask() const { return fMask; }
+	///
+	/// Returns the codes present, in ascending order
+	std::vector<int32_t> GetCodes() const;
+#ifndef __MAKECINT__
+	///
+	/// Call <tt>visitor(int32_t code)</tt> for each code present, in ascending order
+	template <class V> void Visit(V& visitor) const
+		{
+			for (uint32_t mask = fMask, code = 0; mask; mask >>= 1, ++code)
+				if (mask & 1u) visitor(static_cast<int32_t>(code));
+		}
+#endif
+private:
+	/// Bit \e n set if code \e n was unpacked
+	uint32_t fMask;
+};
+
 ///
 /// Handles unpacking event data
 class Unpacker {
 public:
+	///
+	/// Interface to hand off the unpacking of head, tail and coincidence events
+	/*!
+	 * When a delegate is set (see SetDelegate()), UnpackHead(), UnpackTail() and
+	 * UnpackCoinc() forward their event to it instead of unpacking into the
+	 * external classes; the event codes are recorded as usual. This allows the
+	 * (expensive) unpack() and calculate() work to be done elsewhere, e.g. in
+	 * worker threads, while timestamp matching and scaler unpacking stay in order.
+	 * The event references are only valid for the duration of the call. With
+	 * SONIK unpacking enabled (see SetSonik()), UnpackTail() also stands in for
+	 * the SONIK calculation, which the delegate does from the same tail event.
+	 */
+	class Delegate {
+	public:
+		/// Empty
+		virtual ~Delegate() { }
+		/// Called in place of unpacking a head singles event
+		virtual void UnpackHead(const midas::Event& event) = 0;
+		/// Called in place of unpacking a tail singles event
+		virtual void UnpackTail(const midas::Event& event) = 0;
+		/// Called in place of unpacking a coincidence event
+		virtual void UnpackCoinc(const midas::CoincEvent& event) = 0;
+	};
 	///
 	/// Sets pointers to container classes, initializes fQueue
 	Unpacker(dragon::Head* head,
@@ -66,6 +139,9 @@ public:
 	///  Returns the event codes of unpacked events
 	std::vector<int32_t> GetUnpackedCodes() const;
 	///
+	/// Returns the set of unpacked event codes, without copying
+	const UnpackedCodes& GetUnpacked() const;
+	///
 	/// Perform actions at the beginning of a run
 	void HandleBor(const char* dbname);
 	///
@@ -90,6 +166,15 @@ public:
 	/// Set the queue buffering time
 	void SetQueueTime(double t);
 	///
+	/// Select the timestamp matching algorithm (storage engine of the queue)
+	void SetQueueEngine(tstamp::Queue::Engine_t engine);
+	///
+	/// Hand off head, tail and coincidence unpacking to an external delegate
+	void SetDelegate(Delegate* delegate);
+	///
+	/// Also calculate SONIK events from tail events, into \e sonik (NULL = none)
+	void SetSonik(Sonik* sonik);
+	///
 	/// Unpack a head event into fHead
 	void UnpackHead(const midas::Event& event);
 	///
@@ -114,11 +199,22 @@ public:
 	/// Unpack run parameters into fRunpar
 	void UnpackRunParameters(const midas::Database& db);
 	///
+	/// ODB directories read from BOR and EOR dumps (NULL terminated, see midas::OdbSnapshot::Scan())
+	static const char* const* GetOdbSubtrees();
+	///
 	/// Unpack a generic midas event (from full data buffer)
 	std::vector<int32_t> UnpackMidasEvent(char* databuf);
 	///
 	/// Unpack a generic midas event (from header + data)
 	std::vector<int32_t> UnpackMidasEvent(void* header, char* data);
+	///
+	/// Unpack a generic midas event (from header + data), returning the unpacked codes as a set
+	const UnpackedCodes& Unpack(void* header, char* data);
+#ifndef __MAKECINT__
+	///
+	/// Unpack a generic midas event, then call \e visitor for each unpacked code
+	template <class V> const UnpackedCodes& Unpack(void* header, char* data, V& visitor);
+#endif
 
 private:
 	/// Default queue time in seconds
@@ -129,8 +225,8 @@ private:
 	double fCoincWindow;
 	///	Timestamp queue for coincidence matching
 	std::auto_ptr<tstamp::Queue> fQueue;
-	/// Container of event codes of unpacked events
-	std::vector<int32_t> fUnpacked;
+	/// Event codes of unpacked events
+	UnpackedCodes fUnpacked;
 	/// Pointer to _external_ head class
 	dragon::Head* fHead;
 	/// Pointer to _external_ tail class
@@ -149,6 +245,14 @@ private:
 	dragon::RunParameters* fRunpar;
 	/// Pointer to _external_ timestamp diagnostics class
 	tstamp::Diagnostics* fDiag;
+	/// Pointer to _external_ unpacking delegate (NULL = unpack here)
+	Delegate* fDelegate;
+	/// Pointer to _external_ SONIK class (NULL = no SONIK events)
+	Sonik* fSonik;
+	/// Head events calculated for coincidences, reused when they are handled as singles
+	std::auto_ptr<utils::EventCache<Head> > fHeadCache;
+	/// Tail events calculated for coincidences, reused when they are handled as singles
+	std::auto_ptr<utils::EventCache<Tail> > fTailCache;
 };
 
 } // namespace dragon
@@ -181,6 +285,34 @@ inline void dragon::Unpacker::SetQueueTime(double t)
 	fQueue->SetMaxDelta(t*1e6);
 }
 
+inline void dragon::Unpacker::SetQueueEngine(tstamp::Queue::Engine_t engine)
+{
+	/// Replaces the queue, keeping the queue time. Any events in the queue are
+	/// flushed first, and the diagnostics sampling is reset to the default, so
+	/// call this before setting it. No effect in singles mode.
+	/// \note tstamp::Queue::kMergeJoin only handles events once they can have no
+	///  further matches, which for time-ordered head and tail streams is much
+	///  sooner than the queue time.
+	if(IsSinglesMode() || fQueue->GetEngine() == engine) return;
+	const double maxDelta = fQueue->GetMaxDelta();
+	FlushQueue();
+	fQueue.reset(new tstamp::OwnedQueue<Unpacker>(maxDelta, this, engine));
+}
+
+inline void dragon::Unpacker::SetDelegate(Delegate* delegate)
+{
+	/// \param delegate Pointer to the delegate, which is not owned by the
+	///  unpacker. Passing NULL restores normal unpacking.
+	fDelegate = delegate;
+}
+
+inline void dragon::Unpacker::SetSonik(Sonik* sonik)
+{
+	/// \param sonik Pointer to the SONIK class, which is not owned by the
+	///  unpacker. Its variables are read by HandleBor(), so call this first.
+	fSonik = sonik;
+}
+
 inline void dragon::Unpacker::SetSinglesMode(int qFlush)
 {
 	/// Any incoming events after this call are processed as singles only.
@@ -209,13 +341,32 @@ inline std::vector<int32_t> dragon::Unpacker::UnpackMidasEvent(char* databuf)
 	return UnpackMidasEvent(databuf, databuf + sizeof(midas::Event::Header));
 }
 
+inline std::vector<int32_t> dragon::Unpacker::UnpackMidasEvent(void* header, char* data)
+{
+	/// Forward all work to Unpack(void*, char*)
+	/// \returns The result of GetUnpackedCodes() after this event
+	return Unpack(header, data).GetCodes();
+}
+
+#ifndef __MAKECINT__
+template <class V>
+inline const dragon::UnpackedCodes& dragon::Unpacker::Unpack(void* header, char* data, V& visitor)
+{
+	/// \param visitor Object or function called as <tt>visitor(int32_t code)</tt> for
+	///  each unpacked code, in ascending order.
+	/// \returns The set of unpacked codes
+	Unpack(header, data).Visit(visitor);
+	return fUnpacked;
+}
+#endif
+
 inline void
 dragon::Unpacker::ClearUnpackedCodes()
 {
 	/// Needed when the unpack routines are called implicitly, for example
 	/// during a queue flush which calls Process(), not UnpackEvent()
 
-	fUnpacked.clear();
+	fUnpacked.Clear();
 }
 
 inline std::vector<int32_t>
@@ -227,7 +378,16 @@ dragon::Unpacker::GetUnpackedCodes() const
 	/// a class structure. This function allows the caller to see what
 	/// those event codes are and, e.g. fill ROOT trees, ntuples, histograms,
 	/// etc. as appripriate.
+	///
+	/// \note Codes are listed once each, in ascending order. Use GetUnpacked()
+	///  to avoid copying into a vector.
 
+	return fUnpacked.GetCodes();
+}
+
+inline const dragon::UnpackedCodes&
+dragon::Unpacker::GetUnpacked() const
+{
 	return fUnpacked;
 }
 
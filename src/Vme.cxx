@@ -3,14 +3,37 @@
 /// \author G. Christian
 /// \brief Implements Vme.hxx
 ///
+#include <algorithm>
 #include "utils/ErrorDragon.hxx"
 #include "utils/Valid.hxx"
-#include "utils/Bits.hxx"
 #include "midas/Event.hxx"
 #include "Vme.hxx"
 
 namespace dutils = dragon::utils;
 
+namespace {
+dutils::MessageLimit gTrailerIdLimit("vme::V1190::unpack_footer_buffer: trailer event id mismatch");
+
+// V1190 error bits (0 - 13), as given in the manual
+const char* const gV1190Errors[15] = {
+	"Hit lost in group 0 from read-out FIFO overflow.",
+	"Hit lost in group 0 from L1 buffer overflow",
+	"Hit error have been detected in group 0.",
+	"Hit lost in group 1 from read-out FIFO overflow.",
+	"Hit lost in group 1 from L1 buffer overflow",
+	"Hit error have been detected in group 1.",
+	"Hit data lost in group 2 from read-out FIFO overflow.",
+	"Hit lost in group 2 from L1 buffer overflow",
+	"Hit error have been detected in group 2.",
+	"Hit lost in group 3 from read-out FIFO overflow.",
+	"Hit lost in group 3 from L1 buffer overflow",
+	"Hit error have been detected in group 3.",
+	"Hits rejected because of programmed event size limit",
+	"Event lost (trigger FIFO overflow).",
+	"Internal fatal chip error has been detected."
+};
+}
+
 
 
 // ================ Class vme::Io32 ================ //
@@ -53,25 +76,26 @@ bool vme::Io32::unpack(const midas::Event& event, const char* bankName, bool rep
 	 * \returns True if the event was successfully unpacked, false otherwise
 	 */
 	int bank_len;
-	const int expected_bank_len = 9;
 	uint32_t* pdata32 =
 		event.GetBankPointer<uint32_t>(bankName, &bank_len, reportMissing, true);
 
 	if (!pdata32) return false;
 
-	if (bank_len != expected_bank_len) {
+	if (bank_len != NUM_WORDS) {
 		dutils::Error("vme::Io32::unpack", __FILE__, __LINE__) <<
-			"Bank length: " << bank_len << " != 8, skipping..." << DRAGON_ERR_FILE_LINE;
+			"Bank length: " << bank_len << " != " << int(NUM_WORDS) << ", skipping..." << DRAGON_ERR_FILE_LINE;
 		return false;
 	}
 
-	uint32_t* data_fields[expected_bank_len]
-		= { &header, &trig_count, &tstamp, &start, &end,
-				&latency, &read_time, &busy_time, &trigger_latch };
-
-	for (int i=0; i< bank_len; ++i) {
-		*(data_fields[i]) = *pdata32++;
-	}
+	header        = pdata32[HEADER_WORD];
+	trig_count    = pdata32[TRIG_COUNT_WORD];
+	tstamp        = pdata32[TSTAMP_WORD];
+	start         = pdata32[START_WORD];
+	end           = pdata32[END_WORD];
+	latency       = pdata32[LATENCY_WORD];
+	read_time     = pdata32[READ_TIME_WORD];
+	busy_time     = pdata32[BUSY_TIME_WORD];
+	trigger_latch = pdata32[TRIGGER_LATCH_WORD];
 
 	// Unpck TSC4 from midas::Event storage
 	tsc4.trig_time = event.TriggerTime();
@@ -89,6 +113,11 @@ vme::V1190::V1190():
 	fMessagePeriod(0)
 {
 	///
+	for (int ch = 0; ch < MAX_CHANNELS; ++ch) {
+		channel[ch].nleading  = 0;
+		channel[ch].ntrailing = 0;
+	}
+	fNumTouched = 0;
 	reset();
 }
 
@@ -97,8 +126,6 @@ namespace { inline void reset_channel(vme::V1190::Channel* channel)
 	///
 	channel->nleading  = 0;
 	channel->ntrailing = 0;
-	channel->fLeading.clear();
-	channel->fTrailing.clear();
 }
 
 template <class T> class hitmatch {
@@ -119,14 +146,36 @@ int32_t get_hit_edge(ch_t ch, hit_t hit, const vch_t& vch, const vmeas_t& vmeas)
 	return ich != vch.end() ? *(vmeas.begin() + (ich - vch.begin())) : -1;
 } }
 
+int32_t vme::V1190::find_hit(const Fifo& fifo, int16_t ch, int16_t hit)
+{
+	return ::get_hit_edge(ch, hit, fifo.channel, fifo.measurement);
+}
+
 int32_t vme::V1190::get_leading(int16_t ch, int16_t hit) const
 {
-	return ::get_hit_edge(ch, hit, fifo0.channel, fifo0.measurement);
+	/*!
+	 * \param ch Channel number
+	 * \param hit Hit number, in order of arrival
+	 * \returns The measurement value, or -1 if there is no such hit
+	 *
+	 * The channel arrays are transient, so objects read back from a file (with no
+	 * channels touched) are searched in the FIFO instead.
+	 */
+	if (fNumTouched == 0) return find_hit(fifo0, ch, hit);
+	if (ch < 0 || ch >= MAX_CHANNELS || hit < 0 || hit >= channel[ch].nleading) return -1;
+	return hit < MAX_HITS ? channel[ch].fLeading[hit] : find_hit(fifo0, ch, hit);
 }
 
 int32_t vme::V1190::get_trailing(int16_t ch, int16_t hit) const
 {
-	return ::get_hit_edge(ch, hit, fifo1.channel, fifo1.measurement);
+	/*!
+	 * \param ch Channel number
+	 * \param hit Hit number, in order of arrival
+	 * \returns The measurement value, or -1 if there is no such hit
+	 */
+	if (fNumTouched == 0) return find_hit(fifo1, ch, hit);
+	if (ch < 0 || ch >= MAX_CHANNELS || hit < 0 || hit >= channel[ch].ntrailing) return -1;
+	return hit < MAX_HITS ? channel[ch].fTrailing[hit] : find_hit(fifo1, ch, hit);
 }
 
 void vme::V1190::Fifo::push_back(int32_t measurement_, int16_t channel_, int16_t number_)
@@ -147,9 +196,10 @@ void vme::V1190::Fifo::clear()
 
 void vme::V1190::reset()
 {
-	///
-	for (int ch = 0; ch < MAX_CHANNELS; ++ch)
-		::reset_channel( &(channel[ch]) );
+	/// Only channels hit in the previous event need resetting
+	for (int16_t i = 0; i< fNumTouched; ++i)
+		::reset_channel( &(channel[fTouched[i]]) );
+	fNumTouched = 0;
 
 	fifo0.clear();
 	fifo1.clear();
@@ -169,7 +219,7 @@ int32_t vme::V1190::get_data(int16_t ch) const
 	 */
 
 	if (ch >= 0 && ch < MAX_CHANNELS) {
-		if(!channel[ch].fLeading.empty())
+		if(channel[ch].nleading > 0)
 			return channel[ch].fLeading[0];
 		else
 			return dragon::NoData<int32_t>::value();
@@ -182,10 +232,10 @@ int32_t vme::V1190::get_data(int16_t ch) const
 	}
 }
 
-bool vme::V1190::unpack_data_buffer(const uint32_t* const pbuffer)
+inline bool vme::V1190::unpack_data_buffer(uint32_t word)
 {
 	/*!
-	 * \param [in] pbuffer Pointer to the data buffer word.
+	 * \param [in] word The data buffer word.
 	 *
 	 * A data buffer encodes the measurement value (i.e. the pulse time)
 	 * for a single TDC measurement. The TDC is multi-hit, so more than one measurement
@@ -194,35 +244,31 @@ bool vme::V1190::unpack_data_buffer(const uint32_t* const pbuffer)
 	 * See below for bitpacking instructions.
 	 */
 
-	type     = (*pbuffer >> 26) & READ1; /// - Bit 26 tells the measurement type (leading or trailing)
-	int ch   = (*pbuffer >> 19) & READ7; /// - Bits 19-25 tell the channel number
+	type     = Format::Edge::get(word);    /// - Bit 26 tells the measurement type (leading or trailing)
+	int ch   = Format::Channel::get(word); /// - Bits 19-25 tell the channel number
 	if (ch >= MAX_CHANNELS) {
 		dutils::Error("vme::V1190::unpack_data_buffer", __FILE__, __LINE__)
 			<< DRAGON_ERR_FILE_LINE << "Read a channel number (" << ch
 			<< ") which is >= the maximum (" << MAX_CHANNELS << "). Skipping...\n";
 		return false;
 	}
-	if ( !(type==1 || type == 0) ) {
-		dutils::Error("vme::V1190::unpack_data_buffer", __FILE__, __LINE__)
-			<< "\"type\" bitfield == " << type << ": Should be impossible, skipping event..."
-			<< DRAGON_ERR_FILE_LINE;
-		return false;
-	}
 
-	int32_t measurement = (*pbuffer >> 0) & READ19; /// - Bits 0 - 18 encode the measurement value
+	int32_t measurement = Format::Measurement::get(word); /// - Bits 0 - 18 encode the measurement value
+
+	Channel& chan = channel[ch];
+	if (chan.nleading == 0 && chan.ntrailing == 0) // first hit, remember for reset()
+		fTouched[fNumTouched++] = ch;
 
 	if (type == 0) // leading edge
 	{
-		channel[ch].fLeading.push_back(measurement);
+		if (chan.nleading < MAX_HITS) chan.fLeading[chan.nleading] = measurement;
+		fifo0.push_back(measurement, ch, ++chan.nleading);
 	}
 	else // trailing edge
-		channel[ch].fTrailing.push_back(measurement);
-
-	channel[ch].nleading  = channel[ch].fLeading.size();
-	channel[ch].ntrailing = channel[ch].fTrailing.size();
-
-	if(type == 0) fifo0.push_back(measurement, ch, channel[ch].nleading);
-	else          fifo1.push_back(measurement, ch, channel[ch].ntrailing);
+	{
+		if (chan.ntrailing < MAX_HITS) chan.fTrailing[chan.ntrailing] = measurement;
+		fifo1.push_back(measurement, ch, ++chan.ntrailing);
+	}
 
 	return true;
 }
@@ -236,13 +282,13 @@ void vme::V1190::unpack_footer_buffer(const uint32_t* const pbuffer, const char*
 	 *
 	 * See below for the bitpacking instructions and what we read.
 	 */
-	word_count = (*pbuffer >> 0) & READ12; /// Bits 0 - 11 are the event counter (word_count)
-	int16_t evtId = (*pbuffer >> 12) & READ12;
-	if(evtId != event_id) { /// Bits 12 - 23 are the event id (event_id), check for consistency w/ header
-		std::cerr << DRAGON_ERR_FILE_LINE;
+	word_count = Format::WordCount::get(*pbuffer); /// Bits 0 - 11 are the event counter (word_count)
+	int16_t evtId = Format::EventId::get(*pbuffer);
+	if(evtId != event_id && gTrailerIdLimit.Check()) { /// Bits 12 - 23 are the event id (event_id), check for consistency w/ header
 		dutils::Warning("vme::V1190::unpack_footer_buffer")
 			<< DRAGON_ERR_FILE_LINE << "Bank name: \"" << bankName << "\": "
-			<< "Trailer event id (" << evtId << ") != header event Id (" << event_id << ")\n";
+			<< "Trailer event id (" << evtId << ") != header event Id (" << event_id << ")"
+			<< gTrailerIdLimit.Note() << "\n";
 	}
 }
 
@@ -255,32 +301,14 @@ void vme::V1190::handle_error_buffer(const uint32_t* const pbuffer, const char*
 	 * \param [in] pbuffer Pointer to the error buffer longword
 	 * \param [in] bankName Name of the MIDAS bank containing the data in question
 	 */
-	std::string errors[15] = {
-		"Hit lost in group 0 from read-out FIFO overflow.",
-		"Hit lost in group 0 from L1 buffer overflow",
-		"Hit error have been detected in group 0.",
-		"Hit lost in group 1 from read-out FIFO overflow.",
-		"Hit lost in group 1 from L1 buffer overflow",
-		"Hit error have been detected in group 1.",
-		"Hit data lost in group 2 from read-out FIFO overflow.",
-		"Hit lost in group 2 from L1 buffer overflow",
-		"Hit error have been detected in group 2.",
-		"Hit lost in group 3 from read-out FIFO overflow.",
-		"Hit lost in group 3 from L1 buffer overflow",
-		"Hit error have been detected in group 3.",
-		"Hits rejected because of programmed event size limit",
-		"Event lost (trigger FIFO overflow).",
-		"Internal fatal chip error has been detected."
-	};
-
-	for(int i=0; i< 14; ++i) {
-		if((*pbuffer >> i) & READ1) {
+	for(int i=0; i< Format::NUM_ERROR_BITS; ++i) {
+		if((*pbuffer >> i) & 1) {
 			error = i; // set error code
 
 			dutils::ADelayedMessagePrinter* msg = dutils::gDelayedMessageFactory.Get(this, i);
 			if(!msg) {
 				std::stringstream temp;
-				temp << "TDC error (bank \"" << bankName << "\", addr " << this << "): " << errors[i];
+				temp << "TDC error (bank \"" << bankName << "\", addr " << this << "): " << gV1190Errors[i];
 				msg = dutils::gDelayedMessageFactory.Register<dutils::Error>
 					(this, i, "vme::V1190::handle_error_buffer", fMessagePeriod, __FILE__, __LINE__, temp.str().c_str());
 			}
@@ -301,25 +329,25 @@ bool vme::V1190::unpack_buffer(const uint32_t* const pbuffer, const char* bankNa
 	 * in the buffer. In this function, we read the buffer type and then handle appropriately.
 	 */
 	bool success = true;
-	uint32_t type = (*pbuffer >> 27) & READ5;
+	uint32_t type = Format::Type::get(*pbuffer);
 
 	switch (type) {
 	case GLOBAL_HEADER:  /// case GLOBAL_HEADER: read event counter from bits 5 - 26
-		count = (*pbuffer >> 5) & READ22;
+		count = Format::EventCount::get(*pbuffer);
 		break;
 	case GLOBAL_TRAILER: /// case GLOBAL_TRAILER: read status word from bits 24-26 and word count from bits 5-21
-		status = (*pbuffer >> 24) & READ3;
-		trailer_word_count = (*pbuffer >> 5) & READ16;
+		status = Format::Status::get(*pbuffer);
+		trailer_word_count = Format::TrailerWordCount::get(*pbuffer);
 		break;
 	case EXTENDED_TRIGGER_TIME: /// case EXTENDED_TRIGGER_TIME: read extended trigger from bits 0 - 26
-		extended_trigger = (*pbuffer >> 0) & READ27;
+		extended_trigger = Format::ExtendedTrigger::get(*pbuffer);
 		break;
 	case TDC_HEADER: /// case TDC_HEADER: read bunch id from bits 0 - 12, event id from bits 12 - 23
-		bunch_id = (*pbuffer >> 0)  & READ12;
-		event_id = (*pbuffer >> 12) & READ12;
+		bunch_id = Format::BunchId::get(*pbuffer);
+		event_id = Format::EventId::get(*pbuffer);
 		break;
 	case TDC_MEASUREMENT: /// case TDC_MEASUREMENT: See unpack_data_buffer()
-		success = unpack_data_buffer(pbuffer);
+		success = unpack_data_buffer(*pbuffer);
 		break;
 	case TDC_ERROR:   /// case TDC_ERROR: See handle_error_buffer()
 		handle_error_buffer(pbuffer, bankName);
@@ -350,14 +378,40 @@ bool vme::V1190::unpack(const midas::Event& event, const char* bankName, bool re
 	int bank_len;
 	uint32_t* pbank32 =
 		event.GetBankPointer<uint32_t>(bankName, &bank_len, reportMissing, true);
+	if (!pbank32) return true;
 
+#ifndef VME_SCALAR_UNPACK
+	return unpack_bank(pbank32, bank_len, bankName);
+#else
 	// Loop over all data words in the bank
 	bool ret = true;
 	for (int i=0; i< bank_len; ++i) {
 		bool success = unpack_buffer(pbank32++, bankName);
 		if(!success) ret = false;
 	}
+	return ret;
+#endif
+}
 
+bool vme::V1190::unpack_bank(const uint32_t* pbank, int bank_len, const char* bankName)
+{
+	/*!
+	 * Same result as calling unpack_buffer() on each word. Measurements, which are
+	 * nearly all of the words, are decoded inline; only the other buffer types go
+	 * through the switch in unpack_buffer().
+	 *
+	 * \param [in] pbank Pointer to the first word of the bank
+	 * \param [in] bank_len Number of words in the bank
+	 * \param [in] bankName Name of the midas bank being unpacked
+	 * \returns True if the bank was successfully unpacked, false otherwise
+	 */
+	bool ret = true;
+	for (int i=0; i< bank_len; ++i) {
+		const uint32_t word = pbank[i];
+		const bool success = Format::Type::get(word) == TDC_MEASUREMENT ?
+			unpack_data_buffer(word) : unpack_buffer(pbank + i, bankName);
+		if(!success) ret = false;
+	}
 	return ret;
 }
 
@@ -404,16 +458,16 @@ bool vme::V792::unpack_data_buffer(const uint32_t* const pbuffer)
 	 * A data buffer encodes the conversion value (i.e. integrated charge or peak pulse height)
 	 * for a single ADC channel. See below for bitpacking instructions.
 	 */
-	overflow     = (*pbuffer >> 12) & READ1; /// Bit 12 is an overflow tag
-	underflow    = (*pbuffer >> 13) & READ1; /// Bit 13 is an underflow tag
-	uint16_t ch  = (*pbuffer >> 16) & READ5; /// Bits 16-20 tell the channel number of the conversion
+	overflow     = Format::Overflow::get(*pbuffer);  /// Bit 12 is an overflow tag
+	underflow    = Format::Underflow::get(*pbuffer); /// Bit 13 is an underflow tag
+	uint16_t ch  = Format::Channel::get(*pbuffer);   /// Bits 16-20 tell the channel number of the conversion
 	if (ch >= MAX_CHANNELS) {
 		dutils::Error("vme::V792::unpack_data_buffer", __FILE__, __LINE__)
 			<< DRAGON_ERR_FILE_LINE << "Read a channel number (" << ch
 			<< ") which is >= the maximum (" << MAX_CHANNELS << "). Skipping...\n";
 		return false;
 	}
-	data[ch]  = (*pbuffer >> 0) & READ12; /// Bits 0 - 11 encode the converted value
+	data[ch]  = Format::Value::get(*pbuffer); /// Bits 0 - 11 encode the converted value
 	return true;
 }
 
@@ -428,17 +482,17 @@ bool vme::V792::unpack_buffer(const uint32_t* const pbuffer, const char* bankNam
 	 * in the buffer. In this function, we read the buffer type and then handle appropriately.
 	 */
 	bool success = true;
-	uint32_t type = (*pbuffer >> 24) & READ3;
+	uint32_t type = Format::Type::get(*pbuffer);
 
 	switch (type) {
 	case DATA_BITS:    /// case DATA_BITS : See unpack_data_buffer()
 		success = unpack_data_buffer(pbuffer);
 		break;
 	case HEADER_BITS:  /// case HEADER_BITS: read number of channels (n_ch) in the event from bits 6 - 13
-		n_ch  = (*pbuffer >> 6) & READ8;
+		n_ch  = Format::NumChannels::get(*pbuffer);
 		break;
 	case FOOTER_BITS:  /// case FOOTER_BITS: read event counter (count) from bits 0 - 23
-		count = (*pbuffer >> 0) & READ24;
+		count = Format::Count::get(*pbuffer);
 		break;
 	case INVALID_BITS: /// case INVALID_BITS: bail out
 		dutils::Error("vme::V792::unpack_buffer", __FILE__, __LINE__)
@@ -471,7 +525,11 @@ bool vme::V792::unpack(const midas::Event& event, const char* bankName, bool rep
 	int bank_len;
 	uint32_t* pbank32 =
 		event.GetBankPointer<uint32_t>(bankName, &bank_len, reportMissing, true);
+	if (!pbank32) return true;
 
+#ifndef VME_SCALAR_UNPACK
+	return unpack_bank(pbank32, bank_len, bankName);
+#else
 	// Loop over all data words in the bank
 	bool ret = true;
 	for (int i=0; i< bank_len; ++i) {
@@ -479,4 +537,69 @@ bool vme::V792::unpack(const midas::Event& event, const char* bankName, bool rep
 		if(!success) ret = false;
 	}
 	return ret;
+#endif
+}
+
+namespace {
+// Branch-free decode of a bank of CAEN ADC words (see vme::V792::unpack_bank()),
+// for any module class M with the buffer type codes of vme::V792, its bit layout
+// given by M::Format and M::MAX_CHANNELS. values has M::MAX_CHANNELS + 1 elements,
+// the last a scratch slot. Returns the number of invalid words.
+template <class M>
+int decode_adc_bank(const uint32_t* pbank, int bank_len, int16_t* values,
+										int32_t& nch, int32_t& cnt, bool& over, bool& under)
+{
+	typedef typename M::Format F;
+	int nbad = 0;
+	for (int i=0; i< bank_len; ++i) {
+		const uint32_t word = pbank[i];
+		const uint32_t type = F::Type::get(word);
+		const uint32_t ch   = F::Channel::get(word);
+		const bool isData   = (type == M::DATA_BITS) && ch < M::MAX_CHANNELS;
+
+		values[isData ? ch : M::MAX_CHANNELS] = F::Value::get(word);
+		over  = isData ? F::Overflow::get(word)  : over;
+		under = isData ? F::Underflow::get(word) : under;
+		nch   = (type == M::HEADER_BITS) ? (int32_t)F::NumChannels::get(word) : nch;
+		cnt   = (type == M::FOOTER_BITS) ? (int32_t)F::Count::get(word) : cnt;
+		nbad += !(isData || type == M::HEADER_BITS || type == M::FOOTER_BITS);
+	}
+	return nbad;
+} }
+
+bool vme::V792::unpack_bank(const uint32_t* pbank, int bank_len, const char* bankName)
+{
+	/*!
+	 * Same result as calling unpack_buffer() on each word, but without branching on
+	 * the buffer type: every word is decoded as if it were data, and written either
+	 * to its channel or (for non-data words) to a scratch slot; header and footer
+	 * fields are updated with conditional selects. Invalid words are only counted,
+	 * and checked once at the end: if there are any, the bank is decoded again with
+	 * unpack_buffer() to print the usual error messages.
+	 *
+	 * \param [in] pbank Pointer to the first word of the bank
+	 * \param [in] bank_len Number of words in the bank
+	 * \param [in] bankName Name of the midas bank being unpacked
+	 * \returns True if the bank was successfully unpacked, false otherwise
+	 */
+	int16_t values[MAX_CHANNELS + 1]; // last element is the scratch slot
+	std::copy(data, data + MAX_CHANNELS, values);
+	int32_t nch = n_ch, cnt = count;
+	bool over = overflow, under = underflow;
+	const int nbad = ::decode_adc_bank<V792>(pbank, bank_len, values, nch, cnt, over, under);
+
+	std::copy(values, values + MAX_CHANNELS, data);
+	n_ch = nch;
+	count = cnt;
+	overflow = over;
+	underflow = under;
+
+	if (nbad == 0) return true;
+
+	// Error path: repeat with the scalar decoder for the diagnostics
+	bool ret = true;
+	for (int i=0; i< bank_len; ++i) {
+		if(!unpack_buffer(pbank + i, bankName)) ret = false;
+	}
+	return ret;
 }
@@ -9,6 +9,7 @@
 #include <map>
 #include <vector>
 #include "utils/Valid.hxx"
+#include "utils/Bitfield.hxx"
 
 
 namespace midas { class Event; }
@@ -21,6 +22,14 @@ namespace vme {
 /// IO32 FPGA
 ///
 class Io32 {
+public: // Constants
+	/// Positions of the words in the main bank
+	enum Word_t {
+		HEADER_WORD = 0, TRIG_COUNT_WORD, TSTAMP_WORD, START_WORD, END_WORD,
+		LATENCY_WORD, READ_TIME_WORD, BUSY_TIME_WORD, TRIGGER_LATCH_WORD,
+		NUM_WORDS ///< Length of the main bank
+	};
+
 public: // Methods
 	/// Calls reset()
 	Io32();
@@ -91,10 +100,28 @@ public: // Constants
 	static const uint16_t EXTENDED_TRIGGER_TIME = 0x11;
 	/// Number of data channels available in the TDC
 	static const uint16_t MAX_CHANNELS          = 64;
+	/// Number of hits per channel and edge held in Channel (later hits are kept in the FIFOs only)
+	static const uint16_t MAX_HITS              = 8;
 
 	/// Hit types (leading or trailing edge)
 	enum HitType { LEADING, TRAILING };
 
+	/// Word format: the buffer type field, and the fields of each type of buffer
+	struct Format {
+		typedef dragon::utils::Bitfield<27, 5>  Type;             ///< Buffer type (TDC_HEADER, ...)
+		typedef dragon::utils::Bitfield<26, 1>  Edge;             ///< TDC_MEASUREMENT: HitType
+		typedef dragon::utils::Bitfield<19, 7>  Channel;          ///< TDC_MEASUREMENT: channel number
+		typedef dragon::utils::Bitfield< 0, 19> Measurement;      ///< TDC_MEASUREMENT: time
+		typedef dragon::utils::Bitfield< 5, 22> EventCount;       ///< GLOBAL_HEADER: event counter
+		typedef dragon::utils::Bitfield<24, 3>  Status;           ///< GLOBAL_TRAILER: status
+		typedef dragon::utils::Bitfield< 5, 16> TrailerWordCount; ///< GLOBAL_TRAILER: word count
+		typedef dragon::utils::Bitfield< 0, 27> ExtendedTrigger;  ///< EXTENDED_TRIGGER_TIME: trigger time
+		typedef dragon::utils::Bitfield< 0, 12> BunchId;          ///< TDC_HEADER: bunch id
+		typedef dragon::utils::Bitfield<12, 12> EventId;          ///< TDC_HEADER and TDC_TRAILER: event id
+		typedef dragon::utils::Bitfield< 0, 12> WordCount;        ///< TDC_TRAILER: word count
+		enum { NUM_ERROR_BITS = 14 };                             ///< TDC_ERROR: flags in bits 0 - 13
+	};
+
 public: // Methods
 	/// Calls reset()
 	V1190();
@@ -138,24 +165,31 @@ public: // Data
 private: // Internal routines
   /// Unpack a generic V1190 buffer
 	bool unpack_buffer(const uint32_t* const pbuffer, const char* bankName);
+	/// Unpack all buffers in a bank
+	bool unpack_bank(const uint32_t* pbank, int bank_len, const char* bankName);
   /// Unpack footer buffer
 	void unpack_footer_buffer(const uint32_t* const pbuffer, const char* bankName);
   /// Deals with V1190 error codes
 	void handle_error_buffer(const uint32_t* const pbuffer, const char* bankName);
 	/// Unpack event data buffer
-	bool unpack_data_buffer(const uint32_t* const pbuffer);
+	bool unpack_data_buffer(uint32_t word);
 
 public: // Subclasses
 /// Encloses measurement data for a single v1190 TDC channel
+	/*!
+	 * Hit values are held in fixed-size arrays, so that no memory is allocated
+	 * while unpacking and a hit is found by index. Only the first MAX_HITS hits of
+	 * each edge are stored here; nleading and ntrailing count all of them.
+	 */
 	struct Channel {
     /// Number of leading-edge hits in the current event
 		int32_t nleading;
     /// Number of trailing-edge hits in the current event
 		int32_t ntrailing;
 		/// Temporary storage of leading edge hits
-		std::vector<int32_t> fLeading;  //!
+		int32_t fLeading[MAX_HITS];  //!
 		/// Temporary storage of trailing edge hits
-		std::vector<int32_t> fTrailing; //!
+		int32_t fTrailing[MAX_HITS]; //!
 	};
 
 
@@ -186,11 +220,22 @@ public: // Subclass instances
 	Fifo fifo0;
 	/// Trailing edge measurements
 	Fifo fifo1;
+	/// Channels with at least one hit in the current event, in order of first hit
+	uint8_t fTouched[MAX_CHANNELS]; //!
+	/// Number of entries in fTouched
+	int16_t fNumTouched; //!
+
+private:
+	/// Find a hit beyond MAX_HITS by searching a FIFO
+	static int32_t find_hit(const Fifo& fifo, int16_t ch, int16_t hit);
 };
 
 ///
 /// CAEN v792 ADC
-///
+/*!
+ * Banks are decoded in bulk, see unpack_bank(). Compile with `-DVME_SCALAR_UNPACK`
+ * to decode word by word with unpack_buffer() instead (e.g. for debugging).
+ */
 class V792 {
 public: // Constants
 	/// Code to specify a data buffer
@@ -204,6 +249,17 @@ public: // Constants
  	/// Number of data channels availible in the ADC
 	static const uint16_t MAX_CHANNELS = 32;
 
+	/// Word format: the buffer type field, and the fields of each type of buffer
+	struct Format {
+		typedef dragon::utils::Bitfield<24, 3>  Type;        ///< Buffer type (DATA_BITS, ...)
+		typedef dragon::utils::Bitfield<16, 5>  Channel;     ///< DATA_BITS: channel number
+		typedef dragon::utils::Bitfield< 0, 12> Value;       ///< DATA_BITS: converted value
+		typedef dragon::utils::Bitfield<12, 1>  Overflow;    ///< DATA_BITS: overflow tag
+		typedef dragon::utils::Bitfield<13, 1>  Underflow;   ///< DATA_BITS: under threshold tag
+		typedef dragon::utils::Bitfield< 6, 8>  NumChannels; ///< HEADER_BITS: number of channels
+		typedef dragon::utils::Bitfield< 0, 24> Count;       ///< FOOTER_BITS: event counter
+	};
+
 public: // Methods
 	/// Calls reset(),
 	V792();
@@ -231,6 +287,8 @@ private:
 	bool unpack_data_buffer(const uint32_t* const pbuffer);
   /// Unpack a Midas data buffer from a CAEN ADC
 	bool unpack_buffer(const uint32_t* const pbuffer, const char* bankName);
+	/// Unpack all buffers in a bank at once
+	bool unpack_bank(const uint32_t* pbank, int bank_len, const char* bankName);
 };
 
 
@@ -6,21 +6,42 @@
 ///  root file.
 ///
 #ifdef USE_ROOT
+#include <map>
+#include <set>
 #include <vector>
 #include <string>
 #include <memory>
 #include <cassert>
+#include <list>
+#include <fstream>
+#include <sstream>
 #include <algorithm>
 #include <iostream>
 #include <TTree.h>
+#include <TChain.h>
+#include <TTreeFormula.h>
+#include <TKey.h>
+#include <TBranch.h>
+#include <TObjArray.h>
 #include <TFile.h>
 #include <TROOT.h>
 #include <TError.h>
 #include <TString.h>
 #include <TSystem.h>
+#include <RVersion.h>
+#include <glob.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/wait.h>
 #include "midas/libMidasInterface/TMidasFile.h"
 #include "midas/Database.hxx"
+#include "midas/Event.hxx"
 #include "utils/definitions.h"
+#include "utils/Thread.hxx"
+#include "utils/Profile.hxx"
+#include "utils/RootAnalysis.hxx"
 #include "Unpack.hxx"
 #include "Dragon.hxx"
 #include "Sonik.hxx"
@@ -30,8 +51,9 @@
 namespace {
   bool arg_return = false;
   const char* const msg_use =
-	"usage: mid2root <input file> [-o <output file>] [-v <xml odb>] [-histos <*.xml> ] "
-	"[--singles] [--overwrite] [--quiet <n>] [--help]\n";
+	"usage: mid2root <input file> [<input file> ...] [--runlist <file>] [--jobs <n>] [-o <output file>] [-v <xml odb>] [-histos <*.xml> ] "
+	"[--singles] [--sonik] [--chunk <i>/<n>] [--merge] [--follow [<s>]] [--queue <engine>] [--threads <n>] [--imt <n>] [--autoflush <n>[k|M]] [--autosave <n>[k|M]] [--diagnostics <n>[s]] [--flat] [--raw] [--compress <group>=<alg>:<level>[:<basket>]] "
+	"[--profile [<n>]] [--overwrite] [--quiet <n>] [--help]\n";
 }
 
 //
@@ -119,18 +141,129 @@ namespace m2r {
 
 #endif
 
+  /// Groups of output branches sharing compression settings
+  enum BranchGroup_t {
+	kPhysics = 0,   ///< Head, tail, coincidence and SONIK event data
+	kRaw = 1,       ///< Raw VME module data (only written with --raw)
+	kAux = 2,       ///< Scalers, EPICS, diagnostics and run parameters
+	kNumGroups = 3
+  };
+
+  /// Names of the branch groups, as given to --compress
+  const char* const gGroupNames[kNumGroups] = { "physics", "raw", "aux" };
+
+  /// Compression settings of a branch group
+  struct Compression_t {
+	int fAlgorithm;  ///< ROOT compression algorithm (1: zlib, 2: lzma, 4: lz4, 5: zstd), -1 for the file default
+	int fLevel;      ///< Compression level, 0-9
+	int fBasketSize; ///< Basket size in bytes, 0 for the ROOT default
+	Compression_t(): fAlgorithm(-1), fLevel(0), fBasketSize(0) {}
+  };
+
   /// Program options
   struct Options_t {
 	std::string fIn;
+	std::vector<std::string> fInputs;
+	std::string fRunList;
 	std::string fOut;
 	std::string fOdb;
 	std::string fHistos;
 	bool fOverwrite;
 	bool fSingles;
 	bool fSonik;
-	Options_t(): fOverwrite(false), fSingles(false), fSonik(false) {}
+	bool fFlat;
+	bool fRaw;
+	int fThreads;
+	int fImt;
+	int fJobs;
+	int fProfile;
+	int fChunk;
+	int fChunks;
+	bool fMerge;
+	int fFollow;
+	tstamp::Queue::Engine_t fQueue;
+	Long64_t fAutoFlush;
+	Long64_t fAutoSave;
+	UInt_t fDiagEvents;
+	UInt_t fDiagSeconds;
+	Compression_t fCompress[kNumGroups];
+	Options_t(): fOverwrite(false), fSingles(false), fSonik(false), fFlat(false), fRaw(false),
+				 fThreads(1), fImt(0), fJobs(1), fProfile(0), fChunk(0), fChunks(0), fMerge(false), fFollow(0),
+				 fQueue(tstamp::Queue::kMultiSet),
+				 fAutoFlush(0), fAutoSave(0),
+				 fDiagEvents(0), fDiagSeconds(1) {}
   };
 
+  /// Parse a TTree::SetAutoFlush() / SetAutoSave() argument
+  /*!
+   * A plain number is a number of entries; with a 'k' or 'M' suffix it is a size
+   * in kilobytes or megabytes, returned as a negative number of bytes as ROOT expects.
+   * \returns false if \e arg is not a positive number with an optional suffix.
+   */
+  bool parse_entries_or_size(const std::string& arg, Long64_t* value)
+  {
+	std::istringstream in(arg);
+	Long64_t n = 0;
+	std::string suffix;
+	if (!(in >> n) || n <= 0) return false;
+	in >> suffix;
+	if (suffix.empty())    *value = n;
+	else if (suffix == "k") *value = -n * 1024;
+	else if (suffix == "M") *value = -n * 1024 * 1024;
+	else return false;
+	return true;
+  }
+
+  /// Parse a --compress argument, <group>=<algorithm>:<level>[:<basket size>]
+  bool parse_compression(const std::string& arg, Options_t* options)
+  {
+	const char* const algNames[] = { "zlib", "lzma", "lz4", "zstd" };
+	const int algCodes[] = { 1, 2, 4, 5 };
+
+	size_t eq = arg.find('=');
+	if (eq == std::string::npos) return false;
+	int group = -1;
+	for (int i = 0; i< kNumGroups; ++i) {
+      if (arg.substr(0, eq) == gGroupNames[i]) group = i;
+	}
+	if (group < 0) return false;
+
+	std::string settings = arg.substr(eq + 1);
+	for (size_t i = 0; i< settings.size(); ++i) {
+      if (settings[i] == ':') settings[i] = ' ';
+	}
+	std::string alg;
+	Compression_t c;
+	std::istringstream in(settings);
+	if (!(in >> alg >> c.fLevel) || c.fLevel < 0 || c.fLevel > 9) return false;
+	if (!in.eof() && (!(in >> c.fBasketSize) || c.fBasketSize <= 0)) return false;
+	for (int i = 0; i< 4; ++i) {
+      if (alg == algNames[i]) c.fAlgorithm = algCodes[i];
+	}
+	if (c.fAlgorithm < 0) return false;
+
+	options->fCompress[group] = c;
+	return true;
+  }
+
+  /// Apply the cluster size and save interval options to a tree
+  void configure_tree(TTree* tree, const Options_t& options)
+  {
+	if (options.fAutoFlush != 0) tree->SetAutoFlush(options.fAutoFlush);
+	if (options.fAutoSave  != 0) tree->SetAutoSave(options.fAutoSave);
+  }
+
+  /// Apply compression settings to a branch and all of its sub-branches
+  void apply_compression(TBranch* branch, const Compression_t& c)
+  {
+	if (c.fAlgorithm >= 0) branch->SetCompressionSettings(100*c.fAlgorithm + c.fLevel);
+	if (c.fBasketSize > 0) branch->SetBasketSize(c.fBasketSize);
+	TObjArray* sub = branch->GetListOfBranches();
+	for (Int_t i = 0; i< sub->GetEntriesFast(); ++i) {
+      apply_compression(static_cast<TBranch*>(sub->At(i)), c);
+	}
+  }
+
 
   /// Print in-place event counter
   void static_counter(Int_t n, Int_t nupdate = 1000, bool force = false)
@@ -182,7 +315,19 @@ namespace m2r {
       "\n"
       "Program arguments:\n"
       "\n"
-      "\t<input file>:     Specifies the MIDAS file to convert [required].\n"
+      "\t<input file>:     Specifies the MIDAS file to convert [required, unless --runlist is given].\n"
+      "\t                  Several files, or quoted wildcard patterns (e.g. 'run*.mid.gz'), can be given to\n"
+      "\t                  convert a batch of runs; see --jobs.\n"
+      "\n"
+      "\t--runlist <file>: Convert the runs listed in <file>, one file name or wildcard pattern per line\n"
+      "\t                  (empty lines and lines beginning with '#' are ignored).\n"
+      "\n"
+      "\t--jobs <n>:       Batch mode: convert up to <n> runs at a time, each in its own process forked\n"
+      "\t                  after ROOT and the histogram definitions have been initialized. Runs whose\n"
+      "\t                  output file is newer than the input are skipped unless --overwrite is given;\n"
+      "\t                  -o specifies the output directory. <n> is reduced if <n> times the number of\n"
+      "\t                  --threads exceeds the number of cores. Aggregate rates are printed at the end.\n"
+      "\t                  Batch mode is also used whenever more than one input file is given.\n"
       "\n"
       "\t-o <output file>: Specify the output file. If not set, the output file\n"
       "\t                  will have the same name as the input file, but with the extension\n"
@@ -207,6 +352,84 @@ namespace m2r {
       "\t                  event only. In this mode, the buffering in a queue and timestamp matching routines are\n"
       "\t                  skipped completely.\n"
       "\n"
+      "\t--chunk <i>/<n>:  Convert only chunk <i> (0 to <n>-1) of the run, for converting one run on <n>\n"
+      "\t                  nodes at once. The run is split into <n> parts of equal numbers of events using\n"
+      "\t                  its index (see midasindex; it is built if there is none, so build it first when\n"
+      "\t                  the chunks are converted at the same time). Each chunk also reads the events\n"
+      "\t                  within the queue time plus the coincidence window before and after its own, so\n"
+      "\t                  that coincidences at its edges are matched as in the conversion of the whole\n"
+      "\t                  run, but only fills the entries of its own events. Implies --threads 1. The\n"
+      "\t                  default output is the default output file name with '_chunk<i>' added.\n"
+      "\t                  See script/chunked_convert.sh for running the chunks over ssh or Slurm.\n"
+      "\n"
+      "\t--merge:          Merge the output files of the chunks of one run, given as the input files in\n"
+      "\t                  chunk order, into the file given with -o [required]. Head, tail and coincidence\n"
+      "\t                  entries of events already written by the previous chunk are skipped, the\n"
+      "\t                  run parameters are recalculated from the ODB at the start of the first chunk\n"
+      "\t                  and at the end of the last one, and these are written as 'odbstart' and\n"
+      "\t                  'odbstop'. Histograms and run summaries are not merged.\n"
+      "\n"
+      "\t--follow [<s>]:   Follow the input file while it is being written, e.g. the current run, as\n"
+      "\t                  'tail -f' does: at the end of the data written so far, save the trees and\n"
+      "\t                  wait for more, checking every <s> seconds (default 1), until the end-of-run\n"
+      "\t                  event or an interrupt (Ctrl-C), then finish as usual. Each save writes the\n"
+      "\t                  tree entries so far (the events still waiting in the timestamp queue for a\n"
+      "\t                  coincidence are written later) and a 'checkpoint' of the number of events read\n"
+      "\t                  and queued, so the output can be read (e.g. with a TChain) while it is written.\n"
+      "\t                  Needs a local, uncompressed file. Implies --threads 1.\n"
+      "\n"
+      "\t--queue <engine>: Storage of the timestamp queue: 'multiset' (default), 'calendar' (faster at large\n"
+      "\t                  queue depths) or 'mergejoin', which keeps the head and tail streams in time\n"
+      "\t                  ordered lists of their own and hands each event on as soon as the other stream\n"
+      "\t                  has passed its coincidence window, so far fewer events are buffered. With\n"
+      "\t                  'mergejoin' only head + tail pairs are matched.\n"
+      "\n"
+      "\t--threads <n>:    Unpack using <n> worker threads. Reading, timestamp matching and tree filling\n"
+      "\t                  each run in their own thread, with the head, tail and coincidence unpacking and\n"
+      "\t                  calculations spread over the workers. The output is identical to the default\n"
+      "\t                  (single threaded) conversion, which is used if <n> is 1 or less.\n"
+      "\n"
+      "\t--imt <n>:        Enable ROOT implicit multi-threading with <n> threads (0: as many as there are\n"
+      "\t                  cores), so that the baskets of the different branches are compressed and written\n"
+      "\t                  in parallel. Requires ROOT 6.10 or later. Can be combined with --threads, in\n"
+      "\t                  which case the tree filling also runs concurrently with the unpacking.\n"
+      "\n"
+      "\t--autoflush <n>[k|M]:\n"
+      "\t                  Size of the tree clusters (the number of entries whose baskets are written\n"
+      "\t                  together): <n> entries, or <n> kilobytes ('k') or megabytes ('M') of uncompressed\n"
+      "\t                  data. Default is the ROOT default (30 MB).\n"
+      "\n"
+      "\t--autosave <n>[k|M]:\n"
+      "\t                  Write the tree headers to file every <n> entries, or every <n> kilobytes ('k')\n"
+      "\t                  or megabytes ('M') of data, so that all data up to the last save can be recovered\n"
+      "\t                  from the output file if the conversion is interrupted. Default is the ROOT\n"
+      "\t                  default (300 MB); the trees are always saved at the end of the run.\n"
+      "\n"
+      "\t--diagnostics <n>[s]:\n"
+      "\t                  Write a timestamp diagnostics entry (t6) every <n> queued events, or every <n>\n"
+      "\t                  seconds of run time with an 's' suffix, and once more at the end of the run.\n"
+      "\t                  0 writes one for every event. Default is one per second.\n"
+      "\n"
+      "\t--flat:           Write the calibrated detector parameters as flat columns of primitive types\n"
+      "\t                  (e.g. 'bgo.ecal' as a Double_t[30] leaf) instead of one object branch per\n"
+      "\t                  event class. The files can be read without the DRAGON dictionary, and only\n"
+      "\t                  the columns used are read back from disk.\n"
+      "\n"
+      "\t--raw:            With --flat, also write the raw VME module data (IO32, V792/V785 and V1190)\n"
+      "\t                  of head and tail events, as split object branches ('io32', 'v792', ...).\n"
+      "\n"
+      "\t--compress <group>=<algorithm>:<level>[:<basket size>]:\n"
+      "\t                  Compression of a group of branches: 'physics' (head, tail, coincidence and\n"
+      "\t                  SONIK data), 'raw' (VME modules, see --raw) or 'aux' (scalers, EPICS, timestamp\n"
+      "\t                  diagnostics and run parameters). The algorithm is one of zlib, lzma, lz4 or zstd\n"
+      "\t                  (as supported by the ROOT version in use), the level is 0-9 and the optional basket\n"
+      "\t                  size is in bytes. May be given once per group; default is the ROOT file default.\n"
+      "\n"
+      "\t--profile [<n>]:  Time the stages of the conversion (file reading, event construction, queueing,\n"
+      "\t                  head and tail unpacking and calculations, tree filling) and print a summary\n"
+      "\t                  table at the end. If <n> is given, only one in every <n> calls of each stage\n"
+      "\t                  is timed. Not available in batch mode.\n"
+      "\n"
       "\t--overwrite:      Overwrite any existing output files without asking the user.\n"
       "\n"
       "\t--quiet <n>:      Suppress program output messages. Followed by a numeral specifying the level of\n"
@@ -222,6 +445,21 @@ namespace m2r {
   }
 
 
+  /// Add an input file, or all files matching a wildcard pattern
+  void add_inputs(const std::string& pattern, Options_t* options)
+  {
+	glob_t matches;
+	if (pattern.find_first_of("*?[") == std::string::npos ||
+        glob(pattern.c_str(), 0, 0, &matches) != 0) { // plain file name, or no match (reported later)
+      options->fInputs.push_back(pattern);
+      return;
+	}
+	for (size_t i = 0; i< matches.gl_pathc; ++i) {
+      options->fInputs.push_back(matches.gl_pathv[i]);
+	}
+	globfree(&matches);
+  }
+
   /// Parse command line arguments
   int process_args(int argc, char** argv, Options_t* options)
   {
@@ -229,21 +467,10 @@ namespace m2r {
 	strvector_t::iterator iarg = args.begin();
 
 	//
-	// Look for input file
+	// Check arguments
 	for(; iarg != args.end(); ++iarg) {
-      if(iarg->substr(0, 2) == "--")
-        continue;
-      if((iarg-1 >= args.begin()) && *(iarg-1) == "--quiet")
-        continue;
-      options->fIn = *iarg;
-      break;
-	}
-
-	//
-	// Check other arguments
-	for(iarg = args.begin(); iarg != args.end(); ++iarg) {
-      if (*iarg == options->fIn) { // Input file, already set
-        continue;
+      if ((*iarg)[0] != '-') { // Input file or pattern
+        add_inputs(*iarg, options);
       }
       else if (*iarg == "--help") { // Help message
         return help();
@@ -269,6 +496,128 @@ namespace m2r {
       else if (*iarg == "--sonik") { // SONIK mode
         options->fSonik = true;
       }
+      else if (*iarg == "--threads") { // Number of worker threads
+        if (++iarg == args.end()) return usage("number of threads not specified");
+        TString nstr = iarg->c_str();
+        if (nstr.IsDigit() == false) {
+          TString error ("Number of threads \'");
+          error += nstr; error += "\' is not an integer";
+          return usage(error.Data());
+        }
+        options->fThreads = nstr.Atoi();
+      }
+      else if (*iarg == "--chunk") { // Convert one part of the run
+        if (++iarg == args.end()) return usage("chunk not specified");
+        std::istringstream in(*iarg);
+        char slash = 0;
+        if (!(in >> options->fChunk >> slash >> options->fChunks) || slash != '/' ||
+            options->fChunk < 0 || options->fChunk >= options->fChunks) {
+          TString error ("Invalid chunk \'");
+          error += iarg->c_str(); error += "\', expected <i>/<n> with 0 <= <i> < <n>";
+          return usage(error.Data());
+        }
+      }
+      else if (*iarg == "--merge") { // Merge the chunks of a run
+        options->fMerge = true;
+      }
+      else if (*iarg == "--follow") { // Follow a growing file, optionally with the polling interval
+        options->fFollow = 1;
+        if (iarg + 1 != args.end() && TString(iarg[1].c_str()).IsDigit()) {
+          options->fFollow = TString((++iarg)->c_str()).Atoi();
+          if (options->fFollow <= 0) return usage("follow interval must be positive");
+        }
+      }
+      else if (*iarg == "--queue") { // Timestamp queue engine
+        if (++iarg == args.end()) return usage("queue engine not specified");
+        if      (*iarg == "multiset")  options->fQueue = tstamp::Queue::kMultiSet;
+        else if (*iarg == "calendar")  options->fQueue = tstamp::Queue::kCalendar;
+        else if (*iarg == "mergejoin") options->fQueue = tstamp::Queue::kMergeJoin;
+        else {
+          TString error ("Unknown queue engine \'");
+          error += iarg->c_str(); error += "\', expected multiset, calendar or mergejoin";
+          return usage(error.Data());
+        }
+      }
+      else if (*iarg == "--runlist") { // List of runs
+        if (++iarg == args.end()) return usage("run list file not specified");
+        options->fRunList = *iarg;
+        std::ifstream list(iarg->c_str());
+        if (!list.good()) {
+          TString error ("Couldn\'t open the run list \'");
+          error += iarg->c_str(); error += "\'";
+          return usage(error.Data());
+        }
+        std::string line;
+        while (std::getline(list, line)) {
+          std::istringstream words(line);
+          std::string word;
+          if ((words >> word) && word[0] != '#') add_inputs(word, options);
+        }
+      }
+      else if (*iarg == "--jobs") { // Number of simultaneous conversions
+        if (++iarg == args.end()) return usage("number of jobs not specified");
+        TString nstr = iarg->c_str();
+        if (nstr.IsDigit() == false) {
+          TString error ("Number of jobs \'");
+          error += nstr; error += "\' is not an integer";
+          return usage(error.Data());
+        }
+        options->fJobs = nstr.Atoi();
+      }
+      else if (*iarg == "--imt") { // ROOT implicit multi-threading
+        if (++iarg == args.end()) return usage("number of IMT threads not specified");
+        TString nstr = iarg->c_str();
+        if (nstr.IsDigit() == false) {
+          TString error ("Number of IMT threads \'");
+          error += nstr; error += "\' is not an integer";
+          return usage(error.Data());
+        }
+        options->fImt = nstr.Atoi();
+        if (options->fImt == 0) options->fImt = -1; // all cores
+      }
+      else if (*iarg == "--autoflush" || *iarg == "--autosave") { // Tree cluster / save interval
+        const bool flush = (*iarg == "--autoflush");
+        if (++iarg == args.end()) return usage(flush ? "autoflush value not specified" : "autosave value not specified");
+        if (!parse_entries_or_size(*iarg, flush ? &options->fAutoFlush : &options->fAutoSave)) {
+          TString error ("Invalid number of entries or size \'");
+          error += iarg->c_str(); error += "\'";
+          return usage(error.Data());
+        }
+      }
+      else if (*iarg == "--diagnostics") { // Timestamp diagnostics sampling
+        if (++iarg == args.end()) return usage("diagnostics sampling not specified");
+        TString nstr = iarg->c_str();
+        const bool seconds = nstr.EndsWith("s");
+        if (seconds) nstr.Chop();
+        if (nstr.IsDigit() == false) {
+          TString error ("Invalid diagnostics sampling \'");
+          error += iarg->c_str(); error += "\'";
+          return usage(error.Data());
+        }
+        options->fDiagEvents  = seconds ? 0 : nstr.Atoi();
+        options->fDiagSeconds = seconds ? nstr.Atoi() : 0;
+      }
+      else if (*iarg == "--flat") { // Flat columnar output
+        options->fFlat = true;
+      }
+      else if (*iarg == "--raw") { // Raw module output
+        options->fRaw = true;
+      }
+      else if (*iarg == "--compress") { // Branch group compression
+        if (++iarg == args.end()) return usage("compression settings not specified");
+        if (!parse_compression(*iarg, options)) {
+          TString error ("Invalid compression settings \'");
+          error += iarg->c_str(); error += "\'";
+          return usage(error.Data());
+        }
+      }
+      else if (*iarg == "--profile") { // Stage timing, optionally sampled
+        options->fProfile = 1;
+        if (iarg + 1 != args.end() && TString(iarg[1].c_str()).IsDigit()) {
+          options->fProfile = TString((++iarg)->c_str()).Atoi();
+          if (options->fProfile <= 0) return usage("profile sampling factor must be positive");
+        }
+      }
       else if (*iarg == "--overwrite") { // Overwrite flag
         options->fOverwrite = true;
       }
@@ -290,20 +639,937 @@ namespace m2r {
       }
 	}
 
-	if (options->fIn.empty()) // Didn't find input file
+	if (options->fInputs.empty()) // Didn't find input file
       return usage("no input file specified");
 
+	if (options->fRaw && !options->fFlat)
+      return usage("--raw is only available with --flat");
+
+	if (options->fChunks > 0 && (options->fInputs.size() != 1 || !options->fRunList.empty()))
+      return usage("--chunk converts a single input file");
+
+	if (options->fFollow > 0 && (options->fInputs.size() != 1 || !options->fRunList.empty() || options->fChunks > 0))
+      return usage("--follow converts a single input file, and can't be combined with --chunk");
+
+	if (options->fMerge && (options->fOut.empty() || options->fChunks > 0))
+      return usage("--merge needs an output file (-o), and can't be combined with --chunk");
+
 	return 0;
   }
 
-  //
-  /// The main function implementation
-  int main_(int argc, char** argv)
+  /// Tree-bound objects and output settings shared by the conversion loops
+  struct Output_t {
+	int nIds;                       ///< Number of event types
+	const int* eventIds;            ///< Event codes, one per tree
+	TTree** trees;                  ///< Trees, one per event code (may be NULL)
+	void** addr;                    ///< Addresses of the tree-bound objects
+	bool fillHistos;                ///< Fill rootbeer histograms?
+	bool fillSonik;                 ///< Fill the SONIK tree for DRAGON_SONIK_EVENT codes?
+	Sonik* sonik;                   ///< SONIK object bound to \c t0
+	TTree* t0;                      ///< SONIK tree
+	dragon::RunSummary* summary;    ///< Run summary, filled with the trees (may be NULL)
+  };
+
+  /// Creates flat (primitive-typed) output branches for the event classes
+  /*!
+   * Each detector parameter becomes its own leaf, named after the data member it is
+   * bound to, so that e.g. <tt>t1->Draw("bgo.ecal[0]")</tt> works the same as for the
+   * split object branches. Leaves are bound directly to the members of the tree-bound
+   * objects, so filling is unchanged. With Options_t::fRaw, the raw VME modules of head
+   * and tail events are added as split object branches.
+   */
+  class FlatBranches {
+  public:
+	/// Set options
+	FlatBranches(const Options_t& options): fOptions(options) { }
+
+	/// Create branches for the event class with code \e code at \e addr
+	void Add(TTree* tree, int code, void* addr)
+      {
+        fTree = tree;
+        switch (code) {
+        case DRAGON_HEAD_EVENT:
+          Add("", *reinterpret_cast<dragon::Head*>(addr));
+          if (fOptions.fRaw) AddRaw("", *reinterpret_cast<dragon::Head*>(addr));
+          break;
+        case DRAGON_TAIL_EVENT:
+          Add("", *reinterpret_cast<dragon::Tail*>(addr));
+          if (fOptions.fRaw) AddRaw("", *reinterpret_cast<dragon::Tail*>(addr));
+          break;
+        case DRAGON_COINC_EVENT:
+          Add("", *reinterpret_cast<dragon::Coinc*>(addr));
+          if (fOptions.fRaw) {
+            AddRaw("head.", reinterpret_cast<dragon::Coinc*>(addr)->head);
+            AddRaw("tail.", reinterpret_cast<dragon::Coinc*>(addr)->tail);
+          }
+          break;
+        case DRAGON_HEAD_SCALER: case DRAGON_TAIL_SCALER: case DRAGON_AUX_SCALER:
+          Add("", *reinterpret_cast<dragon::Scaler*>(addr));
+          break;
+        case DRAGON_EPICS_EVENT:
+          Add("", *reinterpret_cast<dragon::Epics*>(addr));
+          break;
+        case DRAGON_TSTAMP_DIAGNOSTICS:
+          Add("", *reinterpret_cast<tstamp::Diagnostics*>(addr));
+          break;
+        case DRAGON_RUN_PARAMETERS:
+          Add("", *reinterpret_cast<dragon::RunParameters*>(addr));
+          break;
+        default:
+          break;
+        }
+      }
+
+	/// Create branches for SONIK data
+	void Add(TTree* tree, Sonik& sonik)
+      {
+        fTree = tree;
+        Leaf("ecal",   sonik.ecal, Sonik::MAX_CHANNELS);
+        Leaf("ehit",   &sonik.ehit);
+        Leaf("hit",    &sonik.hit);
+        Leaf("thit",   &sonik.thit);
+        Leaf("rf_tof", &sonik.rf_tof);
+        Add("trf.",    sonik.trf);
+        Leaf("tcal0",  &sonik.tcal0);
+      }
+
+  private:
+	// ROOT leaf type codes
+	static char LeafType(const double*)   { return 'D'; }
+	static char LeafType(const float*)    { return 'F'; }
+	static char LeafType(const int16_t*)  { return 'S'; }
+	static char LeafType(const uint16_t*) { return 's'; }
+	static char LeafType(const int32_t*)  { return 'I'; }
+	static char LeafType(const uint32_t*) { return 'i'; }
+	static char LeafType(const int64_t*)  { return 'L'; }
+	static char LeafType(const uint64_t*) { return 'l'; }
+
+	/// Create a leaf \e name of \e n elements at \e address
+	template <class T>
+	void Leaf(const std::string& name, T* address, int n = 1, BranchGroup_t group = kPhysics)
+      {
+        std::stringstream leaflist;
+        leaflist << name;
+        if (n > 1) leaflist << "[" << n << "]";
+        leaflist << "/" << LeafType(address);
+        TBranch* branch = fTree->Branch(name.c_str(), address, leaflist.str().c_str());
+        apply_compression(branch, fOptions.fCompress[group]);
+      }
+
+	/// Create the MIDAS event header branch
+	void Header(const std::string& p, TMidas_EVENT_HEADER& header, BranchGroup_t group)
+      {
+        TBranch* branch = fTree->Branch((p + "header").c_str(), &header,
+                                        "fEventId/s:fTriggerMask/s:fSerialNumber/i:fTimeStamp/i:fDataSize/i");
+        apply_compression(branch, fOptions.fCompress[group]);
+      }
+
+	/// Create a split object branch for raw module data
+	void Object(const std::string& name, const char* classname, void* obj)
+      {
+        fObjects.push_back(obj); // TTree::Branch() needs the address of the pointer
+        TBranch* branch = fTree->Branch((name + ".").c_str(), classname, &fObjects.back());
+        apply_compression(branch, fOptions.fCompress[kRaw]);
+      }
+
+	void Add(const std::string& p, dragon::Bgo& bgo)
+      {
+        Leaf(p + "ecal",  bgo.ecal,  dragon::Bgo::MAX_CHANNELS);
+        Leaf(p + "tcal",  bgo.tcal,  dragon::Bgo::MAX_CHANNELS);
+        Leaf(p + "esort", bgo.esort, dragon::Bgo::MAX_CHANNELS);
+        Leaf(p + "sum",   &bgo.sum);
+        Leaf(p + "hit0",  &bgo.hit0);
+        Leaf(p + "x0",    &bgo.x0);
+        Leaf(p + "y0",    &bgo.y0);
+        Leaf(p + "z0",    &bgo.z0);
+        Leaf(p + "t0",    &bgo.t0);
+      }
+
+#ifndef DRAGON_OMIT_DSSSD
+	void Add(const std::string& p, dragon::Dsssd& dsssd)
+      {
+        Leaf(p + "ecal",      dsssd.ecal, dragon::Dsssd::MAX_CHANNELS);
+        Leaf(p + "efront",    &dsssd.efront);
+        Leaf(p + "eback",     &dsssd.eback);
+        Leaf(p + "hit_front", &dsssd.hit_front);
+        Leaf(p + "hit_back",  &dsssd.hit_back);
+        Leaf(p + "tfront",    &dsssd.tfront);
+        Leaf(p + "tback",     &dsssd.tback);
+      }
+#endif
+
+#ifndef DRAGON_OMIT_IC
+	void Add(const std::string& p, dragon::IonChamber& ic)
+      {
+        Leaf(p + "anode", ic.anode, dragon::IonChamber::MAX_CHANNELS);
+        Leaf(p + "tcal",  ic.tcal,  dragon::IonChamber::MAX_TDC);
+        Leaf(p + "sum",   &ic.sum);
+      }
+#endif
+
+#ifndef DRAGON_OMIT_NAI
+	void Add(const std::string& p, dragon::NaI& nai)
+      { Leaf(p + "ecal", nai.ecal, dragon::NaI::MAX_CHANNELS); }
+#endif
+
+#ifndef DRAGON_OMIT_GE
+	void Add(const std::string& p, dragon::Ge& ge)
+      { Leaf(p + "ecal", &ge.ecal); }
+#endif
+
+	void Add(const std::string& p, dragon::Mcp& mcp)
+      {
+        Leaf(p + "anode", mcp.anode, dragon::Mcp::MAX_CHANNELS);
+        Leaf(p + "tcal",  mcp.tcal,  dragon::Mcp::NUM_DETECTORS);
+        Leaf(p + "esum",  &mcp.esum);
+        Leaf(p + "tac",   &mcp.tac);
+        Leaf(p + "x",     &mcp.x);
+        Leaf(p + "y",     &mcp.y);
+      }
+
+	void Add(const std::string& p, dragon::SurfaceBarrier& sb)
+      { Leaf(p + "ecal", sb.ecal, dragon::SurfaceBarrier::MAX_CHANNELS); }
+
+	void Add(const std::string& p, const dragon::Tail& tail, dragon::HiTof& tof)
+      {
+        Leaf(p + "mcp", &tof.mcp);
+#ifndef DRAGON_OMIT_DSSSD
+        if (tail.has_detector(dragon::Tail::kDsssd)) Leaf(p + "mcp_dsssd", &tof.mcp_dsssd);
+#endif
+#ifndef DRAGON_OMIT_IC
+        if (tail.has_detector(dragon::Tail::kIonChamber)) Leaf(p + "mcp_ic", &tof.mcp_ic);
+#endif
+      }
+
+	template <int N>
+	void Add(const std::string& p, dragon::TdcChannel<N>& tdc)
+      {
+        Leaf(p + "leading",  tdc.leading,  N);
+        Leaf(p + "trailing", tdc.trailing, N);
+      }
+
+	void Add(const std::string& p, dragon::Head& head)
+      {
+        Header(p, head.header, kPhysics);
+        Add(p + "bgo.", head.bgo);
+        Add(p + "trf.", head.trf);
+        Leaf(p + "tcal0",   &head.tcal0);
+        Leaf(p + "tcalx",   &head.tcalx);
+        Leaf(p + "tcal_rf", &head.tcal_rf);
+      }
+
+	void Add(const std::string& p, dragon::Tail& tail)
+      {
+        Header(p, tail.header, kPhysics);
+        // detectors not installed (Tail::has_detector()) get no branches
+#ifndef DRAGON_OMIT_DSSSD
+        if (tail.has_detector(dragon::Tail::kDsssd)) Add(p + "dsssd.", tail.dsssd);
+#endif
+#ifndef DRAGON_OMIT_IC
+        if (tail.has_detector(dragon::Tail::kIonChamber)) Add(p + "ic.", tail.ic);
+#endif
+#ifndef DRAGON_OMIT_NAI
+        if (tail.has_detector(dragon::Tail::kNaI)) Add(p + "nai.", tail.nai);
+#endif
+#ifndef DRAGON_OMIT_GE
+        if (tail.has_detector(dragon::Tail::kGe)) Add(p + "ge.", tail.ge);
+#endif
+        Add(p + "mcp.", tail.mcp);
+        Add(p + "sb.",  tail.sb);
+        Add(p + "tof.", tail, tail.tof);
+        Add(p + "trf.", tail.trf);
+        Leaf(p + "tcal_rf", &tail.tcal_rf);
+        Leaf(p + "tcal0",   &tail.tcal0);
+        Leaf(p + "tcalx",   &tail.tcalx);
+      }
+
+	void Add(const std::string& p, dragon::Coinc& coinc)
+      {
+        Add(p + "head.", coinc.head);
+        Add(p + "tail.", coinc.tail);
+        Leaf(p + "xtrig", &coinc.xtrig);
+        Leaf(p + "xtofh", &coinc.xtofh);
+        Leaf(p + "xtoft", &coinc.xtoft);
+      }
+
+	void Add(const std::string& p, dragon::Scaler& scaler)
+      {
+        Leaf(p + "count", scaler.count, dragon::Scaler::MAX_CHANNELS, kAux);
+        Leaf(p + "sum",   scaler.sum,   dragon::Scaler::MAX_CHANNELS, kAux);
+        Leaf(p + "rate",  scaler.rate,  dragon::Scaler::MAX_CHANNELS, kAux);
+      }
+
+	void Add(const std::string& p, dragon::Epics& epics)
+      {
+        Header(p, epics.header, kAux);
+        Leaf(p + "ch",  &epics.ch,  1, kAux);
+        Leaf(p + "val", &epics.val, 1, kAux);
+      }
+
+	void Add(const std::string& p, tstamp::Diagnostics& diag)
+      {
+        Leaf(p + "size",         &diag.size,        1, kAux);
+        Leaf(p + "n_coinc",      &diag.n_coinc,     1, kAux);
+        Leaf(p + "coinc_rate",   &diag.coinc_rate,  1, kAux);
+        Leaf(p + "n_singles",    diag.n_singles,    tstamp::Diagnostics::MAX_TYPES, kAux);
+        Leaf(p + "singles_rate", diag.singles_rate, tstamp::Diagnostics::MAX_TYPES, kAux);
+        Leaf(p + "time_diff",    &diag.time_diff,   1, kAux);
+      }
+
+	void Add(const std::string& p, dragon::RunParameters& runpar)
+      {
+        const int n = dragon::RunParameters::MAX_FRONTENDS;
+        Leaf(p + "run_start",     runpar.run_start,     n, kAux);
+        Leaf(p + "run_stop",      runpar.run_stop,      n, kAux);
+        Leaf(p + "trigger_start", runpar.trigger_start, n, kAux);
+        Leaf(p + "trigger_stop",  runpar.trigger_stop,  n, kAux);
+      }
+
+	void AddRaw(const std::string& p, dragon::Head& head)
+      {
+        Object(p + "io32", "vme::Io32", &head.io32);
+        Object(p + "v792", "vme::V792", &head.v792);
+        Object(p + "v1190", "vme::V1190", &head.v1190);
+      }
+
+	void AddRaw(const std::string& p, dragon::Tail& tail)
+      {
+        Object(p + "io32", "vme::Io32", &tail.io32);
+        for (int i = 0; i< dragon::Tail::NUM_ADC; ++i) {
+          std::stringstream name;
+          name << p << "v785_" << i;
+          Object(name.str(), "vme::V792", &tail.v785[i]);
+        }
+        Object(p + "v1190", "vme::V1190", &tail.v1190);
+      }
+
+  private:
+	const Options_t& fOptions;
+	TTree* fTree;
+	std::list<void*> fObjects; ///< Raw module addresses bound to object branches
+  };
+
+  /// Decides which entries belong to one chunk of a run converted in parts (--chunk)
+  /*!
+   * A chunk reads its own events plus margins of the neighbouring ones (see
+   * TMidasFileIndex::GetChunk()), so the queue matches the coincidences at its edges
+   * as in the conversion of the whole run, but the entries for the margins are filled
+   * by the neighbours. Head and tail events belong to the chunk their serial number
+   * falls in, coincidences to the chunk of their head event and SONIK events to that
+   * of their tail event. Everything else (scalers, EPICS, diagnostics, run parameters)
+   * belongs to the chunk holding the event being unpacked, and what is unpacked while
+   * flushing the queue at the end to the last chunk.
+   */
+  class Chunk {
+  public:
+	/// Serial number ranges of the events owned by \e chunk
+	Chunk(const TMidasFileIndex& index, const TMidasFileIndex::Chunk_t& chunk,
+          const dragon::Head& head, const dragon::Tail& tail, const dragon::Coinc& coinc):
+      fChunk(chunk), fHead(head), fTail(tail), fCoinc(coinc),
+      fLastChunk(chunk.fEnd == index.GetNumEvents()), fEventNumber(chunk.fFirst), fFlushing(false)
+      {
+        SetSerials(index, DRAGON_HEAD_EVENT, fHeadSerials);
+        SetSerials(index, DRAGON_TAIL_EVENT, fTailSerials);
+      }
+	/// Event numbers owned and read
+	const TMidasFileIndex::Chunk_t& GetRange() const { return fChunk; }
+	/// Check if event number \e n is read by the chunk
+	bool Reads(size_t n) const { return n >= fChunk.fFirst && n < fChunk.fLast; }
+	/// Set the number of the event being unpacked
+	void SetEventNumber(size_t n) { fEventNumber = n; }
+	/// Flushing the queue after the last event read
+	void SetFlushing() { fFlushing = true; }
+	/// Check if the entry for \e code of the event being unpacked belongs to the chunk
+	bool Owns(Int_t code) const
+      {
+        switch (code) {
+        case DRAGON_HEAD_EVENT:  return InRange(fHead.header.fSerialNumber, fHeadSerials);
+        case DRAGON_COINC_EVENT: return InRange(fCoinc.head.header.fSerialNumber, fHeadSerials);
+        case DRAGON_TAIL_EVENT:
+        case DRAGON_SONIK_EVENT: return InRange(fTail.header.fSerialNumber, fTailSerials);
+        default:
+          if (fFlushing) return fLastChunk;
+          return fEventNumber >= fChunk.fBegin && fEventNumber < fChunk.fEnd;
+        }
+      }
+  private:
+	/// First and one past the last serial number of events with one id
+	typedef std::pair<Long64_t, Long64_t> Range_t;
+	/// Serial numbers of the events with id \e id from fChunk.fBegin up to fChunk.fEnd
+	void SetSerials(const TMidasFileIndex& index, int id, Range_t& range)
+      {
+        const long first = index.FindEvent(id, fChunk.fBegin);
+        const long next = index.FindEvent(id, fChunk.fEnd);
+        range = Range_t(0, 0);
+        if (first < 0 || size_t(first) >= fChunk.fEnd) return; // none in the chunk
+        range.first = index.GetEntry(first).fSerialNumber;
+        range.second = next < 0 ? (Long64_t(1) << 32) : Long64_t(index.GetEntry(next).fSerialNumber);
+      }
+	static bool InRange(Long64_t serial, const Range_t& range)
+      { return serial >= range.first && serial < range.second; }
+
+	TMidasFileIndex::Chunk_t fChunk;
+	const dragon::Head& fHead;
+	const dragon::Tail& fTail;
+	const dragon::Coinc& fCoinc;
+	Range_t fHeadSerials;
+	Range_t fTailSerials;
+	bool fLastChunk;     ///< Owns the end of the run
+	size_t fEventNumber; ///< Number of the event being unpacked
+	bool fFlushing;
+  };
+
+  /// Fills trees (and histograms) for unpacked event codes
+  /*!
+   * Used as the visitor in dragon::Unpacker::Unpack(); the tree for each code
+   * is found with a table lookup instead of searching the list of event codes.
+   */
+  class TreeFiller {
+  public:
+	/// Build the code -> tree index table
+	TreeFiller(const Output_t& output): fOutput(output), fHistos(output.fillHistos), fChunk(0)
+      {
+        std::fill(fIndex, fIndex + dragon::UnpackedCodes::kMaxCode, -1);
+        for (int i = 0; i< fOutput.nIds; ++i) {
+          if (fOutput.eventIds[i] >= 0 && fOutput.eventIds[i] < dragon::UnpackedCodes::kMaxCode)
+            fIndex[fOutput.eventIds[i]] = i;
+        }
+      }
+	/// Enable or disable histogram filling (only if requested in the output settings)
+	void SetFillHistos(bool histos) { fHistos = histos && fOutput.fillHistos; }
+	/// Only fill the entries owned by \e chunk, NULL to fill all of them
+	void SetChunk(const Chunk* chunk) { fChunk = chunk; }
+	/// Returns the tree index for \e code, or -1 if there is none
+	int Index(Int_t code) const
+      { return (code >= 0 && code < dragon::UnpackedCodes::kMaxCode) ? fIndex[code] : -1; }
+	/// Returns the address of the tree-bound object at \e index
+	void* Address(int index) const { return fOutput.addr[index]; }
+	/// Returns the SONIK object bound to \c t0, or NULL if it is not filled
+	Sonik* SonikAddress() const { return fOutput.fillSonik ? fOutput.sonik : 0; }
+	/// Fill the tree at \e index and its histograms
+	void Fill(int index)
+      {
+        const Output_t& o = fOutput;
+        if(o.trees[index]) {
+          dragon::utils::ProfileScope profile(dragon::utils::Profile::kTreeFill);
+          o.trees[index]->Fill();
+        }
+        if(o.summary) o.summary->Fill(o.eventIds[index], o.addr[index]);
+        if(fHistos) fill_histos(o.eventIds[index], o.addr[index]);
+      }
+	/// Fill the SONIK tree and its histograms
+	void FillSonik()
+      {
+        const Output_t& o = fOutput;
+        if(!o.fillSonik || !o.t0) return;
+        {
+          dragon::utils::ProfileScope profile(dragon::utils::Profile::kTreeFill);
+          o.t0->Fill();
+        }
+        if(fHistos) fill_histos(DRAGON_SONIK_EVENT, o.sonik);
+      }
+	/// Visitor interface: fill for one unpacked code
+	void operator() (Int_t code)
+      {
+        if (fChunk && !fChunk->Owns(code)) return;
+        if (code == DRAGON_SONIK_EVENT) { FillSonik(); return; }
+        int index = Index(code);
+        if (index >= 0) Fill(index);
+      }
+  private:
+	Output_t fOutput;
+	bool fHistos;
+	const Chunk* fChunk;
+	int fIndex[dragon::UnpackedCodes::kMaxCode];
+  };
+
+  /// Set by SIGINT while following a file, to stop waiting for more data
+  volatile sig_atomic_t gStopFollowing = 0;
+
+  /// SIGINT handler while following a file
+  extern "C" void stop_following(int) { gStopFollowing = 1; }
+
+  /// Follows a MIDAS file while it is being written (--follow)
+  /*!
+   * When the reader reaches the end of the data written so far, the trees are saved
+   * (baskets flushed and headers written, see TTree::AutoSave()) with a "checkpoint"
+   * of how far the conversion has got, and the file is checked for more data. The
+   * unpacker and the timestamp queue simply carry on once there is: events in the
+   * queue are matched and filled as more data arrive, as in the conversion of the
+   * complete file. Following stops after the end-of-run event, or on SIGINT.
+   */
+  class Follower {
+  public:
+	/// Check \e file every \e seconds, saving the trees of \e output in \e fout
+	Follower(int seconds, const Output_t& output, TFile& fout, const dragon::Unpacker& unpack):
+      fSeconds(seconds), fOutput(output), fFile(fout), fUnpack(unpack), fEor(false), fSaved(-1)
+      {
+        gStopFollowing = 0;
+        fHandler = signal(SIGINT, stop_following);
+      }
+	/// Restore the SIGINT handler
+	~Follower() { signal(SIGINT, fHandler); }
+	/// Called for every event read, to stop at the end of the run
+	void Read(const TMidasEvent& event) { if (event.GetEventId() == MIDAS_EOR) fEor = true; }
+	/// At the end of the data read so far: save the output, then wait for more of \e fin
+	/*!
+	 * \param nread Number of events read
+	 * \returns true once there are more data, false at the end of the run, on a read error or on SIGINT
+	 */
+	bool Wait(TMidasFile& fin, Long64_t nread)
+      {
+        if (fEor || fin.GetLastErrno() != 0) return false;
+        if (nread != fSaved) Checkpoint(nread);
+        while (!gStopFollowing) {
+          if (fin.Follow()) return true;
+          if (fin.GetLastErrno() != 0) return false;
+          sleep(fSeconds);
+        }
+        m2r::cout << "\nInterrupted, finishing the conversion.\n";
+        return false;
+      }
+  private:
+	/// Save the trees and the checkpoint
+	void Checkpoint(Long64_t nread)
+      {
+        TDirectory::TContext context(&fFile);
+        for (int i = 0; i< fOutput.nIds; ++i) {
+          if (fOutput.trees[i]) fOutput.trees[i]->AutoSave("FlushBaskets");
+        }
+        if (fOutput.t0) fOutput.t0->AutoSave("FlushBaskets");
+        const size_t nqueued = fUnpack.IsSinglesMode() ? 0 : fUnpack.GetQueue()->Size();
+        TNamed checkpoint("checkpoint", TString::Format("%lld events read, %lu in the timestamp queue",
+                                                        nread, (unsigned long)nqueued).Data());
+        checkpoint.Write("checkpoint", TObject::kOverwrite);
+        fFile.SaveSelf();
+        fSaved = nread;
+      }
+
+	int fSeconds;
+	Output_t fOutput;
+	TFile& fFile;
+	const dragon::Unpacker& fUnpack;
+	bool fEor;
+	Long64_t fSaved; ///< Number of events read at the last checkpoint
+	void (*fHandler)(int);
+  };
+
+  /// Multi-threaded conversion pipeline
+  /*!
+   * Stages, connected by bounded queues:
+   *   - Reader thread: reads raw events from the MIDAS file.
+   *   - Ordered stage (calling thread): runs a dragon::Unpacker on every event, in file order, with
+   *     itself set as the unpacking delegate. Timestamp matching, BOR/EOR, scaler, EPICS, run parameter
+   *     and diagnostics handling are done here exactly as in the serial conversion; head, tail and
+   *     coincidence events are copied into a Group_t for the workers.
+   *   - Worker threads: run unpack() and calculate() on the head, tail and coincidence events of each group
+   *     (and the SONIK calculation on its tail event, with --sonik).
+   *   - Writer thread: takes groups back in sequence order and fills the trees (and histograms).
+   *
+   * Since each group corresponds to one call to dragon::Unpacker::Unpack() or
+   * dragon::Unpacker::FlushQueueIterative() in the serial loop, and is written in the same
+   * order with the same data, every tree receives exactly the same entries in the same order.
+   * A single writer thread is used for all trees because they share one TFile, and ROOT does
+   * not support concurrent basket writes to the same file; with --imt, the writer's basket
+   * compression is itself spread over the ROOT implicit multi-threading pool.
+   */
+  class Pipeline: public dragon::Unpacker::Delegate {
+  public:
+	/// Everything produced by one step of the ordered stage
+	struct Group_t {
+      Long64_t fSeq;                 ///< Sequence number
+      bool fFlush;                   ///< Produced while flushing the queue (no histograms)
+      dragon::UnpackedCodes fCodes;  ///< Unpacked event codes
+      bool fHaveHead, fHaveTail, fHaveCoinc;
+      midas::Event fHeadEvent;       ///< Head singles event to unpack
+      midas::Event fTailEvent;       ///< Tail singles event to unpack
+      midas::Event fGammaEvent;      ///< Head part of the coincidence to unpack
+      midas::Event fHeavyIonEvent;   ///< Tail part of the coincidence to unpack
+      dragon::Head fHead;
+      dragon::Tail fTail;
+      dragon::Coinc fCoinc;
+      Sonik fSonik;
+      dragon::Epics fEpics;
+      dragon::Scaler fHeadScaler;
+      dragon::Scaler fTailScaler;
+      dragon::Scaler fAuxScaler;
+      dragon::RunParameters fRunpar;
+      tstamp::Diagnostics fDiag;
+	};
+
+  private:
+	/// Reads raw events into fRawQ
+	class Reader: public dragon::utils::Thread {
+	public:
+      Reader(Pipeline* p): fP(p) { }
+	private:
+      void Run()
+		{
+          TMidasEvent* event;
+          while (fP->fRawFree.Pop(event)) {
+            if (!fP->fFile.Read(event)) { fP->fRawFree.Push(event); break; }
+            fP->fRawQ.Push(event);
+          }
+          fP->fRawQ.Close();
+		}
+      Pipeline* fP;
+	};
+
+	/// Unpacks groups from fWorkQ
+	class Worker: public dragon::utils::Thread {
+	public:
+      Worker(Pipeline* p): fP(p) { }
+	private:
+      void Run()
+		{
+          Group_t* g;
+          while (fP->fWorkQ.Pop(g)) {
+            fP->Calculate(g);
+            fP->Done(g);
+          }
+		}
+      Pipeline* fP;
+	};
+
+	/// Writes groups in sequence order
+	class Writer: public dragon::utils::Thread {
+	public:
+      Writer(Pipeline* p): fP(p) { }
+	private:
+      void Run()
+		{
+          Group_t* g;
+          while ((g = fP->NextDone()) != 0) {
+            fP->Write(g);
+            fP->fGroupFree.Push(g);
+          }
+		}
+      Pipeline* fP;
+	};
+
+  public:
+	/// Set up the pipeline, including its own unpacker and detector classes
+	Pipeline(TMidasFile& file, const Output_t& output, int nthreads, bool singles,
+             double coincWindow, double queueTime, tstamp::Queue::Engine_t engine,
+             UInt_t diagEvents, UInt_t diagSeconds, const char* odb):
+      fFile(file), fFiller(output), fNumWorkers(nthreads),
+      fUnpacker(&fHead, &fTail, &fCoinc, &fEpics, &fHeadScaler, &fTailScaler,
+                &fAuxScaler, &fRunpar, &fDiag, singles),
+      fCurrent(0), fRawFree(4*nthreads + 8), fRawQ(4*nthreads + 8),
+      fGroupFree(4*nthreads + 8), fWorkQ(4*nthreads + 8),
+      fNextWrite(0), fTotal(-1)
+      {
+        if(!singles) {
+          fUnpacker.SetCoincWindow(coincWindow);
+          fUnpacker.SetQueueTime(queueTime);
+          fUnpacker.SetQueueEngine(engine);
+          fUnpacker.GetQueue()->SetDiagnosticsSampling(diagEvents, diagSeconds);
+        }
+        if(output.fillSonik) fUnpacker.SetSonik(&fSonik);
+        fUnpacker.HandleBor(odb);
+        fUnpacker.SetDelegate(this);
+
+        const size_t ngroups = 4*nthreads + 8;
+        for (size_t i = 0; i< ngroups; ++i) {
+          Group_t* g = new Group_t();
+          g->fHead  = fHead;  // copies variables
+          g->fTail  = fTail;
+          g->fCoinc = fCoinc;
+          g->fSonik = fSonik;
+          fGroups.push_back(g);
+          fGroupFree.Push(g);
+          TMidasEvent* event = new TMidasEvent();
+          fRaw.push_back(event);
+          fRawFree.Push(event);
+        }
+      }
+
+	/// Free groups and raw events
+	~Pipeline()
+      {
+        for (size_t i = 0; i< fGroups.size(); ++i) delete fGroups[i];
+        for (size_t i = 0; i< fRaw.size(); ++i) delete fRaw[i];
+      }
+
+	/// Convert the whole file, returns the number of events read
+	Int_t Run(std::auto_ptr<midas::Database>& db0, std::auto_ptr<midas::Database>& db1)
+      {
+        Reader reader(this);
+        Writer writer(this);
+        std::vector<Worker*> workers;
+        for (int i = 0; i< fNumWorkers; ++i) workers.push_back(new Worker(this));
+
+        reader.Start();
+        writer.Start();
+        for (size_t i = 0; i< workers.size(); ++i) workers[i]->Start();
+
+        Long64_t seq = 0;
+        Int_t nnn = 0;
+        TMidasEvent* event;
+        while (fRawQ.Pop(event)) {
+          Group_t* g = NewGroup(seq++, false);
+          if (event->GetEventId() == MIDAS_BOR || event->GetEventId() == MIDAS_EOR) {
+            // The full dump is kept for the output file; unpack the run parameters from the same parse
+            std::auto_ptr<midas::Database>& db = event->GetEventId() == MIDAS_BOR ? db0 : db1;
+            db.reset(new midas::Database(event->GetData(), event->GetDataSize()));
+            fUnpacker.ClearUnpackedCodes();
+            fUnpacker.UnpackRunParameters(*db);
+            g->fCodes = fUnpacker.GetUnpacked();
+          }
+          else
+            g->fCodes = fUnpacker.Unpack(event->GetEventHeader(), event->GetData());
+          fRawFree.Push(event);
+          Submit(g);
+          m2r::static_counter (nnn++, 1000, false);
+        }
+        m2r::static_counter (nnn, 1000, true);
+
+        if(!fUnpacker.IsSinglesMode()) { // Flush the queue
+          while (1) {
+            Group_t* g = NewGroup(seq, true);
+            size_t qsize = fUnpacker.FlushQueueIterative(); // Unpacks implicitly
+            if (qsize == 0) { fGroupFree.Push(g); break; }
+            g->fCodes = fUnpacker.GetUnpacked();
+            ++seq;
+            Submit(g);
+          }
+        }
+
+        fWorkQ.Close();
+        for (size_t i = 0; i< workers.size(); ++i) { workers[i]->Join(); delete workers[i]; }
+        {
+          dragon::utils::ScopedLock lock(fDoneMutex);
+          fTotal = seq;
+          fDoneCond.Broadcast();
+        }
+        writer.Join();
+        reader.Join();
+        return nnn;
+      }
+
+	/// Delegate: store head singles event for the workers
+	void UnpackHead(const midas::Event& event)
+      { fCurrent->fHeadEvent = event; fCurrent->fHaveHead = true; }
+
+	/// Delegate: store tail singles event for the workers
+	void UnpackTail(const midas::Event& event)
+      { fCurrent->fTailEvent = event; fCurrent->fHaveTail = true; }
+
+	/// Delegate: store coincidence events for the workers
+	void UnpackCoinc(const midas::CoincEvent& event)
+      {
+        fCurrent->fGammaEvent = *event.fGamma;
+        fCurrent->fHeavyIonEvent = *event.fHeavyIon;
+        fCurrent->fHaveCoinc = true;
+      }
+
+  private:
+	/// Get a free group and make it current
+	Group_t* NewGroup(Long64_t seq, bool flush)
+      {
+        Group_t* g = 0;
+        fGroupFree.Pop(g);
+        g->fSeq = seq;
+        g->fFlush = flush;
+        g->fHaveHead = g->fHaveTail = g->fHaveCoinc = false;
+        fCurrent = g;
+        return g;
+      }
+
+	/// Copy the ordered-stage results into the current group and send it to the workers
+	void Submit(Group_t* g)
+      {
+        const dragon::UnpackedCodes& c = g->fCodes;
+        if (c.Test(DRAGON_HEAD_SCALER))        g->fHeadScaler = fHeadScaler;
+        if (c.Test(DRAGON_TAIL_SCALER))        g->fTailScaler = fTailScaler;
+        if (c.Test(DRAGON_AUX_SCALER))         g->fAuxScaler  = fAuxScaler;
+        if (c.Test(DRAGON_EPICS_EVENT))        g->fEpics      = fEpics;
+        if (c.Test(DRAGON_RUN_PARAMETERS))     g->fRunpar     = fRunpar;
+        if (c.Test(DRAGON_TSTAMP_DIAGNOSTICS)) g->fDiag       = fDiag;
+        fCurrent = 0;
+        fWorkQ.Push(g);
+      }
+
+	/// Worker: same as dragon::Unpacker::UnpackHead(), UnpackTail() (including SONIK), UnpackCoinc()
+	void Calculate(Group_t* g)
+      {
+        if (g->fHaveHead) {
+          g->fHead.reset();
+          g->fHead.unpack(g->fHeadEvent);
+          g->fHead.calculate();
+        }
+        if (g->fHaveTail) {
+          g->fTail.reset();
+          g->fTail.unpack(g->fTailEvent);
+          g->fTail.calculate();
+          if (g->fCodes.Test(DRAGON_SONIK_EVENT)) {
+            g->fSonik.reset();
+            g->fSonik.read_data(g->fTail.v785, g->fTail.v1190);
+            g->fSonik.calculate();
+          }
+        }
+        if (g->fHaveCoinc) {
+          midas::CoincEvent coincEvent(g->fGammaEvent, g->fHeavyIonEvent);
+          g->fCoinc.reset();
+          g->fCoinc.unpack(coincEvent);
+          g->fCoinc.calculate();
+        }
+      }
+
+	/// Worker: hand a finished group to the writer
+	void Done(Group_t* g)
+      {
+        dragon::utils::ScopedLock lock(fDoneMutex);
+        fDone[g->fSeq] = g;
+        fDoneCond.Broadcast();
+      }
+
+	/// Writer: wait for the next group in sequence, NULL when finished
+	Group_t* NextDone()
+      {
+        dragon::utils::ScopedLock lock(fDoneMutex);
+        while (1) {
+          std::map<Long64_t, Group_t*>::iterator it = fDone.find(fNextWrite);
+          if (it != fDone.end()) {
+            Group_t* g = it->second;
+            fDone.erase(it);
+            ++fNextWrite;
+            return g;
+          }
+          if (fTotal >= 0 && fNextWrite >= fTotal) return 0;
+          fDoneCond.Wait(fDoneMutex);
+        }
+      }
+
+	/// Writer: visitor copying group data out before filling
+	struct GroupWriter {
+      Pipeline* fP;
+      const Group_t* fGroup;
+      void operator() (Int_t code)
+		{
+          if (code == DRAGON_SONIK_EVENT) {
+            Sonik* sonik = fP->fFiller.SonikAddress();
+            if (sonik) *sonik = fGroup->fSonik;
+            fP->fFiller.FillSonik();
+            return;
+          }
+          int index = fP->fFiller.Index(code);
+          if (index < 0) return;
+          CopyOut(fGroup, code, fP->fFiller.Address(index));
+          fP->fFiller.Fill(index);
+		}
+	};
+
+	/// Writer: fill trees, same as the serial conversion loop
+	void Write(Group_t* g)
+      {
+        fFiller.SetFillHistos(!g->fFlush);
+        GroupWriter writer = { this, g };
+        g->fCodes.Visit(writer);
+      }
+
+	/// Writer: copy group data into a tree-bound object
+	static void CopyOut(const Group_t* g, int code, void* addr)
+      {
+        switch (code) {
+        case DRAGON_HEAD_EVENT:         *reinterpret_cast<dragon::Head*>(addr)          = g->fHead;       break;
+        case DRAGON_TAIL_EVENT:         *reinterpret_cast<dragon::Tail*>(addr)          = g->fTail;       break;
+        case DRAGON_COINC_EVENT:        *reinterpret_cast<dragon::Coinc*>(addr)         = g->fCoinc;      break;
+        case DRAGON_HEAD_SCALER:        *reinterpret_cast<dragon::Scaler*>(addr)        = g->fHeadScaler; break;
+        case DRAGON_TAIL_SCALER:        *reinterpret_cast<dragon::Scaler*>(addr)        = g->fTailScaler; break;
+        case DRAGON_AUX_SCALER:         *reinterpret_cast<dragon::Scaler*>(addr)        = g->fAuxScaler;  break;
+        case DRAGON_EPICS_EVENT:        *reinterpret_cast<dragon::Epics*>(addr)         = g->fEpics;      break;
+        case DRAGON_RUN_PARAMETERS:     *reinterpret_cast<dragon::RunParameters*>(addr) = g->fRunpar;     break;
+        case DRAGON_TSTAMP_DIAGNOSTICS: *reinterpret_cast<tstamp::Diagnostics*>(addr)   = g->fDiag;       break;
+        default: break;
+        }
+      }
+
+  private:
+	TMidasFile& fFile;
+	TreeFiller fFiller;
+	int fNumWorkers;
+
+	// Ordered-stage detector classes and unpacker
+	dragon::Head fHead;
+	dragon::Tail fTail;
+	dragon::Coinc fCoinc;
+	Sonik fSonik;
+	dragon::Epics fEpics;
+	dragon::Scaler fHeadScaler;
+	dragon::Scaler fTailScaler;
+	dragon::Scaler fAuxScaler;
+	dragon::RunParameters fRunpar;
+	tstamp::Diagnostics fDiag;
+	dragon::Unpacker fUnpacker;
+
+	Group_t* fCurrent;                                ///< Group being filled by the ordered stage
+	std::vector<Group_t*> fGroups;                    ///< All groups (owned)
+	std::vector<TMidasEvent*> fRaw;                   ///< All raw events (owned)
+	dragon::utils::BoundedQueue<TMidasEvent*> fRawFree;
+	dragon::utils::BoundedQueue<TMidasEvent*> fRawQ;
+	dragon::utils::BoundedQueue<Group_t*> fGroupFree;
+	dragon::utils::BoundedQueue<Group_t*> fWorkQ;
+
+	dragon::utils::Mutex fDoneMutex;
+	dragon::utils::Condition fDoneCond;
+	std::map<Long64_t, Group_t*> fDone;               ///< Finished groups waiting to be written
+	Long64_t fNextWrite;                              ///< Next sequence number to write
+	Long64_t fTotal;                                  ///< Total number of groups, -1 until known
+  };
+
+  /// Default output file name for input file \e in
+  /*!
+   * Strips any '.mid' extension and the input directory and adds '.root'; the file
+   * is placed in $DH/rootfiles if that directory exists, the present working directory
+   * otherwise.
+   */
+  TString default_output(const std::string& in)
   {
-	m2r::Options_t options;
-	int arg_result = m2r::process_args(argc, argv, &options);
-	if(arg_return) return arg_result;
+	TString out = in.c_str();
+	//
+	// Strip '.mid' extension if it's there
+	if(out.Contains(".mid"))
+      out.Remove(out.Index(".mid"));
+	//
+	// Add '.root' extension
+	out.Append(".root");
+	//
+	// Strip input directory
+	out = gSystem->BaseName(out.Data());
+	//
+	// Check for $DH/rootfiles
+	TString outdir = "$DH";
+	Int_t gel = gErrorIgnoreLevel;
+	gErrorIgnoreLevel = 3001; // Suppress error if $DH isn't available
+	Bool_t have_DH = !(gSystem->ExpandPathName(outdir));
+	gErrorIgnoreLevel = gel; // reset error level
+
+  dhcheck:
+	if (have_DH) { // Check for $DH/rootfiles
+      outdir += "/rootfiles";
+      void *d = gSystem->OpenDirectory(outdir.Data());
+      if (d) // Directory exists, need to free it
+        gSystem->FreeDirectory(d);
+      else { // Doesn't exist, set path back to "."
+        have_DH = false;
+        goto dhcheck;
+      }
+	}
+	else outdir = ".";
 
+	gSystem->PrependPathName(outdir.Data(), out);
+	return out;
+  }
+
+  //
+  /// Convert one file, options.fIn, to options.fOut (or the default output file)
+  /*!
+   * \param [out] nevents Number of MIDAS events read, if not NULL
+   * \returns the program exit status
+   */
+  int convert(m2r::Options_t options, Long64_t* nevents = 0)
+  {
 	//
 	// Open input file
 	TMidasFile fin;
@@ -319,40 +1585,12 @@ namespace m2r {
 	TString out = options.fOut.empty() ? options.fIn.c_str() : options.fOut.c_str();
 	//
 	// If no output specified, create file name from input
-	if (options.fOut.empty()) {
-      //
-      // Strip '.mid' extension if it's there
-      if(out.Contains(".mid"))
-        out.Remove(out.Index(".mid"));
-      //
-      // Add '.root' extension
-      out.Append(".root");
-      //
-      // Strip input directory
-      out = gSystem->BaseName(out.Data());
-      //
-      // Check for $DH/rootfiles
-      TString outdir = "$DH";
-      Int_t gel = gErrorIgnoreLevel;
-      gErrorIgnoreLevel = 3001; // Suppress error if $DH isn't available
-      Bool_t have_DH = !(gSystem->ExpandPathName(outdir));
-      gErrorIgnoreLevel = gel; // reset error level
-
-    dhcheck:
-      if (have_DH) { // Check for $DH/rootfiles
-        outdir += "/rootfiles";
-        void *d = gSystem->OpenDirectory(outdir.Data());
-        if (d) // Directory exists, need to free it
-          gSystem->FreeDirectory(d);
-        else { // Doesn't exist, set path back to "."
-          have_DH = false;
-          goto dhcheck;
-        }
-      }
-      else outdir = ".";
-
-      gSystem->PrependPathName(outdir.Data(), out);
-	} // if (options.fOut.empty()) {
+	if (options.fOut.empty())
+      out = default_output(options.fIn);
+	if (options.fOut.empty() && options.fChunks > 0) {
+      out.Remove(out.Length() - 5); // ".root"
+      out += TString::Format("_chunk%d.root", options.fChunk);
+	}
 
 	//
 	// Handle odb variables file
@@ -396,16 +1634,25 @@ namespace m2r {
 	}
 
 	//
-	// Open histos file if specified
-	bool fillHistos = false;
-	if(!options.fHistos.empty()) {
-      fillHistos = true;
-      read_histos(options.fHistos);
-	}
+	// Fill histograms if specified (read in main_())
+	bool fillHistos = !options.fHistos.empty();
 
 	m2r::cout
       << "\nConverting MIDAS file\n\t\'" << options.fIn << "\'\n"
       << "into ROOT file\n\t\'" << out.Data() << "\'\n";
+	if (options.fFlat)
+      m2r::cout << "Writing flat columns" << (options.fRaw ? " (including raw VME modules).\n" : ".\n");
+
+	//
+	// Parallel basket compression
+	if (options.fImt != 0) {
+#if ROOT_VERSION_CODE >= ROOT_VERSION(6,10,0)
+      ROOT::EnableImplicitMT(options.fImt > 0 ? options.fImt : 0);
+      m2r::cout << "Compressing output with " << ROOT::GetImplicitMTPoolSize() << " threads.\n";
+#else
+      m2r::cwar << "Warning: --imt requires ROOT 6.10 or later, ignoring.\n";
+#endif
+	}
 
 	TFile fout (out.Data(), "RECREATE", ftitle.c_str());
 	if (fout.IsZombie()) {
@@ -487,28 +1734,6 @@ namespace m2r {
                                           "dragon::RunParameters"
 	};
 
-	// SONIK Tree
-	TTree* trees[nIds];
-	TTree* t0 = 0;
-	if(options.fSonik) {
-      t0 = new TTree("t0", "Sonik Events");
-      t0->Branch("sonik", "Sonik", &psonik);
-	}
-
-	// Normal trees
-	for(int i=0; i< nIds; ++i) {
-      char buf[256];
-      sprintf (buf, "t%d", eventIds[i]); // n.b. TTree cleanup handled by TFile destructor
-      //
-      bool makeTree = true; // always make all trees
-      if (makeTree) {
-        trees[i] = new TTree(buf, eventTitles[i].c_str());
-        trees[i]->Branch(branchNames[i].c_str(), classNames[i].c_str(), &(addr[i]));
-      } else {
-        trees [i] = 0;
-      }
-	}
-
 	dragon::Unpacker
       unpack (&head, &tail, &coinc, &epics, &head_scaler, &tail_scaler, &aux_scaler, &runpar, &tsdiag, options.fSingles);
 
@@ -530,96 +1755,198 @@ namespace m2r {
       m2r::cout
         << "\nUnpacker parameters: coincidence window = " << unpack.GetCoincWindow() << " usec., "
         << "queue time = " << unpack.GetQueueTime() << " sec.\n\n";
+      unpack.SetQueueEngine(options.fQueue);
+      unpack.GetQueue()->SetDiagnosticsSampling(options.fDiagEvents, options.fDiagSeconds);
 	}
 	else {
       m2r::cout << "\nRunning in singles mode.\n\n";
 	}
 
 	//
-	// Begin-of-run initialization
+	// Begin-of-run initialization, before creating branches: flat trees
+	// have none for tail detectors which are not installed
+	if(options.fSonik) unpack.SetSonik(&sonik);
 	unpack.HandleBor(options.fOdb.c_str());
 
+	// SONIK Tree
+	TTree* trees[nIds];
+	TTree* t0 = 0;
+	m2r::FlatBranches flat(options);
+	if(options.fSonik) {
+      t0 = new TTree("t0", "Sonik Events");
+      m2r::configure_tree(t0, options);
+      if(options.fFlat)
+        flat.Add(t0, sonik);
+      else
+        m2r::apply_compression(t0->Branch("sonik", "Sonik", &psonik), options.fCompress[m2r::kPhysics]);
+	}
+
+	// Normal trees
+	for(int i=0; i< nIds; ++i) {
+      char buf[256];
+      sprintf (buf, "t%d", eventIds[i]); // n.b. TTree cleanup handled by TFile destructor
+      //
+      bool makeTree = true; // always make all trees
+      if (makeTree) {
+        trees[i] = new TTree(buf, eventTitles[i].c_str());
+        m2r::configure_tree(trees[i], options);
+        if(options.fFlat) {
+          flat.Add(trees[i], eventIds[i], addr[i]);
+        }
+        else {
+          const bool physics = (eventIds[i] == DRAGON_HEAD_EVENT ||
+                                eventIds[i] == DRAGON_TAIL_EVENT ||
+                                eventIds[i] == DRAGON_COINC_EVENT);
+          TBranch* branch = trees[i]->Branch(branchNames[i].c_str(), classNames[i].c_str(), &(addr[i]));
+          m2r::apply_compression(branch, options.fCompress[physics ? m2r::kPhysics : m2r::kAux]);
+        }
+      } else {
+        trees [i] = 0;
+      }
+	}
+
 	//
 	// ODB parameters
 	std::auto_ptr<midas::Database> db0(0); // run start
 	std::auto_ptr<midas::Database> db1(0); // run stop
 
+	//
+	// Tree filling, looked up by event code
+	// (no run summary for chunks, which only have part of the run)
+	dragon::RunSummary summary;
+	m2r::Output_t output = { nIds, eventIds, trees, addr, fillHistos, options.fSonik, &sonik, t0,
+                             options.fChunks > 0 ? 0 : &summary };
+	m2r::TreeFiller filler(output);
+	if (options.fProfile) dragon::utils::Profile::Enable(options.fProfile);
+
+	//
+	// Convert one chunk of the run, with margins of the queue time and coincidence window
+	std::auto_ptr<m2r::Chunk> chunk(0);
+	if (options.fChunks > 0) {
+      if (!fin.LoadIndex(true, &midas::Event::IndexTime)) {
+        m2r::cerr << "Error: Couldn't index the file \'" << options.fIn
+                  << "\': \"" << fin.GetLastError() << ".\"\n\n";
+        return 1;
+      }
+      const double margin = options.fSingles ? 0 : unpack.GetQueueTime()*1e6 + unpack.GetCoincWindow();
+      const TMidasFileIndex* index = fin.GetIndex();
+      chunk.reset(new m2r::Chunk(*index, index->GetChunk(options.fChunk, options.fChunks, margin), head, tail, coinc));
+      const TMidasFileIndex::Chunk_t& range = chunk->GetRange();
+      if (range.fFirst < index->GetNumEvents() && !fin.SeekEvent(range.fFirst)) {
+        m2r::cerr << "Error: Couldn't go to event " << range.fFirst << " of the file \'" << options.fIn
+                  << "\': \"" << fin.GetLastError() << ".\"\n\n";
+        return 1;
+      }
+      filler.SetChunk(chunk.get());
+      if (options.fThreads > 1)
+        m2r::cwar << "Warning: --threads is ignored with --chunk.\n";
+      options.fThreads = 1;
+      m2r::cout << "Converting chunk " << options.fChunk << " of " << options.fChunks << ": events "
+                << range.fBegin << " - " << range.fEnd << " of " << index->GetNumEvents()
+                << ", reading " << range.fFirst << " - " << range.fLast << ".\n\n";
+	}
+
+	//
+	// Follow the input file while it is written
+	std::auto_ptr<m2r::Follower> follower(0);
+	if (options.fFollow > 0) {
+      if (!fin.CanFollow()) {
+        m2r::cerr << "Error: Can only follow local, uncompressed files, not \'" << options.fIn << "\'.\n\n";
+        return 1;
+      }
+      if (options.fThreads > 1)
+        m2r::cwar << "Warning: --threads is ignored with --follow.\n";
+      options.fThreads = 1;
+      follower.reset(new m2r::Follower(options.fFollow, output, fout, unpack));
+      m2r::cout << "Following the input file until the end of the run (Ctrl-C to stop).\n\n";
+	}
+
+	//
+	// Multi-threaded conversion
+	if (options.fThreads > 1) {
+#if ROOT_VERSION_CODE >= ROOT_VERSION(6,0,0)
+      ROOT::EnableThreadSafety();
+#endif
+      m2r::cout << "Converting with " << options.fThreads << " worker threads.\n\n";
+      m2r::Pipeline pipeline(fin, output, options.fThreads, options.fSingles,
+                             unpack.GetCoincWindow(), unpack.GetQueueTime(), options.fQueue,
+                             options.fDiagEvents, options.fDiagSeconds, options.fOdb.c_str());
+      Int_t nread = pipeline.Run(db0, db1);
+      if (nevents) *nevents = nread;
+	}
 	//
 	// Loop over events in the midas file
 	int nnn = 0;
-	while (1) {
+	while (options.fThreads <= 1) {
+      if (chunk.get()) { // stop after the margin following the chunk
+        if (!chunk->Reads(fin.GetEventNumber())) break;
+        chunk->SetEventNumber(fin.GetEventNumber());
+      }
       //
       // Read event from MIDAS file
       TMidasEvent temp;
-      bool success = fin.Read(&temp);
-      if (!success) break;
-
-      //
-      // Read ODB tree if MIDAS_EOR buffer
-      if (temp.GetEventId() == MIDAS_BOR) {
-        db0.reset(new midas::Database(temp.GetData(), temp.GetDataSize()));
-      }
-      else if (temp.GetEventId() == MIDAS_EOR) {
-        db1.reset(new midas::Database(temp.GetData(), temp.GetDataSize()));
+      bool success = fin.ReadView(&temp); // temp is processed before the next read
+      if (!success) {
+        if (follower.get() && follower->Wait(fin, nnn)) continue; // more data written
+        break;
       }
+      if (follower.get()) follower->Read(temp);
 
       //
-      // Unpack into our classes
-      std::vector<Int_t> which =
-        unpack.UnpackMidasEvent(temp.GetEventHeader(), temp.GetData());
-
-      //
-      // Check which classes have data, fill trees for those that do
-      // Also fill histograms if appropriate
-      for (int i=0; i< nIds; ++i) {
-        std::vector<Int_t>::iterator it =
-          std::find(which.begin(), which.end(), eventIds[i]);
-        if(it != which.end()) {
-          if(trees[i]) {
-            trees[i]->Fill();
-          }
-          if(fillHistos) fill_histos(*it, addr[i]);
-          if(options.fSonik && eventIds[i] == DRAGON_TAIL_EVENT) {
-            sonik.reset();
-            sonik.read_data(tail.v785, tail.v1190);
-            sonik.calculate();
-            t0->Fill();
-            if(fillHistos) fill_histos(0, psonik);
-          }
-        }
+      // Read ODB tree if MIDAS_BOR or MIDAS_EOR buffer, and unpack the run
+      // parameters from it rather than having the unpacker parse it again
+      if (temp.GetEventId() == MIDAS_BOR || temp.GetEventId() == MIDAS_EOR) {
+        std::auto_ptr<midas::Database>& db = temp.GetEventId() == MIDAS_BOR ? db0 : db1;
+        db.reset(new midas::Database(temp.GetData(), temp.GetDataSize()));
+        unpack.ClearUnpackedCodes();
+        unpack.UnpackRunParameters(*db);
+        unpack.GetUnpacked().Visit(filler);
+      }
+      else {
+        //
+        // Unpack into our classes, then fill trees for those that have
+        // data; also fill histograms if appropriate
+        unpack.Unpack(temp.GetEventHeader(), temp.GetData(), filler);
       }
       m2r::static_counter (nnn++, 1000, false);
 	} // while (1) {
 
-	m2r::static_counter (nnn, 1000, true);
+	if (options.fThreads <= 1) {
+      m2r::static_counter (nnn, 1000, true);
+      if (nevents) *nevents = nnn;
+	}
 
-	if(!options.fSingles) { // Flush the queue
+	if(!options.fSingles && options.fThreads <= 1) { // Flush the queue
+      filler.SetFillHistos(false);
+      if (chunk.get()) chunk->SetFlushing();
       size_t qsize;
       while (1) {
         qsize = unpack.FlushQueueIterative(); // Fills classes implicitly
         if (qsize == 0) break;
 
         // Explicitly fill TTrees
-        std::vector<Int_t> which = unpack.GetUnpackedCodes();
-        for (int i=0; i< nIds; ++i) {
-          std::vector<Int_t>::iterator it =
-            std::find(which.begin(), which.end(), eventIds[i]);
-          if(it != which.end()) {
-            if(trees[i]) {
-              trees[i]->Fill();
-            }
-            if(options.fSonik && eventIds[i] == DRAGON_TAIL_EVENT) {
-              sonik.reset();
-              sonik.read_data(tail.v785, tail.v1190);
-              sonik.calculate();
-              t0->Fill();
-            }
-          }
-        }
+        unpack.GetUnpacked().Visit(filler);
       }
 	}
 
 	m2r::cout << "\nDone!\n\n";
+	if (options.fProfile) {
+      dragon::utils::Profile::Disable();
+      dragon::utils::Profile::Print(m2r::cout);
+      m2r::cout << "\n";
+	}
+
+	//
+	// Run summary, once the run is complete (trees 0, 2 and 4 are t1, t3 and t5)
+	if(output.summary && db1.get()) {
+      const Long64_t nhead  = trees[0] ? trees[0]->GetEntries() : 0;
+      const Long64_t ntail  = trees[2] ? trees[2]->GetEntries() : 0;
+      const Long64_t ncoinc = trees[4] ? trees[4]->GetEntries() : 0;
+      if(summary.Finish(db1.get(), nhead, ntail, ncoinc)) {
+        fout.cd();
+        summary.Write("summary");
+      }
+	}
 
 	//
 	// Write trees to file.
@@ -644,12 +1971,14 @@ namespace m2r {
 	//
 	// Write run start ODB variables
 	if(db0.get()) {
+      db0->BuildSnapshot();
       db0->SetNameTitle("odbstart", "ODB tree at run start.");
       db0->Write("odbstart");
 	}
 	//
 	// Write run stop ODB variables
 	if(db1.get()) {
+      db1->BuildSnapshot();
       db1->SetNameTitle("odbstop", "ODB tree at run stop.");
       db1->Write("odbstop");
 
@@ -663,14 +1992,322 @@ namespace m2r {
 	db.SetNameTitle("variables", "ODB tree used in analysis.");
 	db.Write("variables");
 	//
-	// Print delayed error messages
+	// Print delayed error messages, and the totals of rate-limited ones
 	dragon::utils::gDelayedMessageFactory.Flush();
+	dragon::utils::MessageLimit::Flush();
 	//
 	// Close output file
 	fout.Close();
 	return 0;
   }
 
+  /// Seconds since the epoch, with microsecond resolution
+  double wall_time()
+  {
+	timeval tv;
+	gettimeofday(&tv, 0);
+	return tv.tv_sec + 1e-6*tv.tv_usec;
+  }
+
+  /// Convert several runs, each in a child process of a pool of options.fJobs
+  /*!
+   * The children are forked after the histogram definitions have been parsed and ROOT
+   * and the dictionaries initialized, so each conversion starts from a copy of that
+   * state instead of setting it up again. Runs whose output file is newer than the
+   * input are skipped unless --overwrite is given. With -o, the outputs are written
+   * to that directory.
+   * \returns the number of failed conversions (0 for success)
+   */
+  int convert_batch(const m2r::Options_t& options)
+  {
+	/// One run to convert
+	struct Job_t {
+      std::string fIn;       ///< Input file
+      std::string fOut;      ///< Output file
+      Long64_t fSize;        ///< Size of the input file, bytes
+      Long64_t fEvents;      ///< Number of events converted
+      double fStart;         ///< Start time of the child process
+      int fPipe;             ///< Read end of the pipe reporting fEvents
+	};
+
+	std::vector<Job_t> jobs;
+	for (size_t i = 0; i< options.fInputs.size(); ++i) {
+      Job_t job = { options.fInputs[i], "", 0, 0, 0, -1 };
+      TString out = default_output(job.fIn);
+      if (!options.fOut.empty()) {
+        out = gSystem->BaseName(out.Data());
+        gSystem->PrependPathName(options.fOut.c_str(), out);
+      }
+      job.fOut = out.Data();
+
+      struct stat in, outstat;
+      if (stat(job.fIn.c_str(), &in) != 0) {
+        m2r::cerr << "Error: Couldn't open the file \'" << job.fIn << "\', skipping.\n";
+        continue;
+      }
+      if (!options.fOverwrite && stat(job.fOut.c_str(), &outstat) == 0 && outstat.st_mtime > in.st_mtime) {
+        m2r::cout << "Skipping \'" << job.fIn << "\': \'" << job.fOut << "\' is up to date.\n";
+        continue;
+      }
+      job.fSize = in.st_size;
+      jobs.push_back(job);
+	}
+
+	const long ncores = sysconf(_SC_NPROCESSORS_ONLN);
+	const int nthreads = std::max(options.fThreads, 1);
+	int njobs = std::max(options.fJobs, 1);
+	if (ncores > 0 && njobs * nthreads > ncores) {
+      njobs = std::max(1L, ncores / nthreads);
+      m2r::cwar << "Warning: limiting to " << njobs << " simultaneous conversions ("
+                << nthreads << " threads each, " << ncores << " cores).\n";
+	}
+	m2r::cout << "\nConverting " << jobs.size() << " runs, " << njobs << " at a time.\n\n";
+
+	const double t0 = wall_time();
+	std::map<pid_t, size_t> running;
+	size_t next = 0, ndone = 0;
+	int nfailed = 0;
+	Long64_t nbytes = 0, nevents = 0;
+
+	while (next < jobs.size() || !running.empty()) {
+      //
+      // Start as many conversions as there are free workers
+      while (next < jobs.size() && running.size() < (size_t)njobs) {
+        Job_t& job = jobs[next];
+        int fd[2];
+        if (pipe(fd) != 0) { m2r::cerr << "Error: pipe() failed.\n"; return nfailed + jobs.size() - next; }
+        job.fStart = wall_time();
+        pid_t pid = fork();
+        if (pid == 0) { // child: convert, report the number of events, exit
+          close(fd[0]);
+          m2r::Options_t runOptions = options;
+          runOptions.fIn = job.fIn;
+          runOptions.fOut = job.fOut;
+          runOptions.fOverwrite = true; // checked above
+          m2r::cout = m2r::cnul;
+          Long64_t n = 0;
+          int status = m2r::convert(runOptions, &n);
+          if (write(fd[1], &n, sizeof(n)) != sizeof(n)) status = 1;
+          close(fd[1]);
+          _exit(status);
+        }
+        close(fd[1]);
+        if (pid < 0) {
+          close(fd[0]);
+          m2r::cerr << "Error: fork() failed for \'" << job.fIn << "\'.\n";
+          ++nfailed; ++next; ++ndone;
+          continue;
+        }
+        job.fPipe = fd[0];
+        running[pid] = next++;
+      }
+
+      //
+      // Wait for one to finish
+      int status = 0;
+      pid_t pid = waitpid(-1, &status, 0);
+      if (pid < 0) break;
+      std::map<pid_t, size_t>::iterator it = running.find(pid);
+      if (it == running.end()) continue;
+      Job_t& job = jobs[it->second];
+      running.erase(it);
+      ++ndone;
+
+      Long64_t n = 0;
+      bool ok = read(job.fPipe, &n, sizeof(n)) == sizeof(n) && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+      close(job.fPipe);
+      const double dt = wall_time() - job.fStart;
+      if (ok) {
+        nbytes += job.fSize;
+        nevents += n;
+        m2r::cout << "[" << ndone << "/" << jobs.size() << "] \'" << job.fIn << "\' -> \'" << job.fOut << "\': "
+                  << n << " events in " << dt << " s\n";
+      } else {
+        ++nfailed;
+        m2r::cerr << "[" << ndone << "/" << jobs.size() << "] Error: conversion of \'" << job.fIn << "\' failed.\n";
+      }
+	}
+
+	const double dt = wall_time() - t0;
+	m2r::cout << "\nConverted " << (jobs.size() - nfailed) << " of " << jobs.size() << " runs in " << dt << " s: "
+              << nbytes / 1048576. / (dt > 0 ? dt : 1) << " MB/s, "
+              << nevents / (dt > 0 ? dt : 1) << " events/s.\n\n";
+	return nfailed;
+  }
+
+  /// Expression of the serial number identifying the entries of tree \e tree, for event code \e code
+  /*!
+   * \returns the serial number of the head and tail events, and of the head event of
+   *  coincidences, with object or flat (--flat) branches; an empty string for the other trees.
+   */
+  std::string serial_expression(TTree* tree, int code)
+  {
+	if (code != DRAGON_HEAD_EVENT && code != DRAGON_TAIL_EVENT && code != DRAGON_COINC_EVENT) return "";
+	const std::string header = code == DRAGON_COINC_EVENT ? "head.header" : "header";
+	if (tree->GetBranch(header.c_str())) // flat
+      return header + ".fSerialNumber";
+	TObjArray* branches = tree->GetListOfBranches();
+	if (branches->GetEntriesFast() == 0) return "";
+	return std::string(branches->At(0)->GetName()) + "." + header + ".fSerialNumber";
+  }
+
+  /// Write the run parameters of a merged run, calculated from its start and stop ODB
+  /*!
+   * Creates the tree in the current directory, with the branches of \e chunkTree
+   * (object or flat) and the same entries as the conversion of the whole run.
+   */
+  void write_runpar(TTree* chunkTree, const midas::Database* db0, const midas::Database* db1, const Options_t& options)
+  {
+	dragon::RunParameters runpar;
+	void* addr = &runpar;
+	TTree* tree = new TTree(chunkTree->GetName(), chunkTree->GetTitle());
+	m2r::configure_tree(tree, options);
+	if (chunkTree->GetBranch("runpar")) {
+      TBranch* branch = tree->Branch("runpar", "dragon::RunParameters", &addr);
+      m2r::apply_compression(branch, options.fCompress[kAux]);
+	}
+	else {
+      m2r::FlatBranches flat(options);
+      flat.Add(tree, DRAGON_RUN_PARAMETERS, addr);
+	}
+	const midas::Database* dbs[2] = { db0, db1 };
+	for (int i = 0; i< 2; ++i) {
+      if (!dbs[i]) continue;
+      runpar.read_data(dbs[i]);
+      tree->Fill();
+	}
+	tree->AutoSave();
+	tree->ResetBranchAddresses();
+  }
+
+  /// Merge the outputs of a run converted in chunks (--chunk), options.fInputs, into options.fOut
+  /*!
+   * The trees of the chunks are concatenated in the order given. Head, tail and coincidence
+   * entries whose serial number was already written by the same or the previous chunk are
+   * skipped, so that chunks overlap by no more than their margins. The run parameters are
+   * recalculated, and "odbstart" and "variables" are taken from the first chunk, "odbstop"
+   * from the last one.
+   * \returns the program exit status
+   */
+  int merge(const m2r::Options_t& options)
+  {
+	std::vector<TFile*> files;
+	for (size_t i = 0; i< options.fInputs.size(); ++i) {
+      TFile* file = TFile::Open(options.fInputs[i].c_str());
+      if (!file || file->IsZombie()) {
+        m2r::cerr << "Error: Couldn't open the file \'" << options.fInputs[i] << "\'.\n\n";
+        delete file;
+        for (size_t j = 0; j< files.size(); ++j) delete files[j];
+        return 1;
+      }
+      files.push_back(file);
+	}
+	FileStat_t dummy;
+	if (!options.fOverwrite && gSystem->GetPathInfo(options.fOut.c_str(), dummy) == 0) {
+      m2r::cerr << "Error: The file \'" << options.fOut << "\' exists, use --overwrite to replace it.\n\n";
+      for (size_t j = 0; j< files.size(); ++j) delete files[j];
+      return 1;
+	}
+
+	m2r::cout << "\nMerging " << files.size() << " chunks into ROOT file\n\t\'" << options.fOut << "\'\n\n";
+	TFile fout (options.fOut.c_str(), "RECREATE", files.front()->GetTitle());
+	if (fout.IsZombie()) {
+      m2r::cerr << "Error: Couldn't open the file \'" << options.fOut << "\' for writing.\n\n";
+      for (size_t j = 0; j< files.size(); ++j) delete files[j];
+      return 1;
+	}
+	midas::Database* db0 = dynamic_cast<midas::Database*>(files.front()->Get("odbstart"));
+	midas::Database* db1 = dynamic_cast<midas::Database*>(files.back()->Get("odbstop"));
+	midas::Database* variables = dynamic_cast<midas::Database*>(files.front()->Get("variables"));
+
+	std::set<std::string> names;
+	TIter nextKey(files.front()->GetListOfKeys());
+	while (TKey* key = static_cast<TKey*>(nextKey())) {
+      if (std::string(key->GetClassName()) != "TTree" || !names.insert(key->GetName()).second) continue;
+      const int code = atoi(key->GetName() + 1); // "t<code>"
+      TTree* first = static_cast<TTree*>(key->ReadObj());
+      fout.cd();
+      if (code == DRAGON_RUN_PARAMETERS) {
+        write_runpar(first, db0, db1, options);
+        continue;
+      }
+
+      TChain chain(key->GetName());
+      for (size_t i = 0; i< files.size(); ++i) chain.Add(files[i]->GetName());
+      TTree* tree = chain.CloneTree(0);
+      m2r::configure_tree(tree, options);
+
+      // Serial numbers written by the current and the previous chunk
+      const std::string serial = serial_expression(first, code);
+      std::auto_ptr<TTreeFormula> formula(serial.empty() ? 0 : new TTreeFormula("serial", serial.c_str(), &chain));
+      if (formula.get()) chain.SetNotify(formula.get());
+      std::set<UInt_t> current, previous;
+      Int_t treeNumber = -1;
+
+      Long64_t nskipped = 0;
+      for (Long64_t i = 0; chain.GetEntry(i) > 0; ++i) {
+        if (formula.get()) {
+          if (chain.GetTreeNumber() != treeNumber) {
+            previous.swap(current);
+            current.clear();
+            treeNumber = chain.GetTreeNumber();
+          }
+          formula->GetNdata();
+          const UInt_t n = UInt_t(formula->EvalInstance());
+          if (previous.count(n) || !current.insert(n).second) { ++nskipped; continue; }
+        }
+        tree->Fill();
+      }
+      chain.SetNotify(0);
+      tree->AutoSave();
+      m2r::cout << key->GetName() << ": " << tree->GetEntries() << " entries";
+      if (nskipped) m2r::cout << ", " << nskipped << " duplicates skipped";
+      m2r::cout << ".\n";
+	}
+
+	fout.cd();
+	if (db0) db0->Write("odbstart");
+	if (db1) {
+      db1->Write("odbstop");
+      std::string ftitle;
+      if (db1->ReadValue("/Experiment/Run Parameters/Comment", ftitle)) fout.SetTitle(ftitle.c_str());
+	}
+	if (variables) variables->Write("variables");
+	if (!db0 || !db1)
+      m2r::cwar << "Warning: " << (db0 ? "odbstop" : "odbstart") << " is missing, the first and last "
+                << "chunk of the run should be given first and last.\n";
+
+	fout.Close();
+	for (size_t j = 0; j< files.size(); ++j) delete files[j];
+	m2r::cout << "\nDone!\n\n";
+	return 0;
+  }
+
+  //
+  /// The main function implementation
+  int main_(int argc, char** argv)
+  {
+	m2r::Options_t options;
+	int arg_result = m2r::process_args(argc, argv, &options);
+	if(arg_return) return arg_result;
+	if(options.fMerge) return merge(options);
+
+	//
+	// Read histogram definitions once, for all runs
+	if(!options.fHistos.empty())
+      read_histos(options.fHistos);
+
+	if (options.fInputs.size() == 1 && options.fJobs <= 1 && options.fRunList.empty()) {
+      options.fIn = options.fInputs[0];
+      return convert(options);
+	}
+	if (options.fProfile) {
+      m2r::cerr << "Warning: --profile is ignored in batch mode.\n";
+      options.fProfile = 0;
+	}
+	return convert_batch(options) == 0 ? 0 : 1;
+  }
+
 } // namespace m2r
 
 #ifndef USE_ROOTBEER
@@ -791,7 +2428,7 @@ namespace m2r {
 // defined above
 void rb::Rint::RegisterEvents()
 {
-  RegisterEvent<m2r::SonikEvent> (0,                  "SonikEvent");
+  RegisterEvent<m2r::SonikEvent> (DRAGON_SONIK_EVENT, "SonikEvent");
   RegisterEvent<m2r::HeadEvent>  (DRAGON_HEAD_EVENT,   "HeadEvent");
   RegisterEvent<m2r::TailEvent>  (DRAGON_TAIL_EVENT,   "TailEvent");
   RegisterEvent<m2r::CoincEvent> (DRAGON_COINC_EVENT, "CoincEvent");
@@ -8,6 +8,7 @@
 #include "utils/ErrorDragon.hxx"
 #include "Odb.hxx"
 #include "Xml.hxx"
+#include "OdbSnapshot.hxx"
 
 #ifdef USE_ROOT
 #include <RVersion.h>
@@ -22,9 +23,9 @@
 // This will disable reading of midas::Database objects from files created
 // w/ other versions, though.
 
-#define MIDAS_XML_CLASS_VERSION 4
+#define MIDAS_XML_CLASS_VERSION 6
 #else
-#define MIDAS_XML_CLASS_VERSION 3
+#define MIDAS_XML_CLASS_VERSION 5
 #endif
 
 #endif // #ifdef USE_ROOT
@@ -38,6 +39,11 @@ namespace midas {
  * from the ODB or a file is specified by the constructor argument, which
  * is either the path to a file containing XML data, or "online" to read
  * from the ODB.
+ *
+ * Offline databases can also carry a midas::OdbSnapshot of their keys (see
+ * BuildSnapshot()), which is then read instead of the XML: a database read
+ * back from a ROOT file answers lookups without parsing its XML, which
+ * is kept only for Dump() and Print().
  */
 class Database
 #ifdef USE_ROOT
@@ -61,6 +67,9 @@ private:
 	/// Flag specifying 'zombie' status
 	bool fIsZombie;
 
+	/// Compact copy of the keys of fXml, read instead of it when not empty
+	OdbSnapshot fSnapshot;
+
 public:
 	/// Default constructor for ROOT I/O
 	Database (): fXml(0), fIsOnline(false), fIsZombie(false)
@@ -74,21 +83,39 @@ public:
 			 *  data. \note Specifying "online" reads from the ODB if connected to an
 			 *  experiment.
 			 */
-			if (strcmp(filename, "online")) {
-				fXml.reset(new Xml(filename));
-				if (fXml->IsZombie()) {
-					fXml.reset(0);
-					fIsZombie = true;
-				}
-			}
-			else {
-				fIsOnline = true;
-				if (Odb::GetHandle() == 0)
-					fIsZombie = true;
+			Init(filename);
+		}
+
+	/// Read the ODB through a copy of its contents held in memory
+	Database (const char* filename, bool preload): fXml(0), fIsOnline(false), fIsZombie(false)
+		{
+			/*!
+			 * \param filename As for Database(const char*)
+			 * \param preload If true and \e filename is "online", copy the whole
+			 *  ODB as XML in a single call and serve all reads from that copy,
+			 *  instead of contacting the ODB once or more per read. Falls back to
+			 *  reading from the ODB directly if the copy fails.
+			 */
+			if (!preload || strcmp(filename, "online")) {
+				Init(filename);
+				return;
 			}
-			if (fIsZombie) {
+			fIsOnline = true;
+			if (Odb::GetHandle() == 0) {
+				fIsZombie = true;
 				dragon::utils::Error("midas::Database::Database", __FILE__, __LINE__)
 					<< "Failed opening the database: \"" << filename << "\"";
+				return;
+			}
+			std::vector<char> buf;
+			if (Odb::ReadXml("/", buf)) {
+				fXml.reset(new Xml(&buf[0], buf.size()));
+				if (fXml->IsZombie()) fXml.reset(0);
+				else fIsOnline = false;
+			}
+			if (fIsOnline) {
+				dragon::utils::Warning("midas::Database::Database", __FILE__, __LINE__)
+					<< "Couldn't copy the ODB, reading from it directly instead.";
 			}
 		}
 
@@ -110,9 +137,69 @@ public:
 			}
 		}
 
+	/// Read selected directories of buffered XML data
+	Database (const char* buf, int length, const char* const* subtrees):
+		fXml(0), fIsOnline(false), fIsZombie(false)
+		{
+			/*!
+			 * \param buf Buffer containing xml data, e.g. a BOR or EOR event
+			 * \param length Size of the buffer in bytes
+			 * \param subtrees NULL terminated list of the ODB directories to read,
+			 *  see OdbSnapshot::Scan()
+			 *
+			 * Only the keys below \e subtrees are read, straight into the snapshot
+			 * and without building an XML tree, which is much faster than
+			 * Database(char*, int) for a full ODB dump. The XML is not kept, so
+			 * Dump() and Print() are not available.
+			 */
+			if (!fSnapshot.Scan(buf, length, subtrees)) {
+				fIsZombie = true;
+				dragon::utils::Error("midas::Database::Database", __FILE__, __LINE__)
+					<< "Failed parsing the XML data.";
+			}
+		}
+
+private:
+	/// Open \e filename, as for Database(const char*)
+	void Init(const char* filename)
+		{
+			if (strcmp(filename, "online")) {
+				fXml.reset(new Xml(filename));
+				if (fXml->IsZombie()) {
+					fXml.reset(0);
+					fIsZombie = true;
+				}
+			}
+			else {
+				fIsOnline = true;
+				if (Odb::GetHandle() == 0)
+					fIsZombie = true;
+			}
+			if (fIsZombie) {
+				dragon::utils::Error("midas::Database::Database", __FILE__, __LINE__)
+					<< "Failed opening the database: \"" << filename << "\"";
+			}
+		}
+
+public:
 	/// Tell the public if a zombie or not
 	bool IsZombie() const { return fIsZombie; }
 
+	/// Store a snapshot of the XML keys, to be read instead of the XML from now on
+	bool BuildSnapshot()
+		{
+			/*!
+			 * Call before writing the database to a ROOT file, so it can be read
+			 * back without parsing the XML.
+			 * \returns false if there is no XML data (online or zombie database)
+			 */
+			if (fIsZombie || !fXml.get()) return false;
+			return fSnapshot.Build(*fXml);
+		}
+
+	/// Check if lookups use a snapshot
+	bool HasSnapshot() const { return !fSnapshot.IsEmpty(); }
+
 	/// Dump odb contents to an output stream
 	void Dump(std::ostream& strm) const
 		{
@@ -123,6 +210,10 @@ public:
 				return;
 			}
 			if(fXml.get()) fXml->Dump(strm);
+			else if (HasSnapshot()) {
+				dragon::utils::Error("Database::Dump", __FILE__, __LINE__)
+					<< "Not available, only selected keys were read";
+			}
 		}
 
 	/// Default dump to std::cout
@@ -139,6 +230,7 @@ public:
 			 */
 			if(fIsZombie) return false;
 			if (fIsOnline) return Odb::ReadValue(path, value);
+			else if (HasSnapshot()) return fSnapshot.GetValue(path, value);
 			else if (fXml.get()) {
 				bool success;
 				fXml->GetValue(path, value, &success);
@@ -156,6 +248,7 @@ public:
 			 */
 			if      (fIsZombie)  return -1;
 			else if (fIsOnline)  return Odb::ReadArraySize(path);
+			else if (HasSnapshot()) return fSnapshot.GetArrayLength(path);
 			else if (fXml.get()) return fXml->GetArrayLength(path);
 			else                 return -1;
 		}
@@ -172,6 +265,10 @@ public:
 			 */
 			if(fIsZombie) return 0;
 			if(fIsOnline) return Odb::ReadArray(path, array, length);
+			else if (HasSnapshot()) {
+				fSnapshot.GetArray(path, length, array);
+				return length;
+			}
 			else if (fXml.get()) {
 				bool success;
 				fXml->GetArray(path, length, array, &success);
@@ -212,6 +309,7 @@ public:
 				int arrlen = midas::Odb::ReadArraySize(path);
 				return (arrlen != -1);
 			}
+			else if (HasSnapshot()) return fSnapshot.CheckPath(path);
 			else if (fXml.get()) {
 				midas::Xml::Node node = fXml->FindKey(path, true);
 				if(!node) node = fXml->FindKeyArray(path, true);
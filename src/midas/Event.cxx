@@ -12,11 +12,16 @@
 #include "utils/definitions.h"
 #include "utils/Functions.hxx"
 #include "utils/Bits.hxx"
+#include "utils/Profile.hxx"
+#include "Defaults.hxx"
 #include "Event.hxx"
 
 
 namespace {
 
+// Printed for the first events only, see dragon::utils::MessageLimit
+dragon::utils::MessageLimit gTscVersionLimit("midas::Event::Init: unknown TSC version");
+
 // Helper function to calculate full timestamp values
 inline uint64_t read_timestamp (uint32_t tscl, uint32_t tsch)
 {
@@ -34,6 +39,15 @@ inline uint64_t read_timestamp (uint32_t tscl, uint32_t tsch)
 	return tscfull;
 }
 
+// Number of array elements in a bank of \e size bytes, same as TMidasEvent::FindBank()
+inline int bank_length (uint32_t size, uint32_t type)
+{
+	static const unsigned tid_size[] = {0, 1, 1, 1, 2, 2, 4, 4, 4, 4, 8, 1, 0, 0, 0, 0, 0};
+	const unsigned tid = type & 0xFF;
+	if (tid >= sizeof(tid_size)/sizeof(tid_size[0]) || tid_size[tid] == 0) return size;
+	return size / tid_size[tid];
+}
+
 }
 
 
@@ -42,7 +56,10 @@ inline uint64_t read_timestamp (uint32_t tscl, uint32_t tsch)
 midas::Event::Event(const void* header, const void* data, int size, const Bank_t tsbank, double coinc_window):
 	fCoincWindow(coinc_window),
 	fClock (std::numeric_limits<uint64_t>::max()),
-	fTriggerTime(0.)
+	fTriggerTime(0.),
+	fReceiveTime(0.),
+	fQueueTime(0.),
+	fNumBanks(-1)
 {
 	/*!
 	 * \param header Pointer to event header (midas::Event::Header struct)
@@ -57,7 +74,10 @@ midas::Event::Event(const void* header, const void* data, int size, const Bank_t
 midas::Event::Event(char* buf, int size, const Bank_t tsbank, double coinc_window):
 	fCoincWindow(coinc_window),
  	fClock (std::numeric_limits<uint64_t>::max()),
-	fTriggerTime(0.)
+	fTriggerTime(0.),
+	fReceiveTime(0.),
+	fQueueTime(0.),
+	fNumBanks(-1)
 {
 	/*!
 	 * \param buf Buffer containing the entirity of the event data (header + actual data)
@@ -71,7 +91,10 @@ midas::Event::Event(char* buf, int size, const Bank_t tsbank, double coinc_windo
 midas::Event::Event(char* buf, int size):
 	fCoincWindow(0),
  	fClock (std::numeric_limits<uint64_t>::max()),
-	fTriggerTime(0.)
+	fTriggerTime(0.),
+	fReceiveTime(0.),
+	fQueueTime(0.),
+	fNumBanks(-1)
 {
 	/*!
 	 * \param buf Buffer containing the entirity of the event data (header + actual data)
@@ -83,7 +106,10 @@ midas::Event::Event(char* buf, int size):
 midas::Event::Event(const void* header, const void* data, int size):
 	fCoincWindow(0),
 	fClock (std::numeric_limits<uint64_t>::max()),
-	fTriggerTime(0.)
+	fTriggerTime(0.),
+	fReceiveTime(0.),
+	fQueueTime(0.),
+	fNumBanks(-1)
 {
 	/*!
 	 * \param header Pointer to event header (midas::Event::Header struct)
@@ -93,16 +119,73 @@ midas::Event::Event(const void* header, const void* data, int size):
 	Init(0, header, data, size);
 }
 
+void midas::Event::Reset(const void* header, const void* data, int size, const Bank_t tsbank, double coinc_window)
+{
+	/*!
+	 * Same as the equivalent constructor, but re-uses the storage already allocated
+	 * by this event. Intended for event objects which are recycled many times, for
+	 * example by the tstamp::Queue event pool.
+	 * \param header Pointer to event header (midas::Event::Header struct)
+	 * \param data Pointer to the data portion of an event
+	 * \param size Size in bytes of the data portion of the event
+	 * \param tsbank Bank name of the TSC4 data; if NULL, tsc features are ignored
+	 * \param coinc_window Desired window to be considered a coincidence match w/ another event.
+	 */
+	fCoincWindow = coinc_window;
+	fClock = std::numeric_limits<uint64_t>::max();
+	fTriggerTime = 0.;
+	fReceiveTime = 0.;
+	fQueueTime = 0.;
+	for(uint32_t i=0; i< MAX_FIFO; ++i) {
+		fFifo[i].clear();
+	}
+	Init(tsbank, header, data, size);
+}
+
 void midas::Event::CopyDerived(const midas::Event& other)
 {
 	/*!
-	 * Copies all data fields and calls TMidasEvent::Copy().
+	 * Copies all data fields, header and data buffer. Storage already held by
+	 * this event is re-used where possible. The bank list (if any) is rebuilt
+	 * only if \e other has one.
 	 */
 	fClock       = other.fClock;
 	fTriggerTime = other.fTriggerTime;
 	fCoincWindow = other.fCoincWindow;
+	fReceiveTime = other.fReceiveTime;
+	fQueueTime   = other.fQueueTime;
 	other.CopyFifo(fFifo);
-	TMidasEvent::Copy(other);
+
+	TMidasEvent::Clear();
+	fEventHeader = other.fEventHeader;
+	if (other.fData) {
+		UseBuffer();
+		memcpy(fData, other.fData, GetDataSize());
+	}
+	if (other.fBankList) {
+		SetBankList();
+	}
+	fNumBanks = other.fNumBanks;
+	if (fNumBanks > 0)
+		std::copy(other.fBankDir, other.fBankDir + fNumBanks, fBankDir);
+}
+
+void midas::Event::UseBuffer()
+{
+	if (fAllocatedByUs && fData) {
+		free(fData); // allocated by TMidasEvent
+	}
+	const size_t size = GetDataSize() > 0 ? GetDataSize() : 1;
+	if (fBuffer.capacity() < size) {
+		// grow in powers of two, so that recycled events (see Reset()) soon hold
+		// enough storage for any event, and stop re-allocating
+		size_t capacity = 1024;
+		while (capacity < size) capacity *= 2;
+		fBuffer.reserve(capacity);
+	}
+	fBuffer.resize(size);
+	fData = &fBuffer[0];
+	fAllocatedByUs = false;
 }
 
 void midas::Event::CopyFifo(std::vector<uint64_t>* pfifo) const
@@ -111,9 +194,7 @@ void midas::Event::CopyFifo(std::vector<uint64_t>* pfifo) const
 	 * \attention Input pointer must point to an array w/ length >= 4.
 	 */
 	for(uint32_t i=0; i< MAX_FIFO; ++i) {
-		(pfifo+i)->clear();
-		(pfifo+i)->resize(fFifo[i].size());
-		std::copy(fFifo[i].begin(), fFifo[i].end(), pfifo[i].begin());
+		(pfifo+i)->assign(fFifo[i].begin(), fFifo[i].end());
 	}
 }
 
@@ -136,11 +217,45 @@ void midas::Event::PrintCoinc(const Event& other, FILE* where) const
 }
 
 
+double midas::Event::IndexTime(const TMidasEvent& event)
+{
+	/*!
+	 * Matches TMidasFileIndex::TimeFunction_t, to store trigger times in a file index.
+	 * \param event Raw event from a TMidasFile
+	 * \returns Trigger time in uSec (from the default TSC banks) of a head or tail
+	 *  event; -1 for any other event, or if the TSC bank cannot be read
+	 */
+	const char* tsbank = 0;
+	if (event.GetEventId() == DRAGON_HEAD_EVENT) tsbank = HEAD_TSC_BANK;
+	else if (event.GetEventId() == DRAGON_TAIL_EVENT) tsbank = TAIL_TSC_BANK;
+	else return -1;
+
+	int length, type;
+	void* ptsc;
+	if (!event.FindBank(tsbank, &length, &type, &ptsc)) return -1;
+
+	TMidasEvent& e = const_cast<TMidasEvent&>(event);
+	try {
+		midas::Event timed(e.GetEventHeader(), e.GetData(), e.GetDataSize(), tsbank, 0.);
+		return timed.TriggerTime();
+	}
+	catch (std::exception&) {
+		return -1;
+	}
+}
+
 void midas::Event::Init(const char* tsbank, const void* header, const void* addr, int size)
 {
+	/*!
+	 * \note The TMidasEvent bank list is not built here since none of the
+	 *  unpacking routines need it; call SetBankList() explicitly if required.
+	 */
+	dragon::utils::ProfileScope profile(dragon::utils::Profile::kEventInit);
+	TMidasEvent::Clear();
 	memcpy(GetEventHeader(), header, sizeof(midas::Event::Header));
-	memcpy(GetData(), addr, GetDataSize());
-	SetBankList();
+	UseBuffer();
+	memcpy(fData, addr, GetDataSize());
+	BuildBankDirectory();
 
 	if (tsbank != 0) {
 		int tsclength;
@@ -164,10 +279,10 @@ void midas::Event::Init(const char* tsbank, const void* header, const void* addr
 		for(uint32_t v=0; v< sizeof(versions)/sizeof(uint32_t); ++v) {
 			if(version == versions[v]) { okVersion = true; break; }
 		}
-		if(okVersion == false) {
+		if(okVersion == false && gTscVersionLimit.Check()) {
 			dragon::utils::Warning("midas::Event::Init") <<
 				"Unknown TSC version 0x" << std::hex << version << std::dec << " (id, serial #: " << GetEventId() <<
-				", " << GetSerialNumber() << ")" << DRAGON_ERR_FILE_LINE;
+				", " << GetSerialNumber() << ")" << gTscVersionLimit.Note() << DRAGON_ERR_FILE_LINE;
 		}
 
 		// Get TSC4 info
@@ -186,6 +301,7 @@ void midas::Event::Init(const char* tsbank, const void* header, const void* addr
 			assert(ch< MAX_FIFO);
 
 			uint64_t tscfull = read_timestamp(tscl, tsch | (roll<<8));
+			if (fFifo[ch].capacity() == 0) fFifo[ch].reserve(MAX_FIFO); // skip the smallest re-allocations
 			fFifo[ch].push_back(tscfull);
 
 			if(ch == TRIGGER_CHANNEL && fClock == std::numeric_limits<uint64_t>::max()) {
@@ -196,6 +312,42 @@ void midas::Event::Init(const char* tsbank, const void* header, const void* addr
 	} // if tsbank != 0
 }
 
+void midas::Event::BuildBankDirectory()
+{
+	/*!
+	 * Walks the bank list once (16- or 32-bit banks). If the event has more than
+	 * MAX_BANKS banks, the directory is marked unavailable and lookups fall back
+	 * to TMidasEvent::FindBank().
+	 */
+	fNumBanks = 0;
+	if (!fData || GetDataSize() < (int)sizeof(TMidas_BANK_HEADER))
+		return;
+
+	char* pdata = 0;
+	if (IsBank32()) {
+		TMidas_BANK32* pbk = 0;
+		while (IterateBank32(&pbk, &pdata), pbk != 0) {
+			if (fNumBanks == MAX_BANKS) { fNumBanks = -1; return; }
+			BankEntry_t& entry = fBankDir[fNumBanks++];
+			entry.fKey    = BankKey(pbk->fName);
+			entry.fOffset = pdata - fData;
+			entry.fType   = pbk->fType;
+			entry.fLength = bank_length(pbk->fDataSize, pbk->fType);
+		}
+	}
+	else {
+		TMidas_BANK* pbk = 0;
+		while (IterateBank(&pbk, &pdata), pbk != 0) {
+			if (fNumBanks == MAX_BANKS) { fNumBanks = -1; return; }
+			BankEntry_t& entry = fBankDir[fNumBanks++];
+			entry.fKey    = BankKey(pbk->fName);
+			entry.fOffset = pdata - fData;
+			entry.fType   = pbk->fType;
+			entry.fLength = bank_length(pbk->fDataSize, pbk->fType);
+		}
+	}
+}
+
 double midas::Event::TimeDiff(const Event& other) const
 {
 	/*!
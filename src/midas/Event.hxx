@@ -52,6 +52,19 @@ public:
 	/// FIFO channel w/ the trigger as input
 	static const uint32_t TRIGGER_CHANNEL = 0;
 
+	/// Maximum number of banks in the bank directory
+	static const int MAX_BANKS = 32;
+
+	/// Packs a (up to) four-character bank name into an integer key
+	/*! Characters after a terminating null are taken as zero. */
+	static uint32_t BankKey(const char* name)
+		{
+			uint32_t key = 0;
+			for (int i = 0; i< 4 && name[i]; ++i)
+				key |= uint32_t(uint8_t(name[i])) << (8*i);
+			return key;
+		}
+
 private:
 	/// Coincidence window (in us)
 	double fCoincWindow;
@@ -65,9 +78,42 @@ private:
 	/// Timestamp value in uSec
 	double fTriggerTime;
 
+	/// Time of day at which the analysis received the event, in seconds (0 if not stamped)
+	double fReceiveTime;
+
+	/// Time of day at which the event entered a timestamp queue, in seconds (0 if not stamped)
+	double fQueueTime;
+
+	/// Event data storage
+	/*!
+	 * TMidasEvent::fData points here, with fAllocatedByUs = false, so that the
+	 * storage is re-used (not re-allocated) when the event is copied into or reset.
+	 */
+	std::vector<char> fBuffer;
+
+	/// Bank directory entry
+	struct BankEntry_t {
+		uint32_t fKey;    ///< Bank name, from BankKey()
+		uint32_t fOffset; ///< Offset of the bank data from the start of fData, in bytes
+		int fLength;      ///< Number of array elements in the bank
+		int fType;        ///< Bank data type (MIDAS TID_xxx)
+	};
+
+	/// Directory of the banks in fData
+	/*!
+	 * Built in one pass over the event whenever the data are set, so that bank lookups
+	 * compare packed integer keys in this small array instead of walking the event data.
+	 * Offsets (not pointers) are stored so that copying the event copies the directory.
+	 */
+	BankEntry_t fBankDir[MAX_BANKS];
+
+	/// Number of entries in fBankDir; -1 if the directory is not available
+	int fNumBanks;
+
 public:
 	/// Empty constructor
-	Event(): TMidasEvent() { }
+	Event():
+		TMidasEvent(), fCoincWindow(0), fClock(0), fTriggerTime(0.), fReceiveTime(0.), fQueueTime(0.), fNumBanks(-1) { }
 
 	/// Construct from event callback parameters, with TSC handling
 	Event(const void* header, const void* data, int size, const Bank_t tsbank, double coinc_window);
@@ -82,11 +128,18 @@ public:
 	Event(char* buf, int size);
 
 	/// Copy constructor
-	Event(const Event& other):TMidasEvent(other) { CopyDerived(other); }
+	Event(const Event& other):TMidasEvent() { CopyDerived(other); }
 
 	/// Assignment operator
+	/*! Re-uses the existing data and fifo storage if it is large enough */
 	Event& operator= (const Event& other)
-		{ CopyDerived(other); return *this; }
+		{ if (&other != this) CopyDerived(other); return *this; }
+
+	/// Re-initialize from event callback parameters, with TSC handling
+	void Reset(const void* header, const void* data, int size, const Bank_t tsbank, double coinc_window);
+
+	/// Trigger time of a raw head or tail event, for TMidasFileIndex
+	static double IndexTime(const TMidasEvent& event);
 
 	/// Copies event header information into another one
 	void CopyHeader(Header& destination) const
@@ -94,7 +147,7 @@ public:
 
 	/// Read an event from a TMidasFile
 	bool ReadFromFile(TMidasFile& file)
-		{	Clear(); return file.Read(this); }
+		{	Clear(); fNumBanks = -1; bool success = file.Read(this); if (success) BuildBankDirectory(); return success; }
 
 	/// Returns trigger time in uSec
 	double TriggerTime() const { return fTriggerTime; }
@@ -102,6 +155,23 @@ public:
 	/// Returns the trigger time in clock cycles
 	uint64_t ClockTime() const { return fClock; }
 
+	/// Returns the coincidence window in uSec
+	double GetCoincWindow() const { return fCoincWindow; }
+
+	/// Stamps the time of day (seconds) at which the event was received
+	/*! Unlike the MIDAS header time stamp, set by the analysis, e.g. for latency
+	 *  monitoring; zero until set. Copied with the event. */
+	void SetReceiveTime(double t) { fReceiveTime = t; }
+
+	/// Returns the time set by SetReceiveTime(), 0 if none
+	double GetReceiveTime() const { return fReceiveTime; }
+
+	/// Stamps the time of day (seconds) at which the event entered a timestamp queue
+	void SetQueueTime(double t) { fQueueTime = t; }
+
+	/// Returns the time set by SetQueueTime(), 0 if none
+	double GetQueueTime() const { return fQueueTime; }
+
 	/// Copy fifo values to an external vector array
 	void CopyFifo(std::vector<uint64_t>* pfifo) const;
 
@@ -146,7 +216,7 @@ public:
 			 */
 			void *pbk;
 			int type;
-			int bkfound = FindBank(name, length, &type, &pbk);
+			int bkfound = LookupBank(name, length, &type, &pbk);
 
 			if(!bkfound && reportMissing) {
 				dragon::utils::Warning("midas::Event::GetBankPointer<T>", __FILE__, __LINE__)
@@ -172,6 +242,30 @@ public:
 			return bkfound ? reinterpret_cast<T*>(pbk) : 0;
 		}
 
+	/// Find a bank using the bank directory
+	/*!
+	 * Same arguments and return value as TMidasEvent::FindBank(), which is used
+	 * instead if the directory is not available.
+	 */
+	int LookupBank(const char* name, int* length, int* type, void** pdata) const
+		{
+			if (fNumBanks < 0) return FindBank(name, length, type, pdata);
+			const uint32_t key = BankKey(name);
+			for (int i = 0; i< fNumBanks; ++i) {
+				if (fBankDir[i].fKey == key) {
+					*length = fBankDir[i].fLength;
+					*type   = fBankDir[i].fType;
+					*pdata  = fData + fBankDir[i].fOffset;
+					return 1;
+				}
+			}
+			*pdata = 0;
+			return 0;
+		}
+
+	/// (Re)build the bank directory from the current event data
+	void BuildBankDirectory();
+
 private:
 	/// Helper function for copy constructor / assignment operator
 	void CopyDerived(const Event& other);
@@ -179,6 +273,9 @@ private:
 	/// Helper function for constructors
 	void Init(const char* tsbank, const void* header, const void* addr, int size);
 
+	/// Point fData at fBuffer, resized to hold the current header's data size
+	void UseBuffer();
+
 public:
 	/// Class to compare by event id
 	struct CompareId {
@@ -10,10 +10,20 @@
 #include <cstring>
 #include <stdio.h>
 #include <stdint.h>
+#include <map>
 #include <midas.h>
+#include "utils/Thread.hxx"
 #include "Odb.hxx"
 
 
+namespace {
+//
+// Key handles found by Odb::FindKey(), valid for one database handle
+dragon::utils::Mutex gKeyCacheMutex;
+std::map<std::string, HNDLE> gKeyCache;
+HNDLE gKeyCacheDb = 0;
+}
+
 HNDLE midas::Odb::GetHandle()
 {
   int hndle;
@@ -24,6 +34,73 @@ HNDLE midas::Odb::GetHandle()
   return hndle;
 }
 
+int midas::Odb::FindKey(const char* path, HNDLE* hkey)
+{
+  /*!
+   * The first lookup of each path goes to db_find_key(); later ones return the
+   * same handle without contacting the ODB. Only successful lookups are kept.
+   * \attention A handle stays cached after its key is deleted, so call
+   * ClearCache() wherever keys may have been recreated, e.g. at run start.
+   * \returns The db_find_key() status (SUCCESS for a cached handle)
+   */
+  HNDLE hdb = GetHandle();
+  if (hdb == 0) return DB_INVALID_HANDLE;
+  {
+    dragon::utils::ScopedLock lock(gKeyCacheMutex);
+    if (hdb != gKeyCacheDb) {
+      gKeyCache.clear();
+      gKeyCacheDb = hdb;
+    }
+    std::map<std::string, HNDLE>::const_iterator it = gKeyCache.find(path);
+    if (it != gKeyCache.end()) {
+      *hkey = it->second;
+      return SUCCESS;
+    }
+  }
+  int status = db_find_key(hdb, 0, (char*)path, hkey);
+  if (status == SUCCESS) {
+    dragon::utils::ScopedLock lock(gKeyCacheMutex);
+    if (hdb == gKeyCacheDb) gKeyCache[path] = *hkey;
+  }
+  return status;
+}
+
+void midas::Odb::ClearCache()
+{
+  dragon::utils::ScopedLock lock(gKeyCacheMutex);
+  gKeyCache.clear();
+}
+
+bool midas::Odb::ReadXml(const char* path, std::vector<char>& buffer)
+{
+  /*!
+   * \param [in] path Path of the subtree, "/" for the whole ODB
+   * \param [out] buffer Set to the XML text, NUL terminated
+   * \returns true if successful
+   */
+  HNDLE hkey;
+  int status = FindKey(path, &hkey);
+  if (status != SUCCESS) {
+    fprintf(stderr, "Cannot find \'%s\' in odb, db_find_key() status %d\n", path, status);
+    return false;
+  }
+  const int maxSize = 1 << 28;
+  for (int size = buffer.size() > (1 << 20) ? buffer.size() : (1 << 20); size <= maxSize; size *= 2) {
+    buffer.resize(size);
+    int bufferSize = size;
+    status = db_copy_xml(GetHandle(), hkey, &buffer[0], &bufferSize);
+    if (status == SUCCESS) {
+      buffer.resize(strnlen(&buffer[0], size) + 1);
+      buffer.back() = 0;
+      return true;
+    }
+    if (status != DB_TRUNCATED) break;
+  }
+  fprintf(stderr, "Cannot copy \'%s\' from odb as XML, db_copy_xml() status %d\n", path, status);
+  buffer.clear();
+  return false;
+}
+
 int midas::Odb::ReadAny(const char*name,int index,int tid,void* value,int valueLength)
 {
   int status;
@@ -34,7 +111,7 @@ int midas::Odb::ReadAny(const char*name,int index,int tid,void* value,int valueL
   if (valueLength > 0)
     size = valueLength;
 
-  status = db_find_key (GetHandle(), hdir, (char*)name, &hkey);
+  status = FindKey(name, &hkey);
   if (status == SUCCESS)
     {
       status = db_get_data_index(GetHandle(), hkey, value, &size, index, tid);
@@ -57,7 +134,7 @@ int midas::Odb::ReadAny(const char*name,int index,int tid,void* value,int valueL
           return -1;
         }
 
-      status = db_find_key (GetHandle(), hdir, (char*)name, &hkey);
+      status = FindKey(name, &hkey);
       if (status != SUCCESS)
         {
           fprintf(stderr, "Cannot create \'%s\', db_find_key() status %d\n", name, status);
@@ -142,11 +219,10 @@ const char* midas::Odb::ReadString(const char*name,int index,const char* default
 int midas::Odb::ReadArraySize(const char*name)
 {
   int status;
-  HNDLE hdir = 0;
   HNDLE hkey;
   KEY key;
 
-  status = db_find_key (GetHandle(), hdir, (char*)name, &hkey);
+  status = FindKey(name, &hkey);
   if (status != SUCCESS)
     return -1;
 
@@ -168,7 +244,7 @@ int midas::Odb::ResizeArray(const char*name, int tid, int size)
   HNDLE hkey;
   HNDLE hdir = 0;
 
-  status = db_find_key (GetHandle(), hdir, (char*)name, &hkey);
+  status = FindKey(name, &hkey);
   if (status != SUCCESS)
     {
       //      cm_msg(MINFO, frontend_name, "Creating \'%s\'[%d] of type %d", name, size, tid);
@@ -182,7 +258,7 @@ int midas::Odb::ResizeArray(const char*name, int tid, int size)
           return -1;
         }
 
-      status = db_find_key (GetHandle(), hdir, (char*)name, &hkey);
+      status = FindKey(name, &hkey);
       if (status != SUCCESS)
         {
           //    cm_msg(MERROR, frontend_name, "Cannot create \'%s\', db_find_key() status %d", name, status);
@@ -208,10 +284,9 @@ int midas::Odb::ResizeArray(const char*name, int tid, int size)
 int midas::Odb::WriteInt(const char*name, int index, int value)
 {
   int status;
-  HNDLE hdir = 0;
   HNDLE hkey;
 
-  status = db_find_key (GetHandle(), hdir, name, &hkey);
+  status = FindKey(name, &hkey);
   if (status == SUCCESS)
     {
       int size = 4;
@@ -226,10 +301,9 @@ int midas::Odb::WriteInt(const char*name, int index, int value)
 int midas::Odb::WriteBool(const char*name, int index, bool value)
 {
   int status;
-  HNDLE hdir = 0;
   HNDLE hkey;
 
-  status = db_find_key (GetHandle(), hdir, (char*)name, &hkey);
+  status = FindKey(name, &hkey);
   if (status == SUCCESS)
     {
       int size = 4;
@@ -244,10 +318,9 @@ int midas::Odb::WriteBool(const char*name, int index, bool value)
 int midas::Odb::WriteDouble(const char*name, int index, double value)
 {
   int status;
-  HNDLE hdir = 0;
   HNDLE hkey;
 
-  status = db_find_key (GetHandle(), hdir, name, &hkey);
+  status = FindKey(name, &hkey);
   if (status == SUCCESS)
     {
       int size = sizeof(double);
@@ -262,10 +335,9 @@ int midas::Odb::WriteDouble(const char*name, int index, double value)
 int midas::Odb::WriteString(const char*name, const char* string)
 {
   int status;
-  HNDLE hdir = 0;
   HNDLE hkey;
 
-  status = db_find_key(GetHandle(), hdir, name, &hkey);
+  status = FindKey(name, &hkey);
   if (status == SUCCESS)
     {
       int size = strlen(string) + 1;
@@ -287,6 +359,9 @@ int midas::Odb::WriteString(const char*name, const char* string)
   std::cerr << "Error: MIDASSYS not defined. file, line: " << __FILE__ <<  ", " << __LINE__ << "\n"
 
 HNDLE midas::Odb::GetHandle() { ERR_NO_MIDAS; return 0; }
+int midas::Odb::FindKey(const char* path, HNDLE* hkey) { ERR_NO_MIDAS; return -1; }
+void midas::Odb::ClearCache() { }
+bool midas::Odb::ReadXml(const char* path, std::vector<char>& buffer) { ERR_NO_MIDAS; return false; }
 int midas::Odb::ReadAny(const char*name,int index,int tid,void* value,int valueLength) { ERR_NO_MIDAS; return -1; }
 int midas::Odb::ReadInt(const char*name,int index,int defaultValue) { ERR_NO_MIDAS; return -1; }
 uint32_t midas::Odb::ReadUint32(const char*name,int index,uint32_t defaultValue) { ERR_NO_MIDAS; return 1; }
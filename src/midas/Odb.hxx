@@ -8,6 +8,8 @@
 #include <iostream>
 #endif
 #include <string>
+#include <vector>
+#include <cstring>
 #include "utils/ErrorDragon.hxx"
 
 #ifdef MIDASSYS
@@ -39,7 +41,8 @@ namespace midas {
  * \note This is intended to be a stateless "static" class and evolved
  * from free functions. Addition of state or non-static member functions
  * will likely cause problems; if this is ever needed then it might be
- * better to re-write as a singleton.
+ * better to re-write as a singleton. The one exception is the cache of key
+ * handles behind FindKey(), which is internal to Odb.cxx and lock protected.
  */
 class Odb {
 public:
@@ -47,6 +50,15 @@ public:
   /// Get database handle
 	static HNDLE GetHandle();
 
+  /// Find the handle of a key, remembering it for later calls
+	static int FindKey(const char* path, HNDLE* hkey);
+
+  /// Forget all remembered key handles
+	static void ClearCache();
+
+  /// Copy a whole odb subtree as XML, in a single call
+	static bool ReadXml(const char* path, std::vector<char>& buffer);
+
   /// Read any value from the odb
 	static int ReadAny(const char*name,int index,int tid,void* value,int valueLength = 0);
 
@@ -110,11 +122,11 @@ public:
 #ifdef MIDASSYS
 			int status;
 			int size = length * sizeof(T);
-			HNDLE hdir = 0, hkey;
+			HNDLE hkey;
 			HNDLE hdb = GetHandle();
 			if (hdb == 0) return false;
 
-			status = db_find_key (hdb, hdir, path, &hkey);
+			status = FindKey(path, &hkey);
 			if (status == DB_NO_KEY) {
 				dragon::utils::Error("midas::Odb::ReadArray") << "Couldn't get array key for path \""
                                                               << path << "\". status = " << status
@@ -190,11 +202,11 @@ template<> inline bool Odb::ReadValue<std::string>(const char* path, std::string
 	int status;
 	char buf[256];
 	int size = sizeof(buf);
-	HNDLE hdir = 0, hkey;
+	HNDLE hkey;
 	HNDLE hdb = GetHandle();
 	if (hdb == 0) return false;
 
-	status = db_find_key (hdb, hdir, path, &hkey);
+	status = FindKey(path, &hkey);
 	if (status == DB_NO_KEY) {
 		dragon::utils::Error("midas::Odb::ReadValue<std::string>", __FILE__, __LINE__)
 			<< "Couldn't get array key for path \"" << path << "\". status = " << status;
@@ -226,28 +238,32 @@ template<> inline int Odb::ReadArray<std::string>(const char* path, std::string*
 {
 #ifdef MIDASSYS
   int status;
-  char buf[256];
-
-  int size = sizeof(buf);
-  HNDLE hdir = 0, hkey;
+  KEY key;
+  HNDLE hkey;
   HNDLE hdb = GetHandle();
   if (hdb == 0) return false;
 
-  status = db_find_key (hdb, hdir, path, &hkey);
+  status = FindKey(path, &hkey);
   if (status == DB_NO_KEY) {
     dragon::utils::Error("midas::Odb::ReadArray<std::string>", __FILE__, __LINE__)
       << "Couldn't get array key for path \"" << path << "\". status = " << status;
     return 0;
   }
 
-  if (status == SUCCESS) {
-    for(int i=0; i< length; ++i) {
-      status = db_get_data_index(hdb, hkey, buf, &size, i, tid_string);
-      if (status != SUCCESS) break;
-      array[i] = buf;
+  // Read all elements at once, then split them
+  if (status == SUCCESS) status = db_get_key(hdb, hkey, &key);
+  if (status == SUCCESS && key.item_size > 0 && key.num_values > 0) {
+    std::vector<char> buf(key.num_values * key.item_size);
+    int size = buf.size();
+    status = db_get_data(hdb, hkey, &buf[0], &size, tid_string);
+    if (status == SUCCESS) {
+      const int n = length < key.num_values ? length : key.num_values;
+      for(int i=0; i< n; ++i) {
+        const char* element = &buf[i * key.item_size];
+        array[i] = std::string(element, strnlen(element, key.item_size));
+      }
+      return true;
     }
-
-    if (status == SUCCESS) return true;
   }
 
   dragon::utils::Error("midas::Odb::ReadArray<std::string>", __FILE__, __LINE__)
@@ -0,0 +1,629 @@
+//! \file OdbSnapshot.cxx
+//! \brief Implements OdbSnapshot.hxx
+#include <cctype>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include "utils/ErrorDragon.hxx"
+#include "Xml.hxx"
+#include "OdbSnapshot.hxx"
+
+
+namespace {
+
+//
+// Buffer layout, all integers are 32 bit little endian:
+//   header:  kMagic, number of keys, number of slots (a power of two)
+//   slots:   key index + 1, or 0 if empty
+//   keys:    kKeyWords words per key (see KeyWord_t)
+//   chars:   directory paths (without leading '/', stored once per directory),
+//            and the name of each key followed by its values, each NUL terminated
+//
+const char kMagic[4] = { 'O', 'D', 'B', '1' };
+const uint32_t kHeaderSize = 12;
+enum KeyWord_t {
+	kHash,      ///< hash_path() of the full path
+	kDir,       ///< Offset of the directory path in chars
+	kName,      ///< Offset of the name in chars
+	kLengths,   ///< Directory path length << 8 | name length
+	kNumValues, ///< Number of values, kArrayBit set for keyarrays
+	kKeyWords
+};
+const uint32_t kArrayBit = 0x80000000u;
+
+uint32_t get32(const char* p)
+{
+	const unsigned char* u = reinterpret_cast<const unsigned char*>(p);
+	return uint32_t(u[0]) | (uint32_t(u[1]) << 8) | (uint32_t(u[2]) << 16) | (uint32_t(u[3]) << 24);
+}
+
+void put32(std::vector<char>& buf, size_t pos, uint32_t value)
+{
+	for (int i = 0; i< 4; ++i)
+		buf[pos + i] = char((value >> 8*i) & 0xff);
+}
+
+uint32_t hash_path(const char* path, size_t length, bool array)
+{
+	uint32_t hash = array ? 0x050c5d1fu : 2166136261u; // FNV-1a, separate offsets per node type
+	for (size_t i = 0; i< length; ++i) {
+		hash ^= (unsigned char)path[i];
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+uint32_t key_word(const char* data, int key, KeyWord_t word)
+{
+	const char* keys = data + kHeaderSize + 4 * get32(data + 8);
+	return get32(keys + 4 * (kKeyWords * key + word));
+}
+
+struct Key_t {
+	uint32_t fWords[kKeyWords];
+};
+
+bool begin_key(const std::string& path, size_t dirLength, uint32_t dirPath, bool isArray,
+							 std::vector<char>& chars, Key_t& key)
+{
+	/*!
+	 * Fills the record of the key at \e path, whose directory path is at \e dirPath
+	 * in \e chars, and appends its name. The caller appends the values and counts
+	 * them in kNumValues.
+	 * \returns false if the path is longer than the record can hold
+	 */
+	const size_t nameLength = path.size() - dirLength;
+	if (nameLength > 0xff || dirLength > 0xffffff) {
+		dragon::utils::Warning("midas::OdbSnapshot")
+			<< "Skipping ODB path longer than supported: " << path;
+		return false;
+	}
+	key.fWords[kHash] = hash_path(path.data(), path.size(), isArray);
+	key.fWords[kDir] = dirPath;
+	key.fWords[kName] = chars.size();
+	key.fWords[kLengths] = (dirLength << 8) | nameLength;
+	key.fWords[kNumValues] = 0;
+	chars.insert(chars.end(), path.begin() + dirLength, path.end());
+	chars.push_back(0);
+	return true;
+}
+
+void collect(midas::Xml::Node dir, std::string& path, std::vector<Key_t>& keys, std::vector<char>& chars)
+{
+	const size_t dirLength = path.size();
+	const uint32_t dirPath = chars.size();
+	chars.insert(chars.end(), path.begin(), path.end());
+	chars.push_back(0);
+	for (int i = 0; i< dir->n_children; ++i) {
+		midas::Xml::Node node = dir->child + i;
+		const bool isDir = !strcmp(node->name, "dir"), isArray = !strcmp(node->name, "keyarray");
+		if (!isDir && !isArray && strcmp(node->name, "key")) continue;
+		const char* name = mxml_get_attribute(node, "name");
+		if (!name) continue;
+
+		path.resize(dirLength);
+		path += name;
+		if (isDir) {
+			path += '/';
+			collect(node, path, keys, chars);
+			continue;
+		}
+
+		Key_t key;
+		if (!begin_key(path, dirLength, dirPath, isArray, chars, key)) continue;
+		for (int j = 0; j< (isArray ? node->n_children : 1); ++j) {
+			midas::Xml::Node valNode = isArray ? node->child + j : node;
+			if (isArray && strcmp(valNode->name, "value")) continue;
+			const char* value = valNode->value ? valNode->value : "";
+			chars.insert(chars.end(), value, value + strlen(value) + 1);
+			++key.fWords[kNumValues];
+		}
+		if (isArray) key.fWords[kNumValues] |= kArrayBit;
+		keys.push_back(key);
+	}
+	path.resize(dirLength);
+}
+
+/// Streams through the text of an ODB XML dump, collecting the keys of selected subtrees
+/*!
+ * Reads the text in place, in a single pass and without building a tree: tags
+ * are only looked at as far as needed (name and "name" attribute), values are
+ * decoded straight into the snapshot characters, and directories outside the
+ * selection are skipped by matching their tags only. Values are taken as
+ * mxml_parse_buffer() takes them, so the keys read the same as from midas::Xml.
+ */
+class Scanner {
+public:
+	/// Scan [\e begin, \e end), selecting \e subtrees (NULL terminated, NULL for all)
+	Scanner(const char* begin, const char* end, const char* const* subtrees):
+		fPos(begin), fEnd(end), fSubtrees(subtrees), fError(0) { }
+
+	/// Collect the keys, returns false (see GetError()) if the text is malformed
+	bool Run(std::vector<Key_t>& keys, std::vector<char>& chars);
+
+	/// Description of the error stopping Run()
+	const char* GetError() const { return fError ? fError : ""; }
+
+private:
+	/// What to do with a directory
+	enum Select_t {
+		kSkip,    ///< Nothing below is selected
+		kDescend, ///< Some subdirectory might be selected
+		kTake     ///< Everything below is selected
+	};
+
+	/// A directory being read
+	struct Dir_t {
+		size_t fLength;  ///< Length of its path, including the trailing '/'
+		uint32_t fChars; ///< Offset of its path in the characters, kNoChars until needed
+		Select_t fSelect;
+	};
+	static const uint32_t kNoChars = 0xffffffffu;
+
+	/// The parts of a tag used here
+	struct Tag_t {
+		const char* fName;   ///< Element name, not terminated
+		size_t fNameLength;
+		bool fEnd;           ///< Closing tag, </...>
+		bool fEmpty;         ///< Empty element, <.../>
+		bool fHasName;       ///< Has a "name" attribute
+		std::string fAttr;   ///< Decoded value of the "name" attribute
+		bool Is(const char* name) const
+			{ return strlen(name) == fNameLength && !memcmp(fName, name, fNameLength); }
+	};
+
+	const char* Find(const char* from, const char* text) const;
+	bool Fail(const char* error) { fError = error; return false; }
+	bool NextTag(Tag_t& tag);
+	bool ReadText(std::vector<char>& chars);
+	bool SkipDir();
+	Select_t Select(const std::string& path) const;
+
+	static void Decode(const char* begin, const char* end, std::vector<char>& out);
+	static bool IsSpace(char c) { return c == ' ' || c == '\t' || c == '\n' || c == '\r'; }
+
+private:
+	const char* fPos;
+	const char* fEnd;
+	const char* const* fSubtrees;
+	const char* fError;
+};
+
+const char* Scanner::Find(const char* from, const char* text) const
+{
+	/*! \returns Pointer to the first occurrence of \e text at or after \e from, 0 if none */
+	const size_t length = strlen(text);
+	while (from < fEnd) {
+		const char* p = static_cast<const char*>(memchr(from, text[0], fEnd - from));
+		if (!p || size_t(fEnd - p) < length) return 0;
+		if (!memcmp(p, text, length)) return p;
+		from = p + 1;
+	}
+	return 0;
+}
+
+void Scanner::Decode(const char* begin, const char* end, std::vector<char>& out)
+{
+	/*! Appends [\e begin, \e end) with the entities mxml_decode() knows replaced, and a NUL */
+	static const char* const entities[] = { "&lt;", "&gt;", "&amp;", "&quot;", "&apos;" };
+	static const char replacements[] = { '<', '>', '&', '\"', '\'' };
+	while (begin < end) {
+		const char* amp = static_cast<const char*>(memchr(begin, '&', end - begin));
+		if (!amp) amp = end;
+		out.insert(out.end(), begin, amp);
+		if (amp == end) break;
+		int i = 0;
+		for (; i< 5; ++i) {
+			const size_t length = strlen(entities[i]);
+			if (size_t(end - amp) >= length && !memcmp(amp, entities[i], length)) break;
+		}
+		out.push_back(i < 5 ? replacements[i] : '&');
+		begin = amp + (i < 5 ? strlen(entities[i]) : 1);
+	}
+	out.push_back(0);
+}
+
+bool Scanner::NextTag(Tag_t& tag)
+{
+	/*!
+	 * Moves past the next element tag, skipping text, comments, processing
+	 * instructions and DOCTYPE.
+	 * \returns false at the end of the text, or if it is malformed (fError set)
+	 */
+	const char* p;
+	for (;;) {
+		p = fPos < fEnd ? static_cast<const char*>(memchr(fPos, '<', fEnd - fPos)) : 0;
+		if (!p) return false;
+		++p;
+		while (p < fEnd && IsSpace(*p)) ++p;
+		const char* close = 0;
+		if (fEnd - p >= 3 && !memcmp(p, "!--", 3)) close = Find(p, "-->");
+		else if (p < fEnd && *p == '?') close = Find(p, "?>");
+		else if (p < fEnd && *p == '!') close = Find(p, ">");
+		else break;
+		if (!close) return Fail("Unterminated comment or declaration");
+		fPos = close + 1;
+	}
+
+	tag.fEnd = p < fEnd && *p == '/';
+	if (tag.fEnd) {
+		++p;
+		while (p < fEnd && IsSpace(*p)) ++p;
+	}
+	tag.fName = p;
+	while (p < fEnd && !IsSpace(*p) && *p != '/' && *p != '>' && *p != '<') ++p;
+	tag.fNameLength = p - tag.fName;
+	tag.fEmpty = false;
+	tag.fHasName = false;
+
+	for (;;) {
+		while (p < fEnd && IsSpace(*p)) ++p;
+		if (p == fEnd) return Fail("Unexpected end of text inside a tag");
+		if (*p == '>') break;
+		if (*p == '/') {
+			tag.fEmpty = true;
+			++p;
+			continue;
+		}
+		if (*p == '<') return Fail("Unexpected '<' inside a tag");
+
+		const char* attr = p;
+		while (p < fEnd && !IsSpace(*p) && *p != '=' && *p != '<' && *p != '>') ++p;
+		const size_t attrLength = p - attr;
+		while (p < fEnd && IsSpace(*p)) ++p;
+		if (p == fEnd || *p != '=') return Fail("Expected '=' after an attribute name");
+		++p;
+		while (p < fEnd && IsSpace(*p)) ++p;
+		if (p == fEnd || (*p != '\"' && *p != '\'')) return Fail("Expected a quoted attribute value");
+		const char* value = p + 1;
+		p = static_cast<const char*>(memchr(value, *p, fEnd - value));
+		if (!p) return Fail("Unterminated attribute value");
+		if (attrLength == 4 && !memcmp(attr, "name", 4)) {
+			std::vector<char> decoded;
+			Decode(value, p, decoded);
+			tag.fAttr.assign(&decoded[0]);
+			tag.fHasName = true;
+		}
+		++p;
+	}
+	fPos = p + 1;
+	return true;
+}
+
+bool Scanner::ReadText(std::vector<char>& chars)
+{
+	/*! Appends the (decoded) text up to the next tag to \e chars */
+	const char* lt = static_cast<const char*>(memchr(fPos, '<', fEnd - fPos));
+	if (!lt) return Fail("Unexpected end of text inside a value");
+	Decode(fPos, lt, chars);
+	fPos = lt;
+	return true;
+}
+
+bool Scanner::SkipDir()
+{
+	/*! Moves past the </dir> closing the directory just opened */
+	int depth = 1;
+	for (const char* p = fPos; (p = Find(p, "<")); ) {
+		const bool open = fEnd - p > 4 && !memcmp(p, "<dir", 4) && (IsSpace(p[4]) || p[4] == '>');
+		const bool close = fEnd - p > 5 && !memcmp(p, "</dir", 5);
+		if (!open && !close) {
+			++p;
+			continue;
+		}
+		const char* gt = static_cast<const char*>(memchr(p, '>', fEnd - p));
+		if (!gt) break;
+		if (open && gt[-1] != '/') ++depth;
+		if (close && --depth == 0) {
+			fPos = gt + 1;
+			return true;
+		}
+		p = gt + 1;
+	}
+	return Fail("Unterminated directory");
+}
+
+Scanner::Select_t Scanner::Select(const std::string& path) const
+{
+	/*!
+	 * \param path Directory path, without leading and with trailing '/'
+	 * Matching is by path component and not case sensitive, as in the ODB; a
+	 * component "*" in a subtree matches any directory.
+	 */
+	Select_t select = kSkip;
+	for (const char* const* subtree = fSubtrees; *subtree && select != kTake; ++subtree) {
+		const char* a = path.c_str();
+		const char* b = *subtree;
+		while (*b == '/') ++b;
+		for (;;) {
+			if (!*b) {
+				if (*a == '/' || (a > path.c_str() && a[-1] == '/')) select = kTake;
+				break;
+			}
+			if (!*a) {
+				select = kDescend;
+				break;
+			}
+			if (b[0] == '*' && (b[1] == '/' || !b[1]) && (a == path.c_str() || a[-1] == '/')) {
+				while (*a && *a != '/') ++a;
+				++b;
+				continue;
+			}
+			if (tolower((unsigned char)*a) != tolower((unsigned char)*b)) break;
+			++a;
+			++b;
+		}
+	}
+	return select;
+}
+
+bool Scanner::Run(std::vector<Key_t>& keys, std::vector<char>& chars)
+{
+	fPos = Find(fPos, "<odb");
+	if (!fPos) return Fail("No odb tag found");
+	Tag_t odb;
+	if (!NextTag(odb)) return Fail(fError ? fError : "Unexpected end of text");
+
+	std::string path;
+	std::vector<Dir_t> dirs(1);
+	dirs[0].fLength = 0;
+	dirs[0].fChars = kNoChars;
+	dirs[0].fSelect = fSubtrees ? kDescend : kTake;
+
+	Tag_t tag;
+	while (NextTag(tag)) {
+		if (tag.fEnd) {
+			if (tag.Is("odb")) return true;
+			if (tag.Is("dir") && dirs.size() > 1) dirs.pop_back();
+			continue;
+		}
+		const bool isDir = tag.Is("dir"), isArray = !isDir && tag.Is("keyarray");
+		if ((!isDir && !isArray && !tag.Is("key")) || !tag.fHasName) continue;
+
+		Dir_t& dir = dirs.back();
+		path.resize(dir.fLength);
+		path += tag.fAttr;
+		if (isDir) {
+			if (tag.fEmpty) continue;
+			path += '/';
+			const Select_t select = dir.fSelect == kTake ? kTake : Select(path);
+			if (select == kSkip) {
+				if (!SkipDir()) return false;
+				continue;
+			}
+			Dir_t sub = { path.size(), kNoChars, select };
+			dirs.push_back(sub);
+			continue;
+		}
+		if (dir.fSelect != kTake) continue;
+
+		if (dir.fChars == kNoChars) {
+			dir.fChars = chars.size();
+			chars.insert(chars.end(), path.begin(), path.begin() + dir.fLength);
+			chars.push_back(0);
+		}
+		Key_t key;
+		const bool ok = begin_key(path, dir.fLength, dir.fChars, isArray, chars, key);
+		const size_t valuesStart = chars.size();
+		if (!isArray) {
+			if (tag.fEmpty) chars.push_back(0);
+			else if (!ReadText(chars)) return false;
+			key.fWords[kNumValues] = 1;
+		}
+		else if (!tag.fEmpty) {
+			Tag_t value;
+			for (;;) {
+				if (!NextTag(value)) return Fail(fError ? fError : "Unterminated keyarray");
+				if (value.fEnd && value.Is("keyarray")) break;
+				if (value.fEnd || !value.Is("value")) continue;
+				if (value.fEmpty) chars.push_back(0);
+				else if (!ReadText(chars)) return false;
+				++key.fWords[kNumValues];
+			}
+		}
+		if (!ok) {
+			chars.resize(valuesStart);
+			continue;
+		}
+		if (isArray) key.fWords[kNumValues] |= kArrayBit;
+		keys.push_back(key);
+	}
+	return Fail(fError ? fError : "Unterminated odb tag");
+}
+
+void assemble(const std::vector<Key_t>& keys, const std::vector<char>& chars, std::vector<char>& buf)
+{
+	/*! Lays out the header, hash slots, key records and characters in \e buf */
+	uint32_t nSlots = 16;
+	while (nSlots < 2 * keys.size()) nSlots *= 2;
+	std::vector<uint32_t> slots(nSlots, 0);
+	const uint32_t mask = nSlots - 1;
+	for (size_t i = 0; i< keys.size(); ++i) {
+		const uint32_t* key = keys[i].fWords;
+		for (uint32_t slot = key[kHash] & mask; ; slot = (slot + 1) & mask) {
+			if (!slots[slot]) {
+				slots[slot] = i + 1;
+				break;
+			}
+			const uint32_t* other = keys[slots[slot] - 1].fWords;
+			const uint32_t dirLength = key[kLengths] >> 8;
+			if (other[kHash] == key[kHash] && other[kLengths] == key[kLengths] &&
+					(other[kNumValues] & kArrayBit) == (key[kNumValues] & kArrayBit) &&
+					!memcmp(&chars[other[kDir]], &chars[key[kDir]], dirLength) &&
+					!memcmp(&chars[other[kName]], &chars[key[kName]], key[kLengths] & 0xff))
+				break; // keep the first
+		}
+	}
+
+	const size_t charsStart = kHeaderSize + 4 * (nSlots + kKeyWords * keys.size());
+	buf.assign(charsStart, 0);
+	memcpy(&buf[0], kMagic, 4);
+	put32(buf, 4, keys.size());
+	put32(buf, 8, nSlots);
+	for (uint32_t i = 0; i< nSlots; ++i)
+		put32(buf, kHeaderSize + 4 * i, slots[i]);
+	for (size_t i = 0; i< keys.size(); ++i)
+		for (int j = 0; j< kKeyWords; ++j)
+			put32(buf, kHeaderSize + 4 * (nSlots + kKeyWords * i + j), keys[i].fWords[j]);
+	buf.insert(buf.end(), chars.begin(), chars.end());
+}
+
+}
+
+
+midas::OdbSnapshot::OdbSnapshot():
+	fLength(0), fData(0)
+{ }
+
+midas::OdbSnapshot::OdbSnapshot(const OdbSnapshot& other):
+	fLength(0), fData(0)
+{
+	*this = other;
+}
+
+midas::OdbSnapshot& midas::OdbSnapshot::operator= (const OdbSnapshot& other)
+{
+	if (this != &other) {
+		Clear();
+		if (other.fLength) {
+			fData = new char[other.fLength];
+			memcpy(fData, other.fData, other.fLength);
+			fLength = other.fLength;
+		}
+	}
+	return *this;
+}
+
+midas::OdbSnapshot::~OdbSnapshot()
+{
+	Clear();
+}
+
+void midas::OdbSnapshot::Clear()
+{
+	delete[] fData;
+	fData = 0;
+	fLength = 0;
+}
+
+bool midas::OdbSnapshot::Build(Xml& xml)
+{
+	Clear();
+	if (!xml.Check()) return false;
+
+	std::vector<Key_t> keys;
+	std::vector<char> chars;
+	std::string path;
+	collect(xml.fOdb, path, keys, chars);
+
+	std::vector<char> buf;
+	assemble(keys, chars, buf);
+	return Set(&buf[0], buf.size());
+}
+
+bool midas::OdbSnapshot::Scan(const char* buf, uint32_t length, const char* const* subtrees)
+{
+	/*!
+	 * \param buf ODB XML text, e.g. the data of a BOR or EOR event; anything before
+	 *  the \c \<odb\> tag is ignored
+	 * \param length Size of \e buf in bytes
+	 * \param subtrees NULL terminated list of the directories to keep, e.g.
+	 *  <tt>{ "/Runinfo", "/dragon", 0 }</tt>. A path component "*" matches any
+	 *  directory, so that e.g. "/Equipment/ * /Settings" (without the spaces) keeps
+	 *  the settings of all equipment. NULL keeps all.
+	 * \returns false (and clears) if the text could not be read
+	 */
+	Clear();
+	std::vector<Key_t> keys;
+	std::vector<char> chars;
+	Scanner scanner(buf, buf + length, subtrees);
+	if (!scanner.Run(keys, chars)) {
+		dragon::utils::Error("midas::OdbSnapshot::Scan", __FILE__, __LINE__)
+			<< "Bad ODB XML text: " << scanner.GetError();
+		return false;
+	}
+
+	std::vector<char> out;
+	assemble(keys, chars, out);
+	return Set(&out[0], out.size());
+}
+
+bool midas::OdbSnapshot::Set(const char* buf, uint32_t length)
+{
+	/*!
+	 * Checks the header and that the tables fit in \e length; the contents of the
+	 * tables are trusted.
+	 */
+	Clear();
+	if (length < kHeaderSize || memcmp(buf, kMagic, 4)) return false;
+	const uint64_t nKeys = get32(buf + 4), nSlots = get32(buf + 8);
+	if (nSlots == 0 || (nSlots & (nSlots - 1)) || nKeys >= nSlots ||
+			kHeaderSize + 4 * (nSlots + kKeyWords * nKeys) > length) {
+		dragon::utils::Error("midas::OdbSnapshot::Set", __FILE__, __LINE__)
+			<< "Invalid snapshot buffer of length " << length;
+		return false;
+	}
+	fData = new char[length];
+	memcpy(fData, buf, length);
+	fLength = length;
+	return true;
+}
+
+uint32_t midas::OdbSnapshot::GetNumKeys() const
+{
+	return fLength ? get32(fData + 4) : 0;
+}
+
+int midas::OdbSnapshot::Find(const char* path, bool array, bool silent) const
+{
+	if (!fLength || !path) return -1;
+	if (path[0] == '/') ++path;
+	const size_t length = strlen(path);
+	const uint32_t hash = hash_path(path, length, array);
+	const uint32_t nSlots = get32(fData + 8), mask = nSlots - 1;
+	const char* keys = fData + kHeaderSize + 4 * nSlots;
+	const char* chars = keys + 4 * kKeyWords * get32(fData + 4);
+
+	for (uint32_t slot = hash & mask; ; slot = (slot + 1) & mask) {
+		const uint32_t index = get32(fData + kHeaderSize + 4 * slot);
+		if (!index) break;
+		const char* key = keys + 4 * kKeyWords * (index - 1);
+		if (get32(key + 4 * kHash) != hash || !(get32(key + 4 * kNumValues) & kArrayBit) != !array)
+			continue;
+		const uint32_t lengths = get32(key + 4 * kLengths), dirLength = lengths >> 8;
+		if (dirLength + (lengths & 0xff) == length &&
+				!memcmp(chars + get32(key + 4 * kDir), path, dirLength) &&
+				!memcmp(chars + get32(key + 4 * kName), path + dirLength, length - dirLength))
+			return index - 1;
+	}
+	if (!silent) {
+		dragon::utils::Error("midas::OdbSnapshot::Find")
+			<< "Error: ODB path: " << path << " was not found.";
+	}
+	return -1;
+}
+
+const char* midas::OdbSnapshot::GetValues(int key) const
+{
+	const char* chars = fData + kHeaderSize + 4 * (get32(fData + 8) + kKeyWords * get32(fData + 4));
+	return chars + key_word(fData, key, kName) + (key_word(fData, key, kLengths) & 0xff) + 1;
+}
+
+bool midas::OdbSnapshot::CheckLength(int key, const char* path, int length) const
+{
+	const int size = key_word(fData, key, kNumValues) & ~kArrayBit;
+	if (size != length) {
+		dragon::utils::Error("midas::OdbSnapshot::GetArray", __FILE__, __LINE__)
+			<< "size of the ODB array " << path << ": " << size
+			<< " is not equal to the size of the array to fill: " << length;
+		return false;
+	}
+	return true;
+}
+
+int midas::OdbSnapshot::GetArrayLength(const char* path) const
+{
+	const int key = Find(path, true, false);
+	if (key < 0) return -1;
+	return key_word(fData, key, kNumValues) & ~kArrayBit;
+}
@@ -0,0 +1,153 @@
+//! \file OdbSnapshot.hxx
+//! \brief Defines a compact binary snapshot of the keys of an ODB tree.
+#ifndef MIDAS_ODB_SNAPSHOT_HXX
+#define MIDAS_ODB_SNAPSHOT_HXX
+#include <string>
+#include <sstream>
+#include <cstring>
+#include "utils/IntTypes.h"
+
+#ifdef USE_ROOT
+#include <Rtypes.h>
+#endif
+
+
+namespace midas {
+
+class Xml;
+
+/// Compact binary snapshot of the keys and keyarrays of an ODB tree
+/*!
+ * All keys are stored in one flat, position independent buffer: a header, an
+ * open-addressing hash table of the key paths, one fixed-size record per key and
+ * the paths and values as NUL-terminated text. Lookups hash the path and read the
+ * buffer in place, so a snapshot read back from a ROOT file (or set from a memory
+ * mapped one) is usable immediately, without the XML parse midas::Xml needs.
+ *
+ * Values keep their XML text and are converted only when read, in the same way as
+ * midas::Xml does, so reading a snapshot gives the same results as reading the Xml
+ * it was built from. A snapshot can also be filled straight from XML text by Scan(),
+ * which reads only the directories asked for. Paths are case sensitive; if one occurs more than once, the
+ * first in document order is kept.
+ *
+ * Integers in the buffer are little endian, regardless of the host.
+ */
+class OdbSnapshot {
+public:
+	/// Empty snapshot
+	OdbSnapshot();
+	/// Copy the buffer of \e other
+	OdbSnapshot(const OdbSnapshot& other);
+	/// Copy the buffer of \e other
+	OdbSnapshot& operator= (const OdbSnapshot& other);
+	/// Free the buffer
+	~OdbSnapshot();
+
+	/// Replace the contents by the keys of \e xml, returns false if it has no tree
+	bool Build(Xml& xml);
+	/// Replace the contents by the keys of selected directories of ODB XML text, without parsing it into a tree
+	bool Scan(const char* buf, uint32_t length, const char* const* subtrees = 0);
+	/// Replace the contents by a copy of \e buf, returns false (and clears) if not a valid snapshot
+	bool Set(const char* buf, uint32_t length);
+	/// Remove all keys
+	void Clear();
+
+	/// Check if there are no keys
+	bool IsEmpty() const { return fLength == 0; }
+	/// Size of the buffer in bytes
+	uint32_t GetLength() const { return fLength; }
+	/// The buffer, e.g. to save it to a file
+	const char* GetBuffer() const { return fData; }
+	/// Number of keys and keyarrays
+	uint32_t GetNumKeys() const;
+
+	/// Check if a key or keyarray exists
+	bool CheckPath(const char* path) const
+		{ return Find(path, false, true) >= 0 || Find(path, true, true) >= 0; }
+
+	/// Read the length of a keyarray, -1 if there is none
+	int GetArrayLength(const char* path) const;
+
+	/// Read the value of a key
+	template <typename T> bool GetValue(const char* path, T& value) const
+		{
+			/*!
+			 * \param [in] path ODB path of the key, e.g. "/Runinfo/Run number"
+			 * \param [out] value Set to the value of the key, if found
+			 * \returns true if the key was found, false otherwise
+			 */
+			const int key = Find(path, false, false);
+			if (key < 0) return false;
+			Convert(GetValues(key), value);
+			return true;
+		}
+
+	/// Read the values of a keyarray
+	template <typename T> bool GetArray(const char* path, int length, T* array) const
+		{
+			/*!
+			 * \param [in] path ODB path of the keyarray
+			 * \param [in] length Length of \e array, which must equal that of the keyarray
+			 * \param [out] array Filled with the values of the keyarray
+			 * \returns true if the keyarray was found and had length \e length
+			 */
+			const int key = Find(path, true, false);
+			if (key < 0 || !CheckLength(key, path, length)) return false;
+			const char* value = GetValues(key);
+			for (int i = 0; i< length; ++i) {
+				Convert(value, array[i]);
+				value += strlen(value) + 1;
+			}
+			return true;
+		}
+
+private:
+	/// Index of the key (\e array false) or keyarray record at \e path, -1 if there is none
+	int Find(const char* path, bool array, bool silent) const;
+	/// Pointer to the first of the values of a key record
+	const char* GetValues(int key) const;
+	/// Check that a keyarray record has \e length values, reporting an error if not
+	bool CheckLength(int key, const char* path, int length) const;
+
+	/// Convert the text of a value
+	template <typename T> static void Convert(const char* text, T& value)
+		{
+			std::stringstream val;
+			val << text;
+			val >> value;
+		}
+
+private:
+	/// Size of fData in bytes
+	uint32_t fLength;
+	/// The snapshot
+	char* fData; //[fLength]
+
+public:
+#ifdef USE_ROOT
+	ClassDef(midas::OdbSnapshot, 1);
+#endif
+};
+
+#ifndef __MAKECINT__
+
+/// Template specialization for bool
+template <>
+inline void midas::OdbSnapshot::Convert<bool>(const char* text, bool& value)
+{
+	value = !strcmp("y", text);
+}
+
+/// Template specialization for std::string
+template <>
+inline void midas::OdbSnapshot::Convert<std::string>(const char* text, std::string& value)
+{
+	value = text;
+}
+
+#endif
+
+} // namespace midas
+
+
+#endif
@@ -18,7 +18,7 @@
 #endif
 
 midas::Xml::Xml(const char* filename):
-	fTree(0), fOdb(0), fIsZombie(false), fLength(0), fBuffer(0)
+	fTree(0), fOdb(0), fIsZombie(false), fLength(0), fBuffer(0), fIndex(0)
 {
 #ifdef USE_ROOT
 	TString fnameExp (filename);
@@ -47,7 +47,7 @@ midas::Xml::Xml(const char* filename):
 }
 
 midas::Xml::Xml(char* buf, int length):
-	fTree(0), fOdb(0), fIsZombie(false), fLength(0), fBuffer(0)
+	fTree(0), fOdb(0), fIsZombie(false), fLength(0), fBuffer(0), fIndex(0)
 {
 	char err[256]; int err_line;
 	fTree = ParseBuffer(buf, length, err, sizeof(err), &err_line);
@@ -68,7 +68,7 @@ midas::Xml::Xml(char* buf, int length):
 }
 
 midas::Xml::Xml():
-	fTree(0), fOdb(0), fIsZombie(false), fLength(0), fBuffer(0)
+	fTree(0), fOdb(0), fIsZombie(false), fLength(0), fBuffer(0), fIndex(0)
 {
 	;
 }
@@ -94,13 +94,6 @@ void midas::Xml::InitFromStreamer()
 	}
 }
 
-midas::Xml::~Xml()
-{
-	if(fTree) mxml_free_tree(fTree);
-	if(fBuffer) delete fBuffer;
-}
-
-
 midas::Xml::Node midas::Xml::ParseFile(const char* file_name, char *error, int error_size, int *error_line)
 {
 	char line[1000];
@@ -241,34 +234,134 @@ bool midas::Xml::Check()
 	return false; // not okay
 }
 
-namespace {
-inline std::vector<std::string> path_tokenize(const char* path) {
-	std::string strPath(path);
-	std::vector<std::string> nodes;
-	long posn (0);
-	while(strPath.find("/") < strPath.size()) {
-		posn = strPath.find("/");
-		nodes.push_back(strPath.substr(0, posn));
-		strPath = strPath.substr(posn+1);
+namespace midas {
+
+/// Open-addressing hash table of the key and keyarray nodes of an ODB tree
+/*!
+ * Maps full ODB paths (without the leading '/', e.g. "dragon/bgo/variables/adc/slope")
+ * to nodes, giving the same results as the equivalent
+ * <tt>/dir[@name=...]/.../key[@name=...]</tt> mxml_find_node() search: names are
+ * case sensitive, and if a path occurs more than once the first node in document
+ * order is kept. Paths are stored back to back in one character buffer, and a
+ * lookup hashes \e path in place, so no memory is allocated after construction.
+ */
+class XmlIndex {
+public:
+	/// Index all keys below \e odb
+	XmlIndex(Xml::Node odb);
+	/// Find a key (\e array false) or keyarray, returns 0 if there is none
+	Xml::Node Find(const char* path, bool array) const;
+
+private:
+	struct Entry_t {
+		uint32_t fHash;   ///< Hash of the path and node type
+		uint32_t fPath;   ///< Offset of the path in fChars
+		uint32_t fLength; ///< Length of the path
+		bool fArray;      ///< keyarray (true) or key node
+		Xml::Node fNode;  ///< 0 for empty slots
+	};
+	static uint32_t Hash(const char* path, size_t length, bool array);
+	void Collect(Xml::Node dir, std::string& path, std::vector<Entry_t>& entries);
+	size_t Probe(uint32_t hash, const char* path, size_t length, bool array) const;
+
+	std::vector<char> fChars;     ///< All paths
+	std::vector<Entry_t> fTable;  ///< Power-of-two number of slots, at most half full
+};
+
+}
+
+midas::XmlIndex::XmlIndex(Xml::Node odb)
+{
+	std::vector<Entry_t> entries;
+	std::string path;
+	Collect(odb, path, entries);
+	fChars.push_back(0); // never empty
+
+	size_t size = 16;
+	while (size < 2 * entries.size()) size *= 2;
+	Entry_t empty = { 0, 0, 0, false, 0 };
+	fTable.assign(size, empty);
+	for (size_t i = 0; i< entries.size(); ++i) {
+		const Entry_t& entry = entries[i];
+		const size_t slot = Probe(entry.fHash, &fChars[entry.fPath], entry.fLength, entry.fArray);
+		if (!fTable[slot].fNode) fTable[slot] = entry; // else keep the first
 	}
-	nodes.push_back(strPath);
-	return nodes;
 }
-std::string get_xml_path(const char* path, const char* node_type) {
-	const char* pPath = path[0] == '/' ? &path[1] : &path[0];
-	std::vector<std::string> nodes = path_tokenize(pPath);
-	std::stringstream xmlPath;
-	for(std::vector<std::string>::iterator it = nodes.begin(); it != nodes.end(); ++it) {
-		if(it != nodes.end() - 1) xmlPath << "/dir[@name=" << *it << "]";
-		else xmlPath << "/" << node_type << "[@name=" << *it << "]";
+
+uint32_t midas::XmlIndex::Hash(const char* path, size_t length, bool array)
+{
+	uint32_t hash = array ? 0x050c5d1fu : 2166136261u; // FNV-1a, separate offsets per node type
+	for (size_t i = 0; i< length; ++i) {
+		hash ^= (unsigned char)path[i];
+		hash *= 16777619u;
 	}
-	return xmlPath.str();
-} }
+	return hash;
+}
+
+void midas::XmlIndex::Collect(Xml::Node dir, std::string& path, std::vector<Entry_t>& entries)
+{
+	const size_t dirLength = path.size();
+	for (int i = 0; i< dir->n_children; ++i) {
+		Xml::Node node = dir->child + i;
+		const bool isDir = !strcmp(node->name, "dir"), isArray = !strcmp(node->name, "keyarray");
+		if (!isDir && !isArray && strcmp(node->name, "key")) continue;
+		const char* name = mxml_get_attribute(node, "name");
+		if (!name) continue;
+
+		path.resize(dirLength);
+		path += name;
+		if (isDir) {
+			path += '/';
+			Collect(node, path, entries);
+		}
+		else {
+			Entry_t entry = { Hash(path.data(), path.size(), isArray), (uint32_t)fChars.size(),
+												(uint32_t)path.size(), isArray, node };
+			fChars.insert(fChars.end(), path.begin(), path.end());
+			entries.push_back(entry);
+		}
+	}
+	path.resize(dirLength);
+}
+
+size_t midas::XmlIndex::Probe(uint32_t hash, const char* path, size_t length, bool array) const
+{
+	/*! \returns The slot of the matching entry, or the empty slot where it would go */
+	const size_t mask = fTable.size() - 1;
+	for (size_t i = hash & mask; ; i = (i + 1) & mask) {
+		const Entry_t& entry = fTable[i];
+		if (!entry.fNode) return i;
+		if (entry.fHash == hash && entry.fLength == length && entry.fArray == array &&
+				!memcmp(&fChars[entry.fPath], path, length))
+			return i;
+	}
+}
+
+midas::Xml::Node midas::XmlIndex::Find(const char* path, bool array) const
+{
+	if (!path) return 0;
+	if (path[0] == '/') ++path;
+	const size_t length = strlen(path);
+	return fTable[Probe(Hash(path, length, array), path, length, array)].fNode;
+}
+
+midas::Xml::~Xml()
+{
+	delete fIndex; // after the definition of XmlIndex, so that its destructor runs
+	if(fTree) mxml_free_tree(fTree);
+	if(fBuffer) delete fBuffer;
+}
+
+midas::Xml::Node midas::Xml::FindIndexed(const char* path, bool array)
+{
+	if (!fIndex) fIndex = new XmlIndex(fOdb);
+	return fIndex->Find(path, array);
+}
 
 midas::Xml::Node midas::Xml::FindKey(const char* path, bool silent)
 {
 	if(!Check()) return 0;
-	Node out = mxml_find_node(fOdb, get_xml_path(path, "key").c_str());
+	Node out = FindIndexed(path, false);
 	if(!out && !silent) {
 		dragon::utils::Error("midas::Xml::FindKey")
 			<< "Error: XML path: " << path << " was not found.";
@@ -279,7 +372,7 @@ midas::Xml::Node midas::Xml::FindKey(const char* path, bool silent)
 midas::Xml::Node midas::Xml::FindKeyArray(const char* path, bool silent)
 {
 	if(!Check()) return 0;
-	Node out = mxml_find_node(fOdb, get_xml_path(path, "keyarray").c_str());
+	Node out = FindIndexed(path, true);
 	if(!out && !silent) {
 		dragon::utils::Error("midas::Xml::FindKey")
 			<< "Error: XML path: " << path << " was not found.";
@@ -24,6 +24,9 @@
 
 namespace midas {
 
+class XmlIndex;
+class OdbSnapshot;
+
 /// Class to parse MIDAS ODB XML files.
 /*!
  * \attention If you want to be able to cleanly read from either the
@@ -52,6 +55,8 @@ public:// private:
 	uint32_t fLength;
 	/// Buffer containing all of the XML data
 	char* fBuffer; //[fLength]
+	/// Index of the key and keyarray nodes by ODB path, built on the first lookup
+	XmlIndex* fIndex; //!
 
 public:
 	/// \brief Default constructor for ROOTCINT
@@ -83,6 +88,7 @@ public:
 	/// \brief Find the node location of a specific key element within the xml file
 	/// \param [in] path String specifying the "directory" path of the element, e.g.
 	/// "Equipment/gTrigger/Variables/Pedestals".
+	/// \note Lookups go through a hash index of all keys, built on the first call.
 	Node FindKey(const char* path, bool silent = false);
 
 	/// \brief Find the node location of a specific keyarray element within the xml file
@@ -337,6 +343,12 @@ private:
 	/// \brief Check if fTree and fOdb are non-null
 	bool Check();
 
+	/// \brief Find a key (\e array false) or keyarray node through fIndex, building it if needed
+	Node FindIndexed(const char* path, bool array);
+
+	/// Builds its snapshots from fOdb
+	friend class OdbSnapshot;
+
 	/// Disable copy
 	Xml(const Xml&) { }
 
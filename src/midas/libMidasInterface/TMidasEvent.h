@@ -53,7 +53,9 @@ class TMidasEvent
   // helpers for event creation
 
   TMidas_EVENT_HEADER* GetEventHeader(); ///< return pointer to the event header
+  const TMidas_EVENT_HEADER* GetEventHeader() const { return &fEventHeader; } ///< return pointer to the event header
   char* GetData(); ///< return pointer to the data buffer
+  const char* GetData() const { return fData; } ///< return pointer to the data buffer
 
   void AllocateData(); ///< allocate data buffer using the existing event header
   void SetData(uint32_t dataSize, char* dataBuffer); ///< set an externally allocated data buffer
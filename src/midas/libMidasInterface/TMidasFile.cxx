@@ -9,14 +9,720 @@
 #include <fcntl.h>
 #include <errno.h>
 #include <assert.h>
+#include <poll.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <vector>
+#include <deque>
+#include <algorithm>
 
 #ifdef HAVE_ZLIB
 #include <zlib.h>
 #endif
+#ifdef HAVE_BZIP2
+#include <bzlib.h>
+#endif
+#ifdef HAVE_LZ4
+#include <lz4frame.h>
+#endif
 
+#include "utils/Thread.hxx"
+#include "utils/Profile.hxx"
 #include "TMidasFile.h"
+#include "TMidasFileIndex.h"
 #include "TMidasEvent.h"
 
+/// Reads (and decompresses) the input in a separate thread
+///
+/// The thread fills a ring of kNumChunks buffers of kChunkSize bytes each: empty
+/// buffers are taken from fFree, filled and handed to the reading thread
+/// through fFull. The reading thread gets contiguous pieces of the stream with
+/// Fetch(); a piece is a pointer into the current buffer, unless it straddles two
+/// buffers, in which case it is assembled in fSpill.
+///
+/// Gzip files are inflated directly with zlib, which can record access points
+/// (see TMidasFileIndex) while reading, and can restart from one.
+
+class TMidasFileReadAhead : public dragon::utils::Thread
+{
+public:
+  enum Source_t { kFd, kInflate, kBz2, kLz4 }; ///< input stream types
+
+  TMidasFileReadAhead(Source_t source, int fd); ///< allocate buffers
+  ~TMidasFileReadAhead(); ///< stop the thread and free buffers
+
+  void RecordAccessPoints(uint64_t span) { fSpan = span; } ///< record gzip access points every "span" bytes
+  bool Init(const TMidasFileIndex::AccessPoint_t* start = NULL); ///< open the decompressor (if any) and start the thread
+  void Stop(); ///< stop the thread
+  const char* Fetch(size_t length, size_t* got); ///< get the next "length" bytes
+
+  Source_t    GetSource() const { return fSource; }       ///< type of input
+  int         GetErrno() const { return fErrno; }         ///< errno from the last i/o error
+  const std::string& GetError() const { return fError; } ///< text of the last i/o error
+  std::vector<TMidasFileIndex::AccessPoint_t>& GetAccessPoints() { return fPoints; } ///< recorded access points, after Stop()
+
+private:
+  struct Chunk { char* fData; size_t fSize; }; ///< one buffer in the ring
+
+  static const int    kNumChunks = 4;
+  static const size_t kChunkSize = 4*1024*1024;
+  static const size_t kWindowSize = 32768;
+
+  void Run(); ///< thread body
+  size_t Fill(char* buf, size_t length); ///< fill a buffer from the source
+  long ReadFd(char* buf, size_t length); ///< single read() from fFd, watching fStop
+  size_t Inflate(char* buf, size_t length); ///< Fill() for kInflate
+  void AddToWindow(const char* data, size_t length); ///< keep the last kWindowSize bytes of output
+  void SetError(int err, const std::string& text) { fErrno = err; fError = text; }
+
+  Source_t fSource;
+  int      fFd;
+  void*    fBzFile;
+  void*    fLz4;
+  void*    fZStream;
+  bool     fRawDeflate;  ///< inflating a raw deflate stream (restarted from an access point)
+  int      fSkipTrailer; ///< bytes of gzip trailer still to skip (raw deflate only)
+  std::vector<char> fIn; ///< compressed input buffer
+  size_t   fInPos;
+  size_t   fInSize;
+  uint64_t fInTotal;   ///< bytes of compressed input read so far (file offset)
+  uint64_t fOutTotal;  ///< bytes of output so far (stream offset)
+  uint64_t fSpan;      ///< spacing of access points, 0 to not record them
+  std::vector<unsigned char> fWindow; ///< ring buffer with the last kWindowSize bytes of output
+  size_t   fWindowPos;
+  size_t   fWindowFill;
+  std::vector<TMidasFileIndex::AccessPoint_t> fPoints;
+
+  volatile bool fStop;
+  int         fErrno;
+  std::string fError;
+
+  std::vector<Chunk> fChunks;
+  dragon::utils::BoundedQueue<Chunk*> fFree;
+  dragon::utils::BoundedQueue<Chunk*> fFull;
+
+  Chunk*            fCurrent; ///< buffer being read by Fetch()
+  size_t            fPos;     ///< read position in fCurrent
+  std::vector<char> fSpill;   ///< pieces straddling two buffers
+};
+
+const int    TMidasFileReadAhead::kNumChunks;
+const size_t TMidasFileReadAhead::kChunkSize;
+const size_t TMidasFileReadAhead::kWindowSize;
+
+TMidasFileReadAhead::TMidasFileReadAhead(Source_t source, int fd):
+  fSource(source), fFd(fd), fBzFile(NULL), fLz4(NULL), fZStream(NULL),
+  fRawDeflate(false), fSkipTrailer(0), fInPos(0), fInSize(0), fInTotal(0), fOutTotal(0),
+  fSpan(0), fWindowPos(0), fWindowFill(0), fStop(false), fErrno(0),
+  fChunks(kNumChunks), fFree(kNumChunks), fFull(kNumChunks),
+  fCurrent(NULL), fPos(0)
+{
+  for (int i=0; i<kNumChunks; i++)
+    {
+      fChunks[i].fData = (char*)malloc(kChunkSize);
+      assert(fChunks[i].fData);
+      fChunks[i].fSize = 0;
+      fFree.Push(&fChunks[i]);
+    }
+}
+
+TMidasFileReadAhead::~TMidasFileReadAhead()
+{
+  Stop();
+#ifdef HAVE_ZLIB
+  if (fZStream)
+    {
+      inflateEnd((z_stream*)fZStream);
+      delete (z_stream*)fZStream;
+    }
+#endif
+#ifdef HAVE_BZIP2
+  if (fBzFile)
+    BZ2_bzclose((BZFILE*)fBzFile);
+#endif
+#ifdef HAVE_LZ4
+  if (fLz4)
+    LZ4F_freeDecompressionContext((LZ4F_decompressionContext_t)fLz4);
+#endif
+  for (int i=0; i<kNumChunks; i++)
+    free(fChunks[i].fData);
+}
+
+bool TMidasFileReadAhead::Init(const TMidasFileIndex::AccessPoint_t* start)
+{
+  /// \param [in] start Access point to restart decompression from (kInflate only),
+  ///  NULL to read from the current position of the file descriptor.
+
+  if (fSource == kInflate)
+    {
+#ifdef HAVE_ZLIB
+      z_stream* strm = new z_stream;
+      memset(strm, 0, sizeof(z_stream));
+      fZStream = strm;
+      fIn.resize(1024*1024);
+      fRawDeflate = (start != NULL);
+      if (inflateInit2(strm, fRawDeflate ? -15 : 47) != Z_OK) // 47: gzip or zlib header
+        {
+          SetError(-1, "zlib inflateInit2() error");
+          return false;
+        }
+      if (start)
+        {
+          unsigned char byte = 0;
+          off_t offset = start->fIn - (start->fBits ? 1 : 0);
+          if (lseek(fFd, offset, SEEK_SET) != offset ||
+              (start->fBits && read(fFd, &byte, 1) != 1))
+            {
+              SetError(errno, strerror(errno));
+              return false;
+            }
+          if (start->fBits)
+            inflatePrime(strm, start->fBits, byte >> (8 - start->fBits));
+          if (!start->fWindow.empty())
+            inflateSetDictionary(strm, &start->fWindow[0], start->fWindow.size());
+          fInTotal = start->fIn;
+          fOutTotal = start->fOut;
+        }
+      if (fSpan)
+        fWindow.resize(kWindowSize);
+#else
+      assert(!"Cannot get here");
+#endif
+    }
+  else if (fSource == kBz2)
+    {
+#ifdef HAVE_BZIP2
+      // bzclose() closes the descriptor, so give it a copy
+      int fd = dup(fFd);
+      fBzFile = (fd < 0) ? NULL : BZ2_bzdopen(fd, "rb");
+      if (fBzFile == NULL)
+        {
+          if (fd >= 0)
+            close(fd);
+          SetError(-1, "bzlib BZ2_bzdopen() error");
+          return false;
+        }
+#else
+      assert(!"Cannot get here");
+#endif
+    }
+  else if (fSource == kLz4)
+    {
+#ifdef HAVE_LZ4
+      LZ4F_decompressionContext_t ctx;
+      size_t status = LZ4F_createDecompressionContext(&ctx, LZ4F_VERSION);
+      if (LZ4F_isError(status))
+        {
+          SetError(-1, LZ4F_getErrorName(status));
+          return false;
+        }
+      fLz4 = ctx;
+      fIn.resize(1024*1024);
+#else
+      assert(!"Cannot get here");
+#endif
+    }
+
+  if (!Start())
+    {
+      SetError(-1, "Cannot start read-ahead thread");
+      return false;
+    }
+  return true;
+}
+
+void TMidasFileReadAhead::Stop()
+{
+  fStop = true;
+  fFree.Close();
+  fFull.Close();
+  Join();
+}
+
+long TMidasFileReadAhead::ReadFd(char* buf, size_t length)
+{
+  // wait with a timeout, so that a stalled pipe does not block Stop()
+  while (!fStop)
+    {
+      struct pollfd pfd;
+      pfd.fd = fFd;
+      pfd.events = POLLIN;
+      pfd.revents = 0;
+      int pr = poll(&pfd, 1, 200);
+      if (pr == 0 || (pr < 0 && errno == EINTR))
+        continue;
+
+      long rd = read(fFd, buf, length);
+      if (rd < 0 && errno == EINTR)
+        continue;
+      if (rd < 0)
+        SetError(errno, strerror(errno));
+      return rd;
+    }
+  return 0;
+}
+
+void TMidasFileReadAhead::AddToWindow(const char* data, size_t length)
+{
+  if (length >= kWindowSize)
+    {
+      memcpy(&fWindow[0], data + length - kWindowSize, kWindowSize);
+      fWindowPos = 0;
+      fWindowFill = kWindowSize;
+      return;
+    }
+  size_t n = kWindowSize - fWindowPos;
+  if (n > length)
+    n = length;
+  memcpy(&fWindow[fWindowPos], data, n);
+  memcpy(&fWindow[0], data + n, length - n);
+  fWindowPos = (fWindowPos + length) % kWindowSize;
+  fWindowFill = std::min(fWindowFill + length, kWindowSize);
+}
+
+size_t TMidasFileReadAhead::Inflate(char* buf, size_t length)
+{
+#ifdef HAVE_ZLIB
+  z_stream* strm = (z_stream*)fZStream;
+  strm->next_out = (Bytef*)buf;
+  strm->avail_out = length;
+
+  while (strm->avail_out > 0 && !fStop)
+    {
+      if (fInPos == fInSize)
+        {
+          long rd = ReadFd(&fIn[0], fIn.size());
+          if (rd <= 0)
+            break;
+          fInPos = 0;
+          fInSize = rd;
+          fInTotal += rd;
+        }
+
+      if (fSkipTrailer > 0)
+        {
+          size_t n = std::min((size_t)fSkipTrailer, fInSize - fInPos);
+          fInPos += n;
+          fSkipTrailer -= n;
+          if (fSkipTrailer > 0)
+            continue;
+          inflateReset2(strm, 47); // next gzip member, if any
+          fRawDeflate = false;
+          continue;
+        }
+
+      strm->next_in = (Bytef*)&fIn[fInPos];
+      strm->avail_in = fInSize - fInPos;
+      char* out = (char*)strm->next_out;
+      int ret = inflate(strm, fSpan ? Z_BLOCK : Z_NO_FLUSH);
+      size_t produced = (char*)strm->next_out - out;
+      fInPos = fInSize - strm->avail_in;
+      fOutTotal += produced;
+      if (fSpan)
+        AddToWindow(out, produced);
+
+      if (ret == Z_NEED_DICT || ret == Z_DATA_ERROR || ret == Z_MEM_ERROR || ret == Z_STREAM_ERROR)
+        {
+          SetError(-1, strm->msg ? strm->msg : "zlib inflate() error");
+          break;
+        }
+      if (ret == Z_STREAM_END)
+        {
+          if (fRawDeflate)
+            fSkipTrailer = 8;
+          else
+            inflateReset2(strm, 47); // next gzip member, if any
+          continue;
+        }
+
+      // at the end of a deflate block (not the last one): record an access point
+      if (fSpan && (strm->data_type & 128) && !(strm->data_type & 64) &&
+          (fPoints.empty() || fOutTotal - fPoints.back().fOut >= fSpan))
+        {
+          TMidasFileIndex::AccessPoint_t point;
+          point.fIn   = fInTotal - (fInSize - fInPos);
+          point.fOut  = fOutTotal;
+          point.fBits = strm->data_type & 7;
+          point.fWindow.resize(fWindowFill);
+          size_t first = (fWindowPos + kWindowSize - fWindowFill) % kWindowSize;
+          for (size_t i=0; i<fWindowFill; i++)
+            point.fWindow[i] = fWindow[(first + i) % kWindowSize];
+          fPoints.push_back(point);
+        }
+    }
+  return length - strm->avail_out;
+#else
+  assert(!"Cannot get here");
+  return 0;
+#endif
+}
+
+size_t TMidasFileReadAhead::Fill(char* buf, size_t length)
+{
+  /// \returns the number of bytes read; less than "length" only at the end of
+  /// the input (or on error, with fErrno set)
+
+  if (fSource == kInflate)
+    return Inflate(buf, length);
+
+  size_t count = 0;
+  while (count < length && !fStop)
+    {
+      long rd = 0;
+      switch (fSource)
+        {
+        case kFd:
+          rd = ReadFd(buf + count, length - count);
+          break;
+        case kBz2:
+#ifdef HAVE_BZIP2
+          rd = BZ2_bzread((BZFILE*)fBzFile, buf + count, length - count);
+          if (rd < 0)
+            {
+              int err = 0;
+              SetError(-1, BZ2_bzerror((BZFILE*)fBzFile, &err));
+            }
+#endif
+          break;
+        case kLz4:
+#ifdef HAVE_LZ4
+          if (fInPos == fInSize)
+            {
+              rd = ReadFd(&fIn[0], fIn.size());
+              if (rd <= 0)
+                break;
+              fInPos = 0;
+              fInSize = rd;
+            }
+          {
+            size_t dstSize = length - count;
+            size_t srcSize = fInSize - fInPos;
+            size_t status = LZ4F_decompress((LZ4F_decompressionContext_t)fLz4, buf + count, &dstSize,
+                                            &fIn[fInPos], &srcSize, NULL);
+            if (LZ4F_isError(status))
+              {
+                SetError(-1, LZ4F_getErrorName(status));
+                rd = -1;
+                break;
+              }
+            fInPos += srcSize;
+            count += dstSize;
+            continue;
+          }
+#endif
+          break;
+        case kInflate:
+          break;
+        }
+
+      if (rd <= 0)
+        break;
+      count += rd;
+    }
+  return count;
+}
+
+void TMidasFileReadAhead::Run()
+{
+  Chunk* chunk;
+  while (!fStop && fFree.Pop(chunk))
+    {
+      chunk->fSize = Fill(chunk->fData, kChunkSize);
+      if (chunk->fSize == 0)
+        break;
+      if (!fFull.Push(chunk))
+        break;
+      if (chunk->fSize < kChunkSize)
+        break; // end of input
+    }
+  fFull.Close();
+}
+
+const char* TMidasFileReadAhead::Fetch(size_t length, size_t* got)
+{
+  /// \returns pointer to the next "length" bytes of the stream, valid until the
+  /// next call; NULL if the stream ends first, with the number of bytes that were
+  /// available in "got"
+
+  *got = 0;
+  if (fCurrent && fCurrent->fSize - fPos >= length)
+    {
+      const char* p = fCurrent->fData + fPos;
+      fPos += length;
+      *got = length;
+      return p;
+    }
+
+  if (fSpill.size() < length)
+    fSpill.resize(length);
+  while (*got < length)
+    {
+      if (fCurrent == NULL || fPos == fCurrent->fSize)
+        {
+          if (fCurrent)
+            fFree.Push(fCurrent);
+          fCurrent = NULL;
+          fPos = 0;
+          if (!fFull.Pop(fCurrent))
+            {
+              fCurrent = NULL;
+              return NULL;
+            }
+          if (*got == 0 && fCurrent->fSize >= length)
+            return Fetch(length, got);
+        }
+      size_t n = fCurrent->fSize - fPos;
+      if (n > length - *got)
+        n = length - *got;
+      memcpy(&fSpill[*got], fCurrent->fData + fPos, n);
+      fPos += n;
+      *got += n;
+    }
+  return &fSpill[0];
+}
+
+/// Compresses the output in parallel, in blocks written as separate gzip members
+///
+/// Output is collected in blocks of kBlockSize bytes. Each full block is
+/// deflated into a complete gzip member by one of the compressor threads, and
+/// the members are written out by the calling thread in their original order.
+/// Concatenated gzip members are a valid gzip file, which zlib (and the
+/// read-ahead thread above) reads as one stream. At most two blocks per
+/// compressor are in flight, so the memory used is bounded; Write() waits for
+/// the oldest one when all are.
+
+class TMidasFileWriteBehind
+{
+public:
+  TMidasFileWriteBehind(int fd, int level, int threads); ///< start the compressor threads
+  ~TMidasFileWriteBehind(); ///< Finish(), then free the blocks
+
+  bool Init(); ///< start the threads, false on error
+  bool Write(const char* data, size_t length); ///< append "length" bytes to the output
+  bool Finish(); ///< compress and write all output, stop the threads
+
+  int         GetErrno() const { return fErrno; }         ///< errno from the last i/o error
+  const std::string& GetError() const { return fError; } ///< text of the last error
+
+private:
+  struct Block
+  {
+    std::vector<char> fIn;  ///< uncompressed data, kBlockSize allocated
+    size_t            fSize; ///< bytes of fIn used
+    std::vector<char> fOut; ///< the gzip member
+    bool              fDone; ///< fOut is complete
+    bool              fFailed; ///< deflate() failed
+  };
+
+  /// Compressor thread, deflating the blocks taken from fTodo
+  class Compressor : public dragon::utils::Thread
+  {
+  public:
+    Compressor(TMidasFileWriteBehind* parent): fParent(parent) { }
+  protected:
+    void Run() { fParent->Compress(); }
+  private:
+    TMidasFileWriteBehind* fParent;
+  };
+
+  static const size_t kBlockSize = 4*1024*1024;
+
+  void Compress(); ///< compressor thread body
+  bool Deflate(Block* block); ///< compress one block into its gzip member
+  bool Submit(); ///< hand the current block to the compressors
+  bool WriteDone(bool wait); ///< write the finished blocks at the front of fPending
+  void SetError(int err, const std::string& text) { fErrno = err; fError = text; }
+
+  int      fFd;
+  int      fLevel;
+  std::vector<Compressor*> fThreads;
+  dragon::utils::BoundedQueue<Block*> fTodo; ///< blocks to compress
+  std::deque<Block*>  fPending; ///< blocks submitted and not yet written, in order
+  std::vector<Block*> fFree;    ///< blocks to reuse
+  Block*   fCurrent;            ///< block being filled
+  size_t   fMaxPending;
+
+  dragon::utils::Mutex     fMutex; ///< guards Block::fDone
+  dragon::utils::Condition fDone;  ///< signalled when a block is done
+
+  bool        fFinished;
+  int         fErrno;
+  std::string fError;
+};
+
+const size_t TMidasFileWriteBehind::kBlockSize;
+
+TMidasFileWriteBehind::TMidasFileWriteBehind(int fd, int level, int threads):
+  fFd(fd), fLevel(level), fThreads(threads > 0 ? threads : 1, (Compressor*)NULL),
+  fTodo(2*fThreads.size()), fCurrent(NULL), fMaxPending(2*fThreads.size()),
+  fFinished(false), fErrno(0)
+{
+}
+
+TMidasFileWriteBehind::~TMidasFileWriteBehind()
+{
+  Finish();
+  for (size_t i=0; i<fFree.size(); i++)
+    delete fFree[i];
+  delete fCurrent;
+}
+
+bool TMidasFileWriteBehind::Init()
+{
+  for (size_t i=0; i<fThreads.size(); i++)
+    {
+      fThreads[i] = new Compressor(this);
+      if (!fThreads[i]->Start())
+        {
+          SetError(-1, "Cannot start compressor thread");
+          return false;
+        }
+    }
+  return true;
+}
+
+bool TMidasFileWriteBehind::Write(const char* data, size_t length)
+{
+  while (length > 0)
+    {
+      if (fErrno)
+        return false;
+      if (fCurrent == NULL)
+        {
+          if (fFree.empty())
+            {
+              fCurrent = new Block;
+              fCurrent->fIn.resize(kBlockSize);
+            }
+          else
+            {
+              fCurrent = fFree.back();
+              fFree.pop_back();
+            }
+          fCurrent->fSize = 0;
+          fCurrent->fDone = false;
+          fCurrent->fFailed = false;
+        }
+      size_t n = std::min(length, kBlockSize - fCurrent->fSize);
+      memcpy(&fCurrent->fIn[fCurrent->fSize], data, n);
+      fCurrent->fSize += n;
+      data += n;
+      length -= n;
+      if (fCurrent->fSize == kBlockSize && !Submit())
+        return false;
+    }
+  return fErrno == 0;
+}
+
+bool TMidasFileWriteBehind::Submit()
+{
+  Block* block = fCurrent;
+  fCurrent = NULL;
+  fPending.push_back(block);
+  fTodo.Push(block);
+  // write what is done already, waiting only if all blocks are in flight
+  return WriteDone(false) && (fPending.size() < fMaxPending || WriteDone(true));
+}
+
+bool TMidasFileWriteBehind::WriteDone(bool wait)
+{
+  /// \param [in] wait Wait for (and write) at least the front block
+
+  while (!fPending.empty())
+    {
+      Block* block = fPending.front();
+      {
+        dragon::utils::ScopedLock lock(fMutex);
+        while (wait && !block->fDone)
+          fDone.Wait(fMutex);
+        if (!block->fDone)
+          return true;
+      }
+      wait = false;
+      fPending.pop_front();
+      fFree.push_back(block);
+      if (block->fFailed)
+        {
+          SetError(-1, "zlib deflate() error");
+          return false;
+        }
+      size_t pos = 0;
+      while (pos < block->fOut.size())
+        {
+          ssize_t wr = ::write(fFd, &block->fOut[pos], block->fOut.size() - pos);
+          if (wr < 0 && errno == EINTR)
+            continue;
+          if (wr <= 0)
+            {
+              SetError(errno, strerror(errno));
+              return false;
+            }
+          pos += wr;
+        }
+    }
+  return true;
+}
+
+void TMidasFileWriteBehind::Compress()
+{
+  Block* block;
+  while (fTodo.Pop(block))
+    {
+      bool success = Deflate(block);
+      dragon::utils::ScopedLock lock(fMutex);
+      block->fFailed = !success;
+      block->fDone = true;
+      fDone.Broadcast();
+    }
+}
+
+bool TMidasFileWriteBehind::Deflate(Block* block)
+{
+#ifdef HAVE_ZLIB
+  z_stream strm;
+  memset(&strm, 0, sizeof(strm));
+  if (deflateInit2(&strm, fLevel, Z_DEFLATED, 31, 8, Z_DEFAULT_STRATEGY) != Z_OK) // 31: gzip header
+    return false;
+  block->fOut.resize(deflateBound(&strm, block->fSize) + 32);
+  strm.next_in = (Bytef*)&block->fIn[0];
+  strm.avail_in = block->fSize;
+  strm.next_out = (Bytef*)&block->fOut[0];
+  strm.avail_out = block->fOut.size();
+  int ret = deflate(&strm, Z_FINISH);
+  block->fOut.resize(strm.total_out);
+  deflateEnd(&strm);
+  return ret == Z_STREAM_END;
+#else
+  assert(!"Cannot get here");
+  return false;
+#endif
+}
+
+bool TMidasFileWriteBehind::Finish()
+{
+  if (fFinished)
+    return fErrno == 0;
+  fFinished = true;
+  if (fCurrent && fCurrent->fSize > 0 && fErrno == 0)
+    Submit();
+  // write out everything still in flight, then stop the threads
+  while (!fPending.empty() && WriteDone(true))
+    ;
+  fTodo.Close();
+  for (size_t i=0; i<fThreads.size(); i++)
+    {
+      if (fThreads[i])
+        fThreads[i]->Join();
+      delete fThreads[i];
+    }
+  fThreads.clear();
+  for (size_t i=0; i<fPending.size(); i++) // left after an error
+    fFree.push_back(fPending[i]);
+  fPending.clear();
+  return fErrno == 0;
+}
+
 TMidasFile::TMidasFile()
 {
   uint32_t endian = 0x12345678;
@@ -28,6 +734,17 @@ TMidasFile::TMidasFile()
 
   fOutFile = -1;
   fOutGzFile = NULL;
+  fWriteBehind = NULL;
+
+  fMap = NULL;
+  fMapSize = 0;
+  fMapPos = 0;
+  fReadAhead = NULL;
+
+  fStreamPos = 0;
+  fEventNumber = 0;
+  fAccessSpan = 0;
+  fIndex = NULL;
 
   fDoByteSwap = *(char*)(&endian) != 0x78;
 }
@@ -54,8 +771,8 @@ bool TMidasFile::Open(const char *filename)
   /// Remote files can be accessed using these special file names:
   /// - pipein://command - read data produced by given command, see examples below
   /// - ssh://username\@hostname/path/file.mid - read remote file through an ssh pipe
-  /// - ssh://username\@hostname/path/file.mid.gz and file.mid.bz2 - same for compressed files
-  /// - dccp://path/file.mid (also file.mid.gz and file.mid.bz2) - read data from dcache, requires dccp in the PATH
+  /// - ssh://username\@hostname/path/file.mid.gz, file.mid.bz2 and file.mid.lz4 - same for compressed files
+  /// - dccp://path/file.mid (also file.mid.gz, file.mid.bz2 and file.mid.lz4) - read data from dcache, requires dccp in the PATH
   ///
   /// Examples:
   /// - ./event_dump.exe /ladd/data9/t2km11/data/run02696.mid.gz - read normal compressed file
@@ -64,10 +781,14 @@ bool TMidasFile::Open(const char *filename)
   /// - ./event_dump.exe pipein://"gzip -dc /ladd/data9/t2km11/data/run02696.mid.gz" - another way to read compressed files
   /// - ./event_dump.exe dccp:///pnfs/triumf.ca/data/t2km11/aug2008/run02837.mid.gz - read file directly from a dcache pool (note triple "/")
   ///
+  /// Local uncompressed files are memory mapped. Local .gz files (and .bz2 or .lz4 files,
+  /// if compiled with HAVE_BZIP2 or HAVE_LZ4) are decompressed in-process, and all other
+  /// input through a pipe; either way, by a read-ahead thread.
+  ///
   /// \param [in] filename The file to open.
   /// \returns "true" for succes, "false" for error, use GetLastError() to see why
 
-  if (fFile > 0)
+  if (fFile > 0 || fMap || fReadAhead)
     Close();
 
   fFilename = filename;
@@ -106,6 +827,8 @@ bool TMidasFile::Open(const char *filename)
         pipe += " | gzip -dc";
       else if (hasSuffix(remoteFile,".bz2"))
         pipe += " | bzip2 -dc";
+      else if (hasSuffix(remoteFile,".lz4"))
+        pipe += " | lz4 -dc";
     }
   else if (strncmp(filename, "dccp://", 7) == 0)
     {
@@ -119,6 +842,8 @@ bool TMidasFile::Open(const char *filename)
         pipe += " | gzip -dc";
       else if (hasSuffix(filename,".bz2"))
         pipe += " | bzip2 -dc";
+      else if (hasSuffix(filename,".lz4"))
+        pipe += " | lz4 -dc";
     }
   else if (strncmp(filename, "pipein://", 9) == 0)
     {
@@ -131,11 +856,20 @@ bool TMidasFile::Open(const char *filename)
       pipe += filename;
     }
 #endif
+#ifndef HAVE_BZIP2
   else if (hasSuffix(filename, ".bz2"))
     {
       pipe = "bzip2 -dc ";
       pipe += filename;
     }
+#endif
+#ifndef HAVE_LZ4
+  else if (hasSuffix(filename, ".lz4"))
+    {
+      pipe = "lz4 -dc ";
+      pipe += filename;
+    }
+#endif
 
   if (pipe.length() > 0)
     {
@@ -151,6 +885,7 @@ bool TMidasFile::Open(const char *filename)
         }
 
       fFile = fileno((FILE*)fPoFile);
+      return StartReadAhead(TMidasFileReadAhead::kFd);
     }
   else
     {
@@ -171,32 +906,73 @@ bool TMidasFile::Open(const char *filename)
         {
           // this is a compressed file
 #ifdef HAVE_ZLIB
-          fGzFile = new gzFile;
-          (*(gzFile*)fGzFile) = gzdopen(fFile,"rb");
-          if ((*(gzFile*)fGzFile) == NULL)
-            {
-              fLastErrno = -1;
-              fLastError = "zlib gzdopen() error";
-              return false;
-            }
+          return StartReadAhead(TMidasFileReadAhead::kInflate);
 #else
           fLastErrno = -1;
           fLastError = "Do not know how to read compressed MIDAS files";
           return false;
 #endif
         }
+#ifdef HAVE_BZIP2
+      if (hasSuffix(filename, ".bz2"))
+        return StartReadAhead(TMidasFileReadAhead::kBz2);
+#endif
+#ifdef HAVE_LZ4
+      if (hasSuffix(filename, ".lz4"))
+        return StartReadAhead(TMidasFileReadAhead::kLz4);
+#endif
+
+      // uncompressed file: map it, or if that fails read it in the background
+      struct stat st;
+      if (fstat(fFile, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0)
+        {
+          // private writable mapping, since TMidasEvent::SwapBytes() swaps in place
+          void* map = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fFile, 0);
+          if (map != MAP_FAILED)
+            {
+              madvise(map, st.st_size, MADV_SEQUENTIAL);
+              fMap = (char*)map;
+              fMapSize = st.st_size;
+              fMapPos = 0;
+              return true;
+            }
+        }
+      return StartReadAhead(TMidasFileReadAhead::kFd);
     }
 
   return true;
 }
 
-bool TMidasFile::OutOpen(const char *filename)
+bool TMidasFile::StartReadAhead(int source, const TMidasFileIndex::AccessPoint_t* start)
+{
+  /// \param [in] source Type of input (TMidasFileReadAhead::Source_t)
+  /// \param [in] start Access point to restart decompression from, NULL for the beginning
+  /// \returns "true" if the read-ahead thread is running
+
+  fReadAhead = new TMidasFileReadAhead((TMidasFileReadAhead::Source_t)source, fFile);
+  if (source == TMidasFileReadAhead::kInflate)
+    fReadAhead->RecordAccessPoints(fAccessSpan);
+  if (!fReadAhead->Init(start))
+    {
+      fLastErrno = fReadAhead->GetErrno();
+      fLastError = fReadAhead->GetError();
+      delete fReadAhead;
+      fReadAhead = NULL;
+      return false;
+    }
+  return true;
+}
+
+bool TMidasFile::OutOpen(const char *filename, int level, int threads)
 {
   /// Open a midas .mid file for OUTPUT with given file name.
   ///
   /// Remote files not yet implemented
   ///
-  /// \param [in] filename The file to open.
+  /// \param [in] filename The file to open; written gzip compressed if it ends in ".gz"
+  /// \param [in] level Compression level (1 = fastest, 9 = best)
+  /// \param [in] threads Number of compressor threads; with more than one, the output
+  ///  is compressed in parallel, in blocks (see TMidasFileWriteBehind)
   /// \returns "true" for succes, "false" for error, use GetLastError() to see why
 
   if (fOutFile > 0)
@@ -223,6 +999,18 @@ bool TMidasFile::OutOpen(const char *filename)
     {
       // this is a compressed file
 #ifdef HAVE_ZLIB
+      if (threads > 1)
+        {
+          fWriteBehind = new TMidasFileWriteBehind(fOutFile, level, threads);
+          if (!fWriteBehind->Init())
+            {
+              fLastErrno = -1;
+              fLastError = fWriteBehind->GetError();
+              OutClose();
+              return false;
+            }
+          return true;
+        }
       fOutGzFile = new gzFile;
       *(gzFile*)fOutGzFile = gzdopen(fOutFile,"wb");
       if ((*(gzFile*)fOutGzFile) == NULL)
@@ -234,7 +1022,7 @@ bool TMidasFile::OutOpen(const char *filename)
       printf("Opened gz file successfully\n");
       if (1) 
 	{
-	  if (gzsetparams(*(gzFile*)fOutGzFile, 1, Z_DEFAULT_STRATEGY) != Z_OK) {
+	  if (gzsetparams(*(gzFile*)fOutGzFile, level, Z_DEFAULT_STRATEGY) != Z_OK) {
 	    printf("Cannot set gzparams\n");
 	    fLastErrno = -1;
 	    fLastError = "zlib gzsetparams() error";
@@ -252,127 +1040,484 @@ bool TMidasFile::OutOpen(const char *filename)
 }
 
 
-static int readpipe(int fd, char* buf, int length)
+const char* TMidasFile::Fetch(size_t length)
 {
-  int count = 0;
-  while (length > 0)
+  /// \returns pointer to the next "length" bytes of input, valid until the next
+  /// call to Read() or ReadView(); NULL at the end of input or on error, see GetLastError()
+
+  const char* p = NULL;
+  size_t got = 0;
+
+  if (fMap)
     {
-      int rd = read(fd, buf, length);
-      if (rd > 0)
+      // an incomplete read is not consumed, the rest may be appended later (see Follow())
+      if (fMapSize - fMapPos < length)
         {
-          buf += rd;
-          length -= rd;
-          count += rd;
+          fLastErrno = 0;
+          fLastError = (fMapPos == fMapSize) ? "EOF" : "Unexpected end of file";
+          return NULL;
         }
-      else if (rd == 0)
-        {
-          return count;
-        }
-      else
+      p = fMap + fMapPos;
+      got = length;
+      fMapPos += got;
+    }
+  else if (fReadAhead)
+    {
+      p = fReadAhead->Fetch(length, &got);
+      if (p == NULL && fReadAhead->GetErrno() != 0)
         {
-          return -1;
+          fLastErrno = fReadAhead->GetErrno();
+          fLastError = fReadAhead->GetError();
+          fStreamPos += got;
+          return NULL;
         }
     }
-  return count;
+  else
+    {
+      fLastErrno = -1;
+      fLastError = "File is not open";
+      return NULL;
+    }
+
+  if (p == NULL)
+    {
+      fLastErrno = 0;
+      fLastError = (got == 0) ? "EOF" : "Unexpected end of file";
+    }
+  fStreamPos += got;
+  return p;
 }
 
-bool TMidasFile::Read(TMidasEvent *midasEvent)
+bool TMidasFile::ReadHeader(TMidasEvent *midasEvent)
 {
-  /// \param [in] midasEvent Pointer to an empty TMidasEvent 
-  /// \returns "true" for success, "false" for failure, see GetLastError() to see why
-
   midasEvent->Clear();
 
-  int rd = 0;
+  const char* header = Fetch(sizeof(TMidas_EVENT_HEADER));
+  if (header == NULL)
+    return false;
 
-  if (fGzFile)
-#ifdef HAVE_ZLIB
-    rd = gzread(*(gzFile*)fGzFile, (char*)midasEvent->GetEventHeader(), sizeof(TMidas_EVENT_HEADER));
-#else
-    assert(!"Cannot get here");
-#endif
-  else
-    rd = readpipe(fFile, (char*)midasEvent->GetEventHeader(), sizeof(TMidas_EVENT_HEADER));
+  memcpy(midasEvent->GetEventHeader(), header, sizeof(TMidas_EVENT_HEADER));
 
-  if (rd == 0)
+  if (fDoByteSwap)
+    midasEvent->SwapBytesEventHeader();
+
+  if (!midasEvent->IsGoodSize())
     {
-      fLastErrno = 0;
-      fLastError = "EOF";
+      fLastErrno = -1;
+      fLastError = "Invalid event size";
       return false;
     }
-  else if (rd != sizeof(TMidas_EVENT_HEADER))
+
+  fEventNumber++;
+  return true;
+}
+
+void TMidasFile::UnreadHeader()
+{
+  /// After an incomplete event at the end of a memory mapped file, go back to
+  /// its header, so that it is read again once complete (see Follow()).
+
+  if (fMap == NULL || fLastErrno != 0)
+    return;
+  fMapPos -= sizeof(TMidas_EVENT_HEADER);
+  fStreamPos -= sizeof(TMidas_EVENT_HEADER);
+  fEventNumber--;
+}
+
+bool TMidasFile::Follow()
+{
+  /// For reading a file while it is being written (e.g. the current run): a memory
+  /// mapped (local, uncompressed) file is mapped again if it has grown, so that
+  /// Read() and ReadView() continue with the data appended since it was opened or
+  /// last followed. Events only partially written are read once they are complete.
+  /// Data of events read before with ReadView() are no longer valid.
+  ///
+  /// \returns "true" if there is new data, "false" if not or if the file is not memory mapped
+
+  if (fMap == NULL || fFile <= 0)
+    return false;
+
+  struct stat st;
+  if (fstat(fFile, &st) != 0 || (uint64_t)st.st_size <= fMapSize)
+    return false;
+
+  void* map = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fFile, 0);
+  if (map == MAP_FAILED)
     {
       fLastErrno = errno;
       fLastError = strerror(errno);
       return false;
     }
+  munmap(fMap, fMapSize);
+  madvise(map, st.st_size, MADV_SEQUENTIAL);
+  fMap = (char*)map;
+  fMapSize = st.st_size;
+  return true;
+}
 
-  if (fDoByteSwap)
-    midasEvent->SwapBytesEventHeader();
+bool TMidasFile::Read(TMidasEvent *midasEvent)
+{
+  /// \param [in] midasEvent Pointer to an empty TMidasEvent 
+  /// \returns "true" for success, "false" for failure, see GetLastError() to see why
 
-  if (!midasEvent->IsGoodSize())
+  dragon::utils::ProfileScope profile(dragon::utils::Profile::kFileRead);
+  if (!ReadHeader(midasEvent))
+    return false;
+
+  const char* data = Fetch(midasEvent->GetDataSize());
+  if (data == NULL)
+    {
+      UnreadHeader();
+      return false;
+    }
+
+  memcpy(midasEvent->GetData(), data, midasEvent->GetDataSize());
+
+  midasEvent->SwapBytes(false);
+
+  return true;
+}
+
+bool TMidasFile::ReadView(TMidasEvent *midasEvent)
+{
+  /// Same as Read(), except that the event data are not copied: the event is set
+  /// to point into the memory map or the read-ahead buffers. The data are only valid
+  /// until the next call to Read(), ReadView() or Close(), so this is for events that
+  /// are processed straight away.
+  ///
+  /// \param [in] midasEvent Pointer to an empty TMidasEvent 
+  /// \returns "true" for success, "false" for failure, see GetLastError() to see why
+
+  dragon::utils::ProfileScope profile(dragon::utils::Profile::kFileRead);
+  if (!ReadHeader(midasEvent))
+    return false;
+
+  const char* data = Fetch(midasEvent->GetDataSize());
+  if (data == NULL)
+    {
+      UnreadHeader();
+      return false;
+    }
+
+  midasEvent->SetData(midasEvent->GetDataSize(), const_cast<char*>(data)); // also swaps bytes
+
+  return true;
+}
+
+bool TMidasFile::SeekStream(uint64_t offset)
+{
+  /// Memory mapped files are positioned directly, and gzip files restart
+  /// decompression from the closest access point in the index. Otherwise the
+  /// input is read (from the beginning, if "offset" is behind the current
+  /// position) up to "offset".
+  ///
+  /// \param [in] offset Byte offset in the uncompressed stream
+  /// \returns "true" for success, "false" for error, use GetLastError() to see why
+
+  if (fMap)
+    {
+      if (offset > fMapSize)
+        {
+          fLastErrno = -1;
+          fLastError = "Seek beyond the end of file";
+          return false;
+        }
+      fMapPos = offset;
+      fStreamPos = offset;
+      return true;
+    }
+
+  if (fReadAhead == NULL)
     {
       fLastErrno = -1;
-      fLastError = "Invalid event size";
+      fLastError = "File is not open";
       return false;
     }
 
-  if (fGzFile)
-#ifdef HAVE_ZLIB
-    rd = gzread(*(gzFile*)fGzFile, midasEvent->GetData(), midasEvent->GetDataSize());
-#else
-    assert(!"Cannot get here");
-#endif
-  else
-    rd = readpipe(fFile, midasEvent->GetData(), midasEvent->GetDataSize());
+  static const uint64_t kMaxSkip = 16*1024*1024; // restart rather than skip more than this
+  const TMidasFileIndex::AccessPoint_t* point = NULL;
+  if (fIndex && fReadAhead->GetSource() == TMidasFileReadAhead::kInflate)
+    point = fIndex->FindAccessPoint(offset);
 
-  if (rd != (int)midasEvent->GetDataSize())
+  if (point && (offset < fStreamPos || (offset - fStreamPos > kMaxSkip && point->fOut > fStreamPos)))
     {
-      fLastErrno = errno;
-      fLastError = strerror(errno);
+      delete fReadAhead;
+      fReadAhead = NULL;
+      if (!StartReadAhead(TMidasFileReadAhead::kInflate, point))
+        return false;
+      fStreamPos = point->fOut;
+    }
+  else if (offset < fStreamPos)
+    {
+      // re-open, keeping the index
+      TMidasFileIndex* index = fIndex;
+      fIndex = NULL;
+      std::string filename = fFilename;
+      Close();
+      bool opened = Open(filename.c_str());
+      fIndex = index;
+      if (!opened)
+        return false;
+    }
+
+  while (fStreamPos < offset)
+    {
+      uint64_t n = std::min(offset - fStreamPos, (uint64_t)1024*1024);
+      if (Fetch(n) == NULL)
+        return false;
+    }
+  return true;
+}
+
+bool TMidasFile::SeekEvent(size_t number)
+{
+  /// Needs an index, see LoadIndex().
+  ///
+  /// \param [in] number Event number, counting from 0 at the start of the file
+  /// \returns "true" for success, "false" for error, use GetLastError() to see why
+
+  if (fIndex == NULL)
+    {
+      fLastErrno = -1;
+      fLastError = "No index loaded";
       return false;
     }
+  if (number >= fIndex->GetNumEvents())
+    {
+      fLastErrno = -1;
+      fLastError = "Event number beyond the end of the index";
+      return false;
+    }
+  if (number == fEventNumber)
+    return true;
 
-  midasEvent->SwapBytes(false);
+  // go to the closest indexed event, unless already between it and "number"
+  size_t first = number - number % fIndex->GetEvery();
+  if (fEventNumber < first || fEventNumber > number)
+    {
+      if (!SeekStream(fIndex->GetOffset(number)))
+        return false;
+      fEventNumber = first;
+    }
 
+  TMidasEvent event;
+  while (fEventNumber < number)
+    if (!ReadView(&event))
+      return false;
   return true;
 }
 
-bool TMidasFile::Write(TMidasEvent *midasEvent)
+bool TMidasFile::Seek(uint32_t serial, int eventId)
 {
-  int wr = -2;
+  /// \param [in] serial Serial number of the event
+  /// \param [in] eventId Id of the event, -1 for any
+  /// \returns "true" for success, "false" if there is no index or no such event
 
-  if (fOutGzFile)
-#ifdef HAVE_ZLIB
-    wr = gzwrite(*(gzFile*)fOutGzFile, (char*)midasEvent->GetEventHeader(), sizeof(TMidas_EVENT_HEADER));
-#else
-    assert(!"Cannot get here");
-#endif
-  else
-    wr = write(fOutFile, (char*)midasEvent->GetEventHeader(), sizeof(TMidas_EVENT_HEADER));
+  if (fIndex == NULL)
+    {
+      fLastErrno = -1;
+      fLastError = "No index loaded";
+      return false;
+    }
+  long number = fIndex->FindSerial(serial, eventId);
+  if (number < 0)
+    {
+      fLastErrno = -1;
+      fLastError = "Serial number not found in the index";
+      return false;
+    }
+  return SeekEvent(number);
+}
 
-  if(wr !=  sizeof(TMidas_EVENT_HEADER)){
-    printf("TMidasFile: error on write event header, return %i, size requested %lu\n",wr,sizeof(TMidas_EVENT_HEADER));
-    return false;
-  }
+bool TMidasFile::SeekTime(double time)
+{
+  /// Positions at the first event in the file with a trigger time (as given by
+  /// the index TimeFunction_t) at or after "time". Events read from there on
+  /// can still be earlier than "time", see TMidasFileIndex::FindTime().
+  ///
+  /// \param [in] time Trigger time
+  /// \returns "true" for success, "false" if there is no index or no such event
+
+  if (fIndex == NULL)
+    {
+      fLastErrno = -1;
+      fLastError = "No index loaded";
+      return false;
+    }
+  long number = fIndex->FindTime(time);
+  if (number < 0)
+    {
+      fLastErrno = -1;
+      fLastError = "No event at or after the requested time";
+      return false;
+    }
+  return SeekEvent(number);
+}
+
+bool TMidasFile::LoadIndex(bool build, TMidasFileIndex::TimeFunction_t time, uint32_t every)
+{
+  /// Reads the sidecar index file (TMidasFileIndex::GetPath()) of the open file,
+  /// if there is one and it is up to date.
+  ///
+  /// \param [in] build If there is no valid index file, build one with BuildIndex()
+  /// \param [in] time, every Arguments of BuildIndex()
+  /// \returns "true" if an index was loaded or built
+
+  struct stat st;
+  if (stat(fFilename.c_str(), &st) == 0)
+    {
+      TMidasFileIndex* index = new TMidasFileIndex();
+      if (index->Read(TMidasFileIndex::GetPath(fFilename.c_str()).c_str(), st.st_size, st.st_mtime))
+        {
+          delete fIndex;
+          fIndex = index;
+          return true;
+        }
+      delete index;
+    }
+
+  if (build)
+    return BuildIndex(time, every);
+
+  fLastErrno = -1;
+  fLastError = "No valid index file";
+  return false;
+}
+
+bool TMidasFile::BuildIndex(TMidasFileIndex::TimeFunction_t time, uint32_t every)
+{
+  /// Reads the whole file (independently of the current read position) to build
+  /// the index, then saves it as a sidecar file if the file is local and the
+  /// directory writable.
+  ///
+  /// \param [in] time Function returning the trigger time of an event, NULL to not
+  ///  store trigger times
+  /// \param [in] every Store the offset of every "every" events
+  /// \returns "true" for success, "false" if the file cannot be read
+
+  TMidasFile file;
+  file.fAccessSpan = 4*1024*1024;
+  if (!file.Open(fFilename.c_str()))
+    {
+      fLastErrno = file.GetLastErrno();
+      fLastError = file.GetLastError();
+      return false;
+    }
+
+  TMidasFileIndex* index = new TMidasFileIndex(every);
+  TMidasEvent event;
+  while (1)
+    {
+      uint64_t offset = file.fStreamPos;
+      if (!file.ReadView(&event))
+        break;
+      index->AddEvent(event, offset, time ? time(event) : -1);
+    }
+
+  if (file.fReadAhead)
+    {
+      file.fReadAhead->Stop();
+      index->SetAccessPoints(file.fReadAhead->GetAccessPoints());
+    }
+
+  if (file.GetLastErrno() != 0)
+    {
+      fLastErrno = file.GetLastErrno();
+      fLastError = file.GetLastError();
+      delete index;
+      return false;
+    }
 
-  printf("Written event header to outfile , return is %i\n",wr);
+  struct stat st;
+  if (stat(fFilename.c_str(), &st) == 0)
+    {
+      index->fFileSize = st.st_size;
+      index->fFileTime = st.st_mtime;
+      std::string path = TMidasFileIndex::GetPath(fFilename.c_str());
+      if (!index->Write(path.c_str()))
+        fprintf(stderr, "TMidasFile::BuildIndex: Cannot write index file %s\n", path.c_str());
+    }
+
+  delete fIndex;
+  fIndex = index;
+  return true;
+}
+
+bool TMidasFile::Write(const TMidasEvent *midasEvent)
+{
+  if (!WriteBytes(midasEvent->GetEventHeader(), sizeof(TMidas_EVENT_HEADER)))
+    {
+      printf("TMidasFile: error on write event header: %s\n", fLastError.c_str());
+      return false;
+    }
+  if (!WriteBytes(midasEvent->GetData(), midasEvent->GetDataSize()))
+    {
+      printf("TMidasFile: error on write event data: %s\n", fLastError.c_str());
+      return false;
+    }
+  return true;
+}
+
+bool TMidasFile::WriteBytes(const void* data, size_t length)
+{
+  /// \returns false on error (or if no output file is open), see GetLastError()
+
+  if (fWriteBehind)
+    {
+      if (fWriteBehind->Write((const char*)data, length))
+        return true;
+      fLastErrno = fWriteBehind->GetErrno();
+      fLastError = fWriteBehind->GetError();
+      return false;
+    }
 
   if (fOutGzFile)
+    {
 #ifdef HAVE_ZLIB
-    wr = gzwrite(*(gzFile*)fOutGzFile, (char*)midasEvent->GetData(), midasEvent->GetDataSize());
+      if (length == 0 || gzwrite(*(gzFile*)fOutGzFile, data, length) == (int)length)
+        return true;
+      fLastErrno = -1;
+      fLastError = "zlib gzwrite() error";
+      return false;
 #else
-    assert(!"Cannot get here");
+      assert(!"Cannot get here");
 #endif
-  else
-    wr = write(fOutFile, (char*)midasEvent->GetData(), midasEvent->GetDataSize());
-  printf("Written event to outfile , return is %d\n",wr);
+    }
 
-  return wr;
+  const char* p = (const char*)data;
+  while (length > 0)
+    {
+      ssize_t wr = write(fOutFile, p, length);
+      if (wr < 0 && errno == EINTR)
+        continue;
+      if (wr <= 0)
+        {
+          fLastErrno = errno;
+          fLastError = wr < 0 ? strerror(errno) : "write() error";
+          return false;
+        }
+      p += wr;
+      length -= wr;
+    }
+  return true;
 }
 
 void TMidasFile::Close()
 {
+  // stop the read-ahead thread before closing what it reads from
+  if (fReadAhead)
+    delete fReadAhead;
+  fReadAhead = NULL;
+  if (fIndex)
+    delete fIndex;
+  fIndex = NULL;
+  fStreamPos = 0;
+  fEventNumber = 0;
+  if (fMap)
+    munmap(fMap, fMapSize);
+  fMap = NULL;
+  fMapSize = 0;
+  fMapPos = 0;
   if (fPoFile)
     pclose((FILE*)fPoFile);
   fPoFile = NULL;
@@ -387,19 +1532,45 @@ void TMidasFile::Close()
   fFilename = "";
 }
 
-void TMidasFile::OutClose()
+bool TMidasFile::OutClose()
 {
+  /// \returns false if writing the last of the output failed, see GetLastError()
+
+  bool success = true;
+  if (fWriteBehind)
+    {
+      success = fWriteBehind->Finish();
+      if (!success)
+        {
+          fLastErrno = fWriteBehind->GetErrno();
+          fLastError = fWriteBehind->GetError();
+        }
+      delete fWriteBehind;
+    }
+  fWriteBehind = NULL;
 #ifdef HAVE_ZLIB
   if (fOutGzFile) {
     gzflush(*(gzFile*)fOutGzFile, Z_FULL_FLUSH);
-    gzclose(*(gzFile*)fOutGzFile);
+    if (gzclose(*(gzFile*)fOutGzFile) != Z_OK && success)
+      {
+        fLastErrno = -1;
+        fLastError = "zlib gzclose() error";
+        success = false;
+      }
+    delete (gzFile*)fOutGzFile;
+    fOutFile = -1; // closed by gzclose()
   }
   fOutGzFile = NULL;
 #endif
-  if (fOutFile > 0)
-    close(fOutFile);
+  if (fOutFile > 0 && close(fOutFile) != 0 && success)
+    {
+      fLastErrno = errno;
+      fLastError = strerror(errno);
+      success = false;
+    }
   fOutFile = -1;
   fOutFilename = "";
+  return success;
 }
 
 // end
@@ -6,10 +6,23 @@
 #define TMIDASFILE_H
 
 #include <string>
+#include <stddef.h>
+#include "TMidasFileIndex.h"
 
 class TMidasEvent;
+class TMidasFileReadAhead;
+class TMidasFileWriteBehind;
 
 /// Reader for MIDAS .mid files
+///
+/// Uncompressed files are memory mapped and read sequentially straight out of the
+/// mapping. Everything else (compressed files and pipes) is read, and if necessary
+/// decompressed, by a read-ahead thread into a ring of large buffers, in parallel with
+/// the caller's processing of the events.
+///
+/// With an index (see LoadIndex() and TMidasFileIndex), the file can also be
+/// positioned at any event with SeekEvent(), Seek() or SeekTime(). Files being
+/// written can be followed as they grow, see Follow().
 
 class TMidasFile
 {
@@ -18,13 +31,25 @@ public:
   ~TMidasFile(); ///< destructor
 
   bool Open(const char* filename); ///< Open input file
-  bool OutOpen(const char* filename); ///< Open output file
+  bool OutOpen(const char* filename, int level = 1, int threads = 1); ///< Open output file
 
   void Close(); ///< Close input file
-  void OutClose(); ///< Close output file
+  bool OutClose(); ///< Close output file, false if writing failed
 
   bool Read(TMidasEvent *event); ///< Read one event from the file
-  bool Write(TMidasEvent *event); ///< Write one event to the output file
+  bool ReadView(TMidasEvent *event); ///< Read one event without copying its data
+  bool Follow(); ///< Continue reading a file that has grown since it was opened
+  bool CanFollow() const { return fMap != NULL; } ///< Check if the file can be followed (is memory mapped)
+
+  bool LoadIndex(bool build = true, TMidasFileIndex::TimeFunction_t time = NULL, uint32_t every = 1000); ///< Read (or build) the index
+  bool BuildIndex(TMidasFileIndex::TimeFunction_t time = NULL, uint32_t every = 1000); ///< Build the index and save it
+  const TMidasFileIndex* GetIndex() const { return fIndex; } ///< Get the index, NULL if not loaded
+
+  bool SeekEvent(size_t number); ///< Position at the given event number (0 = first event in the file)
+  bool Seek(uint32_t serial, int eventId = -1); ///< Position at the event with the given serial number
+  bool SeekTime(double time); ///< Position at the first event with trigger time at or after "time"
+  size_t GetEventNumber() const { return fEventNumber; } ///< Number of the next event to be read
+  bool Write(const TMidasEvent *event); ///< Write one event to the output file
 
   const char* GetFilename()  const { return fFilename.c_str();  } ///< Get the name of this file
   int         GetLastErrno() const { return fLastErrno; }         ///< Get error value for the last file error
@@ -32,6 +57,13 @@ public:
 
 protected:
 
+  bool StartReadAhead(int source, const TMidasFileIndex::AccessPoint_t* start = NULL); ///< Start the read-ahead thread
+  bool SeekStream(uint64_t offset); ///< Position at a byte offset in the uncompressed stream
+  bool ReadHeader(TMidasEvent *event); ///< Read and check the event header
+  void UnreadHeader(); ///< Go back to the header of an incomplete event
+  const char* Fetch(size_t length); ///< Get the next "length" bytes of the input stream
+  bool WriteBytes(const void* data, size_t length); ///< Append "length" bytes to the output
+
   std::string fFilename; ///< name of the currently open file
   std::string fOutFilename; ///< name of the currently open file
 
@@ -45,6 +77,18 @@ protected:
   void*       fPoFile; ///< popen() input file reader
   int         fOutFile; ///< open output file descriptor
   void*       fOutGzFile; ///< zlib compressed output file reader
+  TMidasFileWriteBehind* fWriteBehind; ///< parallel compressor, NULL if not used
+
+  char*       fMap;     ///< mmap()ed input file, NULL if not mapped
+  size_t      fMapSize; ///< length of fMap
+  size_t      fMapPos;  ///< read position in fMap
+
+  TMidasFileReadAhead* fReadAhead; ///< read-ahead thread, NULL if not used
+
+  uint64_t    fStreamPos;   ///< offset of the next byte in the uncompressed stream
+  size_t      fEventNumber; ///< number of the next event
+  uint64_t    fAccessSpan;  ///< spacing of gzip access points to record while reading, 0 for none
+  TMidasFileIndex* fIndex;  ///< event index, NULL if not loaded
 };
 
 #endif // TMidasFile.h
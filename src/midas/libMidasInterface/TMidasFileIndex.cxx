@@ -0,0 +1,272 @@
+//
+//  TMidasFileIndex.cxx.
+//
+
+#include <stdio.h>
+#include <string.h>
+
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+#include "TMidasFileIndex.h"
+#include "TMidasEvent.h"
+
+static const char kMagic[8] = { 'M', 'I', 'D', 'X', '0', '0', '0', '1' };
+
+TMidasFileIndex::TMidasFileIndex(uint32_t every)
+{
+  fEvery = every > 0 ? every : 1;
+  fFileSize = 0;
+  fFileTime = 0;
+}
+
+void TMidasFileIndex::Clear()
+{
+  fEntries.clear();
+  fOffsets.clear();
+  fPoints.clear();
+}
+
+std::string TMidasFileIndex::GetPath(const char* filename)
+{
+  return std::string(filename) + ".idx";
+}
+
+void TMidasFileIndex::AddEvent(const TMidasEvent& event, uint64_t offset, double time)
+{
+  /// \param [in] event The event
+  /// \param [in] offset Offset of the event header in the uncompressed stream
+  /// \param [in] time Trigger time of the event, negative if it does not have one
+
+  if (fEntries.size() % fEvery == 0)
+    fOffsets.push_back(offset);
+
+  Entry_t entry;
+  entry.fSerialNumber = event.GetSerialNumber();
+  entry.fEventId      = event.GetEventId();
+  entry.fTriggerMask  = event.GetTriggerMask();
+  entry.fTime         = time < 0 ? -1 : time;
+  fEntries.push_back(entry);
+}
+
+long TMidasFileIndex::FindSerial(uint32_t serial, int eventId) const
+{
+  /// \param [in] serial Serial number to look for
+  /// \param [in] eventId Event id to look for, -1 for any (serial numbers
+  ///  are only unique per event id)
+  /// \returns event number in the file, -1 if not found
+
+  for (size_t i=0; i<fEntries.size(); i++)
+    if (fEntries[i].fSerialNumber == serial && (eventId < 0 || fEntries[i].fEventId == eventId))
+      return i;
+  return -1;
+}
+
+long TMidasFileIndex::FindTime(double time) const
+{
+  /// Events are not stored in trigger time order (e.g. one event type is read out
+  /// with more latency than another), so events after the one returned can still
+  /// be earlier than "time"; none before it are later.
+  ///
+  /// \param [in] time Trigger time to look for
+  /// \returns number of the first event in the file with a trigger time >= "time",
+  ///  -1 if there is none
+
+  for (size_t i=0; i<fEntries.size(); i++)
+    if (fEntries[i].fTime >= 0 && fEntries[i].fTime >= time)
+      return i;
+  return -1;
+}
+
+long TMidasFileIndex::FindEvent(int eventId, size_t from) const
+{
+  /// \param [in] eventId Event id to look for
+  /// \param [in] from Event number to start from
+  /// \returns event number in the file, -1 if not found
+
+  for (size_t i=from; i<fEntries.size(); i++)
+    if (fEntries[i].fEventId == eventId)
+      return i;
+  return -1;
+}
+
+TMidasFileIndex::Chunk_t TMidasFileIndex::GetChunk(size_t chunk, size_t nchunks, double margin) const
+{
+  /// Splits the events into "nchunks" ranges of (nearly) equal numbers of events,
+  /// which can be processed independently, e.g. on different nodes. Chunk
+  /// "chunk" owns events [fBegin, fEnd). Events are not read in trigger time
+  /// order, and events at the edges of a chunk can belong together with events of
+  /// the neighbouring chunks, so [fFirst, fLast) extends the chunk by "margin"
+  /// in trigger time on either side: from the first event in the file at or after
+  /// the earliest trigger time in the chunk minus "margin", up to the first event
+  /// after the chunk with a trigger time later than the latest one in the chunk
+  /// plus "margin".
+  ///
+  /// \param [in] chunk Chunk number, 0 to nchunks - 1
+  /// \param [in] nchunks Number of chunks
+  /// \param [in] margin Overlap with the neighbouring chunks, in TimeFunction_t units
+  /// \returns the ranges of event numbers of the chunk
+
+  const size_t n = fEntries.size();
+  Chunk_t c;
+  c.fBegin = nchunks ? n * chunk / nchunks : 0;
+  c.fEnd   = nchunks ? n * (chunk + 1) / nchunks : n;
+  if (c.fEnd > n)
+    c.fEnd = n;
+  if (c.fBegin > c.fEnd)
+    c.fBegin = c.fEnd;
+  c.fFirst = c.fBegin;
+  c.fLast  = c.fEnd;
+
+  double lo = -1, hi = -1;
+  for (size_t i=c.fBegin; i<c.fEnd; i++)
+    {
+      const double t = fEntries[i].fTime;
+      if (t < 0)
+        continue;
+      if (lo < 0 || t < lo)
+        lo = t;
+      if (t > hi)
+        hi = t;
+    }
+  if (lo < 0)
+    return c; // nothing with a trigger time
+
+  long first = FindTime(lo - margin);
+  if (first >= 0 && size_t(first) < c.fFirst)
+    c.fFirst = first;
+  while (c.fLast < n && !(fEntries[c.fLast].fTime > hi + margin))
+    c.fLast++;
+  return c;
+}
+
+const TMidasFileIndex::AccessPoint_t* TMidasFileIndex::FindAccessPoint(uint64_t offset) const
+{
+  /// \returns the access point closest before (or at) "offset", NULL if there is none
+
+  size_t lo = 0, hi = fPoints.size();
+  while (lo < hi)
+    {
+      size_t mid = lo + (hi - lo) / 2;
+      if (fPoints[mid].fOut <= offset)
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+  return lo == 0 ? NULL : &fPoints[lo - 1];
+}
+
+template <class T>
+static bool put(FILE* fp, const T& value)
+{
+  return fwrite(&value, sizeof(T), 1, fp) == 1;
+}
+
+template <class T>
+static bool get(FILE* fp, T& value)
+{
+  return fread(&value, sizeof(T), 1, fp) == 1;
+}
+
+bool TMidasFileIndex::Write(const char* path) const
+{
+  /// \returns "true" for success, "false" if the file cannot be written
+
+  FILE* fp = fopen(path, "wb");
+  if (fp == NULL)
+    return false;
+
+  bool ok = fwrite(kMagic, sizeof(kMagic), 1, fp) == 1;
+  ok = ok && put(fp, fEvery) && put(fp, fFileSize) && put(fp, fFileTime);
+  ok = ok && put(fp, (uint64_t)fEntries.size()) && put(fp, (uint64_t)fOffsets.size()) && put(fp, (uint64_t)fPoints.size());
+  if (ok && !fOffsets.empty())
+    ok = fwrite(&fOffsets[0], sizeof(uint64_t), fOffsets.size(), fp) == fOffsets.size();
+  if (ok && !fEntries.empty())
+    ok = fwrite(&fEntries[0], sizeof(Entry_t), fEntries.size(), fp) == fEntries.size();
+
+  for (size_t i=0; ok && i<fPoints.size(); i++)
+    {
+      const AccessPoint_t& point = fPoints[i];
+      std::vector<unsigned char> packed(point.fWindow);
+#ifdef HAVE_ZLIB
+      if (!point.fWindow.empty())
+        {
+          uLongf length = compressBound(point.fWindow.size());
+          packed.resize(length);
+          if (compress2(&packed[0], &length, &point.fWindow[0], point.fWindow.size(), 1) != Z_OK)
+            ok = false;
+          packed.resize(length);
+        }
+#endif
+      ok = ok && put(fp, point.fIn) && put(fp, point.fOut) && put(fp, point.fBits);
+      ok = ok && put(fp, (uint32_t)point.fWindow.size()) && put(fp, (uint32_t)packed.size());
+      ok = ok && (packed.empty() || fwrite(&packed[0], packed.size(), 1, fp) == 1);
+    }
+
+  if (fclose(fp) != 0)
+    ok = false;
+  if (!ok)
+    remove(path);
+  return ok;
+}
+
+bool TMidasFileIndex::Read(const char* path, uint64_t fileSize, int64_t fileTime)
+{
+  /// \param [in] path Sidecar file to read
+  /// \param [in] fileSize, fileTime Size and modification time of the data file;
+  ///  the index is rejected if they do not match the ones stored in it.
+  /// \returns "true" if a valid index was read
+
+  Clear();
+  FILE* fp = fopen(path, "rb");
+  if (fp == NULL)
+    return false;
+
+  char magic[sizeof(kMagic)];
+  uint64_t nEntries = 0, nOffsets = 0, nPoints = 0;
+  bool ok = fread(magic, sizeof(magic), 1, fp) == 1 && memcmp(magic, kMagic, sizeof(kMagic)) == 0;
+  ok = ok && get(fp, fEvery) && get(fp, fFileSize) && get(fp, fFileTime);
+  ok = ok && get(fp, nEntries) && get(fp, nOffsets) && get(fp, nPoints);
+  ok = ok && fEvery > 0 && fFileSize == fileSize && fFileTime == fileTime;
+  ok = ok && nOffsets == (nEntries + fEvery - 1) / fEvery;
+
+  if (ok)
+    {
+      fOffsets.resize(nOffsets);
+      fEntries.resize(nEntries);
+      if (nOffsets)
+        ok = fread(&fOffsets[0], sizeof(uint64_t), nOffsets, fp) == nOffsets;
+      if (ok && nEntries)
+        ok = fread(&fEntries[0], sizeof(Entry_t), nEntries, fp) == nEntries;
+    }
+
+  if (ok)
+    fPoints.resize(nPoints);
+  for (size_t i=0; ok && i<nPoints; i++)
+    {
+      AccessPoint_t& point = fPoints[i];
+      uint32_t size = 0, packedSize = 0;
+      ok = get(fp, point.fIn) && get(fp, point.fOut) && get(fp, point.fBits) && get(fp, size) && get(fp, packedSize);
+      ok = ok && size <= 32768 && packedSize <= 2*32768;
+      if (!ok)
+        break;
+      std::vector<unsigned char> packed(packedSize);
+      ok = packed.empty() || fread(&packed[0], packedSize, 1, fp) == 1;
+#ifdef HAVE_ZLIB
+      uLongf length = size;
+      point.fWindow.resize(size);
+      ok = ok && (size == 0 || uncompress(&point.fWindow[0], &length, &packed[0], packedSize) == Z_OK);
+      ok = ok && length == size;
+#else
+      ok = false;
+#endif
+    }
+
+  fclose(fp);
+  if (!ok)
+    Clear();
+  return ok;
+}
+
+// end
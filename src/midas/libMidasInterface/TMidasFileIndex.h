@@ -0,0 +1,86 @@
+//
+// TMidasFileIndex.h
+//
+
+#ifndef TMIDASFILEINDEX_H
+#define TMIDASFILEINDEX_H
+
+#include <string>
+#include <vector>
+#include "TMidasStructs.h"
+
+class TMidasEvent;
+
+/// Random-access index of the events in a MIDAS file
+///
+/// Stores the event id, trigger mask, serial number and trigger time of every
+/// event, and the offset (in the uncompressed stream) of every Nth event. For
+/// gzip compressed files it also stores the access points from which
+/// decompression can be restarted: the compressed and uncompressed offsets of a
+/// deflate block boundary, plus the 32 kB of output preceeding it. The index is
+/// saved as a binary "sidecar" file next to the data file, see GetPath().
+
+class TMidasFileIndex
+{
+public:
+  /// Trigger time of an event (any units, increasing), negative if it has none
+  typedef double (*TimeFunction_t)(const TMidasEvent&);
+
+  /// Per-event information
+  struct Entry_t {
+    uint32_t fSerialNumber; ///< event serial number
+    uint16_t fEventId;      ///< event id
+    uint16_t fTriggerMask;  ///< event trigger mask
+    double   fTime;         ///< trigger time from TimeFunction_t, -1 if none
+  };
+
+  /// Part of a file split into chunks of consecutive events, see GetChunk()
+  struct Chunk_t {
+    size_t fBegin; ///< number of the first event owned by the chunk
+    size_t fEnd;   ///< number of the first event owned by the next chunk
+    size_t fFirst; ///< number of the first event to read, fBegin or earlier
+    size_t fLast;  ///< number of the event after the last one to read, fEnd or later
+  };
+
+  /// Restart point for decompressing a .gz file
+  struct AccessPoint_t {
+    uint64_t fIn;  ///< offset in the compressed file (of the first full byte)
+    uint64_t fOut; ///< corresponding offset in the uncompressed stream
+    int      fBits; ///< number of bits of the previous byte belonging to the block
+    std::vector<unsigned char> fWindow; ///< uncompressed data preceeding fOut (up to 32 kB)
+  };
+
+  TMidasFileIndex(uint32_t every = 1000); ///< constructor, offsets of every "every" events
+  void Clear(); ///< remove all entries
+
+  bool Read(const char* path, uint64_t fileSize, int64_t fileTime); ///< read a sidecar file
+  bool Write(const char* path) const; ///< write a sidecar file
+
+  void AddEvent(const TMidasEvent& event, uint64_t offset, double time); ///< append the next event
+  void SetAccessPoints(std::vector<AccessPoint_t>& points) { fPoints.swap(points); } ///< set (swap in) gzip access points
+
+  size_t   GetNumEvents() const { return fEntries.size(); } ///< number of indexed events
+  uint32_t GetEvery() const { return fEvery; } ///< spacing of the stored offsets
+  const Entry_t& GetEntry(size_t n) const { return fEntries[n]; } ///< information of event number "n"
+  uint64_t GetOffset(size_t n) const { return fOffsets[n / fEvery]; } ///< offset of event number "n - n % GetEvery()"
+  size_t   GetNumAccessPoints() const { return fPoints.size(); } ///< number of gzip access points
+
+  long FindSerial(uint32_t serial, int eventId = -1) const; ///< number of the first event with a given serial number
+  long FindTime(double time) const; ///< number of the first event at or after a given trigger time
+  long FindEvent(int eventId, size_t from = 0) const; ///< number of the first event with a given id, at or after event number "from"
+  Chunk_t GetChunk(size_t chunk, size_t nchunks, double margin) const; ///< split the events into chunks, with overlapping margins in trigger time
+  const AccessPoint_t* FindAccessPoint(uint64_t offset) const; ///< last access point at or before an offset
+
+  uint64_t fFileSize; ///< size of the indexed file
+  int64_t  fFileTime; ///< modification time of the indexed file
+
+  static std::string GetPath(const char* filename); ///< name of the sidecar file for "filename"
+
+protected:
+  uint32_t fEvery; ///< spacing of fOffsets, in events
+  std::vector<Entry_t>  fEntries; ///< information of every event
+  std::vector<uint64_t> fOffsets; ///< offset of every fEvery'th event
+  std::vector<AccessPoint_t> fPoints; ///< gzip access points, increasing fOut
+};
+
+#endif // TMidasFileIndex.h
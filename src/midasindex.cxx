@@ -0,0 +1,74 @@
+/// \file midasindex.cxx
+/// \brief Builds random-access index files for MIDAS runs.
+/// \details Writes the TMidasFileIndex sidecar (<run>.mid[.gz].idx) of each file
+///  given on the command line, storing head and tail trigger times. Files with an
+///  up-to-date index are skipped unless -f is given.
+///
+/// Usage: <tt>midasindex [-n <events per offset>] [-f] <file> [<file> ...]</tt>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "midas/Event.hxx"
+#include "midas/libMidasInterface/TMidasFile.h"
+#include "midas/libMidasInterface/TMidasFileIndex.h"
+
+
+namespace {
+
+int usage()
+{
+	fprintf(stderr, "usage: midasindex [-n <events per offset>] [-f] <file> [<file> ...]\n");
+	return 1;
+}
+
+} // namespace
+
+
+int main(int argc, char** argv)
+{
+	unsigned every = 1000;
+	bool force = false;
+	std::vector<std::string> files;
+	for (int i = 1; i< argc; ++i) {
+		if (!strcmp(argv[i], "-n")) {
+			if (++i == argc || atoi(argv[i]) <= 0) return usage();
+			every = atoi(argv[i]);
+		}
+		else if (!strcmp(argv[i], "-f")) force = true;
+		else if (argv[i][0] == '-') return usage();
+		else files.push_back(argv[i]);
+	}
+	if (files.empty()) return usage();
+
+	int nerror = 0;
+	for (size_t i = 0; i< files.size(); ++i) {
+		TMidasFile file;
+		bool success = file.Open(files[i].c_str());
+		if (success && !force && file.LoadIndex(false)) {
+			printf("%s: index is up to date\n", files[i].c_str());
+			continue;
+		}
+		if (success) success = file.BuildIndex(&midas::Event::IndexTime, every);
+		if (!success) {
+			fprintf(stderr, "%s: %s\n", files[i].c_str(), file.GetLastError());
+			++nerror;
+			continue;
+		}
+
+		const TMidasFileIndex* index = file.GetIndex();
+		double t0 = -1, t1 = -1;
+		for (size_t j = 0; j< index->GetNumEvents(); ++j) {
+			double t = index->GetEntry(j).fTime;
+			if (t < 0) continue;
+			if (t0 < 0 || t < t0) t0 = t;
+			if (t > t1) t1 = t;
+		}
+		printf("%s: %lu events, %lu gzip access points, trigger times [%.6g, %.6g] us\n",
+					 files[i].c_str(), (unsigned long)index->GetNumEvents(),
+					 (unsigned long)index->GetNumAccessPoints(), t0, t1);
+	}
+
+	return nerror ? 1 : 0;
+}
@@ -0,0 +1,226 @@
+/// \file midskim.cxx
+/// \brief Writes the coincidences of a MIDAS run, optionally cut, to a smaller MIDAS file.
+/// \details Head and tail events are matched with the timestamp queue, with the
+///  coincidence window and buffer time of the run's ODB, and only those which are
+///  part of a coincidence passing all cuts are written. All other events (BOR and EOR
+///  ODB dumps, scalers and EPICS) are written as they are read, so the skim converts
+///  and analyzes like the full run, minus the singles. A cut selects one calculated
+///  coincidence parameter, by the same paths as dragon::BatchReader. Output files
+///  ending in ".gz" are compressed in parallel blocks (one gzip member per block).
+///
+/// Usage: <tt>midskim [-o <output>] [-j <threads>] [-z <level>] [-x <odb>]
+///  [-c <path>:<low>:<high>] ... <input></tt>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <set>
+#include <utility>
+#include "utils/definitions.h"
+#include "midas/Event.hxx"
+#include "midas/Database.hxx"
+#include "midas/libMidasInterface/TMidasFile.h"
+#include "midas/libMidasInterface/TMidasEvent.h"
+#include "TStamp.hxx"
+#include "Dragon.hxx"
+#include "Unpack.hxx"
+#include "Batch.hxx"
+
+
+namespace {
+
+int usage()
+{
+	fprintf(stderr, "usage: midskim [-o <output>] [-j <threads>] [-z <level>] [-x <odb>] "
+					"[-c <path>:<low>:<high>] ... <input>\n");
+	return 1;
+}
+
+/// Keep coincidences with low <= value < high of one coincidence parameter
+struct Cut_t {
+	dragon::BatchReader::Column column;
+	int index;
+	double low, high;
+	Cut_t(const std::string& path, int index_, double low_, double high_):
+		column(dragon::BatchReader::kCoinc, path.c_str()), index(index_), low(low_), high(high_) { }
+};
+
+/// Parse "path[index]:low:high", e.g. "head.bgo.sum:1000:8000" or "tail.dsssd.ecal[3]:0:4000"
+bool parse_cut(const char* arg, std::vector<Cut_t>& cuts)
+{
+	std::string text(arg);
+	size_t c2 = text.rfind(':');
+	size_t c1 = c2 == std::string::npos || c2 == 0 ? std::string::npos : text.rfind(':', c2 - 1);
+	if (c1 == std::string::npos) return false;
+	std::string path = text.substr(0, c1);
+	int index = 0;
+	size_t bracket = path.find('[');
+	if (bracket != std::string::npos) {
+		index = atoi(path.c_str() + bracket + 1);
+		path.erase(bracket);
+	}
+	cuts.push_back(Cut_t(path, index,
+											 atof(text.substr(c1 + 1, c2 - c1 - 1).c_str()), atof(text.substr(c2 + 1).c_str())));
+	const Cut_t& cut = cuts.back();
+	if (!cut.column.IsValid() || index < 0 || index >= cut.column.GetWidth()) {
+		fprintf(stderr, "midskim: no coincidence parameter \"%s\"\n", arg);
+		return false;
+	}
+	return true;
+}
+
+/// Unpacker delegate writing the coincidences which pass the cuts
+class Skimmer: public dragon::Unpacker::Delegate {
+public:
+	Skimmer(TMidasFile& out, const std::vector<Cut_t>& cuts):
+		fOut(out), fCuts(cuts), fCoincs(0), fPassed(0), fWritten(0), fFailed(false)
+		{
+			int head = 0, tail = 0;
+			for (size_t i = 0; i< fCuts.size(); ++i)
+				dragon::Coinc::derived_of(fCuts[i].column.GetPath(), head, tail);
+			fCoinc.head.set_derived(head);
+			fCoinc.tail.set_derived(tail);
+		}
+
+	/// Read the variables used by the cuts
+	void SetVariables(const char* odb)
+		{ if (!fCuts.empty()) fCoinc.set_variables(odb); }
+
+	/// Singles are not written
+	void UnpackHead(const midas::Event&) { }
+	void UnpackTail(const midas::Event&) { }
+
+	/// Write both events of a coincidence passing all cuts, each at most once
+	void UnpackCoinc(const midas::CoincEvent& event)
+		{
+			++fCoincs;
+			if (!fCuts.empty()) {
+				fCoinc.reset();
+				fCoinc.unpack(event);
+				fCoinc.calculate();
+				for (size_t i = 0; i< fCuts.size(); ++i) {
+					const double value = fCuts[i].column.Get(&fCoinc, fCuts[i].index);
+					if (!(value >= fCuts[i].low && value < fCuts[i].high)) return;
+				}
+			}
+			++fPassed;
+			Write(*event.fGamma);
+			Write(*event.fHeavyIon);
+		}
+
+	/// Write any other event
+	void Write(const TMidasEvent& event)
+		{
+			if (event.GetEventId() == DRAGON_HEAD_EVENT || event.GetEventId() == DRAGON_TAIL_EVENT) {
+				const std::pair<uint16_t, uint32_t> key(event.GetEventId(), event.GetSerialNumber());
+				if (!fWrittenSerials.insert(key).second) return; // part of an earlier coincidence
+			}
+			if (!fOut.Write(&event)) fFailed = true;
+			++fWritten;
+		}
+
+	size_t GetNumCoincs() const { return fCoincs; }
+	size_t GetNumPassed() const { return fPassed; }
+	size_t GetNumWritten() const { return fWritten; }
+	bool HasFailed() const { return fFailed; }
+
+private:
+	TMidasFile& fOut;
+	const std::vector<Cut_t>& fCuts;
+	dragon::Coinc fCoinc;
+	std::set<std::pair<uint16_t, uint32_t> > fWrittenSerials;
+	size_t fCoincs, fPassed, fWritten;
+	bool fFailed;
+};
+
+/// Default output name: <input stem>_skim.mid.gz
+std::string skim_name(const std::string& input)
+{
+	std::string stem = input;
+	const char* const suffixes[] = { ".gz", ".bz2", ".lz4", ".mid" };
+	for (size_t i = 0; i< sizeof(suffixes) / sizeof(suffixes[0]); ++i) {
+		const size_t n = strlen(suffixes[i]);
+		if (stem.size() > n && stem.compare(stem.size() - n, n, suffixes[i]) == 0) stem.erase(stem.size() - n);
+	}
+	return stem + "_skim.mid.gz";
+}
+
+} // namespace
+
+
+int main(int argc, char** argv)
+{
+	std::string input, output, odb;
+	int threads = 4, level = 6;
+	std::vector<Cut_t> cuts;
+	for (int i = 1; i< argc; ++i) {
+		if (!strcmp(argv[i], "-o") && i + 1 < argc) output = argv[++i];
+		else if (!strcmp(argv[i], "-x") && i + 1 < argc) odb = argv[++i];
+		else if (!strcmp(argv[i], "-j") && i + 1 < argc) threads = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "-z") && i + 1 < argc) level = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "-c") && i + 1 < argc) {
+			if (!parse_cut(argv[++i], cuts)) return usage();
+		}
+		else if (argv[i][0] == '-' || !input.empty()) return usage();
+		else input = argv[i];
+	}
+	if (input.empty() || threads < 1 || level < 1 || level > 9) return usage();
+	if (output.empty()) output = skim_name(input);
+	if (odb.empty()) odb = input;
+
+	TMidasFile fin;
+	if (!fin.Open(input.c_str())) {
+		fprintf(stderr, "%s: %s\n", input.c_str(), fin.GetLastError());
+		return 1;
+	}
+	TMidasFile fout;
+	if (!fout.OutOpen(output.c_str(), level, threads)) {
+		fprintf(stderr, "%s: %s\n", output.c_str(), fout.GetLastError());
+		return 1;
+	}
+
+	dragon::Head head;
+	dragon::Tail tail;
+	dragon::Coinc coinc;
+	dragon::Epics epics;
+	dragon::Scaler head_scaler, tail_scaler, aux_scaler;
+	dragon::RunParameters runpar;
+	tstamp::Diagnostics tsdiag;
+	dragon::Unpacker unpack(&head, &tail, &coinc, &epics, &head_scaler, &tail_scaler, &aux_scaler, &runpar, &tsdiag);
+	{
+		midas::Database db(odb.c_str());
+		double window = 10, queueTime = 4;
+		if (!db.IsZombie() &&
+				db.ReadValue("/dragon/coinc/variables/window", window) &&
+				db.ReadValue("/dragon/coinc/variables/buffer_time", queueTime)) {
+			unpack.SetCoincWindow(window);
+			unpack.SetQueueTime(queueTime);
+		}
+	}
+	Skimmer skimmer(fout, cuts);
+	skimmer.SetVariables(odb.c_str());
+	unpack.SetDelegate(&skimmer);
+
+	size_t nread = 0;
+	TMidasEvent event;
+	while (fin.ReadView(&event)) {
+		++nread;
+		const uint16_t id = event.GetEventId();
+		if (id == DRAGON_HEAD_EVENT || id == DRAGON_TAIL_EVENT) {
+			unpack.Unpack(event.GetEventHeader(), event.GetData());
+			continue;
+		}
+		if (id == MIDAS_EOR) unpack.FlushQueue(); // coincidences before the EOR dump
+		skimmer.Write(event);
+	}
+	unpack.FlushQueue();
+
+	const bool success = fout.OutClose() && !skimmer.HasFailed();
+	if (!success) fprintf(stderr, "%s: %s\n", output.c_str(), fout.GetLastError());
+	printf("%s: %lu of %lu events written to %s; %lu of %lu coincidences passed %lu cut(s)\n",
+				 input.c_str(), (unsigned long)skimmer.GetNumWritten(), (unsigned long)nread, output.c_str(),
+				 (unsigned long)skimmer.GetNumPassed(), (unsigned long)skimmer.GetNumCoincs(), (unsigned long)cuts.size());
+
+	return success ? 0 : 1;
+}
@@ -4,9 +4,11 @@
  * \brief Implements Application.hxx
  */
 #include <algorithm>
+#include <set>
 #include <cassert>
 #include <vector>
 #include <string>
+#include <iostream>
 
 #include <TROOT.h>
 #include <TFile.h>
@@ -21,6 +23,10 @@
 #include "midas/Database.hxx"
 #include "utils/Functions.hxx"
 #include "Timer.hxx"
+#include "Receiver.hxx"
+#include "HistServer.hxx"
+#include "HistShm.hxx"
+#include "Hotlinks.hxx"
 #include "Histos.hxx"
 #include "HistParser.hxx"
 #include "Callbacks.hxx"
@@ -32,13 +38,85 @@ namespace {
 
 const uint32_t TS_DIAGNOSTICS_EVENT = 6;
 
+const uint32_t RECEIVER_STATS_EVENT = 7;
+
+const uint32_t LOAD_STATS_EVENT = 8;
+
+const uint32_t PROFILE_STATS_EVENT = 9;
+
+const uint32_t LATENCY_STATS_EVENT = 10;
+
+// Event request sampling types (GET_NONBLOCKING, GET_RECENT in midas.h)
+const int SAMPLE_NONBLOCKING = (1<<1);
+const int SAMPLE_RECENT = (1<<2);
+
 template <class T, class E>
 inline void unpack_event(T& data, const E& buf)
 {
 	data.reset();
 	data.unpack(buf);
 	data.calculate();
-} }
+}
+
+// Copy the event already unpacked for an earlier coincidence, if any;
+// otherwise unpack it and keep it for the singles path, if the singles
+// instance calculates the same parameters
+template <class T>
+inline void unpack_shared(dragon::utils::EventCache<T>& cache, T& data, const midas::Event& buf, const T& single)
+{
+	const bool share = single.can_copy_event(data);
+	const T* cached = share ? cache.Find(buf.GetSerialNumber()) : 0;
+	if (cached) {
+		data.copy_event(*cached);
+		return;
+	}
+	unpack_event(data, buf);
+	if (share) cache.Put(buf.GetSerialNumber(), data);
+}
+
+// Event loop timer which also handles events from the receive thread, and
+// flushes batched histogram fills so that the histogram servers see them at
+// least once per period
+class FlushTimer: public rootana::Timer {
+public:
+	FlushTimer(int period_msec): rootana::Timer(period_msec), fBudget(0.8e-3*period_msec) { }
+	void PeriodicAction()
+		{
+			rootana::Timer::PeriodicAction();
+			rootana::App::instance()->drain_receiver(fBudget);
+			rootana::App::instance()->update_load();
+			rootana::App::instance()->update_profile();
+			rootana::App::instance()->update_latency();
+			rootana::App::instance()->update_variables();
+			rootana::App::instance()->flush_hists();
+			rootana::App::instance()->snapshot_hists();
+		}
+private:
+	double fBudget; // time (seconds) spent handling received events per period
+};
+
+// Event handler for the receive ring when replaying a file
+void replay_handle_event(const void* pheader, const void* pdata, int size)
+{
+	rootana::App::instance()->handle_replay_event(pheader, pdata, size);
+}
+
+// Default number of values buffered by each histogram between fills
+const Int_t DEFAULT_BATCH_SIZE = 256;
+
+// Default number of events in the online receive ring
+const Int_t DEFAULT_RING_SIZE = 1024;
+
+// Default number of head and tail events kept for reuse after a coincidence
+const Int_t DEFAULT_PROCESSED_SIZE = 64;
+
+// Default maximum singles prescale applied by load shedding
+const Int_t DEFAULT_MAX_PRESCALE = 64;
+
+// Number of events in the timestamp queue counted as a full backlog
+const double QUEUE_NOMINAL_SIZE = 1e5;
+
+}
 
 
 // RAII wrapper for TMidasOnline //
@@ -76,26 +154,59 @@ rootana::App::App(const char* appClassName, Int_t* argc, char** argv):
 	fCutoff(0),
 	fReturn(0),
 	fTcp(9091),
+	fDeltaPort(0),
+	fRingSize(DEFAULT_RING_SIZE),
+	fRingOverflow(0),
+	fRequestId(-1),
+	fProfile(0),
+	fWatchOdb(false),
+	fLazy(false),
 	fCoincWindow(10.),
+	fReplaySpeed(-1.),
+	fQueueHighWater(0),
 	fFilename(""),
 	fHost(""),
 	fExpt(""),
 	fHistos( DRAGON_UTILS_STRINGIFY(ROOTANA_DEFAULT_HISTOS) ),
 	fHistosOnline(""),
+	fShmName(""),
 	fOutputFile(0),
 	fOnlineHists(0),
 	fOdb(0),
-	fMidasOnline(0)
+	fMidasOnline(0),
+	fReceiver(0),
+	fHistServer(0),
+	fHistShm(0),
+	fHotlinks(0),
+	fShedder(DEFAULT_MAX_PRESCALE),
+	fHeadProcessed(DEFAULT_PROCESSED_SIZE),
+	fTailProcessed(DEFAULT_PROCESSED_SIZE)
 { 
 /*!
  *  Also: process command line arguments, starts histogram server if appropriate.
  */
+	rootana::HistBase::set_batch_size(DEFAULT_BATCH_SIZE);
 	process_argv (*argc, argv);
+	if (fProfile > 0) dragon::utils::Profile::Enable(fProfile);
 	if (!fQueue.get()) fQueue.reset(tstamp::NewOwnedQueue(4e6, this));
-	if (fMode == ONLINE) {
+	if (fMode == ONLINE || fMode == REPLAY) {
 		gROOT->cd();
 		fOnlineHists.reset(new rootana::OnlineDirectory());
 		fOnlineHists->Open(fTcp, fHistosOnline.c_str());
+		if (fDeltaPort) {
+			fHistServer.reset(new rootana::HistServer(fDeltaPort));
+			if (fHistServer->IsListening() && fHistServer->Start())
+				printf("Serving changed histograms on port %d.\n", fDeltaPort);
+			else
+				fHistServer.reset(0);
+		}
+		if (!fShmName.empty()) {
+			fHistShm.reset(new rootana::HistShm(fShmName.c_str()));
+			if (fHistShm->IsOpen())
+				printf("Publishing histograms in shared memory segment \"%s\".\n", fShmName.c_str());
+			else
+				fHistShm.reset(0);
+		}
 	}
 }
 
@@ -121,6 +232,8 @@ void rootana::App::process_argv(int argc, char** argv)
 			fCutoff =  atoi (iarg->substr(2).c_str() );
 		else if ( iarg->compare(0, 2, "-P") == 0 )
 			fTcp  = atoi (iarg->substr(2).c_str() );
+		else if ( iarg->compare(0, 2, "-D") == 0 )
+			fDeltaPort = atoi (iarg->substr(2).c_str() );
 		else if ( iarg->compare(0, 2, "-H") == 0 )
 			fHost = iarg->substr(2);
 		else if ( iarg->compare(0, 2, "-E") == 0 )
@@ -129,6 +242,32 @@ void rootana::App::process_argv(int argc, char** argv)
 			fQueue.reset(tstamp::NewOwnedQueue( atof(iarg->substr(6).c_str()), this ));
 		else if ( iarg->compare(0, 6, "-Ctime") == 0 )
 			fCoincWindow = atof(iarg->substr(6).c_str());
+		else if ( iarg->compare("-Rdrop") == 0 )
+			fRingOverflow = 1;
+		else if ( iarg->compare(0, 2, "-R") == 0 )
+			fRingSize = atoi (iarg->substr(2).c_str() );
+		else if ( iarg->compare(0, 2, "-L") == 0 )
+			fShedder = rootana::LoadShedder( atoi (iarg->substr(2).c_str()) );
+		else if ( iarg->compare(0, 2, "-A") == 0 )
+			fLatency.SetThreshold(LatencyStats::TOTAL, atof (iarg->substr(2).c_str() ));
+		else if ( iarg->compare(0, 2, "-S") == 0 )
+			fProfile = iarg->size() > 2 ? atoi (iarg->substr(2).c_str() ) : 1;
+		else if ( iarg->compare("-W") == 0 )
+			fWatchOdb = true;
+		else if ( iarg->compare("-lazy") == 0 )
+			fLazy = true;
+		else if ( iarg->compare(0, 7, "-replay") == 0 )
+			fReplaySpeed = iarg->size() > 7 ? atof (iarg->substr(7).c_str() ) : 1.;
+		else if ( iarg->compare(0, 4, "-shm") == 0 ) {
+			fShmName = iarg->size() > 4 ? iarg->substr(4) : "/dragon_histos";
+			if (fShmName[0] != '/') fShmName.insert(0, "/");
+		}
+		else if ( iarg->compare(0, 2, "-M") == 0 ) {
+			fHeadProcessed.SetCapacity( atoi (iarg->substr(2).c_str()) );
+			fTailProcessed.SetCapacity( atoi (iarg->substr(2).c_str()) );
+		}
+		else if ( iarg->compare(0, 2, "-B") == 0 )
+			rootana::HistBase::set_batch_size( atoi (iarg->substr(2).c_str()) );
 		else if ( iarg->compare("-histos")  == 0 )
 			fHistos = *(++iarg);
 		else if ( iarg->compare("-histos0")  == 0 )
@@ -140,6 +279,8 @@ void rootana::App::process_argv(int argc, char** argv)
 			fFilename = *iarg;
 		}
 	}
+	if (fMode == OFFLINE && fReplaySpeed >= 0)
+		fMode = REPLAY;
 }
 
 void rootana::App::handle_event(midas::Event& event)
@@ -148,10 +289,17 @@ void rootana::App::handle_event(midas::Event& event)
 	 * Handles various types of events in the following ways:
 	 */
 	const uint16_t EID = event.GetEventId();
+	if (fMode != OFFLINE) { // stamp for latency monitoring, with the time the receive thread got it (if any)
+		const double now = Receiver::GetTimeSec();
+		const double received = fReceiver.get() ? fReceiver->GetReceiveTime() : 0;
+		event.SetReceiveTime(received > 0 ? received : now);
+		event.SetQueueTime(now);
+	}
 	if (EID == DRAGON_HEAD_EVENT || EID == DRAGON_TAIL_EVENT) {
 		/// - Head and tail events: insert into queue; call to Process() is delayed
 		///   until it's at the front of the queue.
 		fQueue->Push(event, &gDiagnostics);
+		if (fQueue->Size() > fQueueHighWater) fQueueHighWater = fQueue->Size();
 	}
 	else {
 		/// - All others: call Process() directly.
@@ -159,55 +307,36 @@ void rootana::App::handle_event(midas::Event& event)
 	}
 }
 
-template <class IT>
-IT FindSerial(IT begin_, IT end_, uint32_t value)
-{
-	for(; begin_!=end_; ++begin_) if (value == begin_->header.fSerialNumber) break;
-	return begin_;
-}
-
 void rootana::App::Process(const midas::Event& event)
 {
 	const uint16_t EID = event.GetEventId();
 	switch (EID) {
 
-	case DRAGON_HEAD_EVENT:  /// - DRAGON_HEAD_EVENT: Calculate head params & fill head histos
+	case DRAGON_HEAD_EVENT:  /// - DRAGON_HEAD_EVENT: Calculate head params & fill head histos, unless prescaled by load shedding
 		{
-#if 0
-			std::list<dragon::Head>::iterator it =
-				FindSerial(fHeadProcessed.begin(), fHeadProcessed.end(), event.GetSerialNumber());
-
-			if (it != fHeadProcessed.end()) {
-				rootana::gHead = *it;
-				fHeadProcessed.erase(it);
+			record_queue_latency(event);
+			if (!fShedder.AcceptSingle()) {
+				fHeadProcessed.Erase(event.GetSerialNumber());
+				break;
 			}
-			else {
+			if (!fHeadProcessed.Take(event.GetSerialNumber(), rootana::gHead))
 				unpack_event(rootana::gHead, event);
-			}
-#else
-			unpack_event(rootana::gHead, event);
 			fill_hists(EID);
-#endif
+			record_fill_latency(event);
 			break;
 		}
 
-	case DRAGON_TAIL_EVENT:  /// - DRAGON_TAIL_EVENT: Calculate tail params & fill tail histos
+	case DRAGON_TAIL_EVENT:  /// - DRAGON_TAIL_EVENT: Calculate tail params & fill tail histos, unless prescaled by load shedding
 		{
-#if 0
-			std::list<dragon::Tail>::iterator it =
-				FindSerial(fTailProcessed.begin(), fTailProcessed.end(), event.GetSerialNumber());
-
-			if (it != fTailProcessed.end()) {
-				rootana::gTail = *it;
-				fTailProcessed.erase(it);
+			record_queue_latency(event);
+			if (!fShedder.AcceptSingle()) {
+				fTailProcessed.Erase(event.GetSerialNumber());
+				break;
 			}
-			else {
+			if (!fTailProcessed.Take(event.GetSerialNumber(), rootana::gTail))
 				unpack_event(rootana::gTail, event);
-			}
-#else
-			unpack_event(rootana::gTail, event);
 			fill_hists(EID);
-#endif
+			record_fill_latency(event);
 			break;
 		}
 
@@ -243,11 +372,12 @@ void rootana::App::Process(const midas::Event& event1, const midas::Event& event
 		return;
 	}
 
-	unpack_event(rootana::gCoinc, coincEvent);
+	unpack_shared(fHeadProcessed, rootana::gCoinc.head, *coincEvent.fGamma, rootana::gHead);
+	unpack_shared(fTailProcessed, rootana::gCoinc.tail, *coincEvent.fHeavyIon, rootana::gTail);
+	rootana::gCoinc.calculate_coinc();
 	fill_hists(DRAGON_COINC_EVENT);
-
-	fHeadProcessed.push_back(rootana::gCoinc.head);
-	fTailProcessed.push_back(rootana::gCoinc.tail);
+	// as old as the earlier of the two events
+	record_fill_latency(event1.GetReceiveTime() <= event2.GetReceiveTime() ? event1 : event2);
 
 	if(0) event1.PrintCoinc(event2);
 }
@@ -279,7 +409,7 @@ int rootana::App::midas_file(const char* fname)
   while (1) {
 
 		TMidasEvent event;
-		if (!f.Read(&event)) break;
+		if (!f.ReadView(&event)) break;
 
 		int eventId = event.GetEventId();
 
@@ -303,6 +433,7 @@ int rootana::App::midas_file(const char* fname)
       
 		if((i%500)==0)
 			printf("Processing event %d\n",i);
+		update_profile();
 		
 		i++;
 
@@ -313,6 +444,10 @@ int rootana::App::midas_file(const char* fname)
 	}
   
   f.Close();
+	if (fProfile > 0) {
+		printf("\n");
+		dragon::utils::Profile::Print(std::cout);
+	}
   return 0;
 }
 
@@ -334,13 +469,35 @@ int rootana::App::midas_online(const char* host, const char* experiment)
 	}
 	fOdb.reset(new midas::Database("online"));
 
+	/*! - Watch the variables directories for changes during a run, if requested (-W) */
+	if (fWatchOdb) {
+		fHotlinks.reset(new Hotlinks((*fMidasOnline)->fDB));
+		int n = fHotlinks->Add("/dragon");
+		n += fHotlinks->AddEquipmentSettings();
+		printf("Watching %d ODB directories for variable changes.\n", n);
+	}
+
 	/*! - Set transition handlers */
 	(*fMidasOnline)->setTransitionHandlers(rootana_run_start, rootana_run_stop, rootana_run_resume, rootana_run_pause);
 	(*fMidasOnline)->registerTransitions();
 
-	/*! -Register event requests */
-	(*fMidasOnline)->setEventHandler(rootana_handle_event);
-	(*fMidasOnline)->eventRequest("SYSTEM",-1,-1,(1<<1));
+	/*! -Register event requests: polled from a separate receive thread if the
+	 *   ring size is > 0, otherwise delivered by callback from the event loop */
+	if (fRingSize <= 0)
+		(*fMidasOnline)->setEventHandler(rootana_handle_event);
+	if (!request_events(SAMPLE_NONBLOCKING))
+		return -1;
+	if (fRingSize > 0) {
+		fReceiver.reset(new OnlineReceiver(fRequestId, fRingSize, Receiver::Overflow_t(fRingOverflow)));
+		if (!fReceiver->Start()) {
+			fprintf(stderr, "Cannot start receive thread!\n");
+			return -1;
+		}
+		printf("Receiving events into a ring of %d, %s when full.\n",
+					 int(fReceiver->Capacity()), fRingOverflow ? "dropping the oldest" : "blocking");
+	}
+	if (fShedder.IsEnabled())
+		printf("Load shedding on, maximum singles prescale %d.\n", fShedder.GetMaxPrescale());
 
 
 	/*! Open output file */
@@ -385,7 +542,7 @@ int rootana::App::midas_online(const char* host, const char* experiment)
 
 
 	/*! - Enter event loop and run until told to exit */
-	rootana::Timer tm(100);
+	FlushTimer tm(100);
 	TApplication::Run(kTRUE);
 
 	// /*! - (Upon exit:) disconnect from experiment */
@@ -394,6 +551,91 @@ int rootana::App::midas_online(const char* host, const char* experiment)
 	return 0;
 }
 
+int rootana::App::midas_replay(const char* fname)
+{
+	/*!
+	 * \param fname MIDAS file to replay
+	 * \returns 0 if successful, -1 if failure
+	 *
+	 * Events are read from the file by a ReplayReceiver thread, at fReplaySpeed times
+	 * the recorded rate, and handled as in midas_online(): through the receive ring
+	 * (-Rsize, -Rdrop), the timestamp queue, unpacking (with load shedding, -L) and
+	 * histogram filling, with the histogram servers running. Once all of them were
+	 * handled, prints the achieved and the maximum sustainable event rates, the
+	 * ring and timestamp queue high-water marks and the number of dropped events.
+	 *
+	 * The maximum sustainable rate is the number of events handled per second spent
+	 * handling them; the event loop's periodic work, and waiting for events, are
+	 * not counted.
+	 */
+	const int ringSize = fRingSize > 0 ? fRingSize : DEFAULT_RING_SIZE;
+	ReplayReceiver* replay = new ReplayReceiver(fname, fReplaySpeed, ringSize, Receiver::Overflow_t(fRingOverflow));
+	fReceiver.reset(replay);
+	if (!replay->IsOpen()) {
+		printf("Cannot open input file \"%s\"\n", fname);
+		return -1;
+	}
+	fOutputFile.reset(new rootana::OfflineDirectory("."));
+
+	const double start = Receiver::GetTimeSec();
+	if (!fReceiver->Start()) {
+		fprintf(stderr, "Cannot start replay thread!\n");
+		return -1;
+	}
+	if (fReplaySpeed > 0)
+		printf("Replaying %s at %g times the recorded rate", fname, fReplaySpeed);
+	else
+		printf("Replaying %s as fast as possible", fname);
+	printf(", into a ring of %d, %s when full.\n",
+				 int(fReceiver->Capacity()), fRingOverflow ? "dropping the oldest" : "blocking");
+	if (fShedder.IsEnabled())
+		printf("Load shedding on, maximum singles prescale %d.\n", fShedder.GetMaxPrescale());
+
+	FlushTimer tm(100);
+	TApplication::Run(kTRUE);
+
+	const double elapsed = Receiver::GetTimeSec() - start;
+	const double recorded = replay->GetRecordedTime();
+	const double received = fReceiver->GetNumReceived(), handled = fReceiver->GetNumHandled();
+	printf("\n---- REPLAY SUMMARY ----\n");
+	printf("Events replayed:        %.0f in %.1f s (%.4g/s)", received, elapsed, elapsed > 0 ? received / elapsed : 0.);
+	if (recorded > 0) printf(", recorded at %.4g/s over %.0f s", received / recorded, recorded);
+	printf("\n");
+	printf("Maximum sustainable:    %.4g events/s (%.0f handled in %.2f s)\n",
+				 fReceiver->GetBusyTime() > 0 ? handled / fReceiver->GetBusyTime() : 0., handled, fReceiver->GetBusyTime());
+	printf("Receive ring:           high-water %d of %d, %llu dropped\n", int(fReceiver->HighWater()),
+				 int(fReceiver->Capacity()), (unsigned long long)fReceiver->GetNumDropped());
+	printf("Timestamp queue:        high-water %lu events\n", (unsigned long)fQueueHighWater);
+	if (fShedder.IsEnabled())
+		printf("Load shedding:          final singles prescale %d\n", fShedder.GetPrescale());
+	Double_t p50, p99, max;
+	if (fLatency.GetRunTotals(LatencyStats::QUEUE, p50, p99, max))
+		printf("Queue latency:          %.3g ms median, %.3g ms 99th percentile, %.3g ms maximum\n", p50, p99, max);
+	if (fLatency.GetRunTotals(LatencyStats::TOTAL, p50, p99, max))
+		printf("Receipt to fill:        %.3g ms median, %.3g ms 99th percentile, %.3g ms maximum\n", p50, p99, max);
+	return 0;
+}
+
+void rootana::App::handle_replay_event(const void* pheader, const void* pdata, int size)
+{
+	/*!
+	 * Begin-of-run events start a run, with the variables of the file's ODB, as in
+	 * midas_file(); all others go to rootana_handle_event().
+	 */
+	const midas::Event::Header* header = reinterpret_cast<const midas::Event::Header*>(pheader);
+	if ((header->fEventId & 0xFFFF) == 0x8000) { // begin run
+		printf("---- BEGIN RUN ---- \n");
+		fOdb.reset(new midas::Database(fFilename.c_str()));
+		rootana_run_start(0, header->fSerialNumber, 0);
+	}
+	else if ((header->fEventId & 0xFFFF) == 0x8001) { // end run
+		printf("---- END RUN ---- \n");
+	}
+	else {
+		rootana_handle_event(pheader, pdata, size);
+	}
+}
+
 void rootana::App::Run(Bool_t)
 {
 	/*!
@@ -405,6 +647,10 @@ void rootana::App::Run(Bool_t)
 		fReturn = midas_file(fFilename.c_str());
 		break;
 
+	case REPLAY:
+		fReturn = midas_replay(fFilename.c_str());
+		break;
+
 	case ONLINE:
 #ifdef MIDASSYS
 		fReturn = midas_online(fHost.c_str(), fExpt.c_str());
@@ -424,7 +670,11 @@ void rootana::App::Run(Bool_t)
 void rootana::App::Terminate(Int_t status)
 {
 	do_exit();
-	if (fMidasOnline->Connected()) fMidasOnline.reset(0);
+	fReceiver.reset(0);
+	fHistServer.reset(0);
+	fHistShm.reset(0);
+	fHotlinks.reset(0);
+	if (fMidasOnline.get() && fMidasOnline->Connected()) fMidasOnline.reset(0);
 	TApplication::Terminate(status);
 }
 
@@ -449,17 +699,41 @@ void rootana::App::run_start(int runnum)
 	rootana::gHeadScaler.reset();
 	rootana::gTailScaler.reset();
 	rootana::gDiagnostics.reset();
-
-	/// Read variables from the ODB
-	rootana::gHead.set_variables("online");
-	rootana::gTail.set_variables("online");
-	rootana::gCoinc.set_variables("online");
-	rootana::gHeadScaler.set_variables("online", "head");
-	rootana::gTailScaler.set_variables("online", "tail");
+	dragon::utils::MessageLimit::ResetAll();
+
+	/// Forget events unpacked in the previous run (serial numbers restart)
+	fHeadProcessed.Clear();
+	fTailProcessed.Clear();
+	fLatency.Reset();
+
+	/// Read variables from the ODB, all from one copy of it fetched at once
+	midas::Odb::ClearCache();
+	midas::Database db(fMode == REPLAY ? fFilename.c_str() : "online", true);
+	rootana::gHead.set_variables(&db);
+	rootana::gTail.set_variables(&db);
+	rootana::gCoinc.set_variables(&db);
+	rootana::gHeadScaler.set_variables(&db, "head");
+	rootana::gTailScaler.set_variables(&db, "tail");
 
 	bool opened = fOutputFile->Open(runnum, fHistos.c_str());
 	if(!opened) Terminate(1);
 
+	/// Skip derived parameters which no histogram or cut reads, if requested
+	if (fLazy) {
+		Int_t head = 0, tail = 0;
+		fOutputFile->AddDerived(head, tail);
+		if (fOnlineHists.get()) fOnlineHists->AddDerived(head, tail);
+		// coincidence and singles events share calculated heads and tails, so they
+		// must calculate the same parameters
+		rootana::gHead.set_derived(head);
+		rootana::gCoinc.head.set_derived(head);
+		rootana::gTail.set_derived(tail);
+		rootana::gCoinc.tail.set_derived(tail);
+		dragon::utils::Info("rootana") << std::hex << std::showbase
+			<< "Calculating derived head parameters " << head << " of " << dragon::Head::ALL_DERIVED
+			<< ", tail parameters " << tail << " of " << dragon::Tail::ALL_DERIVED << std::dec << std::noshowbase;
+	}
+
 	dragon::utils::Info("rootana") << "Start of run " << runnum;
 }
 
@@ -470,21 +744,235 @@ void rootana::App::run_stop(int runnum)
 	 *  save histograms, closes output root file.
 	 */
   fRunNumber = runnum;
+	drain_receiver(-1);
 	fQueue->Flush(30, &gDiagnostics);
 	fOutputFile->Close();
+	dragon::utils::MessageLimit::Flush();
+	if (fHeadProcessed.GetNumEvicted() || fTailProcessed.GetNumEvicted()) {
+		dragon::utils::Warning("rootana")
+			<< "Unpacked again " << fHeadProcessed.GetNumEvicted() << " head and "
+			<< fTailProcessed.GetNumEvicted() << " tail singles evicted from the cache of "
+			<< fHeadProcessed.GetCapacity() << " coincidence events, consider a larger -Msize";
+	}
 	dragon::utils::Info("rootana") << "End of run " << runnum;
 }
 
 void rootana::App::fill_hists(uint16_t eid)
 {
+	dragon::utils::ProfileScope profile(dragon::utils::Profile::kHistFill);
+	rootana::CutTable::instance().new_event();
 	fOutputFile->CallForAll(&rootana::HistBase::fill, eid);
 	fOnlineHists->CallForAll(&rootana::HistBase::fill, eid);
 }
 
+void rootana::App::record_queue_latency(const midas::Event& event)
+{
+	if (event.GetQueueTime() > 0)
+		fLatency.Record(LatencyStats::QUEUE, Receiver::GetTimeSec() - event.GetQueueTime());
+}
+
+void rootana::App::record_fill_latency(const midas::Event& event)
+{
+	/*! Values still buffered by batched fills (-B) reach the histograms at the next
+	 *  flush, at most one timer period later, which is not counted. */
+	if (event.GetReceiveTime() <= 0) return;
+	const double now = Receiver::GetTimeSec();
+	fLatency.Record(LatencyStats::TOTAL, now - event.GetReceiveTime());
+	if (fMode == ONLINE) // replayed time stamps are those of the recording
+		fLatency.Record(LatencyStats::DAQ, now - event.GetTimeStamp());
+}
+
+void rootana::App::flush_hists()
+{
+	if(rootana::HistBase::get_batch_size() <= 1) return;
+	if(fOutputFile.get())  fOutputFile->CallForAll(&rootana::HistBase::flush);
+	if(fOnlineHists.get()) fOnlineHists->CallForAll(&rootana::HistBase::flush);
+}
+
+void rootana::App::snapshot_hists()
+{
+	/*! Does nothing if neither the server nor the shared-memory segment is running;
+	 *  see HistServer::Snapshot() and HistShm::Publish() */
+	if (!fHistServer.get() && !fHistShm.get()) return;
+	std::vector<const rootana::Directory*> directories;
+	if (fOutputFile.get())  directories.push_back(fOutputFile.get());
+	if (fOnlineHists.get()) directories.push_back(fOnlineHists.get());
+	if (fHistServer.get()) fHistServer->Snapshot(directories);
+	if (fHistShm.get())    fHistShm->Publish(directories);
+}
+
+void rootana::App::drain_receiver(double maxSec)
+{
+	/*!
+	 * \param maxSec Time limit, negative to handle all waiting events
+	 *
+	 * Also updates rootana::gReceiver and fills the histograms using it.
+	 * Does nothing if there is no receive thread. When replaying, leaves the
+	 * event loop once all events of the file were handled.
+	 */
+	if (!fReceiver.get()) return;
+	fReceiver->Drain(fMode == REPLAY ? replay_handle_event : rootana_handle_event, maxSec);
+	fReceiver->UpdateStats(rootana::gReceiver);
+	fill_hists(RECEIVER_STATS_EVENT);
+	if (fMode == REPLAY && fReceiver->IsDone() && !fReceiver->Size())
+		gSystem->ExitLoop();
+}
+
+bool rootana::App::request_events(int samplingType)
+{
+	/*!
+	 * \param samplingType MIDAS sampling type (GET_NONBLOCKING, GET_RECENT, ...)
+	 * \returns true if successful
+	 *
+	 * The new request is made before deleting the old one, so that the receive
+	 * thread (which is switched over in between) always has a valid request.
+	 */
+	int requestId = (*fMidasOnline)->eventRequest("SYSTEM",-1,-1,samplingType, fRingSize > 0);
+	if (requestId < 0) return false;
+	if (fReceiver.get()) fReceiver->SetRequestId(requestId);
+	if (fRequestId >= 0) (*fMidasOnline)->deleteEventRequest(fRequestId);
+	fRequestId = requestId;
+	return true;
+}
+
+void rootana::App::update_load()
+{
+	/*!
+	 * Measures the backlog from the MIDAS buffer and receive ring fill levels
+	 * and the timestamp queue size, and updates fShedder and rootana::gLoad.
+	 * When entering or leaving LoadShedder::kRecent, events are re-requested with
+	 * the corresponding sampling type (online only; when replaying, kRecent is
+	 * the maximum prescale).
+	 */
+	if (!fShedder.IsEnabled() || (!fMidasOnline.get() && !fReceiver.get())) return;
+
+	double buffer = 0;
+	if (fMidasOnline.get()) {
+		const int level = (*fMidasOnline)->getBufferLevel(), size = (*fMidasOnline)->getBufferSize();
+		if (level >= 0 && size > 0) buffer = double(level) / size;
+	}
+	if (fReceiver.get()) buffer = std::max(buffer, double(fReceiver->Size()) / fReceiver->Capacity());
+	const double queue = fQueue->Size() / QUEUE_NOMINAL_SIZE;
+
+	const bool recent = (fShedder.GetMode() == LoadShedder::kRecent);
+	if (fShedder.Update(buffer, queue, rootana::gLoad)) {
+		const bool nowRecent = (fShedder.GetMode() == LoadShedder::kRecent);
+		if (nowRecent != recent && fMidasOnline.get())
+			request_events(nowRecent ? SAMPLE_RECENT : SAMPLE_NONBLOCKING);
+		dragon::utils::Info("rootana")
+			<< "Load shedding: mode " << fShedder.GetMode() << ", singles prescale " << fShedder.GetPrescale()
+			<< " (buffer " << buffer << ", queue " << queue << ")";
+	}
+	fill_hists(LOAD_STATS_EVENT);
+}
+
+void rootana::App::update_profile()
+{
+	/*!
+	 * Once per second while profiling (-S option): updates rootana::gProfile and fills
+	 * the histograms using it. Online, the mean times, call rates and busy fractions
+	 * are also written to the ODB, as /Analyzer/Profile/<stage>/{mean_us,rate,busy}.
+	 */
+	if (!fProfiler.Update(rootana::gProfile)) return;
+	fill_hists(PROFILE_STATS_EVENT);
+
+#ifdef MIDASSYS
+	if (!fMidasOnline.get() || !fMidasOnline->Connected()) return;
+	const HNDLE hDB = (*fMidasOnline)->fDB;
+	for (int i = 0; i< dragon::utils::Profile::kNumStages; ++i) {
+		const std::string key = std::string("/Analyzer/Profile/") + dragon::utils::Profile::GetName(i);
+		db_set_value(hDB, 0, (key + "/mean_us").c_str(), &rootana::gProfile.mean[i], sizeof(double), 1, TID_DOUBLE);
+		db_set_value(hDB, 0, (key + "/rate").c_str(),    &rootana::gProfile.rate[i], sizeof(double), 1, TID_DOUBLE);
+		db_set_value(hDB, 0, (key + "/busy").c_str(),    &rootana::gProfile.busy[i], sizeof(double), 1, TID_DOUBLE);
+	}
+#endif
+}
+
+void rootana::App::update_latency()
+{
+	/*!
+	 * Once per second, online and when replaying: updates rootana::gLatency from the
+	 * events handled since the last update and fills the histograms using it. A
+	 * warning is printed when the 99th percentile of a latency goes above its alarm
+	 * threshold (the one from receipt to fill is set with -A).
+	 *
+	 * Online, the percentiles are also written to the ODB, as
+	 * /Analyzer/Latency/<kind>/{p50_ms,p99_ms,max_ms}, and the thresholds are read
+	 * from /Analyzer/Latency/<kind>/alarm_ms (created if missing; 0 for no alarm),
+	 * so that operators can change them during a run. Going above one also triggers
+	 * the MIDAS alarm "Analyzer latency", which is reset once all are below again.
+	 */
+	if (fMode == OFFLINE) return;
+	static const char* const kinds[LatencyStats::NUM_KINDS] = { "queue", "total", "daq" };
+	const int wasAlarm = rootana::gLatency.alarm;
+	if (!fLatency.Update(rootana::gLatency, Receiver::GetTimeSec())) return;
+	fill_hists(LATENCY_STATS_EVENT);
+
+	const int raised = rootana::gLatency.alarm & ~wasAlarm;
+	char message[256] = "";
+	for (int i = 0; i< LatencyStats::NUM_KINDS; ++i) {
+		if (!(raised & (1 << i))) continue;
+		snprintf(message, sizeof(message), "99th percentile %s latency %.0f ms is above %.0f ms",
+						 kinds[i], rootana::gLatency.p99[i], fLatency.GetThreshold(i));
+		dragon::utils::Warning("rootana") << "Latency alarm: " << message;
+	}
+	if (wasAlarm && !rootana::gLatency.alarm)
+		dragon::utils::Info("rootana") << "Latency alarm cleared";
+
+#ifdef MIDASSYS
+	if (!fMidasOnline.get() || !fMidasOnline->Connected()) return;
+	const HNDLE hDB = (*fMidasOnline)->fDB;
+	for (int i = 0; i< LatencyStats::NUM_KINDS; ++i) {
+		const std::string key = std::string("/Analyzer/Latency/") + kinds[i];
+		db_set_value(hDB, 0, (key + "/p50_ms").c_str(), &rootana::gLatency.p50[i], sizeof(double), 1, TID_DOUBLE);
+		db_set_value(hDB, 0, (key + "/p99_ms").c_str(), &rootana::gLatency.p99[i], sizeof(double), 1, TID_DOUBLE);
+		db_set_value(hDB, 0, (key + "/max_ms").c_str(), &rootana::gLatency.max[i], sizeof(double), 1, TID_DOUBLE);
+		double threshold = fLatency.GetThreshold(i);
+		INT size = sizeof(threshold);
+		if (db_get_value(hDB, 0, (key + "/alarm_ms").c_str(), &threshold, &size, TID_DOUBLE, TRUE) == DB_SUCCESS)
+			fLatency.SetThreshold(i, threshold);
+	}
+	char alarmName[] = "Analyzer latency";
+	if (raised) {
+		char alarmClass[] = "Warning", condition[] = "";
+		al_trigger_alarm(alarmName, message, alarmClass, condition, AT_INTERNAL);
+	}
+	else if (wasAlarm && !rootana::gLatency.alarm)
+		al_reset_alarm(alarmName);
+#endif
+}
+
+void rootana::App::update_variables()
+{
+	/*!
+	 * Called between events. For each ODB directory changed since the last call,
+	 * only the variables stored there are read again; see e.g.
+	 * dragon::Head::update_variables().
+	 */
+#ifdef MIDASSYS
+	if (!fHotlinks.get()) return;
+	std::set<std::string> dirs;
+	fHotlinks->Take(dirs);
+	if (dirs.empty()) return;
+
+	midas::Database db("online");
+	for (std::set<std::string>::const_iterator it = dirs.begin(); it != dirs.end(); ++it) {
+		const char* path = it->c_str();
+		bool found = rootana::gHead.update_variables(&db, path);
+		found |= rootana::gTail.update_variables(&db, path);
+		found |= rootana::gCoinc.update_variables(&db, path);
+		found |= rootana::gHeadScaler.update_variables(&db, path, "head");
+		found |= rootana::gTailScaler.update_variables(&db, path, "tail");
+		if (found)
+			dragon::utils::Info("rootana") << "Updated variables from \"" << path << "\"";
+	}
+#endif
+}
+
 void rootana::App::help()
 {
   printf("\nUsage:\n");
-  printf("\n./anaDragon [-h] [-histos <histogram file>] [-histos0 <histogram file>] [-Qtime] [-Ctime] [-Hhostname] [-Eexptname] [-eMaxEvents] [-P9091] [file1 file2 ...]\n");
+  printf("\n./anaDragon [-h] [-histos <histogram file>] [-histos0 <histogram file>] [-Qtime] [-Ctime] [-Bsize] [-Rsize] [-Rdrop] [-Msize] [-Lprescale] [-Amsec] [-S[n]] [-W] [-lazy] [-shm[name]] [-replay[speed]] [-Hhostname] [-Eexptname] [-eMaxEvents] [-P9091] [-Dport] [file1 file2 ...]\n");
   printf("\n");
   printf("\t-h: print this help message\n");
   printf("\t-T: test mode - start and serve a test histogram\n");
@@ -494,7 +982,19 @@ void rootana::App::help()
   printf("\t-Eexptname: connect to this MIDAS experiment\n");
 	printf("\t-Qtime: Set timestamp matching queue time in microseconds (default: 10e6)\n");
 	printf("\t-Ctime: Set coincidence matching window in microseconds (default: 10.0)\n");
+	printf("\t-Bsize: Number of values buffered per histogram between fills (default: %d, 1 disables)\n", DEFAULT_BATCH_SIZE);
+	printf("\t-Rsize: Number of events buffered between the online receive thread and the analysis (default: %d, 0 disables the thread)\n", DEFAULT_RING_SIZE);
+	printf("\t-Rdrop: Drop the oldest buffered events when the analysis falls behind, instead of blocking the receive thread\n");
+	printf("\t-replay[speed]: Replay file1 through the online receive thread at speed times the recorded trigger rate (default: 1, 0 for as fast as possible), then report the load\n");
+	printf("\t-Msize: Number of head and tail events kept after a coincidence for reuse as singles (default: %d)\n", DEFAULT_PROCESSED_SIZE);
+	printf("\t-Lprescale: Maximum singles prescale when shedding load online (default: %d, 0 disables load shedding)\n", DEFAULT_MAX_PRESCALE);
+	printf("\t-Amsec: Warn when the 99th percentile time from receipt of an event until its histograms are filled is above msec (online and replay; also /Analyzer/Latency/total/alarm_ms in the ODB)\n");
+	printf("\t-S[n]: Time 1 in n calls (default: 1) of each analysis stage, as rootana::gProfile (and in the ODB, online)\n");
+	printf("\t-W: Re-read variables changed in the ODB during a run, instead of only at run start (online only)\n");
+	printf("\t-lazy: Calculate only the derived parameters (BGO sums, TOFs, etc.) read by histograms and cuts\n");
+	printf("\t-shm[name]: Publish histogram contents in a shared memory segment for local viewers (default: /dragon_histos, online only)\n");
   printf("\t-P: Start the TNetDirectory server on specified tcp port (for use with roody -Plocalhost:9091)\n");
+	printf("\t-Dport: Also serve compressed updates of changed histograms on this tcp port (online only)\n");
   printf("\t-e: Number of events to read from input data files\n");
   printf("\n");
   exit(1);
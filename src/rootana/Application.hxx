@@ -5,11 +5,16 @@
  */
 #ifndef ROOTANA_DRAGON_HXX
 #define ROOTANA_DRAGON_HXX
-#include <list>
 #include <memory>
 #include <TApplication.h>
 #include "Dragon.hxx"
 #include "Directory.hxx"
+#include "LoadShedder.hxx"
+#include "ProfileStats.hxx"
+#include "LatencyStats.hxx"
+#ifndef __MAKECINT__
+#include "utils/EventCache.hxx"
+#endif
 
 
 class TFile;
@@ -20,12 +25,16 @@ namespace tstamp { class Queue; class Diagnostics; }
 namespace rootana {
 
 class MidasOnline;
+class Receiver;
+class HistServer;
+class HistShm;
+class Hotlinks;
 
 /// Application class for dragon rootana
 class App: public TApplication {
 
 	/// Tells the running mode of the application
-	enum Mode_t { ONLINE, OFFLINE };
+	enum Mode_t { ONLINE, OFFLINE, REPLAY };
 
 private:
 	int fRunNumber; ///< Current run number
@@ -33,19 +42,38 @@ private:
 	int fCutoff;    ///< Event cutoff (offline only)
 	int fReturn;    ///< Return value
 	int fTcp;       ///< TCP port value
+	int fDeltaPort; ///< Changed-histogram server port, 0 if none
+	int fRingSize;  ///< Online receive ring size (events), 0 to receive in the event loop
+	int fRingOverflow; ///< Receive ring overflow policy, see Receiver::Overflow_t
+	int fRequestId; ///< Online event request id, -1 if none
+	int fProfile;   ///< Time 1 in fProfile calls of each analysis stage, 0 if not profiling
+	bool fWatchOdb; ///< Re-read variables changed in the ODB during a run (online only)
+	bool fLazy;     ///< Calculate only the derived parameters read by histograms and cuts
 	double fCoincWindow;        ///< Coincidence window for timestamping
+	double fReplaySpeed;        ///< Replay rate relative to the recorded one, 0 as fast as possible, < 0 if not replaying
+	size_t fQueueHighWater;     ///< Largest timestamp queue size so far
 	std::string fFilename;      ///< Offline file name
 	std::string fHost;          ///< Online host name
 	std::string fExpt;          ///< Online experiment name
 	std::string fHistos;        ///< Histogram specification file (online + file)
 	std::string fHistosOnline;  ///< Histogram specification file (online only)
+	std::string fShmName;       ///< Shared-memory histogram segment name, empty if none
 	std::auto_ptr<rootana::OfflineDirectory> fOutputFile;      ///< Online/offline histograms
 	std::auto_ptr<rootana::OnlineDirectory>  fOnlineHists;     ///< Online-only histograms
 	std::auto_ptr<midas::Database> fOdb;        ///< Online/offline database
 	std::auto_ptr<tstamp::Queue> fQueue;        ///< Timestamping queue
 	std::auto_ptr<MidasOnline> fMidasOnline;    ///< "Online midas" instance
-	std::list<dragon::Head> fHeadProcessed;     ///< Head events already unpacked
-	std::list<dragon::Tail> fTailProcessed;     ///< Tail events already unpacked
+	std::auto_ptr<Receiver> fReceiver;          ///< Online (or replay) receive thread
+	std::auto_ptr<HistServer> fHistServer;      ///< Changed-histogram server
+	std::auto_ptr<HistShm> fHistShm;            ///< Shared-memory histogram segment
+	std::auto_ptr<Hotlinks> fHotlinks;          ///< Watches of the variables directories
+	rootana::LoadShedder fShedder;              ///< Online load shedding controller
+#ifndef __MAKECINT__
+	rootana::ProfileMonitor fProfiler;          ///< Stage timing statistics
+	rootana::LatencyMonitor fLatency;           ///< Event latency statistics (online and replay)
+	dragon::utils::EventCache<dragon::Head> fHeadProcessed; ///< Head events already unpacked for coincidences
+	dragon::utils::EventCache<dragon::Tail> fTailProcessed; ///< Tail events already unpacked for coincidences
+#endif
 
 public:
 	/// Calls TApplication constructor
@@ -90,6 +118,12 @@ public:
 	/// Process online MIDAS data
 	int midas_online(const char* host = "", const char* experiment = "dragon");
 
+	/// Replay a MIDAS file through the online event path
+	int midas_replay(const char* fname);
+
+	/// Handle an event of a replayed file
+	void handle_replay_event(const void* pheader, const void* pdata, int size);
+
 	/// Deletes fQueue if it's non-null;
 	virtual ~App();
 
@@ -103,9 +137,42 @@ private:
 	/// Handles cleanup for destructor or Terminate()
 	void do_exit();
 
+	/// (Re-)requests online events with a given sampling type
+	bool request_events(int samplingType);
+
 	/// Fills all histos w/ a specific event ID
 	void fill_hists(uint16_t eid);
 
+	/// Records the time an event spent in the timestamp queue, if it was stamped
+	void record_queue_latency(const midas::Event& event);
+
+	/// Records the time from receipt of an event until its histograms were filled, if it was stamped
+	void record_fill_latency(const midas::Event& event);
+
+public:
+	/// Fills all histos with the values buffered by batched fills
+	void flush_hists();
+
+	/// Hands the histograms changed since the last call to the changed-histogram server and the shared-memory segment
+	void snapshot_hists();
+
+	/// Handles events waiting in the receive ring, for up to \e maxSec seconds
+	void drain_receiver(double maxSec);
+
+	/// Updates the load shedding controller from the current backlog
+	void update_load();
+
+	/// Updates the stage timing statistics, if profiling
+	void update_profile();
+
+	/// Updates the event latency statistics and alarms (online and replay)
+	void update_latency();
+
+	/// Re-reads the variables changed in the ODB, if watching it
+	void update_variables();
+
+private:
+
 	ClassDef (rootana::App, 0);
 };
 
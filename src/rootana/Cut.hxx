@@ -30,15 +30,22 @@
  * j = 2;
  * cut3(); // false
  * \endcode
+ *
+ * For repeated evaluation, a Condition tree can be flattened into a rootana::CutProgram,
+ * which replaces the chain of virtual calls through nested Cut instances by a short
+ * sequence of tests and (short-circuiting) jumps. rootana::CutTable uses these to share
+ * cuts between histograms, evaluating each distinct cut at most once per event.
  */
 #ifndef ROOTANA_CUT_HXX
 #define ROOTANA_CUT_HXX
 #include <functional>
 #include <algorithm>
+#include <string>
 #include <vector>
 #include <TCutG.h>
 #include "utils/ErrorDragon.hxx"
 #include "utils/Functions.hxx"
+#include "utils/PolygonGate.hxx"
 
 /// Point-by-point arguments for use with rootana::Condition2D
 #define ROOTANA_CUT2D_POINT_ARGS double x0 = 0, double y0 = 0, double x1 = 0, double y1 = 0, double x2 = 0, double y2 = 0, double x3 = 0, double y3 = 0, double x4 = 0, double y4 = 0, double x5 = 0, double y5 = 0, double x6 = 0, double y6 = 0, double x7 = 0, double y7 = 0, double x8 = 0, double y8 = 0, double x9 = 0, double y9 = 0, double x10 = 0, double y10 = 0, double x11 = 0, double y11 = 0, double x12 = 0, double y12 = 0, double x13 = 0, double y13 = 0
@@ -48,6 +55,67 @@
 
 namespace rootana {
 
+class Condition;
+
+/// Flattened form of a Condition tree
+/*!
+ * A program is a sequence of instructions acting on a single boolean "accumulator":
+ *   - kTest sets it to the result of a test function applied to two arguments
+ *     (typically the addresses of the parameters being compared)
+ *   - kNot negates it
+ *   - kJumpIfFalse, kJumpIfTrue skip to another instruction depending on its value,
+ *     which implements the short-circuiting of logical AND and OR.
+ *
+ * The result is the accumulator after the last instruction. Instructions refer into
+ * the Condition from which the program was compiled, which must outlive the program.
+ */
+class CutProgram {
+public:
+	/// Test function of a kTest instruction
+	typedef bool (*Test_t)(const void*, const void*);
+
+	/// Instruction codes
+	enum Op_t { kTest, kNot, kJumpIfFalse, kJumpIfTrue };
+
+	/// Single instruction
+	struct Instruction_t {
+		Int_t  fOp;    ///< Instruction code (Op_t)
+		Test_t fTest;  ///< Test function (kTest)
+		const void* fArg1; ///< First test argument (kTest)
+		const void* fArg2; ///< Second test argument (kTest)
+		size_t fJump;  ///< Destination instruction (kJumpIfFalse, kJumpIfTrue)
+	};
+
+private:
+	/// Instructions
+	std::vector<Instruction_t> fCode;
+
+public:
+	/// Empty program (always true)
+	CutProgram() { }
+	/// Compile from a Condition tree
+	explicit CutProgram(const Condition& condition);
+
+	/// Append a test
+	void emit_test(Test_t test, const void* arg1, const void* arg2)
+		{ Instruction_t i = { kTest, test, arg1, arg2, 0 }; fCode.push_back(i); }
+	/// Append a negation
+	void emit_not()
+		{ Instruction_t i = { kNot, 0, 0, 0, 0 }; fCode.push_back(i); }
+	/// Append a jump, returns its position for patch()
+	size_t emit_jump(Int_t op)
+		{ Instruction_t i = { op, 0, 0, 0, 0 }; fCode.push_back(i); return fCode.size() - 1; }
+	/// Set the destination of a jump to the next instruction to be appended
+	void patch(size_t jump)
+		{ fCode[jump].fJump = fCode.size(); }
+
+	/// Number of instructions
+	size_t size() const { return fCode.size(); }
+
+	/// Run the program
+	bool operator() () const;
+};
+
 /// Abstract class defining a logical condition.
 class Condition {
 public:
@@ -58,6 +126,12 @@ public:
 	/// Defines the "cut" logical condition
 	virtual bool operator() () const = 0;
 
+	/// Appends the instructions evaluating \c this to a CutProgram
+	/*! The default emits a single test calling operator() (virtually); derived
+	 *  classes override this to avoid the virtual call */
+	virtual void compile(CutProgram& program) const
+		{ program.emit_test(&Condition::test_, this, 0); }
+
 	/// Empty
 	virtual ~Condition(){ }
 
@@ -72,6 +146,11 @@ public:
 	/// Logical NOT of \c this Condition
 	bool operator!() const
 		{ return !( operator()() ); }
+
+private:
+	/// Test function calling operator() of \e condition
+	static bool test_(const void* condition, const void*)
+		{ return (*static_cast<const Condition*>(condition))(); }
 };
 
 /// Implementation of rootana::Condition for equivalency operators
@@ -98,6 +177,13 @@ public:
 	/// Applies comparison class's operator() to fV1 and fV2, each converted to double.
 	bool operator() () const
 		{ return F()( fV1, fV2 ); }
+	/// Emits a test comparing the values at the addresses of fV1 and fV2
+	void compile(CutProgram& program) const
+		{ program.emit_test(&Equivalency::test_, &fV1, &fV2); }
+private:
+	/// Test function for compile()
+	static bool test_(const void* v1, const void* v2)
+		{ return F()( *static_cast<const T1*>(v1), *static_cast<const T2*>(v2) ); }
 };
 
 /// Implementation of rootana::Condition for checking parameter validity
@@ -120,6 +206,13 @@ public:
 	/// Checks if fV1 is valid
 	bool operator() () const
 		{ return dragon::utils::is_valid(fV1); }
+	/// Emits a test checking the value at the address of fV1
+	void compile(CutProgram& program) const
+		{ program.emit_test(&Validity::test_, &fV1, 0); }
+private:
+	/// Test function for compile()
+	static bool test_(const void* v1, const void*)
+		{ return dragon::utils::is_valid(*static_cast<const T1*>(v1)); }
 };
 
 
@@ -141,6 +234,7 @@ private:
 	const T2& fYpar; ///< Y-axis parameter value
 	std::vector<double> fXpoints; ///< X-axis contour points
 	std::vector<double> fYpoints; ///< Y-axis contour points
+	dragon::utils::PolygonGate fGate; ///< Lookup structure built from the contour points
 public:
 	/// Construct from a TCutG
 	Condition2D(const T1& xpar, const T2& ypar, TCutG& cutg);
@@ -156,30 +250,17 @@ public:
 	bool operator() () const
 		{ 
 			double parx = fXpar, pary = fYpar;
-			return inside<double> (parx, pary, fXpoints.size(), &fXpoints[0], &fYpoints[0]);
+			return fGate.IsInside(parx, pary);
 		}
 
-private:
-	/// Checks if the points are inside the polygon
-	template <typename T>
-	bool inside(T xp, T yp, Int_t np, const T* x, const T* y) const
-		{
-			/*! \note Copied from TMath::IsInside(), which has no version
-				taking const array arguments - otherwise I'd just use it directly. */
-			Int_t i, j = np-1 ;
-			Bool_t oddNodes = kFALSE;
-
-			for (i=0; i<np; i++) {
-				if ((y[i]<yp && y[j]>=yp) || (y[j]<yp && y[i]>=yp)) {
-					if (x[i]+(yp-y[i])/(y[j]-y[i])*(x[j]-x[i])<xp) {
-						oddNodes = !oddNodes;
-					}
-				}
-				j=i;
-			}
+	/// Emits a (non-virtual) test of \c this
+	void compile(CutProgram& program) const
+		{ program.emit_test(&Condition2D::test_, this, 0); }
 
-			return oddNodes;
-		}
+private:
+	/// Test function for compile()
+	static bool test_(const void* condition, const void*)
+		{ return static_cast<const Condition2D*>(condition)->Condition2D::operator()(); }
 };
 
 /// "Cut" class to be used with histograms, etc.
@@ -275,8 +356,20 @@ public:
 	/// Returns the logical NOT of fCut().
 	bool operator() () const
 		{ return !fCut(); }
+
+	/// Compiles fCut followed by a negation
+	void compile(CutProgram& program) const
+		{ fCut->compile(program); program.emit_not(); }
 };
 
+/// Jump instruction short-circuiting a logical AND
+inline Int_t logical_jump(const std::logical_and<Condition>*)
+{ return CutProgram::kJumpIfFalse; }
+
+/// Jump instruction short-circuiting a logical OR
+inline Int_t logical_jump(const std::logical_or<Condition>*)
+{ return CutProgram::kJumpIfTrue; }
+
 /// Implementation of condition for binary logicals (AND, OR).
 /*!
  * Stores two Cuts and applies a binary logical operator to them.
@@ -300,6 +393,15 @@ public:
 	/// Applies the operator() of template parameter L.
 	bool operator() () const
 		{ return L() (*fCut1, *fCut2); }
+
+	/// Compiles fCut1, a jump past fCut2 if it decides the result, then fCut2
+	void compile(CutProgram& program) const
+		{
+			fCut1->compile(program);
+			const size_t jump = program.emit_jump(logical_jump(static_cast<const L*>(0)));
+			fCut2->compile(program);
+			program.patch(jump);
+		}
 };
 
 /// Implementation of an always TRUE condition
@@ -315,6 +417,13 @@ public:
 	/// Returns \c true
 	bool operator() () const
 		{ return true; }
+
+	/// Emits a constant test
+	void compile(CutProgram& program) const
+		{ program.emit_test(&TrueCondition::test_, 0, 0); }
+private:
+	/// Test function for compile()
+	static bool test_(const void*, const void*) { return true; }
 };
 
 /// Implementation of an always FALSE condition
@@ -330,6 +439,73 @@ public:
 	/// Returns \c false
 	bool operator() () const
 		{ return false; }
+
+	/// Emits a constant test
+	void compile(CutProgram& program) const
+		{ program.emit_test(&FalseCondition::test_, 0, 0); }
+private:
+	/// Test function for compile()
+	static bool test_(const void*, const void*) { return false; }
+};
+
+
+/// Table of distinct cuts, shared between histograms
+/*!
+ * Cuts are interned by a key (in rootana::HistParser, the cut's definition text with
+ * white space removed, prefixed by an id of the parser), so histograms gated on the same
+ * condition share one entry. Each entry is compiled into a CutProgram and evaluated at
+ * most once per event: its result is cached in a bitset until new_event() is called.
+ * Entries are reference counted by their users (acquire(), release()) and freed when
+ * no longer used.
+ * \attention new_event() must be called before filling the histograms of each event.
+ */
+class CutTable {
+private:
+	std::vector<std::string> fKeys;    ///< Key of each cut
+	std::vector<Cut*> fCuts;           ///< Cut conditions (owned), NULL for free entries
+	std::vector<Int_t> fRefs;          ///< Number of users of each cut
+	std::vector<CutProgram> fPrograms; ///< Compiled form of fCuts
+	std::vector<ULong64_t> fDone;      ///< Bit set for each cut evaluated in this event
+	std::vector<ULong64_t> fPass;      ///< Bit set for each cut passed in this event
+
+public:
+	/// Returns the process-wide table
+	static CutTable& instance()
+		{ static CutTable table; return table; }
+	/// Frees the cuts
+	~CutTable();
+
+	/// Index of the cut with a given key, -1 if there is none
+	Int_t find(const std::string& key) const;
+	/// Add a cut, or return the index of the existing one if \e key is known
+	Int_t intern(const std::string& key, const Cut& cut);
+	/// Register a user of cut number \e index
+	void acquire(Int_t index) { ++fRefs[index]; }
+	/// Unregister a user of cut number \e index, freeing it if it was the last
+	void release(Int_t index);
+	/// Number of entries (including free ones)
+	Int_t size() const { return fCuts.size(); }
+
+	/// Evaluate cut number \e index, once per event
+	bool operator() (Int_t index)
+		{
+			const ULong64_t bit = 1ULL << (index & 63);
+			ULong64_t& done = fDone[index >> 6];
+			if (!(done & bit)) {
+				done |= bit;
+				if (fPrograms[index]()) fPass[index >> 6] |= bit;
+				else fPass[index >> 6] &= ~bit;
+			}
+			return fPass[index >> 6] & bit;
+		}
+	/// Forget the cached results of the previous event
+	void new_event()
+		{ std::fill(fDone.begin(), fDone.end(), 0); }
+
+private:
+	CutTable() { }
+	CutTable(const CutTable&);
+	CutTable& operator= (const CutTable&);
 };
 
 
@@ -345,6 +521,79 @@ inline Cut Cut::operator&& (const Cut& other) const
 inline Cut Cut::operator|| (const Cut& other) const
 { Cut c(new LogicalCondition<std::logical_or<Condition> > (*this, other)); return c; }
 
+inline CutProgram::CutProgram(const Condition& condition)
+{
+	condition.compile(*this);
+}
+
+inline bool CutProgram::operator() () const
+{
+	bool acc = true;
+	const Instruction_t* const begin = fCode.empty() ? 0 : &fCode[0];
+	const Instruction_t* const end = begin + fCode.size();
+	for (const Instruction_t* pc = begin; pc < end; ++pc) {
+		switch (pc->fOp) {
+		case kTest:        acc = pc->fTest(pc->fArg1, pc->fArg2); break;
+		case kNot:         acc = !acc; break;
+		case kJumpIfFalse: if (!acc) pc = begin + pc->fJump - 1; break;
+		case kJumpIfTrue:  if (acc)  pc = begin + pc->fJump - 1; break;
+		default: break;
+		}
+	}
+	return acc;
+}
+
+inline CutTable::~CutTable()
+{
+	for (size_t i=0; i< fCuts.size(); ++i)
+		delete fCuts[i];
+}
+
+inline Int_t CutTable::find(const std::string& key) const
+{
+	for (size_t i=0; i< fKeys.size(); ++i)
+		if (fCuts[i] && fKeys[i] == key) return i;
+	return -1;
+}
+
+inline Int_t CutTable::intern(const std::string& key, const Cut& cut)
+{
+	/*!
+	 * \param key Key identifying the cut
+	 * \param cut Cut condition, copied into the table
+	 * \returns Index of the cut, for use with operator(); the new entry has no users
+	 *  until acquire() is called.
+	 */
+	Int_t index = find(key);
+	if (index >= 0) return index;
+	index = std::find(fCuts.begin(), fCuts.end(), (Cut*)0) - fCuts.begin();
+	if (index == (Int_t)fCuts.size()) {
+		fKeys.push_back("");
+		fCuts.push_back(0);
+		fRefs.push_back(0);
+		fPrograms.push_back(CutProgram());
+		if (fCuts.size() > 64*fDone.size()) {
+			fDone.push_back(0);
+			fPass.push_back(0);
+		}
+	}
+	fKeys[index] = key;
+	fCuts[index] = new Cut(cut);
+	fRefs[index] = 0;
+	fPrograms[index] = CutProgram(*fCuts[index]->get());
+	fDone[index >> 6] &= ~(1ULL << (index & 63));
+	return index;
+}
+
+inline void CutTable::release(Int_t index)
+{
+	if (--fRefs[index] > 0) return;
+	delete fCuts[index];
+	fCuts[index] = 0;
+	fKeys[index].clear();
+	fPrograms[index] = CutProgram();
+}
+
 // Also implement long Condition2D constructors here
 template <class T1, class T2>
 inline Condition2D<T1, T2>::Condition2D(const T1& xpar, const T2& ypar, TCutG& cutg):
@@ -357,6 +606,7 @@ inline Condition2D<T1, T2>::Condition2D(const T1& xpar, const T2& ypar, TCutG& c
 	 */
 	std::copy (cutg.GetX(), cutg.GetX() + fXpoints.size(), fXpoints.begin());
 	std::copy (cutg.GetY(), cutg.GetY() + fYpoints.size(), fYpoints.begin());
+	fGate.Set(fXpoints.size(), &fXpoints[0], &fYpoints[0]);
 }
 
 template <class T1, class T2>
@@ -398,6 +648,7 @@ inline Condition2D<T1, T2>::Condition2D(const T1& xpar, const T2& ypar, ROOTANA_
 	else {
 		dragon::utils::Warning("Condition2D") << "Empty polygon specification";
 	}
+	fGate.Set(fXpoints.size(), &fXpoints[0], &fYpoints[0]);
 }
 
 } // namespace rootana
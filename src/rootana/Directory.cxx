@@ -38,9 +38,12 @@ void rootana::Directory::DeleteHists()
 		it->second.clear();
 	}
 	fHistos.clear();
+	fHeadDerived = fTailDerived = 0;
 }
 
 rootana::Directory::Directory(TDirectory* dir):
+	fHeadDerived(0),
+	fTailDerived(0),
 	fDir(dir)
 {
 	VerboseNetDirectoryServer(true);
@@ -111,6 +114,7 @@ void rootana::Directory::CreateHists(const char* definitionFile)
 
 	rootana::HistParser parse (definitionFile);
 	parse.Run();
+	parse.AddDerived(fHeadDerived, fTailDerived);
 	parse.Transfer(this);
 }
 
@@ -157,6 +161,7 @@ rootana::OfflineDirectory::OfflineDirectory(const char* outPath):
 rootana::OfflineDirectory::~OfflineDirectory()
 {
 	if(IsOpen()) {
+		CallForAll(&rootana::HistBase::flush);
 		Write();
 		DeleteHists();
 		Reset(0); // calls TFile::Close()
@@ -199,6 +204,7 @@ void rootana::OfflineDirectory::Close()
  * \attention DeleteHists() must be called before Reset(0); see warning in fDir for why.
  */
 	if(IsOpen()) {
+		CallForAll(&rootana::HistBase::flush);
 		Write();
 		DeleteHists();
 		Reset(0); // calls TFile::Close()
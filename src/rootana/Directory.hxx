@@ -38,6 +38,11 @@ private:
 	/*! See Map_t typedef */
 	Map_t fHistos;
 
+	/// Derived dragon::Head parameters read by the histograms (Head::Derived_t bits)
+	Int_t fHeadDerived;
+	/// Derived dragon::Tail parameters read by the histograms (Tail::Derived_t bits)
+	Int_t fTailDerived;
+
 	/// Internal ROOT directory
 	/*!
 	 * \note Derived classes may set this to a specific type using the Reset() method.
@@ -68,6 +73,11 @@ public:
 	virtual bool Open(Int_t, const char*) = 0;
 	/// Virtual method to close (cleanup) the directory
 	virtual void Close() = 0;
+	/// Returns all histograms, keyed by event id
+	const Map_t& GetHists() const { return fHistos; }
+	/// Adds the derived parameters read by the histograms and their cuts (see HistParser::AddDerived())
+	void AddDerived(Int_t& head, Int_t& tail) const
+		{ head |= fHeadDerived; tail |= fTailDerived; }
 
 protected:
 	/// Parse definition file and create histograms
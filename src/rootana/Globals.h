@@ -12,6 +12,10 @@
 // DRAGON Globals //
 #include "Dragon.hxx"
 #include "TStamp.hxx"
+#include "Receiver.hxx"
+#include "LoadShedder.hxx"
+#include "ProfileStats.hxx"
+#include "LatencyStats.hxx"
 
 #ifndef G__DICTIONARY
 /// Provide 'extern' linkage except in CINT dictionary
@@ -25,6 +29,18 @@ namespace rootana {
 /// Global timestamp diagnostics class
 EXTERN tstamp::Diagnostics gDiagnostics;
 
+/// Global online receive thread statistics
+EXTERN rootana::ReceiverStats gReceiver;
+
+/// Global online load shedding state
+EXTERN rootana::LoadStats gLoad;
+
+/// Global analysis stage timing
+EXTERN rootana::ProfileStats gProfile;
+
+/// Global event latency statistics
+EXTERN rootana::LatencyStats gLatency;
+
 /// Gloal gamma event class
 EXTERN dragon::Head gHead;
 
@@ -1,14 +1,27 @@
 /// \file HistParser.cxx
 /// \author G. Christian
 /// \brief Implements HistParser.hxx
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <typeinfo>
 #include <algorithm>
+#include <functional>
 #include <stdexcept>
 #include <sstream>
 #include <TROOT.h>
+#include <TList.h>
+#include <TClass.h>
+#include <TSystem.h>
+#include <TDataType.h>
+#include <TBaseClass.h>
+#include <TDataMember.h>
 #include <TDirectory.h>
 #include "midas.h"
 #include "utils/definitions.h"
 #include "utils/ErrorDragon.hxx"
+#include "Globals.h"
 #include "Histos.hxx"
 #include "Directory.hxx"
 #include "HistParser.hxx"
@@ -18,7 +31,7 @@
 
 namespace {
 
-struct replace_tab { 
+struct replace_tab {
 	void operator() (char& c)
 		{ if (c == '\t') c = ' '; }
 };
@@ -37,6 +50,10 @@ inline Int_t get_type(const std::string& spar)
 	else if (contains(spar, "rootana::gTail"))        return DRAGON_TAIL_EVENT;
 	else if (contains(spar, "rootana::gCoinc"))       return DRAGON_COINC_EVENT;
 	else if (contains(spar, "rootana::gDiagnostics")) return 6; // timestamp diagnostics
+	else if (contains(spar, "rootana::gReceiver"))    return 7; // receive thread statistics
+	else if (contains(spar, "rootana::gLoad"))        return 8; // load shedding state
+	else if (contains(spar, "rootana::gProfile"))     return 9; // analysis stage timing
+	else if (contains(spar, "rootana::gLatency"))     return 10; // event latency
 	else return -1;
 }
 
@@ -46,7 +63,10 @@ inline void throw_bad_line(const std::string& line, int linenum, const char* fna
 	error << "Bad line in file \"" << fname << "\": "<< line << ", line number: " << linenum;
 	if(pcmd) error << "\n(Cmd: " << pcmd->str() << " )";
 	throw std::invalid_argument (error.str().c_str());
-}	
+}
+
+// Id of the next parser created
+unsigned gNextParserId = 0;
 
 inline void throw_missing_arg(const char* which, int linenum, const char* fname)
 {
@@ -55,6 +75,718 @@ inline void throw_missing_arg(const char* which, int linenum, const char* fname)
 	throw std::invalid_argument (error.str().c_str());
 }
 
+typedef rootana::HistParser::Entry Entry_t;
+typedef std::vector<rootana::HistParser::CutToken> CutTokens_t;
+
+// Types of definitions (Entry::fKind)
+enum { kDir, kCommand, kCut, kHist1, kHist2, kHist3, kSummary, kScaler, kRate };
+
+// Instructions of a natively parsed cut (CutToken::fOp)
+enum { kLess, kGreater, kEqual, kNotEqual, kLessEqual, kGreaterEqual,
+			 kIsValid, kNot, kAnd, kOr, kTrue, kFalse };
+
+
+// NATIVE PARSING //
+
+inline std::string trim(const std::string& s)
+{
+	const size_t begin = s.find_first_not_of(" \r");
+	if (begin >= s.size()) return "";
+	return s.substr(begin, s.find_last_not_of(" \r") - begin + 1);
+}
+
+inline void skip_space(const std::string& s, size_t& pos)
+{
+	while (pos < s.size() && (s[pos] == ' ' || s[pos] == '\r')) ++pos;
+}
+
+// Skips white space, then \e token if it's next
+inline bool expect(const std::string& s, size_t& pos, const char* token)
+{
+	skip_space(s, pos);
+	const size_t n = strlen(token);
+	if (s.compare(pos, n, token) != 0) return false;
+	pos += n;
+	return true;
+}
+
+bool parse_number(const std::string& text, Double_t& value)
+{
+	const std::string s = trim(text);
+	if (s.empty()) return false;
+	char* end;
+	value = strtod(s.c_str(), &end);
+	return *end == '\0';
+}
+
+// Parameter path, e.g. "rootana::gHead.bgo.ecal[0]" -> "gHead.bgo.ecal[0]"
+bool parse_path(const std::string& text, std::string& path)
+{
+	std::string s = trim(text);
+	if (!s.empty() && s[s.size() - 1] == ';') s = trim(s.substr(0, s.size() - 1));
+	if (s.compare(0, 9, "rootana::") == 0) s.erase(0, 9);
+
+	bool name = true; // expecting a name
+	for (size_t i = 0; i < s.size(); ) {
+		if (name) {
+			if (!isalpha(s[i]) && s[i] != '_') return false;
+			while (i < s.size() && (isalnum(s[i]) || s[i] == '_')) ++i;
+			name = false;
+		}
+		else if (s[i] == '.') {
+			++i;
+			name = true;
+		}
+		else if (s[i] == '[') {
+			const size_t close = s.find(']', i);
+			if (close >= s.size() || close == i + 1) return false;
+			for (++i; i < close; ++i) if (!isdigit(s[i])) return false;
+			++i;
+		}
+		else return false;
+	}
+	if (name) return false; // empty or ends in '.'
+	path = s;
+	return true;
+}
+
+bool parse_string(const std::string& s, size_t& pos, std::string& out)
+{
+	if (!expect(s, pos, "\"")) return false;
+	out.clear();
+	for (; pos < s.size(); ++pos) {
+		if (s[pos] == '"') {
+			++pos;
+			return true;
+		}
+		if (s[pos] == '\\') { // other escapes are left to the interpreter
+			if (++pos == s.size() || (s[pos] != '"' && s[pos] != '\\')) return false;
+		}
+		out += s[pos];
+	}
+	return false;
+}
+
+// Reads a function argument, up to the next ',' or ')' outside of brackets
+std::string read_arg(const std::string& s, size_t& pos)
+{
+	const size_t begin = pos;
+	for (int depth = 0; pos < s.size(); ++pos) {
+		const char c = s[pos];
+		if (c == '(' || c == '[') ++depth;
+		else if (depth > 0 && (c == ')' || c == ']')) --depth;
+		else if (depth == 0 && (c == ',' || c == ')')) break;
+	}
+	return s.substr(begin, pos - begin);
+}
+
+// Histogram arguments: ("name", "title", nbins, low, high[, nbins, low, high...])
+void parse_spec(Entry_t& entry, size_t naxes)
+{
+	const std::string& s = entry.fText.at(0);
+	size_t pos = 0;
+	std::string name, title;
+	if (!expect(s, pos, "(") || !parse_string(s, pos, name) ||
+			!expect(s, pos, ",") || !parse_string(s, pos, title)) return;
+
+	std::vector<Double_t> bins;
+	for (size_t i = 0; i < 3*naxes; ++i) {
+		Double_t value;
+		if (!expect(s, pos, ",") || !parse_number(read_arg(s, pos), value)) return;
+		if (i % 3 == 0 && (value < 1 || value != Int_t(value))) return;
+		bins.push_back(value);
+	}
+	if (!expect(s, pos, ")")) return;
+	expect(s, pos, ";");
+	skip_space(s, pos);
+	if (pos != s.size()) return;
+
+	entry.fName = name;
+	entry.fTitle = title;
+	entry.fBins = bins;
+}
+
+// Histogram arguments, then one parameter per line
+void parse_hist(Entry_t& entry, size_t naxes, size_t nparams)
+{
+	parse_spec(entry, naxes);
+	entry.fParams.resize(nparams);
+	for (size_t i = 0; i < nparams; ++i)
+		if (!parse_path(entry.fText.at(i + 1), entry.fParams[i])) entry.fParams[i] = "";
+}
+
+void parse_summary(Entry_t& entry)
+{
+	parse_hist(entry, 1, 1);
+	Double_t length;
+	if (parse_number(entry.fText.at(2), length) && length >= 1 && length == UInt_t(length))
+		entry.fLength = UInt_t(length);
+}
+
+// Cut functions handled natively
+struct CutFunction_t {
+	const char* fName; // Function name (see Cut.hxx)
+	Int_t fOp;         // Instruction
+	Int_t fValues;     // Number of value (number or parameter) arguments
+	Int_t fCuts;       // Number of cut arguments
+};
+
+const CutFunction_t kCutFunctions[] = {
+	{ "Less",         kLess,         2, 0 },
+	{ "Greater",      kGreater,      2, 0 },
+	{ "Equal",        kEqual,        2, 0 },
+	{ "NotEqual",     kNotEqual,     2, 0 },
+	{ "LessEqual",    kLessEqual,    2, 0 },
+	{ "GreaterEqual", kGreaterEqual, 2, 0 },
+	{ "IsValid",      kIsValid,      1, 0 },
+	{ "Not",          kNot,          0, 1 },
+	{ "And",          kAnd,          0, 2 },
+	{ "Or",           kOr,           0, 2 },
+	{ "True",         kTrue,         0, 0 },
+	{ "False",        kFalse,        0, 0 }
+};
+
+void push_token(CutTokens_t& out, Int_t op, const std::string& arg1 = "", const std::string& arg2 = "")
+{
+	rootana::HistParser::CutToken token;
+	token.fOp = op;
+	token.fArg1 = arg1;
+	token.fArg2 = arg2;
+	out.push_back(token);
+}
+
+bool parse_value(const std::string& text, std::string& value)
+{
+	Double_t number;
+	if (parse_number(text, number)) {
+		value = trim(text);
+		return true;
+	}
+	return parse_path(text, value);
+}
+
+// Recursive descent, in order of increasing precedence: ||, &&, then
+// !, parentheses and function calls. Instructions are appended in postfix order.
+bool parse_or(const std::string& s, size_t& pos, CutTokens_t& out);
+
+bool parse_unary(const std::string& s, size_t& pos, CutTokens_t& out)
+{
+	if (expect(s, pos, "!")) {
+		if (!parse_unary(s, pos, out)) return false;
+		push_token(out, kNot);
+		return true;
+	}
+	if (expect(s, pos, "("))
+		return parse_or(s, pos, out) && expect(s, pos, ")");
+
+	expect(s, pos, "rootana::");
+	const size_t begin = pos;
+	while (pos < s.size() && (isalnum(s[pos]) || s[pos] == '_')) ++pos;
+	const std::string name = s.substr(begin, pos - begin);
+
+	const CutFunction_t* function = 0;
+	for (size_t i = 0; i < sizeof(kCutFunctions) / sizeof(kCutFunctions[0]) && !function; ++i)
+		if (name == kCutFunctions[i].fName) function = &kCutFunctions[i];
+	if (!function || !expect(s, pos, "(")) return false;
+
+	std::string values[2];
+	for (Int_t i = 0; i < function->fValues; ++i) {
+		if (i > 0 && !expect(s, pos, ",")) return false;
+		if (!parse_value(read_arg(s, pos), values[i])) return false;
+	}
+	for (Int_t i = 0; i < function->fCuts; ++i) {
+		if (i > 0 && !expect(s, pos, ",")) return false;
+		if (!parse_or(s, pos, out)) return false;
+	}
+	if (!expect(s, pos, ")")) return false;
+	push_token(out, function->fOp, values[0], values[1]);
+	return true;
+}
+
+bool parse_and(const std::string& s, size_t& pos, CutTokens_t& out)
+{
+	if (!parse_unary(s, pos, out)) return false;
+	while (expect(s, pos, "&&")) {
+		if (!parse_unary(s, pos, out)) return false;
+		push_token(out, kAnd);
+	}
+	return true;
+}
+
+bool parse_or(const std::string& s, size_t& pos, CutTokens_t& out)
+{
+	if (!parse_and(s, pos, out)) return false;
+	while (expect(s, pos, "||")) {
+		if (!parse_and(s, pos, out)) return false;
+		push_token(out, kOr);
+	}
+	return true;
+}
+
+void parse_cut(Entry_t& entry)
+{
+	const std::string& s = entry.fText.at(0);
+	CutTokens_t tokens;
+	size_t pos = 0;
+	if (!parse_or(s, pos, tokens)) return;
+	expect(s, pos, ";");
+	skip_space(s, pos);
+	if (pos == s.size()) entry.fCut.swap(tokens);
+}
+
+
+// DEFINITION CACHE //
+
+const char kCacheMagic[8] = { 'R', 'H', 'P', 'C', '0', '0', '0', '1' };
+
+inline std::string cache_path(const char* filename)
+{
+	return std::string(filename) + ".cache";
+}
+
+// Size and modification time of the definition file
+bool source_stamp(const char* filename, Long64_t& size, Long64_t& mtime)
+{
+	FileStat_t st;
+	if (gSystem->GetPathInfo(filename, st) != 0) return false;
+	size = st.fSize;
+	mtime = st.fMtime;
+	return true;
+}
+
+template <class T>
+bool put(FILE* fp, const T& value)
+{
+	return fwrite(&value, sizeof(T), 1, fp) == 1;
+}
+
+template <class T>
+bool get(FILE* fp, T& value)
+{
+	return fread(&value, sizeof(T), 1, fp) == 1;
+}
+
+bool put_string(FILE* fp, const std::string& s)
+{
+	const UInt_t n = s.size();
+	return put(fp, n) && (n == 0 || fwrite(s.data(), n, 1, fp) == 1);
+}
+
+bool get_string(FILE* fp, std::string& s)
+{
+	UInt_t n;
+	if (!get(fp, n) || n > (1 << 20)) return false;
+	s.resize(n);
+	return n == 0 || fread(&s[0], n, 1, fp) == 1;
+}
+
+template <class T>
+bool put_vector(FILE* fp, const std::vector<T>& v)
+{
+	const UInt_t n = v.size();
+	return put(fp, n) && (n == 0 || fwrite(&v[0], sizeof(T), n, fp) == n);
+}
+
+template <class T>
+bool get_vector(FILE* fp, std::vector<T>& v)
+{
+	UInt_t n;
+	if (!get(fp, n) || n > (1 << 20)) return false;
+	v.resize(n);
+	return n == 0 || fread(&v[0], sizeof(T), n, fp) == n;
+}
+
+bool put_strings(FILE* fp, const std::vector<std::string>& v)
+{
+	bool ok = put(fp, UInt_t(v.size()));
+	for (size_t i = 0; ok && i < v.size(); ++i) ok = put_string(fp, v[i]);
+	return ok;
+}
+
+bool get_strings(FILE* fp, std::vector<std::string>& v)
+{
+	UInt_t n;
+	if (!get(fp, n) || n > (1 << 20)) return false;
+	v.resize(n);
+	bool ok = true;
+	for (size_t i = 0; ok && i < v.size(); ++i) ok = get_string(fp, v[i]);
+	return ok;
+}
+
+bool put_entry(FILE* fp, const Entry_t& entry)
+{
+	bool ok = put(fp, entry.fKind) && put_strings(fp, entry.fText) && put_vector(fp, entry.fLines) &&
+		put_string(fp, entry.fName) && put_string(fp, entry.fTitle) && put_vector(fp, entry.fBins) &&
+		put_strings(fp, entry.fParams) && put(fp, entry.fLength) && put(fp, UInt_t(entry.fCut.size()));
+	for (size_t i = 0; ok && i < entry.fCut.size(); ++i)
+		ok = put(fp, entry.fCut[i].fOp) && put_string(fp, entry.fCut[i].fArg1) && put_string(fp, entry.fCut[i].fArg2);
+	return ok;
+}
+
+bool get_entry(FILE* fp, Entry_t& entry)
+{
+	UInt_t ncut = 0;
+	bool ok = get(fp, entry.fKind) && get_strings(fp, entry.fText) && get_vector(fp, entry.fLines) &&
+		get_string(fp, entry.fName) && get_string(fp, entry.fTitle) && get_vector(fp, entry.fBins) &&
+		get_strings(fp, entry.fParams) && get(fp, entry.fLength) && get(fp, ncut) && ncut < (1 << 20);
+	if (ok) entry.fCut.resize(ncut);
+	for (size_t i = 0; ok && i < entry.fCut.size(); ++i)
+		ok = get(fp, entry.fCut[i].fOp) && get_string(fp, entry.fCut[i].fArg1) && get_string(fp, entry.fCut[i].fArg2);
+	if (!ok || entry.fLines.size() != entry.fText.size()) return false;
+
+	// the build stage indexes the fields by line, so check they are consistent
+	static const size_t lines[]  = { 1, 0, 1, 2, 3, 4, 3, 2, 2 }; // by kind
+	static const size_t params[] = { 0, 0, 0, 1, 2, 3, 1, 1, 1 };
+	static const size_t axes[]   = { 0, 0, 0, 1, 2, 3, 1, 1, 1 };
+	const size_t kind = entry.fKind;
+	if (kind > kRate) return false;
+	if (kind == kCommand) return true;
+	return entry.fText.size() == lines[kind] && entry.fParams.size() == params[kind] &&
+		(entry.fBins.empty() || entry.fBins.size() == 3*axes[kind]);
+}
+
+
+// PARAMETER LOOKUP //
+
+typedef double (*Read_t)(const void*);
+typedef bool (*Valid_t)(const void*);
+typedef rootana::DataPointer* (*NewPointer_t)(void*, UInt_t);
+
+template <class T>
+double read_value(const void* addr)
+{
+	return *static_cast<const T*>(addr);
+}
+
+template <class T>
+bool valid_value(const void* addr)
+{
+	return dragon::utils::is_valid(*static_cast<const T*>(addr));
+}
+
+template <class T>
+rootana::DataPointer* new_pointer(void* addr, UInt_t length)
+{
+	T* value = static_cast<T*>(addr);
+	return length ? rootana::DataPointer::New(value, length) : rootana::DataPointer::New(*value);
+}
+
+// Operations on a parameter of a given basic type
+struct TypeOps_t {
+	Read_t fRead;
+	Valid_t fValid;
+	NewPointer_t fNew;
+};
+
+template <class T>
+const TypeOps_t* type_ops_of()
+{
+	static const TypeOps_t ops = { &read_value<T>, &valid_value<T>, &new_pointer<T> };
+	return &ops;
+}
+
+const TypeOps_t* type_ops(Int_t type)
+{
+	switch (type) {
+	case kChar_t:     return type_ops_of<Char_t>();
+	case kchar:       return type_ops_of<char>();
+	case kUChar_t:    return type_ops_of<UChar_t>();
+	case kShort_t:    return type_ops_of<Short_t>();
+	case kUShort_t:   return type_ops_of<UShort_t>();
+	case kInt_t:      return type_ops_of<Int_t>();
+	case kUInt_t:     return type_ops_of<UInt_t>();
+	case kLong_t:     return type_ops_of<Long_t>();
+	case kULong_t:    return type_ops_of<ULong_t>();
+	case kLong64_t:   return type_ops_of<Long64_t>();
+	case kULong64_t:  return type_ops_of<ULong64_t>();
+	case kFloat_t:    return type_ops_of<Float_t>();
+	case kFloat16_t:  return type_ops_of<Float_t>();
+	case kDouble_t:   return type_ops_of<Double_t>();
+	case kDouble32_t: return type_ops_of<Double_t>();
+	case kBool_t:     return type_ops_of<Bool_t>();
+	default:          return 0;
+	}
+}
+
+// Global event classes whose members may be histogrammed
+struct Global_t {
+	const char* fName;
+	void* fAddr;
+	const std::type_info* fType;
+};
+
+const Global_t kGlobals[] = {
+	{ "gHead",        &rootana::gHead,        &typeid(rootana::gHead) },
+	{ "gTail",        &rootana::gTail,        &typeid(rootana::gTail) },
+	{ "gCoinc",       &rootana::gCoinc,       &typeid(rootana::gCoinc) },
+	{ "gHeadScaler",  &rootana::gHeadScaler,  &typeid(rootana::gHeadScaler) },
+	{ "gTailScaler",  &rootana::gTailScaler,  &typeid(rootana::gTailScaler) },
+	{ "gEpics",       &rootana::gEpics,       &typeid(rootana::gEpics) },
+	{ "gDiagnostics", &rootana::gDiagnostics, &typeid(rootana::gDiagnostics) },
+	{ "gReceiver",    &rootana::gReceiver,    &typeid(rootana::gReceiver) },
+	{ "gLoad",        &rootana::gLoad,        &typeid(rootana::gLoad) },
+	{ "gProfile",     &rootana::gProfile,     &typeid(rootana::gProfile) },
+	{ "gLatency",     &rootana::gLatency,     &typeid(rootana::gLatency) }
+};
+
+// Data member of a class or of one of its bases, adding its offset to \e offset
+TDataMember* find_member(TClass* cl, const std::string& name, Long_t& offset)
+{
+	TDataMember* member = cl->GetDataMember(name.c_str());
+	if (member) {
+		offset += member->GetOffset();
+		return member;
+	}
+	TIter next(cl->GetListOfBases());
+	while (TBaseClass* base = static_cast<TBaseClass*>(next())) {
+		Long_t baseOffset = offset + base->GetDelta();
+		TClass* baseClass = base->GetClassPointer();
+		if (baseClass && (member = find_member(baseClass, name, baseOffset))) {
+			offset = baseOffset;
+			return member;
+		}
+	}
+	return 0;
+}
+
+inline std::string next_name(const std::string& path, size_t& pos)
+{
+	const size_t begin = pos;
+	while (pos < path.size() && path[pos] != '.' && path[pos] != '[') ++pos;
+	return path.substr(begin, pos - begin);
+}
+
+// Parameter found from its path
+struct Param_t {
+	char* fAddr;           // Address of the value (or first array element)
+	const TypeOps_t* fOps; // Operations for its type
+	UInt_t fElements;      // Number of elements if an array (not fully indexed), 0 otherwise
+};
+
+// Looks up a parameter path (from parse_path()) in the class dictionaries
+bool resolve(const std::string& path, Param_t& param)
+{
+	size_t pos = 0;
+	const std::string global = next_name(path, pos);
+	char* addr = 0;
+	TClass* cl = 0;
+	for (size_t i = 0; i < sizeof(kGlobals) / sizeof(kGlobals[0]) && !addr; ++i) {
+		if (global != kGlobals[i].fName) continue;
+		addr = static_cast<char*>(kGlobals[i].fAddr);
+		cl = TClass::GetClass(*kGlobals[i].fType);
+	}
+	if (!cl) return false;
+
+	const TypeOps_t* ops = 0;
+	UInt_t elements = 0;
+	while (pos < path.size()) {
+		if (path[pos] != '.' || !cl) return false; // index of a non-array, or member of a basic type
+		++pos;
+		Long_t offset = 0;
+		TDataMember* member = find_member(cl, next_name(path, pos), offset);
+		if (!member || member->IsaPointer() || member->GetUnitSize() <= 0) return false;
+		addr += offset;
+
+		const Int_t ndim = member->GetArrayDim();
+		Long_t size = member->GetUnitSize(); // of what remains to be indexed
+		for (Int_t dim = 0; dim < ndim; ++dim) size *= member->GetMaxIndex(dim);
+		Int_t dim = 0;
+		for (; dim < ndim && pos < path.size() && path[pos] == '['; ++dim) {
+			const size_t close = path.find(']', pos);
+			if (close >= path.size()) return false;
+			const Long_t index = atol(path.substr(pos + 1, close - pos - 1).c_str());
+			if (index >= member->GetMaxIndex(dim)) return false;
+			size /= member->GetMaxIndex(dim);
+			addr += index*size;
+			pos = close + 1;
+		}
+		elements = dim < ndim ? size / member->GetUnitSize() : 0;
+
+		if (member->IsBasic()) {
+			TDataType* type = member->GetDataType();
+			ops = type ? type_ops(type->GetType()) : 0;
+			if (!ops) return false;
+			cl = 0;
+		}
+		else if (elements) return false; // array of classes, which must be indexed
+		else if (!(cl = TClass::GetClass(member->GetTypeName()))) return false;
+	}
+	if (!ops) return false;
+
+	param.fAddr = addr;
+	param.fOps = ops;
+	param.fElements = elements;
+	return true;
+}
+
+// Adds the derived parameters (dragon::Head::Derived_t and Tail::Derived_t bits)
+// read through a parameter path to \e head and \e tail
+void add_derived(const std::string& path, Int_t& head, Int_t& tail)
+{
+	size_t pos = 0;
+	const std::string global = next_name(path, pos);
+	const char* member = pos < path.size() ? path.c_str() + pos + 1 : "";
+	if      (global == "gHead")  head |= dragon::Head::derived_of(member);
+	else if (global == "gTail")  tail |= dragon::Tail::derived_of(member);
+	else if (global == "gCoinc") dragon::Coinc::derived_of(member, head, tail);
+}
+
+
+// NATIVE CUTS //
+
+// Operand of a natively built comparison: a parameter, or a constant
+struct Operand_t {
+	const void* fAddr; // Parameter address, 0 for a constant
+	Read_t fRead;
+	Valid_t fValid;
+	Double_t fValue;   // Constant value
+	double get() const
+		{ return fAddr ? fRead(fAddr) : fValue; }
+	bool valid() const
+		{ return fAddr ? fValid(fAddr) : dragon::utils::is_valid(fValue); }
+};
+
+bool make_operand(const std::string& arg, Operand_t& operand)
+{
+	operand.fAddr = 0;
+	operand.fRead = 0;
+	operand.fValid = 0;
+	operand.fValue = 0;
+	if (parse_number(arg, operand.fValue)) return true;
+
+	Param_t param;
+	if (!resolve(arg, param) || param.fElements) return false;
+	operand.fAddr = param.fAddr;
+	operand.fRead = param.fOps->fRead;
+	operand.fValid = param.fOps->fValid;
+	return true;
+}
+
+// As rootana::Equivalency, on operands whose types are only known at run time
+template <class F>
+class OperandComparison: public rootana::Condition {
+private:
+	Operand_t fV1;
+	Operand_t fV2;
+public:
+	OperandComparison(const Operand_t& v1, const Operand_t& v2):
+		fV1(v1), fV2(v2) { }
+	rootana::Condition* clone() const
+		{ return new OperandComparison(*this); }
+	bool operator() () const
+		{ return F()( fV1.get(), fV2.get() ); }
+	void compile(rootana::CutProgram& program) const
+		{ program.emit_test(&OperandComparison::test_, this, 0); }
+private:
+	static bool test_(const void* condition, const void*)
+		{
+			const OperandComparison* c = static_cast<const OperandComparison*>(condition);
+			return F()( c->fV1.get(), c->fV2.get() );
+		}
+};
+
+// As rootana::Validity, on an operand whose type is only known at run time
+class OperandValidity: public rootana::Condition {
+private:
+	Operand_t fV1;
+public:
+	OperandValidity(const Operand_t& v1):
+		fV1(v1) { }
+	rootana::Condition* clone() const
+		{ return new OperandValidity(*this); }
+	bool operator() () const
+		{ return fV1.valid(); }
+	void compile(rootana::CutProgram& program) const
+		{ program.emit_test(&OperandValidity::test_, this, 0); }
+private:
+	static bool test_(const void* condition, const void*)
+		{ return static_cast<const OperandValidity*>(condition)->fV1.valid(); }
+};
+
+rootana::Condition* new_comparison(Int_t op, const Operand_t& v1, const Operand_t& v2)
+{
+	switch (op) {
+	case kLess:         return new OperandComparison<std::less<double> >(v1, v2);
+	case kGreater:      return new OperandComparison<std::greater<double> >(v1, v2);
+	case kEqual:        return new OperandComparison<std::equal_to<double> >(v1, v2);
+	case kNotEqual:     return new OperandComparison<std::not_equal_to<double> >(v1, v2);
+	case kLessEqual:    return new OperandComparison<std::less_equal<double> >(v1, v2);
+	case kGreaterEqual: return new OperandComparison<std::greater_equal<double> >(v1, v2);
+	default:            return 0;
+	}
+}
+
+// Builds a condition from postfix instructions, returns 0 if any parameter can't be found
+rootana::Condition* build_cut(const CutTokens_t& tokens)
+{
+	std::vector<rootana::Condition*> stack;
+	bool ok = true;
+	for (size_t i = 0; ok && i < tokens.size(); ++i) {
+		const rootana::HistParser::CutToken& token = tokens[i];
+		rootana::Condition* condition = 0;
+		Operand_t v1, v2;
+		switch (token.fOp) {
+		case kLess: case kGreater: case kEqual: case kNotEqual: case kLessEqual: case kGreaterEqual:
+			if (make_operand(token.fArg1, v1) && make_operand(token.fArg2, v2))
+				condition = new_comparison(token.fOp, v1, v2);
+			break;
+		case kIsValid:
+			if (make_operand(token.fArg1, v1)) condition = new OperandValidity(v1);
+			break;
+		case kTrue:
+			condition = new rootana::TrueCondition();
+			break;
+		case kFalse:
+			condition = new rootana::FalseCondition();
+			break;
+		case kNot:
+			if (stack.size() >= 1) {
+				rootana::Cut c1(stack.back()); stack.pop_back();
+				condition = new rootana::NegatedCondition(c1);
+			}
+			break;
+		case kAnd: case kOr:
+			if (stack.size() >= 2) {
+				rootana::Cut c2(stack.back()); stack.pop_back();
+				rootana::Cut c1(stack.back()); stack.pop_back();
+				if (token.fOp == kAnd)
+					condition = new rootana::LogicalCondition<std::logical_and<rootana::Condition> >(c1, c2);
+				else
+					condition = new rootana::LogicalCondition<std::logical_or<rootana::Condition> >(c1, c2);
+			}
+			break;
+		default:
+			break;
+		}
+		if (condition) stack.push_back(condition);
+		else ok = false;
+	}
+	if (ok && stack.size() == 1) return stack[0];
+
+	for (size_t i = 0; i< stack.size(); ++i) delete stack[i];
+	return 0;
+}
+
+TH1D* make_hist(const Entry_t& entry, TH1D*)
+{
+	const std::vector<Double_t>& b = entry.fBins;
+	return new TH1D(entry.fName.c_str(), entry.fTitle.c_str(), Int_t(b[0]), b[1], b[2]);
+}
+
+TH2D* make_hist(const Entry_t& entry, TH2D*)
+{
+	const std::vector<Double_t>& b = entry.fBins;
+	return new TH2D(entry.fName.c_str(), entry.fTitle.c_str(),
+									Int_t(b[0]), b[1], b[2], Int_t(b[3]), b[4], b[5]);
+}
+
+TH3D* make_hist(const Entry_t& entry, TH3D*)
+{
+	const std::vector<Double_t>& b = entry.fBins;
+	return new TH3D(entry.fName.c_str(), entry.fTitle.c_str(),
+									Int_t(b[0]), b[1], b[2], Int_t(b[3]), b[4], b[5], Int_t(b[6]), b[7], b[8]);
+}
+
 }
 
 
@@ -62,7 +794,8 @@ inline void throw_missing_arg(const char* which, int linenum, const char* fname)
 
 rootana::HistParser::HistParser(const char* filename):
 	fFilename(filename), fFile(filename),
-	fLine(""), fLineNumber(0), fDir("")
+	fLine(""), fLineNumber(0), fDir(""), fParserId(gNextParserId++),
+	fInterpreter(false)
 {
 	/*!
 	 *  \param filename Path to the histogram definition file
@@ -112,91 +845,199 @@ bool rootana::HistParser::read_line()
 	return IsGood();
 }
 
-void rootana::HistParser::handle_command()
+rootana::HistParser::Entry& rootana::HistParser::read_entry(Int_t kind, int nlines, const char* flag)
 {
-	bool done = false;
-	int err;
-	while(read_line()) {
-		if (contains(fLine, "END:")) {
-			done = true;
-			break;
+	/*!
+	 * \param kind Type of definition
+	 * \param nlines Number of argument lines following the flag, or -1 to read up to \c END:
+	 * \param flag Name of the flag, for error messages
+	 * \returns The new entry, appended to fEntries
+	 */
+	Entry entry;
+	entry.fKind = kind;
+	entry.fLength = 0;
+	for (int i = 0; nlines < 0 || i < nlines; ++i) {
+		if (!read_line()) throw_missing_arg(flag, fLineNumber, fFilename);
+		if (nlines < 0 && contains(fLine, "END:")) break;
+		entry.fText.push_back(fLine);
+		entry.fLines.push_back(fLineNumber);
+	}
+	fEntries.push_back(entry);
+	return fEntries.back();
+}
+
+bool rootana::HistParser::parse_file()
+{
+	/*!
+	 * Arguments, parameters and cuts which can't be handled natively are kept as
+	 * text only, for the interpreter.
+	 * \returns true if there were no errors
+	 */
+	bool good = true;
+	while (read_line()) {
+		try {
+			if      (contains(fLine, "DIR:"))     read_entry(kDir, 1, "DIR:");
+			else if (contains(fLine, "CMD:"))     read_entry(kCommand, -1, "CMD:");
+			else if (contains(fLine, "CUT:"))     parse_cut(read_entry(kCut, 1, "CUT:"));
+			else if (contains(fLine, "TH1D:"))    parse_hist(read_entry(kHist1, 2, "HIST:"), 1, 1);
+			else if (contains(fLine, "TH2D:"))    parse_hist(read_entry(kHist2, 3, "HIST:"), 2, 2);
+			else if (contains(fLine, "TH3D:"))    parse_hist(read_entry(kHist3, 4, "HIST:"), 3, 3);
+			else if (contains(fLine, "SUMMARY:")) parse_summary(read_entry(kSummary, 3, "SUMMARY:"));
+			else if (contains(fLine, "SCALER:"))  parse_hist(read_entry(kScaler, 2, "SCALER:"), 1, 1);
+			else if (contains(fLine, "RATE:"))    parse_hist(read_entry(kRate, 2, "RATE:"), 1, 1);
+			else continue;
+		} catch (std::exception& e) {
+			cm_msg(MERROR, "anaDragon::HistParser::Run", "%s. Attempting to continue...", e.what());
+			good = false;
 		}
-		gROOT->ProcessLine(fLine.c_str(), &err);
-		if (err != 0) throw_bad_line(fLine, fLineNumber, fFilename);
 	}
-	if (!done) throw_missing_arg("CMD:", fLineNumber, fFilename);
+	return good;
+}
+
+bool rootana::HistParser::read_cache()
+{
+	/*!
+	 * \returns true if the cache exists, was made from the current version of
+	 *  the definition file, and could be read.
+	 */
+	Long64_t size, mtime;
+	if (!source_stamp(fFilename, size, mtime)) return false;
+	FILE* fp = fopen(cache_path(fFilename).c_str(), "rb");
+	if (!fp) return false;
+
+	char magic[sizeof(kCacheMagic)];
+	Long64_t cacheSize = -1, cacheMtime = -1;
+	UInt_t nentries = 0;
+	bool ok = fread(magic, sizeof(magic), 1, fp) == 1 && memcmp(magic, kCacheMagic, sizeof(kCacheMagic)) == 0 &&
+		get(fp, cacheSize) && get(fp, cacheMtime) && cacheSize == size && cacheMtime == mtime &&
+		get(fp, nentries) && nentries < (1 << 20);
+
+	std::vector<Entry> entries(ok ? nentries : 0);
+	for (size_t i = 0; ok && i < entries.size(); ++i) ok = get_entry(fp, entries[i]);
+	fclose(fp);
+	if (!ok) return false;
+
+	fEntries.swap(entries);
+	dragon::utils::Info("rootana::HistParser")
+		<< "Reading histogram definitions from cache file " << cache_path(fFilename);
+	return true;
+}
+
+void rootana::HistParser::write_cache() const
+{
+	/*!
+	 * Writes to a temporary file first, then renames it, so that concurrent
+	 * readers never see a partial cache. Failures (e.g. a read-only directory)
+	 * are ignored, the text file is then parsed again next time.
+	 */
+	Long64_t size, mtime;
+	if (!source_stamp(fFilename, size, mtime)) return;
+	const std::string path = cache_path(fFilename), temp = path + ".tmp";
+	FILE* fp = fopen(temp.c_str(), "wb");
+	if (!fp) return;
+
+	bool ok = fwrite(kCacheMagic, sizeof(kCacheMagic), 1, fp) == 1 &&
+		put(fp, size) && put(fp, mtime) && put(fp, UInt_t(fEntries.size()));
+	for (size_t i = 0; ok && i < fEntries.size(); ++i) ok = put_entry(fp, fEntries[i]);
+	ok = fclose(fp) == 0 && ok;
+	if (!ok || rename(temp.c_str(), path.c_str()) != 0) remove(temp.c_str());
+}
+
+void rootana::HistParser::use_interpreter()
+{
+	if (fInterpreter) return;
+	gROOT->ProcessLine("using namespace rootana;");
+	fInterpreter = true;
+}
+
+void rootana::HistParser::handle_command(const Entry& entry)
+{
+	use_interpreter();
+	int err;
+	for (size_t i = 0; i< entry.fText.size(); ++i) {
+		gROOT->ProcessLine(entry.fText[i].c_str(), &err);
+		if (err != 0) throw_bad_line(entry.fText[i], entry.fLines[i], fFilename);
+	}
 
 	for (int i=0; i< gROOT->GetListOfSpecials()->GetEntries(); ++i) {
 		TCutG* cutg = dynamic_cast<TCutG*>(gROOT->GetListOfSpecials()->At(i));
-		if(cutg && std::count(fExistingCuts.begin(), fExistingCuts.end(), cutg) == 0) {
+		if(cutg &&
+			 std::count(fExistingCuts.begin(), fExistingCuts.end(), cutg) == 0 &&
+			 std::count(fLocalCuts.begin(), fLocalCuts.end(), cutg) == 0) {
 			fLocalCuts.push_back(cutg);
 		}
 	}
 }
 
-void rootana::HistParser::handle_dir()
+void rootana::HistParser::handle_dir(const Entry& entry)
 {
-	read_line();
-	if(!IsGood()) throw_missing_arg("DIR:", fLineNumber, fFilename);
-	fDir = fLine;
+	fDir = entry.fText.at(0);
 	std::cout << "\n";
 	dragon::utils::Info("HistParser", false)	<< "New directory: " << fDir;
 }
 
-namespace {
+rootana::DataPointer* rootana::HistParser::new_data_pointer(const Entry& entry, int param, bool summary)
+{
+	/*!
+	 * \param entry Histogram definition
+	 * \param param Index of the parameter; its argument line is <tt>param + 1</tt>
+	 * \param summary Point to an array of Entry::fLength elements (argument line <tt>param + 2</tt>)
+	 */
+	Param_t p;
+	if (!entry.fParams.at(param).empty() && resolve(entry.fParams[param], p)) {
+		if (!summary && p.fElements == 0)
+			return p.fOps->fNew(p.fAddr, 0);
+		if (summary && entry.fLength > 0 && entry.fLength <= p.fElements)
+			return p.fOps->fNew(p.fAddr, entry.fLength);
+	}
+
+	use_interpreter();
+	const std::string& spar = entry.fText.at(param + 1);
+	std::stringstream cmd;
+	cmd << "rootana::DataPointer::New(" << spar;
+	if (summary) cmd << ", " << entry.fText.at(param + 2);
+	cmd << ");";
+	rootana::DataPointer* data = (rootana::DataPointer*)gROOT->ProcessLineFast(cmd.str().c_str());
+	if (!data) throw_bad_line(spar, entry.fLines.at(param + 1), fFilename);
+	return data;
+}
+
 template <class T>
-T* create_hist(const char* type, std::string sHst, unsigned lHst, std::string filename)
+T* rootana::HistParser::new_hist(const Entry& entry, const char* type)
 {
+	/*!
+	 * \param entry Histogram definition
+	 * \param type Class name of \e T
+	 */
+	if (!entry.fBins.empty())
+		return make_hist(entry, static_cast<T*>(0));
+
+	use_interpreter();
 	std::stringstream cmd;
-	cmd << "new " << type << sHst << ";";
+	cmd << "new " << type << entry.fText.at(0) << ";";
 	T* out = (T*)gROOT->ProcessLine(cmd.str().c_str());
-	if(!out) throw_bad_line(sHst, lHst, filename.c_str(), &cmd);
+	if(!out) throw_bad_line(entry.fText.at(0), entry.fLines.at(0), fFilename, &cmd);
 	return out;
-} }
-
-void rootana::HistParser::handle_hist(const char* type)
-{
-	int npar = atoi ( std::string(type).substr(2,1).c_str() );
-	assert (npar > 0 && npar < 4);
-	unsigned lhst, lpar[3];
-	std::string shst, spar[3];
-	{
-		unsigned* lll[2] = { &lhst, lpar };
-		std::string* lread[2] = { &shst, spar };
-
-		read_line();
-		if(!IsGood()) throw_missing_arg("HIST:", fLineNumber, fFilename);
-		*(lll[0])   = fLineNumber;
-		*(lread[0]) = fLine;
-
-		for (int i=0; i< npar; ++i) {
-			read_line();
-			if(!IsGood()) throw_missing_arg("HIST:", fLineNumber, fFilename);
-			unsigned* lll1 = lll[1];
-			lll1[i] = fLineNumber;
-			std::string* lread1 = lread[1];
-			lread1[i] = fLine;
-		}
-	}
+}
 
-	std::stringstream cmdParam[3];
+void rootana::HistParser::handle_hist(const Entry& entry)
+{
+	const int npar = entry.fParams.size();
 	rootana::DataPointer* data[3];
 	for (int i=0; i< npar; ++i) {
-		cmdParam[i] << "rootana::DataPointer::New(" << spar[i] << ");";
-		data[i] = (rootana::DataPointer*)gROOT->ProcessLineFast(cmdParam[i].str().c_str());
-		if (!data[i]) throw_bad_line (spar[i], lpar[i], fFilename);
+		data[i] = new_data_pointer(entry, i);
 	}
 
 	rootana::HistBase* h = 0;
-	switch(npar) {
-	case 1:
-		h = new rootana::Hist<TH1D> (create_hist<TH1D>(type, shst, lhst, fFilename), data[0]);
+	switch(entry.fKind) {
+	case kHist1:
+		h = new rootana::Hist<TH1D> (new_hist<TH1D>(entry, "TH1D"), data[0]);
 		break;
-	case 2:
-		h = new rootana::Hist<TH2D> (create_hist<TH2D>(type, shst, lhst, fFilename), data[0], data[1]);
+	case kHist2:
+		h = new rootana::Hist<TH2D> (new_hist<TH2D>(entry, "TH2D"), data[0], data[1]);
 		break;
-	case 3:
-		h = new rootana::Hist<TH3D> (create_hist<TH3D>(type, shst, lhst, fFilename), data[1], data[1], data[2]);
+	case kHist3:
+		h = new rootana::Hist<TH3D> (new_hist<TH3D>(entry, "TH3D"), data[0], data[1], data[2]);
 		break;
 	default:
 		{
@@ -206,104 +1047,91 @@ void rootana::HistParser::handle_hist(const char* type)
 		}
 	}
 
-	Int_t type_code = get_type(spar[0]);
+	Int_t type_code = get_type(entry.fText.at(1));
 	for(int i=1; i< npar; ++i) {
-		Int_t type_i = get_type(spar[i]);
+		Int_t type_i = get_type(entry.fText.at(i + 1));
 		if(type_i != type_code) {
 			dragon::utils::Error("HistParser") << "Mixed event types.";
-			throw_bad_line (spar[i], lpar[i], fFilename);
+			throw_bad_line (entry.fText.at(i + 1), entry.fLines.at(i + 1), fFilename);
 		}
 	}
 	add_hist(h, type_code);
 }
 
-void rootana::HistParser::handle_scaler()
+void rootana::HistParser::handle_scaler(const Entry& entry)
 {
-	unsigned lhst, lpar;
-	std::string shst, spar;
-	{
-		unsigned* lll[2] = { &lhst, &lpar };
-		std::string* lread[2] = { &shst, &spar };
-		for (int i=0; i< 2; ++i) {
-			read_line();
-			if(!IsGood()) throw_missing_arg("SCALER:", fLineNumber, fFilename);
-			*(lll[i])   = fLineNumber;
-			*(lread[i]) = fLine;
-		}
-	}
-
-	std::stringstream cmdData;
-	cmdData << "rootana::DataPointer::New(" << spar << ");";
-	rootana::DataPointer* data = (rootana::DataPointer*)gROOT->ProcessLineFast(cmdData.str().c_str());
-	if (!data) throw_bad_line(spar, lpar, fFilename);
-
-	std::stringstream cmdHist;
-	cmdHist << "new TH1D" << shst << ";";
-	TH1D* hst = (TH1D*)gROOT->ProcessLineFast(cmdHist.str().c_str());
-	if (!hst) throw_bad_line(shst, lhst, fFilename);
+	rootana::DataPointer* data = new_data_pointer(entry, 0);
+	TH1D* hst = new_hist<TH1D>(entry, "TH1D");
 
 	rootana::ScalerHist* h = new rootana::ScalerHist(hst, data);
 	assert(h);
 
-	Int_t type = get_type(spar);
+	Int_t type = get_type(entry.fText.at(1));
 	add_hist(h, type);
 }
 
-void rootana::HistParser::handle_summary()
+void rootana::HistParser::handle_rate(const Entry& entry)
 {
-	unsigned lhst, lpar, lnum;
-	std::string shst, spar, snum;
-	{
-		unsigned* lll[3] = { &lhst, &lpar, &lnum };
-		std::string* lread[3] = { &shst, &spar, &snum };
-		for (int i=0; i< 3; ++i) {
-			read_line();
-			if(!IsGood()) throw_missing_arg("SUMMARY:", fLineNumber, fFilename);
-			*(lll[i])   = fLineNumber;
-			*(lread[i]) = fLine;
-		}
-	}
+	rootana::DataPointer* data = new_data_pointer(entry, 0);
+	TH1D* hst = new_hist<TH1D>(entry, "TH1D");
 
-	std::stringstream cmdData;
-	cmdData << "rootana::DataPointer::New(" << spar << ", " << snum << ");";
-	rootana::DataPointer* data = (rootana::DataPointer*)gROOT->ProcessLineFast(cmdData.str().c_str());
-	if (!data) throw_bad_line(spar, lpar, fFilename);
+	rootana::RateHist* h = new rootana::RateHist(hst, data);
+	assert(h);
 
-	std::stringstream cmdHist;
-	cmdHist << "new TH1D" << shst << ";";
-	TH1D* hst = (TH1D*)gROOT->ProcessLineFast(cmdHist.str().c_str());
-	if (!hst) throw_bad_line(shst, lhst, fFilename);
+	Int_t type = get_type(entry.fText.at(1));
+	add_hist(h, type);
+}
+
+void rootana::HistParser::handle_summary(const Entry& entry)
+{
+	rootana::DataPointer* data = new_data_pointer(entry, 0, true);
+	TH1D* hst = new_hist<TH1D>(entry, "TH1D");
 
 	rootana::SummaryHist* h = new rootana::SummaryHist(hst, data);
 	assert(h);
 
-	Int_t type = get_type(spar);
+	Int_t type = get_type(entry.fText.at(1));
 	add_hist(h, type);
 }
 
-void rootana::HistParser::handle_cut()
+void rootana::HistParser::handle_cut(const Entry& entry)
 {
+	const std::string& line = entry.fText.at(0);
 	if (fCreatedHistograms.empty()) {
 		std::stringstream err;
-		err << "CUT: line without a prior histogram, in file " << fFilename << " at line " << fLineNumber;
+		err << "CUT: line without a prior histogram, in file " << fFilename << " at line " << entry.fLines.at(0);
 		throw(std::invalid_argument(err.str().c_str()));
 	}
 
-	if(!read_line()) throw_missing_arg("CUT:", fLineNumber, fFilename);
-	std::stringstream cmd;
-	cmd << "( " << fLine << " ).get()->clone();";
-	rootana::Condition* condition = (rootana::Condition*)gROOT->ProcessLineFast(cmd.str().c_str());
-	if(!condition) throw_bad_line(fLine, fLineNumber, fFilename, &cmd);
+	// Cuts are shared (see rootana::CutTable) between the histograms of this
+	// file whose cut definitions are the same up to white space
+	std::stringstream skey;
+	skey << fParserId << ":" << line;
+	std::string key = skey.str();
+	key.erase(std::remove(key.begin(), key.end(), ' '), key.end());
+	rootana::CutTable& table = rootana::CutTable::instance();
+	Int_t index = table.find(key);
+	if(index < 0) {
+		rootana::Condition* condition = build_cut(entry.fCut);
+		if(!condition) {
+			use_interpreter();
+			std::stringstream cmd;
+			cmd << "( " << line << " ).get()->clone();";
+			condition = (rootana::Condition*)gROOT->ProcessLineFast(cmd.str().c_str());
+			if(!condition) throw_bad_line(line, entry.fLines.at(0), fFilename, &cmd);
+		}
+		index = table.intern(key, rootana::Cut(condition));
+	}
 
 	std::list<HistInfo>::iterator itEnd = fCreatedHistograms.end();
 	--itEnd;
 	HistInfo* pInfo = &(*(itEnd));
 
-	pInfo->fHist->set_cut( rootana::Cut(condition) );
+	pInfo->fHist->set_shared_cut(index);
 
 	std::cout << "\t\t";
 	dragon::utils::Info("HistParser", false)
-		<< "Applying cut: " << fLine << " to histogram " << pInfo->fName;
+		<< "Applying cut: " << line << " to histogram " << pInfo->fName;
 }
 
 void rootana::HistParser::add_hist(rootana::HistBase* hst, Int_t type)
@@ -321,20 +1149,77 @@ void rootana::HistParser::add_hist(rootana::HistBase* hst, Int_t type)
 		<< "Adding histogram " << histInfo.fName << " to directory " << fDir << ", EID = " << type;
 }
 
+void rootana::HistParser::AddDerived(Int_t& head, Int_t& tail) const
+{
+	/*!
+	 * \param [in,out] head dragon::Head::Derived_t bits read by the definitions are added to this
+	 * \param [in,out] tail dragon::Tail::Derived_t bits read by the definitions are added to this
+	 *
+	 * Only parameters and cuts handled natively can be followed; anything passed to the
+	 * interpreter (including CMD: blocks) may read any parameter, so it adds them all.
+	 */
+	const Int_t allHead = dragon::Head::ALL_DERIVED, allTail = dragon::Tail::ALL_DERIVED;
+	for (size_t i = 0; i< fEntries.size(); ++i) {
+		const Entry& entry = fEntries[i];
+		bool interpreted = false;
+		switch(entry.fKind) {
+		case kCommand:
+			interpreted = true;
+			break;
+		case kCut:
+			interpreted = entry.fCut.empty();
+			for (size_t j = 0; j< entry.fCut.size(); ++j) {
+				const CutToken& token = entry.fCut[j];
+				const std::string* args[2] = { &token.fArg1, &token.fArg2 };
+				for (int k = 0; k< 2; ++k) {
+					Operand_t operand;
+					if (args[k]->empty()) continue;
+					if (!make_operand(*args[k], operand)) interpreted = true;
+					else if (operand.fAddr) add_derived(*args[k], head, tail);
+				}
+			}
+			break;
+		case kHist1: case kHist2: case kHist3: case kSummary: case kScaler: case kRate:
+			for (size_t j = 0; j< entry.fParams.size(); ++j) {
+				Param_t param;
+				if (entry.fParams[j].empty() || !resolve(entry.fParams[j], param)) interpreted = true;
+				else add_derived(entry.fParams[j], head, tail);
+			}
+			break;
+		default:
+			break;
+		}
+		if (interpreted) {
+			head |= allHead;
+			tail |= allTail;
+		}
+	}
+}
+
 void rootana::HistParser::Run()
 {
-	gROOT->ProcessLine("using namespace rootana;");
-	while (read_line()) {
+	/*!
+	 * Reads the definitions from the cache file if it is up to date, otherwise
+	 * parses the text file (and re-writes the cache, if there were no errors).
+	 * Then creates the histograms and cuts.
+	 */
+	if (!read_cache() && parse_file()) write_cache();
+
+	for (size_t i = 0; i< fEntries.size(); ++i) {
+		const Entry& entry = fEntries[i];
 		try {
-			if      (contains(fLine, "DIR:"))     handle_dir();
-			else if (contains(fLine, "CMD:"))     handle_command();
-			else if (contains(fLine, "CUT:"))     handle_cut();
-			else if (contains(fLine, "TH1D:"))    handle_hist("TH1D");
-			else if (contains(fLine, "TH2D:"))    handle_hist("TH2D");
-			else if (contains(fLine, "TH3D:"))    handle_hist("TH3D");
-			else if (contains(fLine, "SUMMARY:")) handle_summary();
-			else if (contains(fLine, "SCALER:"))  handle_scaler();
-			else continue;
+			switch(entry.fKind) {
+			case kDir:     handle_dir(entry);     break;
+			case kCommand: handle_command(entry); break;
+			case kCut:     handle_cut(entry);     break;
+			case kHist1:
+			case kHist2:
+			case kHist3:   handle_hist(entry);    break;
+			case kSummary: handle_summary(entry); break;
+			case kScaler:  handle_scaler(entry);  break;
+			case kRate:    handle_rate(entry);    break;
+			default: break;
+			}
 		} catch (std::exception& e) {
 			cm_msg(MERROR, "anaDragon::HistParser::Run", "%s. Attempting to continue...", e.what());
 			// std::cerr << "\n*******\n";
@@ -347,4 +1232,3 @@ void rootana::HistParser::Run()
 	dragon::utils::Info("rootana::HistParser")
 		<< "Done creating histograms from file " << fFilename << std::endl;
 }
-
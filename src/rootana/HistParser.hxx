@@ -19,6 +19,17 @@ class Directory;
 /*!
  *  Allows histogram definitions to be changed without requiring
  *  the program to be re-compiled.
+ *
+ *  The file is first read into a list of definitions (Entry), which are then used to
+ *  create the histograms. Histogram arguments, parameters (e.g. \c rootana::gHead.bgo.ecal[0])
+ *  and cuts made of the comparison, IsValid(), Not(), And(), Or(), True() and False()
+ *  functions and the \c !, \c && and \c || operators are handled natively: parameters are
+ *  looked up in the class dictionaries of the global event classes. Anything else (CMD:
+ *  blocks, Cut2D(), other expressions) is passed to the interpreter, as before.
+ *
+ *  The definitions are cached in binary form in <tt>\<filename\>.cache</tt>, which is
+ *  used instead of the text file as long as the size and modification time of the latter
+ *  do not change.
  */
 class HistParser {
 private:
@@ -32,6 +43,8 @@ private:
 	unsigned fLineNumber;
 	/// Current directory argument
 	std::string fDir;
+	/// Unique id of this parser, used in the keys of its cuts in rootana::CutTable
+	const unsigned fParserId;
 	/// Temporary TCutGs created during parsing
 	std::vector<TCutG*> fLocalCuts;
 	/// Any TCutGs existing before parsing
@@ -46,6 +59,34 @@ private:
 	/// List of all histograms created by the parser (plus related info)
 	std::list<HistInfo> fCreatedHistograms;
 
+public:
+	/// Single instruction of a natively parsed cut
+	struct CutToken {
+		Int_t fOp;         ///< Operation, see HistParser.cxx
+		std::string fArg1; ///< First argument (parameter path or number) of a comparison
+		std::string fArg2; ///< Second argument of a comparison
+	};
+	/// Single definition from the file
+	struct Entry {
+		Int_t fKind;                      ///< Type of definition, see HistParser.cxx
+		std::vector<std::string> fText;   ///< Argument lines, as read from the file
+		std::vector<UInt_t> fLines;       ///< Line number of each argument line
+		std::string fName;                ///< Histogram name
+		std::string fTitle;               ///< Histogram title
+		std::vector<Double_t> fBins;      ///< Binning: number of bins, low and high edges of each axis
+		std::vector<std::string> fParams; ///< Parameter paths, without "rootana::"
+		UInt_t fLength;                   ///< Summary histogram array length
+		std::vector<CutToken> fCut;       ///< Cut instructions, in postfix order
+		/// \note Fields which could not be parsed natively are left empty (fLength zero),
+		///  and the corresponding argument lines are passed to the interpreter instead.
+	};
+
+private:
+	/// All definitions in the file, in order
+	std::vector<Entry> fEntries;
+	/// Set if the interpreter has been prepared for parsing definitions
+	bool fInterpreter;
+
 public:
 	/// Sets fFile
 	HistParser(const char* filename);
@@ -55,6 +96,8 @@ public:
 	bool IsGood() { return fFile.good(); }
 	/// Runs through a file and creates histograms
 	void Run();
+	/// Adds the derived parameters read by the histograms and cuts (after Run())
+	void AddDerived(Int_t& head, Int_t& tail) const;
 	/// Transfers ownership of created histograms from \c this to a new class
 	template <class T> void Transfer(T* newOwner)
 		{
@@ -77,20 +120,36 @@ public:
 private:
 	/// Reads & formats a single line
 	bool read_line();
+	/// Reads the definitions from the text file into fEntries
+	bool parse_file();
+	/// Reads fEntries from the cache file, if it is up to date
+	bool read_cache();
+	/// Writes fEntries to the cache file
+	void write_cache() const;
+	/// Reads the argument lines of a definition
+	Entry& read_entry(Int_t kind, int nlines, const char* flag);
 	/// Handle a directory flag in the file
-	void handle_dir();
+	void handle_dir(const Entry& entry);
 	/// Handle a scaler hist flag in the file
-	void handle_scaler();
+	void handle_scaler(const Entry& entry);
+	/// Handle a rate hist flag in the file
+	void handle_rate(const Entry& entry);
 	/// Handle a summary hist flag in the file
-	void handle_summary();
+	void handle_summary(const Entry& entry);
 	/// Handle a hist flag in the file
-	void handle_hist(const char* type);
+	void handle_hist(const Entry& entry);
 	/// Handle a cut flag in the file
-	void handle_cut();
+	void handle_cut(const Entry& entry);
 	/// Handles command flag in the file
-	void handle_command();
+	void handle_command(const Entry& entry);
 	/// Adds a histogram to rootana
 	void add_hist(rootana::HistBase* hst, Int_t type);
+	/// Creates a DataPointer natively if possible, otherwise with the interpreter
+	rootana::DataPointer* new_data_pointer(const Entry& entry, int param, bool summary = false);
+	/// Creates a ROOT histogram natively if possible, otherwise with the interpreter
+	template <class T> T* new_hist(const Entry& entry, const char* type);
+	/// Prepares the interpreter, the first time a definition needs it
+	void use_interpreter();
 };
 
 } //namespace rootana
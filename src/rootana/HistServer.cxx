@@ -0,0 +1,213 @@
+///\file HistServer.cxx
+///\brief Implements HistServer.hxx
+#include <cstdio>
+#include <list>
+#include <poll.h>
+#include <sys/time.h>
+#include <TH1.h>
+#include <TThread.h>
+#include <TSocket.h>
+#include <TMessage.h>
+#include <TDirectory.h>
+#include <TServerSocket.h>
+#include "utils/ErrorDragon.hxx"
+#include "Histos.hxx"
+#include "Directory.hxx"
+#include "HistServer.hxx"
+
+
+namespace {
+// Time (milliseconds) the server thread waits for clients before serializing new snapshots
+const int POLL_TIMEOUT = 100;
+}
+
+rootana::HistServer::HistServer(Int_t port, Double_t interval, Int_t compression):
+	fInterval(interval), fLastSnapshot(0), fCompression(compression),
+	fSnapshots(0), fPendingVersion(0), fVersion(0), fStop(false)
+{
+	/*!
+	 * \param port TCP port to listen on
+	 * \param interval Minimum time between snapshots, in seconds
+	 * \param compression Compression level of the messages sent (0 to 9)
+	 */
+	TThread::Initialize(); // ROOT locks, as histograms are cloned and streamed in different threads
+	fServer.reset(new TServerSocket(port, kTRUE));
+	if (!IsListening())
+		dragon::utils::Error("rootana::HistServer") << "Cannot listen on port " << port;
+}
+
+rootana::HistServer::~HistServer()
+{
+	Stop();
+	for (size_t i = 0; i< fClients.size(); ++i) {
+		fClients[i]->Close();
+		delete fClients[i];
+	}
+	for (CacheMap_t::iterator it = fCache.begin(); it != fCache.end(); ++it)
+		delete it->second.fMessage;
+	for (PendingMap_t::iterator it = fPending.begin(); it != fPending.end(); ++it)
+		delete it->second;
+}
+
+bool rootana::HistServer::IsListening() const
+{
+	return fServer.get() && fServer->IsValid();
+}
+
+void rootana::HistServer::Stop()
+{
+	fStop = true;
+	Join();
+}
+
+double rootana::HistServer::GetTimeSec()
+{
+	timeval tv;
+	gettimeofday(&tv, 0);
+	return tv.tv_sec + 1e-6*tv.tv_usec;
+}
+
+void rootana::HistServer::Snapshot(const std::vector<const Directory*>& directories)
+{
+	/*!
+	 * \param directories Directories to serve the histograms of
+	 *
+	 * Call from the analysis thread, with all batched fills flushed. Does nothing
+	 * if the last snapshot was less than the snapshot interval ago.
+	 */
+	const double now = GetTimeSec();
+	if (now - fLastSnapshot < fInterval) return;
+	fLastSnapshot = now;
+
+	for (SeenMap_t::iterator it = fSeen.begin(); it != fSeen.end(); ++it)
+		it->second.fFound = false;
+
+	PendingMap_t changed;
+	for (size_t i = 0; i< directories.size(); ++i) {
+		if (!directories[i]) continue;
+		const Directory::Map_t& hists = directories[i]->GetHists();
+		for (Directory::Map_t::const_iterator it = hists.begin(); it != hists.end(); ++it) {
+			for (std::list<HistBase*>::const_iterator ih = it->second.begin(); ih != it->second.end(); ++ih) {
+				TH1* hist = (*ih)->hist();
+				if (!hist) continue;
+				std::string path = hist->GetDirectory() ? hist->GetDirectory()->GetPath() : "";
+				if (path.empty() || path[path.size() - 1] != '/') path += "/";
+				path += hist->GetName();
+
+				Seen_t& seen = fSeen[path];
+				const bool unchanged = seen.fHist == *ih && seen.fModified == (*ih)->modified();
+				seen.fHist = *ih;
+				seen.fModified = (*ih)->modified();
+				seen.fFound = true;
+				if (unchanged || changed.count(path)) continue;
+
+				TH1* clone = static_cast<TH1*>(hist->Clone(path.c_str()));
+				clone->SetDirectory(0);
+				changed[path] = clone;
+			}
+		}
+	}
+	for (SeenMap_t::iterator it = fSeen.begin(); it != fSeen.end(); ) {
+		if (it->second.fFound) { ++it; continue; }
+		changed[it->first] = 0;
+		fSeen.erase(it++);
+	}
+	if (changed.empty()) return;
+
+	dragon::utils::ScopedLock lock(fMutex);
+	for (PendingMap_t::iterator it = changed.begin(); it != changed.end(); ++it) {
+		TH1*& pending = fPending[it->first];
+		delete pending; // not yet serialized, superseded
+		pending = it->second;
+	}
+	fPendingVersion = ++fSnapshots;
+}
+
+void rootana::HistServer::Serialize()
+{
+	PendingMap_t pending;
+	ULong64_t version;
+	{
+		dragon::utils::ScopedLock lock(fMutex);
+		pending.swap(fPending);
+		version = fPendingVersion;
+	}
+	if (pending.empty()) return;
+
+	for (PendingMap_t::iterator it = pending.begin(); it != pending.end(); ++it) {
+		CacheMap_t::iterator ic = fCache.find(it->first);
+		if (ic != fCache.end()) {
+			delete ic->second.fMessage;
+			fCache.erase(ic);
+		}
+		if (!it->second) continue; // removed
+
+		Cached_t cached;
+		cached.fVersion = version;
+		cached.fMessage = new TMessage(kMESS_OBJECT);
+		cached.fMessage->SetCompressionLevel(fCompression);
+		cached.fMessage->WriteObject(it->second);
+		cached.fMessage->Compress(); // once; TSocket::Send() re-uses the compressed buffer
+		delete it->second;
+		fCache[it->first] = cached;
+	}
+	fVersion = version;
+}
+
+bool rootana::HistServer::Reply(TSocket* socket)
+{
+	TMessage* request = 0;
+	if (socket->Recv(request) <= 0 || !request) {
+		delete request;
+		return false;
+	}
+	std::auto_ptr<TMessage> owner(request);
+	if (request->What() != kMESS_STRING) return false;
+
+	char str[64] = "";
+	unsigned long long since = 0;
+	request->ReadString(str, sizeof(str));
+	if (sscanf(str, "GET %llu", &since) != 1) return false;
+	if (since > fVersion) since = 0; // from before a restart
+
+	std::vector<const TMessage*> changed;
+	for (CacheMap_t::const_iterator it = fCache.begin(); it != fCache.end(); ++it)
+		if (it->second.fVersion > since) changed.push_back(it->second.fMessage);
+
+	TMessage header(kMESS_ANY);
+	header << fVersion << Int_t(changed.size());
+	if (socket->Send(header) <= 0) return false;
+	for (size_t i = 0; i< changed.size(); ++i)
+		if (socket->Send(*changed[i]) <= 0) return false;
+	return true;
+}
+
+void rootana::HistServer::Run()
+{
+	if (!IsListening()) return;
+	while (!fStop) {
+		Serialize();
+
+		std::vector<pollfd> fds(1 + fClients.size());
+		for (size_t i = 0; i< fds.size(); ++i) {
+			fds[i].fd = i == 0 ? fServer->GetDescriptor() : fClients[i-1]->GetDescriptor();
+			fds[i].events = POLLIN;
+			fds[i].revents = 0;
+		}
+		if (poll(&fds[0], fds.size(), POLL_TIMEOUT) <= 0) continue;
+
+		for (size_t i = fds.size() - 1; i > 0; --i) {
+			if (!fds[i].revents || Reply(fClients[i-1])) continue;
+			fClients[i-1]->Close();
+			delete fClients[i-1];
+			fClients.erase(fClients.begin() + i - 1);
+		}
+		if (fds[0].revents & POLLIN) {
+			TSocket* client = fServer->Accept();
+			if (client && client != (TSocket*)-1) {
+				if (client->IsValid()) fClients.push_back(client);
+				else delete client;
+			}
+		}
+	}
+}
@@ -0,0 +1,105 @@
+///\file HistServer.hxx
+///\brief Defines a server sending compressed updates of changed histograms.
+#ifndef ROOTANA_HIST_SERVER_HXX
+#define ROOTANA_HIST_SERVER_HXX
+#include <Rtypes.h>
+
+#ifndef __MAKECINT__
+#include <map>
+#include <string>
+#include <vector>
+#include <memory>
+#include "utils/Thread.hxx"
+
+class TH1;
+class TMessage;
+class TSocket;
+class TServerSocket;
+
+namespace rootana {
+
+class Directory;
+
+/// Serves histograms to remote viewers, sending only those which changed
+/*!
+ * An alternative to the roody (netDirectoryServer) histogram server, which serializes
+ * every requested histogram in the analysis thread, for every request from every client.
+ *
+ * Here the analysis thread only calls Snapshot() periodically: histograms whose
+ * HistBase::modified() counter changed since the last snapshot are cloned and handed
+ * to the server thread, which serializes and compresses each of them once. Every
+ * snapshot with changes gets a new version number, and each client is sent the
+ * histograms changed since the version it already has, straight from the cache.
+ *
+ * Protocol (over a ROOT TSocket):
+ *  - The client sends a string message <tt>"GET <version>"</tt>, where version is the
+ *  one from the previous reply (0 to get all histograms).
+ *  - The server replies with a kMESS_ANY message containing the current version
+ *  (ULong64_t) and the number of histograms to follow (Int_t), followed by one
+ *  kMESS_OBJECT message for each of them. Histograms are named by their full path,
+ *  e.g. <tt>"rootana:/histos/head/bgo_e0"</tt>.
+ *  - Any other message closes the connection.
+ *
+ * Histograms which disappear (e.g. when a run's histogram file is closed) are dropped
+ * from the cache; clients are not told about them.
+ */
+class HistServer: public dragon::utils::Thread {
+public:
+	/// Opens the server socket, does not start the thread
+	HistServer(Int_t port, Double_t interval = 1., Int_t compression = 1);
+	/// Stops the thread, frees cached messages and pending snapshots
+	~HistServer();
+	/// Checks if the server socket is open
+	bool IsListening() const;
+	/// Tells the thread to return and waits for it
+	void Stop();
+	/// Clone the histograms changed since the last snapshot, for serving
+	void Snapshot(const std::vector<const Directory*>& directories);
+
+private:
+	/// Server loop
+	void Run();
+	/// Serializes pending snapshots into the cache
+	void Serialize();
+	/// Answers one client message, returns false to close the connection
+	bool Reply(TSocket* socket);
+	/// Time of day in seconds
+	static double GetTimeSec();
+
+private:
+	/// Last snapshot of a histogram (analysis thread only)
+	struct Seen_t {
+		const void* fHist;   ///< HistBase address
+		ULong64_t fModified; ///< HistBase::modified() at the snapshot
+		bool fFound;         ///< Seen during the current snapshot
+	};
+	/// Serialized histogram (server thread only)
+	struct Cached_t {
+		ULong64_t fVersion;  ///< Version in which it last changed
+		TMessage* fMessage;  ///< Compressed kMESS_OBJECT message
+	};
+	typedef std::map<std::string, Seen_t> SeenMap_t;
+	typedef std::map<std::string, TH1*> PendingMap_t;
+	typedef std::map<std::string, Cached_t> CacheMap_t;
+
+	std::auto_ptr<TServerSocket> fServer;
+	std::vector<TSocket*> fClients;
+	Double_t fInterval;       ///< Minimum time between snapshots (seconds)
+	Double_t fLastSnapshot;   ///< Time of the last snapshot
+	Int_t fCompression;       ///< Compression level of the messages
+	SeenMap_t fSeen;          ///< Analysis thread only
+	ULong64_t fSnapshots;     ///< Number of snapshots with changes so far (analysis thread only)
+	dragon::utils::Mutex fMutex; ///< Guards fPending and fPendingVersion
+	PendingMap_t fPending;    ///< Changed clones (0 if removed), not yet serialized
+	ULong64_t fPendingVersion; ///< Version of the latest pending snapshot
+	CacheMap_t fCache;        ///< Server thread only
+	ULong64_t fVersion;       ///< Version of fCache (server thread only)
+	volatile bool fStop;
+};
+
+}
+
+#endif
+
+
+#endif
@@ -0,0 +1,178 @@
+///\file HistShm.cxx
+///\brief Implements HistShm.hxx
+#include <cstring>
+#include <list>
+#include <sys/time.h>
+#include <TH1.h>
+#include <TH2.h>
+#include <TH3.h>
+#include <TDirectory.h>
+#include "utils/ErrorDragon.hxx"
+#include "Histos.hxx"
+#include "Directory.hxx"
+#include "HistShm.hxx"
+
+
+rootana::HistShm::HistShm(const char* name, ULong64_t size, UInt_t maxHists, Double_t interval):
+	fInterval(interval), fLastPublish(0)
+{
+	/*!
+	 * \param name Segment name, e.g. "/dragon_histos"
+	 * \param size Segment size in bytes; histograms which don't fit are not published
+	 * \param maxHists Maximum number of histograms
+	 * \param interval Minimum time between copies, in seconds
+	 */
+	fSegment.Create(name, size, maxHists);
+}
+
+rootana::HistShm::~HistShm()
+{
+	fSegment.Close();
+}
+
+double rootana::HistShm::GetTimeSec()
+{
+	timeval tv;
+	gettimeofday(&tv, 0);
+	return tv.tv_sec + 1e-6*tv.tv_usec;
+}
+
+UInt_t rootana::HistShm::GetNumCells(const TH1* hist)
+{
+	UInt_t cells = hist->GetNbinsX() + 2;
+	if (hist->GetDimension() > 1) cells *= hist->GetNbinsY() + 2;
+	if (hist->GetDimension() > 2) cells *= hist->GetNbinsZ() + 2;
+	return cells;
+}
+
+void rootana::HistShm::Publish(const std::vector<const Directory*>& directories)
+{
+	/*!
+	 * \param directories Directories to publish the histograms of
+	 *
+	 * Call from the analysis thread, with all batched fills flushed. Does nothing
+	 * if the last copy was less than the interval ago.
+	 */
+	if (!IsOpen()) return;
+	const double now = GetTimeSec();
+	if (now - fLastPublish < fInterval) return;
+	fLastPublish = now;
+
+	std::map<std::string, const HistBase*> hists;
+	for (size_t i = 0; i< directories.size(); ++i) {
+		if (!directories[i]) continue;
+		const Directory::Map_t& dirHists = directories[i]->GetHists();
+		for (Directory::Map_t::const_iterator it = dirHists.begin(); it != dirHists.end(); ++it) {
+			for (std::list<HistBase*>::const_iterator ih = it->second.begin(); ih != it->second.end(); ++ih) {
+				TH1* hist = (*ih)->hist();
+				if (!hist) continue;
+				std::string path = hist->GetDirectory() ? hist->GetDirectory()->GetPath() : "";
+				if (path.empty() || path[path.size() - 1] != '/') path += "/";
+				path += hist->GetName();
+				hists.insert(std::make_pair(path, *ih)); // first one wins
+			}
+		}
+	}
+
+	bool changed = hists.size() != fPublished.size();
+	for (std::map<std::string, const HistBase*>::const_iterator it = hists.begin(); !changed && it != hists.end(); ++it) {
+		PublishedMap_t::const_iterator ip = fPublished.find(it->first);
+		changed = ip == fPublished.end() || ip->second.fHist != it->second ||
+			ip->second.fCells != GetNumCells(it->second->hist());
+	}
+	if (changed) Layout(hists);
+
+	for (PublishedMap_t::iterator it = fPublished.begin(); it != fPublished.end(); ++it) {
+		Published_t& published = it->second;
+		if (published.fIndex < 0) continue;
+		if (published.fWritten && published.fModified == published.fHist->modified()) continue;
+
+		const TH1* hist = published.fHist->hist();
+		double* cells = fSegment.BeginWrite(published.fIndex);
+		for (UInt_t i = 0; i< published.fCells; ++i)
+			cells[i] = hist->GetBinContent(i);
+		fSegment.EndWrite(published.fIndex, hist->GetEntries());
+		published.fModified = published.fHist->modified();
+		published.fWritten = true;
+	}
+}
+
+void rootana::HistShm::Layout(const std::map<std::string, const HistBase*>& hists)
+{
+	int skipped = 0;
+	fPublished.clear();
+	fSegment.BeginLayout();
+	for (std::map<std::string, const HistBase*>::const_iterator it = hists.begin(); it != hists.end(); ++it) {
+		const TH1* hist = it->second->hist();
+		dragon::utils::HistSegment::Info_t info;
+		memset(&info, 0, sizeof(info));
+		strncpy(info.fPath, it->first.c_str(), sizeof(info.fPath) - 1);
+		strncpy(info.fTitle, hist->GetTitle(), sizeof(info.fTitle) - 1);
+		info.fDimension = hist->GetDimension();
+		const TAxis* axes[3] = { hist->GetXaxis(), hist->GetYaxis(), hist->GetZaxis() };
+		for (UInt_t i = 0; i< info.fDimension && i< 3; ++i) {
+			info.fAxis[i].fBins = axes[i]->GetNbins();
+			info.fAxis[i].fLow = axes[i]->GetXmin();
+			info.fAxis[i].fHigh = axes[i]->GetXmax();
+		}
+		info.fCells = GetNumCells(hist);
+
+		Published_t published;
+		published.fHist = it->second;
+		published.fModified = 0;
+		published.fCells = info.fCells;
+		published.fWritten = false;
+		// paths longer than the segment's are truncated, and might collide: not published
+		published.fIndex = it->first.size() < sizeof(info.fPath) ? fSegment.Add(info) : -1;
+		if (published.fIndex < 0) ++skipped;
+		fPublished[it->first] = published;
+	}
+	fSegment.EndLayout();
+
+	if (skipped)
+		dragon::utils::Warning("rootana::HistShm")
+			<< skipped << " of " << hists.size() << " histograms do not fit in shared memory segment \""
+			<< fSegment.GetName() << "\"; they are not published.";
+}
+
+TH1* rootana::HistShm::Get(const dragon::utils::HistSegment& segment, const char* path)
+{
+	/*!
+	 * \param segment Segment opened (read-only) with dragon::utils::HistSegment::Open()
+	 * \param path Full path of the histogram, e.g. <tt>"rootana:/histos/head/bgo_e0"</tt>
+	 * \returns A TH1D, TH2D or TH3D owned by the caller (not by any directory),
+	 *  named as the last part of the path; 0 if there is no such histogram, or
+	 *  the writer was busy with it for too long.
+	 */
+	dragon::utils::HistSegment::Info_t info;
+	std::vector<double> cells;
+	if (!segment.Read(segment.Find(path), info, cells)) return 0;
+
+	const char* name = strrchr(info.fPath, '/');
+	name = name ? name + 1 : info.fPath;
+	const dragon::utils::HistSegment::Axis_t* a = info.fAxis;
+	TH1* hist = 0;
+	switch (info.fDimension) {
+	case 1:
+		hist = new TH1D(name, info.fTitle, a[0].fBins, a[0].fLow, a[0].fHigh);
+		break;
+	case 2:
+		hist = new TH2D(name, info.fTitle, a[0].fBins, a[0].fLow, a[0].fHigh, a[1].fBins, a[1].fLow, a[1].fHigh);
+		break;
+	case 3:
+		hist = new TH3D(name, info.fTitle, a[0].fBins, a[0].fLow, a[0].fHigh, a[1].fBins, a[1].fLow, a[1].fHigh,
+										a[2].fBins, a[2].fLow, a[2].fHigh);
+		break;
+	default:
+		return 0;
+	}
+	hist->SetDirectory(0);
+	if (GetNumCells(hist) != cells.size()) {
+		delete hist;
+		return 0;
+	}
+	for (size_t i = 0; i< cells.size(); ++i)
+		hist->SetBinContent(i, cells[i]);
+	hist->SetEntries(info.fEntries);
+	return hist;
+}
@@ -0,0 +1,79 @@
+///\file HistShm.hxx
+///\brief Defines a publisher of histogram contents into shared memory, for local viewers.
+#ifndef ROOTANA_HIST_SHM_HXX
+#define ROOTANA_HIST_SHM_HXX
+#include <Rtypes.h>
+
+#ifndef __MAKECINT__
+#include <map>
+#include <string>
+#include <vector>
+#include "utils/HistSegment.hxx"
+
+class TH1;
+
+namespace rootana {
+
+class Directory;
+class HistBase;
+
+/// Publishes the histograms of the analysis into a dragon::utils::HistSegment
+/*!
+ * For viewers on the same machine: instead of each of them asking the analysis
+ * for serialized copies (roody), or for compressed updates (HistServer), they map
+ * the segment read-only and copy the bin contents themselves, so the number of
+ * viewers costs the analysis nothing.
+ *
+ * The analysis thread calls Publish() periodically; it copies the cells of the
+ * histograms whose HistBase::modified() counter changed since the last call into
+ * the segment, under the histogram's sequence lock. No ROOT objects are created
+ * or streamed. The table of histograms is laid out again whenever histograms
+ * are added or removed (e.g. when a run's histogram file is opened or closed).
+ *
+ * Viewers use dragon::utils::HistSegment directly (no ROOT needed), or Get() for a
+ * ROOT histogram of the current contents.
+ */
+class HistShm {
+public:
+	/// Creates the segment
+	HistShm(const char* name, ULong64_t size = 64ULL << 20, UInt_t maxHists = 4096, Double_t interval = 0.5);
+	/// Closes and unlinks the segment
+	~HistShm();
+	/// Checks if the segment was created
+	bool IsOpen() const { return fSegment.IsOpen(); }
+	/// Copies the histograms changed since the last call into the segment
+	void Publish(const std::vector<const Directory*>& directories);
+	/// Returns a new histogram with the contents of one in a segment
+	static TH1* Get(const dragon::utils::HistSegment& segment, const char* path);
+
+private:
+	/// Published histogram
+	struct Published_t {
+		const HistBase* fHist; ///< HistBase address
+		ULong64_t fModified;   ///< HistBase::modified() at the last copy
+		UInt_t fCells;         ///< Number of cells in the segment
+		Int_t fIndex;          ///< Index in the segment, -1 if it did not fit
+		bool fWritten;         ///< Copied at least once
+	};
+	typedef std::map<std::string, Published_t> PublishedMap_t;
+
+	/// Number of cells of a histogram, including under- and overflows
+	static UInt_t GetNumCells(const TH1* hist);
+	/// Lays out the segment for new histograms
+	void Layout(const std::map<std::string, const HistBase*>& hists);
+	/// Time of day in seconds
+	static double GetTimeSec();
+
+private:
+	dragon::utils::HistSegment fSegment;
+	PublishedMap_t fPublished; ///< Histograms in the segment, by path
+	Double_t fInterval;        ///< Minimum time between copies (seconds)
+	Double_t fLastPublish;     ///< Time of the last copy
+};
+
+}
+
+#endif
+
+
+#endif
@@ -5,11 +5,16 @@
  */
 #ifndef DRAGON_ROOTANA_HISTOS_HXX
 #define DRAGON_ROOTANA_HISTOS_HXX
+#include <cmath>
+#include <vector>
+#include <algorithm>
 #include <TH1D.h>
 #include <TH2D.h>
 #include <TH3D.h>
 #include <TDirectory.h>
 #include "utils/Valid.hxx"
+#include "utils/RateHistory.hxx"
+#include "utils/definitions.h"
 #include "DataPointer.hxx"
 #include "Cut.hxx"
 
@@ -24,23 +29,37 @@ namespace rootana {
  * ROOTANA framework.
  * 
  * Also handles application of cuts for derived classes
+ *
+ * Fills may be batched: when the batch size (set_batch_size()) is greater than one,
+ * fill() only evaluates the parameters and cut, and buffers the values; the internal
+ * ROOT histogram is filled (`TH1::FillN`) once the buffer is full or when flush() is
+ * called. Owners of the histograms must call flush() before something reads them.
+ *
+ * Each histogram also counts the calls which changed it (or buffered values for it),
+ * so that servers can tell which histograms need to be sent again.
  */
 class HistBase {
 private:
 	rootana::Cut fCut; ///< Cut (gate) condition
+	Int_t fSharedCut;  ///< Index of the cut in rootana::CutTable, -1 if none
+	ULong64_t fModified; ///< Modification counter
 
 public:
 	/// Sets fCut to NULL, otherwise empty
-	HistBase():	fCut(0) { }
-	/// Empty
-	virtual ~HistBase() { }
+	HistBase():	fCut(0), fSharedCut(-1), fModified(0) { }
+	/// Releases the shared cut, if any
+	virtual ~HistBase() { set_shared_cut(-1); }
 	/// Sets the cut (gate) condition
 	void set_cut(const Cut& cut);
+	/// Sets the cut (gate) condition to an entry of rootana::CutTable
+	void set_shared_cut(Int_t index);
   /// Applies the cut condition
 	bool apply_cut();
 
 	/// Fills the histogram with appropriate data
 	virtual Int_t fill() = 0;
+	/// Fills the histogram with the values buffered by fill()
+	virtual Int_t flush() { return 0; }
 	/// Draw the histogram
 	virtual void draw(Option_t* option = "") const = 0;
 	/// Writes the histogram to disk
@@ -53,8 +72,23 @@ public:
 	virtual const char* name() const = 0;
 	/// Sets owner TDirectory
 	virtual void set_directory(TDirectory*) = 0;
+	/// Returns the internal ROOT histogram
+	virtual TH1* hist() const = 0;
+	/// Returns the modification counter, incremented whenever the histogram changes
+	ULong64_t modified() const { return fModified; }
 	/// For testing
 	void test() { printf ("test\n"); }
+
+	/// Sets the number of values fill() buffers before filling the histogram
+	static void set_batch_size(Int_t size) { batch_size() = size > 1 ? size : 1; }
+	/// Returns the number of values fill() buffers before filling the histogram
+	static Int_t get_batch_size() { return batch_size(); }
+
+protected:
+	/// Batch size shared by all histograms; 1 (the default) fills immediately
+	static Int_t& batch_size() { static Int_t size = 1; return size; }
+	/// Increments the modification counter
+	void touch() { ++fModified; }
 };
 
 /// Rootana histogram class
@@ -73,6 +107,9 @@ protected:
 	const DataPointer* fParamy; ///< Y-axis parameter
 	const DataPointer* fParamz; ///< Z-axis parameter
 	TDirectory* fHistOwner;     /// Directory owning fHist
+	std::vector<Double_t> fBufx; ///< Buffered x values
+	std::vector<Double_t> fBufy; ///< Buffered y values
+	std::vector<Double_t> fBufz; ///< Buffered z values
 
 public:
 	/// 1d (TH1D) constructor
@@ -100,27 +137,39 @@ public:
 
 	/// Calls TH1::Fill using fParamx, fParamy, fParamz
 	virtual Int_t fill();
+	/// Calls TH1::FillN for the buffered values
+	virtual Int_t flush();
 	/// Calls TH1::Draw()
 	virtual void draw(Option_t* option = "") const
 		{ fHist->Draw(option); }
-	/// Calls TH1::Write()
+	/// Calls flush() then TH1::Write()
 	virtual void write()
-		{ fHist->Write(); }
+		{ flush(); fHist->Write(); }
 	/// Calls TH1::SetName()
 	virtual void set_name(const char* name)
 		{ fHist->SetName(name); }
 	/// Calls TH1::GetName()
 	virtual const char* name() const
 		{ return fHist->GetName(); }
-	/// Calls TH1::Clear()
+	/// Discards buffered values, calls TH1::Clear()
 	virtual void clear()
-		{ fHist->Clear(); }
+		{ discard(); fHist->Clear(); touch(); }
 	/// Calls TH1::SetDirectory
 	virtual void set_directory(TDirectory* directory)
 		{
 			fHist->SetDirectory(directory);
 			fHistOwner = directory;
 		}
+	/// Returns fHist
+	virtual TH1* hist() const
+		{ return fHist; }
+
+protected:
+	/// Buffers a set of values, flushing if the buffer is full
+	Int_t buffer(Double_t x, Double_t y = 0., Double_t z = 0.);
+	/// Empties the buffers
+	void discard()
+		{ fBufx.clear(); fBufy.clear(); fBufz.clear(); }
 };
 
 /// Specialized case of TH2D that displays "summary" information
@@ -161,17 +210,57 @@ private:
 	void extend(double factor);
 };
 
+/// Moving-average rate of a scaler channel, over a fixed window of recent time
+/*!
+ * The x-axis is time in seconds relative to the latest scaler readout (so normally
+ * negative, ending at zero), and the y-axis the average rate of the counts parameter
+ * in each bin. Unlike ScalerHist the histogram never grows: readouts are kept in a
+ * dragon::utils::RateHistory sized from the binning (full resolution over the width of
+ * one bin, one readout per bin width beyond that), and every bin is re-calculated from
+ * it after each readout. Readouts are assumed to be DRAGON_SCALER_READ_PERIOD apart.
+ */
+class RateHist: public Hist<TH1D> {
+private:
+	/// Counts of the scaler channel in past readouts
+	dragon::utils::RateHistory fHistory; //!
+public:
+	/// Calls Hist<TH1D> constructor; sizes fHistory from the x-axis of \e hist
+	RateHist(TH1D* hist, const DataPointer* param);
+	/// Empty, Hist<TH1D> destructor handles everything
+	~RateHist() { }
+	/// Add the counts of a readout and re-calculate the rates
+	virtual Int_t fill();
+	/// Forgets past readouts, calls Hist<TH1D>::clear()
+	virtual void clear()
+		{ fHistory.Clear(); Hist<TH1D>::clear(); }
+private:
+	/// History for the x-axis of \e hist
+	static dragon::utils::RateHistory make_history(const TH1D* hist);
+};
+
 
 // INLINE IMPLEMENTATIONS //
 
 inline void rootana::HistBase::set_cut(const Cut& cut)
 {
+	set_shared_cut(-1);
 	fCut.reset(cut);
 }
 
+inline void rootana::HistBase::set_shared_cut(Int_t index)
+{
+	/*! \param index Index returned by rootana::CutTable::intern(), -1 for none */
+	if (index >= 0) rootana::CutTable::instance().acquire(index);
+	if (fSharedCut >= 0) rootana::CutTable::instance().release(fSharedCut);
+	fCut.reset(0);
+	fSharedCut = index;
+}
+
 inline bool rootana::HistBase::apply_cut()
 {
-	/*! \returns true if fCut.get() == 0, otherwise, the value of fCut.operator() */
+	/*! \returns the (once per event) result of the shared cut, if set; otherwise
+	 *  true if fCut.get() == 0, or the value of fCut.operator() */
+	if (fSharedCut >= 0) return rootana::CutTable::instance() (fSharedCut);
 	return !fCut.get() ? true: fCut();
 }
 
@@ -209,6 +298,22 @@ inline rootana::Hist<T>& rootana::Hist<T>::operator= (const Hist& other)
 	return *this;
 }
 
+template <class T>
+inline Int_t rootana::Hist<T>::buffer(Double_t x, Double_t y, Double_t z)
+{
+	/*!
+	 *  Only the values used by the histogram dimension are kept.
+	 *  \returns 1
+	 */
+	if (fBufx.capacity() < (size_t)batch_size())
+		fBufx.reserve(batch_size());
+	fBufx.push_back(x);
+	if (fHist->GetDimension() > 1) fBufy.push_back(y);
+	if (fHist->GetDimension() > 2) fBufz.push_back(z);
+	if (fBufx.size() >= (size_t)batch_size()) flush();
+	return 1;
+}
+
 /// Specialized constructor for TH1
 template <>
 inline rootana::Hist<TH1D>::Hist(TH1D* hist, const DataPointer* param):
@@ -234,13 +339,52 @@ inline rootana::Hist<TH3D>::Hist(TH3D* hist, const DataPointer* paramx, const Da
  	fHistOwner = hist ? hist->GetDirectory() : 0;
 }
 
+/// Specialized flush() for TH1D
+template <>
+inline Int_t rootana::Hist<TH1D>::flush()
+{
+	/*! \returns the number of values filled */
+	const Int_t n = fBufx.size();
+	if (n) fHist->FillN (n, &fBufx[0], 0, 1);
+	discard();
+	return n;
+}
+
+/// Specialized flush() for TH2D
+template <>
+inline Int_t rootana::Hist<TH2D>::flush()
+{
+	/*! \returns the number of values filled
+	 * \note The stride must be given explicitly: TH2 also has a (no-op) four
+	 * argument FillN(), inherited from TH1, that a null weight would select */
+	const Int_t n = fBufx.size();
+	if (n) fHist->FillN (n, &fBufx[0], &fBufy[0], 0, 1);
+	discard();
+	return n;
+}
+
+/// Specialized flush() for TH3D
+template <>
+inline Int_t rootana::Hist<TH3D>::flush()
+{
+	/*! TH3 has no FillN() for three coordinates, so fill point by point
+	 * \returns the number of values filled */
+	const Int_t n = fBufx.size();
+	for (Int_t i = 0; i< n; ++i)
+		fHist->Fill (fBufx[i], fBufy[i], fBufz[i]);
+	discard();
+	return n;
+}
+
 /// Specialized fill() for TH1D
 template <>
 inline Int_t rootana::Hist<TH1D>::fill()
 {
 	/*! Fills the histogram if x param is valid and fCut is satisfied */
-	if ( dragon::utils::is_valid(fParamx->get()) && apply_cut() )
-		return fHist->Fill (fParamx->get());
+	if ( dragon::utils::is_valid(fParamx->get()) && apply_cut() ) {
+		touch();
+		return batch_size() > 1 ? buffer(fParamx->get()) : fHist->Fill (fParamx->get());
+	}
 	else return 0;
 }
 
@@ -249,8 +393,11 @@ template <>
 inline Int_t rootana::Hist<TH2D>::fill()
 {
 	/*! Fills the histogram if x,y params are valid and fCut is satisfied */
-	if ( dragon::utils::is_valid(fParamx->get(), fParamy->get()) && apply_cut() )
-		return fHist->Fill (fParamx->get(), fParamy->get());
+	if ( dragon::utils::is_valid(fParamx->get(), fParamy->get()) && apply_cut() ) {
+		touch();
+		return batch_size() > 1 ?
+			buffer (fParamx->get(), fParamy->get()) : fHist->Fill (fParamx->get(), fParamy->get());
+	}
 	else return 0;
 }
 
@@ -259,12 +406,15 @@ template<>
 inline Int_t rootana::Hist<TH3D>::fill()
 {
 	/*! Fills the histogram if x,y,z params are valid and fCut is satisfied */
-	if (dragon::utils::is_valid(fParamx->get(), fParamy->get(), fParamz->get()) && apply_cut() )
-		return fHist->Fill (fParamx->get(), fParamy->get(), fParamz->get());
+	if (dragon::utils::is_valid(fParamx->get(), fParamy->get(), fParamz->get()) && apply_cut() ) {
+		touch();
+		return batch_size() > 1 ?
+			buffer (fParamx->get(), fParamy->get(), fParamz->get()) :
+			fHist->Fill (fParamx->get(), fParamy->get(), fParamz->get());
+	}
 	else return 0;
 }
 
-
 // Scaler Hist //
 
 inline rootana::ScalerHist::ScalerHist(TH1D* hist, const DataPointer* param):
@@ -305,6 +455,57 @@ inline Int_t rootana::ScalerHist::fill()
 
 	const double counts = fParamx->get();
 	fHist->SetBinContent(1 + fEventNumber++, counts);
+	touch();
+	return counts;
+}
+
+// Rate Hist //
+
+inline dragon::utils::RateHistory rootana::RateHist::make_history(const TH1D* hist)
+{
+	const double period = DRAGON_SCALER_READ_PERIOD / 1000.;
+	const double low  = hist->GetXaxis()->GetXmin();
+	const double high = hist->GetXaxis()->GetXmax();
+	const double width = (high - low) / hist->GetNbinsX();
+	const double reach = std::max(std::fabs(low), std::fabs(high));
+
+	const size_t factor = width > period ? size_t(width / period) : 1;
+	const size_t coarse = size_t(reach / (factor * period)) + 2;
+	return dragon::utils::RateHistory(1, 2*factor + 2, factor, coarse);
+}
+
+inline rootana::RateHist::RateHist(TH1D* hist, const DataPointer* param):
+	rootana::Hist<TH1D>(hist, param), fHistory(make_history(hist))
+{
+	/*!
+	 * \param hist Histogram defining the time axis, e.g. <tt>(..., 360, -3600, 0)</tt>
+	 *  for the last hour in 10 second bins
+	 * \param param DataPointer referencing the scaler counts parameter
+	 */
+	fHist->SetFillColor(30);
+}
+
+inline Int_t rootana::RateHist::fill()
+{
+	/*!
+	 * Each bin costs two constant-time lookups in the history, whatever the
+	 * length of the run.
+	 */
+	const double period = DRAGON_SCALER_READ_PERIOD / 1000.;
+	const double counts = fParamx->get();
+	fHistory.Add(fHistory.GetNumReadouts() * period, &counts);
+
+	const TAxis* axis = fHist->GetXaxis();
+	for (Int_t bin = 1; bin <= fHist->GetNbinsX(); ++bin) {
+		const double start = -std::min(axis->GetBinLowEdge(bin), 0.);
+		const double stop  = -std::min(axis->GetBinUpEdge(bin), 0.);
+		double t0, s0, t1, s1;
+		double rate = 0.;
+		if (fHistory.Sample(0, start, t0, s0) && fHistory.Sample(0, stop, t1, s1) && t1 > t0)
+			rate = (s1 - s0) / (t1 - t0);
+		fHist->SetBinContent(bin, rate);
+	}
+	touch();
 	return counts;
 }
 
@@ -343,10 +544,12 @@ inline Int_t rootana::SummaryHist::fill()
 	if (!apply_cut()) return filled;
 	for (Int_t bin = 0; bin < fHist->GetYaxis()->GetNbins(); ++bin) {
 		if (dragon::utils::is_valid(fParamx->get(bin))) {
-			fHist->Fill (fParamx->get(bin), bin);
+			if (batch_size() > 1) buffer (fParamx->get(bin), bin);
+			else fHist->Fill (fParamx->get(bin), bin);
 			filled = 1;
 		}
 	}
+	if (filled) touch();
 	return filled;
 }
 
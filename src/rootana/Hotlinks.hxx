@@ -0,0 +1,104 @@
+///\file Hotlinks.hxx
+///\brief Defines watching of ODB directories for variable changes during a run.
+#ifndef ROOTANA_HOTLINKS_HXX
+#define ROOTANA_HOTLINKS_HXX
+
+#if defined (MIDASSYS) && !defined (__MAKECINT__)
+#include <set>
+#include <string>
+#include <vector>
+#include "midas.h"
+#include "utils/Thread.hxx"
+#include "utils/ErrorDragon.hxx"
+
+namespace rootana {
+
+/// Collects the ODB keys changed in watched directories
+/*!
+ * Each watched directory gets a db_watch() hotlink. The MIDAS callback only
+ * records the directory holding the changed key. The analysis picks the
+ * directories up with Take() at a point of its choosing, between events, and
+ * re-reads the affected variables from there.
+ */
+class Hotlinks {
+public:
+	/// Set the database handle, watches nothing yet
+	Hotlinks(HNDLE hDB): fDB(hDB) { }
+	/// Remove all watches
+	~Hotlinks()
+		{
+			for (size_t i = 0; i< fKeys.size(); ++i) db_unwatch(fDB, fKeys[i]);
+		}
+
+	/// Watch a directory (and everything below it)
+	bool Add(const char* path)
+		{
+			/*! \returns true if successful */
+			HNDLE hKey;
+			int status = db_find_key(fDB, 0, path, &hKey);
+			if (status == SUCCESS) status = db_watch(fDB, hKey, Dispatch, this);
+			if (status != SUCCESS) {
+				dragon::utils::Warning("rootana::Hotlinks", __FILE__, __LINE__)
+					<< "Cannot watch \"" << path << "\", status " << status;
+				return false;
+			}
+			fKeys.push_back(hKey);
+			return true;
+		}
+
+	/// Watch the "Settings" directory of every equipment
+	int AddEquipmentSettings()
+		{
+			/*! \returns The number of directories watched */
+			HNDLE hEquipment, hKey;
+			if (db_find_key(fDB, 0, "/Equipment", &hEquipment) != SUCCESS) return 0;
+			int n = 0;
+			for (int i = 0; db_enum_key(fDB, hEquipment, i, &hKey) == SUCCESS; ++i) {
+				KEY key;
+				if (db_get_key(fDB, hKey, &key) != SUCCESS || key.type != TID_KEY) continue;
+				const std::string path = std::string("/Equipment/") + key.name + "/Settings";
+				HNDLE hSettings;
+				if (db_find_key(fDB, 0, path.c_str(), &hSettings) == SUCCESS && Add(path.c_str())) ++n;
+			}
+			return n;
+		}
+
+	/// Move the directories changed since the last call into \e dirs
+	void Take(std::set<std::string>& dirs)
+		{
+			dragon::utils::ScopedLock lock(fMutex);
+			dirs.swap(fChanged);
+			fChanged.clear();
+		}
+
+private:
+	/// MIDAS callback, records the directory holding the changed key
+	static void Dispatch(INT hDB, INT hKey, INT, void* info)
+		{
+			char path[MAX_ODB_PATH];
+			if (db_get_path(hDB, hKey, path, sizeof(path)) != SUCCESS) return;
+			std::string dir = path;
+			const size_t slash = dir.rfind('/');
+			if (slash != std::string::npos && slash > 0) dir.resize(slash);
+
+			Hotlinks* self = static_cast<Hotlinks*>(info);
+			dragon::utils::ScopedLock lock(self->fMutex);
+			self->fChanged.insert(dir);
+		}
+
+private:
+	Hotlinks(const Hotlinks&);
+	Hotlinks& operator= (const Hotlinks&);
+
+	HNDLE fDB;
+	std::vector<HNDLE> fKeys;         ///< Watched directories
+	std::set<std::string> fChanged;   ///< Directories changed since the last Take()
+	dragon::utils::Mutex fMutex;
+};
+
+}
+
+#endif
+
+
+#endif
@@ -0,0 +1,173 @@
+///\file LatencyStats.hxx
+///\brief Defines online statistics of the time events take to reach the histograms.
+#ifndef ROOTANA_LATENCY_STATS_HXX
+#define ROOTANA_LATENCY_STATS_HXX
+#include <Rtypes.h>
+
+#ifndef __MAKECINT__
+#include <cmath>
+#include <cstring>
+#endif
+
+namespace rootana {
+
+/// Event latency percentiles over the last update interval
+/*!
+ * Updated once per second from rootana::App, online and when replaying, and
+ * available for histogramming as rootana::gLatency (filled with event id 10).
+ * Arrays are indexed by the latency kind, e.g. <tt>rootana::gLatency.p99[1]</tt>
+ * is the 99th percentile of the time from receipt to histogram fill.
+ */
+struct LatencyStats {
+	/// Latency kinds
+	enum {
+		QUEUE = 0,    ///< Time spent waiting in the timestamp queue (head and tail events)
+		TOTAL = 1,    ///< Time from receipt (by the receive thread, if any) until the histograms were filled
+		DAQ = 2,      ///< Time from the MIDAS time stamp until the histograms were filled (online only, to within a second)
+		NUM_KINDS = 3
+	};
+	/// Median, in milliseconds
+	Double_t p50[NUM_KINDS];
+	/// 99th percentile, in milliseconds
+	Double_t p99[NUM_KINDS];
+	/// Maximum, in milliseconds
+	Double_t max[NUM_KINDS];
+	/// Events measured per second
+	Double_t rate[NUM_KINDS];
+	/// Bit \e i is set while p99[i] is above its alarm threshold
+	Int_t alarm;
+
+	/// Set all to zero
+	LatencyStats() { reset(); }
+	/// Set all to zero
+	void reset()
+		{ for (int i = 0; i< NUM_KINDS; ++i) p50[i] = p99[i] = max[i] = rate[i] = 0; alarm = 0; }
+};
+
+#ifndef __MAKECINT__
+
+/// Collects event latencies and turns them into LatencyStats
+/*!
+ * Latencies are counted in bins of an eighth of an octave (about 10%), from a
+ * microsecond to about an hour, so that recording one costs a few operations
+ * and percentiles are interpolated within a bin. The maxima are exact.
+ * Counts are kept both for the current update interval and since Reset(),
+ * e.g. for a summary at the end of a replay.
+ */
+class LatencyMonitor {
+public:
+	/// Set minimum time between updates, in seconds
+	LatencyMonitor(Double_t interval = 1.):
+		fInterval(interval), fLastTime(0)
+		{ memset(fThreshold, 0, sizeof(fThreshold)); Reset(); }
+	/// Record one latency of kind \e kind (LatencyStats::QUEUE, ...), in seconds
+	void Record(Int_t kind, Double_t sec)
+		{
+			const Int_t bin = Bin(sec);
+			++fCounts[kind][bin];
+			++fRunCounts[kind][bin];
+			if (sec > fMax[kind]) fMax[kind] = sec;
+			if (sec > fRunMax[kind]) fRunMax[kind] = sec;
+		}
+	/// Update \e stats from the latencies recorded since the last update, if the interval has passed
+	/*!
+	 * \param stats Statistics to update
+	 * \param now Time of day, in seconds
+	 * \returns true if \e stats was updated
+	 */
+	Bool_t Update(LatencyStats& stats, Double_t now)
+		{
+			if (now < fLastTime) fLastTime = 0;
+			if (now - fLastTime < fInterval) return kFALSE;
+			const Double_t dt = fLastTime > 0 ? now - fLastTime : 0;
+			stats.alarm = 0;
+			for (int i = 0; i< LatencyStats::NUM_KINDS; ++i) {
+				ULong64_t n = 0;
+				for (int j = 0; j< NUM_BINS; ++j) n += fCounts[i][j];
+				stats.p50[i] = 1e3 * Quantile(fCounts[i], n, fMax[i], 0.50);
+				stats.p99[i] = 1e3 * Quantile(fCounts[i], n, fMax[i], 0.99);
+				stats.max[i] = 1e3 * fMax[i];
+				stats.rate[i] = dt > 0 ? n / dt : 0;
+				if (fThreshold[i] > 0 && stats.p99[i] > fThreshold[i]) stats.alarm |= (1 << i);
+			}
+			memset(fCounts, 0, sizeof(fCounts));
+			memset(fMax, 0, sizeof(fMax));
+			fLastTime = now;
+			return kTRUE;
+		}
+	/// Latency percentiles of kind \e kind since Reset(), in milliseconds
+	/*! \returns The number of latencies recorded */
+	ULong64_t GetRunTotals(Int_t kind, Double_t& p50, Double_t& p99, Double_t& max) const
+		{
+			ULong64_t n = 0;
+			for (int j = 0; j< NUM_BINS; ++j) n += fRunCounts[kind][j];
+			p50 = 1e3 * Quantile(fRunCounts[kind], n, fRunMax[kind], 0.50);
+			p99 = 1e3 * Quantile(fRunCounts[kind], n, fRunMax[kind], 0.99);
+			max = 1e3 * fRunMax[kind];
+			return n;
+		}
+	/// Alarm threshold on the 99th percentile of kind \e kind, in milliseconds (0 for none)
+	void SetThreshold(Int_t kind, Double_t msec) { fThreshold[kind] = msec; }
+	/// Alarm threshold on the 99th percentile of kind \e kind, in milliseconds
+	Double_t GetThreshold(Int_t kind) const { return fThreshold[kind]; }
+	/// Forget all latencies recorded so far
+	void Reset()
+		{
+			memset(fCounts, 0, sizeof(fCounts));
+			memset(fRunCounts, 0, sizeof(fRunCounts));
+			memset(fMax, 0, sizeof(fMax));
+			memset(fRunMax, 0, sizeof(fRunMax));
+		}
+
+private:
+	/// Number of bins: below a microsecond, then 8 per octave
+	enum { NUM_BINS = 1 + 8*32 };
+
+	/// Bin of a latency in seconds
+	static Int_t Bin(Double_t sec)
+		{
+			const Double_t usec = 1e6 * sec;
+			if (!(usec >= 1)) return 0; // also negative (clock steps) and NaN
+			int exp;
+			const Double_t mant = frexp(usec, &exp); // usec = mant * 2^exp, 0.5 <= mant < 1
+			const Int_t bin = 1 + 8*(exp - 1) + Int_t(16*(mant - 0.5));
+			return bin < NUM_BINS ? bin : NUM_BINS - 1;
+		}
+	/// Lower edge of a bin, in seconds
+	static Double_t LowEdge(Int_t bin)
+		{
+			if (bin == 0) return 0;
+			const Int_t exp = (bin - 1)/8 + 1, sub = (bin - 1)%8;
+			return 1e-6 * ldexp(0.5 + sub/16., exp);
+		}
+	/// Quantile \e q of \e n counts, interpolated within the bin and limited to \e max (seconds)
+	static Double_t Quantile(const ULong64_t* counts, ULong64_t n, Double_t max, Double_t q)
+		{
+			if (n == 0) return 0;
+			const Double_t target = q*n;
+			ULong64_t sum = 0;
+			for (int j = 0; j< NUM_BINS; ++j) {
+				if (!counts[j] || sum + counts[j] < target) { sum += counts[j]; continue; }
+				const Double_t low = LowEdge(j), high = j + 1 < NUM_BINS ? LowEdge(j + 1) : max;
+				const Double_t value = low + (high - low) * (target - sum) / counts[j];
+				return value < max ? value : max;
+			}
+			return max;
+		}
+
+private:
+	Double_t fInterval; ///< Minimum time between updates (seconds)
+	Double_t fLastTime; ///< Time of day at the last update
+	ULong64_t fCounts[LatencyStats::NUM_KINDS][NUM_BINS];    ///< Counts since the last update
+	ULong64_t fRunCounts[LatencyStats::NUM_KINDS][NUM_BINS]; ///< Counts since Reset()
+	Double_t fMax[LatencyStats::NUM_KINDS];       ///< Maximum since the last update (seconds)
+	Double_t fRunMax[LatencyStats::NUM_KINDS];    ///< Maximum since Reset() (seconds)
+	Double_t fThreshold[LatencyStats::NUM_KINDS]; ///< Alarm thresholds on the 99th percentile (milliseconds)
+};
+
+#endif
+
+}
+
+
+#endif
@@ -15,12 +15,21 @@
 #pragma link C++ class rootana::HistParser+;
 #pragma link C++ class rootana::SummaryHist+;
 #pragma link C++ class rootana::ScalerHist+;
+#pragma link C++ class rootana::RateHist+;
 #pragma link C++ class rootana::DataPointer+;
 #pragma link C++ class rootana::Directory+;
+#pragma link C++ class rootana::ReceiverStats+;
+#pragma link C++ class rootana::LoadStats+;
+#pragma link C++ class rootana::ProfileStats+;
+#pragma link C++ class rootana::LatencyStats+;
 
 #pragma link C++ global rootana::gHead;
 #pragma link C++ global rootana::gTail;
 #pragma link C++ global rootana::gCoinc;
+#pragma link C++ global rootana::gReceiver;
+#pragma link C++ global rootana::gLoad;
+#pragma link C++ global rootana::gProfile;
+#pragma link C++ global rootana::gLatency;
 
 #pragma link C++ function rootana::DataPointer::New(Char_t);
 #pragma link C++ function rootana::DataPointer::New(Short_t);
@@ -0,0 +1,116 @@
+///\file LoadShedder.hxx
+///\brief Defines a controller reducing the online analysis load when it falls behind.
+#ifndef ROOTANA_LOAD_SHEDDER_HXX
+#define ROOTANA_LOAD_SHEDDER_HXX
+#include <Rtypes.h>
+
+namespace rootana {
+
+/// State of the online load shedding
+/*!
+ * Updated periodically from rootana::App, and available for histogramming
+ * as rootana::gLoad (filled with event id 8).
+ */
+struct LoadStats {
+	/// Processing mode, see LoadShedder::Mode_t
+	Int_t mode;
+	/// Fraction of head and tail singles events processed is 1 / prescale
+	Int_t prescale;
+	/// Fill level of the MIDAS buffer (or the receive ring, if larger), 0 to 1
+	Double_t buffer;
+	/// Number of events in the timestamp queue, relative to its nominal size
+	Double_t queue;
+
+	/// Set to defaults (full processing)
+	LoadStats() { reset(); }
+	/// Set to defaults (full processing)
+	void reset()
+		{ mode = 0; prescale = 1; buffer = queue = 0; }
+};
+
+/// Chooses how much of the online data to process from the backlog
+/*!
+ * The backlog is the larger of the buffer and queue levels passed to Update().
+ * Whenever it stays above a high-water mark, the controller steps up from full
+ * processing, through prescaling of singles events by increasing powers of two
+ * up to a maximum, to sampling only the most recent events from the MIDAS
+ * buffer (GET_RECENT). It steps back down once the backlog falls below a
+ * low-water mark. After each step the next one is held off for a number of
+ * updates, to let the backlog respond.
+ *
+ * Coincidences, scalers and EPICS events are never prescaled.
+ */
+class LoadShedder {
+public:
+	/// Processing modes
+	enum Mode_t {
+		kFull = 0,      ///< Process all events
+		kPrescaled = 1, ///< Process 1 / GetPrescale() singles, all others
+		kRecent = 2     ///< As kPrescaled, and only sample recent events from the buffer
+	};
+
+public:
+	/// Set maximum prescale (rounded down to a power of 2), 0 disables load shedding
+	LoadShedder(Int_t maxPrescale, Double_t high = 0.5, Double_t low = 0.1, Int_t hold = 10):
+		fMaxLevel(-1), fLevel(0), fHold(0), fHoldUpdates(hold),
+		fHigh(high), fLow(low), fCount(0)
+		{ if (maxPrescale > 0) for (fMaxLevel = 0; (2 << fMaxLevel) <= maxPrescale; ++fMaxLevel); }
+	/// Returns true if load shedding is enabled
+	Bool_t IsEnabled() const
+		{ return fMaxLevel >= 0; }
+	/// Returns the current mode
+	Mode_t GetMode() const
+		{ return fLevel == 0 ? kFull : fLevel > fMaxLevel ? kRecent : kPrescaled; }
+	/// Returns the maximum singles prescale
+	Int_t GetMaxPrescale() const
+		{ return IsEnabled() ? 1 << fMaxLevel : 1; }
+	/// Returns the current singles prescale
+	Int_t GetPrescale() const
+		{ return 1 << (fLevel > fMaxLevel ? fMaxLevel : fLevel); }
+	/// Check if the next singles event should be processed
+	Bool_t AcceptSingle()
+		{
+			if (fLevel == 0) return kTRUE;
+			if (++fCount < GetPrescale()) return kFALSE;
+			fCount = 0;
+			return kTRUE;
+		}
+	/// Update from the current backlog
+	/*!
+	 * \param buffer Buffer fill level (0 to 1)
+	 * \param queue Queue fill level (relative to nominal)
+	 * \param stats Filled with the new state
+	 * \returns true if the mode or prescale changed
+	 */
+	Bool_t Update(Double_t buffer, Double_t queue, LoadStats& stats)
+		{
+			const Int_t level = fLevel;
+			const Double_t backlog = buffer > queue ? buffer : queue;
+			if (!IsEnabled()) { }
+			else if (fHold > 0) --fHold;
+			else if (backlog > fHigh && fLevel <= fMaxLevel) { ++fLevel; fHold = fHoldUpdates; }
+			else if (backlog < fLow  && fLevel > 0)          { --fLevel; fHold = fHoldUpdates; }
+			stats.mode = GetMode();
+			stats.prescale = GetPrescale();
+			stats.buffer = buffer;
+			stats.queue = queue;
+			return fLevel != level;
+		}
+	/// Return to full processing
+	void Reset()
+		{ fLevel = 0; fHold = 0; fCount = 0; }
+
+private:
+	Int_t fMaxLevel;    ///< log2 of the maximum prescale, -1 if disabled
+	Int_t fLevel;       ///< 0 (full), log2 of the prescale, or fMaxLevel + 1 (recent)
+	Int_t fHold;        ///< Updates left before the next change
+	Int_t fHoldUpdates; ///< Updates to wait after each change
+	Double_t fHigh;     ///< Backlog above which to shed more
+	Double_t fLow;      ///< Backlog below which to shed less
+	Int_t fCount;       ///< Singles since the last one accepted
+};
+
+}
+
+
+#endif
@@ -0,0 +1,92 @@
+///\file ProfileStats.hxx
+///\brief Defines online statistics of the per-stage analysis timing.
+#ifndef ROOTANA_PROFILE_STATS_HXX
+#define ROOTANA_PROFILE_STATS_HXX
+#include <Rtypes.h>
+
+#ifndef __MAKECINT__
+#include <cstring>
+#include "utils/Profile.hxx"
+#endif
+
+namespace rootana {
+
+/// Timing of the analysis stages over the last update interval
+/*!
+ * Updated periodically from rootana::App while profiling is enabled (-S option),
+ * and available for histogramming as rootana::gProfile (filled with event id 9).
+ * Arrays are indexed by dragon::utils::Profile::Stage_t, e.g.
+ * <tt>rootana::gProfile.mean[4]</tt> is the mean time of dragon::Head::unpack().
+ */
+struct ProfileStats {
+	/// Number of stages
+	enum { NUM_STAGES = 10 };
+	/// Mean time per call, in microseconds
+	Double_t mean[NUM_STAGES];
+	/// Calls per second
+	Double_t rate[NUM_STAGES];
+	/// Fraction of the wall time spent in each stage
+	Double_t busy[NUM_STAGES];
+
+	/// Set all to zero
+	ProfileStats() { reset(); }
+	/// Set all to zero
+	void reset()
+		{ for (int i = 0; i< NUM_STAGES; ++i) mean[i] = rate[i] = busy[i] = 0; }
+};
+
+#ifndef __MAKECINT__
+
+/// Turns the accumulated dragon::utils::Profile counters into ProfileStats
+class ProfileMonitor {
+public:
+	/// Set minimum time between updates, in seconds
+	ProfileMonitor(Double_t interval = 1.):
+		fInterval(interval), fLastTime(0), fTicksPerSec(0)
+		{ memset(fLast, 0, sizeof(fLast)); }
+	/// Update \e stats, if profiling is enabled and the interval has passed
+	/*!
+	 * \returns true if \e stats was updated
+	 * \note The TSC frequency is measured at the first update, so the interval
+	 *  should be long enough for that to be accurate (see Profile::TicksPerSecond()).
+	 */
+	Bool_t Update(ProfileStats& stats)
+		{
+			typedef dragon::utils::Profile Profile;
+			if (!Profile::IsEnabled()) return kFALSE;
+			const Double_t t = Profile::Elapsed();
+			if (t < fLastTime) fLastTime = 0; // re-enabled
+			if (t - fLastTime < fInterval) return kFALSE;
+			if (fTicksPerSec <= 0) fTicksPerSec = Profile::TicksPerSecond();
+
+			Profile::Counter_t now[Profile::kNumStages];
+			Profile::Get(now);
+			const Double_t dt = t - fLastTime, sample = Profile::GetSample();
+			for (int i = 0; i< Profile::kNumStages; ++i) {
+				const Double_t calls = now[i].fCalls - fLast[i].fCalls;
+				const Double_t sec = (now[i].fTicks - fLast[i].fTicks) / fTicksPerSec;
+				stats.mean[i] = calls > 0 ? 1e6 * sec / calls : 0;
+				stats.rate[i] = calls * sample / dt;
+				stats.busy[i] = sec * sample / dt;
+			}
+			memcpy(fLast, now, sizeof(fLast));
+			fLastTime = t;
+			return kTRUE;
+		}
+
+private:
+	/// Compile-time check that ProfileStats has room for every stage
+	typedef char StagesCheck_t[int(ProfileStats::NUM_STAGES) == int(dragon::utils::Profile::kNumStages) ? 1 : -1];
+
+	Double_t fInterval;    ///< Minimum time between updates (seconds)
+	Double_t fLastTime;    ///< Profile::Elapsed() at the last update
+	Double_t fTicksPerSec; ///< Profile::TicksPerSecond(), measured at the first update
+	dragon::utils::Profile::Counter_t fLast[dragon::utils::Profile::kNumStages]; ///< Counters at the last update
+};
+
+#endif
+
+}
+
+
+#endif
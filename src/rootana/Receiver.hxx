@@ -0,0 +1,416 @@
+///\file Receiver.hxx
+///\brief Defines threads receiving online MIDAS events, or replaying a MIDAS file,
+/// into a lock-free ring.
+#ifndef ROOTANA_RECEIVER_HXX
+#define ROOTANA_RECEIVER_HXX
+#include <vector>
+#include <Rtypes.h>
+
+#ifndef __MAKECINT__
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <sys/time.h>
+#include <unistd.h>
+#include "utils/definitions.h"
+#include "utils/ErrorDragon.hxx"
+#include "utils/Thread.hxx"
+#include "midas/Event.hxx"
+#include "midas/libMidasInterface/TMidasFile.h"
+#include "midas/libMidasInterface/TMidasStructs.h"
+#endif
+#ifdef MIDASSYS
+#ifndef __MAKECINT__
+#include "midas.h"
+#endif
+#include "IncludeMidasOnline.h"
+#endif
+
+namespace rootana {
+
+/// Statistics of the online receive thread
+/*!
+ * Updated periodically from rootana::App, and available for histogramming
+ * as rootana::gReceiver (filled with event id 7).
+ */
+struct ReceiverStats {
+	/// Ring size, in events
+	Int_t capacity;
+	/// Number of events waiting in the ring
+	Int_t occupancy;
+	/// Largest number of events waiting in the ring so far
+	Int_t high_water;
+	/// Number of events received from the MIDAS buffer
+	ULong64_t n_received;
+	/// Number of received events discarded because the ring was full
+	ULong64_t n_dropped;
+	/// Receive rate (events per second) since the last update
+	Double_t rate;
+
+	/// Set all to zero
+	ReceiverStats() { reset(); }
+	/// Set all to zero
+	void reset()
+		{ capacity = occupancy = high_water = 0; n_received = n_dropped = 0; rate = 0; }
+};
+
+#ifndef __MAKECINT__
+
+/// Receives events in a separate thread
+/*!
+ * Events are copied from their source as soon as they arrive, into one of a fixed
+ * number of event-sized slots, and handed over to the analysis thread through a
+ * dragon::utils::SpscRing. The analysis thread calls Drain() to process them;
+ * slots are passed back to the receive thread through a second ring. If the
+ * analysis falls behind and all slots are in use, the receive thread either waits
+ * for one to be freed (kBlock, the source then backs up as before) or discards the
+ * oldest waiting event (kDropOldest).
+ *
+ * Each event is stamped with the time it was received, available to the handler
+ * as GetReceiveTime() (e.g. for latency monitoring).
+ *
+ * The source is given by derived classes, in Receive(): OnlineReceiver (a MIDAS
+ * buffer) or ReplayReceiver (a MIDAS file). Their destructors must call Stop(), so
+ * that the thread no longer calls Receive() once they are gone.
+ */
+class Receiver: public dragon::utils::Thread {
+public:
+	/// What to do when the ring is full
+	enum Overflow_t {
+		kBlock = 0,     ///< Wait for the analysis thread
+		kDropOldest = 1 ///< Discard the oldest event in the ring
+	};
+	/// Event handler, same as TMidasOnline::EventHandler
+	typedef void (*Handler_t)(const void* header, const void* data, int size);
+
+public:
+	/// Allocate slots, does not start the thread
+	Receiver(size_t capacity, Overflow_t overflow, size_t maxEventSize = 1024*1024);
+	/// Stop the thread, free slots
+	virtual ~Receiver();
+	/// Tell the thread to return and wait for it
+	void Stop();
+	/// Handle events waiting in the ring, for up to \e maxSec seconds (all if < 0)
+	size_t Drain(Handler_t handler, double maxSec);
+	/// Update statistics
+	void UpdateStats(ReceiverStats& stats);
+	/// Number of event slots
+	size_t Capacity() const { return fEvents.Capacity(); }
+	/// Number of events waiting in the ring
+	size_t Size() const { return fEvents.Size(); }
+	/// Largest number of events waiting in the ring so far
+	size_t HighWater() const { return fHighWater; }
+	/// Number of events received
+	ULong64_t GetNumReceived() const { return fReceived; }
+	/// Number of received events discarded because the ring was full
+	ULong64_t GetNumDropped() const { return fDropped; }
+	/// Number of events handled by Drain()
+	ULong64_t GetNumHandled() const { return fHandled; }
+	/// Time spent handling events in Drain(), in seconds
+	double GetBusyTime() const { return fBusy; }
+	/// Check if the source has no more events, and the thread returned
+	bool IsDone() const { return fDone; }
+	/// Time of day at which the event being handled by Drain() was received, 0 outside of Drain()
+	double GetReceiveTime() const { return fReceiveTime; }
+	/// Switch to receiving from another (polled) event request; only used online
+	virtual void SetRequestId(int) { }
+	/// Time of day in seconds
+	static double GetTimeSec()
+		{ timeval tv; gettimeofday(&tv, 0); return tv.tv_sec + 1e-6*tv.tv_usec; }
+
+protected:
+	/// Copy the next event (header and data) into \e slot
+	/*!
+	 * \returns Its size in bytes, 0 if there is none yet, negative if the source
+	 *  has no more events
+	 */
+	virtual int Receive(char* slot, size_t maxSize) = 0;
+	/// Check if Stop() was called
+	bool IsStopping() const { return fStop; }
+
+private:
+	/// Receive loop
+	void Run();
+
+private:
+	Overflow_t fOverflow;
+	size_t fMaxEventSize;
+	std::vector<char*> fSlots; ///< All slots (for freeing): receive time (double), then the event
+	dragon::utils::SpscRing<char*> fEvents; ///< Received events, receive -> analysis thread
+	dragon::utils::SpscRing<char*> fFree;   ///< Empty slots, analysis -> receive thread
+	volatile bool fStop;
+	volatile bool fDone;          ///< Written by the receive thread only
+	volatile ULong64_t fReceived; ///< Written by the receive thread only
+	volatile ULong64_t fDropped;  ///< Written by the receive thread only
+	volatile size_t fHighWater;   ///< Written by the receive thread only
+	ULong64_t fHandled;           ///< Analysis thread only
+	double fBusy;                 ///< Analysis thread only
+	double fReceiveTime;          ///< Analysis thread only
+	ULong64_t fLastReceived;      ///< fReceived at the last UpdateStats()
+	double fLastTime;             ///< Time of the last UpdateStats()
+};
+
+#ifdef MIDASSYS
+
+/// Receives events from a MIDAS buffer
+/*!
+ * \note The event request must be made with <tt>poll = true</tt>, so that
+ *  events are not also delivered through the TMidasOnline event callback.
+ */
+class OnlineReceiver: public Receiver {
+public:
+	/// Allocate slots, does not start the thread
+	OnlineReceiver(int requestId, size_t capacity, Overflow_t overflow, size_t maxEventSize = 1024*1024):
+		Receiver(capacity, overflow, maxEventSize), fRequestId(requestId) { }
+	/// Stop the thread
+	~OnlineReceiver() { Stop(); }
+	/// Switch to receiving from another (polled) event request
+	void SetRequestId(int requestId) { fRequestId = requestId; }
+
+protected:
+	/// Poll the event request
+	int Receive(char* slot, size_t maxSize)
+		{
+			const int size = TMidasOnline::instance()->receiveEvent(fRequestId, slot, maxSize, true);
+			return size > 0 ? size : 0; // no event (or error, already reported)
+		}
+
+private:
+	volatile int fRequestId;
+};
+
+#endif
+
+/// Replays the events of a MIDAS file, at a multiple of the recorded rate
+/*!
+ * For load tests of the online analysis without a DAQ: events are read from the
+ * file in the receive thread and released to the ring when they would arrive at
+ * \e speed times the recorded rate. Their arrival times are taken from the TSC
+ * trigger times of the head and tail events; other events are released as soon
+ * as they are read. Jumps back of more than a second (e.g. a TSC reset) start
+ * the timing over. If a head or tail event has no TSC bank, the rest of the file
+ * is replayed as fast as possible.
+ *
+ * With a speed of zero, events are released as fast as the ring takes them,
+ * and no trigger times are read.
+ *
+ * \note Trigger times are read with midas::Event, so while profiling (-S) the
+ *  event_init stage also counts the replay thread.
+ */
+class ReplayReceiver: public Receiver {
+public:
+	/// Open the file, does not start the thread
+	ReplayReceiver(const char* filename, double speed, size_t capacity, Overflow_t overflow,
+								 size_t maxEventSize = 1024*1024);
+	/// Stop the thread, close the file
+	~ReplayReceiver() { Stop(); fFile.Close(); }
+	/// Check if the file was opened
+	bool IsOpen() const { return fOpen; }
+	/// Time between the first and the last event replayed, from their MIDAS time stamps (seconds)
+	double GetRecordedTime() const
+		{ return fLastStamp > fFirstStamp ? double(fLastStamp - fFirstStamp) : 0; }
+
+protected:
+	/// Read the next event, and wait until it is due
+	int Receive(char* slot, size_t maxSize);
+
+private:
+	/// Wait until an event with trigger time \e trigger (microseconds) is due
+	void Pace(double trigger);
+
+private:
+	TMidasFile fFile;
+	TMidasEvent fEvent;
+	bool fOpen;
+	double fSpeed;              ///< Multiple of the recorded rate, 0 as fast as possible
+	bool fPacing;               ///< fTrigger0 and fTime0 are set
+	double fTrigger0;           ///< Trigger time at which the timing (re)started (microseconds)
+	double fTime0;              ///< Time of day at which the timing (re)started
+	double fLatest;             ///< Latest trigger time so far
+	volatile uint32_t fFirstStamp; ///< MIDAS time stamp of the first event
+	volatile uint32_t fLastStamp;  ///< MIDAS time stamp of the latest event
+};
+
+#endif
+
+}
+
+
+#ifndef __MAKECINT__
+
+inline rootana::Receiver::Receiver(size_t capacity, Overflow_t overflow, size_t maxEventSize):
+	fOverflow(overflow), fMaxEventSize(maxEventSize),
+	fEvents(capacity), fFree(capacity), fStop(false), fDone(false),
+	fReceived(0), fDropped(0), fHighWater(0), fHandled(0), fBusy(0), fReceiveTime(0), fLastReceived(0)
+{
+	/*!
+	 * \param capacity Number of event slots
+	 * \param overflow What to do when all slots are full
+	 * \param maxEventSize Size of each slot, in bytes (including the event header)
+	 *
+	 * Slot memory is only touched as far as events are written into it.
+	 */
+	for (size_t i = 0; i < fEvents.Capacity(); ++i) {
+		fSlots.push_back(static_cast<char*>(malloc(sizeof(double) + fMaxEventSize)));
+		fFree.Push(fSlots.back());
+	}
+	fLastTime = GetTimeSec();
+}
+
+inline rootana::Receiver::~Receiver()
+{
+	Stop();
+	for (size_t i = 0; i < fSlots.size(); ++i) free(fSlots[i]);
+}
+
+inline void rootana::Receiver::Stop()
+{
+	fStop = true;
+	Join();
+}
+
+inline void rootana::Receiver::Run()
+{
+	char* slot = 0;
+	while (!fStop) {
+		if (!slot && !fFree.Pop(slot)) {
+			if (fOverflow == kDropOldest && fEvents.DropOldest(slot))
+				++fDropped;
+			else { // wait for the analysis thread
+				usleep(1000);
+				continue;
+			}
+		}
+		int size = Receive(slot + sizeof(double), fMaxEventSize);
+		if (size < 0) { // end of the source
+			fDone = true;
+			break;
+		}
+		if (size == 0) {
+			usleep(1000);
+			continue;
+		}
+		*reinterpret_cast<double*>(slot) = GetTimeSec();
+		++fReceived;
+		fEvents.Push(slot); // always room, fEvents holds at most all of the slots
+		slot = 0;
+		const size_t n = fEvents.Size();
+		if (n > fHighWater) fHighWater = n;
+	}
+	if (slot) fFree.Push(slot);
+}
+
+inline size_t rootana::Receiver::Drain(Handler_t handler, double maxSec)
+{
+	/*!
+	 * \param handler Function to call for each event
+	 * \param maxSec Time limit, checked after each event; negative to empty the ring
+	 * \returns The number of events handled
+	 */
+	const double start = GetTimeSec(), stop = start + maxSec;
+	size_t n = 0;
+	char* slot;
+	while (fEvents.Pop(slot)) {
+		fReceiveTime = *reinterpret_cast<const double*>(slot);
+		const TMidas_EVENT_HEADER* header = reinterpret_cast<const TMidas_EVENT_HEADER*>(slot + sizeof(double));
+		handler(header, header + 1, header->fDataSize);
+		fFree.Push(slot);
+		++n;
+		if (maxSec >= 0 && GetTimeSec() > stop) break;
+	}
+	fReceiveTime = 0;
+	if (n) {
+		fHandled += n;
+		fBusy += GetTimeSec() - start;
+	}
+	return n;
+}
+
+inline void rootana::Receiver::UpdateStats(ReceiverStats& stats)
+{
+	const double t = GetTimeSec();
+	const ULong64_t received = fReceived;
+	stats.capacity   = fEvents.Capacity();
+	stats.occupancy  = fEvents.Size();
+	stats.high_water = fHighWater;
+	stats.n_received = received;
+	stats.n_dropped  = fDropped;
+	stats.rate       = t > fLastTime ? (received - fLastReceived) / (t - fLastTime) : 0;
+	fLastReceived = received;
+	fLastTime = t;
+}
+
+inline rootana::ReplayReceiver::ReplayReceiver(const char* filename, double speed, size_t capacity,
+																							 Overflow_t overflow, size_t maxEventSize):
+	Receiver(capacity, overflow, maxEventSize),
+	fOpen(false), fSpeed(speed > 0 ? speed : 0), fPacing(false),
+	fTrigger0(0), fTime0(0), fLatest(0), fFirstStamp(0), fLastStamp(0)
+{
+	/*!
+	 * \param filename MIDAS file to replay
+	 * \param speed Multiple of the recorded event rate, 0 (or less) for as fast as possible
+	 * \param capacity, overflow, maxEventSize As for Receiver
+	 */
+	fOpen = fFile.Open(filename);
+	if (!fOpen)
+		dragon::utils::Error("rootana::ReplayReceiver") << filename << ": " << fFile.GetLastError();
+}
+
+inline int rootana::ReplayReceiver::Receive(char* slot, size_t maxSize)
+{
+	if (!fOpen || !fFile.ReadView(&fEvent)) return -1;
+	const TMidas_EVENT_HEADER* header = fEvent.GetEventHeader();
+	const size_t size = sizeof(TMidas_EVENT_HEADER) + header->fDataSize;
+	if (size > maxSize) {
+		dragon::utils::Warning("rootana::ReplayReceiver")
+			<< "Skipping event " << header->fEventId << ", serial number " << header->fSerialNumber
+			<< ": " << size << " bytes, larger than the slots of " << maxSize;
+		return 0;
+	}
+	if (!fFirstStamp) fFirstStamp = header->fTimeStamp;
+	fLastStamp = header->fTimeStamp;
+
+	const uint16_t id = header->fEventId;
+	if (fSpeed > 0 && (id == DRAGON_HEAD_EVENT || id == DRAGON_TAIL_EVENT)) {
+		try {
+			const midas::Event event(header, fEvent.GetData(), header->fDataSize,
+															 id == DRAGON_HEAD_EVENT ? "TSCH" : "TSCT", 0);
+			Pace(event.TriggerTime());
+		}
+		catch (std::exception&) { // no TSC bank
+			dragon::utils::Warning("rootana::ReplayReceiver")
+				<< "No trigger time in event " << id << ", serial number " << header->fSerialNumber
+				<< "; replaying the rest as fast as possible";
+			fSpeed = 0;
+		}
+	}
+	memcpy(slot, header, sizeof(TMidas_EVENT_HEADER));
+	memcpy(slot + sizeof(TMidas_EVENT_HEADER), fEvent.GetData(), header->fDataSize);
+	return size;
+}
+
+inline void rootana::ReplayReceiver::Pace(double trigger)
+{
+	/*!
+	 * Events are released in file order; those whose trigger time is before the
+	 * latest one so far (tails read out after later heads) are released at once.
+	 */
+	if (!fPacing || trigger < fLatest - 1e6) {
+		fPacing = true;
+		fTrigger0 = fLatest = trigger;
+		fTime0 = GetTimeSec();
+		return;
+	}
+	if (trigger <= fLatest) return;
+	fLatest = trigger;
+	const double due = fTime0 + 1e-6*(trigger - fTrigger0)/fSpeed;
+	for (double now = GetTimeSec(); now < due && !IsStopping(); now = GetTimeSec()) {
+		const double wait = due - now;
+		usleep(wait < 1e-3 ? useconds_t(1e6*wait) : 1000);
+	}
+}
+
+#endif
+
+
+#endif
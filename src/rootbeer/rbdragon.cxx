@@ -5,8 +5,10 @@
 ///
 #include <ctime>
 #include <cassert>
+#include <cstring>
 
 #include <TSystem.h>
+#include <TThread.h>
 #include <TFile.h>
 
 // ROOTBEER includes //
@@ -27,13 +29,14 @@
 
 //
 // Helper function to process unpacked events
-namespace { void process_events(const std::vector<Int_t>& codes)
-{
-  for (size_t i=0; i< codes.size(); ++i) {
-    rb::Event* event = rb::Rint::gApp()->GetEvent (codes[i]);
+namespace { struct EventProcessor {
+  // Visitor for dragon::UnpackedCodes, processes the rb::Event for each code
+  void operator() (Int_t code)
+  {
+    rb::Event* event = rb::Rint::gApp()->GetEvent (code);
     if(event) event->Process(0, 0);
   }
-} }
+}; }
 
 #define G_ERROR_RESET(level) ErrorReset err_reset_dummy_123456789 (level)
 namespace { class ErrorReset {
@@ -45,7 +48,10 @@ public:
   { gErrorIgnoreLevel = fIgnore; }
 }; }
 
-namespace { Int_t gAutoZero = 1; bool gAutoZeroOdb = true; }
+namespace { Int_t gAutoZero = 1; bool gAutoZeroOdb = true; Int_t gBatchSize = 32; }
+
+// Maximum time (ms) an event waits in a partly filled batch
+namespace { const Long64_t kBatchLatency = 100; }
 
 
 // ============ Free Functions ============ //
@@ -76,6 +82,18 @@ bool rbdragon::GetAutoZeroOdb()
   return gAutoZeroOdb;
 }
 
+void rbdragon::SetBatchSize(Int_t size)
+{
+  ///
+  /// \note Events already buffered are handled with the next (full) batch.
+  gBatchSize = size > 1 ? size : 1;
+}
+
+Int_t rbdragon::GetBatchSize()
+{
+  return gBatchSize;
+}
+
 
 
 // ============ Class rbdragon::MidasBuffer ============ //
@@ -90,7 +108,8 @@ rbdragon::MidasBuffer::MidasBuffer():
             rb::Event::Instance<rbdragon::TailScaler>()->Get(),
             rb::Event::Instance<rbdragon::AuxScaler>()->Get(),
             rb::Event::Instance<rbdragon::RunParameters>()->Get(),
-            rb::Event::Instance<rbdragon::TStampDiagnostics>()->Get())
+            rb::Event::Instance<rbdragon::TStampDiagnostics>()->Get()),
+  fBatchStart(0)
 {
   ///
   /// Set transition priorities different from default (750 for stop), set buffer size to 1024*1024,
@@ -120,7 +139,8 @@ void rbdragon::MidasBuffer::RunStartTransition(Int_t runnum)
   if (fType == rb::MidasBuffer::ONLINE && GetAutoZeroOdb() == true) {
     dragon::utils::Info("rbdragon::MidasBuffer")
       << "Syncing variable values with the online database.";
-    midas::Database db("online");
+    midas::Odb::ClearCache();
+    midas::Database db("online", true);
     ReadVariables(&db);
 
     // Also set auto zero level from "/dragon/rootbeer/AutoZero"
@@ -213,6 +233,9 @@ void rbdragon::MidasBuffer::RunStopTransition(Int_t runnum)
   ///
   /// Does the following:
 
+  /// - Handle events still waiting in the batch
+  FlushBatch();
+
   /// - Flush timestamp queue (max 15 seconds for online)
   Int_t flush_time = fType == ONLINE ? 15 : -1;
   time_t t_begin = time(0);
@@ -226,16 +249,17 @@ void rbdragon::MidasBuffer::RunStopTransition(Int_t runnum)
     qsize = fUnpacker.FlushQueueIterative(); // Fills classes implicitly
     if (qsize == 0) break;
 
-    std::vector<Int_t> v = fUnpacker.GetUnpackedCodes();
-    process_events(v);
+    EventProcessor process_events;
+    fUnpacker.GetUnpacked().Visit(process_events);
   }
   if (qsize) {
     fUnpacker.GetQueue()->FlushTimeoutMessage(flush_time);
     fUnpacker.GetQueue()->Clear();
   }
 
-  /// - Print delayed error messages
+  /// - Print delayed error messages, and the totals of rate-limited ones
   dragon::utils::gDelayedMessageFactory.Flush();
+  dragon::utils::MessageLimit::Flush();
 
   /// - Call parent class implementation (prints a message)
   rb::MidasBuffer::RunStopTransition(runnum);
@@ -259,19 +283,83 @@ Bool_t rbdragon::MidasBuffer::UnpackEvent(void* header, char* data)
 
   midas::Event::Header* phead = reinterpret_cast<midas::Event::Header*>(header);
 
-  /// - If BOR event (ODB dump), set variables from there
-  if (phead->fEventId == MIDAS_BOR) {
-    midas::Database db(data, phead->fDataSize);
-    ReadVariables(&db);
+  /// - If BOR or EOR event (ODB dump), first handle the events before it, then the dump itself
+  if (phead->fEventId == MIDAS_BOR || phead->fEventId == MIDAS_EOR) {
+    FlushBatch();
+    ProcessOdbDump(header, data);
+    return kTRUE;
+  }
+
+  /// - For all other events, handle them directly if not batching; otherwise
+  ///   copy them into the batch, and handle the batch once it is full or its
+  ///   oldest event has waited long enough
+  if (gBatchSize <= 1 && fBatchOffsets.empty()) {
+    TThread::Lock();
+    ProcessEvent(header, data);
+    TThread::UnLock();
+    return kTRUE;
   }
 
-  /// - For all other events, delegate to rb::Unpacker, then call the Process() function
-  std::vector<Int_t> v = fUnpacker.UnpackMidasEvent(phead, data);
-  process_events(v);
+  const Long64_t now = gSystem->Now();
+  if (fBatchOffsets.empty()) fBatchStart = now;
+  const size_t offset = fBatch.size();
+  fBatch.resize(offset + sizeof(midas::Event::Header) + phead->fDataSize);
+  memcpy(&fBatch[offset], header, sizeof(midas::Event::Header));
+  memcpy(&fBatch[offset + sizeof(midas::Event::Header)], data, phead->fDataSize);
+  fBatchOffsets.push_back(offset);
+
+  if ((Int_t)fBatchOffsets.size() >= gBatchSize || now - fBatchStart >= kBatchLatency)
+    FlushBatch();
 
   return kTRUE;
 }
 
+void rbdragon::MidasBuffer::FlushBatch()
+{
+  ///
+  /// The ROOT global lock is taken once for the whole batch, instead of around
+  /// every event's unpacking and histogram filling.
+  if (fBatchOffsets.empty()) return;
+
+  TThread::Lock();
+  for (size_t i = 0; i< fBatchOffsets.size(); ++i) {
+    char* event = &fBatch[fBatchOffsets[i]];
+    ProcessEvent(event, event + sizeof(midas::Event::Header));
+  }
+  TThread::UnLock();
+
+  fBatch.clear();
+  fBatchOffsets.clear();
+}
+
+void rbdragon::MidasBuffer::ProcessEvent(void* header, char* data)
+{
+  ///
+  /// Delegates to dragon::Unpacker, then calls Process() for each rb::Event filled
+  EventProcessor process_events;
+  fUnpacker.Unpack(header, data, process_events);
+}
+
+void rbdragon::MidasBuffer::ProcessOdbDump(void* header, char* data)
+{
+  ///
+  /// The dump is parsed once: variables are read from it (BOR only), and the
+  /// same midas::Database is used to unpack the run parameters, instead of
+  /// dragon::Unpacker::Unpack() parsing it again. Only the directories in
+  /// dragon::Unpacker::GetOdbSubtrees() are read.
+  midas::Event::Header* phead = reinterpret_cast<midas::Event::Header*>(header);
+  midas::Database db(data, phead->fDataSize, dragon::Unpacker::GetOdbSubtrees());
+
+  TThread::Lock();
+  if (phead->fEventId == MIDAS_BOR)
+    ReadVariables(&db);
+  fUnpacker.ClearUnpackedCodes();
+  fUnpacker.UnpackRunParameters(db);
+  EventProcessor process_events;
+  fUnpacker.GetUnpacked().Visit(process_events);
+  TThread::UnLock();
+}
+
 
 
 // ============ rb::Event Classes ============ //
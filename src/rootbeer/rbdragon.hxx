@@ -1,5 +1,6 @@
 #ifndef RB_DRAGON_INCLUDE_GUARD
 #define RB_DRAGON_INCLUDE_GUARD
+#include <vector>
 ///
 /// \file rbdragon.hxx
 /// \author G. Christian
@@ -45,9 +46,27 @@ public:
 	/// Helper function to read variables from online or offline database.
 	void ReadVariables(midas::Database* db);
 
+	/// Handle all events buffered by UnpackEvent()
+	void FlushBatch();
+
+protected:
+	/// Unpack a single (non ODB dump) event and process the resulting rb::Event classes
+	virtual void ProcessEvent(void* header, char* data);
+
+	/// Handle a BOR or EOR (ODB dump) event
+	void ProcessOdbDump(void* header, char* data);
+
 protected:
 	/// Unpacker instance
 	dragon::Unpacker fUnpacker;
+
+private:
+	/// Copies of the buffered events, each one a header followed by its data
+	std::vector<char> fBatch;
+	/// Offset of each buffered event in fBatch
+	std::vector<size_t> fBatchOffsets;
+	/// Time (milliseconds) at which the oldest buffered event arrived
+	Long64_t fBatchStart;
 };
 
 
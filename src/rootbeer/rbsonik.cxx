@@ -30,34 +30,23 @@
 rbsonik::MidasBuffer::MidasBuffer():
 	rbdragon::MidasBuffer() { }
 
-Bool_t rbsonik::MidasBuffer::UnpackEvent(void* header, char* data)
+void rbsonik::MidasBuffer::ProcessEvent(void* header, char* data)
 {
 	///
-	/// Does the following:
+	/// ODB dumps and batching are handled by rbdragon::MidasBuffer::UnpackEvent()
 
-	midas::Event::Header* phead = reinterpret_cast<midas::Event::Header*>(header);
+	/// - Delegate to rb::Unpacker, then call the Process() function
+	const dragon::UnpackedCodes& codes = fUnpacker.Unpack(header, data);
 
-	/// - If BOR event (ODB dump), set variables from there
-	if (phead->fEventId == MIDAS_BOR) {
-		midas::Database db(data, phead->fDataSize);
-
-		// read variables
-		this->ReadVariables(&db);
-	}
-
-	/// - For all other events, delegate to rb::Unpacker, then call the Process() function
-	std::vector<Int_t> codes = fUnpacker.UnpackMidasEvent(phead, data);
-
-	for (size_t i=0; i< codes.size(); ++i) {
-		rb::Event* event = rb::Rint::gApp()->GetEvent (codes[i]);
+	for (Int_t code = 0; code< dragon::UnpackedCodes::kMaxCode; ++code) {
+		if(!codes.Test(code)) continue;
+		rb::Event* event = rb::Rint::gApp()->GetEvent (code);
 		if(event) event->Process(0, 0);
 
-		if(event && codes[i] == DRAGON_TAIL_EVENT) {
+		if(event && code == DRAGON_TAIL_EVENT) {
 			rb::Event::Instance<SonikEvent>()->Process(0,0);
 		}
 	}
-
-	return kTRUE;
 }
 
 
@@ -35,8 +35,10 @@ public:
 	MidasBuffer();
 	/// No actions needed
 	virtual ~MidasBuffer() { }
-	/// Look at the event id and handle as appropriate.
-	virtual Bool_t UnpackEvent(void* header, char* data);
+
+protected:
+	/// Unpack a single event, also processing SonikEvent after tail events
+	virtual void ProcessEvent(void* header, char* data);
 };
 
 
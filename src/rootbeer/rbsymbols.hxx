@@ -24,6 +24,15 @@ void SetAutoZeroOdb(bool on);
 /// Check SetAutoZeroOdb()
 bool GetAutoZeroOdb();
 
+/// \brief Set the number of events unpacked together under one lock.
+/// \param size Events per batch; a partial batch is also handled when an event
+///  arrives more than 100 ms after its oldest one, and at the end of the run.
+///  A size of 1 handles every event as it arrives.
+void SetBatchSize(Int_t size = 32);
+
+/// Check the batch size
+Int_t GetBatchSize();
+
 }
 
 
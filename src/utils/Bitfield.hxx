@@ -0,0 +1,42 @@
+///
+/// \file Bitfield.hxx
+/// \brief Defines compile-time descriptions of the bit fields in module data words.
+///
+#ifndef DRAGON_UTILS_BITFIELD_HXX
+#define DRAGON_UTILS_BITFIELD_HXX
+#include "IntTypes.h"
+
+namespace dragon { namespace utils {
+
+/// A bit field of a 32-bit word, known at compile time
+/*!
+ * The word formats of the VME modules are described with these, as typedefs
+ * naming each field (see e.g. vme::V792::Format). Decoders are then written in
+ * terms of the fields, and every shift and mask is a constant folded into the
+ * code; a module with a different layout only needs a different description.
+ * \code
+ * typedef dragon::utils::Bitfield<16, 5> Channel;
+ * uint32_t ch = Channel::get(word); // (word >> 16) & READ5
+ * \endcode
+ *
+ * \tparam Shift Position of the lowest bit of the field (0 - 31)
+ * \tparam Width Number of bits in the field (1 - 32)
+ */
+template <unsigned Shift, unsigned Width>
+struct Bitfield {
+	/// Mask of the field, once shifted down
+	static const uint32_t kMask = ((uint32_t(1) << (Width - 1)) << 1) - 1;
+	/// Extract the field from a word
+	static uint32_t get(uint32_t word) { return (word >> Shift) & kMask; }
+	/// Put a value into the field of a word (e.g. to make test data)
+	static uint32_t set(uint32_t word, uint32_t value)
+		{ return (word & ~(kMask << Shift)) | ((value & kMask) << Shift); }
+
+private:
+	/// Compile-time check that the field is within a 32-bit word
+	typedef char RangeCheck_t[(Width >= 1 && Shift + Width <= 32) ? 1 : -1];
+};
+
+} }
+
+#endif
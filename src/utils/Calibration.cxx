@@ -10,7 +10,6 @@
 #include <fstream>
 #include <TPolyMarker.h>
 #include <TDirectory.h>
-#include <TFitResult.h>
 #include <TSpectrum.h>
 #include <TSystem.h>
 #include <TString.h>
@@ -21,8 +20,10 @@
 #include <TF1.h>
 #include <TH1F.h>
 #include <TH2F.h>
+#include <TThread.h>
 #include "midas/Database.hxx"
 #include "midas/Odb.hxx"
+#include "LinearFitter.hxx"
 #include "Calibration.hxx"
 
 static HNDLE hDB;
@@ -164,6 +165,34 @@ std::vector<Double_t> dutils::DsssdCalibrator::FindPeaks(TH1* hst,
   return peaks;
 }
 
+///////////////////////////////// Helper class /////////////////////////////////
+namespace {
+  struct PeakArgs_t {
+    const dutils::DsssdCalibrator* fCalibrator;
+    const std::vector<TH1D*>* fHists;           // spectrum of each channel
+    std::vector<std::vector<Double_t> >* fPeaks; // peaks found in each channel
+    Int_t* fNext;                                // next channel (shared)
+    Double_t fSigma, fThreshold;                 // FindPeaks() parameters
+  };
+  void * find_peaks_thread(void* input)
+  {
+    // NOTE: input must point to a valid PeakArgs_t struct
+    PeakArgs_t* args = (PeakArgs_t*)input;
+    while (1) {
+      Int_t i;
+      {
+        TThread::Lock();
+        i = (*args->fNext)++;
+        TThread::UnLock();
+      }
+      if(i >= (Int_t)args->fHists->size()) break;
+      args->fPeaks->at(i) =
+        args->fCalibrator->FindPeaks(args->fHists->at(i), args->fSigma, args->fThreshold);
+    }
+    return 0;
+  }
+} // namespace
+
 ////////////////////////////////////////////////////////////////////////////////
 /// Helper routine to fit alpha energy vs. ADC channel
 /// \param pklow     Low edge (in uncalibrated channel number) of the region
@@ -172,21 +201,54 @@ std::vector<Double_t> dutils::DsssdCalibrator::FindPeaks(TH1* hst,
 ///        where the peak finding algorithm should search for triple alpha peaks
 /// \param Sigma     Minimum width of peaks to be found by the searching algorithm
 /// \param threshold Minimum peak height for the peak searching algorithm
+/// \param nthreads  Number of threads searching for peaks, 0 for one per CPU
 /// \note See `TSpectrum::Search` in ROOT's class documentation for more info on
 ///       the _sigma_ and _threshold_ parameters
+///
+/// The spectra of all channels are filled in a single pass over the tree, then
+/// the peaks of the channels are searched for in parallel. The (three point)
+/// fits are done afterwards in the calling thread.
 Int_t dutils::DsssdCalibrator::Run(Int_t nbins, Double_t pklow, Double_t pkhigh,
-                                   Double_t sigma, Double_t threshold, Bool_t grid)
+                                   Double_t sigma, Double_t threshold, Bool_t grid,
+                                   Int_t nthreads)
 {
   if(!fTree) return 0;
-  TH1F hpeaks("hpeaks", "", nbins, pklow, pkhigh);
+  TH2F hpeaks("hpeaks", "", NDSSSD, 0, NDSSSD, nbins, pklow, pkhigh);
+  fTree->Project("hpeaks", "dsssd.ecal:Iteration$", "", "goff");
+
+  std::vector<TH1D*> hists(NDSSSD);
+  for(Int_t i = 0; i < NDSSSD; ++i) {
+    hists[i] = hpeaks.ProjectionY(Form("hpeaks_%d", i), i+1, i+1);
+    hists[i]->SetDirectory(0);
+  }
+
+  if(nthreads <= 0) {
+    SysInfo_t info;
+    nthreads = gSystem->GetSysInfo(&info) == 0 && info.fCpus > 0 ? info.fCpus : 1;
+  }
+  nthreads = TMath::Min(nthreads, NDSSSD);
+  Int_t next = 0;
+  std::vector<std::vector<Double_t> > channelPeaks(NDSSSD);
+  PeakArgs_t args = { this, &hists, &channelPeaks, &next, sigma, threshold };
+  if(nthreads == 1) {
+    find_peaks_thread(&args);
+  }
+  else {
+    std::vector<TThread*> threads;
+    for(Int_t i = 0; i < nthreads; ++i) {
+      threads.push_back(new TThread(find_peaks_thread, &args));
+      threads.back()->Run();
+    }
+    for(size_t i = 0; i < threads.size(); ++i) {
+      threads[i]->Join();
+      delete threads[i];
+    }
+  }
+
   Int_t retval = 0;
   for(Int_t i = 0; i < NDSSSD; ++i) {
-    char buf[16];
-    // Double_t slope = GetOldParams(i).slope, offset = GetOldParams(i).offset;
-    // sprintf(buf, "(dsssd.ecal[%d] - %f) / %f", i, offset, slope);
-    sprintf(buf, "dsssd.ecal[%d]", i);
-    fTree->Project("hpeaks", buf, "", "goff");
-    std::vector<Double_t> peaks = FindPeaks(&hpeaks, sigma, threshold);
+    delete hists[i];
+    const std::vector<Double_t>& peaks = channelPeaks[i];
     if(peaks.size() != 3) {
       std::cerr << "Number of peaks found for channel " << i << ": " << peaks.size()
                 << " != 3, skipping!\n";
@@ -255,13 +317,15 @@ void dutils::DsssdCalibrator::FitPeaks(Int_t ch, Bool_t grid)
     for (int i = 0; i < 3; i++)
       aEnergy[i] = alphaEnergies[i] - dEdx_Al[i]*dLayer;
   }
-  TGraph gr(3);
-  for(Int_t i = 0; i < gr.GetN(); ++i) {
-    gr.SetPoint(i, GetPeak(ch, i), aEnergy[i]);
+  dragon::LinearSums sums;
+  for(Int_t i = 0; i < 3; ++i) {
+    sums.Add(GetPeak(ch, i), aEnergy[i]);
+  }
+  if(!sums.Fit(fParams[ch].slope, fParams[ch].offset)) {
+    std::cerr << "Peaks of channel " << ch << " do not determine a line, skipping!\n";
+    fParams[ch].slope  = -1.99999;
+    fParams[ch].offset = 0.0;
   }
-  TFitResultPtr result = gr.Fit("pol1", "qns");
-  fParams[ch].slope  = result->Value(1);
-  fParams[ch].offset = result->Value(0);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -32,6 +32,7 @@ struct msgDelete {
 
 void dutils::DelayedMessageFactory::Flush()
 {
+	ScopedLock lock(fMutex);
 	std::for_each(fPrinters.begin(), fPrinters.end(), msgPrint());
 }
 
@@ -39,3 +40,37 @@ dutils::DelayedMessageFactory::~DelayedMessageFactory()
 {
 	std::for_each(fPrinters.begin(), fPrinters.end(), msgDelete());
 }
+
+
+// Zero-initialized before any (dynamically initialized) call site registers
+dutils::MessageLimit* dutils::MessageLimit::fgFirst;
+uint64_t dutils::MessageLimit::fgTotal;
+
+std::string dutils::MessageLimit::Note() const
+{
+	/*! Empty for the first occurrences, which are printed regardless. */
+	const uint64_t n = fCount;
+	if (n < uint64_t(fFirst)) return "";
+	std::stringstream note;
+	note << " [" << n << " occurrences so far";
+	if (fPeriod > 0) note << ", printing one in " << fPeriod;
+	else note << ", no more will be printed";
+	note << "]";
+	return note.str();
+}
+
+void dutils::MessageLimit::ResetAll()
+{
+	for (MessageLimit* limit = fgFirst; limit; limit = limit->fNext)
+		__sync_lock_test_and_set(&limit->fCount, 0);
+	__sync_lock_test_and_set(&fgTotal, 0);
+}
+
+void dutils::MessageLimit::Flush()
+{
+	for (MessageLimit* limit = fgFirst; limit; limit = limit->fNext) {
+		if (limit->fCount <= uint64_t(limit->fFirst)) continue;
+		Warning("MessageLimit::Flush")
+			<< limit->fName << ": " << limit->fCount << " occurrences since the start of the run";
+	}
+}
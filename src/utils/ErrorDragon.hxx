@@ -10,6 +10,7 @@
 #include <sstream>
 #ifndef __MAKECINT__
 #include <iostream>
+#include "Thread.hxx"
 #endif
 #include <stdexcept>
 #include "AutoPtr.hxx"
@@ -338,6 +339,9 @@ public:
 #ifndef __MAKECINT__
 
 /// Factory class to create and store DelayedMessagePrinters
+/*! Access to the collection of printers is serialized, so different threads may
+ *  register and retrieve printers concurrently; an individual printer should be
+ *  used by only one thread. */
 class DelayedMessageFactory {
 public:
 	/// Empty
@@ -360,6 +364,7 @@ public:
 			/// \returns Pointer to the newly created message printer, or NULL if one already exists with key `base + code`
 
 			int64_t key = (int64_t)base + code;
+			ScopedLock lock(fMutex);
 			ADelayedMessagePrinter* err = new DelayedMessagePrinter<T>(location, period, file, line, message);
 			if(fPrinters.insert(std::make_pair(key, err)).second) return err;
 			else delete err;
@@ -379,8 +384,9 @@ public:
 			/// \returns Pointer to the message printer registered w/ key `base + code` or NULL is it doesn't exist
 
 			int64_t key = (int64_t)base + code;
+			ScopedLock lock(fMutex);
 			std::map<int64_t, ADelayedMessagePrinter*>::iterator i = fPrinters.find(key);
-			return i == fPrinters.end() ? 0 : fPrinters.operator[](key);
+			return i == fPrinters.end() ? 0 : i->second;
 		}
 
 	/// Remove a registered message printer
@@ -394,6 +400,7 @@ public:
 			/// \param code Offset part of the key
 
 			int64_t key = (int64_t)base + code;
+			ScopedLock lock(fMutex);
 			std::map<int64_t, ADelayedMessagePrinter*>::iterator i = fPrinters.find(key);
 			if(i!=fPrinters.end()) { delete i->second; fPrinters.erase(i); }
 			else Warning("DeleteDelayedMessagePrinter")
@@ -409,10 +416,72 @@ private:
 
 private:
 	std::map<int64_t, ADelayedMessagePrinter*> fPrinters;
+	Mutex fMutex;
 };
 
 extern DelayedMessageFactory gDelayedMessageFactory;
 
+/// Rate limiter for a message printed from per-event code
+/*!
+ * One instance per call site, defined at namespace scope so that it exists (and is
+ * registered) before any events are unpacked. Check() counts an occurrence and tells
+ * whether to print it: the first \e first occurrences are printed, then one in every
+ * \e period. Nothing is formatted for the others, so a corrupt run which triggers the
+ * message on every event costs one atomic increment per event instead of a write to
+ * stderr. Flush() (at the end of a run) prints the totals of all call sites with
+ * suppressed messages, and ResetAll() (at the start of one) sets the counts to zero.
+ *
+ * Example:
+ * \code
+ * namespace { dragon::utils::MessageLimit gBadBank("Epics::unpack: bank length != 2"); }
+ * ...
+ * if (gBadBank.Check())
+ *   dragon::utils::Error("Epics::unpack") << "Bank len != 2, skipping!" << gBadBank.Note();
+ * \endcode
+ * Counting is safe from several threads (e.g. the mid2root conversion workers).
+ */
+class MessageLimit {
+public:
+	/// Register the call site \e name
+	MessageLimit(const char* name, int32_t first = 10, int32_t period = 10000):
+		fName(name), fFirst(first), fPeriod(period), fCount(0), fNext(fgFirst)
+		{ fgFirst = this; }
+
+	/// Count one occurrence, returns true if it should be printed
+	bool Check()
+		{
+			const uint64_t n = __sync_add_and_fetch(&fCount, 1);
+			__sync_add_and_fetch(&fgTotal, 1);
+			return n <= uint64_t(fFirst) || (fPeriod > 0 && (n - fFirst) % fPeriod == 0);
+		}
+
+	/// Text to append to a printed message, telling how many occurred so far once they are suppressed
+	std::string Note() const;
+	/// Number of occurrences since the last ResetAll()
+	uint64_t GetCount() const { return fCount; }
+	/// Call site name
+	const char* GetName() const { return fName; }
+
+	/// Number of occurrences at all call sites since the last ResetAll()
+	static uint64_t GetTotal() { return fgTotal; }
+	/// Set all counts to zero
+	static void ResetAll();
+	/// Print the totals of every call site with suppressed occurrences
+	static void Flush();
+
+private:
+	MessageLimit(const MessageLimit&);
+	MessageLimit& operator= (const MessageLimit&);
+
+	const char* fName;
+	int32_t fFirst;        ///< Number printed before limiting
+	int32_t fPeriod;       ///< Print one in this many after that (0 = none)
+	uint64_t fCount;       ///< Occurrences since the last ResetAll()
+	MessageLimit* fNext;   ///< Next registered call site
+	static MessageLimit* fgFirst; ///< Most recently registered call site
+	static uint64_t fgTotal;      ///< Occurrences at all call sites
+};
+
 #endif // __MAKECINT__
 
 } }  // namespace dragon namespace utils
@@ -0,0 +1,128 @@
+///
+/// \file EventCache.hxx
+/// \brief Defines a bounded cache of calculated events, keyed by MIDAS serial number.
+///
+#ifndef DRAGON_UTILS_EVENT_CACHE_HXX
+#define DRAGON_UTILS_EVENT_CACHE_HXX
+#include <vector>
+#include <cstddef>
+#include "IntTypes.h"
+
+namespace dragon { namespace utils {
+
+/// Bounded cache of unpacked and calculated events, keyed by MIDAS serial number
+/*!
+ * Lets the coincidence and singles paths share the work of unpacking and
+ * calibrating an event. tstamp::Queue hands an event to all of its coincidences
+ * before handling it as a single, so the coincidence path stores the events it
+ * calculates with Put() (or reuses them with Find(), for an event matching
+ * several others), and the singles path removes them again with Take().
+ *
+ * Entries are normally taken soon after being stored. The entry for a serial
+ * number is kept in slot <tt>serial % capacity</tt>, so finding it needs no
+ * search; as serial numbers count up by one per event, Put() evicts the entry
+ * stored \e capacity events earlier, if it was not taken yet, and an event whose
+ * entry was evicted is simply calculated again. The memory used is fixed by the
+ * capacity, however long the cache is in use; GetNumEvicted() tells whether it
+ * is large enough to cover the time events wait to be taken.
+ *
+ * Only the event data are copied in and out (with T::copy_event()), not the
+ * variables, so the events stored should have been calculated with the same
+ * variables as the instance taking them (see dragon::Head::can_copy_event()).
+ *
+ * \tparam T Event class (e.g. dragon::Head), must be default constructible and
+ *  have a <tt>copy_event(const T&)</tt> method copying the data of one event
+ */
+template <class T>
+class EventCache {
+public:
+	/// Allocate \e capacity entries, all empty
+	EventCache(std::size_t capacity = 64):
+		fEvents(capacity > 0 ? capacity : 1), fSerials(fEvents.size()),
+		fUsed(fEvents.size(), false), fCount(0), fEvicted(0) { }
+
+	/// Change the number of entries, removing all of them
+	void SetCapacity(std::size_t capacity)
+		{
+			fEvents.assign(capacity > 0 ? capacity : 1, T());
+			fSerials.assign(fEvents.size(), 0);
+			fUsed.assign(fEvents.size(), false);
+			fCount = 0;
+			fEvicted = 0;
+		}
+
+	/// Remove all entries, e.g. at the start of a run (serial numbers restart)
+	void Clear()
+		{
+			fUsed.assign(fUsed.size(), false);
+			fCount = 0;
+			fEvicted = 0;
+		}
+
+	/// Pointer to the entry for \e serial, NULL if there is none
+	const T* Find(uint32_t serial) const
+		{
+			const std::size_t i = Index(serial);
+			return i < fEvents.size() ? &fEvents[i] : 0;
+		}
+
+	/// Store a copy of \e event for \e serial
+	void Put(uint32_t serial, const T& event)
+		{
+			const std::size_t i = serial % fEvents.size();
+			if (!fUsed[i]) ++fCount;
+			else if (fSerials[i] != serial) ++fEvicted;
+			fEvents[i].copy_event(event);
+			fSerials[i] = serial;
+			fUsed[i] = true;
+		}
+
+	/// Copy the entry for \e serial into \e event and remove it
+	bool Take(uint32_t serial, T& event)
+		{
+			/*! \returns false (leaving \e event unchanged) if there is no entry for \e serial */
+			const std::size_t i = Index(serial);
+			if (i == fEvents.size()) return false;
+			event.copy_event(fEvents[i]);
+			fUsed[i] = false;
+			--fCount;
+			return true;
+		}
+
+	/// Remove the entry for \e serial, if any
+	void Erase(uint32_t serial)
+		{
+			const std::size_t i = Index(serial);
+			if (i < fEvents.size()) {
+				fUsed[i] = false;
+				--fCount;
+			}
+		}
+
+	/// Number of entries stored
+	std::size_t Size() const { return fCount; }
+	/// Maximum number of entries
+	std::size_t GetCapacity() const { return fEvents.size(); }
+	/// Number of entries evicted by Put() before being taken, since the last Clear()
+	std::size_t GetNumEvicted() const { return fEvicted; }
+
+private:
+	/// Index of the entry for \e serial, fEvents.size() if there is none
+	std::size_t Index(uint32_t serial) const
+		{
+			const std::size_t i = serial % fEvents.size();
+			return fUsed[i] && fSerials[i] == serial ? i : fEvents.size();
+		}
+
+private:
+	std::vector<T> fEvents;
+	std::vector<uint32_t> fSerials;
+	std::vector<bool> fUsed;
+	std::size_t fCount; ///< Number of slots in use
+	std::size_t fEvicted; ///< Entries evicted since the last Clear()
+};
+
+} } // namespace dragon::utils
+
+
+#endif
@@ -0,0 +1,306 @@
+///
+/// \file HistSegment.cxx
+/// \brief Implements HistSegment.hxx
+///
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sched.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "ErrorDragon.hxx"
+#include "HistSegment.hxx"
+
+
+namespace dutils = dragon::utils;
+
+namespace {
+// Round up to a multiple of 8 bytes, so the cells of every histogram are aligned
+uint64_t align8(uint64_t n)
+{
+	return (n + 7) & ~uint64_t(7);
+}
+}
+
+dutils::HistSegment::HistSegment():
+	fBase(0), fSize(0), fWriter(false)
+{ }
+
+dutils::HistSegment::~HistSegment()
+{
+	Close();
+}
+
+bool dutils::HistSegment::Create(const char* name, uint64_t size, uint32_t maxEntries)
+{
+	/*!
+	 * \param name Segment name, starting with '/', e.g. "/dragon_histos"
+	 * \param size Segment size in bytes, increased to fit at least the table
+	 * \param maxEntries Maximum number of histograms
+	 * \returns true if the segment was created and mapped
+	 *
+	 * An old segment of the same name is unlinked first; viewers which still
+	 * have it mapped see it closed (IsLive() returns false) and should re-open.
+	 */
+	Close();
+	const uint64_t table = align8(sizeof(Header_t) + uint64_t(maxEntries)*sizeof(Entry_t));
+	if (size < table) size = table;
+
+	shm_unlink(name);
+	int fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0644);
+	if (fd < 0) {
+		dutils::Error("HistSegment::Create") << "shm_open(\"" << name << "\"): " << strerror(errno);
+		return false;
+	}
+	if (ftruncate(fd, size) != 0) {
+		dutils::Error("HistSegment::Create") << "ftruncate(\"" << name << "\", " << size << "): " << strerror(errno);
+		close(fd);
+		shm_unlink(name);
+		return false;
+	}
+	void* base = mmap(0, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (base == MAP_FAILED) {
+		dutils::Error("HistSegment::Create") << "mmap(\"" << name << "\"): " << strerror(errno);
+		shm_unlink(name);
+		return false;
+	}
+
+	fBase = static_cast<char*>(base);
+	fSize = size;
+	fWriter = true;
+	fName = name;
+
+	Header_t* header = GetHeader();
+	memset(fBase, 0, table);
+	header->fFormat = kFormat;
+	header->fSize = size;
+	header->fMaxEntries = maxEntries;
+	header->fUsed = table;
+	header->fPid = getpid();
+	__sync_synchronize();
+	header->fMagic = kMagic;
+	return true;
+}
+
+bool dutils::HistSegment::Open(const char* name)
+{
+	/*!
+	 * \param name Segment name, as given to Create() by the writer
+	 * \returns true if the segment exists and has the format of this version
+	 */
+	Close();
+	int fd = shm_open(name, O_RDONLY, 0);
+	if (fd < 0) {
+		dutils::Error("HistSegment::Open") << "shm_open(\"" << name << "\"): " << strerror(errno);
+		return false;
+	}
+	struct stat st;
+	if (fstat(fd, &st) != 0 || uint64_t(st.st_size) < sizeof(Header_t)) {
+		dutils::Error("HistSegment::Open") << "\"" << name << "\" is not a histogram segment";
+		close(fd);
+		return false;
+	}
+	void* base = mmap(0, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (base == MAP_FAILED) {
+		dutils::Error("HistSegment::Open") << "mmap(\"" << name << "\"): " << strerror(errno);
+		return false;
+	}
+
+	fBase = static_cast<char*>(base);
+	fSize = st.st_size;
+	fName = name;
+	const Header_t* header = GetHeader();
+	if (header->fMagic != kMagic || header->fFormat != kFormat || header->fSize > fSize ||
+			sizeof(Header_t) + uint64_t(header->fMaxEntries)*sizeof(Entry_t) > fSize) {
+		dutils::Error("HistSegment::Open") << "\"" << name << "\" is not a histogram segment, or not of format " << kFormat;
+		Close();
+		return false;
+	}
+	return true;
+}
+
+void dutils::HistSegment::Close()
+{
+	if (!fBase) return;
+	if (fWriter) {
+		GetHeader()->fClosed = 1;
+		__sync_synchronize();
+		shm_unlink(fName.c_str());
+	}
+	munmap(fBase, fSize);
+	fBase = 0;
+	fSize = 0;
+	fWriter = false;
+	fName.clear();
+}
+
+bool dutils::HistSegment::IsLive() const
+{
+	/*!
+	 * False once the writer closed the segment or its process is gone (e.g.
+	 * after a crash), in which case the contents are those of the last write.
+	 */
+	if (!fBase || GetHeader()->fClosed) return false;
+	return fWriter || kill(GetHeader()->fPid, 0) == 0 || errno == EPERM;
+}
+
+void dutils::HistSegment::BeginLayout()
+{
+	/*!
+	 * Call from the writer only. Until EndLayout(), readers wait (or fail after
+	 * their number of tries); indices from before are invalid afterwards.
+	 */
+	Header_t* header = GetHeader();
+	++header->fLayout;
+	__sync_synchronize();
+	header->fNumEntries = 0;
+	header->fUsed = align8(sizeof(Header_t) + uint64_t(header->fMaxEntries)*sizeof(Entry_t));
+}
+
+int dutils::HistSegment::Add(const Info_t& info)
+{
+	/*!
+	 * \param info Description of the histogram; its fEntries and fWrites are ignored
+	 * \returns Index to pass to BeginWrite(), or -1 if the table or the segment is full
+	 *
+	 * Call from the writer, between BeginLayout() and EndLayout(). The cells start
+	 * at zero.
+	 */
+	Header_t* header = GetHeader();
+	const uint64_t bytes = info.fCells*sizeof(double);
+	if (header->fNumEntries >= header->fMaxEntries ||
+			info.fCells > fSize/sizeof(double) || header->fUsed + bytes > fSize)
+		return -1;
+
+	const int index = header->fNumEntries;
+	Entry_t* entry = GetEntry(index);
+	entry->fOffset = header->fUsed;
+	entry->fInfo = info;
+	entry->fInfo.fPath[kMaxPath - 1] = '\0';
+	entry->fInfo.fTitle[kMaxTitle - 1] = '\0';
+	entry->fInfo.fEntries = 0;
+	entry->fInfo.fWrites = 0;
+	memset(fBase + entry->fOffset, 0, bytes);
+
+	header->fUsed += bytes;
+	header->fNumEntries = index + 1;
+	return index;
+}
+
+void dutils::HistSegment::EndLayout()
+{
+	__sync_synchronize();
+	++GetHeader()->fLayout;
+}
+
+double* dutils::HistSegment::BeginWrite(int index)
+{
+	/*!
+	 * \param index Index returned by Add()
+	 * \returns The Info_t::fCells cells of the histogram, to be overwritten
+	 */
+	Entry_t* entry = GetEntry(index);
+	++entry->fSequence;
+	__sync_synchronize();
+	return reinterpret_cast<double*>(fBase + entry->fOffset);
+}
+
+void dutils::HistSegment::EndWrite(int index, double entries)
+{
+	/*!
+	 * \param index Index passed to BeginWrite()
+	 * \param entries Number of entries of the histogram
+	 */
+	Entry_t* entry = GetEntry(index);
+	entry->fInfo.fEntries = entries;
+	++entry->fInfo.fWrites;
+	__sync_synchronize();
+	++entry->fSequence;
+}
+
+uint32_t dutils::HistSegment::GetNumEntries() const
+{
+	if (!fBase) return 0;
+	const Header_t* header = GetHeader();
+	for (;;) {
+		const uint64_t layout = header->fLayout;
+		__sync_synchronize();
+		const uint32_t n = header->fNumEntries;
+		__sync_synchronize();
+		if (!(layout & 1) && header->fLayout == layout) return n;
+		sched_yield();
+	}
+}
+
+uint64_t dutils::HistSegment::GetLayouts() const
+{
+	return fBase ? GetHeader()->fLayout/2 : 0;
+}
+
+int dutils::HistSegment::Find(const char* path) const
+{
+	/*!
+	 * Indices stay valid until GetLayouts() changes.
+	 */
+	if (!fBase) return -1;
+	const Header_t* header = GetHeader();
+	for (;;) {
+		const uint64_t layout = header->fLayout;
+		if (layout & 1) { sched_yield(); continue; }
+		__sync_synchronize();
+		int found = -1;
+		const uint32_t n = header->fNumEntries;
+		for (uint32_t i = 0; i< n && i< header->fMaxEntries; ++i) {
+			if (strncmp(GetEntry(i)->fInfo.fPath, path, kMaxPath) == 0) {
+				found = i;
+				break;
+			}
+		}
+		__sync_synchronize();
+		if (header->fLayout == layout) return found;
+	}
+}
+
+bool dutils::HistSegment::Read(int index, Info_t& info, std::vector<double>& cells, int tries) const
+{
+	/*!
+	 * \param index Index of the histogram, from Find() or below GetNumEntries()
+	 * \param [out] info Description of the histogram
+	 * \param [out] cells Its Info_t::fCells cells
+	 * \param tries Number of times to try while the writer changes the histogram
+	 * \returns true if a consistent copy was made, false if there is no such
+	 *  histogram or the writer was busy for all tries
+	 */
+	if (!fBase || index < 0) return false;
+	const Header_t* header = GetHeader();
+	for (int i = 0; i< tries; ++i) {
+		if (i) sched_yield();
+		const uint64_t layout = header->fLayout;
+		if (layout & 1) continue;
+		__sync_synchronize();
+		const bool present = uint32_t(index) < header->fNumEntries && uint32_t(index) < header->fMaxEntries;
+		if (!present) {
+			__sync_synchronize();
+			if (header->fLayout == layout) return false;
+			continue;
+		}
+
+		const Entry_t* entry = GetEntry(index);
+		const uint64_t sequence = entry->fSequence;
+		if (sequence & 1) continue;
+		__sync_synchronize();
+		memcpy(&info, &entry->fInfo, sizeof(Info_t));
+		const uint64_t offset = entry->fOffset;
+		if (offset <= fSize && info.fCells <= (fSize - offset)/sizeof(double)) { // else torn, retry
+			cells.resize(info.fCells);
+			if (info.fCells) memcpy(&cells[0], fBase + offset, info.fCells*sizeof(double));
+		}
+		__sync_synchronize();
+		if (entry->fSequence == sequence && header->fLayout == layout) return true;
+	}
+	return false;
+}
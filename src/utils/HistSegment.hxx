@@ -0,0 +1,166 @@
+///
+/// \file HistSegment.hxx
+/// \brief Defines a POSIX shared-memory segment of histogram bin arrays, written
+///  by one process and read by any number of local viewers.
+/// \details Independent of ROOT: the segment holds only plain descriptions of the
+///  histograms (path, title, axes) and their cell contents as doubles. Each
+///  histogram is guarded by its own sequence lock, and the table of histograms by
+///  another, so the writer never waits for readers; readers copy and retry if the
+///  writer changed what they copied. Uses the GCC `__sync` builtins for the memory
+///  barriers; link with `-lrt` where shm_open() is not in libc.
+///
+#ifndef DRAGON_UTILS_HIST_SEGMENT_HXX
+#define DRAGON_UTILS_HIST_SEGMENT_HXX
+#ifndef __MAKECINT__
+#include <string>
+#include <vector>
+#include "IntTypes.h"
+
+namespace dragon { namespace utils {
+
+/// Histogram contents in shared memory
+/*!
+ * Layout (all offsets from the start of the segment):
+ *  - Header_t
+ *  - Entry_t[max entries]: descriptions and sequence counters of the histograms
+ *  - The cells of every histogram, as double[Info_t::fCells], at Entry_t::fOffset
+ *
+ * Writing (one thread of one process):
+ * \code
+ * HistSegment shm;
+ * shm.Create("/dragon_histos", 64 << 20, 4096);
+ * shm.BeginLayout();                   // table changes: readers wait
+ * int i = shm.Add(info);               // -1 if full
+ * shm.EndLayout();
+ * double* cells = shm.BeginWrite(i);   // cell changes: readers of histogram i retry
+ * ...
+ * shm.EndWrite(i, entries);
+ * \endcode
+ *
+ * Reading (any process, read-only mapping):
+ * \code
+ * HistSegment shm;
+ * shm.Open("/dragon_histos");
+ * HistSegment::Info_t info;
+ * std::vector<double> cells;
+ * shm.Read(shm.Find("rootana:/histos/head/bgo_e0"), info, cells);
+ * \endcode
+ *
+ * Cell indices are those of ROOT's global bin numbers, under- and overflows
+ * included. Variable bin widths are not kept; the axes hold only the number of
+ * bins and the range.
+ */
+class HistSegment {
+public:
+	/// Limits of the fixed-size fields
+	enum { kMaxPath = 128, kMaxTitle = 96, kMaxDimension = 3 };
+	/// Segment magic number, "DRHS"
+	static const uint32_t kMagic = 0x53485244;
+	/// Segment format version
+	static const uint32_t kFormat = 1;
+
+	/// Binning of one axis
+	struct Axis_t {
+		uint32_t fBins;  ///< Number of bins, excluding under- and overflow
+		double fLow;     ///< Low edge of the first bin
+		double fHigh;    ///< High edge of the last bin
+	};
+
+	/// Description of one histogram
+	struct Info_t {
+		char fPath[kMaxPath];           ///< Full path, e.g. "rootana:/histos/head/bgo_e0"
+		char fTitle[kMaxTitle];         ///< Title
+		uint32_t fDimension;            ///< 1, 2 or 3
+		Axis_t fAxis[kMaxDimension];    ///< x, y and z binning (only fDimension used)
+		uint64_t fCells;                ///< Number of cells, including under- and overflows
+		double fEntries;                ///< Number of entries, at the last write
+		uint64_t fWrites;               ///< Number of writes so far
+	};
+
+public:
+	/// Nothing mapped
+	HistSegment();
+	/// Unmap; the writer also marks the segment closed and unlinks it
+	~HistSegment();
+
+	/// Create (replacing any old one) and map a segment for writing
+	bool Create(const char* name, uint64_t size, uint32_t maxEntries);
+	/// Map an existing segment read-only
+	bool Open(const char* name);
+	/// Unmap, as in the destructor
+	void Close();
+
+	/// Check if a segment is mapped
+	bool IsOpen() const { return fBase != 0; }
+	/// Check if the segment is mapped for writing
+	bool IsWriter() const { return fWriter; }
+	/// Check if the writer still has the segment open
+	bool IsLive() const;
+	/// Name given to Create() or Open()
+	const std::string& GetName() const { return fName; }
+	/// Total size of the mapping, in bytes
+	uint64_t GetSize() const { return fSize; }
+
+	/// Start changing the table of histograms, removing all of them
+	void BeginLayout();
+	/// Add a histogram to the table, returns its index or -1 if it does not fit
+	int Add(const Info_t& info);
+	/// Done changing the table
+	void EndLayout();
+	/// Start writing the cells of one histogram, returns them
+	double* BeginWrite(int index);
+	/// Done writing the cells of one histogram
+	void EndWrite(int index, double entries);
+
+	/// Number of histograms in the table
+	uint32_t GetNumEntries() const;
+	/// Number of table changes so far
+	uint64_t GetLayouts() const;
+	/// Index of the histogram with a given path, -1 if there is none
+	int Find(const char* path) const;
+	/// Copy the description and the cells of one histogram
+	bool Read(int index, Info_t& info, std::vector<double>& cells, int tries = 1000) const;
+
+private:
+	/// Segment header
+	struct Header_t {
+		uint32_t fMagic;              ///< kMagic, written last
+		uint32_t fFormat;             ///< kFormat
+		uint64_t fSize;               ///< Segment size (bytes)
+		uint32_t fMaxEntries;         ///< Size of the entry table
+		volatile uint32_t fNumEntries; ///< Used entries
+		volatile uint64_t fLayout;    ///< Table sequence counter, odd while it is changed
+		uint64_t fUsed;               ///< Offset of the first unused cell
+		int32_t fPid;                 ///< Writer process id
+		volatile int32_t fClosed;     ///< Set when the writer unlinks the segment
+	};
+	/// Entry of the histogram table
+	struct Entry_t {
+		volatile uint64_t fSequence;  ///< Cell sequence counter, odd while they are written
+		uint64_t fOffset;             ///< Offset of the cells
+		Info_t fInfo;                 ///< Description
+	};
+
+	/// Disallow copy
+	HistSegment(const HistSegment&);
+	/// Disallow assign
+	HistSegment& operator= (const HistSegment&);
+
+	/// Segment header
+	Header_t* GetHeader() const { return reinterpret_cast<Header_t*>(fBase); }
+	/// Entry of the table
+	Entry_t* GetEntry(int index) const
+		{ return reinterpret_cast<Entry_t*>(fBase + sizeof(Header_t)) + index; }
+
+private:
+	char* fBase;          ///< Start of the mapping, 0 if none
+	uint64_t fSize;       ///< Size of the mapping
+	bool fWriter;         ///< Mapped for writing
+	std::string fName;    ///< Segment name
+};
+
+} }
+
+
+#endif // #ifndef __MAKECINT__
+#endif
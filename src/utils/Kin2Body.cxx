@@ -178,42 +178,83 @@ Double_t dragon::Kin2Body::CalcTLabTheta(Double_t theta, const char* which, Bool
   } else {
     mass = fM3;
   }
+  // At 90 degrees the maximum angle is not needed (nor checked, as before)
+  Double_t tlab;
+  CalcTLab(&theta, 1, &tlab, mass, theta == 90.0 ? 0 : GetMaxAngle(which), negative);
+  return tlab;
+}
 
-  if (theta == 90.0){
-    if (mass*sinh(fChi) / fPprime > 1){
-      return 0.0;
-    } else {
-      Double_t p = fPprime*sqrt(1 - pow(mass*sinh(fChi) / fPprime,2) / (1 + pow(sinh(fChi),2)) );
-      Double_t T = sqrt(p*p + mass*mass) - mass;
-      if (T < 0.001) {
-        return 0;
-      } else {
-        return T;
-      }
-    }
+////////////////////////////////////////////////////////////////////////////////
+/// Calculate the energy of the ejectile or recoil as a function of angle
+/// \param theta angle of ejectile / recoil in degrees
+/// \param which ejectile or recoil
+/// \param negative select the lower energy solution, below the maximum angle
+Double_t dragon::Kin2Body::CalcTLabTheta(Double_t theta, Particle_t which, Bool_t negative) const
+{
+  Double_t tlab;
+  CalcTLabTheta(&theta, 1, &tlab, which, negative);
+  return tlab;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Calculate the energies of the ejectile or recoil for an array of angles
+/// \param [in] theta angles of ejectile / recoil in degrees
+/// \param [in] n number of angles
+/// \param [out] tlab lab frame kinetic energies [MeV], of length \e n
+/// \param [in] which ejectile or recoil
+/// \param [in] negative as for CalcTLabTheta(Double_t, Particle_t, Bool_t)
+///
+/// Gives the same results as calling CalcTLabTheta() for each angle, but
+/// the maximum angle and other per-reaction terms are worked out once and
+/// the loop over angles is free of branches, so it can be vectorized. Does
+/// not change the object, so scans may split the angles between threads.
+void dragon::Kin2Body::CalcTLabTheta(const Double_t* theta, Int_t n, Double_t* tlab,
+                                     Particle_t which, Bool_t negative) const
+{
+  CalcTLab(theta, n, tlab, which == kRecoil ? fM4 : fM3, GetMaxAngle(which), negative);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Lab frame kinetic energies of a product of mass \e mass, for angles up to \e maxAngle
+void dragon::Kin2Body::CalcTLab(const Double_t* theta, Int_t n, Double_t* tlab, Double_t mass,
+                                Double_t maxAngle, Bool_t negative) const
+{
+  // Terms common to all angles
+  const Double_t t90    = CalcTLab90(mass);
+  const Double_t shChi  = sinh(fChi);
+  const Double_t chChi  = cosh(fChi);
+  const Double_t etot   = sqrt(mass*mass + fPprime*fPprime);
+  const Double_t pprime2 = fPprime*fPprime;
+  const Double_t sign   = negative ? -1 : 1;
+
+  for (Int_t i = 0; i < n; ++i) {
+    // Past the maximum angle, the energy at the maximum angle
+    const Bool_t clamp = theta[i] >= maxAngle;
+    const Double_t t   = (clamp ? maxAngle : theta[i]) / 180. * TMath::Pi();
+    const Double_t sn  = sin(t)*shChi;
+    Double_t pe = cos(t)*shChi*etot;
+    const Double_t root = sign*chChi*sqrt( pprime2 - pow(mass*sin(t)*shChi,2) );
+    pe = clamp ? pe : pe + root;
+    pe /= ( 1+sn*sn );
+    const Double_t T = sqrt(pe*pe + mass*mass) - mass;
+    tlab[i] = theta[i] == 90.0 ? t90 : T;
   }
+}
 
-  if (theta >= GetMaxAngle(which)) {
-    theta = GetMaxAngle(which);
-    theta /= 180.;
-    theta *= TMath::Pi();
-    Double_t pe = cos(theta)*sinh(fChi)*sqrt(mass*mass + fPprime*fPprime);
-    pe /= ( 1+pow(sin(theta)*sinh(fChi),2) );
-    return sqrt(pe*pe + mass*mass) - mass;
-  } else if (!negative){
-    theta /= 180.;
-    theta *= TMath::Pi();
-    Double_t pe = cos(theta)*sinh(fChi)*sqrt(mass*mass + fPprime*fPprime);
-    pe += cosh(fChi)*sqrt( fPprime*fPprime - pow(mass*sin(theta)*sinh(fChi),2) );
-    pe /= ( 1+pow(sin(theta)*sinh(fChi),2) );
-    return sqrt(pe*pe + mass*mass) - mass;
+////////////////////////////////////////////////////////////////////////////////
+/// Lab frame kinetic energy at 90 degrees of a product of mass \e mass
+Double_t dragon::Kin2Body::CalcTLab90(Double_t mass) const
+{
+  if (mass*sinh(fChi) / fPprime > 1){
+    return 0.0;
   } else {
-    theta /= 180.;
-    theta *= TMath::Pi();
-    Double_t pe = cos(theta)*sinh(fChi)*sqrt(mass*mass + fPprime*fPprime);
-    pe -= cosh(fChi)*sqrt( fPprime*fPprime - pow(mass*sin(theta)*sinh(fChi),2) );
-    pe /= ( 1+pow(sin(theta)*sinh(fChi),2) );
-    return sqrt(pe*pe + mass*mass) - mass;
+    Double_t p = fPprime*sqrt(1 - pow(mass*sinh(fChi) / fPprime,2) / (1 + pow(sinh(fChi),2)) );
+    Double_t T = sqrt(p*p + mass*mass) - mass;
+    if (T < 0.001) {
+      return 0;
+    } else {
+      return T;
+    }
   }
 }
 
@@ -249,46 +290,37 @@ void dragon::Kin2Body::Set4Mom(Double_t energy, const char* frame)
 Double_t dragon::Kin2Body::GetMaxAngle(const char* which)
 {
   if (strncmp(which, "ejectile", 8) == 0){
-    if ( fabs( fPprime / (fM3*sinh(fChi)) ) >= 1){
-      if ( CalcTLabTheta(90, which) > 0){
-        return 180.;
-      } else {
-        return 90.;
-      }
-    } else {
-      return 180*asin(fPprime / (fM3*sinh(fChi))) / TMath::Pi();
-    }
-  } else if (strncmp(which, "recoil", 6) == 0){
-    if ( fabs( fPprime / (fM4*sinh(fChi)) ) >= 1){
-      if ( CalcTLabTheta(90, which) > 0){
-        return 180.;
-      } else {
-        return 90.;
-      }
-    } else {
-      return 180*asin(fPprime / (fM4*sinh(fChi))) / TMath::Pi();
-    }
-  } else if (strncmp(which, "residue", 7) == 0) {
-    if ( fabs( fPprime / (fM4*sinh(fChi)) ) >= 1){
-      if ( CalcTLabTheta(90, "recoil") > 0){
-        return 180.;
-      } else {
-        return 90.;
-      }
-    } else {
-      return 180*asin(fPprime / (fM4*sinh(fChi))) / TMath::Pi();
-    }
+    return GetMaxAngle(kEjectile);
+  } else if (strncmp(which, "recoil", 6) == 0 || strncmp(which, "residue", 7) == 0){
+    return GetMaxAngle(kRecoil);
   } else {
     dutils::Error("Kin2Body::GetMaxAngle", __FILE__, __LINE__) << "particle string " << which << " invalid; must one of \"ejectile\", \"recoil\", or \"residue.\"\n";
     return 0;
   }
 }
 
+////////////////////////////////////////////////////////////////////////////////
+/// Get maximum cone half angle for ejectile or recoil
+/// \param which the particle
+Double_t dragon::Kin2Body::GetMaxAngle(Particle_t which) const
+{
+  const Double_t mass = which == kRecoil ? fM4 : fM3;
+  if ( fabs( fPprime / (mass*sinh(fChi)) ) >= 1){
+    if ( CalcTLab90(mass) > 0){
+      return 180.;
+    } else {
+      return 90.;
+    }
+  } else {
+    return 180*asin(fPprime / (mass*sinh(fChi))) / TMath::Pi();
+  }
+}
+
 TMultiGraph* dragon::Kin2Body::PlotTLabvsThetaLab(Option_t *option_e, Option_t *option_r)
 {
   Double_t maxtheta;
-  Double_t max_e   = GetMaxAngle("ejectile");
-  Double_t max_rec = GetMaxAngle("recoil");
+  Double_t max_e   = GetMaxAngle(kEjectile);
+  Double_t max_rec = GetMaxAngle(kRecoil);
   Int_t npoints = 90;
 
   if (max_e > 90 || max_rec > 90){
@@ -304,34 +336,30 @@ TMultiGraph* dragon::Kin2Body::PlotTLabvsThetaLab(Option_t *option_e, Option_t *
 
   for (Int_t i = 0; i <= npoints; i++){
     theta_r.push_back(x);
-    Trec.push_back(CalcTLabTheta(x, "recoil"));
     x += dx;
   }
+  Trec.resize(theta_r.size());
+  CalcTLabTheta(&theta_r[0], theta_r.size(), &Trec[0], kRecoil);
 
   if(max_rec < 90) {
-    x = 0;
-    for (Int_t i = 0; i <= npoints; i++){
-      theta_rn.push_back(x);
-      Trec_n.push_back(CalcTLabTheta(x, "recoil", kTRUE));
-      x += dx;
-    }
+    theta_rn = theta_r;
+    Trec_n.resize(theta_rn.size());
+    CalcTLabTheta(&theta_rn[0], theta_rn.size(), &Trec_n[0], kRecoil, kTRUE);
   }
 
   x = 0;
   dx = max_e / npoints;
   for (Int_t i = 0; i <= npoints; i++){
     theta_e.push_back(x);
-    Te.push_back(CalcTLabTheta(x, "ejectile"));
     x += dx;
   }
+  Te.resize(theta_e.size());
+  CalcTLabTheta(&theta_e[0], theta_e.size(), &Te[0], kEjectile);
 
   if(max_e < 90) {
-    x = 0;
-    for (Int_t i = 0; i <= npoints; i++){
-      theta_en.push_back(x);
-      Te_n.push_back(CalcTLabTheta(x, "ejectile", kTRUE));
-      x += dx;
-    }
+    theta_en = theta_e;
+    Te_n.resize(theta_en.size());
+    CalcTLabTheta(&theta_en[0], theta_en.size(), &Te_n[0], kEjectile, kTRUE);
   }
 
   // TMultiGraph* mg = 0;
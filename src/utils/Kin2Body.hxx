@@ -153,6 +153,13 @@ namespace dragon {
     /// Projectile string
     const char* fRecString;
 
+  public:
+    /// Reaction product selected for lab frame calculations
+    enum Particle_t {
+      kEjectile, ///< Light reaction product, mass fM3
+      kRecoil    ///< Heavy reaction product (or "residue"), mass fM4
+    };
+
   public:
     /// Default ctor for radiative capture
     Kin2Body(const char* projectile, const char* target,
@@ -161,9 +168,15 @@ namespace dragon {
     Kin2Body(const char* projectile, const char* target, const char* ejectile,
              Double_t enregy = 0, const char* frame = "CM", Int_t qb = 0);
     Double_t CalcTLabTheta(Double_t theta, const char* which, Bool_t negative = kFALSE);
+    Double_t CalcTLabTheta(Double_t theta, Particle_t which, Bool_t negative = kFALSE) const;
+    void CalcTLabTheta(const Double_t* theta, Int_t n, Double_t* tlab, Particle_t which, Bool_t negative = kFALSE) const;
     Double_t GetMaxAngle(const char* which);
+    Double_t GetMaxAngle(Particle_t which) const;
     TMultiGraph* PlotTLabvsThetaLab(Option_t *option_e = "", Option_t *option_r = "");
   private:
+    void CalcTLab(const Double_t* theta, Int_t n, Double_t* tlab, Double_t mass,
+                  Double_t maxAngle, Bool_t negative) const;
+    Double_t CalcTLab90(Double_t mass) const;
 	void Init(const char* projectile, const char* target,
               Double_t energy, const char* frame, Int_t qb);
 	void Init(const char* projectile, const char* target, const char* ejectile,
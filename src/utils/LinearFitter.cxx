@@ -2,6 +2,7 @@
 #include <string>
 #include <cassert>
 #include <iostream>
+#include <algorithm>
 #include <TF1.h>
 #include <TGraph.h>
 #include "LinearFitter.hxx"
@@ -41,6 +42,81 @@ struct gGraphSetter {
 	~gGraphSetter() { gGraph = 0; }
 };
 
+// Sums of n points, into local variables rather than the members so that
+// they stay in registers; the weights are left out if not given
+template <bool kWeighted>
+void add_sums(int n, const double* x, const double* y, const double* w, double* sums)
+{
+	double s = 0, sx = 0, sy = 0, sxx = 0, sxy = 0;
+	for (int i = 0; i < n; ++i) {
+		const double wi = kWeighted ? w[i] : 1.;
+		const double wx = wi*x[i];
+		s += wi;
+		sx += wx;
+		sy += wi*y[i];
+		sxx += wx*x[i];
+		sxy += wx*y[i];
+	}
+	sums[0] += s;
+	sums[1] += sx;
+	sums[2] += sy;
+	sums[3] += sxx;
+	sums[4] += sxy;
+}
+
+}
+
+
+void dragon::LinearSums::Add(int n, const double* x, const double* y, const double* w)
+{
+	double sums[5] = { fS, fSx, fSy, fSxx, fSxy };
+	if (w) add_sums<true> (n, x, y, w, sums);
+	else   add_sums<false>(n, x, y, w, sums);
+	fS = sums[0];
+	fSx = sums[1];
+	fSy = sums[2];
+	fSxx = sums[3];
+	fSxy = sums[4];
+	fN += n > 0 ? n : 0;
+}
+
+void dragon::LinearSums::Merge(const LinearSums& other)
+{
+	fN += other.fN;
+	fS += other.fS;
+	fSx += other.fSx;
+	fSy += other.fSy;
+	fSxx += other.fSxx;
+	fSxy += other.fSxy;
+}
+
+bool dragon::LinearSums::Fit(double& slope, double& offset) const
+{
+	/*!
+	 * \returns false, leaving \e slope and \e offset unchanged, if there are fewer
+	 * than two points with distinct x
+	 */
+	const double det = GetDeterminant();
+	if (!(det > 1e-12*fS*fSxx)) return false;
+	slope  = (fS*fSxy - fSx*fSy) / det;
+	offset = (fSxx*fSy - fSx*fSxy) / det;
+	return true;
+}
+
+UDouble_t dragon::LinearSums::GetSlope() const
+{
+	/*! \returns 0 +/- 0 if the points do not determine a line */
+	double slope, offset;
+	if (!Fit(slope, offset)) return UDouble_t(0, 0);
+	return UDouble_t(slope, ::sqrt(fS / GetDeterminant()));
+}
+
+UDouble_t dragon::LinearSums::GetOffset() const
+{
+	/*! \returns 0 +/- 0 if the points do not determine a line */
+	double slope, offset;
+	if (!Fit(slope, offset)) return UDouble_t(0, 0);
+	return UDouble_t(offset, ::sqrt(fSxx / GetDeterminant()));
 }
 
 
@@ -73,6 +149,52 @@ double dragon::LinearFitter::Chi2err(double M, double B, double x, double y, dou
 	return num / den;
 }
 
+bool dragon::LinearFitter::FitWeighted(int n, const double* x, const double* y,
+                                       const double* exl, const double* exh,
+                                       const double* eyl, const double* eyh,
+                                       double& slope, double& offset)
+{
+	/*!
+	 * Minimizes the same chi2 as Fit() by iterated weighted least squares: each
+	 * pass solves the linear fit with weights 1/den from Chi2err() at the previous
+	 * solution (the effective variance method), which converges in a few passes.
+	 * Uses no global state or allocation, so it can run in several threads at once.
+	 * Only the parameters are found, not their errors.
+	 *
+	 * \returns false if the points do not determine a line (fewer than two distinct x)
+	 */
+	double xmax = 0;
+	for (int i = 0; i < n; ++i) xmax = std::max(xmax, fabs(x[i]));
+
+	double M = 0, B = 0;
+	for (int pass = 0; pass < 50; ++pass) {
+		LinearSums sums;
+		for (int i = 0; i < n; ++i) {
+			double den = 1;
+			if (pass > 0) {
+				const double ey = M*x[i] + B < y[i] ? eyl[i] : eyh[i];
+				den = ey*ey + pow(0.5*M*(exl[i]+exh[i]), 2);
+			}
+			else {
+				const double ey = 0.5*(eyl[i] + eyh[i]);
+				den = ey*ey;
+			}
+			sums.Add(x[i], y[i], den == 0 ? 1 : 1 / den);
+		}
+		double M1, B1;
+		if (!sums.Fit(M1, B1)) return false;
+
+		const bool converged = pass > 0 &&
+			fabs(M1 - M) <= 1e-12*fabs(M1) && fabs(B1 - B) <= 1e-12*(fabs(B1) + fabs(M1)*xmax);
+		M = M1;
+		B = B1;
+		if (converged) break;
+	}
+	slope = M;
+	offset = B;
+	return true;
+}
+
 void dragon::LinearFitter::Fit(TGraph* graph)
 {
 	gGraphSetter ggset(graph);
@@ -15,6 +15,55 @@ class TGraph;
 
 namespace dragon {
 
+/// Running sums of a weighted least squares straight-line fit
+/*!
+ * Keeps only the weighted sums of 1, x, y, x<sup>2</sup> and xy, so points can be
+ * added (and removed again) one at a time or in bulk at constant memory, and sums
+ * filled separately, e.g. by different threads or for different runs, can be merged.
+ * Fit() solves for the slope and offset in constant time, whatever the number of points.
+ *
+ * The sums are not shifted to the mean, so lines far from x = 0, relative to the
+ * spread of the points in x, lose precision.
+ */
+class LinearSums {
+public:
+	/// No points
+	LinearSums() { Clear(); }
+	/// Remove all points
+	void Clear() { fN = 0; fS = fSx = fSy = fSxx = fSxy = 0; }
+
+	/// Add a point with weight \e w (1/error<sup>2</sup> for an error weighted fit)
+	void Add(double x, double y, double w = 1.)
+		{ ++fN; fS += w; fSx += w*x; fSy += w*y; fSxx += w*x*x; fSxy += w*x*y; }
+	/// Remove a point added before with the same weight
+	void Remove(double x, double y, double w = 1.)
+		{ Add(x, y, -w); fN -= 2; }
+	/// Add \e n points, with weights \e w (all 1 if w is NULL)
+	void Add(int n, const double* x, const double* y, const double* w = 0);
+	/// Add the points of \e other
+	void Merge(const LinearSums& other);
+
+	/// Number of points
+	long GetN() const { return fN; }
+	/// Sum of weights
+	double GetWeight() const { return fS; }
+
+	/// Solve for the line, returns false if the points do not determine one
+	bool Fit(double& slope, double& offset) const;
+	/// Slope, with the error that follows from the weights being 1/error<sup>2</sup>
+	UDouble_t GetSlope() const;
+	/// Offset, with the error that follows from the weights being 1/error<sup>2</sup>
+	UDouble_t GetOffset() const;
+
+private:
+	/// Determinant of the normal equations
+	double GetDeterminant() const { return fS*fSxx - fSx*fSx; }
+
+private:
+	long fN;
+	double fS, fSx, fSy, fSxx, fSxy;
+};
+
 /// Generic linear fitter class. Uses MINOS to calculate asymmetric errors on
 /// parameters and can handle asymmetric x- and y-axis errors.
 class LinearFitter {
@@ -36,6 +85,11 @@ public:
 	/// Calculates chi2 using the asymmetric error method, see TGraph::Fit ROOT documentation
 	static double Chi2err(double M, double B, double x, double y, double exl, double exh, double eyl, double eyh);
 
+	/// Fit slope and offset without MINUIT, e.g. for refitting many resampled point sets in parallel
+	static bool FitWeighted(int n, const double* x, const double* y,
+	                        const double* exl, const double* exh, const double* eyl, const double* eyh,
+	                        double& slope, double& offset);
+
 private:
 	std::auto_ptr<TMinuit> fMinuit;
 	UDouble_t fSlope;
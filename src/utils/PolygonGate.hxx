@@ -0,0 +1,156 @@
+///
+/// \file PolygonGate.hxx
+/// \brief Defines a class for fast evaluation of 2D polygon gates.
+///
+#ifndef DRAGON_UTILS_POLYGON_GATE_HXX
+#define DRAGON_UTILS_POLYGON_GATE_HXX
+#include <vector>
+#include <algorithm>
+
+namespace dragon { namespace utils {
+
+/// Polygon "inside" test with precomputed acceleration structures
+/*!
+ * Gives exactly the same answers as TMath::IsInside() on the same points, which
+ * walks every edge of the polygon for each test. Instead, points are first checked
+ * against the bounding box of the polygon, and then looked up in a uniform grid
+ * laid over it. Cells which no edge passes through are entirely inside or
+ * entirely outside, and are answered directly; for the remaining (boundary)
+ * cells the usual crossing test is done, but only on the edges spanning
+ * the cell's row of the grid.
+ *
+ * Building the structures costs O(ngrid^2 * npoints), so a gate should be built
+ * once and then tested many times.
+ */
+class PolygonGate {
+public:
+	/// Empty gate (nothing is inside)
+	PolygonGate(): fNgrid(0) { }
+	/// Build from point arrays
+	PolygonGate(int np, const double* x, const double* y, int ngrid = 32)
+		{ Set(np, x, y, ngrid); }
+	/// (Re)build from point arrays
+	void Set(int np, const double* x, const double* y, int ngrid = 32);
+	/// Number of polygon points
+	int GetN() const { return fX.size(); }
+	/// Checks if a point is inside the polygon
+	bool IsInside(double xp, double yp) const
+		{
+			if (!(xp >= fXmin && xp <= fXmax && yp >= fYmin && yp <= fYmax)) return false;
+			if (fNgrid == 0) return Crossings(xp, yp, &fEdges[0], &fEdges[0] + fEdges.size());
+			const int ix = Bin(xp, fXmin, fInvDx), iy = Bin(yp, fYmin, fInvDy);
+			const char cell = fCells[iy*fNgrid + ix];
+			if (cell != kBoundary) return cell == kInside;
+			return Crossings(xp, yp, &fEdges[0] + fRowStart[iy], &fEdges[0] + fRowStart[iy+1]);
+		}
+
+private:
+	/// Grid cell states
+	enum { kOutside = 0, kInside = 1, kBoundary = 2 };
+	/// Grid bin of a coordinate, clamped to the grid
+	int Bin(double v, double vmin, double invd) const
+		{
+			int i = int((v - vmin)*invd);
+			return i < 0 ? 0 : i >= fNgrid ? fNgrid - 1 : i;
+		}
+	/// Crossing test over the edges listed in [begin, end)
+	bool Crossings(double xp, double yp, const int* begin, const int* end) const
+		{
+			bool oddNodes = false;
+			for (const int* k = begin; k < end; ++k) {
+				const int i = *k, j = i == 0 ? fX.size() - 1 : i - 1;
+				if ((fY[i]<yp && fY[j]>=yp) || (fY[j]<yp && fY[i]>=yp)) {
+					if (fX[i]+(yp-fY[i])/(fY[j]-fY[i])*(fX[j]-fX[i])<xp) {
+						oddNodes = !oddNodes;
+					}
+				}
+			}
+			return oddNodes;
+		}
+
+private:
+	std::vector<double> fX; ///< Polygon x points
+	std::vector<double> fY; ///< Polygon y points
+	double fXmin, fXmax, fYmin, fYmax; ///< Bounding box
+	double fInvDx, fInvDy; ///< Inverse grid cell size
+	int fNgrid; ///< Grid cells per axis, 0 to always test every edge
+	std::vector<char> fCells; ///< Cell states, row (y) major
+	std::vector<int> fEdges; ///< Edges (by end point index) spanning each row, concatenated
+	std::vector<int> fRowStart; ///< Start of each row in fEdges, plus the end of the last
+};
+
+inline void PolygonGate::Set(int np, const double* x, const double* y, int ngrid)
+{
+	/*!
+	 * \param np Number of points
+	 * \param x Array of x points
+	 * \param y Array of y points
+	 * \param ngrid Number of grid cells along each axis, 0 to skip building the grid.
+	 *
+	 * As for TMath::IsInside(), the last point is implicitly joined to the first.
+	 */
+	fX.assign(x, x + (np > 0 ? np : 0));
+	fY.assign(y, y + (np > 0 ? np : 0));
+	fCells.clear();
+	fEdges.clear();
+	fRowStart.clear();
+	fNgrid = 0;
+	fXmin = fYmin = 1;
+	fXmax = fYmax = 0; // rejects everything
+	fInvDx = fInvDy = 0;
+	if (fX.empty()) return;
+
+	fXmin = fXmax = fX[0];
+	fYmin = fYmax = fY[0];
+	for (size_t i = 1; i < fX.size(); ++i) {
+		if (fX[i] < fXmin) fXmin = fX[i];
+		if (fX[i] > fXmax) fXmax = fX[i];
+		if (fY[i] < fYmin) fYmin = fY[i];
+		if (fY[i] > fYmax) fYmax = fY[i];
+	}
+	for (int i = 0; i < np; ++i) fEdges.push_back(i);
+	if (ngrid <= 0 || !(fXmax > fXmin) || !(fYmax > fYmin)) return;
+
+	// Cells are widened by a small margin when testing which edges touch them,
+	// to cover rounding in Bin() and in the crossing point calculation
+	const double dx = (fXmax - fXmin) / ngrid, dy = (fYmax - fYmin) / ngrid;
+	const double ex = dx*1e-6, ey = dy*1e-6;
+	fInvDx = 1. / dx;
+	fInvDy = 1. / dy;
+
+	std::vector<int> all;
+	all.swap(fEdges);
+	fRowStart.push_back(0);
+	fCells.assign(ngrid*ngrid, kOutside);
+	for (int iy = 0; iy < ngrid; ++iy) {
+		const double y0 = fYmin + iy*dy - ey, y1 = fYmin + (iy+1)*dy + ey;
+		const int rowBegin = fEdges.size();
+		for (int i = 0; i < np; ++i) {
+			const int j = i == 0 ? np - 1 : i - 1;
+			if (std::max(fY[i], fY[j]) >= y0 && std::min(fY[i], fY[j]) <= y1)
+				fEdges.push_back(i);
+		}
+		fRowStart.push_back(fEdges.size());
+
+		for (int ix = 0; ix < ngrid; ++ix) {
+			const double x0 = fXmin + ix*dx - ex, x1 = fXmin + (ix+1)*dx + ex;
+			bool boundary = false;
+			for (size_t k = rowBegin; k < fEdges.size() && !boundary; ++k) {
+				const int i = fEdges[k], j = i == 0 ? np - 1 : i - 1;
+				boundary = std::max(fX[i], fX[j]) >= x0 && std::min(fX[i], fX[j]) <= x1;
+			}
+			char& cell = fCells[iy*ngrid + ix];
+			if (boundary)
+				cell = kBoundary;
+			else {
+				const double xc = fXmin + (ix + 0.5)*dx, yc = fYmin + (iy + 0.5)*dy;
+				cell = Crossings(xc, yc, &all[0], &all[0] + all.size()) ? kInside : kOutside;
+			}
+		}
+	}
+	fNgrid = ngrid;
+}
+
+} } // namespace dragon namespace utils
+
+#endif // #ifndef DRAGON_UTILS_POLYGON_GATE_HXX
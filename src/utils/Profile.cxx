@@ -0,0 +1,133 @@
+///
+/// \file Profile.cxx
+/// \brief Implements Profile.hxx
+///
+#include <cstdio>
+#include <cstring>
+#include <ostream>
+#include <unistd.h>
+#include "Profile.hxx"
+
+
+namespace dutils = dragon::utils;
+
+volatile bool dutils::Profile::fgEnabled = false;
+uint32_t dutils::Profile::fgSample = 1;
+uint32_t dutils::Profile::fgCalls[dutils::Profile::kNumStages];
+dutils::Profile::Counter_t dutils::Profile::fgCounters[dutils::Profile::kNumStages];
+uint64_t dutils::Profile::fgStartTicks = 0;
+double dutils::Profile::fgStartTime = 0;
+
+namespace {
+double get_time()
+{
+	timeval tv;
+	gettimeofday(&tv, 0);
+	return tv.tv_sec + 1e-6*tv.tv_usec;
+}
+const char* const kStageNames[dutils::Profile::kNumStages] = {
+	"file_read",
+	"event_init",
+	"queue_push",
+	"queue_match",
+	"head_unpack",
+	"head_calculate",
+	"tail_unpack",
+	"tail_calculate",
+	"tree_fill",
+	"hist_fill"
+};
+}
+
+void dutils::Profile::Enable(uint32_t sample)
+{
+	fgEnabled = false;
+	fgSample = sample ? sample : 1;
+	memset(fgCalls, 0, sizeof(fgCalls));
+	Reset();
+	fgStartTime = get_time();
+	fgStartTicks = Ticks();
+	fgEnabled = true;
+}
+
+void dutils::Profile::Disable()
+{
+	fgEnabled = false;
+}
+
+void dutils::Profile::Reset()
+{
+	memset(fgCounters, 0, sizeof(fgCounters));
+}
+
+void dutils::Profile::Get(Counter_t* counters)
+{
+	for (int i = 0; i < kNumStages; ++i) {
+		counters[i].fCalls = fgCounters[i].fCalls;
+		counters[i].fTicks = fgCounters[i].fTicks;
+		counters[i].fMax   = fgCounters[i].fMax;
+	}
+}
+
+const char* dutils::Profile::GetName(int stage)
+{
+	return stage >= 0 && stage < kNumStages ? kStageNames[stage] : "";
+}
+
+double dutils::Profile::Elapsed()
+{
+	return fgStartTime > 0 ? get_time() - fgStartTime : 0;
+}
+
+double dutils::Profile::TicksPerSecond()
+{
+	/*!
+	 * On x86 the TSC frequency is measured over the time since Enable(); if that
+	 * was too short to be accurate, over an extra 20 ms.
+	 */
+#if defined (__x86_64__) || defined (__i386__)
+	double t0 = fgStartTime;
+	uint64_t ticks0 = fgStartTicks;
+	if (get_time() - t0 < 0.1) {
+		t0 = get_time();
+		ticks0 = Ticks();
+		usleep(20000);
+	}
+	const double dt = get_time() - t0;
+	return dt > 0 ? (Ticks() - ticks0) / dt : 1e9;
+#else
+	return 1e6;
+#endif
+}
+
+void dutils::Profile::Print(std::ostream& strm)
+{
+	/*!
+	 * One line per stage which was called: the number of timed calls, the mean and
+	 * maximum time per call, the total time and its fraction of the wall time since
+	 * Enable(). With sampling, total times and fractions are extrapolated to all
+	 * calls.
+	 */
+	Counter_t counters[kNumStages];
+	Get(counters);
+	const double usPerTick = 1e6 / TicksPerSecond();
+	const double elapsed = Elapsed();
+
+	char line[256];
+	snprintf(line, sizeof(line), "%-16s %12s %12s %12s %12s %8s\n",
+					 "Stage", "Calls", "Mean [us]", "Max [us]", "Total [s]", "Wall [%]");
+	strm << line;
+	for (int i = 0; i < kNumStages; ++i) {
+		if (!counters[i].fCalls) continue;
+		const double total = 1e-6 * counters[i].fTicks * usPerTick * fgSample;
+		snprintf(line, sizeof(line), "%-16s %12llu %12.3f %12.1f %12.3f %8.2f\n",
+						 GetName(i), (unsigned long long)counters[i].fCalls,
+						 counters[i].fTicks * usPerTick / counters[i].fCalls,
+						 counters[i].fMax * usPerTick,
+						 total, elapsed > 0 ? 100. * total / elapsed : 0.);
+		strm << line;
+	}
+	if (fgSample > 1)
+		strm << "(1 in " << fgSample << " calls of each stage timed)\n";
+	strm.flush();
+}
@@ -0,0 +1,138 @@
+///
+/// \file Profile.hxx
+/// \brief Defines runtime-switchable timing of the stages of the analysis hot path.
+/// \details The timers are always compiled in; while profiling is disabled each
+///  instrumented stage costs one test of a global flag. Counters are updated with
+///  the GCC `__sync` builtins, so stages running in different threads may be timed
+///  at the same time.
+///
+#ifndef DRAGON_UTILS_PROFILE_HXX
+#define DRAGON_UTILS_PROFILE_HXX
+#ifndef __MAKECINT__
+#include <iosfwd>
+#include <sys/time.h>
+#include "IntTypes.h"
+
+namespace dragon { namespace utils {
+
+/// Per-stage call counters and timers of the analysis chain
+/*!
+ * Times are read from the CPU time stamp counter on x86 (calibrated against the
+ * time of day when reported), and from gettimeofday() (microseconds) elsewhere.
+ * With a sampling factor \e n > 1, only one in every \e n calls of each stage is
+ * timed.
+ *
+ * Stages don't nest, except that events constructed directly in the queue
+ * (tstamp::Queue::Push(header, data, ...)) include their event_init in queue_push.
+ * The event handlers called from tstamp::Queue are excluded from both queue stages.
+ */
+class Profile {
+public:
+	/// Instrumented stages
+	enum Stage_t {
+		kFileRead = 0,  ///< TMidasFile::Read(), ReadView(): reading and decompression
+		kEventInit,     ///< midas::Event::Init(): bank lookup and TSC parsing
+		kQueuePush,     ///< tstamp::Queue::Push(): copy and insertion
+		kQueueMatch,    ///< tstamp::Queue::Pop(): coincidence search
+		kHeadUnpack,    ///< dragon::Head::unpack()
+		kHeadCalculate, ///< dragon::Head::calculate()
+		kTailUnpack,    ///< dragon::Tail::unpack()
+		kTailCalculate, ///< dragon::Tail::calculate()
+		kTreeFill,      ///< TTree::Fill() (mid2root)
+		kHistFill,      ///< Histogram filling (rootana)
+		kNumStages
+	};
+
+	/// Accumulated counters of one stage
+	struct Counter_t {
+		uint64_t fCalls; ///< Number of timed calls
+		uint64_t fTicks; ///< Total time of the timed calls
+		uint64_t fMax;   ///< Longest call
+	};
+
+public:
+	/// Reset all counters and start timing 1 in \e sample calls of each stage
+	static void Enable(uint32_t sample = 1);
+	/// Stop timing, keeping the counters
+	static void Disable();
+	/// Check if timing is enabled
+	static bool IsEnabled() { return fgEnabled; }
+	/// Sampling factor
+	static uint32_t GetSample() { return fgSample; }
+	/// Set all counters to zero
+	static void Reset();
+	/// Copy the current counters of all stages into \e counters[kNumStages]
+	static void Get(Counter_t* counters);
+	/// Name of a stage
+	static const char* GetName(int stage);
+	/// Number of ticks per second
+	static double TicksPerSecond();
+	/// Seconds elapsed since Enable()
+	static double Elapsed();
+	/// Print a summary table
+	static void Print(std::ostream& strm);
+
+	/// Start timing a stage, returns 0 if this call isn't timed
+	static uint64_t Begin(Stage_t stage)
+		{
+			if (!fgEnabled) return 0;
+			if (fgSample > 1 && ++fgCalls[stage] % fgSample != 0) return 0;
+			const uint64_t t = Ticks();
+			return t ? t : 1;
+		}
+	/// Stop timing a stage started with Begin() at \e start
+	static void End(Stage_t stage, uint64_t start)
+		{
+			if (!start) return;
+			const uint64_t dt = Ticks() - start;
+			Counter_t& counter = fgCounters[stage];
+			__sync_fetch_and_add(&counter.fCalls, 1);
+			__sync_fetch_and_add(&counter.fTicks, dt);
+			for (uint64_t max = counter.fMax; dt > max; max = counter.fMax)
+				if (__sync_bool_compare_and_swap(&counter.fMax, max, dt)) break;
+		}
+	/// Current time, in ticks
+	static uint64_t Ticks()
+		{
+#if defined (__x86_64__) || defined (__i386__)
+			uint32_t lo, hi;
+			__asm__ __volatile__ ("rdtsc" : "=a" (lo), "=d" (hi));
+			return (uint64_t(hi) << 32) | lo;
+#else
+			timeval tv;
+			gettimeofday(&tv, 0);
+			return uint64_t(tv.tv_sec)*1000000 + tv.tv_usec;
+#endif
+		}
+
+private:
+	static volatile bool fgEnabled;
+	static uint32_t fgSample;
+	static uint32_t fgCalls[kNumStages]; ///< Sampling counts (not atomic, an occasional lost count is harmless)
+	static Counter_t fgCounters[kNumStages];
+	static uint64_t fgStartTicks;        ///< Ticks() at Enable()
+	static double fgStartTime;           ///< Time of day at Enable()
+};
+
+/// Times a stage from construction until Stop() or destruction
+class ProfileScope {
+public:
+	/// Start timing
+	explicit ProfileScope(Profile::Stage_t stage):
+		fStage(stage), fStart(Profile::Begin(stage)) { }
+	/// Stop timing, if not done already
+	~ProfileScope() { Stop(); }
+	/// Stop timing
+	void Stop() { Profile::End(fStage, fStart); fStart = 0; }
+private:
+	ProfileScope(const ProfileScope&);
+	ProfileScope& operator= (const ProfileScope&);
+	Profile::Stage_t fStage;
+	uint64_t fStart;
+};
+
+} }
+
+
+#endif // #ifndef __MAKECINT__
+#endif
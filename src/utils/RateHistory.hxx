@@ -0,0 +1,161 @@
+///
+/// \file RateHistory.hxx
+/// \brief Defines a bounded history of scaler readouts, answering windowed rate queries in constant time.
+///
+#ifndef DRAGON_UTILS_RATE_HISTORY_HXX
+#define DRAGON_UTILS_RATE_HISTORY_HXX
+#include <vector>
+#include <cstddef>
+
+namespace dragon { namespace utils {
+
+/// Bounded history of scaler readouts, for moving-average rates
+/*!
+ * Each readout adds the counts of every channel since the previous one. The
+ * history keeps the running sums of the counts (prefix sums over readouts)
+ * rather than the counts themselves, so the counts between any two stored
+ * readouts are one subtraction, and the rate of a channel over the last \e N
+ * seconds is found without scanning the readouts in between.
+ *
+ * Two rings of readouts are kept: the last \e length readouts, and every
+ * \e factor-th readout of the last \e factor * \e coarse ones. Windows longer
+ * than the first ring are answered from the second, to a resolution of
+ * \e factor readouts, so long horizons are covered with bounded memory
+ * (channels * (length + coarse) pairs of doubles). The stored readout closest
+ * to the start of a window is found from the average readout period, which
+ * for scaler events (read periodically) is one or two steps.
+ */
+class RateHistory {
+public:
+	/// Empty history of \e channels channels, see the class description for the others
+	RateHistory(int channels = 1, std::size_t length = 3600, std::size_t factor = 60, std::size_t coarse = 1440):
+		fChannels(channels > 0 ? channels : 1), fFactor(factor > 0 ? factor : 1),
+		fFine(length > 1 ? length : 2, fChannels), fCoarse(coarse > 1 ? coarse : 2, fChannels),
+		fSums(fChannels, 0.), fReadouts(0) { }
+
+	/// Remove all readouts, e.g. at the start of a run
+	void Clear()
+		{
+			fFine.Clear();
+			fCoarse.Clear();
+			fSums.assign(fSums.size(), 0.);
+			fReadouts = 0;
+		}
+
+	/// Add a readout at \e time (seconds) of the counts since the previous one, one per channel
+	template <class T>
+	void Add(double time, const T* counts)
+		{
+			for (int ch = 0; ch < fChannels; ++ch) fSums[ch] += counts[ch];
+			fFine.Push(time, &fSums[0]);
+			if (fReadouts++ % fFactor == 0) fCoarse.Push(time, &fSums[0]);
+		}
+
+	/// Number of readouts added since the last Clear()
+	std::size_t GetNumReadouts() const { return fReadouts; }
+	/// Number of channels
+	int GetNumChannels() const { return fChannels; }
+	/// Time of the last readout, 0 if there are none
+	double GetTime() const { return fFine.Size() ? fFine.Time(0) : 0.; }
+
+	/// Find the last stored readout at least \e seconds before the last readout
+	bool Sample(int ch, double seconds, double& time, double& sum) const
+		{
+			/*!
+			 * \param [in] ch Channel number
+			 * \param [in] seconds Time before the last readout
+			 * \param [out] time Time of the readout found
+			 * \param [out] sum Counts of channel \e ch up to and including that readout
+			 * \returns false if there are no readouts or \e ch is invalid; if the history
+			 *  does not reach back far enough, the oldest readout is used.
+			 */
+			if (ch < 0 || ch >= fChannels || fFine.Size() == 0) return false;
+			const double target = fFine.Time(0) - seconds;
+			const Ring& ring = (fFine.Time(fFine.Size() - 1) <= target || fCoarse.Size() == 0) ? fFine : fCoarse;
+			const std::size_t i = ring.Find(target);
+			time = ring.Time(i);
+			sum = ring.Sum(i, ch);
+			return true;
+		}
+
+	/// Counts of channel \e ch over the last \e seconds, as stored
+	double Counts(int ch, double seconds) const
+		{
+			double t0, s0, t1, s1;
+			if (!Sample(ch, seconds, t0, s0) || !Sample(ch, 0., t1, s1)) return 0.;
+			return s1 - s0;
+		}
+
+	/// Average rate (counts per second) of channel \e ch over the last \e seconds
+	double Rate(int ch, double seconds) const
+		{
+			/*!
+			 * Divides by the time between the readouts bounding the window, so the
+			 * result is exact for the stored readouts; returns 0 when the window
+			 * holds fewer than two readouts.
+			 */
+			double t0, s0, t1, s1;
+			if (!Sample(ch, seconds, t0, s0) || !Sample(ch, 0., t1, s1) || t1 <= t0) return 0.;
+			return (s1 - s0) / (t1 - t0);
+		}
+
+private:
+	/// Ring of readout times and prefix sums, indexed from the newest (0)
+	class Ring {
+	public:
+		Ring(std::size_t length, int channels):
+			fTimes(length, 0.), fSums(length * channels, 0.), fChannels(channels), fNext(0), fSize(0) { }
+
+		void Clear() { fNext = 0; fSize = 0; }
+
+		void Push(double time, const double* sums)
+			{
+				fTimes[fNext] = time;
+				for (int ch = 0; ch < fChannels; ++ch) fSums[fNext * fChannels + ch] = sums[ch];
+				fNext = (fNext + 1) % fTimes.size();
+				if (fSize < fTimes.size()) ++fSize;
+			}
+
+		std::size_t Size() const { return fSize; }
+		double Time(std::size_t i) const { return fTimes[Slot(i)]; }
+		double Sum(std::size_t i, int ch) const { return fSums[Slot(i) * fChannels + ch]; }
+
+		/// Index of the newest readout at or before \e time, the oldest if there is none
+		std::size_t Find(double time) const
+			{
+				const std::size_t last = fSize - 1;
+				const double span = Time(0) - Time(last);
+				std::size_t i = 0;
+				if (span > 0. && time < Time(0)) {
+					const double steps = (Time(0) - time) * last / span;
+					i = steps < last ? static_cast<std::size_t>(steps) : last;
+				}
+				while (i < last && Time(i) > time) ++i;
+				while (i > 0 && Time(i - 1) <= time) --i;
+				return i;
+			}
+
+	private:
+		std::size_t Slot(std::size_t i) const
+			{ return (fNext + fTimes.size() - 1 - i) % fTimes.size(); }
+
+		std::vector<double> fTimes;
+		std::vector<double> fSums;
+		int fChannels;
+		std::size_t fNext;  ///< Slot of the next readout stored
+		std::size_t fSize;  ///< Number of readouts stored
+	};
+
+private:
+	int fChannels;
+	std::size_t fFactor;      ///< Readouts per entry of fCoarse
+	Ring fFine;               ///< Every recent readout
+	Ring fCoarse;             ///< Every fFactor-th readout
+	std::vector<double> fSums; ///< Counts of each channel up to the last readout
+	std::size_t fReadouts;    ///< Readouts since the last Clear()
+};
+
+} } // namespace dragon::utils
+
+
+#endif
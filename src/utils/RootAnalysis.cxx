@@ -7,8 +7,16 @@
 #include <string>
 #include <cassert>
 #include <sstream>
+#include <fstream>
 #include <numeric>
 #include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include <TMath.h>
 #include <TClass.h>
@@ -17,13 +25,19 @@
 #include <TString.h>
 #include <TSystem.h>
 #include <TThread.h>
+#include <TRandom3.h>
 #include <TRegexp.h>
 #include <TFitResult.h>
 #include <TDataMember.h>
 #include <TTreeFormula.h>
+#include <TChainElement.h>
+#include <TVirtualIndex.h>
+#include <TKey.h>
+#include <TBuffer.h>
 
 #include "midas/Database.hxx"
 #include "utils/Functions.hxx"
+#include "utils/definitions.h"
 #include "Dragon.hxx"
 #include "Constants.hxx"
 #include "ErrorDragon.hxx"
@@ -63,6 +77,20 @@ namespace {
     }
 	~SetMakeClass_t() { if(fTree) fTree->SetMakeClass(fMakeClass); }
   };
+  // RAII class to change the read cache size of a tree and reset it when done
+  class SetCacheSize_t {
+	TTree* fTree;
+	Long64_t fCacheSize;
+  public:
+	SetCacheSize_t(TTree* tree, Long64_t size): fTree(tree)
+    {
+      if(fTree) {
+        fCacheSize = fTree->GetCacheSize();
+        fTree->SetCacheSize(size);
+      }
+    }
+	~SetCacheSize_t() { if(fTree) fTree->SetCacheSize(fCacheSize); }
+  };
   // Class to automatially reset TTree branch addresses
   class AutoResetBranchAddresses {
 	TObjArray fTrees;
@@ -87,6 +115,166 @@ namespace {
   }
 } // namespace
 
+///////////////////////////////// Helper class /////////////////////////////////
+namespace {
+  // Contents of a ROOT file, as stored in the file catalogue
+  struct CatalogueEntry_t {
+	Long_t fMtime;  // modification time, -1 if unknown (not cached)
+	Long64_t fSize; // file size
+	std::map<std::string, Long64_t> fTrees; // number of entries of each tree
+  };
+
+  // Cache of the trees in ROOT files, so that MakeChains() (and friends) do
+  // not need to open the files to check them and count entries. Saved in a
+  // text file, one line per ROOT file:
+  //  mtime size ntrees [tree entries]... filename
+  class FileCatalogue {
+  public:
+	FileCatalogue():
+      fPath(std::string(gSystem->HomeDirectory()) + "/.dragon_catalogue"),
+      fLoaded(kFALSE), fModified(kFALSE) { }
+	void SetPath(const char* path)
+    {
+      fPath = path ? path : "";
+      fEntries.clear();
+      fLoaded = fModified = kFALSE;
+    }
+	// Returns the contents of "filename" (from the cache if the file is unchanged),
+	// 0 if it cannot be read
+	const CatalogueEntry_t* Get(const TString& filename)
+    {
+      Load();
+      FileStat_t stat;
+      Bool_t local = gSystem->GetPathInfo(filename, stat) == 0;
+      std::map<std::string, CatalogueEntry_t>::iterator it = fEntries.find(filename.Data());
+      if(local && it != fEntries.end() &&
+         it->second.fMtime == stat.fMtime && it->second.fSize == stat.fSize)
+        return &(it->second);
+
+      std::auto_ptr<TFile> file (TFile::Open(filename));
+      if(!file.get() || file->IsZombie()) return 0;
+      CatalogueEntry_t entry;
+      entry.fMtime = local ? stat.fMtime : -1;
+      entry.fSize  = local ? stat.fSize  : -1;
+      TIter next(file->GetListOfKeys());
+      while(TKey* key = static_cast<TKey*>(next())) {
+        if(strcmp(key->GetClassName(), "TTree") != 0 || entry.fTrees.count(key->GetName()))
+          continue; // (keys are sorted by cycle, the first one is the latest)
+        TTree* tree = static_cast<TTree*>(file->Get(key->GetName()));
+        if(tree) entry.fTrees[key->GetName()] = tree->GetEntries();
+      }
+      fModified = fModified || local;
+      return &(fEntries[filename.Data()] = entry);
+    }
+	void Write()
+    {
+      if(fPath.empty() || !fModified) return;
+      std::ofstream file(fPath.c_str());
+      for(std::map<std::string, CatalogueEntry_t>::const_iterator it = fEntries.begin();
+          it != fEntries.end(); ++it) {
+        const CatalogueEntry_t& entry = it->second;
+        if(entry.fMtime < 0) continue;
+        file << entry.fMtime << " " << entry.fSize << " " << entry.fTrees.size();
+        for(std::map<std::string, Long64_t>::const_iterator t = entry.fTrees.begin();
+            t != entry.fTrees.end(); ++t)
+          file << " " << t->first << " " << t->second;
+        file << " " << it->first << "\n";
+      }
+      if(!file.good()) {
+        dutils::Warning("FileCatalogue", __FILE__, __LINE__)
+          << "could not write file catalogue \"" << fPath << "\"";
+      }
+      fModified = kFALSE;
+    }
+  private:
+	void Load()
+    {
+      if(fLoaded) return;
+      fLoaded = kTRUE;
+      if(fPath.empty()) return;
+      std::ifstream file(fPath.c_str());
+      std::string line;
+      while(std::getline(file, line)) {
+        std::istringstream strm(line);
+        CatalogueEntry_t entry;
+        size_t ntrees = 0;
+        bool ok = (strm >> entry.fMtime >> entry.fSize >> ntrees);
+        for(size_t i=0; ok && i< ntrees; ++i) {
+          std::string name;
+          Long64_t entries;
+          ok = (strm >> name >> entries);
+          if(ok) entry.fTrees[name] = entries;
+        }
+        std::string filename;
+        if(ok && std::getline(strm >> std::ws, filename) && !filename.empty())
+          fEntries[filename] = entry;
+      }
+    }
+	std::string fPath;
+	std::map<std::string, CatalogueEntry_t> fEntries;
+	Bool_t fLoaded;
+	Bool_t fModified;
+  };
+
+  FileCatalogue& file_catalogue()
+  {
+	static FileCatalogue catalogue;
+	return catalogue;
+  }
+
+  // Keys used to match head, tail and coincidence events: the unix time and
+  // serial number of the MIDAS event, available in the trees under the aliases
+  // "<side>_time" and "<side>_serial"
+  struct FriendKey_t {
+	const char* fTree;   // tree name in the run files
+	const char* fSide;   // "head" or "tail"
+	const char* fTime;   // time expression
+	const char* fSerial; // serial number expression
+  };
+  const FriendKey_t kFriendKeys[] = {
+	{ "t1", "head", "header.fTimeStamp",      "header.fSerialNumber"      },
+	{ "t3", "tail", "header.fTimeStamp",      "header.fSerialNumber"      },
+	{ "t5", "head", "head.header.fTimeStamp", "head.header.fSerialNumber" },
+	{ "t5", "tail", "tail.header.fTimeStamp", "tail.header.fSerialNumber" }
+  };
+  const Int_t kNumFriendKeys = sizeof(kFriendKeys) / sizeof(FriendKey_t);
+
+  // Set the key aliases of a tree named "treename" in the run files
+  void set_key_aliases(TTree* tree, const char* treename)
+  {
+	for(Int_t i=0; i< kNumFriendKeys; ++i) {
+      if(strcmp(treename, kFriendKeys[i].fTree) != 0) continue;
+      tree->SetAlias(Form("%s_time",   kFriendKeys[i].fSide), kFriendKeys[i].fTime);
+      tree->SetAlias(Form("%s_serial", kFriendKeys[i].fSide), kFriendKeys[i].fSerial);
+	}
+  }
+
+  // Add the files of a list of runs to chains named as the trees in the files
+  void add_run_files(TChain** chain, Int_t nchains, const Int_t* runnumbers, Int_t nruns,
+                     const char* format)
+  {
+	FileCatalogue& catalogue = file_catalogue();
+	for(Int_t i=0; i< nruns; ++i) {
+      TString fname = Form(format, runnumbers[i]);
+      gSystem->ExpandPathName(fname);
+      const CatalogueEntry_t* entry = catalogue.Get(fname);
+      if(!entry) {
+        dutils::Warning("MakeChains", __FILE__, __LINE__)
+          << "Skipping run " << runnumbers[i] << ", could not find file " << fname;
+        continue;
+      }
+      for(Int_t j=0; j< nchains; ++j) {
+        std::map<std::string, Long64_t>::const_iterator tree = entry->fTrees.find(chain[j]->GetName());
+        if(tree != entry->fTrees.end())
+          chain[j]->AddFile(fname, tree->second);
+      }
+	}
+	for(Int_t j=0; j< nchains; ++j)
+      set_key_aliases(chain[j], chain[j]->GetName());
+	catalogue.Write();
+  }
+} // namespace
+
 //////////////////////// namespace dragon Free Functions ///////////////////////
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -96,6 +284,10 @@ namespace {
 /// \param [in] nruns Length of _runnumbers_.
 /// \param format String specifying the file name format, uses _printf_ syntax.
 ///
+/// The trees and numbers of entries of each file are taken from the file catalogue
+/// (see SetFileCatalogue()), so unchanged files are not opened. The chains get the
+/// aliases used by FriendByIndex().
+///
 /// \note Does not return anything, but creates `new` heap-allocated TChains that
 ///       become part of the present ROOT directory; these must be deleted by the
 ///       user.
@@ -114,20 +306,7 @@ void dragon::MakeChains(const char* prefix, const Int_t* runnumbers, Int_t nruns
     };
 
     Int_t nchains = sizeof(chain) / sizeof(TChain*);
-    for(Int_t i=0; i< nruns; ++i) {
-      char fname[4096];
-      sprintf(fname, format, runnumbers[i]);
-      {
-        TFile file(fname);
-        if(file.IsZombie()) {
-          dutils::Warning("MakeChains", __FILE__, __LINE__)
-            << "Skipping run " << runnumbers[i] << ", could not find file " << fname;
-        }
-      }
-      for(int j=0; j< nchains; ++j) {
-        chain[j]->AddFile(fname);
-      }
-    }
+    add_run_files(chain, nchains, runnumbers, nruns, format);
     chain[0]->SetName(Form("%s1",  prefix));
     chain[1]->SetName(Form("%s2",  prefix));
     chain[2]->SetName(Form("%s3",  prefix));
@@ -149,20 +328,7 @@ void dragon::MakeChains(const char* prefix, const Int_t* runnumbers, Int_t nruns
     };
 
     Int_t nchains = sizeof(chain) / sizeof(TChain*);
-    for(Int_t i=0; i< nruns; ++i) {
-      char fname[4096];
-      sprintf(fname, format, runnumbers[i]);
-      {
-        TFile file(fname);
-        if(file.IsZombie()) {
-          dutils::Warning("MakeChains", __FILE__, __LINE__)
-            << "Skipping run " << runnumbers[i] << ", could not find file " << fname;
-        }
-      }
-      for(int j=0; j< nchains; ++j) {
-        chain[j]->AddFile(fname);
-      }
-    }
+    add_run_files(chain, nchains, runnumbers, nruns, format);
     chain[0]->SetName(Form("%s0",  prefix));
     chain[1]->SetName(Form("%s3",  prefix));
     chain[2]->SetName(Form("%s4",  prefix));
@@ -225,6 +391,265 @@ void dragon::FriendChain(TChain* chain, const char* friend_name,
   chain->AddFriend(friendchain, friend_alias, kTRUE);
 }
 
+////////////////////////////////////////////////////////////////////////////////
+/// Set the catalogue file used by MakeChains()
+/// \param path Text file caching the trees and entries of the run files, default
+///  `$HOME/.dragon_catalogue`; empty to only cache them for the current session.
+///  Entries are updated whenever a file's size or modification time changes.
+void dragon::SetFileCatalogue(const char* path)
+{
+  file_catalogue().SetPath(path);
+}
+
+///////////////////////////////// Helper class /////////////////////////////////
+namespace {
+  // Name of the friend index file of a run file: "run123.root" -> "run123_index.root"
+  TString friend_index_file(const TString& filename)
+  {
+	TString name = filename;
+	if(name.EndsWith(".root")) name.Remove(name.Length() - 5);
+	return name + "_index.root";
+  }
+
+  struct IndexKey_t {
+	UInt_t fTime;
+	UInt_t fSerial;
+	Long64_t fEntry;
+	bool operator< (const IndexKey_t& rhs) const
+    { return fTime != rhs.fTime ? fTime < rhs.fTime : fSerial < rhs.fSerial; }
+  };
+
+  // Read the keys of "treename"/"side" from the friend index of "filename",
+  // returns false if it is missing or older than the run file
+  bool read_friend_index(const TString& filename, const char* treename, const char* side,
+                         std::vector<IndexKey_t>* keys)
+  {
+	TString indexfile = friend_index_file(filename);
+	FileStat_t stat0, stat1;
+	if(gSystem->GetPathInfo(filename, stat0) != 0 || gSystem->GetPathInfo(indexfile, stat1) != 0 ||
+       stat1.fMtime < stat0.fMtime)
+      return false;
+	std::auto_ptr<TFile> file (TFile::Open(indexfile));
+	TTree* tree = file.get() ? static_cast<TTree*>(file->Get(Form("%s_%s", treename, side))) : 0;
+	if(!tree) return false;
+	IndexKey_t key;
+	tree->SetBranchAddress("time",   &key.fTime);
+	tree->SetBranchAddress("serial", &key.fSerial);
+	tree->SetBranchAddress("entry",  &key.fEntry);
+	keys->reserve(keys->size() + tree->GetEntries());
+	for(Long64_t i=0; i< tree->GetEntries(); ++i) {
+      tree->GetEntry(i);
+      keys->push_back(key);
+	}
+	return true;
+  }
+
+  // Index of a friend chain by the event time and serial number keys,
+  // built from the friend index files of the runs
+  class FriendIndex: public TVirtualIndex {
+  public:
+	FriendIndex(const char* side):
+      fMajorName(Form("%s_time", side)), fMinorName(Form("%s_serial", side)),
+      fParent(0), fParentTree(-1), fMajor(0), fMinor(0) { }
+	~FriendIndex() { delete fMajor; delete fMinor; }
+	std::vector<IndexKey_t>& GetKeys() { return fKeys; }
+	void Append(const TVirtualIndex*, Bool_t) { }
+	Long64_t GetEntryNumberFriend(const TTree* parent)
+    {
+      if(!parent) return -3;
+      if(parent != fParent || !fMajor) UpdateFormulaLeaves(parent);
+      if(fMajor->GetNdim() == 0 || fMinor->GetNdim() == 0) return -1;
+      if(fParent->GetTreeNumber() != fParentTree) {
+        fParentTree = fParent->GetTreeNumber();
+        fMajor->UpdateFormulaLeaves();
+        fMinor->UpdateFormulaLeaves();
+      }
+      fMajor->GetNdata();
+      fMinor->GetNdata();
+      return GetEntryNumberWithIndex(Long64_t(fMajor->EvalInstance()), Long64_t(fMinor->EvalInstance()));
+    }
+	Long64_t GetEntryNumberWithIndex(Long64_t major, Long64_t minor) const
+    {
+      IndexKey_t key = { UInt_t(major), UInt_t(minor), 0 };
+      std::vector<IndexKey_t>::const_iterator it = std::lower_bound(fKeys.begin(), fKeys.end(), key);
+      return it != fKeys.end() && !(key < *it) ? it->fEntry : -1;
+    }
+	Long64_t GetEntryNumberWithBestIndex(Long64_t major, Long64_t minor) const
+    {
+      IndexKey_t key = { UInt_t(major), UInt_t(minor), 0 };
+      std::vector<IndexKey_t>::const_iterator it = std::upper_bound(fKeys.begin(), fKeys.end(), key);
+      return it != fKeys.begin() ? (it - 1)->fEntry : -1;
+    }
+	const char* GetMajorName() const { return fMajorName.Data(); }
+	const char* GetMinorName() const { return fMinorName.Data(); }
+	Long64_t GetN() const { return fKeys.size(); }
+	Bool_t IsValidFor(const TTree* parent) { return parent && parent->GetAlias(fMajorName); }
+	void SetTree(const TTree* tree) { fTree = const_cast<TTree*>(tree); }
+	void UpdateFormulaLeaves(const TTree* parent)
+    {
+      delete fMajor;
+      delete fMinor;
+      fParent = const_cast<TTree*>(parent);
+      fParentTree = fParent->GetTreeNumber();
+      fMajor = new TTreeFormula("major", fMajorName, fParent);
+      fMinor = new TTreeFormula("minor", fMinorName, fParent);
+    }
+  private:
+	TString fMajorName;
+	TString fMinorName;
+	TTree* fParent;       // tree the formulas are compiled for
+	Int_t fParentTree;    // tree number of fParent when the leaves were last updated
+	TTreeFormula* fMajor; // time of the parent entry
+	TTreeFormula* fMinor; // serial number of the parent entry
+	std::vector<IndexKey_t> fKeys; // sorted keys
+  };
+} // namespace
+
+////////////////////////////////////////////////////////////////////////////////
+/// Write the friend index of a run file
+///
+/// For each of the head (`t1`), tail (`t3`) and coincidence (`t5`) trees, stores the
+/// MIDAS event time and serial number of all entries, sorted, into trees named
+/// `<tree>_<side>` of the file `<run>_index.root` next to the run file. These are
+/// used by FriendByIndex() to match events between the trees.
+/// \param filename Run file
+/// \param force Rebuild the index even if it is newer than the run file
+/// \returns Number of index trees written, 0 if the index is up to date, -1 for errors
+Int_t dragon::BuildFriendIndex(const char* filename, Bool_t force)
+{
+  TString fname = filename;
+  gSystem->ExpandPathName(fname);
+  TString indexfile = friend_index_file(fname);
+  FileStat_t stat0, stat1;
+  if(!force && gSystem->GetPathInfo(fname, stat0) == 0 &&
+     gSystem->GetPathInfo(indexfile, stat1) == 0 && stat1.fMtime >= stat0.fMtime)
+    return 0;
+
+  std::auto_ptr<TFile> in (TFile::Open(fname));
+  if(!in.get() || in->IsZombie()) {
+    dutils::Error("BuildFriendIndex", __FILE__, __LINE__)
+      << "could not open file " << fname;
+    return -1;
+  }
+  TDirectory* current = gDirectory;
+  std::auto_ptr<TFile> out (TFile::Open(indexfile, "RECREATE"));
+  if(!out.get() || out->IsZombie()) {
+    dutils::Error("BuildFriendIndex", __FILE__, __LINE__)
+      << "could not create index file " << indexfile;
+    if(current) current->cd();
+    return -1;
+  }
+
+  Int_t nwritten = 0;
+  for(Int_t k=0; k< kNumFriendKeys; ++k) {
+    const FriendKey_t& fk = kFriendKeys[k];
+    TTree* tree = static_cast<TTree*>(in->Get(fk.fTree));
+    if(!tree) continue;
+
+    std::vector<IndexKey_t> keys(tree->GetEntries());
+    TTreeFormula time("time", fk.fTime, tree), serial("serial", fk.fSerial, tree);
+    if(time.GetNdim() == 0 || serial.GetNdim() == 0) continue;
+    for(Long64_t i=0; i< tree->GetEntries(); ++i) {
+      tree->LoadTree(i);
+      time.GetNdata();
+      serial.GetNdata();
+      keys[i].fTime   = UInt_t(time.EvalInstance());
+      keys[i].fSerial = UInt_t(serial.EvalInstance());
+      keys[i].fEntry  = i;
+    }
+    std::sort(keys.begin(), keys.end());
+
+    out->cd();
+    IndexKey_t key;
+    TTree index(Form("%s_%s", fk.fTree, fk.fSide), Form("%s event keys of %s", fk.fSide, fk.fTree));
+    index.Branch("time",   &key.fTime,   "time/i");
+    index.Branch("serial", &key.fSerial, "serial/i");
+    index.Branch("entry",  &key.fEntry,  "entry/L");
+    for(size_t i=0; i< keys.size(); ++i) {
+      key = keys[i];
+      index.Fill();
+    }
+    index.Write();
+    ++nwritten;
+  }
+  if(current) current->cd();
+  return nwritten;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Add a head, tail or coincidence chain of the same runs as a friend, matched by event
+///
+/// Unlike FriendChain(), the entries of the friend are not aligned with those of
+/// _chain_: they are looked up by the MIDAS time and serial number of the _side_ event,
+/// using the index files written by BuildFriendIndex() (built here if missing or out
+/// of date). For example, to use the head singles event of each coincidence:
+/// \code
+/// dragon::MakeChains(runs);
+/// dragon::FriendByIndex(t5, "t1", "hs", "head");
+/// t5->Draw("hs.bgo.esort[0]");
+/// \endcode
+/// Entries with no match in the friend read the friend's default values.
+/// \param chain Chain to add the friend to, made by MakeChains()
+/// \param friend_tree Name of the friend tree in the run files (`t1`, `t3` or `t5`)
+/// \param friend_alias Alias of the friend
+/// \param side Side of the events to match: "head" or "tail"
+/// \returns The friend chain, 0 for errors
+TChain* dragon::FriendByIndex(TChain* chain, const char* friend_tree, const char* friend_alias,
+                              const char* side)
+{
+  Bool_t known = kFALSE;
+  for(Int_t k=0; k< kNumFriendKeys; ++k)
+    known = known || (!strcmp(kFriendKeys[k].fTree, friend_tree) && !strcmp(kFriendKeys[k].fSide, side));
+  if(!known) {
+    dutils::Error("FriendByIndex", __FILE__, __LINE__)
+      << "no \"" << side << "\" event keys in tree \"" << friend_tree << "\"";
+    return 0;
+  }
+  TObjArray* files = chain->GetListOfFiles();
+  if(files->GetEntries()) set_key_aliases(chain, files->At(0)->GetName());
+  if(!chain->GetAlias(Form("%s_time", side))) {
+    dutils::Error("FriendByIndex", __FILE__, __LINE__)
+      << "chain \"" << chain->GetName() << "\" has no \"" << side << "\" events";
+    return 0;
+  }
+
+  FileCatalogue& catalogue = file_catalogue();
+  TChain* friendchain = new TChain(friend_tree);
+  FriendIndex* index = new FriendIndex(side);
+  std::vector<IndexKey_t>& keys = index->GetKeys();
+  Long64_t offset = 0;
+  for(Int_t i=0; i< files->GetEntries(); ++i) {
+    TString fname = files->At(i)->GetTitle();
+    const CatalogueEntry_t* entry = catalogue.Get(fname);
+    std::map<std::string, Long64_t>::const_iterator tree =
+      entry ? entry->fTrees.find(friend_tree) : std::map<std::string, Long64_t>::const_iterator();
+    if(!entry || tree == entry->fTrees.end()) continue;
+
+    size_t first = keys.size();
+    if(!read_friend_index(fname, friend_tree, side, &keys)) {
+      keys.resize(first);
+      if(BuildFriendIndex(fname, kTRUE) < 0 || !read_friend_index(fname, friend_tree, side, &keys)) {
+        keys.resize(first);
+        dutils::Warning("FriendByIndex", __FILE__, __LINE__)
+          << "no friend index for file " << fname << ", skipping";
+        continue;
+      }
+    }
+    for(size_t j = first; j< keys.size(); ++j)
+      keys[j].fEntry += offset;
+    friendchain->AddFile(fname, tree->second);
+    offset += tree->second;
+  }
+  catalogue.Write();
+  // The files are in run order, but events of one run need not be
+  std::sort(keys.begin(), keys.end());
+
+  index->SetTree(friendchain);
+  friendchain->SetTreeIndex(index);
+  chain->AddFriend(friendchain, friend_alias, kTRUE);
+  return friendchain;
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 /// Open a dragon rootfile
 TFile* dragon::OpenRun(int runnum, const char* format)
@@ -282,7 +707,7 @@ Double_t dragon::MetricPrefix::Get(const char* prefix)
 /// TFile constructor documentation</a>.
 dragon::TTreeFilter::TTreeFilter(const char* filename, const char* option,
                                  const char* ftitle, Int_t compress):
-  fRunThreaded(kTRUE)
+  fRunThreaded(kTRUE), fNumThreads(0)
 {
   TDirectory* current = gDirectory;
   fFileOwner = kTRUE;
@@ -297,7 +722,7 @@ dragon::TTreeFilter::TTreeFilter(const char* filename, const char* option,
 /// \param output Currently existing directory in which to place the output tree.
 /// \note Takes no ownership of _output_.
 dragon::TTreeFilter::TTreeFilter(TDirectory* output):
-  fRunThreaded(kTRUE)
+  fRunThreaded(kTRUE), fNumThreads(0)
 {
   fFileOwner = kFALSE;
   fDirectory = output;
@@ -364,11 +789,28 @@ void dragon::TTreeFilter::Close()
 ///       to reset the filter condition to _condition_.
 void dragon::TTreeFilter::SetFilterCondition(TTree* tree, const char* condition)
 {
-  Out_t out = { 0, condition };
+  Out_t out = { 0, condition, "" };
   std::pair<Map_t::iterator, bool> insrt =
     fInputs.insert(std::make_pair(tree, out));
-  if(insrt.second == false) // key already existed, update condition
-    insrt.first->second = out;
+  if(insrt.second == false) { // key already existed, update condition
+    insrt.first->second.fTree = 0;
+    insrt.first->second.fCondition = condition;
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// \param tree The input TTree
+/// \param branches Space (or comma) separated list of the branches to copy into the
+///  output, may contain wildcards (see `TTree::SetBranchStatus()`); empty to copy all
+///  branches. The remaining branches are not read, except as needed to evaluate
+///  the filter condition.
+/// \note If _tree_ is not an input yet, it is added with an empty condition
+///  (all entries are selected).
+void dragon::TTreeFilter::SetBranches(TTree* tree, const char* branches)
+{
+  Out_t out = { 0, "", "" };
+  Map_t::iterator i = fInputs.insert(std::make_pair(tree, out)).first;
+  i->second.fBranches = branches ? branches : "";
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -380,37 +822,157 @@ const char* dragon::TTreeFilter::GetFilterCondition(TTree* tree) const
 
 ///////////////////////////////// Helper class /////////////////////////////////
 namespace {
-  struct ThreadArgs_t {
-	TTree*  fIn;  // input TTree
-	TTree** fOut; // output TTree
-	TDirectory* fOutDir;    // output directory
-	const char* fCondition; // filter condition
+  // Range of entries of one input to filter
+  struct FilterRange_t {
+	Int_t fInput;       // index of the input
+	Long64_t fFirst;    // first entry
+	Long64_t fLast;     // one past the last entry
+	std::vector<Long64_t> fSelected; // entries passing the condition
+	Bool_t fFailed;     // true if the input could not be reopened to filter the range
   };
-  void * run_thread(void* input)
+  struct FilterArgs_t {
+	const std::vector<TTree*>* fInputs;       // input trees
+	const std::vector<TString>* fConditions;  // filter conditions
+	std::vector<FilterRange_t>* fRanges;      // ranges to filter
+	Int_t* fNext;                             // next range to filter (shared)
+  };
+
+  // Make a new chain reading the same files as "in", 0 if it cannot be
+  // reopened (tree not from a file, or with friends)
+  // NOTE: holds TThread::Lock() if other threads may be running
+  TChain* clone_input(TTree* in)
   {
-	// NOTE: input must point to a valid ThreadArgs_t struct
-	Long64_t *nfiltered = new Long64_t(0);
-	TDirectory* current = 0;
-	ThreadArgs_t* args = (ThreadArgs_t*)input;
-	{
-      TThread::Lock();
-      current = gDirectory;
-      args->fOutDir->cd();
-      TThread::UnLock();
+	if(in->GetListOfFriends() && in->GetListOfFriends()->GetEntries()) return 0;
+	TChain* out = 0;
+	if(in->InheritsFrom(TChain::Class())) {
+      TObjArray* files = static_cast<TChain*>(in)->GetListOfFiles();
+      out = new TChain(in->GetName(), in->GetTitle());
+      for(Int_t i=0; i< files->GetEntries(); ++i) {
+        TChainElement* element = static_cast<TChainElement*>(files->At(i));
+        out->AddFile(element->GetTitle(), element->GetEntries(), element->GetName());
+      }
 	}
-	*(args->fOut) = args->fIn->CopyTree(args->fCondition);
-	(*(args->fOut))->AutoSave();
-	*nfiltered = (*(args->fOut))->GetEntries();
-	{
-      TThread::Lock();
-      current->cd();
-      TThread::UnLock();
+	else {
+      TFile* file = in->GetCurrentFile();
+      if(!file || in->GetDirectory() != file) return 0;
+      out = new TChain(in->GetName(), in->GetTitle());
+      out->AddFile(file->GetName(), in->GetEntries());
+	}
+	out->SetDirectory(0);
+	if(in->GetListOfAliases()) {
+      for(Int_t i=0; i< in->GetListOfAliases()->GetEntries(); ++i) {
+        TObject* alias = in->GetListOfAliases()->At(i);
+        if(alias) out->SetAlias(alias->GetName(), alias->GetTitle());
+      }
+	}
+	return out;
+  }
+
+  // Split the entries of "chain" into ranges on cluster boundaries, joining
+  // consecutive clusters until the ranges have at least "minsize" entries
+  void add_ranges(TChain* chain, Int_t input, Long64_t minsize, std::vector<FilterRange_t>* ranges)
+  {
+	chain->GetEntries(); // sets tree offsets
+	for(Int_t t=0; t< chain->GetNtrees(); ++t) {
+      Long64_t offset = chain->GetTreeOffset()[t];
+      if(chain->LoadTree(offset) < 0 || chain->GetTreeNumber() != t) continue;
+      TTree* tree = chain->GetTree();
+      Long64_t nentries = tree->GetEntries();
+      TTree::TClusterIterator clusters = tree->GetClusterIterator(0);
+      Long64_t first;
+      while((first = clusters.Next()) < nentries) {
+        Long64_t last = std::min(clusters.GetNextEntry(), nentries);
+        FilterRange_t* back = ranges->empty() ? 0 : &ranges->back();
+        if(back && back->fInput == input && back->fLast == offset + first &&
+           back->fLast - back->fFirst < minsize) {
+          back->fLast = offset + last;
+        }
+        else {
+          FilterRange_t range;
+          range.fInput = input;
+          range.fFirst = offset + first;
+          range.fLast  = offset + last;
+          range.fFailed = kFALSE;
+          ranges->push_back(range);
+        }
+      }
+	}
+  }
+
+  void * run_filter_thread(void* input)
+  {
+	// NOTE: input must point to a valid FilterArgs_t struct
+	FilterArgs_t* args = (FilterArgs_t*)input;
+	// Input copies and compiled conditions of this thread, made when first needed
+	std::vector<TChain*> chains(args->fInputs->size(), (TChain*)0);
+	std::vector<TTreeFormula*> formulas(args->fInputs->size(), (TTreeFormula*)0);
+	while (1) {
+      Int_t i;
+      {
+        TThread::Lock();
+        i = (*args->fNext)++;
+        TThread::UnLock();
+      }
+      if(i >= (Int_t)args->fRanges->size()) break;
+
+      FilterRange_t& range = args->fRanges->at(i);
+      const Int_t k = range.fInput;
+      if(!chains[k]) {
+        TThread::Lock();
+        chains[k] = clone_input(args->fInputs->at(k));
+        if(chains[k]) {
+          chains[k]->LoadTree(range.fFirst);
+          if(!args->fConditions->at(k).IsNull())
+            formulas[k] = new TTreeFormula("condition", args->fConditions->at(k), chains[k]);
+        }
+        TThread::UnLock();
+        if(!chains[k]) {
+          range.fFailed = kTRUE;
+          continue;
+        }
+      }
+      TChain* chain = chains[k];
+      TTreeFormula* formula = formulas[k];
+
+      // Same selection as TTree::CopyTree(): any instance of the condition is true
+      // (reads only the branches used in the condition)
+      Int_t treenum = -1;
+      for(Long64_t entry = range.fFirst; entry < range.fLast; ++entry) {
+        if(chain->LoadTree(entry) < 0) break;
+        if(formula && chain->GetTreeNumber() != treenum) {
+          treenum = chain->GetTreeNumber();
+          formula->UpdateFormulaLeaves();
+        }
+        Bool_t keep = formula == 0;
+        Int_t ndata = formula ? formula->GetNdata() : 0;
+        for(Int_t j=0; j< ndata && !keep; ++j)
+          keep = formula->EvalInstance(j) != 0;
+        if(keep) range.fSelected.push_back(entry);
+      }
 	}
-	return (void*)nfiltered;
+	TThread::Lock();
+	for(size_t k=0; k< chains.size(); ++k) {
+      Zap(formulas[k]);
+      Zap(chains[k]);
+	}
+	TThread::UnLock();
+	return 0;
+  }
+
+  // Select the branches to read in "tree"
+  void set_branches(TTree* tree, const TString& branches)
+  {
+	if(branches.IsNull()) return;
+	tree->SetBranchStatus("*", 0);
+	std::auto_ptr<TObjArray> tokens(branches.Tokenize(", "));
+	for(Int_t i=0; i< tokens->GetEntries(); ++i)
+      tree->SetBranchStatus(tokens->At(i)->GetName(), 1);
   }
 } // namespace
 
 ////////////////////////////////////////////////////////////////////////////////
+/// Filter all inputs
+/// \returns 0 for success, -1 if there are no inputs or no valid output directory
 Int_t dragon::TTreeFilter::Run()
 {
   if(IsZombie()) {
@@ -421,8 +983,9 @@ Int_t dragon::TTreeFilter::Run()
     utils::Error("TTreeFilter::Run", __FILE__, __LINE__) << "No inputs to filter.";
     return -1;
   }
-  std::vector<std::pair<TThread*, ThreadArgs_t*> > threads;
-  threads.reserve(fInputs.size());
+  std::vector<TTree*> inputs;
+  std::vector<TString> conditions;
+  std::vector<Out_t*> outputs;
   for(Map_t::iterator i = fInputs.begin(); i != fInputs.end(); ++i) {
     if(CheckCondition(i->first) == kFALSE) {
       utils::Warning("TTreeFilter::Run", __FILE__, __LINE__)
@@ -430,238 +993,536 @@ Int_t dragon::TTreeFilter::Run()
         << "\" for TTree at " << i->first << ", skipping.";
       continue;
     }
-    // Construct arguments
-    ThreadArgs_t *args = new ThreadArgs_t();
-    args->fIn     = i->first;
-    args->fOut    = &(i->second.fTree);
-    args->fOutDir = GetOutDir();
-    args->fCondition = i->second.fCondition;
-    // Construct thread and add to list
-    TThread *thread =	GetThreaded() ? new TThread(run_thread, args) : 0;
-    threads.push_back(std::make_pair(thread, args));
+    inputs.push_back(i->first);
+    conditions.push_back(i->second.fCondition);
+    outputs.push_back(&(i->second));
   }
   // Initial message
   std::cout
     << "Running the following filters:\n"
     << "\t<tree name>, <num events>, <filter condition>\n";
-  for(size_t i=0; i< threads.size(); ++i)
-    std::cout << "\t" << threads[i].second->fIn->GetName()    << ", "
-              <<         threads[i].second->fIn->GetEntries() << ", \""
-              <<         threads[i].second->fCondition << "\"\n";
+  for(size_t i=0; i< inputs.size(); ++i)
+    std::cout << "\t" << inputs[i]->GetName()    << ", "
+              <<         inputs[i]->GetEntries() << ", \""
+              <<         conditions[i] << "\"\n";
   std::cout << "\nIf there are many events, this may take a while...\n\n";
+
+  Int_t nthreads = 1;
+  if(GetThreaded()) {
+    nthreads = fNumThreads;
+    if(nthreads <= 0) {
+      SysInfo_t info;
+      nthreads = gSystem->GetSysInfo(&info) == 0 && info.fCpus > 0 ? info.fCpus : 1;
+    }
+  }
+
+  // Split inputs into ranges, aiming for several ranges per thread so that
+  // they are balanced even if a few clusters are slow to read
+  std::vector<TChain*> readers(inputs.size(), (TChain*)0);
+  Long64_t ntotal = 0;
+  for(size_t i=0; i< inputs.size(); ++i) {
+    readers[i] = clone_input(inputs[i]);
+    if(readers[i]) ntotal += readers[i]->GetEntries();
+  }
+  const Long64_t minsize = std::max<Long64_t>(1, ntotal / (8*nthreads));
+  std::vector<FilterRange_t> ranges;
+  for(size_t i=0; i< inputs.size(); ++i) {
+    if(readers[i]) add_ranges(readers[i], i, minsize, &ranges);
+  }
+
   // Run all threads
-  std::vector<void*> nout(threads.size(), 0);
-  for(size_t i=0; i< threads.size(); ++i) {
-    if(GetThreaded())
-      threads[i].first->Run();
-    else
-      nout[i] = run_thread(threads[i].second);
+  Int_t next = 0;
+  FilterArgs_t args = { &inputs, &conditions, &ranges, &next };
+  nthreads = std::max(1, std::min<Int_t>(nthreads, ranges.size()));
+  if(nthreads == 1) {
+    run_filter_thread(&args);
   }
-  // Join all threads
-  if(GetThreaded()) {
+  else {
+    std::vector<TThread*> threads;
+    for(Int_t i=0; i< nthreads; ++i) {
+      threads.push_back(new TThread(run_filter_thread, &args));
+      threads.back()->Run();
+    }
     for(size_t i=0; i< threads.size(); ++i) {
-      threads[i].first->Join( &(nout[i]) );
+      threads[i]->Join();
+      delete threads[i];
+    }
+  }
+
+  // Copy selected entries into the output, in entry order. This is done in
+  // series, and reading and writing the full entries (decompressing and
+  // compressing all of their branches) usually takes longer than the filtering.
+  // Inputs with a range which could not be filtered are copied in one piece.
+  std::vector<Long64_t> nout(inputs.size(), 0);
+  TDirectory* current = gDirectory;
+  GetOutDir()->cd();
+  for(size_t i=0; i< inputs.size(); ++i) {
+    for(size_t j=0; readers[i] && j< ranges.size(); ++j) {
+      if(ranges[j].fInput == (Int_t)i && ranges[j].fFailed) {
+        utils::Warning("TTreeFilter::Run", __FILE__, __LINE__)
+          << "Could not reopen the input files of TTree " << inputs[i]->GetName()
+          << ", filtering it in one piece with TTree::CopyTree().";
+        Zap(readers[i]);
+      }
+    }
+    TTree* out = 0;
+    if(readers[i] == 0) {
+      out = inputs[i]->CopyTree(conditions[i]);
     }
+    else {
+      set_branches(readers[i], outputs[i]->fBranches);
+      readers[i]->LoadTree(0);
+      out = readers[i]->CloneTree(0);
+      for(size_t j=0; j< ranges.size(); ++j) {
+        if(ranges[j].fInput != (Int_t)i) continue;
+        const std::vector<Long64_t>& selected = ranges[j].fSelected;
+        for(size_t e=0; e< selected.size(); ++e) {
+          readers[i]->GetEntry(selected[e]);
+          out->Fill();
+        }
+      }
+    }
+    out->AutoSave();
+    if(readers[i]) {
+      out->ResetBranchAddresses();
+      Zap(readers[i]);
+    }
+    outputs[i]->fTree = out;
+    nout[i] = out->GetEntries();
   }
-  // Message & cleanup
+  if(current) current->cd();
+
+  // Message
   std::cout << "Done!\nNumber of events written:\n"
             << "\t<tree name>, <num events>\n";
-  for(size_t i=0; i< threads.size(); ++i) {
-    Long64_t* nout64 = (Long64_t*) nout[i];
-    Long64_t nnn = nout64 ? *nout64 : 0;
-    std::cout << "\t" << threads[i].second->fIn->GetName() << ", " << nnn << "\n";
-    if(GetThreaded())
-      delete threads[i].first;
-    if(1)
-      delete threads[i].second;
-    if(nout64)
-      delete nout64;
-  }
+  for(size_t i=0; i< inputs.size(); ++i)
+    std::cout << "\t" << inputs[i]->GetName() << ", " << nout[i] << "\n";
   return 0;
 }
 
-/////////////////////////// Class dragon::RossumData ///////////////////////////
-
-////////////////////////////////////////////////////////////////////////////////
-/// Default Ctor
-dragon::RossumData::RossumData():
-  fFile(0)
-{
-  SetCups();
-}
+//////////////////////////// Class dragon::FastCutG ////////////////////////////
 
 ////////////////////////////////////////////////////////////////////////////////
 /// Ctor
-dragon::RossumData::RossumData(const char* name, const char* filename):
-  fFile(0)
+/// \param name Name of the new cut, used to refer to it in TTree::Draw() and
+///  TTreeFilter conditions
+/// \param cutg Cut to take the points and variables from
+dragon::FastCutG::FastCutG(const char* name, const TCutG& cutg):
+  TCutG(cutg)
 {
-  SetNameTitle(name, filename);
-  SetCups();
-  bool opened = OpenFile(filename, kTRUE);
-  if(!opened) CloseFile();
+  SetName(name);
+  Rebuild();
 }
 
 ////////////////////////////////////////////////////////////////////////////////
-/// Dtor
-dragon::RossumData::~RossumData()
+/// Set point
+/// Same as TGraph::SetPoint(), then rebuilds the gate. When changing many points,
+/// it is faster to change them through GetX() and GetY() and call Rebuild() once.
+void dragon::FastCutG::SetPoint(Int_t i, Double_t x, Double_t y)
 {
-  for(TreeMap_t::iterator it = fTrees.begin(); it != fTrees.end(); ++it)
-    if(GetTree_(it)) GetTree_(it)->Delete();
+  TCutG::SetPoint(i, x, y);
+  Rebuild();
 }
 
 ////////////////////////////////////////////////////////////////////////////////
-void dragon::RossumData::SetCups()
+/// Rebuild the gate from the current points
+void dragon::FastCutG::Rebuild()
 {
-  fWhichCup["fc4"]  = 0;
-  fWhichCup["fc1"]  = 1;
-  fWhichCup["fcch"] = 2;
-  fWhichCup["fcm"]  = 3;
-  fWhichCup["fcf"]  = 4;
+  fGate.Set(GetN(), GetX(), GetY());
 }
 
 ////////////////////////////////////////////////////////////////////////////////
-void dragon::RossumData::CloseFile()
+/// Streamer
+/// Streams the class as usual, rebuilding the gate after reading
+void dragon::FastCutG::Streamer(TBuffer& b)
 {
-  fFile.reset(0);
+  if(b.IsReading()) {
+    b.ReadClassBuffer(dragon::FastCutG::Class(), this);
+    Rebuild();
+  }
+  else {
+    b.WriteClassBuffer(dragon::FastCutG::Class(), this);
+  }
 }
 
-////////////////////////////////////////////////////////////////////////////////
-/// \param filename Path to the rossum file
-/// \param parse If true, go ahead and attempt parsing the specified rossum
-///        file, if false, a separate call to ParseFile() will be needed.
-Bool_t dragon::RossumData::OpenFile(const char* filename, Bool_t parse)
-{
-  TString filename2 = filename;
-  Bool_t expand = gSystem->ExpandPathName(filename2);
-  if(!expand)
-    fFile.reset(new std::ifstream(filename2));
-  else
-    std::cerr << "Invalid file: " << filename2 << "\n";
-  Bool_t retval = fFile.get() && fFile->good();
-  if(!retval) CloseFile();
-  else if(parse) ParseFile();
-  return retval;
-}
+/////////////////////////// Class dragon::RossumData ///////////////////////////
 
-////////////////////////////////////////////////////////////////////////////////
-/// Create a ROOT tree of rossum data
-TTree* dragon::RossumData::MakeTree()
-{
-  TTree* tree = new TTree("tcup", "");
-  tree->Branch("cup", &fCup, "cup/I");
-  tree->Branch("iteration", &fIteration, "iteration/I");
-  tree->Branch("time", &fTime, "time/D");
-  tree->Branch("current", &fCurrent, "current/D");
-  return tree;
-}
+///////////////////////////////// Helper class /////////////////////////////////
+namespace {
+  // One Faraday cup reading
+  struct RossumReading_t {
+	Int_t fCup;
+	Int_t fIteration;
+	Double_t fTime;
+	Double_t fCurrent;
+  };
+  // All readings of one rossum query (START to STOP)
+  struct RossumQuery_t {
+	Int_t fRun;
+	std::string fTime;
+	std::vector<RossumReading_t> fReadings;
+  };
+  typedef std::vector<RossumQuery_t> RossumQueries_t;
 
-////////////////////////////////////////////////////////////////////////////////
-/// Parse rossum data (`*.rossumdata`) file
-Bool_t dragon::RossumData::ParseFile()
-{
-  if(!fFile.get()) {
-    dutils::Error("RossumData::ParseFile", __FILE__, __LINE__)
-      << "No rossum data file open.";
-    return kFALSE;
-  }
-  Int_t runnum = 0;
-  Bool_t retval = kTRUE;
-  fFile->seekg(0);
-  while (1) {
-    std::string line0;
-    std::getline(*fFile, line0);
-    if(!fFile->good())
-      break;
-    if(line0.substr(0, 5) == "START") {
-      std::string strTime = "Thu Jan  1 00:00:00 1970";
-      size_t posTime = line0.rfind("\t");
-      if(posTime+1 < line0.size()) strTime = line0.substr(posTime+1);
+  // Read-only memory map of a whole file
+  class MappedFile_t {
+	char* fData;
+	size_t fSize;
+	Bool_t fOpen;
+  public:
+	MappedFile_t(const char* path): fData(0), fSize(0), fOpen(kFALSE)
+    {
+      int fd = open(path, O_RDONLY);
+      if(fd < 0) return;
+      struct stat st;
+      if(fstat(fd, &st) == 0) {
+        fOpen = st.st_size == 0;
+        if(st.st_size > 0) {
+          void* addr = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+          if(addr != MAP_FAILED) {
+            fData = (char*)addr;
+            fSize = st.st_size;
+            fOpen = kTRUE;
+            madvise(addr, fSize, MADV_SEQUENTIAL);
+          }
+        }
+      }
+      close(fd);
+    }
+	~MappedFile_t() { if(fData) munmap(fData, fSize); }
+	Bool_t IsOpen() const { return fOpen; }
+	const char* Begin() const { return fData; }
+	const char* End() const { return fData + fSize; }
+  };
 
-      TTree* tree = MakeTree();
-      AutoResetBranchAddresses Rst_(tree);
-      tree->SetDirectory(0);
-      std::map<Int_t, Int_t> cupIteration;
-      Bool_t fullRun = kFALSE;
+  // One line of text, [fBegin, fEnd) without the newline
+  struct Line_t {
+	const char* fBegin;
+	const char* fEnd;
+	Bool_t StartsWith(const char* s) const
+    {
+      size_t n = strlen(s);
+      return (size_t)(fEnd - fBegin) >= n && memcmp(fBegin, s, n) == 0;
+    }
+	// Pointer to the first occurrence of "s", 0 if there is none
+	const char* Find(const char* s) const
+    {
+      const char* pos = std::search(fBegin, fEnd, s, s + strlen(s));
+      return pos == fEnd ? 0 : pos;
+    }
+	std::string Str() const { return std::string(fBegin, fEnd); }
+  };
 
-      while(1) {
-        std::getline(*fFile, line0);
-        if(!fFile->good())
-          break;
-        else if(line0.substr(0, 4) == "STOP")
+  // Splits a memory range into lines
+  class LineReader_t {
+	const char* fPos;
+	const char* fEnd;
+  public:
+	LineReader_t(const char* begin, const char* end): fPos(begin), fEnd(end) { }
+	Bool_t Next(Line_t& line)
+    {
+      if(fPos >= fEnd) return kFALSE;
+      const char* eol = (const char*)memchr(fPos, '\n', fEnd - fPos);
+      line.fBegin = fPos;
+      line.fEnd = eol ? eol : fEnd;
+      fPos = line.fEnd + 1;
+      return kTRUE;
+    }
+  };
+
+  // Copies at most 63 characters of [begin, end) into "buf", null terminated
+  const char* terminate(const char* begin, const char* end, char (&buf)[64])
+  {
+	size_t n = std::min((size_t)(end - begin), sizeof(buf) - 1);
+	memcpy(buf, begin, n);
+	buf[n] = '\0';
+	return buf;
+  }
+
+  // Parses the text of a rossum file, returns kFALSE if any line is invalid
+  Bool_t parse_rossum(const char* begin, const char* end,
+                      const std::map<std::string, Int_t>& whichCup,
+                      RossumQueries_t& queries)
+  {
+	Int_t runnum = 0;
+	Bool_t retval = kTRUE;
+	LineReader_t reader(begin, end);
+	Line_t line;
+	char buf[64];
+	while (reader.Next(line)) {
+      if(!line.StartsWith("START"))
+        continue;
+      queries.push_back(RossumQuery_t());
+      RossumQuery_t& query = queries.back();
+      query.fTime = "Thu Jan  1 00:00:00 1970";
+      const char* posTime = line.fEnd;
+      while(posTime > line.fBegin && *(posTime-1) != '\t') --posTime;
+      if(posTime == line.fBegin) query.fTime = line.Str();
+      else if(posTime < line.fEnd) query.fTime.assign(posTime, line.fEnd);
+
+      std::map<Int_t, Int_t> cupIteration;
+      while(reader.Next(line)) {
+        if(line.StartsWith("STOP"))
           break;
-        else if(line0.substr(0, 5) == "begin") {
+        else if(line.StartsWith("begin")) {
           runnum = 0;
-          size_t curpos = line0.find("Current");
-          if(curpos > line0.size()) {
+          const char* curpos = line.Find("Current");
+          if(!curpos) {
             dutils::Error("RossumData::ParseFile", __FILE__, __LINE__)
-              << "could not parse cup name from line: " << line0;
+              << "could not parse cup name from line: " << line.Str();
             retval = kFALSE;
             continue;
           }
-          std::string which = line0.substr(6, curpos-6);
-          std::map<std::string, Int_t>::iterator itWhich = fWhichCup.find(which);
-          if(itWhich == fWhichCup.end()) {
+          std::string which = curpos - line.fBegin > 6 ? std::string(line.fBegin + 6, curpos) : "";
+          std::map<std::string, Int_t>::const_iterator itWhich = whichCup.find(which);
+          if(itWhich == whichCup.end()) {
             dutils::Error("RossumData::ParseFile", __FILE__, __LINE__)
-              << "could not parse cup name from line: " << line0;
+              << "could not parse cup name from line: " << line.Str();
             retval = kFALSE;
             continue;
           }
-          {
-            fCup = itWhich->second;
-            std::map<Int_t, Int_t>::iterator itCupIteration = cupIteration.find(fCup);
-            if(itCupIteration == cupIteration.end())
-              cupIteration.insert(std::make_pair(fCup, 0));
-            else
-              ++(itCupIteration->second);
-            itCupIteration = cupIteration.find(fCup);
-            fIteration = itCupIteration->second;
-          }
-          while(1) {
-            std::getline(*fFile, line0);
-            TString line(line0);
-            if(!fFile->good())
-              break;
-            else if(line.Contains("end"))
+          RossumReading_t reading;
+          reading.fCup = itWhich->second;
+          std::map<Int_t, Int_t>::iterator itCupIteration = cupIteration.find(reading.fCup);
+          if(itCupIteration == cupIteration.end())
+            reading.fIteration = cupIteration[reading.fCup] = 0;
+          else
+            reading.fIteration = ++(itCupIteration->second);
+
+          while(reader.Next(line)) {
+            if(line.Find("end"))
               break;
-            else {
-              std::auto_ptr<TObjArray> tok (line.Tokenize("\t"));
-              if(!tok.get() || tok->GetEntries() != 2) {
-                {
-                  dutils::Error err("RossumData::ParseFile", __FILE__, __LINE__);
-                  err << "invalid current read line: " << line;
-                  if(tok.get())
-                    err << " : ntokens == " << tok->GetEntries() << "\n";
-                  else
-                    err << " : tok.get() == 0\n";
-                }
-                retval = kFALSE;
-                continue;
+            // Expect exactly two non-empty, tab separated tokens
+            const char* tok[2][2];
+            Int_t ntok = 0;
+            for(const char* pos = line.fBegin; pos < line.fEnd; ) {
+              const char* tab = std::find(pos, line.fEnd, '\t');
+              if(tab != pos) {
+                if(ntok < 2) { tok[ntok][0] = pos; tok[ntok][1] = tab; }
+                ++ntok;
               }
-              fTime =    ((TObjString*)tok->At(0))->GetString().Atof();
-              fCurrent = ((TObjString*)tok->At(1))->GetString().Atof();
-              tree->Fill();
+              pos = tab + 1;
             }
+            if(ntok != 2) {
+              dutils::Error("RossumData::ParseFile", __FILE__, __LINE__)
+                << "invalid current read line: " << line.Str()
+                << " : ntokens == " << ntok << "\n";
+              retval = kFALSE;
+              continue;
+            }
+            reading.fTime    = atof(terminate(tok[0][0], tok[0][1], buf));
+            reading.fCurrent = atof(terminate(tok[1][0], tok[1][1], buf));
+            query.fReadings.push_back(reading);
           }
         }
-        else if(line0.find("STARTED midas run") < line0.size()) {
-          TString line =
-            line0.substr(line0.find("STARTED")+std::string("STARTED midas run ").size()).c_str();
-          runnum = line.Atoi();
+        else if(const char* started = line.Find("STARTED midas run")) {
+          started = std::min(started + strlen("STARTED midas run "), line.fEnd);
+          runnum = atoi(terminate(started, line.fEnd, buf));
         }
       }
-      fTrees.insert(std::make_pair(runnum, std::make_pair(tree, strTime)));
-      fullRun = kTRUE;
-      std::stringstream ssname, sstitle;
-      ssname << "tcup" << runnum;
-      if(runnum == 0) {
-        static int i = 0;
-        ssname << "_" << i++ ;
-      }
-      sstitle << "Farady cup readings preceding run " << runnum;
-      tree->SetNameTitle(ssname.str().c_str(), sstitle.str().c_str());
+      query.fRun = runnum;
+	}
+	return retval;
+  }
+
+  // Binary cache of a parsed rossum file; layout:
+  //   magic, source size and mtime, number of queries, then for each query:
+  //   run, length of time string, time string, number of readings, readings
+  const char kRossumMagic[8] = { 'R', 'S', 'M', 'C', '0', '0', '0', '1' };
+
+  template <class T>
+  Bool_t write_raw(std::ostream& strm, const T* p, size_t n = 1)
+  {
+	if(n) strm.write((const char*)p, n*sizeof(T));
+	return strm.good();
+  }
+  template <class T>
+  Bool_t read_raw(std::istream& strm, T* p, size_t n = 1)
+  {
+	if(n) strm.read((char*)p, n*sizeof(T));
+	return strm.good();
+  }
+
+  Bool_t read_rossum_cache(const std::string& path, Long64_t size, Long64_t mtime,
+                           RossumQueries_t& queries)
+  {
+	std::ifstream file(path.c_str(), std::ios::binary);
+	char magic[sizeof(kRossumMagic)];
+	Long64_t size0 = -1, mtime0 = -1;
+	UInt_t nqueries = 0;
+	Bool_t ok = file.good() && read_raw(file, magic, sizeof(magic)) &&
+      memcmp(magic, kRossumMagic, sizeof(magic)) == 0;
+	ok = ok && read_raw(file, &size0) && read_raw(file, &mtime0) && read_raw(file, &nqueries);
+	ok = ok && size0 == size && mtime0 == mtime;
+	if(ok) queries.resize(nqueries);
+	for(UInt_t i = 0; ok && i < nqueries; ++i) {
+      UInt_t ntime = 0, nreadings = 0;
+      ok = read_raw(file, &queries[i].fRun) && read_raw(file, &ntime) && ntime < 1024;
+      if(ok) queries[i].fTime.resize(ntime);
+      ok = ok && (ntime == 0 || read_raw(file, &queries[i].fTime[0], ntime)) &&
+        read_raw(file, &nreadings);
+      if(ok) queries[i].fReadings.resize(nreadings);
+      ok = ok && (nreadings == 0 || read_raw(file, &queries[i].fReadings[0], nreadings));
+	}
+	if(!ok) queries.clear();
+	return ok;
+  }
+
+  void write_rossum_cache(const std::string& path, Long64_t size, Long64_t mtime,
+                          const RossumQueries_t& queries)
+  {
+	std::ofstream file(path.c_str(), std::ios::binary);
+	UInt_t nqueries = queries.size();
+	Bool_t ok = file.good() && write_raw(file, kRossumMagic, sizeof(kRossumMagic)) &&
+      write_raw(file, &size) && write_raw(file, &mtime) && write_raw(file, &nqueries);
+	for(UInt_t i = 0; ok && i < nqueries; ++i) {
+      const RossumQuery_t& query = queries[i];
+      UInt_t ntime = query.fTime.size(), nreadings = query.fReadings.size();
+      ok = write_raw(file, &query.fRun) && write_raw(file, &ntime) &&
+        write_raw(file, query.fTime.data(), ntime) && write_raw(file, &nreadings) &&
+        (nreadings == 0 || write_raw(file, &query.fReadings[0], nreadings));
+	}
+	file.close();
+	if(!ok) gSystem->Unlink(path.c_str());
+  }
+} // namespace
+
+////////////////////////////////////////////////////////////////////////////////
+/// Default Ctor
+dragon::RossumData::RossumData()
+{
+  SetCups();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Ctor
+dragon::RossumData::RossumData(const char* name, const char* filename)
+{
+  SetNameTitle(name, filename);
+  SetCups();
+  bool opened = OpenFile(filename, kTRUE);
+  if(!opened) CloseFile();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Dtor
+dragon::RossumData::~RossumData()
+{
+  for(TreeMap_t::iterator it = fTrees.begin(); it != fTrees.end(); ++it)
+    if(GetTree_(it)) GetTree_(it)->Delete();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void dragon::RossumData::SetCups()
+{
+  fWhichCup["fc4"]  = 0;
+  fWhichCup["fc1"]  = 1;
+  fWhichCup["fcch"] = 2;
+  fWhichCup["fcm"]  = 3;
+  fWhichCup["fcf"]  = 4;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void dragon::RossumData::CloseFile()
+{
+  fFileName.clear();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// \param filename Path to the rossum file
+/// \param parse If true, go ahead and attempt parsing the specified rossum
+///        file, if false, a separate call to ParseFile() will be needed.
+Bool_t dragon::RossumData::OpenFile(const char* filename, Bool_t parse)
+{
+  CloseFile();
+  TString filename2 = filename;
+  Bool_t expand = gSystem->ExpandPathName(filename2);
+  if(!expand) {
+    if(!gSystem->AccessPathName(filename2, kReadPermission))
+      fFileName = filename2.Data();
+  }
+  else
+    std::cerr << "Invalid file: " << filename2 << "\n";
+  Bool_t retval = IsFileOpen();
+  if(retval && parse) ParseFile();
+  return retval;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Create a ROOT tree of rossum data
+TTree* dragon::RossumData::MakeTree()
+{
+  TTree* tree = new TTree("tcup", "");
+  tree->Branch("cup", &fCup, "cup/I");
+  tree->Branch("iteration", &fIteration, "iteration/I");
+  tree->Branch("time", &fTime, "time/D");
+  tree->Branch("current", &fCurrent, "current/D");
+  return tree;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Parse rossum data (`*.rossumdata`) file
+/// The readings are loaded from the binary cache (`<file>.cache`) if it matches
+/// the size and modification time of the rossum file; otherwise the file is
+/// parsed (memory-mapped) and, if no errors were found, the cache is rewritten.
+Bool_t dragon::RossumData::ParseFile()
+{
+  FileStat_t stat;
+  if(!IsFileOpen() || gSystem->GetPathInfo(fFileName.c_str(), stat) != 0) {
+    dutils::Error("RossumData::ParseFile", __FILE__, __LINE__)
+      << "No rossum data file open.";
+    return kFALSE;
+  }
+  Bool_t retval = kTRUE;
+  RossumQueries_t queries;
+  const std::string cacheName = fFileName + ".cache";
+  if(!read_rossum_cache(cacheName, stat.fSize, stat.fMtime, queries)) {
+    MappedFile_t file(fFileName.c_str());
+    if(!file.IsOpen()) {
+      dutils::Error("RossumData::ParseFile", __FILE__, __LINE__)
+        << "Could not read rossum data file " << fFileName;
+      return kFALSE;
+    }
+    retval = parse_rossum(file.Begin(), file.End(), fWhichCup, queries);
+    if(retval) write_rossum_cache(cacheName, stat.fSize, stat.fMtime, queries);
+  }
 
-      if(!fullRun) tree->Delete();
+  for(size_t q = 0; q< queries.size(); ++q) {
+    const RossumQuery_t& query = queries[q];
+    const Int_t runnum = query.fRun;
+    TTree* tree = MakeTree();
+    tree->SetDirectory(0);
+    {
+      AutoResetBranchAddresses Rst_(tree);
+      for(size_t i = 0; i< query.fReadings.size(); ++i) {
+        fCup       = query.fReadings[i].fCup;
+        fIteration = query.fReadings[i].fIteration;
+        fTime      = query.fReadings[i].fTime;
+        fCurrent   = query.fReadings[i].fCurrent;
+        tree->Fill();
+      }
+    }
+    // Index the readings of the first query of each run (the one GetTree() returns)
+    if(fTrees.find(runnum) == fTrees.end()) {
+      for(size_t i = 0; i< query.fReadings.size(); ++i) {
+        const RossumReading_t& reading = query.fReadings[i];
+        std::pair<Index_t::iterator, bool> ins =
+          fIndex.insert(std::make_pair(IndexKey_(runnum, reading.fCup, reading.fIteration),
+                                       std::make_pair((Int_t)fReadTime.size(), 0)));
+        fReadTime.push_back(reading.fTime);
+        fReadCurrent.push_back(reading.fCurrent);
+        ins.first->second.second = fReadTime.size();
+      }
     }
+    fTrees.insert(std::make_pair(runnum, std::make_pair(tree, query.fTime)));
+    std::stringstream ssname, sstitle;
+    ssname << "tcup" << runnum;
+    if(runnum == 0) {
+      static int i = 0;
+      ssname << "_" << i++ ;
+    }
+    sstitle << "Farady cup readings preceding run " << runnum;
+    tree->SetNameTitle(ssname.str().c_str(), sstitle.str().c_str());
   }
   return retval;
 }
@@ -708,32 +1569,21 @@ TTree* dragon::RossumData::GetTree(Int_t runnum, const char* time) const
 UDouble_t dragon::RossumData::AverageCurrent(Int_t run, Int_t cup, Int_t iteration,
                                              Double_t skipBegin, Double_t skipEnd)
 {
-  TTree* tree = GetTree(run);
-  if(!tree) {
-    utils::Error("RossumData::AverageCurrent", __FILE__, __LINE__)
-      << "Invalid run " << run;
-    return UDouble_t(0);
-  }
-  Double_t time_, current_;
-  Int_t cup_, iteration_, success;
-  success = tree->SetBranchAddress("current", &current_);
-  success = tree->SetBranchAddress("time", &time_);
-  success = tree->SetBranchAddress("cup", &cup_);
-  success = tree->SetBranchAddress("iteration", &iteration_);
-  if(success) {
-    utils::Error("RossumData::AverageCurrent", __FILE__, __LINE__)
-      << "Failure to set branch addresses";
+  Index_t::const_iterator itIndex = fIndex.find(IndexKey_(run, cup, iteration));
+  if(itIndex == fIndex.end()) {
+    utils::Error err("RossumData::AverageCurrent", __FILE__, __LINE__);
+    if(!GetTree(run))
+      err << "Invalid run " << run;
+    else
+      err << "No readings of cup " << cup << ", iteration " << iteration << " for run " << run;
     return UDouble_t(0);
   }
-  AutoResetBranchAddresses Rst_(tree);
-  Double_t t0 = -1;
+  const Int_t first = itIndex->second.first, last = itIndex->second.second;
+  const Double_t t0 = fReadTime[first];
   std::vector<Double_t> current, time;
-  for(Long64_t entry = 0; entry< tree->GetEntries(); ++entry) {
-    tree->GetEntry(entry);
-    if(cup_ != cup || iteration_ != iteration)
-      continue; // failed cut
+  for(Int_t i = first; i< last; ++i) {
+    const Double_t time_ = fReadTime[i];
     assert(time_ >= 0);
-    if(t0 < 0) t0 = time_;
     if(time_ - t0 > skipBegin) {
       if(!time.empty() && !(time_ >= time.back())) {
         utils::Error("RossumData::AverageCurrent", __FILE__, __LINE__)
@@ -741,10 +1591,15 @@ UDouble_t dragon::RossumData::AverageCurrent(Int_t run, Int_t cup, Int_t iterati
           << time_ << ", " << time.back() << "\n";
         return UDouble_t(0, 0);
       }
-      current.push_back(current_);
+      current.push_back(fReadCurrent[i]);
       time.push_back(time_);
     }
   }
+  if(time.empty()) {
+    utils::Error("RossumData::AverageCurrent", __FILE__, __LINE__)
+      << "No readings after skipping the first " << skipBegin << " seconds";
+    return UDouble_t(0);
+  }
   // Find last time
   const std::vector<Double_t>::iterator::difference_type diffLast =
     std::lower_bound(time.begin(), time.end(), time.back() - skipEnd,
@@ -813,7 +1668,7 @@ TGraph* dragon::RossumData::PlotTransmission(Int_t* runs, Int_t nruns)
 ////////////////////////////////////////////////////////////////////////////////
 /// Default constructor
 dragon::BeamNorm::BeamNorm():
-  fRunDataTree("t_rundata", ""), fRossum(0)
+  fRunDataTree("t_rundata", ""), fRossum(0), fNumThreads(0)
 {
   fRunDataTree.SetMarkerStyle(21);
   fRunDataTree.Branch("rundata", "dragon::BeamNorm::RunData", &fRunDataBranchAddr);
@@ -822,7 +1677,7 @@ dragon::BeamNorm::BeamNorm():
 ////////////////////////////////////////////////////////////////////////////////
 /// Construct from rossum file
 dragon::BeamNorm::BeamNorm(const char* name, const char* rossumFile):
-  fRunDataTree("t_rundata", ""), fRossum(0)
+  fRunDataTree("t_rundata", ""), fRossum(0), fNumThreads(0)
 {
   SetNameTitle(name, rossumFile);
   ChangeRossumFile(rossumFile);
@@ -841,6 +1696,189 @@ void dragon::BeamNorm::ChangeRossumFile(const char* name)
   fRossum.reset(new RossumData(rossumName.c_str(), name));
 }
 
+///////////////////////////////// Helper class /////////////////////////////////
+namespace {
+  // Reads the run number from the stop (or start) ODB of "datafile",
+  // returns 0 for failure
+  Int_t read_runnum(TFile* datafile)
+  {
+	if(!datafile || datafile->IsZombie()) {
+      std::cout << "\n";
+      dutils::Error("BeamNorm::ReadSbCounts", __FILE__, __LINE__)
+        << "Invalid datafile: " << datafile;
+      return 0;
+	}
+
+	Bool_t haveRunnum = kFALSE;
+	Int_t runnum = 0;
+	midas::Database* db = static_cast<midas::Database*>(datafile->Get("odbstop"));
+
+	if (db) haveRunnum = db->ReadValue("/Runinfo/Run number", runnum);
+	else {
+      std::cout << "\n";
+      dutils::Warning("BeamNorm::ReadSbCounts", __FILE__, __LINE__)
+        << "MIDAS database at run stop time missing from file " << datafile->GetName() << "\n";
+      midas::Database* dbstart = static_cast<midas::Database*>(datafile->Get("odbstart"));
+      if (dbstart) haveRunnum = dbstart->ReadValue("/Runinfo/Run number", runnum);
+      else {
+        std::cout << "\n";
+        dutils::Error("BeamNorm::ReadSbCounts", __FILE__, __LINE__)
+          << "MIDAS database at run start time missing from file " << datafile->GetName() << "\n";
+        return 0;
+      }
+	}
+	if(!haveRunnum) {
+      std::cout << "\n";
+      dutils::Error("BeamNorm::ReadSbCounts", __FILE__, __LINE__)
+        << "could not read run number from file " << datafile->GetName();
+      return 0;
+	}
+	return runnum;
+  }
+
+  // Does the work of BeamNorm::ReadSbCounts(), storing the results in "rundata"
+  // (only reads from "datafile", so independent files can be processed concurrently)
+  Int_t read_sb_counts(TFile* datafile, Double_t pkLow0, Double_t pkHigh0,
+                       Double_t pkLow1, Double_t pkHigh1, Double_t time,
+                       dragon::BeamNorm::RunData* rundata)
+  {
+	std::auto_ptr<dragon::RunSummary> summary (dragon::RunSummary::Read(datafile));
+	Int_t runnum = summary.get() ? summary->GetRunNumber() : read_runnum(datafile);
+	if(!runnum) return 0;
+
+	TTree* t3 = static_cast<TTree*>(datafile->Get("t3"));
+	if(t3 == 0 || t3->GetListOfBranches()->At(0) == 0) {
+      std::cout << "\n";
+      dutils::Error("BeamNorm::ReadSbCounts", __FILE__, __LINE__)
+        << "no heavy-ion data tree in file" << datafile->GetName();
+      return 0;
+	}
+
+	TTree* t20 = static_cast<TTree*>(datafile->Get("t20"));
+	if(t20 == 0 || t20->GetListOfBranches()->At(0) == 0) {
+      dutils::Error("BeamNorm::ReadSbCounts", __FILE__, __LINE__)
+        << "no EPICS tree in file" << datafile->GetName();
+      return 0;
+	}
+
+	dragon::Tail tail;
+	dragon::Tail *pTail = &tail;
+	t3->SetBranchAddress(t3->GetListOfBranches()->At(0)->GetName(), &pTail);
+
+	dragon::Epics epics;
+	dragon::Epics* pEpics = &epics;
+	t20->SetBranchAddress(t20->GetListOfBranches()->At(0)->GetName(), &pEpics);
+
+	AutoResetBranchAddresses Rst3_(t3);
+	AutoResetBranchAddresses Rst20_(t20);
+
+	Long64_t ncounts[NSB];
+	Long64_t ncounts_full[NSB];
+	for(int i=0; i< NSB; ++i) {
+      ncounts[i] = 0;
+      ncounts_full[i] = 0;
+	}
+
+	t3->GetEntry(0);
+	Double_t tstart = pTail->header.fTimeStamp;
+	Double_t low[NSB] =  { pkLow0,  pkLow1  };
+	Double_t high[NSB] = { pkHigh0, pkHigh1 };
+
+	// From the summary if possible, otherwise from the tree
+	Bool_t haveCounts = summary.get() != 0;
+	for(int i=0; haveCounts && i< NSB; ++i) {
+      ncounts_full[i] = summary->GetSbCounts(i, low[i], high[i]);
+      ncounts[i] = summary->GetSbCounts(i, low[i], high[i], time);
+      haveCounts = ncounts_full[i] >= 0 && ncounts[i] >= 0;
+	}
+	for(int i=0; !haveCounts && i< NSB; ++i) {
+      std::stringstream cut;
+      cut.precision(20);
+      cut << "sb.ecal[" << i << "] > " << low[i] << " && sb.ecal[" << i << "] < " << high[i];
+      ncounts_full[i] = t3->GetPlayer()->GetEntries(cut.str().c_str());
+
+      cut << " && header.fTimeStamp - " << tstart << " < " << time;
+      ncounts[i] = t3->GetPlayer()->GetEntries(cut.str().c_str());
+	}
+
+	UDouble_t live, live_full[3]; // [3]: head,tail,coinc
+	const Double_t busy = summary.get() ? summary->GetBusytime("tail", 0, time) : -1;
+	if(busy >= 0) {
+      live = (time - busy) / time;
+      live_full[0] = summary->GetLivetime("head");
+      live_full[1] = summary->GetLivetime("tail");
+      live_full[2] = summary->GetLivetime("coinc");
+	}
+	else {
+      dragon::LiveTimeCalculator ltc;
+      ltc.SetFile(datafile);
+      ltc.CalculateSub(0, time);
+      live = ltc.GetLivetime("tail");
+      ltc.Calculate();
+      live_full[0] = ltc.GetLivetime("head");
+      live_full[1] = ltc.GetLivetime("tail");
+      live_full[2] = ltc.GetLivetime("coinc");
+	}
+
+	t20->GetEntry(0);
+	Double_t tstart20 = pEpics->header.fTimeStamp;
+	Int_t t1 = 0;
+	std::vector<double> pressure;
+
+	for(Long64_t entry = 0; entry != t20->GetEntries(); ++entry) {
+      t20->GetEntry(entry);
+      if(pEpics->ch == 0) {
+        pressure.push_back(pEpics->val);
+        if(pEpics->header.fTimeStamp - tstart20 < time)
+          ++t1;
+      }
+	}
+
+	rundata->runnum = runnum;
+	rundata->time = time;
+	for(int i=0; i< NSB; ++i) {
+      rundata->sb_counts[i] = UDouble_t(ncounts[i]);
+      rundata->sb_counts_full[i] = UDouble_t(ncounts_full[i]);
+	}
+	//
+	// Pressure over SB norm time
+	{
+      const Double_t pressureMean = dutils::calculate_mean(pressure.begin(), pressure.begin() + t1);
+      const Double_t pressureSigma = dutils::calculate_stddev(pressure.begin(),
+                                                              pressure.begin() + t1, pressureMean);
+      rundata->pressure = UDouble_t (pressureMean, pressureSigma);
+	}
+	//
+	// Pressure over full run
+	{
+      const Double_t pressureMean = dutils::calculate_mean(pressure.begin(), pressure.end());
+      const Double_t pressureSigma = dutils::calculate_stddev(pressure.begin(),
+                                                              pressure.end(), pressureMean);
+      rundata->pressure_full = UDouble_t (pressureMean, pressureSigma);
+	}
+	rundata->live_time = live;
+	rundata->live_time_head  = live_full[0];
+	rundata->live_time_tail  = live_full[1];
+	rundata->live_time_coinc = live_full[2];
+
+	return runnum;
+  }
+
+  // Copy the values calculated by read_sb_counts()
+  void copy_sb_counts(const dragon::BeamNorm::RunData& from, dragon::BeamNorm::RunData* to)
+  {
+	to->time = from.time;
+	std::copy(from.sb_counts,      from.sb_counts + NSB,      to->sb_counts);
+	std::copy(from.sb_counts_full, from.sb_counts_full + NSB, to->sb_counts_full);
+	to->pressure        = from.pressure;
+	to->pressure_full   = from.pressure_full;
+	to->live_time       = from.live_time;
+	to->live_time_head  = from.live_time_head;
+	to->live_time_tail  = from.live_time_tail;
+	to->live_time_coinc = from.live_time_coinc;
+  }
+} // namespace
+
 ////////////////////////////////////////////////////////////////////////////////
 /// Integrate the surface barrier counts at the beginning and end of a run
 ///
@@ -855,6 +1893,10 @@ void dragon::BeamNorm::ChangeRossumFile(const char* name)
 /// \param time Number of seconds at the beginning of the run to use for
 ///  calculating the normalization
 ///
+/// The counts and live times are taken from the RunSummary of the file
+/// if it has one (and _time_ is a whole number of seconds), instead of
+/// scanning \c t3.
+///
 /// \returns The run number of the specified file.
 Int_t dragon::BeamNorm::ReadSbCounts(TFile* datafile, Double_t pkLow0, Double_t pkHigh0,
                                      Double_t pkLow1, Double_t pkHigh1,Double_t time)
@@ -865,139 +1907,9 @@ Int_t dragon::BeamNorm::ReadSbCounts(TFile* datafile, Double_t pkLow0, Double_t
       << "no rossum file loaded.";
     return 0;
   }
-  if(!datafile || datafile->IsZombie()) {
-    std::cout << "\n";
-    dutils::Error("BeamNorm::ReadSbCounts", __FILE__, __LINE__)
-      << "Invalid datafile: " << datafile;
-    return 0;
-  }
-
-  Bool_t haveRunnum = kFALSE;
-  Int_t runnum = 0;
-  midas::Database* db = static_cast<midas::Database*>(datafile->Get("odbstop"));
-
-  if (db) haveRunnum = db->ReadValue("/Runinfo/Run number", runnum);
-  else {
-    std::cout << "\n";
-    dutils::Warning("BeamNorm::ReadSbCounts", __FILE__, __LINE__)
-      << "MIDAS database at run stop time missing from file " << datafile->GetName() << "\n";
-    midas::Database* dbstart = static_cast<midas::Database*>(datafile->Get("odbstart"));
-    if (dbstart) haveRunnum = dbstart->ReadValue("/Runinfo/Run number", runnum);
-    else {
-      std::cout << "\n";
-      dutils::Error("BeamNorm::ReadSbCounts", __FILE__, __LINE__)
-        << "MIDAS database at run start time missing from file " << datafile->GetName() << "\n";
-      return 0;
-    }
-  }
-  if(!haveRunnum) {
-    std::cout << "\n";
-    dutils::Error("BeamNorm::ReadSbCounts", __FILE__, __LINE__)
-      << "could not read run number from file " << datafile->GetName();
-    return 0;
-  }
-
-  TTree* t3 = static_cast<TTree*>(datafile->Get("t3"));
-  if(t3 == 0 || t3->GetListOfBranches()->At(0) == 0) {
-    std::cout << "\n";
-    dutils::Error("BeamNorm::ReadSbCounts", __FILE__, __LINE__)
-      << "no heavy-ion data tree in file" << datafile->GetName();
-    return 0;
-  }
-
-  TTree* t20 = static_cast<TTree*>(datafile->Get("t20"));
-  if(t20 == 0 || t20->GetListOfBranches()->At(0) == 0) {
-    dutils::Error("BeamNorm::ReadSbCounts", __FILE__, __LINE__)
-      << "no EPICS tree in file" << datafile->GetName();
-    return 0;
-  }
-
-  dragon::Tail tail;
-  dragon::Tail *pTail = &tail;
-  t3->SetBranchAddress(t3->GetListOfBranches()->At(0)->GetName(), &pTail);
-
-  dragon::Epics epics;
-  dragon::Epics* pEpics = &epics;
-  t20->SetBranchAddress(t20->GetListOfBranches()->At(0)->GetName(), &pEpics);
-
-  AutoResetBranchAddresses Rst3_(t3);
-  AutoResetBranchAddresses Rst20_(t20);
-
-  Long64_t ncounts[NSB];
-  Long64_t ncounts_full[NSB];
-  for(int i=0; i< NSB; ++i) {
-    ncounts[i] = 0;
-    ncounts_full[i] = 0;
-  }
-
-  t3->GetEntry(0);
-  Double_t tstart = pTail->header.fTimeStamp;
-  Double_t low[NSB] =  { pkLow0,  pkLow1  };
-  Double_t high[NSB] = { pkHigh0, pkHigh1 };
-
-  for(int i=0; i< NSB; ++i) {
-    std::stringstream cut;
-    cut.precision(20);
-    cut << "sb.ecal[" << i << "] > " << low[i] << " && sb.ecal[" << i << "] < " << high[i];
-    ncounts_full[i] = t3->GetPlayer()->GetEntries(cut.str().c_str());
-
-    cut << " && header.fTimeStamp - " << tstart << " < " << time;
-    ncounts[i] = t3->GetPlayer()->GetEntries(cut.str().c_str());
-  }
-
-  UDouble_t live, live_full[3]; // [3]: head,tail,coinc
-  {
-    dragon::LiveTimeCalculator ltc;
-    ltc.SetFile(datafile);
-    ltc.CalculateSub(0, time);
-    live = ltc.GetLivetime("tail");
-    ltc.Calculate();
-    live_full[0] = ltc.GetLivetime("head");
-    live_full[1] = ltc.GetLivetime("tail");
-    live_full[2] = ltc.GetLivetime("coinc");
-  }
-
-  t20->GetEntry(0);
-  Double_t tstart20 = pTail->header.fTimeStamp;
-  Int_t t1 = 0;
-  std::vector<double> pressure;
-
-  for(Long64_t entry = 0; entry != t20->GetEntries(); ++entry) {
-    t20->GetEntry(entry);
-    if(pEpics->ch == 0) {
-      pressure.push_back(pEpics->val);
-      if(pEpics->header.fTimeStamp - tstart20 < time)
-        ++t1;
-    }
-  }
-
-  RunData* rundata = GetOrCreateRunData(runnum);
-  rundata->time = time;
-  for(int i=0; i< NSB; ++i) {
-    rundata->sb_counts[i] = UDouble_t(ncounts[i]);
-    rundata->sb_counts_full[i] = UDouble_t(ncounts_full[i]);
-  }
-  //
-  // Pressure over SB norm time
-  {
-    const Double_t pressureMean = utils::calculate_mean(pressure.begin(), pressure.begin() + t1);
-    const Double_t pressureSigma = utils::calculate_stddev(pressure.begin(),
-                                                           pressure.begin() + t1, pressureMean);
-    rundata->pressure = UDouble_t (pressureMean, pressureSigma);
-  }
-  //
-  // Pressure over full run
-  {
-    const Double_t pressureMean = utils::calculate_mean(pressure.begin(), pressure.end());
-    const Double_t pressureSigma = utils::calculate_stddev(pressure.begin(),
-                                                           pressure.end(), pressureMean);
-    rundata->pressure_full = UDouble_t (pressureMean, pressureSigma);
-  }
-  rundata->live_time = live;
-  rundata->live_time_head  = live_full[0];
-  rundata->live_time_tail  = live_full[1];
-  rundata->live_time_coinc = live_full[2];
-
+  RunData result;
+  Int_t runnum = read_sb_counts(datafile, pkLow0, pkHigh0, pkLow1, pkHigh1, time, &result);
+  if(runnum) copy_sb_counts(result, GetOrCreateRunData(runnum));
   return runnum;
 }
 
@@ -1284,43 +2196,66 @@ namespace {
   }
 } // namespace
 
-////////////////////////////////////////////////////////////////////////////////
-/// Calculate the number of recoils per run
-void dragon::BeamNorm::CalculateRecoils(TFile* datafile, const char* treename, const char* gate)
-{
-  if(datafile == 0 || datafile->IsZombie()) {
-    std::cerr << "Invalid datafile!\n";
-    return;
-  }
-  TTree* t = (TTree*)datafile->Get(treename);
-  if(!t || t->IsA() != TTree::Class()) {
-    dutils::Error("BeamNorm::CalculateRecoils", __FILE__, __LINE__)
-      << "no tree named \"" << treename << "\" in the specified file!";
-    return;
-  }
-  // Copy aliases from chain
-  TChain* chain = (TChain*)gROOT->GetListOfSpecials()->FindObject(treename);
-  if(chain && chain->InheritsFrom(TChain::Class())) {
-    if(chain->GetListOfAliases()) {
-      for(Int_t i=0; i< chain->GetListOfAliases()->GetEntries(); ++i) {
-        TObject* alias = chain->GetListOfAliases()->At(i);
-        if(alias) t->SetAlias(alias->GetName(), alias->GetTitle());
-      }
-    }
-  }
-
-  Bool_t haveRunnum = kFALSE;
-  Int_t runnum = 0;
-  midas::Database* db = static_cast<midas::Database*>(datafile->Get("odbstop"));
-  if(db) haveRunnum = db->ReadValue("/Runinfo/Run number", runnum);
-  if(!db || !haveRunnum) {
-    dutils::Error("BeamNorm::CalculateRecoils", __FILE__, __LINE__)
-      << "could not read run number from TFile at " << datafile;
-    return;
-  }
-
-  UDouble_t nrecoil (t->GetPlayer()->GetEntries(gate));
-  RunData* rundata = GetOrCreateRunData(runnum);
+///////////////////////////////// Helper class /////////////////////////////////
+namespace {
+  // Does the counting for BeamNorm::CalculateRecoils(), returns the run number
+  // (0 for failure)
+  Int_t count_recoils(TFile* datafile, const char* treename, const char* gate, UDouble_t* nrecoil)
+  {
+	if(datafile == 0 || datafile->IsZombie()) {
+      std::cerr << "Invalid datafile!\n";
+      return 0;
+	}
+	TTree* t = (TTree*)datafile->Get(treename);
+	if(!t || t->IsA() != TTree::Class()) {
+      dutils::Error("BeamNorm::CalculateRecoils", __FILE__, __LINE__)
+        << "no tree named \"" << treename << "\" in the specified file!";
+      return 0;
+	}
+	// Copy aliases from chain
+	{
+      TThread::Lock();
+      TChain* chain = (TChain*)gROOT->GetListOfSpecials()->FindObject(treename);
+      if(chain && chain->InheritsFrom(TChain::Class())) {
+        if(chain->GetListOfAliases()) {
+          for(Int_t i=0; i< chain->GetListOfAliases()->GetEntries(); ++i) {
+            TObject* alias = chain->GetListOfAliases()->At(i);
+            if(alias) t->SetAlias(alias->GetName(), alias->GetTitle());
+          }
+        }
+      }
+      TThread::UnLock();
+	}
+
+	Bool_t haveRunnum = kFALSE;
+	Int_t runnum = 0;
+	midas::Database* db = static_cast<midas::Database*>(datafile->Get("odbstop"));
+	if(db) haveRunnum = db->ReadValue("/Runinfo/Run number", runnum);
+	if(!db || !haveRunnum) {
+      dutils::Error("BeamNorm::CalculateRecoils", __FILE__, __LINE__)
+        << "could not read run number from TFile at " << datafile;
+      return 0;
+	}
+
+	*nrecoil = UDouble_t(t->GetPlayer()->GetEntries(gate));
+	return runnum;
+  }
+} // namespace
+
+////////////////////////////////////////////////////////////////////////////////
+/// Calculate the number of recoils per run
+void dragon::BeamNorm::CalculateRecoils(TFile* datafile, const char* treename, const char* gate)
+{
+  UDouble_t nrecoil;
+  Int_t runnum = count_recoils(datafile, treename, gate, &nrecoil);
+  if(runnum) SetRecoils(runnum, treename, nrecoil);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Store the number of recoils of a run and calculate the yield
+void dragon::BeamNorm::SetRecoils(Int_t runnum, const char* treename, const UDouble_t& nrecoil)
+{
+  RunData* rundata = GetOrCreateRunData(runnum);
   try {
     const UDouble_t& livetime = get_livetime(treename, rundata);
     rundata->nrecoil = nrecoil;
@@ -1352,33 +2287,234 @@ Long64_t dragon::BeamNorm::Draw(const char* varexp, const char* selection, Optio
   return fRunDataTree.Draw(varexp, selection, option, nentries, firstentry);
 }
 
+///////////////////////////////// Helper class /////////////////////////////////
+namespace {
+  // Per-file results of BeamNorm::BatchCalculate()
+  struct BatchResult_t {
+	Long_t fMtime;      // modification time of the file, -1 if unknown
+	UInt_t fKey;        // hash of the calculation parameters
+	Bool_t fCached;     // true if taken from the cache
+	UDouble_t fNrecoil; // number of recoils
+	dragon::BeamNorm::RunData fData; // values set by read_sb_counts(), runnum 0 for failure
+  };
+
+  typedef std::map<Int_t, BatchResult_t> BatchCache_t;
+
+  struct BatchArgs_t {
+	const std::vector<std::string>* fFiles; // files in the chain
+	Int_t* fNext;               // next file to process (shared)
+	const BatchCache_t* fCache; // results of earlier calls, by run number
+	std::vector<BatchResult_t>* fResults; // results of each file
+	Double_t fPeak[2*NSB];      // SB peak limits: low0, high0, low1, high1
+	Double_t fTime;             // SB normalization time
+	const char* fTree;          // recoil tree name
+	const char* fGate;          // recoil gate, 0 for none
+  };
+
+  void write_udouble(std::ostream& strm, const UDouble_t& u)
+  {
+	strm << " " << u.GetNominal() << " " << u.GetErrLow() << " " << u.GetErrHigh()
+         << " " << u.GetSysErrLow() << " " << u.GetSysErrHigh();
+  }
+
+  bool read_udouble(std::istream& strm, UDouble_t* u)
+  {
+	Double_t v[5];
+	for(int i=0; i< 5; ++i) {
+      if(!(strm >> v[i])) return false;
+	}
+	*u = UDouble_t(v[0], v[1], v[2], v[3], v[4]);
+	return true;
+  }
+
+  // Cache file format: one line per run,
+  //  runnum mtime key time sb_counts[NSB] sb_counts_full[NSB] pressure pressure_full
+  //  live_time live_time_head live_time_tail live_time_coinc nrecoil
+  // with each UDouble_t written as nominal, errors and systematic errors.
+  void read_batch_cache(const std::string& path, BatchCache_t* cache)
+  {
+	std::ifstream file(path.c_str());
+	std::string line;
+	while(std::getline(file, line)) {
+      std::istringstream strm(line);
+      BatchResult_t r;
+      dragon::BeamNorm::RunData& d = r.fData;
+      bool ok = (strm >> d.runnum >> r.fMtime >> r.fKey >> d.time);
+      for(int i=0; ok && i< NSB; ++i) ok = read_udouble(strm, d.sb_counts + i);
+      for(int i=0; ok && i< NSB; ++i) ok = read_udouble(strm, d.sb_counts_full + i);
+      ok = ok && read_udouble(strm, &d.pressure) && read_udouble(strm, &d.pressure_full);
+      ok = ok && read_udouble(strm, &d.live_time) && read_udouble(strm, &d.live_time_head);
+      ok = ok && read_udouble(strm, &d.live_time_tail) && read_udouble(strm, &d.live_time_coinc);
+      ok = ok && read_udouble(strm, &r.fNrecoil);
+      if(ok && d.runnum) {
+        r.fCached = kTRUE;
+        (*cache)[d.runnum] = r;
+      }
+	}
+  }
+
+  void write_batch_cache(const std::string& path, const BatchCache_t& cache)
+  {
+	std::ofstream file(path.c_str());
+	if(!file.good()) {
+      dutils::Warning("BeamNorm::BatchCalculate", __FILE__, __LINE__)
+        << "could not write cache file \"" << path << "\"";
+      return;
+	}
+	file.precision(17);
+	for(BatchCache_t::const_iterator it = cache.begin(); it != cache.end(); ++it) {
+      const BatchResult_t& r = it->second;
+      const dragon::BeamNorm::RunData& d = r.fData;
+      file << d.runnum << " " << r.fMtime << " " << r.fKey << " " << d.time;
+      for(int i=0; i< NSB; ++i) write_udouble(file, d.sb_counts[i]);
+      for(int i=0; i< NSB; ++i) write_udouble(file, d.sb_counts_full[i]);
+      write_udouble(file, d.pressure);
+      write_udouble(file, d.pressure_full);
+      write_udouble(file, d.live_time);
+      write_udouble(file, d.live_time_head);
+      write_udouble(file, d.live_time_tail);
+      write_udouble(file, d.live_time_coinc);
+      write_udouble(file, r.fNrecoil);
+      file << "\n";
+	}
+  }
+
+  void * run_batch_thread(void* input)
+  {
+	// NOTE: input must point to a valid BatchArgs_t struct
+	BatchArgs_t* args = (BatchArgs_t*)input;
+	while (1) {
+      Int_t i;
+      {
+        TThread::Lock();
+        i = (*args->fNext)++;
+        TThread::UnLock();
+      }
+      if(i >= (Int_t)args->fFiles->size()) break;
+
+      BatchResult_t& result = args->fResults->at(i);
+      TFile* f = TFile::Open(args->fFiles->at(i).c_str());
+      Int_t runnum = read_runnum(f);
+      if(runnum) {
+        BatchCache_t::const_iterator cached = args->fCache->find(runnum);
+        if(result.fMtime >= 0 && cached != args->fCache->end() &&
+           cached->second.fMtime == result.fMtime && cached->second.fKey == result.fKey) {
+          result = cached->second;
+        }
+        else {
+          const Double_t* pk = args->fPeak;
+          runnum = read_sb_counts(f, pk[0], pk[1], pk[2], pk[3], args->fTime, &result.fData);
+          if(runnum && args->fGate &&
+             count_recoils(f, args->fTree, args->fGate, &result.fNrecoil) == 0)
+            result.fData.runnum = 0;
+        }
+      }
+      if(f) f->Close();
+      Zap(f);
+	}
+	return 0;
+  }
+} // namespace
+
 ////////////////////////////////////////////////////////////////////////////////
 /// Batch calculate over a chain of files
+///
+/// Reading the SB counts, live times and number of recoils of each file is
+/// independent of the other runs, so the files are processed in parallel by
+/// GetNumThreads() threads. The rest of the calculation (reading FC4 currents
+/// from the rossum file and normalizing) is done afterwards, in chain order.
+/// Without a rossum file, only the per-file results are stored in the run data,
+/// and the FC4 reading and normalization are skipped.
+///
+/// If a cache file has been set (see SetCacheFile()), the per-file results are
+/// stored in it, keyed on run number; runs whose file modification time and
+/// calculation parameters are unchanged since the last call are taken from the
+/// cache instead of being read again.
 void dragon::BeamNorm::BatchCalculate(TChain* chain, Int_t chargeBeam,
                                       Double_t pkLow0, Double_t pkHigh0,
 									  Double_t pkLow1, Double_t pkHigh1,
 									  const char* recoilGate,
 									  Double_t time, Double_t skipBegin, Double_t skipEnd)
 {
-  TObjArray* flist = chain->GetListOfFiles();
-  for(Int_t i=0; i< flist->GetEntries(); ++i) {
+  const Bool_t haveRossum = HaveRossumFile();
+  if(!haveRossum) {
+    dutils::Error("BeamNorm::BatchCalculate", __FILE__, __LINE__)
+      << "no rossum file loaded, skipping FC4 reading and normalization.";
+  }
+
+  TString key = Form("%.17g %.17g %.17g %.17g %.17g %s %s", pkLow0, pkHigh0, pkLow1, pkHigh1,
+                     time, chain->GetName(), recoilGate ? recoilGate : "");
+  std::vector<std::string> files;
+  std::vector<BatchResult_t> results;
+  for(Int_t i=0; i< chain->GetListOfFiles()->GetEntries(); ++i) {
+    files.push_back(chain->GetListOfFiles()->At(i)->GetTitle());
+    FileStat_t stat;
+    BatchResult_t result;
+    result.fMtime = gSystem->GetPathInfo(files.back().c_str(), stat) == 0 ? stat.fMtime : -1;
+    result.fKey = key.Hash();
+    result.fCached = kFALSE;
+    result.fData.runnum = 0;
+    results.push_back(result);
+  }
+
+  BatchCache_t cache;
+  if(!fCacheFile.empty()) read_batch_cache(fCacheFile, &cache);
+
+  Int_t nthreads = fNumThreads;
+  if(nthreads <= 0) {
+    SysInfo_t info;
+    nthreads = gSystem->GetSysInfo(&info) == 0 && info.fCpus > 0 ? info.fCpus : 1;
+  }
+  nthreads = std::max(1, std::min<Int_t>(nthreads, files.size()));
+
+  Int_t next = 0;
+  BatchArgs_t args = { &files, &next, &cache, &results,
+                       { pkLow0, pkHigh0, pkLow1, pkHigh1 }, time,
+                       chain->GetName(), recoilGate };
+  if(nthreads == 1) {
+    run_batch_thread(&args);
+  }
+  else {
+    std::vector<TThread*> threads;
+    for(Int_t i=0; i< nthreads; ++i) {
+      threads.push_back(new TThread(run_batch_thread, &args));
+      threads.back()->Run();
+    }
+    for(size_t i=0; i< threads.size(); ++i) {
+      threads[i]->Join();
+      delete threads[i];
+    }
+  }
+
+  Int_t ncached = 0;
+  for(size_t i=0; i< results.size(); ++i) {
     if(!i)
       std::cout << "Calculating normalization for runs ";
 
-    std::auto_ptr<TFile> file (TFile::Open(flist->At(i)->GetTitle()));
-    Int_t runnum = ReadSbCounts(file.get(), pkLow0, pkHigh0, pkLow1, pkHigh1, time);
+    const BatchResult_t& result = results[i];
+    Int_t runnum = result.fData.runnum;
     if(!runnum) continue;
 
     std::cout << runnum << "... ";
     std::flush(std::cout);
 
-    ReadFC4(runnum, skipBegin, skipEnd);
-    CalculateNorm(runnum, chargeBeam);
+    copy_sb_counts(result.fData, GetOrCreateRunData(runnum));
+    if(haveRossum) {
+      ReadFC4(runnum, skipBegin, skipEnd);
+      CalculateNorm(runnum, chargeBeam);
+    }
     if(recoilGate) {
-      CalculateRecoils(file.get(), chain->GetName(), recoilGate);
+      SetRecoils(runnum, chain->GetName(), result.fNrecoil);
     }
+    if(result.fCached) ++ncached;
+    else if(result.fMtime >= 0) cache[runnum] = result;
   }
   std::cout << "\n";
+  if(ncached)
+    std::cout << "(" << ncached << " runs from cache \"" << fCacheFile << "\")\n";
+
+  if(!fCacheFile.empty() && ncached < (Int_t)results.size())
+    write_batch_cache(fCacheFile, cache);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -1483,7 +2619,7 @@ UDouble_t dragon::BeamNorm::CalculateYield(Int_t whichSb, Int_t type, Bool_t pri
 ////////////////////////////////////////////////////////////////////////////////
 /// Default Ctor
 dragon::LiveTimeCalculator::LiveTimeCalculator():
-  fFile(0)
+  fFile(0), fAlgorithm(kStreaming)
 {
   Reset();
 }
@@ -1493,7 +2629,7 @@ dragon::LiveTimeCalculator::LiveTimeCalculator():
 /// \param calculate If set to true, performs a full-run live time calculation
 ///  on initialization
 dragon::LiveTimeCalculator::LiveTimeCalculator(TFile* file, Bool_t calculate):
-  fFile(file)
+  fFile(file), fAlgorithm(kStreaming)
 {
   Reset();
   if(calculate) Calculate();
@@ -1661,13 +2797,18 @@ Double_t dragon::LiveTimeCalculator::CalculateRuntime(midas::Database* db,
 // fix for an early frontend bug where the tsc4 36-bit rollover counter
 // started from 1 instead of 0
 namespace {
-  inline Double_t correct_rollover_fe_bug(TBranch* trigBranch, Double_t& trig_time)
+  // Correction for the trigger time of the first event being "trig_time"
+  inline Double_t rollover_fe_bug(Double_t trig_time)
   {
-	Double_t rollCorrect = 0;
 	const ULong_t roll36 = (ULong64_t)1<<36;
+	return trig_time >= roll36/20. ? roll36/20. : 0; // microseconds
+  }
+
+  inline Double_t correct_rollover_fe_bug(TBranch* trigBranch, Double_t& trig_time)
+  {
 	trigBranch->GetEntry(0);
-	if(trig_time >= roll36/20.) { // the bug was present
-      rollCorrect = roll36/20.; // microseconds
+	const Double_t rollCorrect = rollover_fe_bug(trig_time);
+	if(rollCorrect != 0) { // the bug was present
       // This should only be present in files analyzed on jabberwock, and part of the
       // DAQ test, so warn otherwise
       TString hostname = "$HOSTNAME1";
@@ -1707,6 +2848,20 @@ void dragon::LiveTimeCalculator::DoCalculate(Double_t tbegin, Double_t tend)
     return;
   }
 
+  // Whole run: use the summary written by mid2root, if the file has one
+  if (isFull) {
+    std::auto_ptr<RunSummary> summary (RunSummary::Read(fFile));
+    if (summary.get()) {
+      const char* which[3] = { "head", "tail", "coinc" };
+      for(int i=0; i< 3; ++i) {
+        fBusytime[i] = summary->GetBusytime(which[i]);
+        fRuntime[i]  = summary->GetRuntime(which[i]);
+        fLivetime[i] = summary->GetLivetime(which[i]);
+      }
+      return;
+    }
+  }
+
   // Initialize midas database, TTrees, etc
   midas::Database* db = 0;
   TTree* trees[2] = { 0, 0 };
@@ -1715,9 +2870,6 @@ void dragon::LiveTimeCalculator::DoCalculate(Double_t tbegin, Double_t tend)
       << "Invalid file or trees";
     return;
   }
-  size_t nentries = trees[0]->GetEntries() + trees[1]->GetEntries();
-  CoincBusytime coincBusy(nentries);
-
   // Ensure to reset branch addresses when done
   AutoResetBranchAddresses Rst_(trees, 2);
 
@@ -1727,47 +2879,188 @@ void dragon::LiveTimeCalculator::DoCalculate(Double_t tbegin, Double_t tend)
   CalculateRuntime(db, "tail",  trigStart[1], trigStop[1]);
   CalculateRuntime(db, "coinc", trigStart[2], trigStop[2]);
 
-  // Loop over trees
-  for(int i=0; i< 2; ++i) {
-    // Set MakeClass to 1 (resets at end of loop or return)
-    SetMakeClass_t dummy(trees[i], 1);
-
-    // Find branches
-    UInt_t busy_time;
-    Double_t trig_time;
-    TBranch* trigBranch = get_branch(trees[i], trig_time, "io32.tsc4.trig_time",
-                                     "LiveTimeCalculator::DoCalculate");
-    TBranch* busyBranch = get_branch(trees[i], busy_time, "io32.busy_time",
-                                     "LiveTimeCalculator::DoCalculate");
-    if(!trigBranch || !busyBranch) return;
-    // Correct TSC4 rollover for early runs taken with a frontend bug
-    Double_t rollCorrect = correct_rollover_fe_bug(trigBranch, trig_time);
-    Long64_t busyTotal = 0;
-    Long64_t nentries = trees[i]->GetEntries();
-    for(Long64_t entry = 0; entry< nentries; ++entry) {
-      // read entries
-      trigBranch->GetEntry(entry);
-      busyBranch->GetEntry(entry);
-      const Double_t trigtime = trig_time - rollCorrect - trigStart[i];
-      // check cut condition
-      if (!isFull && !(trigtime > tbegin*1e6 && trigtime < tend*1e6))
-        continue;
-      // accuulate busy time
-      busyTotal += busy_time;
-      coincBusy.AddEvent(trigtime, busy_time/20.);
+  // Sum busy times
+  Double_t busy[3];
+  Int_t result = 0;
+  if(fAlgorithm == kStreaming) {
+    result = MergeBusytime(trees, trigStart, isFull, tbegin, tend, busy);
+    if(result == 0) {
+      dutils::Warning("LiveTimeCalculator::DoCalculate", __FILE__, __LINE__)
+        << "Trigger times in \"" << fFile->GetName() << "\" are not ordered, "
+        << "sorting them instead (LiveTimeCalculator::kSort).";
     }
-    // calculate variables
-    fBusytime[i] = busyTotal / 20e6;
+  }
+  if(result == 0)
+    result = SortBusytime(trees, trigStart, isFull, tbegin, tend, busy);
+  if(result < 0) return;
+
+  // calculate variables
+  for(int i=0; i< 3; ++i) {
+    fBusytime[i] = busy[i];
     fRuntime[i]  = isFull ? trigStop[i] - trigStart[i] : tend - tbegin;
     fLivetime[i] = (fRuntime[i] - fBusytime[i]) / fRuntime[i];
   }
-  fRuntime[2]  = isFull ? trigStop[2] - trigStart[2] : tend - tbegin;
-  fBusytime[2] = coincBusy.Calculate();
-  fLivetime[2] = (fRuntime[2] - fBusytime[2]) / fRuntime[2];
+}
+
+///////////////////////////////// Helper class /////////////////////////////////
+namespace {
+  struct AccumulateBusy {
+	struct Output_t {
+      Double_t fEnd;
+      Double_t fTotalBusy;
+	};
+	Output_t operator() (const Output_t& current,
+                         const dragon::CoincBusytime::Event& additional);
+  };
+
+  inline AccumulateBusy::Output_t AccumulateBusy::operator()
+	(const Output_t& current, const dragon::CoincBusytime::Event& additional)
+  {
+	Output_t out = current;
+	if( current.fEnd < additional.fTrigger ) { // no overlap
+      out.fTotalBusy += additional.fBusy;
+      out.fEnd = additional.End();
+	}
+	else if( current.fEnd < additional.End() ) { // incomplete overlap
+      out.fTotalBusy += (additional.End() - current.fEnd);
+      out.fEnd = additional.End();
+	}
+	else { // complete overlap
+      ;
+	}
+	return out;
+  }
+} // namespace
+
+///////////////////////////////// Helper class /////////////////////////////////
+namespace {
+  // Reads the trigger and busy times of the events in t1 or t3, in entry order,
+  // skipping events outside of an optional time window
+  class BusyReader {
+  public:
+	Double_t fTrigger;   // trigger time relative to the trigger start, microseconds
+	Double_t fBusy;      // busy time, microseconds
+	Long64_t fBusyTotal; // sum of busy times, IO32 clock cycles
+	Bool_t fOrdered;     // have all trigger times been increasing?
+
+	// Set branch addresses, tree must be in MakeClass mode
+	Bool_t Init(TTree* tree, Double_t trigStart, Bool_t isFull, Double_t tbegin, Double_t tend)
+    {
+      fTrigBranch = get_branch(tree, fTrigTime, "io32.tsc4.trig_time", "LiveTimeCalculator::DoCalculate");
+      fBusyBranch = get_branch(tree, fBusyTime, "io32.busy_time", "LiveTimeCalculator::DoCalculate");
+      if(!fTrigBranch || !fBusyBranch) return kFALSE;
+      tree->AddBranchToCache(fTrigBranch, kTRUE);
+      tree->AddBranchToCache(fBusyBranch, kTRUE);
+      // Correct TSC4 rollover for early runs taken with a frontend bug
+      fOffset = correct_rollover_fe_bug(fTrigBranch, fTrigTime) + trigStart;
+      fIsFull = isFull;
+      fBegin = tbegin*1e6;
+      fEnd = tend*1e6;
+      fEntry = 0;
+      fEntries = tree->GetEntries();
+      fTrigger = -1e300;
+      fBusy = 0;
+      fBusyTotal = 0;
+      fOrdered = kTRUE;
+      return kTRUE;
+    }
+	// Read the next event, returns false at the end of the tree
+	Bool_t Next()
+    {
+      while(fEntry < fEntries) {
+        fTrigBranch->GetEntry(fEntry);
+        fBusyBranch->GetEntry(fEntry);
+        ++fEntry;
+        const Double_t trigtime = fTrigTime - fOffset;
+        // check cut condition
+        if (!fIsFull && !(trigtime > fBegin && trigtime < fEnd))
+          continue;
+        if(trigtime < fTrigger) fOrdered = kFALSE;
+        fTrigger = trigtime;
+        fBusy = fBusyTime/20.;
+        fBusyTotal += fBusyTime;
+        return kTRUE;
+      }
+      return kFALSE;
+    }
+  private:
+	TBranch* fTrigBranch;
+	TBranch* fBusyBranch;
+	Double_t fTrigTime;
+	UInt_t fBusyTime;
+	Double_t fOffset;
+	Bool_t fIsFull;
+	Double_t fBegin, fEnd;
+	Long64_t fEntry, fEntries;
+  };
+
+  // Read cache size for the live time calculation
+  const Long64_t kBusyCacheSize = 10*1024*1024;
+} // namespace
+
+////////////////////////////////////////////////////////////////////////////////
+/// Since the head and tail trees are each in trigger time order, reading them
+/// in parallel and always taking the earlier of the two next events gives all
+/// events in trigger time order, and the coincidence busy time can be
+/// accumulated on the go (see CoincBusytime::Calculate()) without storing any
+/// events. The two branches needed are read through a TTreeCache, so the reads
+/// are done in whole clusters.
+///
+/// \param [out] busy head, tail and coincidence busy times in seconds
+/// \returns 1 for success, 0 if either tree is not in trigger time order, -1 for
+///  an error (missing branches)
+Int_t dragon::LiveTimeCalculator::MergeBusytime(TTree** trees, const Double_t* trigStart, Bool_t isFull,
+                                                Double_t tbegin, Double_t tend, Double_t* busy)
+{
+  SetMakeClass_t make0(trees[0], 1), make1(trees[1], 1);
+  SetCacheSize_t cache0(trees[0], kBusyCacheSize), cache1(trees[1], kBusyCacheSize);
+  BusyReader in[2];
+  for(int i=0; i< 2; ++i) {
+    if(!in[i].Init(trees[i], trigStart[i], isFull, tbegin, tend)) return -1;
+  }
+
+  AccumulateBusy accumulate;
+  AccumulateBusy::Output_t accum = { 0., 0. };
+  Bool_t have[2] = { in[0].Next(), in[1].Next() };
+  while(have[0] || have[1]) {
+    const int i = (have[0] && (!have[1] || in[0].fTrigger <= in[1].fTrigger)) ? 0 : 1;
+    accum = accumulate(accum, CoincBusytime::Event(in[i].fTrigger, in[i].fBusy));
+    have[i] = in[i].Next();
+  }
+  if(!in[0].fOrdered || !in[1].fOrdered) return 0;
+
+  busy[0] = in[0].fBusyTotal / 20e6;
+  busy[1] = in[1].fBusyTotal / 20e6;
+  busy[2] = accum.fTotalBusy / 1e6;
+  return 1;
 }
 
 ////////////////////////////////////////////////////////////////////////////////
-/// Results can be viewed with GetLivetime(), GetBusytime(), etc.
+/// \param [out] busy head, tail and coincidence busy times in seconds
+/// \returns 1 for success, -1 for an error (missing branches)
+Int_t dragon::LiveTimeCalculator::SortBusytime(TTree** trees, const Double_t* trigStart, Bool_t isFull,
+                                               Double_t tbegin, Double_t tend, Double_t* busy)
+{
+  size_t nentries = trees[0]->GetEntries() + trees[1]->GetEntries();
+  CoincBusytime coincBusy(nentries);
+
+  for(int i=0; i< 2; ++i) {
+    // Set MakeClass to 1 (resets at end of loop or return)
+    SetMakeClass_t dummy(trees[i], 1);
+    SetCacheSize_t cache(trees[i], kBusyCacheSize);
+    BusyReader in;
+    if(!in.Init(trees[i], trigStart[i], isFull, tbegin, tend)) return -1;
+    while(in.Next()) coincBusy.AddEvent(in.fTrigger, in.fBusy);
+    busy[i] = in.fBusyTotal / 20e6;
+  }
+  busy[2] = coincBusy.Calculate();
+  return 1;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Uses the RunSummary of the file if there is a valid one, instead of
+/// reading the trees and the ODB. Results can be viewed with GetLivetime(),
+/// GetBusytime(), etc.
 void dragon::LiveTimeCalculator::Calculate()
 {
   DoCalculate(-1, -1);
@@ -1791,28 +3084,96 @@ void dragon::LiveTimeCalculator::CalculateSub(Double_t tbegin, Double_t tend)
   DoCalculate(tbegin, tend);
 }
 
+///////////////////////////////// Helper class /////////////////////////////////
+namespace {
+  struct ChainArgs_t {
+	const std::vector<std::string>* fFiles; // files in the chain
+	Int_t* fNext;            // next file to process (shared)
+	Int_t fAlgorithm;        // dragon::LiveTimeCalculator::Algorithm_t
+	Double_t (*fRun)[3];     // run times of each file
+	Double_t (*fBusy)[3];    // busy times of each file
+  };
+  void * run_chain_thread(void* input)
+  {
+	// NOTE: input must point to a valid ChainArgs_t struct
+	ChainArgs_t* args = (ChainArgs_t*)input;
+	while (1) {
+      Int_t i;
+      {
+        TThread::Lock();
+        i = (*args->fNext)++;
+        TThread::UnLock();
+      }
+      if(i >= (Int_t)args->fFiles->size()) break;
+
+      TFile* f = TFile::Open(args->fFiles->at(i).c_str());
+      if(!f || f->IsZombie()) { Zap(f); continue; }
+      dragon::LiveTimeCalculator calculator(f, kFALSE);
+      calculator.SetAlgorithm(dragon::LiveTimeCalculator::Algorithm_t(args->fAlgorithm));
+      calculator.Calculate();
+      const char* which[3] = { "head", "tail", "coinc" };
+      for(int j=0; j< 3; ++j) {
+        args->fRun[i][j]  = calculator.GetRuntime(which[j]);
+        args->fBusy[i][j] = calculator.GetBusytime(which[j]);
+      }
+      f->Close();
+      Zap(f);
+	}
+	return 0;
+  }
+} // namespace
+
 ////////////////////////////////////////////////////////////////////////////////
 /// Calculate overall times across a chain of runs.
 /// For this, the sum of running time and busy time across
 /// the chain are calculated and then used to figure out the
 /// live time fraction.
-void dragon::LiveTimeCalculator::CalculateChain(TChain* chain)
+///
+/// The runs are independent, so they are processed in parallel by
+/// _nthreads_ threads, each opening its own copy of the files.
+/// \param chain Chain of runs
+/// \param nthreads Number of threads; 0 to use one per CPU, 1 to
+///  process all runs in the calling thread
+void dragon::LiveTimeCalculator::CalculateChain(TChain* chain, Int_t nthreads)
 {
-  TFile* file0 = GetFile(); if(file0) { }
-  Double_t sumbusy[3] = {0,0,0}, sumrun[3] = {0,0,0};
+  std::vector<std::string> files;
+  for (Int_t i=0; i< chain->GetListOfFiles()->GetEntries(); ++i)
+    files.push_back(chain->GetListOfFiles()->At(i)->GetTitle());
+
+  if(nthreads <= 0) {
+    SysInfo_t info;
+    nthreads = gSystem->GetSysInfo(&info) == 0 && info.fCpus > 0 ? info.fCpus : 1;
+  }
+  nthreads = std::max(1, std::min<Int_t>(nthreads, files.size()));
+
+  // Results per file, zero for files that could not be opened
+  std::vector<Double_t> run(3*files.size(), 0.), busy(3*files.size(), 0.);
+  Int_t next = 0;
+  ChainArgs_t args = { &files, &next, fAlgorithm,
+                       (Double_t(*)[3])(files.empty() ? 0 : &run[0]),
+                       (Double_t(*)[3])(files.empty() ? 0 : &busy[0]) };
+  if(nthreads == 1) {
+    run_chain_thread(&args);
+  }
+  else {
+    std::vector<TThread*> threads;
+    for(Int_t i=0; i< nthreads; ++i) {
+      threads.push_back(new TThread(run_chain_thread, &args));
+      threads.back()->Run();
+    }
+    for(size_t i=0; i< threads.size(); ++i) {
+      threads[i]->Join();
+      delete threads[i];
+    }
+  }
 
-  for (Int_t i=0; i< chain->GetListOfFiles()->GetEntries(); ++i) {
-    TFile* f = TFile::Open ( chain->GetListOfFiles()->At(i)->GetTitle() );
-    if(f->IsZombie()) { f->Close(); continue; }
-    SetFile(f);
-    Calculate();
-    sumrun[0]  += GetRuntime("head");
-    sumrun[1]  += GetRuntime("tail");
-    sumrun[2]  += GetRuntime("coinc");
-    sumbusy[0] += GetBusytime("head");
-    sumbusy[1] += GetBusytime("tail");
-    sumbusy[2] += GetBusytime("coinc");
-    f->Close();
+  // Sum in chain order
+  Double_t sumbusy[3] = {0,0,0}, sumrun[3] = {0,0,0};
+  for(size_t i=0; i< files.size(); ++i) {
+    for(int j=0; j< 3; ++j) {
+      sumrun[j]  += run[3*i + j];
+      sumbusy[j] += busy[3*i + j];
+    }
   }
 
   for(int i=0; i< 3; ++i) {
@@ -1824,35 +3185,6 @@ void dragon::LiveTimeCalculator::CalculateChain(TChain* chain)
 
 ////////////////////////// Class dragon::CoincBusytime //////////////////////////
 
-///////////////////////////////// Helper class /////////////////////////////////
-namespace {
-  struct AccumulateBusy {
-	struct Output_t {
-      Double_t fEnd;
-      Double_t fTotalBusy;
-	};
-	Output_t operator() (const Output_t& current,
-                         const dragon::CoincBusytime::Event& additional);
-  };
-
-  inline AccumulateBusy::Output_t AccumulateBusy::operator()
-	(const Output_t& current, const dragon::CoincBusytime::Event& additional)
-  {
-	Output_t out = current;
-	if( current.fEnd < additional.fTrigger ) { // no overlap
-      out.fTotalBusy += additional.fBusy;
-      out.fEnd = additional.End();
-	}
-	else if( current.fEnd < additional.End() ) { // incomplete overlap
-      out.fTotalBusy += (additional.End() - current.fEnd);
-      out.fEnd = additional.End();
-	}
-	else { // complete overlap
-      ;
-	}
-	return out;
-  }
-} // namespace
 
 ////////////////////////////////////////////////////////////////////////////////
 /// \param reserve If nonzero, reserve memory space for this many events
@@ -1860,87 +3192,930 @@ namespace {
 dragon::CoincBusytime::CoincBusytime(size_t reserve):
   fIsSorted(false)
 {
-  if(reserve) fEvents.reserve(reserve);
+  if(reserve) fEvents.reserve(reserve);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// \param trigger Trigger time in microseconds
+/// \param busy Busy time in microseconds
+void dragon::CoincBusytime::AddEvent(Double_t trigger, Double_t busy)
+{
+  fIsSorted = false;
+  dragon::CoincBusytime::Event evt(trigger, busy);
+  try {
+    fEvents.push_back(evt);
+  } catch (std::bad_alloc& err) {
+    utils::Error("CoincBusytime::AddEvent", __FILE__, __LINE__)
+      << "Failed to allocate memory for event: trigger, busy = "
+      << trigger << ", " << busy;
+    throw err;
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void dragon::CoincBusytime::Sort()
+{
+  std::sort(fEvents.begin(), fEvents.end(), dragon::CoincBusytime::Event::TriggerCompare);
+  fIsSorted = true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Calculate total busy time for coincidence events
+///
+/// Calcluation of the busy time is performed as follows:
+/// First, sort the collection of events by the trigger time. Then sum up all of
+/// the busy times, but ignoring any overlap. To accomplish this, use the
+/// `std::accumulate` algorithm, with a custom "accumulator" function which
+/// ignores overlap by storing the last "end time" of an event and removing
+/// any overlap between the begin time of the present event and the previous
+/// end time. The code below shows how this is accomplished.
+/// \code
+/// struct AccumulateBusy {
+///		struct Output_t {
+///			Double_t fEnd;
+///			Double_t fTotalBusy;
+///		};
+///		Output_t operator() (const Output_t& current,
+///                          const dragon::CoincBusytime::Event& additional);
+/// };
+///
+/// inline AccumulateBusy::Output_t AccumulateBusy::operator()
+///   (const Output_t& current, const dragon::CoincBusytime::Event& additional)
+/// {
+///		Output_t out = current;
+///		if( current.fEnd < additional.fTrigger ) { // no overlap
+///			out.fTotalBusy += additional.fBusy;
+///			out.fEnd = additional.End();
+///		}
+///		else if( current.fEnd < additional.End() ) { // incomplete overlap
+///			out.fTotalBusy += (additional.End() - current.fEnd);
+///			out.fEnd = additional.End();
+///		}
+///		else { // complete overlap
+///			;
+///		}
+///		return out;
+/// }
+///
+/// Double_t dragon::CoincBusytime::Calculate()
+/// {
+///   if(!fIsSorted) Sort();
+///   AccumulateBusy::Output_t accum = { 0., 0. };
+///   accum = std::accumulate(fEvents.begin(), fEvents.end(), accum, AccumulateBusy());
+///   return accum.fTotalBusy / 1e6;
+/// }
+/// \endcode
+///
+/// \returns Total coincidence busy time in seconds.
+Double_t dragon::CoincBusytime::Calculate()
+{
+  if(!fIsSorted) Sort();
+  AccumulateBusy::Output_t accum = { 0., 0. };
+  accum = std::accumulate(fEvents.begin(), fEvents.end(), accum, AccumulateBusy());
+  return accum.fTotalBusy / 1e6;
+}
+
+//////////////////////////// Class dragon::RunSummary ///////////////////////////
+
+Bool_t dragon::RunSummary::fgEnabled = kTRUE;
+
+namespace {
+  // Longest run with busy times per second (about 11 days), so a corrupt
+  // trigger time can't make the summary huge
+  const Double_t kMaxSummarySeconds = 1e6;
+
+  // Count the triggers in each second, and find the entry of the first event in
+  // each second (left empty unless the trigger times are increasing)
+  void bin_triggers(const std::vector<Double_t>& trigger, Double_t offset,
+                    std::vector<Int_t>& counts, std::vector<Long64_t>& first)
+  {
+	counts.clear();
+	first.clear();
+	Bool_t ordered = kTRUE;
+	for(size_t j=0; j< trigger.size(); ++j) {
+      const Double_t trigtime = trigger[j] - offset;
+      if(j && trigtime < trigger[j-1] - offset) ordered = kFALSE;
+      if(trigtime < 0 || trigtime >= kMaxSummarySeconds*1e6) continue;
+      const size_t second = size_t(trigtime / 1e6);
+      if(second >= counts.size()) counts.resize(second + 1, 0);
+      ++counts[second];
+      while(ordered && first.size() <= second) first.push_back(j);
+	}
+	if(ordered) first.push_back(trigger.size());
+	else std::vector<Long64_t>().swap(first);
+  }
+
+  // Sum of a per-second series in whole seconds [tbegin, tend), -1 unless they are whole
+  template <class T>
+  Double_t sum_seconds(const std::vector<T>& perSecond, Double_t tbegin, Double_t tend)
+  {
+	if(tbegin < 0 || tend < tbegin || tbegin != floor(tbegin) || tend != floor(tend)) return -1;
+	const size_t end = std::min(perSecond.size(), size_t(tend));
+	Double_t sum = 0;
+	for(size_t i = size_t(tbegin); i< end; ++i) sum += perSecond[i];
+	return sum;
+  }
+
+  // Index of "head", "tail" or "aux" scalers, -1 if invalid
+  int get_scaler_indx(const char* which)
+  {
+	TString which1 = which;
+	which1.ToLower();
+	return which1 == "head" ? 0 : which1 == "tail" ? 1 : which1 == "aux" ? 2 : -1;
+  }
+
+  // Read cache size for summarizing a run from its trees
+  const Long64_t kSummaryCacheSize = 10*1024*1024;
+
+  // Add every entry of the tree of event code "code" in "file" to a summary,
+  // returns the number of entries
+  template <class T>
+  Long64_t fill_summary(TFile* file, Int_t code, dragon::RunSummary* summary)
+  {
+	TTree* tree = dynamic_cast<TTree*>(file->Get(Form("t%d", code)));
+	if(tree == 0 || tree->GetListOfBranches()->At(0) == 0) return 0;
+	std::auto_ptr<T> data(new T());
+	T* pdata = data.get();
+	tree->SetBranchAddress(tree->GetListOfBranches()->At(0)->GetName(), &pdata);
+	AutoResetBranchAddresses Rst_(tree);
+	SetCacheSize_t cache(tree, kSummaryCacheSize);
+	const Long64_t nentries = tree->GetEntries();
+	for(Long64_t i=0; i< nentries; ++i) {
+      tree->GetEntry(i);
+      summary->Fill(code, pdata);
+	}
+	return nentries;
+  }
+
+  // Summary file for a run file without a summary, next to it
+  TString summary_file(const TString& filename)
+  {
+	TString name = filename;
+	if(name.EndsWith(".root")) name.Remove(name.Length() - 5);
+	return name + "_summary.root";
+  }
+} // namespace
+
+////////////////////////////////////////////////////////////////////////////////
+/// Ctor
+dragon::RunSummary::RunSummary():
+  TNamed("summary", "Run summary."),
+  fComplete(kFALSE), fRunNumber(0), fRunStart(0), fRunStop(0), fTailStart(0), fHaveSeries(kFALSE)
+{
+  std::fill_n(fEntries, 3, 0);
+  std::fill_n(fTriggerStart, 3, 0.);
+  std::fill_n(fTriggerStop, 3, 0.);
+  std::fill_n(fBusytime, 3, 0.);
+  std::fill_n(&fScalerSum[0][0], 3*dragon::Scaler::MAX_CHANNELS, 0);
+  std::fill_n(fTimeOffset, 3, 0.);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// \param code Event code of the tree filled (e.g. DRAGON_HEAD_EVENT for \c t1)
+/// \param addr Address of the object bound to the tree: dragon::Head, dragon::Tail,
+///  dragon::Coinc, dragon::Scaler or dragon::Epics; other codes are ignored
+///
+/// Entries must be added in the order they are filled, the busy time
+/// calculation depends on it as for the trees.
+void dragon::RunSummary::Fill(Int_t code, const void* addr)
+{
+  switch(code) {
+  case DRAGON_HEAD_EVENT:
+    {
+      const dragon::Head* head = static_cast<const dragon::Head*>(addr);
+      fTrigger[0].push_back(head->io32.tsc4.trig_time);
+      fBusy[0].push_back(head->io32.busy_time);
+      ++fEntries[0];
+      break;
+    }
+  case DRAGON_TAIL_EVENT:
+    {
+      const dragon::Tail* tail = static_cast<const dragon::Tail*>(addr);
+      fTrigger[1].push_back(tail->io32.tsc4.trig_time);
+      fBusy[1].push_back(tail->io32.busy_time);
+      if(fEntries[1]++ == 0) fTailStart = tail->header.fTimeStamp;
+      for(int i=0; i< dragon::SurfaceBarrier::MAX_CHANNELS; ++i) {
+        if(!dutils::is_valid(tail->sb.ecal[i])) continue;
+        fSbDetector.push_back(i);
+        fSbEnergy.push_back(tail->sb.ecal[i]);
+        fSbTime.push_back(Long64_t(tail->header.fTimeStamp) - Long64_t(fTailStart));
+        fSbTrigger.push_back(tail->io32.tsc4.trig_time);
+      }
+      break;
+    }
+  case DRAGON_COINC_EVENT:
+    fCoincTrigger.push_back(static_cast<const dragon::Coinc*>(addr)->head.io32.tsc4.trig_time);
+    ++fEntries[2];
+    break;
+  case DRAGON_HEAD_SCALER:
+  case DRAGON_TAIL_SCALER:
+  case DRAGON_AUX_SCALER:
+    {
+      const int indx = code == DRAGON_HEAD_SCALER ? 0 : code == DRAGON_TAIL_SCALER ? 1 : 2;
+      const dragon::Scaler* scaler = static_cast<const dragon::Scaler*>(addr);
+      std::copy(scaler->sum, scaler->sum + dragon::Scaler::MAX_CHANNELS, fScalerSum[indx]);
+      std::vector<UInt_t>& counts = indx == 0 ? fHeadScalers : indx == 1 ? fTailScalers : fAuxScalers;
+      counts.insert(counts.end(), scaler->count, scaler->count + dragon::Scaler::MAX_CHANNELS);
+      break;
+    }
+  case DRAGON_EPICS_EVENT:
+    {
+      const dragon::Epics* epics = static_cast<const dragon::Epics*>(addr);
+      fEpicsTime.push_back(epics->header.fTimeStamp);
+      fEpicsChannel.push_back(epics->ch);
+      fEpicsValue.push_back(epics->val);
+      break;
+    }
+  default:
+    break;
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Calculates the run and busy times as LiveTimeCalculator::Calculate() does
+/// from the trees, and frees the trigger and busy times of the single events.
+///
+/// \param odbstop ODB at the end of the run
+/// \param nhead, ntail, ncoinc Numbers of entries of \c t1, \c t3 and \c t5
+/// \returns true for success, false if the ODB is missing or the numbers of
+///  entries don't match those added
+Bool_t dragon::RunSummary::Finish(midas::Database* odbstop, Long64_t nhead, Long64_t ntail, Long64_t ncoinc)
+{
+  fComplete = kFALSE;
+  if(!odbstop || odbstop->IsZombie()) return kFALSE;
+  if(nhead != fEntries[0] || ntail != fEntries[1] || ncoinc != fEntries[2]) {
+    dutils::Error("RunSummary::Finish", __FILE__, __LINE__)
+      << "Entries added (" << fEntries[0] << ", " << fEntries[1] << ", " << fEntries[2]
+      << ") don't match the trees (" << nhead << ", " << ntail << ", " << ncoinc << ")";
+    return kFALSE;
+  }
+
+  odbstop->ReadValue("/Runinfo/Run number", fRunNumber);
+  odbstop->ReadValue("/Runinfo/Start time binary", fRunStart);
+  odbstop->ReadValue("/Runinfo/Stop time binary", fRunStop);
+  const char* which[3] = { "head", "tail", "coinc" };
+  for(int i=0; i< 3; ++i)
+    LiveTimeCalculator::CalculateRuntime(odbstop, which[i], fTriggerStart[i], fTriggerStop[i]);
+
+  // Head and tail busy times, in total and per second; events merged in
+  // trigger time order for the coincidence busy time (see MergeBusytime())
+  std::vector<Double_t>* perSecond[2] = { &fHeadBusy, &fTailBusy };
+  Double_t offset[2];
+  Bool_t ordered = kTRUE;
+  for(int i=0; i< 2; ++i) {
+    offset[i] = (fTrigger[i].empty() ? 0 : rollover_fe_bug(fTrigger[i].front())) + fTriggerStart[i];
+    perSecond[i]->clear();
+    Long64_t busyTotal = 0;
+    for(size_t j=0; j< fTrigger[i].size(); ++j) {
+      const Double_t trigtime = fTrigger[i][j] - offset[i];
+      if(j && trigtime < fTrigger[i][j-1] - offset[i]) ordered = kFALSE;
+      busyTotal += fBusy[i][j];
+      if(trigtime < 0 || trigtime >= kMaxSummarySeconds*1e6) continue;
+      const size_t second = size_t(trigtime / 1e6);
+      if(second >= perSecond[i]->size()) perSecond[i]->resize(second + 1, 0.);
+      (*perSecond[i])[second] += fBusy[i][j] / 20e6;
+    }
+    fBusytime[i] = busyTotal / 20e6;
+  }
+
+  // Time series: coincidences are timed by their head event
+  std::copy(offset, offset + 2, fTimeOffset);
+  fTimeOffset[2] = offset[0];
+  bin_triggers(fTrigger[0], fTimeOffset[0], fHeadTriggers, fHeadFirst);
+  bin_triggers(fTrigger[1], fTimeOffset[1], fTailTriggers, fTailFirst);
+  bin_triggers(fCoincTrigger, fTimeOffset[2], fCoincTriggers, fCoincFirst);
+  for(size_t i=0; i< fSbTrigger.size(); ++i)
+    fSbTrigger[i] = (fSbTrigger[i] - fTimeOffset[1]) / 1e6;
+
+  if(ordered) {
+    AccumulateBusy accumulate;
+    AccumulateBusy::Output_t accum = { 0., 0. };
+    size_t next[2] = { 0, 0 };
+    while(next[0] < fTrigger[0].size() || next[1] < fTrigger[1].size()) {
+      const Bool_t have0 = next[0] < fTrigger[0].size(), have1 = next[1] < fTrigger[1].size();
+      const int i = (have0 && (!have1 || fTrigger[0][next[0]] - offset[0] <= fTrigger[1][next[1]] - offset[1])) ? 0 : 1;
+      accum = accumulate(accum, CoincBusytime::Event(fTrigger[i][next[i]] - offset[i], fBusy[i][next[i]] / 20.));
+      ++next[i];
+    }
+    fBusytime[2] = accum.fTotalBusy / 1e6;
+  }
+  else {
+    CoincBusytime coincBusy(fTrigger[0].size() + fTrigger[1].size());
+    for(int i=0; i< 2; ++i) {
+      for(size_t j=0; j< fTrigger[i].size(); ++j) coincBusy.AddEvent(fTrigger[i][j] - offset[i], fBusy[i][j] / 20.);
+    }
+    fBusytime[2] = coincBusy.Calculate();
+  }
+
+  for(int i=0; i< 2; ++i) {
+    std::vector<Double_t>().swap(fTrigger[i]);
+    std::vector<UInt_t>().swap(fBusy[i]);
+  }
+  std::vector<Double_t>().swap(fCoincTrigger);
+  fHaveSeries = kTRUE;
+  fComplete = kTRUE;
+  return kTRUE;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// \param file Run file written by `mid2root`
+/// \returns The summary of _file_, owned by the caller; 0 if there is none, if
+///  it is incomplete, or if the numbers of \c t1, \c t3 or \c t5 entries differ
+///  from those of the trees in the file (e.g. the trees were rewritten since).
+///  Also 0 if summaries are disabled with SetEnabled(kFALSE).
+dragon::RunSummary* dragon::RunSummary::Read(TFile* file)
+{
+  if(!fgEnabled || !file || file->IsZombie()) return 0;
+  RunSummary* summary = dynamic_cast<RunSummary*>(file->Get("summary"));
+  if(summary && !summary->Matches(file)) Zap(summary);
+  return summary;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Adds all entries of \c t1, \c t3, \c t5, the scaler and the EPICS trees to a
+/// new summary, as `mid2root` does while converting, for files converted
+/// without one (or before the time series was added). Reads every tree once.
+/// \param file Run file written by `mid2root`
+/// \returns The summary of _file_, owned by the caller; 0 if the file or its
+///  "odbstop" database is missing
+dragon::RunSummary* dragon::RunSummary::Build(TFile* file)
+{
+  if(!file || file->IsZombie()) return 0;
+  midas::Database* db = dynamic_cast<midas::Database*>(file->Get("odbstop"));
+  if(!db) {
+    dutils::Error("RunSummary::Build", __FILE__, __LINE__)
+      << "File " << file->GetName() << " is missing database \"odbstop\"";
+    return 0;
+  }
+
+  std::auto_ptr<RunSummary> summary(new RunSummary());
+  const Long64_t nhead  = fill_summary<dragon::Head> (file, DRAGON_HEAD_EVENT,  summary.get());
+  const Long64_t ntail  = fill_summary<dragon::Tail> (file, DRAGON_TAIL_EVENT,  summary.get());
+  const Long64_t ncoinc = fill_summary<dragon::Coinc>(file, DRAGON_COINC_EVENT, summary.get());
+  fill_summary<dragon::Scaler>(file, DRAGON_HEAD_SCALER, summary.get());
+  fill_summary<dragon::Scaler>(file, DRAGON_TAIL_SCALER, summary.get());
+  fill_summary<dragon::Scaler>(file, DRAGON_AUX_SCALER,  summary.get());
+  fill_summary<dragon::Epics> (file, DRAGON_EPICS_EVENT, summary.get());
+  if(!summary->Finish(db, nhead, ntail, ncoinc)) return 0;
+  return summary.release();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Looks for a summary with a time series (HasTimeSeries()) in turn:
+///   -# in the run file (written by `mid2root`);
+///   -# in the summary file next to it (`<run>_summary.root`), if not older than the run file;
+///   -# by Build(), writing it into the summary file for next time (if the directory is writable).
+///
+/// \param filename Run file written by `mid2root`
+/// \returns The summary, owned by the caller; 0 if the file can't be summarized
+dragon::RunSummary* dragon::RunSummary::Get(const char* filename)
+{
+  TString fname = filename;
+  gSystem->ExpandPathName(fname);
+  std::auto_ptr<TFile> file (TFile::Open(fname));
+  if(!file.get() || file->IsZombie()) {
+    dutils::Error("RunSummary::Get", __FILE__, __LINE__)
+      << "could not open file " << fname;
+    return 0;
+  }
+  std::auto_ptr<RunSummary> summary (Read(file.get()));
+  if(summary.get() && summary->HasTimeSeries()) return summary.release();
+
+  const TString sumfile = summary_file(fname);
+  FileStat_t stat0, stat1;
+  if(fgEnabled && gSystem->GetPathInfo(fname, stat0) == 0 &&
+     gSystem->GetPathInfo(sumfile, stat1) == 0 && stat1.fMtime >= stat0.fMtime) {
+    std::auto_ptr<TFile> in (TFile::Open(sumfile));
+    if(in.get() && !in->IsZombie()) {
+      summary.reset(dynamic_cast<RunSummary*>(in->Get("summary")));
+      if(summary.get() && summary->HasTimeSeries() && summary->Matches(file.get()))
+        return summary.release();
+    }
+  }
+
+  summary.reset(Build(file.get()));
+  if(!summary.get()) return 0;
+  TDirectory* current = gDirectory;
+  std::auto_ptr<TFile> out (TFile::Open(sumfile, "RECREATE"));
+  if(out.get() && !out->IsZombie()) summary->Write("summary");
+  if(current) current->cd();
+  return summary.release();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+Bool_t dragon::RunSummary::Matches(TFile* file) const
+{
+  Bool_t valid = fComplete;
+  const char* trees[3] = { "t1", "t3", "t5" };
+  for(int i=0; valid && i< 3; ++i) {
+    TTree* tree = dynamic_cast<TTree*>(file->Get(trees[i]));
+    valid = (tree ? tree->GetEntries() : 0) == fEntries[i];
+  }
+  return valid;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+Long64_t dragon::RunSummary::GetEntries(const char* which) const
+{
+  const int indx = get_which_indx(which);
+  return indx < 0 ? 0 : fEntries[indx];
+}
+
+////////////////////////////////////////////////////////////////////////////////
+Double_t dragon::RunSummary::GetTriggerStart(const char* which) const
+{
+  return get_from_array(fTriggerStart, which, "RunSummary::GetTriggerStart");
+}
+
+////////////////////////////////////////////////////////////////////////////////
+Double_t dragon::RunSummary::GetTriggerStop(const char* which) const
+{
+  return get_from_array(fTriggerStop, which, "RunSummary::GetTriggerStop");
+}
+
+////////////////////////////////////////////////////////////////////////////////
+Double_t dragon::RunSummary::GetRuntime(const char* which) const
+{
+  return GetTriggerStop(which) - GetTriggerStart(which);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+Double_t dragon::RunSummary::GetBusytime(const char* which) const
+{
+  return get_from_array(fBusytime, which, "RunSummary::GetBusytime");
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// \param which "head" or "tail"
+/// \param tbegin, tend Part of the run, in seconds after the trigger start
+/// \returns Busy time of the events between _tbegin_ and _tend_, as
+///  LiveTimeCalculator::CalculateSub(); -1 unless _tbegin_ and _tend_ are whole
+///  seconds, or for "coinc"
+Double_t dragon::RunSummary::GetBusytime(const char* which, Double_t tbegin, Double_t tend) const
+{
+  const int indx = get_which_indx(which);
+  if(indx != 0 && indx != 1) return -1;
+  return sum_seconds(indx == 0 ? fHeadBusy : fTailBusy, tbegin, tend);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+Double_t dragon::RunSummary::GetLivetime(const char* which) const
+{
+  const Double_t runtime = GetRuntime(which);
+  return (runtime - GetBusytime(which)) / runtime;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// \param detector Surface barrier detector, 0 or 1
+/// \param low, high Energy window, exclusive
+/// \param time Only count events less than _time_ seconds (timestamp) after the
+///  first tail event; negative for the whole run
+/// \returns Number of tail events with _low_ < `sb.ecal[detector]` < _high_, as
+///  BeamNorm::ReadSbCounts() counts the entries of \c t3; -1 if the window
+///  includes dragon::NoData<double>::value(), as only valid energies are kept
+Long64_t dragon::RunSummary::GetSbCounts(Int_t detector, Double_t low, Double_t high, Double_t time) const
+{
+  const Double_t nodata = dragon::NoData<double>::value();
+  if(low < nodata && high > nodata) return -1;
+  Long64_t counts = 0;
+  for(size_t i=0; i< fSbEnergy.size(); ++i) {
+    if(fSbDetector[i] != detector || !(fSbEnergy[i] > low && fSbEnergy[i] < high)) continue;
+    if(time >= 0 && !(fSbTime[i] < time)) continue;
+    ++counts;
+  }
+  return counts;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// \param which "head", "tail" or "aux"
+/// \param channel Scaler channel
+/// \returns The `sum` of _channel_ in the last scaler event of the run
+UInt_t dragon::RunSummary::GetScalerSum(const char* which, Int_t channel) const
+{
+  const int indx = get_scaler_indx(which);
+  if(indx < 0 || channel < 0 || channel >= dragon::Scaler::MAX_CHANNELS) {
+    dutils::Error("RunSummary::GetScalerSum", __FILE__, __LINE__)
+      << "Invalid scaler \"" << which << "\" or channel " << channel;
+    return 0;
+  }
+  return fScalerSum[indx][channel];
+}
+
+////////////////////////////////////////////////////////////////////////////////
+Int_t dragon::RunSummary::GetNumSeconds() const
+{
+  return std::max(fHeadTriggers.size(), fTailTriggers.size());
+}
+
+////////////////////////////////////////////////////////////////////////////////
+const std::vector<Int_t>* dragon::RunSummary::GetTriggerSeries(const char* which, const char* func) const
+{
+  switch(get_which_indx(which)) {
+  case 0: return &fHeadTriggers;
+  case 1: return &fTailTriggers;
+  case 2: return &fCoincTriggers;
+  default:
+    dutils::Error(func, __FILE__, __LINE__)
+      << "Invalid specification \"" << which << "\", please specify \"head\", \"tail\" or \"coinc\"";
+    return 0;
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// \param which "head", "tail" or "coinc" (timed by the head event)
+/// \param tbegin, tend Part of the run, in seconds of trigger time as GetBusytime()
+/// \returns Number of events with a trigger time in [_tbegin_, _tend_); -1 unless
+///  _tbegin_ and _tend_ are whole seconds, or without a time series
+Long64_t dragon::RunSummary::GetTriggers(const char* which, Double_t tbegin, Double_t tend) const
+{
+  const std::vector<Int_t>* perSecond = GetTriggerSeries(which, "RunSummary::GetTriggers");
+  if(!perSecond || !fHaveSeries) return -1;
+  return Long64_t(sum_seconds(*perSecond, tbegin, tend));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// \param which "head", "tail" or "coinc"
+/// \param second Second of trigger time; GetNumSeconds() or later gives the number of entries
+/// \returns Entry of \c t1, \c t3 or \c t5 of the first event in _second_ or later;
+///  -1 if the tree is not in trigger time order, or without a time series
+Long64_t dragon::RunSummary::GetFirstEntry(const char* which, Int_t second) const
+{
+  const int indx = get_which_indx(which);
+  const std::vector<Long64_t>& first = indx == 0 ? fHeadFirst : indx == 1 ? fTailFirst : fCoincFirst;
+  if(indx < 0 || first.empty()) return -1;
+  if(second < 0) second = 0;
+  return size_t(second) < first.size() ? first[second] : first.back();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// \param which "head", "tail" or "coinc" (the head offset: coincidences are timed by their head event)
+/// \returns The value subtracted from `io32.tsc4.trig_time` to give the trigger time
+///  used in the summary and by LiveTimeCalculator, in microseconds
+Double_t dragon::RunSummary::GetTimeOffset(const char* which) const
+{
+  return get_from_array(fTimeOffset, which, "RunSummary::GetTimeOffset");
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// \param detector Surface barrier detector, 0 or 1
+/// \param low, high Energy window, exclusive
+/// \param tbegin, tend Part of the run, in seconds of tail trigger time (any values)
+/// \returns Number of tail events with _low_ < `sb.ecal[detector]` < _high_ and a
+///  trigger time in [_tbegin_, _tend_); -1 for a window including
+///  dragon::NoData<double>::value(), or without a time series
+Long64_t dragon::RunSummary::GetSbCounts(Int_t detector, Double_t low, Double_t high,
+                                         Double_t tbegin, Double_t tend) const
+{
+  const Double_t nodata = dragon::NoData<double>::value();
+  if(!fHaveSeries || (low < nodata && high > nodata)) return -1;
+  Long64_t counts = 0;
+  for(size_t i=0; i< fSbEnergy.size(); ++i) {
+    if(fSbDetector[i] != detector || !(fSbEnergy[i] > low && fSbEnergy[i] < high)) continue;
+    if(fSbTrigger[i] >= tbegin && fSbTrigger[i] < tend) ++counts;
+  }
+  return counts;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Scaler read period _i_ (entry _i_ of the scaler tree) is taken to cover second
+/// [_i_, _i_ + 1) of the run, as in Scaler::plot(); periods partly in the window
+/// count in proportion.
+/// \param which "head", "tail" or "aux"
+/// \param channel Scaler channel
+/// \param tbegin, tend Part of the run, in seconds after its start (any values)
+/// \returns Sum of the `count` of _channel_ in the window; -1 for an invalid
+///  scaler or channel, or without a time series
+Double_t dragon::RunSummary::GetScalerSum(const char* which, Int_t channel, Double_t tbegin, Double_t tend) const
+{
+  const int indx = get_scaler_indx(which);
+  if(indx < 0 || channel < 0 || channel >= dragon::Scaler::MAX_CHANNELS) {
+    dutils::Error("RunSummary::GetScalerSum", __FILE__, __LINE__)
+      << "Invalid scaler \"" << which << "\" or channel " << channel;
+    return -1;
+  }
+  if(!fHaveSeries) return -1;
+
+  const std::vector<UInt_t>& counts = indx == 0 ? fHeadScalers : indx == 1 ? fTailScalers : fAuxScalers;
+  const size_t nperiods = counts.size() / dragon::Scaler::MAX_CHANNELS;
+  const Double_t begin = std::max(tbegin, 0.), end = std::min(tend, Double_t(nperiods));
+  Double_t sum = 0;
+  for(size_t i = size_t(begin); i< nperiods && i< end; ++i) {
+    const Double_t overlap = std::min(end, i + 1.) - std::max(begin, Double_t(i));
+    sum += overlap * counts[i*dragon::Scaler::MAX_CHANNELS + channel];
+  }
+  return sum;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// \param channel EPICS channel (`ch`)
+/// \param tbegin, tend Part of the run, in seconds after its start (computer clock)
+/// \param [out] times Appended with the time of each reading in [_tbegin_, _tend_), seconds after the run start
+/// \param [out] values Appended with the value of each reading
+/// \returns The number of readings appended; -1 without a time series
+Int_t dragon::RunSummary::GetEpicsReadings(Int_t channel, Double_t tbegin, Double_t tend,
+                                           std::vector<Double_t>& times, std::vector<Double_t>& values) const
+{
+  if(!fHaveSeries) return -1;
+  Int_t n = 0;
+  for(size_t i=0; i< fEpicsTime.size(); ++i) {
+    if(fEpicsChannel[i] != channel) continue;
+    const Double_t t = Double_t(fEpicsTime[i]) - fRunStart;
+    if(!(t >= tbegin && t < tend)) continue;
+    times.push_back(t);
+    values.push_back(fEpicsValue[i]);
+    ++n;
+  }
+  return n;
+}
+
+//////////////////////////// Class dragon::RunQuery ////////////////////////////
+
+namespace {
+  const char* const kWhich[3] = { "head", "tail", "coinc" };
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Gets the summary of each run with RunSummary::Get(); runs without a file or
+/// summary are left out (with an error).
+/// \param runnumbers Run numbers
+/// \param format printf() format of the run file names, from the run number
+dragon::RunQuery::RunQuery(const std::vector<Int_t>& runnumbers, const char* format)
+{
+  Init(runnumbers, format);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// \param first, last Range of run numbers, inclusive; run numbers without a file are skipped
+/// \param format printf() format of the run file names, from the run number
+dragon::RunQuery::RunQuery(Int_t first, Int_t last, const char* format)
+{
+  std::vector<Int_t> runnumbers;
+  for(Int_t run = first; run <= last; ++run) {
+    TString fname = Form(format, run);
+    gSystem->ExpandPathName(fname);
+    if(!gSystem->AccessPathName(fname, kReadPermission)) runnumbers.push_back(run);
+  }
+  Init(runnumbers, format);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+dragon::RunQuery::~RunQuery()
+{
+  for(size_t i=0; i< fRuns.size(); ++i) {
+    Zap(fRuns[i].fSummary);
+    Zap(fRuns[i].fFile);
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void dragon::RunQuery::Init(const std::vector<Int_t>& runnumbers, const char* format)
+{
+  fRuns.reserve(runnumbers.size());
+  for(size_t i=0; i< runnumbers.size(); ++i) {
+    Run_t run;
+    run.fFileName = Form(format, runnumbers[i]);
+    gSystem->ExpandPathName(run.fFileName);
+    run.fSummary = RunSummary::Get(run.fFileName);
+    run.fFile = 0;
+    if(run.fSummary) fRuns.push_back(run);
+    else {
+      dutils::Error("RunQuery::RunQuery", __FILE__, __LINE__)
+        << "No summary of run " << runnumbers[i] << " (" << run.fFileName << "), leaving it out";
+    }
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+Double_t dragon::RunQuery::GetStart() const
+{
+  Double_t start = 0;
+  for(size_t i=0; i< fRuns.size(); ++i) {
+    if(i == 0 || fRuns[i].fSummary->GetRunStart() < start) start = fRuns[i].fSummary->GetRunStart();
+  }
+  return start;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+Double_t dragon::RunQuery::GetStop() const
+{
+  Double_t stop = 0;
+  for(size_t i=0; i< fRuns.size(); ++i)
+    stop = std::max(stop, Double_t(fRuns[i].fSummary->GetRunStop()));
+  return stop;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Whole seconds come from the summary, the rest from the tree (CountEdge()).
+/// \param run Run to count
+/// \param indx 0 (head), 1 (tail) or 2 (coinc, without busy time)
+/// \param tbegin, tend Window in seconds of trigger time
+/// \param [out] triggers, busy Incremented by the triggers and busy time in the window
+/// \returns false if the tree could not be read
+Bool_t dragon::RunQuery::Count(Run_t& run, Int_t indx, Double_t tbegin, Double_t tend,
+                               Long64_t& triggers, Double_t& busy)
+{
+  const char* which = kWhich[indx];
+  const Double_t a = std::max(tbegin, 0.), b = std::min(tend, Double_t(run.fSummary->GetNumSeconds()));
+  if(!(b > a)) return kTRUE;
+
+  const Double_t ka = ceil(a), kb = floor(b);
+  if(kb > ka) {
+    triggers += run.fSummary->GetTriggers(which, ka, kb);
+    if(indx < 2) busy += run.fSummary->GetBusytime(which, ka, kb);
+  }
+  if(a < ka && !CountEdge(run, indx, Int_t(floor(a)), a, std::min(b, ka), triggers, busy))
+    return kFALSE;
+  if(b > kb && kb >= ka && !CountEdge(run, indx, Int_t(kb), kb, b, triggers, busy))
+    return kFALSE;
+  return kTRUE;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Reads the events of _second_ from the tree, which are found from
+/// RunSummary::GetFirstEntry() (the whole tree is read if it is not in time order).
+Bool_t dragon::RunQuery::CountEdge(Run_t& run, Int_t indx, Int_t second, Double_t tbegin, Double_t tend,
+                                   Long64_t& triggers, Double_t& busy)
+{
+  if(!run.fFile) {
+    run.fFile = TFile::Open(run.fFileName);
+    if(!run.fFile || run.fFile->IsZombie()) {
+      dutils::Error("RunQuery::CountEdge", __FILE__, __LINE__)
+        << "could not open file " << run.fFileName;
+      Zap(run.fFile);
+      return kFALSE;
+    }
+  }
+  const char* trees[3] = { "t1", "t3", "t5" };
+  TTree* tree = dynamic_cast<TTree*>(run.fFile->Get(trees[indx]));
+  if(!tree) {
+    dutils::Error("RunQuery::CountEdge", __FILE__, __LINE__)
+      << "No tree \"" << trees[indx] << "\" in " << run.fFileName;
+    return kFALSE;
+  }
+
+  const char* which = kWhich[indx];
+  Long64_t begin = run.fSummary->GetFirstEntry(which, second);
+  Long64_t end = run.fSummary->GetFirstEntry(which, second + 1);
+  if(begin < 0) {
+    begin = 0;
+    end = tree->GetEntries();
+  }
+
+  SetMakeClass_t make(tree, 1);
+  AutoResetBranchAddresses Rst_(tree);
+  Double_t trigTime = 0;
+  UInt_t busyTime = 0;
+  TBranch* trigBranch = get_branch(tree, trigTime, indx == 2 ? "head.io32.tsc4.trig_time" : "io32.tsc4.trig_time",
+                                   "RunQuery::CountEdge");
+  TBranch* busyBranch = indx == 2 ? 0 : get_branch(tree, busyTime, "io32.busy_time", "RunQuery::CountEdge");
+  if(!trigBranch || (indx < 2 && !busyBranch)) return kFALSE;
+
+  const Double_t offset = run.fSummary->GetTimeOffset(which);
+  for(Long64_t i = begin; i< end; ++i) {
+    trigBranch->GetEntry(i);
+    const Double_t t = (trigTime - offset) / 1e6;
+    if(!(t >= tbegin && t < tend)) continue;
+    ++triggers;
+    if(busyBranch) {
+      busyBranch->GetEntry(i);
+      busy += busyTime / 20e6;
+    }
+  }
+  return kTRUE;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// \param which "head", "tail" or "coinc" (timed by the head event)
+/// \param tbegin, tend Window, seconds since the epoch
+/// \returns The number of events in the window; -1 for invalid _which_ or if a tree could not be read
+Long64_t dragon::RunQuery::GetTriggers(const char* which, Double_t tbegin, Double_t tend)
+{
+  const int indx = get_which_indx(which);
+  if(indx < 0) {
+    dutils::Error("RunQuery::GetTriggers", __FILE__, __LINE__)
+      << "Invalid specification \"" << which << "\", please specify \"head\", \"tail\" or \"coinc\"";
+    return -1;
+  }
+  Long64_t triggers = 0;
+  Double_t busy = 0;
+  for(size_t i=0; i< fRuns.size(); ++i) {
+    const Double_t start = fRuns[i].fSummary->GetRunStart();
+    if(!Count(fRuns[i], indx, tbegin - start, tend - start, triggers, busy)) return -1;
+  }
+  return triggers;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// \param which "head" or "tail"
+/// \param tbegin, tend Window, seconds since the epoch
+/// \returns Busy time of the events in the window, as LiveTimeCalculator::CalculateSub()
+///  for each run; -1 for "coinc" or if a tree could not be read
+Double_t dragon::RunQuery::GetBusytime(const char* which, Double_t tbegin, Double_t tend)
+{
+  const int indx = get_which_indx(which);
+  if(indx != 0 && indx != 1) return -1;
+  Long64_t triggers = 0;
+  Double_t busy = 0;
+  for(size_t i=0; i< fRuns.size(); ++i) {
+    const Double_t start = fRuns[i].fSummary->GetRunStart();
+    if(!Count(fRuns[i], indx, tbegin - start, tend - start, triggers, busy)) return -1;
+  }
+  return busy;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// \param which "head", "tail" or "coinc"
+/// \param tbegin, tend Window, seconds since the epoch
+/// \returns The part of the window in which each run was taking triggers
+///  (RunSummary::GetRuntime(), from its start), in seconds
+Double_t dragon::RunQuery::GetRuntime(const char* which, Double_t tbegin, Double_t tend) const
+{
+  Double_t runtime = 0;
+  for(size_t i=0; i< fRuns.size(); ++i) {
+    const Double_t start = fRuns[i].fSummary->GetRunStart();
+    const Double_t stop = start + fRuns[i].fSummary->GetRuntime(which);
+    runtime += std::max(0., std::min(tend, stop) - std::max(tbegin, start));
+  }
+  return runtime;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// \param which "head" or "tail"
+/// \param tbegin, tend Window, seconds since the epoch
+/// \returns (GetRuntime() - GetBusytime()) / GetRuntime(); -1 if either is invalid
+///  or no run was taking triggers in the window
+Double_t dragon::RunQuery::GetLivetime(const char* which, Double_t tbegin, Double_t tend)
+{
+  const Double_t runtime = GetRuntime(which, tbegin, tend);
+  const Double_t busy = GetBusytime(which, tbegin, tend);
+  if(busy < 0 || !(runtime > 0)) return -1;
+  return (runtime - busy) / runtime;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// \param detector Surface barrier detector, 0 or 1
+/// \param low, high Energy window, exclusive
+/// \param tbegin, tend Window, seconds since the epoch
+/// \returns Sum of RunSummary::GetSbCounts() over the runs; -1 if that is invalid
+Long64_t dragon::RunQuery::GetSbCounts(Int_t detector, Double_t low, Double_t high,
+                                       Double_t tbegin, Double_t tend) const
+{
+  Long64_t counts = 0;
+  for(size_t i=0; i< fRuns.size(); ++i) {
+    const Double_t start = fRuns[i].fSummary->GetRunStart();
+    const Long64_t n = fRuns[i].fSummary->GetSbCounts(detector, low, high, tbegin - start, tend - start);
+    if(n < 0) return -1;
+    counts += n;
+  }
+  return counts;
 }
 
 ////////////////////////////////////////////////////////////////////////////////
-/// \param trigger Trigger time in microseconds
-/// \param busy Busy time in microseconds
-void dragon::CoincBusytime::AddEvent(Double_t trigger, Double_t busy)
+/// \param which "head", "tail" or "aux"
+/// \param channel Scaler channel
+/// \param tbegin, tend Window, seconds since the epoch
+/// \returns Sum of RunSummary::GetScalerSum() over the runs; -1 if that is invalid
+Double_t dragon::RunQuery::GetScalerSum(const char* which, Int_t channel, Double_t tbegin, Double_t tend) const
 {
-  fIsSorted = false;
-  dragon::CoincBusytime::Event evt(trigger, busy);
-  try {
-    fEvents.push_back(evt);
-  } catch (std::bad_alloc& err) {
-    utils::Error("CoincBusytime::AddEvent", __FILE__, __LINE__)
-      << "Failed to allocate memory for event: trigger, busy = "
-      << trigger << ", " << busy;
-    throw err;
+  Double_t sum = 0;
+  for(size_t i=0; i< fRuns.size(); ++i) {
+    const Double_t start = fRuns[i].fSummary->GetRunStart();
+    const Double_t n = fRuns[i].fSummary->GetScalerSum(which, channel, tbegin - start, tend - start);
+    if(n < 0) return -1;
+    sum += n;
   }
+  return sum;
 }
 
 ////////////////////////////////////////////////////////////////////////////////
-void dragon::CoincBusytime::Sort()
+/// \param channel EPICS channel (`ch`)
+/// \param tbegin, tend Window, seconds since the epoch
+/// \param [out] times Appended with the time of each reading, seconds since the epoch
+/// \param [out] values Appended with the value of each reading
+/// \returns The number of readings appended; -1 if a run has no time series
+Int_t dragon::RunQuery::GetEpicsReadings(Int_t channel, Double_t tbegin, Double_t tend,
+                                         std::vector<Double_t>& times, std::vector<Double_t>& values) const
 {
-  std::sort(fEvents.begin(), fEvents.end(), dragon::CoincBusytime::Event::TriggerCompare);
-  fIsSorted = true;
+  Int_t n = 0;
+  for(size_t i=0; i< fRuns.size(); ++i) {
+    const Double_t start = fRuns[i].fSummary->GetRunStart();
+    const size_t first = times.size();
+    const Int_t nrun = fRuns[i].fSummary->GetEpicsReadings(channel, tbegin - start, tend - start, times, values);
+    if(nrun < 0) return -1;
+    for(size_t j = first; j< times.size(); ++j) times[j] += start;
+    n += nrun;
+  }
+  return n;
 }
 
 ////////////////////////////////////////////////////////////////////////////////
-/// Calculate total busy time for coincidence events
-///
-/// Calcluation of the busy time is performed as follows:
-/// First, sort the collection of events by the trigger time. Then sum up all of
-/// the busy times, but ignoring any overlap. To accomplish this, use the
-/// `std::accumulate` algorithm, with a custom "accumulator" function which
-/// ignores overlap by storing the last "end time" of an event and removing
-/// any overlap between the begin time of the present event and the previous
-/// end time. The code below shows how this is accomplished.
-/// \code
-/// struct AccumulateBusy {
-///		struct Output_t {
-///			Double_t fEnd;
-///			Double_t fTotalBusy;
-///		};
-///		Output_t operator() (const Output_t& current,
-///                          const dragon::CoincBusytime::Event& additional);
-/// };
-///
-/// inline AccumulateBusy::Output_t AccumulateBusy::operator()
-///   (const Output_t& current, const dragon::CoincBusytime::Event& additional)
-/// {
-///		Output_t out = current;
-///		if( current.fEnd < additional.fTrigger ) { // no overlap
-///			out.fTotalBusy += additional.fBusy;
-///			out.fEnd = additional.End();
-///		}
-///		else if( current.fEnd < additional.End() ) { // incomplete overlap
-///			out.fTotalBusy += (additional.End() - current.fEnd);
-///			out.fEnd = additional.End();
-///		}
-///		else { // complete overlap
-///			;
-///		}
-///		return out;
-/// }
-///
-/// Double_t dragon::CoincBusytime::Calculate()
-/// {
-///   if(!fIsSorted) Sort();
-///   AccumulateBusy::Output_t accum = { 0., 0. };
-///   accum = std::accumulate(fEvents.begin(), fEvents.end(), accum, AccumulateBusy());
-///   return accum.fTotalBusy / 1e6;
-/// }
-/// \endcode
-///
-/// \returns Total coincidence busy time in seconds.
-Double_t dragon::CoincBusytime::Calculate()
+/// \returns The mean of GetEpicsReadings(); dragon::NoData<double>::value() if there are none
+Double_t dragon::RunQuery::GetEpicsMean(Int_t channel, Double_t tbegin, Double_t tend) const
 {
-  if(!fIsSorted) Sort();
-  AccumulateBusy::Output_t accum = { 0., 0. };
-  accum = std::accumulate(fEvents.begin(), fEvents.end(), accum, AccumulateBusy());
-  return accum.fTotalBusy / 1e6;
+  std::vector<Double_t> times, values;
+  if(GetEpicsReadings(channel, tbegin, tend, times, values) <= 0)
+    return dragon::NoData<double>::value();
+  return std::accumulate(values.begin(), values.end(), 0.) / values.size();
 }
 
 ///////////////////// Class dragon::StoppingPowerCalculator ////////////////////
@@ -1968,11 +4143,58 @@ dragon::StoppingPowerCalculator::StoppingPowerCalculator(Int_t beamCharge,
   fNmol(nmol),
   fTargetLength(targetLen, targetLenErr),
   fTemp(temp),
-  fMd1Constant(cmd1, cmd1Err)
+  fMd1Constant(cmd1, cmd1Err),
+  fNumThreads(0)
 {
   ;
 }
 
+namespace {
+  // Formulas shared by the UDouble_t and USample_t versions of the
+  // calculator functions, T is either of them
+  template <class T>
+  T torr_cgs(const T& torr)
+  {
+	return 10. * torr * 101325. / 760.0;
+  }
+
+  template <class T>
+  T target_density(const T& pressure, const T& length, Int_t nmol, Double_t temp)
+  {
+	return nmol * torr_cgs(pressure) * length / TMath::Kcgs() / temp;
+  }
+
+  template <class T>
+  T de_broglie_wavelength(T eres, Double_t mbeam, Double_t mtarget)
+  {
+	Double_t mu = 1e6*dragon::Constants::AMU()*mbeam*mtarget / (mbeam + mtarget); // reduced mass in eV/c^2
+	eres *= 1e3; // keV -> eV
+	T pc = T::sqrt(eres*eres + 2.*eres*mu);
+	Double_t hc = 2*TMath::Pi()*dragon::Constants::HbarC()*1e6; // eV*fm
+	T lambda = hc / pc; // nm
+	lambda /= 1e13; // cm
+	return lambda;
+  }
+
+  template <class T>
+  T resonance_strength(const T& yield, const T& epsilon, const T& wavelength,
+                       Double_t mbeam, Double_t mtarget)
+  {
+	T wg = 2.*epsilon*yield / (wavelength*wavelength);
+	wg *= (mtarget / (mbeam+mtarget));
+	return wg;
+  }
+
+  template <class T>
+  T cross_section(const T& yield, const T& pressure, Double_t length, Int_t nmol, Double_t temp)
+  {
+	T rho = target_density(pressure, T(length), nmol, temp);
+	T sigma = yield / rho; // cm^2
+	sigma /= 1e-24; // barns
+	return sigma;
+  }
+} // namespace
+
 ////////////////////////////////////////////////////////////////////////////////
 /// \param torr Pressure in `torr`
 /// \returns Pressure in `dyn/cm<sup>2</sup>`
@@ -1986,7 +4208,15 @@ Double_t dragon::StoppingPowerCalculator::TorrCgs(Double_t torr)
 /// \returns Pressure in `dyn/cm<sup>2</sup>` (with uncertainty)
 UDouble_t dragon::StoppingPowerCalculator::TorrCgs(UDouble_t torr)
 {
-  return 10. * torr * 101325. / 760.0;
+  return torr_cgs(torr);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// \param torr Pressure in `torr` (with sampled uncertainty)
+/// \returns Pressure in `dyn/cm<sup>2</sup>` (with sampled uncertainty)
+USample_t dragon::StoppingPowerCalculator::TorrCgs(const USample_t& torr)
+{
+  return torr_cgs(torr);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -2010,7 +4240,16 @@ Double_t dragon::StoppingPowerCalculator::CalculateDensity(Double_t pressure, Do
 UDouble_t dragon::StoppingPowerCalculator::CalculateDensity(UDouble_t pressure, UDouble_t length,
                                                             Int_t nmol, Double_t temp)
 {
-  return nmol * TorrCgs(pressure) * length / TMath::Kcgs() / temp;
+  return target_density(pressure, length, nmol, temp);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Same as the UDouble_t version, with uncertainties propagated by sampling
+USample_t dragon::StoppingPowerCalculator::CalculateDensity(const USample_t& pressure,
+                                                            const USample_t& length,
+                                                            Int_t nmol, Double_t temp)
+{
+  return target_density(pressure, length, nmol, temp);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -2149,15 +4388,8 @@ UDouble_t dragon::StoppingPowerCalculator::CalculateEbeam(TGraphAsymmErrors** pl
 {
   UDouble_t out(0,0);
   std::auto_ptr<TGraphAsymmErrors> g(new TGraphAsymmErrors(GetNmeasurements()));
-  // calculate density, energy w/ random errors only
-  std::vector<UDouble_t> pres(GetNmeasurements()), energy(GetNmeasurements());
-  for(Int_t i=0; i< GetNmeasurements(); ++i) {
-    double md1err = fMd1[i].GetErrLow() < fMd1[i].GetErrHigh() ? fMd1[i].GetErrHigh()
-                                          : fMd1[i].GetErrLow();
-    pres[i] = fPressures[i];
-    energy[i] = CalculateEnergy(fMd1[i].GetNominal(), md1err, fBeamCharge,
-                                fBeamMass, fMd1Constant.GetNominal(), 0);
-  }
+  std::vector<UDouble_t> pres, energy;
+  GetEbeamPoints(pres, energy);
   // plot and fit to get dE/d[n/A]
   g.reset(PlotUncertainties(GetNmeasurements(), &pres[0], &energy[0]));
   dragon::LinearFitter fit;
@@ -2203,16 +4435,8 @@ UDouble_t dragon::StoppingPowerCalculator::CalculateEpsilon(TGraphAsymmErrors**
 {
   UDouble_t out(0,0);
   std::auto_ptr<TGraph> g(new TGraphAsymmErrors(GetNmeasurements()));
-  // calculate density, energy w/ random errors only
-  std::vector<UDouble_t> dens(GetNmeasurements()), energy(GetNmeasurements());
-  for(Int_t i=0; i< GetNmeasurements(); ++i) {
-    double md1err = fMd1[i].GetErrLow() < fMd1[i].GetErrHigh() ?
-                                          fMd1[i].GetErrHigh() : fMd1[i].GetErrLow();
-    dens[i] = CalculateDensity(fPressures[i], UDouble_t(fTargetLength.GetNominal(), 0),
-                               fNmol, fTemp);
-    energy[i] = CalculateEnergy(fMd1[i].GetNominal(), md1err, fBeamCharge, fBeamMass,
-                                fMd1Constant.GetNominal(), 0);
-  }
+  std::vector<UDouble_t> dens, energy;
+  GetEpsilonPoints(dens, energy);
   // plot and fit to get dE/d[n/A]
   g.reset(PlotUncertainties(GetNmeasurements(), &dens[0], &energy[0]));
   dragon::LinearFitter fit;
@@ -2254,6 +4478,256 @@ UDouble_t dragon::StoppingPowerCalculator::CalculateEpsilon(TGraphAsymmErrors**
   return out;
 }
 
+////////////////////////////////////////////////////////////////////////////////
+/// Same as CalculateEpsilon(), but the errors of the fit are found from the
+/// spread of refits to resampled measurements instead of from MINOS. The refits
+/// run in GetNumThreads() threads.
+///
+/// \param nsamples Number of bootstrap samples (ignored for kJackknife, which
+///        refits once per measurement)
+/// \param type kBootstrap or kJackknife
+/// \param [out] ebeam Pointer to UDouble_t holding beam energy from offset of
+///        linear fit.
+/// \param seed Seed of the bootstrap samples, the result is the same for a
+///        given seed regardless of the number of threads.
+///
+/// \returns The `epslion` parameter, as for CalculateEpsilon(). The nominal
+///          value is the fit to all measurements, the errors are the distances
+///          to the 15.9% and 84.1% quantiles of the bootstrap fits (or the
+///          jackknife standard error). Systematic errors are added back after
+///          the fit as in CalculateEpsilon().
+UDouble_t dragon::StoppingPowerCalculator::ResampleEpsilon(Int_t nsamples, Int_t type,
+                                                           UDouble_t* ebeam, UInt_t seed)
+{
+  std::vector<UDouble_t> dens, energy;
+  GetEpsilonPoints(dens, energy);
+  UDouble_t slope(0,0), offset(0,0);
+  Resample(dens, energy, nsamples, type, seed, slope, offset);
+
+  UDouble_t out = -1*slope;
+  out *= fBeamMass; // keV/u -> keV
+  out *= 1e3; // keV -> eV
+  if(ebeam) {
+    *ebeam = offset; // keV/u;
+  }
+  // add back systematic errors
+  out *= fMd1Constant / fMd1Constant.GetNominal();
+  out *= fTargetLength / fTargetLength.GetNominal();
+  return out;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Same as CalculateEbeam(), with the errors found from refits to resampled
+/// measurements; the parameters are as for ResampleEpsilon().
+/// \returns The beam energy at zero pressure in keV/u.
+UDouble_t dragon::StoppingPowerCalculator::ResampleEbeam(Int_t nsamples, Int_t type, UInt_t seed)
+{
+  std::vector<UDouble_t> pres, energy;
+  GetEbeamPoints(pres, energy);
+  UDouble_t slope(0,0), offset(0,0);
+  Resample(pres, energy, nsamples, type, seed, slope, offset);
+  return offset;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Energy (random errors only) vs. pressure of each measurement
+void dragon::StoppingPowerCalculator::GetEbeamPoints(std::vector<UDouble_t>& pres,
+                                                     std::vector<UDouble_t>& energy) const
+{
+  pres.resize(GetNmeasurements());
+  energy.resize(GetNmeasurements());
+  for(Int_t i=0; i< GetNmeasurements(); ++i) {
+    double md1err = fMd1[i].GetErrLow() < fMd1[i].GetErrHigh() ? fMd1[i].GetErrHigh()
+                                          : fMd1[i].GetErrLow();
+    pres[i] = fPressures[i];
+    energy[i] = CalculateEnergy(fMd1[i].GetNominal(), md1err, fBeamCharge,
+                                fBeamMass, fMd1Constant.GetNominal(), 0);
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Energy vs. density of each measurement, with random errors only
+void dragon::StoppingPowerCalculator::GetEpsilonPoints(std::vector<UDouble_t>& dens,
+                                                       std::vector<UDouble_t>& energy) const
+{
+  dens.resize(GetNmeasurements());
+  energy.resize(GetNmeasurements());
+  for(Int_t i=0; i< GetNmeasurements(); ++i) {
+    double md1err = fMd1[i].GetErrLow() < fMd1[i].GetErrHigh() ?
+                                          fMd1[i].GetErrHigh() : fMd1[i].GetErrLow();
+    dens[i] = CalculateDensity(fPressures[i], UDouble_t(fTargetLength.GetNominal(), 0),
+                               fNmol, fTemp);
+    energy[i] = CalculateEnergy(fMd1[i].GetNominal(), md1err, fBeamCharge, fBeamMass,
+                                fMd1Constant.GetNominal(), 0);
+  }
+}
+
+namespace {
+  // Replicates handed to a thread at a time
+  const Int_t kResampleChunk = 64;
+
+  struct ResampleArgs_t {
+	const std::vector<Double_t>* fPoints; // x, y, exl, exh, eyl, eyh, fN each
+	Int_t fN;
+	Int_t fType;
+	Int_t fNsamples;
+	UInt_t fSeed;
+	Int_t* fNext;
+	std::vector<Double_t>* fSlopes;
+	std::vector<Double_t>* fOffsets;
+	std::vector<Char_t>* fGood;
+  };
+
+  void* run_resample_thread(void* input)
+  {
+	// NOTE: input must point to a valid ResampleArgs_t struct
+	ResampleArgs_t* args = (ResampleArgs_t*)input;
+	const Int_t n = args->fN;
+	const Double_t* p = &args->fPoints->at(0);
+	std::vector<Double_t> q(6*n); // resampled points, reused for every refit
+	TRandom3 rng;
+	while (1) {
+      Int_t begin;
+      {
+        TThread::Lock();
+        begin = *args->fNext;
+        *args->fNext += kResampleChunk;
+        TThread::UnLock();
+      }
+      if(begin >= args->fNsamples) break;
+
+      const Int_t end = std::min(begin + kResampleChunk, args->fNsamples);
+      for(Int_t i = begin; i< end; ++i) {
+        Int_t m = 0;
+        if(args->fType == dragon::StoppingPowerCalculator::kJackknife) {
+          for(Int_t j=0; j< n; ++j) {
+            if(j == i) continue;
+            for(Int_t k=0; k< 6; ++k) q[k*n + m] = p[k*n + j];
+            ++m;
+          }
+        }
+        else {
+          // seeded by replicate, so the result does not depend on the threads
+          const UInt_t seed = args->fSeed*2654435761u + i;
+          rng.SetSeed(seed ? seed : 1);
+          for(m=0; m< n; ++m) {
+            const Int_t j = rng.Integer(n);
+            for(Int_t k=0; k< 6; ++k) q[k*n + m] = p[k*n + j];
+          }
+        }
+        args->fGood->at(i) =
+          dragon::LinearFitter::FitWeighted(m, &q[0], &q[n], &q[2*n], &q[3*n], &q[4*n], &q[5*n],
+                                            args->fSlopes->at(i), args->fOffsets->at(i));
+      }
+	}
+	return 0;
+  }
+
+  // Low and high errors of a replicate distribution, relative to the nominal value
+  void resample_errors(Int_t type, Double_t nominal, std::vector<Double_t> values,
+                       Double_t& low, Double_t& high)
+  {
+	const Int_t n = values.size();
+	if(type == dragon::StoppingPowerCalculator::kJackknife) {
+      const Double_t mean = std::accumulate(values.begin(), values.end(), 0.) / n;
+      Double_t sum2 = 0;
+      for(Int_t i=0; i< n; ++i) sum2 += (values[i] - mean)*(values[i] - mean);
+      low = high = sqrt(sum2 * (n - 1) / n);
+      return;
+	}
+	std::sort(values.begin(), values.end());
+	const Double_t qlow  = values[std::min<Int_t>(0.158655254*n, n-1)];
+	const Double_t qhigh = values[std::min<Int_t>(0.841344746*n, n-1)];
+	low  = std::max(0., nominal - qlow);
+	high = std::max(0., qhigh - nominal);
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Fits y vs. x with LinearFitter::FitWeighted(), and refits resampled sets of
+/// the points in GetNumThreads() threads to find the errors.
+void dragon::StoppingPowerCalculator::Resample(const std::vector<UDouble_t>& x,
+                                               const std::vector<UDouble_t>& y,
+                                               Int_t nsamples, Int_t type, UInt_t seed,
+                                               UDouble_t& slope, UDouble_t& offset) const
+{
+  const Int_t n = x.size();
+  slope = offset = UDouble_t(0,0);
+  if(type != kBootstrap && type != kJackknife) {
+    dutils::Error("StoppingPowerCalculator::Resample", __FILE__, __LINE__)
+      << "Invalid resampling type: " << type;
+    return;
+  }
+  if(type == kJackknife) nsamples = n;
+
+  // Same errors as PlotUncertainties() gives the fit in CalculateEpsilon()
+  std::vector<Double_t> points(6*n);
+  for(Int_t i=0; i< n; ++i) {
+    points[i]     = x[i].GetNominal();
+    points[n+i]   = y[i].GetNominal();
+    points[2*n+i] = sqrt(pow(x[i].GetErrLow(),  2) + pow(x[i].GetSysErrLow(),  2));
+    points[3*n+i] = sqrt(pow(x[i].GetErrHigh(), 2) + pow(x[i].GetSysErrHigh(), 2));
+    points[4*n+i] = sqrt(pow(y[i].GetErrLow(),  2) + pow(y[i].GetSysErrLow(),  2));
+    points[5*n+i] = sqrt(pow(y[i].GetErrHigh(), 2) + pow(y[i].GetSysErrHigh(), 2));
+  }
+  Double_t m0, b0;
+  if(n < 3 || nsamples < 2 ||
+     !dragon::LinearFitter::FitWeighted(n, &points[0], &points[n], &points[2*n], &points[3*n],
+                                        &points[4*n], &points[5*n], m0, b0)) {
+    dutils::Error("StoppingPowerCalculator::Resample", __FILE__, __LINE__)
+      << "Cannot resample " << n << " measurements " << nsamples << " times";
+    return;
+  }
+
+  std::vector<Double_t> slopes(nsamples), offsets(nsamples);
+  std::vector<Char_t> good(nsamples, 0);
+  Int_t next = 0;
+  ResampleArgs_t args = { &points, n, type, nsamples, seed, &next, &slopes, &offsets, &good };
+
+  Int_t nthreads = fNumThreads;
+  if(nthreads <= 0) {
+    SysInfo_t info;
+    nthreads = gSystem->GetSysInfo(&info) == 0 && info.fCpus > 0 ? info.fCpus : 1;
+  }
+  nthreads = std::max(1, std::min(nthreads, (nsamples + kResampleChunk - 1) / kResampleChunk));
+  if(nthreads == 1) {
+    run_resample_thread(&args);
+  }
+  else {
+    std::vector<TThread*> threads;
+    for(Int_t i=0; i< nthreads; ++i) {
+      threads.push_back(new TThread(run_resample_thread, &args));
+      threads.back()->Run();
+    }
+    for(size_t i=0; i< threads.size(); ++i) {
+      threads[i]->Join();
+      delete threads[i];
+    }
+  }
+
+  // Bootstrap samples with all measurements at one point cannot be fit
+  std::vector<Double_t> goodSlopes, goodOffsets;
+  for(Int_t i=0; i< nsamples; ++i) {
+    if(!good[i]) continue;
+    goodSlopes.push_back(slopes[i]);
+    goodOffsets.push_back(offsets[i]);
+  }
+  slope.SetNominal(m0);
+  offset.SetNominal(b0);
+  if(goodSlopes.size() < 2) {
+    dutils::Warning("StoppingPowerCalculator::Resample", __FILE__, __LINE__)
+      << "Only " << goodSlopes.size() << " of " << nsamples << " refits succeeded, no errors";
+    return;
+  }
+  Double_t low, high;
+  resample_errors(type, m0, goodSlopes, low, high);
+  slope.SetErrLow(low);
+  slope.SetErrHigh(high);
+  resample_errors(type, b0, goodOffsets, low, high);
+  offset.SetErrLow(low);
+  offset.SetErrHigh(high);
+}
+
 /////////////// Class dragon::ResonanceStrengthCalculator ///////////////
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -2268,7 +4742,8 @@ dragon::ResonanceStrengthCalculator::ResonanceStrengthCalculator(Double_t eres,
                                                                  Double_t mtarget,
                                                                  dragon::BeamNorm* beamNorm,
                                                                  UDouble_t epsilon):
-  fBeamNorm(beamNorm), fEpsilon(epsilon), fBeamMass(mbeam), fTargetMass(mtarget), fResonanceEnergy(eres)
+  fBeamNorm(beamNorm), fEpsilon(epsilon), fBeamMass(mbeam), fTargetMass(mtarget), fResonanceEnergy(eres),
+  fMonteCarlo(kFALSE)
 {
 
 }
@@ -2278,14 +4753,24 @@ dragon::ResonanceStrengthCalculator::ResonanceStrengthCalculator(Double_t eres,
 /// \param whichSb Specify the surface barrier detector to use
 ///  for normalization
 /// \returns Resonance strenght in eV.
+/// \note With SetMonteCarlo(kTRUE), the uncertainties are propagated by
+///  sampling, see USample_t.
 UDouble_t dragon::ResonanceStrengthCalculator::CalculateResonanceStrength(Int_t whichSb,
                                                                           Int_t type,
                                                                           Bool_t print)
 {
   if(!fBeamNorm) return UDouble_t(0,0);
   UDouble_t yield = fBeamNorm->CalculateYield(whichSb, type, print);
-  UDouble_t wavelength = CalculateWavelength(fResonanceEnergy, fBeamMass, fTargetMass);
-  UDouble_t wg = CalculateResonanceStrength(yield, fEpsilon, wavelength, fBeamMass, fTargetMass);
+  UDouble_t wg;
+  if(fMonteCarlo) {
+    USample_t wavelength = CalculateWavelength(USample_t(fResonanceEnergy), fBeamMass, fTargetMass);
+    wg = CalculateResonanceStrength(USample_t(yield), USample_t(fEpsilon), wavelength,
+                                    fBeamMass, fTargetMass).GetUDouble();
+  }
+  else {
+    UDouble_t wavelength = CalculateWavelength(fResonanceEnergy, fBeamMass, fTargetMass);
+    wg = CalculateResonanceStrength(yield, fEpsilon, wavelength, fBeamMass, fTargetMass);
+  }
   if(print) std::cout << "Resonance Strength [eV]: " << wg << "\n";
   return wg;
 }
@@ -2329,14 +4814,16 @@ UDouble_t dragon::ResonanceStrengthCalculator::CalculateWavelength(UDouble_t ere
                                                                    Double_t mbeam,
                                                                    Double_t mtarget)
 {
-  Double_t mu = 1e6*dragon::Constants::AMU()*mbeam*mtarget / (mbeam + mtarget); // reduced mass in eV/c^2
-  eres *= 1e3; // keV -> eV
-  UDouble_t pc = UDouble_t::sqrt(eres*eres + 2.*eres*mu);
-  // Double_t hc = TMath::HC() * 1e9 / TMath::Qe(); // eV*nm
-  Double_t hc = 2*TMath::Pi()*dragon::Constants::HbarC()*1e6; // eV*fm
-  UDouble_t lambda = hc / pc; // nm
-  lambda /= 1e13; // cm
-  return lambda;
+  return de_broglie_wavelength(eres, mbeam, mtarget);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Same as the UDouble_t version, with uncertainties propagated by sampling
+USample_t dragon::ResonanceStrengthCalculator::CalculateWavelength(const USample_t& eres,
+                                                                   Double_t mbeam,
+                                                                   Double_t mtarget)
+{
+  return de_broglie_wavelength(eres, mbeam, mtarget);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -2363,9 +4850,18 @@ UDouble_t dragon::ResonanceStrengthCalculator::CalculateResonanceStrength(UDoubl
                                                                           Double_t mbeam,
                                                                           Double_t mtarget)
 {
-  UDouble_t wg = 2.*epsilon*yield / (wavelength*wavelength);
-  wg *= (mtarget / (mbeam+mtarget));
-  return wg;
+  return resonance_strength(yield, epsilon, wavelength, mbeam, mtarget);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Calculate the resonance strength, with uncertainties propagated by sampling
+USample_t dragon::ResonanceStrengthCalculator::CalculateResonanceStrength(const USample_t& yield,
+                                                                          const USample_t& epsilon,
+                                                                          const USample_t& wavelength,
+                                                                          Double_t mbeam,
+                                                                          Double_t mtarget)
+{
+  return resonance_strength(yield, epsilon, wavelength, mbeam, mtarget);
 }
 
 ///////////////////////////// Class dragon::LabCM //////////////////////////////
@@ -2412,6 +4908,38 @@ void dragon::LabCM::Init(int Zbeam, int Abeam, int Ztarget, int Atarget,
   fTcm = ecm;
 }
 
+namespace {
+// Conversions to and from the CM kinetic energy for LabCM; energies in keV,
+// beam (m1) and target (m2) masses in keV/c^2
+inline double lab_to_cm(double ebeam, double m1, double m2)
+{
+  double E1tot = ebeam + m1; // total energy
+  double Ecmtot = sqrt(m1*m1 + m2*m2 + 2*m2*E1tot);
+  return Ecmtot - m1 - m2;
+}
+
+inline double target_to_cm(double etarget, double m1, double m2)
+{
+  double E2tot = etarget + m2; // total energy
+  double Ecmtot = sqrt(m1*m1 + m2*m2 + 2*m1*E2tot);
+  return Ecmtot - m1 - m2;
+}
+
+inline double cm_to_lab(double ecm, double m1, double m2)
+{
+  double Ecm = ecm + m1 + m2; // total energy
+  double E1 = (Ecm*Ecm - m1*m1 - m2*m2) / (2*m2); // total energy
+  return E1 - m1; // kinetic energy
+}
+
+inline double cm_to_target(double ecm, double m1, double m2)
+{
+  double Ecm = ecm + m1 + m2; // total energy
+  double E2 = (Ecm*Ecm - m1*m1 - m2*m2) / (2*m1); // total energy
+  return E2 - m2; // kinetic energy
+}
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 /// Set CM energy
 /// \param ecm Center-of-mass kinetic energy in keV
@@ -2425,9 +4953,7 @@ void dragon::LabCM::SetEcm(double ecm)
 /// \param ebeam Beam energy in keV
 void dragon::LabCM::SetEbeam(double ebeam)
 {
-  double E1tot = ebeam + fM1; // total energy
-  double Ecmtot = sqrt(fM1*fM1 + fM2*fM2 + 2*fM2*E1tot);
-  fTcm = Ecmtot - fM1 - fM2;
+  fTcm = lab_to_cm(ebeam, fM1, fM2);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -2443,9 +4969,7 @@ void dragon::LabCM::SetV2beam(double ebeam)
 /// \param etarget Target energy in keV
 void dragon::LabCM::SetEtarget(double etarget)
 {
-  double E2tot = etarget + fM2; // total energy
-  double Ecmtot = sqrt(fM1*fM1 + fM2*fM2 + 2*fM1*E2tot);
-  fTcm = Ecmtot - fM1 - fM2;
+  fTcm = target_to_cm(etarget, fM1, fM2);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -2467,10 +4991,7 @@ double dragon::LabCM::GetV2beam() const
 /// Get lab frame beam energy in keV
 double dragon::LabCM::GetEbeam() const
 {
-  double Ecm = fTcm + fM1 + fM2; // total energy
-  double E1 = (Ecm*Ecm - fM1*fM1 - fM2*fM2) / (2*fM2); // total energy
-  double T1 = E1 - fM1; // kinetic energy
-  return T1;
+  return cm_to_lab(fTcm, fM1, fM2);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -2484,10 +5005,61 @@ double dragon::LabCM::GetV2target() const
 /// Get target frame energy in keV
 double dragon::LabCM::GetEtarget() const
 {
-  double Ecm = fTcm + fM1 + fM2; // total energy
-  double E2 = (Ecm*Ecm - fM1*fM1 - fM2*fM2) / (2*fM1); // total energy
-  double T2 = E2 - fM2; // kinetic energy
-  return T2;
+  return cm_to_target(fTcm, fM1, fM2);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Convert an array of energies between frames
+/// \param [in] energy energies in frame \e from
+/// \param [in] n number of energies
+/// \param [out] out the energies in frame \e to, of length \e n (may be \e energy)
+/// \param [in] from frame of \e energy
+/// \param [in] to frame of \e out
+///
+/// Gives the same results as SetXxx() followed by GetXxx() for each energy,
+/// without changing the CM energy of this object. The frames are resolved
+/// once, and each conversion is a plain loop that can be vectorized.
+void dragon::LabCM::Convert(const double* energy, int n, double* out, Frame_t from, Frame_t to) const
+{
+  const double m1 = fM1, m2 = fM2;
+  const double u1 = fM1/dragon::Constants::AMU(), u2 = fM2/dragon::Constants::AMU();
+
+  // To CM energy
+  switch (from) {
+  case kCM:
+    std::copy(energy, energy + n, out);
+    break;
+  case kBeam:
+    for (int i = 0; i < n; ++i) out[i] = lab_to_cm(energy[i], m1, m2);
+    break;
+  case kV2beam:
+    for (int i = 0; i < n; ++i) out[i] = lab_to_cm(energy[i]*m1/dragon::Constants::AMU(), m1, m2);
+    break;
+  case kTarget:
+    for (int i = 0; i < n; ++i) out[i] = target_to_cm(energy[i], m1, m2);
+    break;
+  case kV2target: // as SetV2target()
+    for (int i = 0; i < n; ++i) out[i] = lab_to_cm(energy[i]*m2/dragon::Constants::AMU(), m1, m2);
+    break;
+  }
+
+  // From CM energy
+  switch (to) {
+  case kCM:
+    break;
+  case kBeam:
+    for (int i = 0; i < n; ++i) out[i] = cm_to_lab(out[i], m1, m2);
+    break;
+  case kV2beam:
+    for (int i = 0; i < n; ++i) out[i] = cm_to_lab(out[i], m1, m2) / u1;
+    break;
+  case kTarget:
+    for (int i = 0; i < n; ++i) out[i] = cm_to_target(out[i], m1, m2);
+    break;
+  case kV2target:
+    for (int i = 0; i < n; ++i) out[i] = cm_to_target(out[i], m1, m2) / u2;
+    break;
+  }
 }
 
 ///////////////////// Class dragon::CrossSectionCalculator /////////////////////
@@ -2506,7 +5078,8 @@ dragon::CrossSectionCalculator::CrossSectionCalculator(dragon::BeamNorm* beamNor
   fBeamNorm(beamNorm),
   fNmol(nmol),
   fTemp(temp),
-  fTargetLen(targetLen)
+  fTargetLen(targetLen),
+  fMonteCarlo(kFALSE)
 {
   fTotalCrossSection = UDouble_t(0, 0);
 }
@@ -2520,6 +5093,9 @@ dragon::CrossSectionCalculator::CrossSectionCalculator(dragon::BeamNorm* beamNor
 ///       that was part of the BatchCalculate() call to the BeamNorm pointer
 ///       passed to the constructor. The total cross section is the weighted
 ///       average of these run-by-run measurements.
+///
+/// \note With SetMonteCarlo(kTRUE), the run-by-run uncertainties are
+///       propagated by sampling, see USample_t.
 UDouble_t dragon::CrossSectionCalculator::Calculate(Int_t whichSB, const
                                                     char* prefix, Bool_t printTotal)
 {
@@ -2548,8 +5124,11 @@ UDouble_t dragon::CrossSectionCalculator::Calculate(Int_t whichSB, const
   while(irun !=  fBeamNorm->GetRuns().end()) {
     dragon::BeamNorm::RunData* rd = fBeamNorm->GetRunData(*irun++);
     if(rd == 0) break;
-    const UDouble_t sigma = CalculateCrossSection(rd->yield[whichSB], rd->pressure,
-                                                  fTargetLen, fNmol, fTemp) / prefixval;
+    const UDouble_t sigma = fMonteCarlo ?
+      (CalculateCrossSection(USample_t(rd->yield[whichSB]), USample_t(rd->pressure),
+                             fTargetLen, fNmol, fTemp) / prefixval).GetUDouble() :
+      CalculateCrossSection(rd->yield[whichSB], rd->pressure,
+                            fTargetLen, fNmol, fTemp) / prefixval;
     fCrossSections.push_back( sigma );
   }
   fTotalCrossSection = MeasurementWeightedAverage(fCrossSections.begin(),
@@ -2567,11 +5146,18 @@ UDouble_t dragon::CrossSectionCalculator::CalculateCrossSection(UDouble_t yield,
                                                                 Int_t nmol,
                                                                 Double_t temp)
 {
-  UDouble_t rho = dragon::StoppingPowerCalculator::CalculateDensity(pressure, length,
-                                                                    nmol, temp);
-  UDouble_t sigma = yield / rho; // cm^2
-  sigma /= 1e-24; // barns
-  return sigma;
+  return cross_section(yield, pressure, length, nmol, temp);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Same as the UDouble_t version, with uncertainties propagated by sampling
+USample_t dragon::CrossSectionCalculator::CalculateCrossSection(const USample_t& yield,
+                                                                const USample_t& pressure,
+                                                                Double_t length,
+                                                                Int_t nmol,
+                                                                Double_t temp)
+{
+  return cross_section(yield, pressure, length, nmol, temp);
 }
 
 ///////////////////////////////// Helper class /////////////////////////////////
@@ -7,6 +7,7 @@
 #ifndef DRAGON_ROOT_ANALYSIS_HEADER
 #define DRAGON_ROOT_ANALYSIS_HEADER
 #include <map>
+#include <vector>
 #include <memory>
 #include <fstream>
 #ifndef __MAKECINT__
@@ -16,6 +17,7 @@
 
 #include <TH1.h>
 #include <TCut.h>
+#include <TCutG.h>
 #include <TROOT.h>
 #include <TChain.h>
 #include <TFile.h>
@@ -27,6 +29,7 @@
 #include "Uncertainty.hxx"
 #include "Constants.hxx"
 #include "AutoPtr.hxx"
+#include "PolygonGate.hxx"
 #include "Dragon.hxx"
 #include "Vme.hxx"
 
@@ -59,6 +62,15 @@ namespace dragon {
                    const char* format = "$DH/rootfiles/run%d.root",
                    const char* friend_format = "$DH/rootfiles/run%d_dsssd_recal.root");
 
+  /// Set the file caching the contents of run files for MakeChains()
+  void SetFileCatalogue(const char* path);
+
+  /// Write the index of event keys of a run file used by FriendByIndex()
+  Int_t BuildFriendIndex(const char* filename, Bool_t force = kFALSE);
+
+  /// Add a head, tail or coincidence chain of the same runs as a friend, matched by event
+  TChain* FriendByIndex(TChain* chain, const char* friend_tree, const char* friend_alias, const char* side);
+
   /// Open a file just by run number
   TFile* OpenRun(int runnum, const char* format = "$DH/rootfiles/run%d.root");
 
@@ -113,10 +125,23 @@ namespace dragon {
    *  filter.Close();
    *  \endcode
    *
-   *  To speed things up, by default each input tree is filtered in a
-   *  different thread (one thread per input). To turn off threading, call
-   *  SetThreaded(kFALSE) before calling Run(). This will cause each input
-   *  tree to be filtered in series rather than in parallel.
+   *  To speed things up, by default the inputs are split into ranges of
+   *  entries (on cluster boundaries), which are filtered in parallel by
+   *  GetNumThreads() threads, each with its own copy of the input files and
+   *  of the compiled filter condition. The selected entries are then copied
+   *  into the output trees in the original entry order; this copy, which reads
+   *  and writes the full entries, is done in series in the calling thread and
+   *  is often the larger part of the run time. To turn off threading,
+   *  call SetThreaded(kFALSE) before calling Run(). This will cause all entries
+   *  to be filtered in series in the calling thread. Inputs which are not read
+   *  from a file, or which have friends, are copied in one piece with
+   *  TTree::CopyTree().
+   *
+   *  By default all branches are copied into the output. Use SetBranches() to
+   *  only copy (and read) some of them:
+   *  \code
+   *  filter.SetBranches(&ch3, "head tail");
+   *  \endcode
    */
   class TTreeFilter {
   public:
@@ -124,6 +149,7 @@ namespace dragon {
 	struct Out_t {
       TTree* fTree;
       TString fCondition;
+      TString fBranches;
 	};
 	typedef std::map <TTree*, Out_t> Map_t;
 	typedef std::pair<TTree*, Out_t> Pair_t;
@@ -152,19 +178,27 @@ namespace dragon {
 	Bool_t GetThreaded() const { return fRunThreaded; }
 	/// Get output directory
 	TDirectory* GetOutDir() const { return fDirectory; }
+	/// Get the number of threads used by Run()
+	Int_t GetNumThreads() const { return fNumThreads; }
 	/// Do the filtering
 	Int_t Run();
 	/// Set a tree to filter and it's filter condition
 	void SetFilterCondition(TTree* tree, const char* condition);
+	/// Set the branches of a tree to copy into the output
+	void SetBranches(TTree* tree, const char* branches);
 	/// Set output directory
 	void SetOutDir(TDirectory* directory);
 	/// Turn on/off threading for different trees, default is on
 	void SetThreaded(Bool_t on) { fRunThreaded = on; }
+	/// Set the number of threads used by Run(), 0 (default) for one per CPU
+	void SetNumThreads(Int_t n) { fNumThreads = n; }
 	/// Check if output directory is valid.
 	Bool_t IsZombie() const;
   private:
 	/// Use separate threads for each tree?
 	Bool_t fRunThreaded;
+	/// Number of threads, 0 for one per CPU
+	Int_t fNumThreads;
 	/// File (directory) owning the output tree
 	TDirectory* fDirectory;
 	/// Do we take ownership of fFile or not?
@@ -173,6 +207,41 @@ namespace dragon {
 	Map_t fInputs;
   };
 
+  /// Graphical cut with a fast IsInside()
+  /*!
+   *  Behaves exactly like the TCutG it is made from, but tests points using a
+   *  dragon::utils::PolygonGate, which is much faster than checking every edge
+   *  of the polygon. This pays off in TTree::Draw() or TTreeFilter conditions
+   *  applied to many entries:
+   *  \code
+   *  TCutG* cut = (TCutG*)gROOT->FindObject("CUTG"); // cut drawn on a canvas
+   *  dragon::FastCutG fastcut("hi_cut", *cut);
+   *  filter.SetFilterCondition(&ch3, "hi_cut && head.bgo.ecal[0] > 0");
+   *  \endcode
+   *  As for any TCutG, the cut is found by name (through `gROOT->GetListOfSpecials()`)
+   *  when compiling the condition, and its variables are taken from SetVarX() and SetVarY().
+   */
+  class FastCutG: public TCutG {
+  public:
+	/// Empty cut
+	FastCutG() { }
+	/// Copy points and variables from an existing cut
+	FastCutG(const char* name, const TCutG& cutg);
+	/// Test with the fast gate
+	Int_t IsInside(Double_t x, Double_t y) const
+	  { return fGate.IsInside(x, y); }
+	/// Set a point and rebuild the gate
+	void SetPoint(Int_t i, Double_t x, Double_t y);
+	/// Rebuild the gate from the current points
+	void Rebuild();
+  private:
+	/// Acceleration structure
+	utils::PolygonGate fGate; //!
+
+	/// The streamer (in RootAnalysis.cxx) rebuilds fGate after reading
+	ClassDef(FastCutG, 1);
+  };
+
   /// Class to extract data from rossum output files
   /*!
    *  This class facilitates extraction of data saved into `*.rossumData` files by the DRAGON
@@ -198,6 +267,10 @@ namespace dragon {
    * rossumData.AverageCurrent(1000, 1, 0).Print(); // print the average current in the first FC1 iteration
    *
    * \endcode
+   *
+   * The parsed readings are cached in a binary file next to the rossum file (`<file>.cache`),
+   * which is loaded instead of parsing the text again as long as the rossum file has not
+   * changed size or modification time.
    */
   class RossumData: public TNamed {
   public:
@@ -220,7 +293,7 @@ namespace dragon {
 	/// Parse the relevant information from a rossumData file
 	Bool_t ParseFile();
 	/// Check if a rossumData file is currently open
-	Bool_t IsFileOpen() { return fFile.get(); }
+	Bool_t IsFileOpen() { return !fFileName.empty(); }
 	/// Get the average beam current from a set of cup readings
 	UDouble_t AverageCurrent(Int_t run, Int_t cup, Int_t iteration = 0,
                              Double_t skipBegin = 10, Double_t skipEnd = 5);
@@ -237,8 +310,15 @@ namespace dragon {
 	static TTree* GetTree_ (TreeMap_t::iterator& it) { return it->second.first; }
 	static std::string GetTime_ (TreeMap_t::const_iterator& it) { return it->second.second; }
 	static std::string GetTime_ (TreeMap_t::iterator& it) { return it->second.second; }
-	dragon::utils::AutoPtr<std::ifstream> fFile; //!
+	/// Range of fReadTime, fReadCurrent holding one cup iteration, keyed on IndexKey_()
+	typedef std::map<Long64_t, std::pair<Int_t, Int_t> > Index_t;
+	static Long64_t IndexKey_ (Int_t run, Int_t cup, Int_t iteration)
+    { return ((Long64_t)run << 32) | ((cup & 0xffff) << 16) | (iteration & 0xffff); }
+	std::string fFileName; //!
 	TreeMap_t fTrees;
+	std::vector<Double_t> fReadTime; //!
+	std::vector<Double_t> fReadCurrent; //!
+	Index_t fIndex; //!
 	std::map<std::string, Int_t> fWhichCup;
 	Int_t fCup;
 	Int_t fIteration;
@@ -257,6 +337,15 @@ namespace dragon {
    *       (Tcm + m1 + m2)^2 = m1^2 + m2^2 + 2*m2*(m1 + T1)
    */
   class LabCM {
+  public:
+	/// Frame (and units) of an energy, for Convert()
+	enum Frame_t {
+	  kCM,       ///< Center of mass kinetic energy [keV]
+	  kBeam,     ///< Lab frame beam energy [keV], as in SetEbeam()
+	  kV2beam,   ///< Lab frame beam energy [keV/u], as in SetV2beam()
+	  kTarget,   ///< Target frame energy [keV], as in SetEtarget()
+	  kV2target  ///< Target frame energy [keV/u], as in SetV2target() and GetV2target()
+	};
   public:
 	LabCM(int Zbeam, int Abeam, int Ztarget, int Atarget, double ecm = 0, int qbeam = 0, int qtarget = 0);
 	LabCM(double mbeam, double mtarget, double ecm = 0.);
@@ -279,6 +368,8 @@ namespace dragon {
 	void SetM1(double m1) { fM1 = 1e3*m1*dragon::Constants::AMU(); }
 	/// Set target mass in amu
 	void SetM2(double m2) { fM2 = 1e3*m2*dragon::Constants::AMU(); }
+	/// Convert an array of energies between frames
+	void Convert(const double* energy, int n, double* out, Frame_t from, Frame_t to) const;
   private:
 	/// Ctor helper
 	void Init(int Zbeam, int Abeam, int Ztarget, int Atarget, double ecm, int qbeam, int qtarget);
@@ -363,6 +454,14 @@ namespace dragon {
       BatchCalculate(chain, chargeBeam, pkLow0, pkHigh0, pkLow1, pkHigh1,
                      recoilGate.GetTitle(), time, skipBegin, skipEnd);
     }
+	/// Set the file caching per-run results of BatchCalculate() (empty: no caching)
+	void SetCacheFile(const char* path) { fCacheFile = path ? path : ""; }
+	/// Returns the cache file of BatchCalculate()
+	const char* GetCacheFile() const { return fCacheFile.c_str(); }
+	/// Set the number of threads used by BatchCalculate() (0: one per CPU)
+	void SetNumThreads(Int_t n) { fNumThreads = n; }
+	/// Returns the number of threads used by BatchCalculate()
+	Int_t GetNumThreads() const { return fNumThreads; }
 	void CalculateRecoils(TFile* datafile, const char* tree, const char* gate);
 	Int_t ReadSbCounts(TFile* datafile, Double_t pkLow0, Double_t pkHigh0,
                        Double_t pkLow1, Double_t pkHigh1,Double_t time = 120.);
@@ -392,6 +491,8 @@ namespace dragon {
 	/// Private GetRunData(), creates new if it's not made
 	RunData* GetOrCreateRunData(Int_t runnum);
 	Bool_t HaveRossumFile() { return fRossum.get(); }
+	/// Store the number of recoils of a run and calculate the yield
+	void SetRecoils(Int_t runnum, const char* treename, const UDouble_t& nrecoil);
 	UInt_t GetParams(const char* param, std::vector<Double_t> *runnum, std::vector<UDouble_t> *parval);
 	BeamNorm(const BeamNorm&) { }
 	BeamNorm& operator= (const BeamNorm&) { return *this; }
@@ -403,6 +504,8 @@ namespace dragon {
 	std::map<Int_t, RunData> fRunData;
 	dragon::utils::AutoPtr<RossumData> fRossum;
 	std::map<std::string, UDouble_t> fEfficiencies;
+	std::string fCacheFile; //!
+	Int_t fNumThreads; //!
 
 	ClassDef(BeamNorm, 2);
   };
@@ -418,6 +521,10 @@ namespace dragon {
 	enum YAxisType_t {
       kMD1,
       kENERGY
+	};
+	enum ResampleType_t {
+      kBootstrap, ///< Refit random draws (with replacement) of the measurements
+      kJackknife  ///< Refit the measurements leaving out one at a time
 	};
 	struct Measurement_t {
       UDouble_t pressure;
@@ -427,7 +534,7 @@ namespace dragon {
 	};
   public:
 	/// Dummy constructor
-	StoppingPowerCalculator() { }
+	StoppingPowerCalculator(): fNumThreads(0) { }
 	/// Construct a stopping power calculator with parameters
     StoppingPowerCalculator(Int_t beamCharge, Double_t beamMass, Int_t nmol, Double_t temp = 300.,
                             Double_t targetLen = 12.3, Double_t targetLenErr = 0.4,
@@ -470,18 +577,38 @@ namespace dragon {
 	UDouble_t CalculateEpsilon(TGraphAsymmErrors** plot = 0, UDouble_t* ebeam = 0);
 	/// Calculate the beam energy (intercept of E vs. P)
 	UDouble_t CalculateEbeam(TGraphAsymmErrors** plot = 0);
+	/// Calculate `epsilon`, with the error estimated by refitting resampled measurements
+	UDouble_t ResampleEpsilon(Int_t nsamples = 1000, Int_t type = kBootstrap, UDouble_t* ebeam = 0, UInt_t seed = 1);
+	/// Calculate the beam energy, with the error estimated by refitting resampled measurements
+	UDouble_t ResampleEbeam(Int_t nsamples = 1000, Int_t type = kBootstrap, UInt_t seed = 1);
+	/// Set the number of threads used by ResampleEpsilon() and ResampleEbeam() (0: one per CPU)
+	void SetNumThreads(Int_t n) { fNumThreads = n; }
+	/// Returns the number of threads used by ResampleEpsilon() and ResampleEbeam()
+	Int_t GetNumThreads() const { return fNumThreads; }
   public:
 	/// Convert pressure in torr to dyn/cm^2
 	static Double_t TorrCgs(Double_t torr); // dyn/cm^2
 	/// Convert pressure in torr to dyn/cm^2 (with uncertainty)
 	static UDouble_t TorrCgs(UDouble_t torr); // dyn/cm^2
+	/// Convert pressure in torr to dyn/cm^2 (with sampled uncertainty)
+	static USample_t TorrCgs(const USample_t& torr); // dyn/cm^2
 	/// Calculate target density in atoms/cm^2
 	static Double_t CalculateDensity(Double_t pressure, Double_t length, Int_t nmol, Double_t temp = 300.);
 	/// Calculate target density in atoms/cm^2 (with uncertainty)
 	static UDouble_t CalculateDensity(UDouble_t pressure, UDouble_t length, Int_t nmol, Double_t temp = 300.);
+	/// Calculate target density in atoms/cm^2 (with sampled uncertainty)
+	static USample_t CalculateDensity(const USample_t& pressure, const USample_t& length, Int_t nmol, Double_t temp = 300.);
 	/// Calculate beam energy from MD1 field
 	static UDouble_t CalculateEnergy(Double_t md1, Double_t md1Err, Int_t q, Double_t m,
 									 Double_t cmd1 = 4.815e-7, Double_t cmd1Err = 0.0015*4.815e-7);
+  private:
+	/// Energy vs. pressure points fit by CalculateEbeam()
+	void GetEbeamPoints(std::vector<UDouble_t>& pres, std::vector<UDouble_t>& energy) const;
+	/// Energy vs. density points fit by CalculateEpsilon()
+	void GetEpsilonPoints(std::vector<UDouble_t>& dens, std::vector<UDouble_t>& energy) const;
+	/// Slope and offset of a linear fit, with errors from refitting resampled points
+	void Resample(const std::vector<UDouble_t>& x, const std::vector<UDouble_t>& y,
+	              Int_t nsamples, Int_t type, UInt_t seed, UDouble_t& slope, UDouble_t& offset) const;
   private:
 	/// Atomic mass of beam
 	Double_t fBeamMass;
@@ -503,6 +630,8 @@ namespace dragon {
 	std::vector<UDouble_t> fMd1;
 	/// Energy measurements
 	std::vector<UDouble_t> fEnergies;
+	/// Number of threads for resampling
+	Int_t fNumThreads;
   };
 
 
@@ -518,8 +647,22 @@ namespace dragon {
    * run or a chain of runs. This class also calculates the live
    * time for coincidences. For more information about how this is
    * done, see the dragon::CoincBusytime class documentation
+   *
+   * By default (kStreaming), the head and tail trees are read in a single
+   * merged pass in trigger time order, accumulating the coincidence busy time
+   * on the fly in constant memory. If either tree turns out not to be time
+   * ordered, the calculation falls back to collecting all events in a
+   * dragon::CoincBusytime and sorting them (kSort). For a whole run, neither
+   * is needed if the file has a dragon::RunSummary.
    */
   class LiveTimeCalculator {
+  public:
+	/// Coincidence busy time algorithms
+	enum Algorithm_t {
+      kStreaming = 0, ///< Merge the (time ordered) head and tail trees in one pass
+      kSort = 1       ///< Collect and sort all events (dragon::CoincBusytime)
+	};
+
   public:
 	/// Empty
 	LiveTimeCalculator();
@@ -528,10 +671,15 @@ namespace dragon {
 
 	/// Perform live time calculation across an entire run
 	void Calculate();
-	/// Perform live time calculation across a subset of the run
+	/// Perform live time calculation across a subset of the run (see also dragon::RunQuery)
 	void CalculateSub(Double_t tbegin, Double_t tend);
 	/// Perform live time calculation across a chain of runs
-	void CalculateChain(TChain* chain);
+	void CalculateChain(TChain* chain, Int_t nthreads = 0);
+
+	/// Set the coincidence busy time algorithm
+	void SetAlgorithm(Algorithm_t algorithm) { fAlgorithm = algorithm; }
+	/// Returns the coincidence busy time algorithm
+	Algorithm_t GetAlgorithm() const { return fAlgorithm; }
 
 	/// Returns the sum of busy times during the run (or subrun) in seconds
 	Double_t GetBusytime(const char* which) const; // seconds
@@ -567,10 +715,18 @@ namespace dragon {
 	Bool_t CheckFile(TTree*& t1, TTree*& t3, midas::Database*& db);
 	/// Does the work of live time calculations
 	void DoCalculate(Double_t tbegin, Double_t tend);
+	/// Merge the head and tail trees in trigger time order (kStreaming)
+	Int_t MergeBusytime(TTree** trees, const Double_t* trigStart, Bool_t isFull,
+                        Double_t tbegin, Double_t tend, Double_t* busy);
+	/// Collect and sort the events of the head and tail trees (kSort)
+	Int_t SortBusytime(TTree** trees, const Double_t* trigStart, Bool_t isFull,
+                       Double_t tbegin, Double_t tend, Double_t* busy);
 
   private:
 	/// Run file (no ownership)
 	TFile* fFile;
+	/// Coincidence busy time algorithm
+	Algorithm_t fAlgorithm;
 	/// Run times
 	Double_t fRuntime [3];
 	/// Busy times
@@ -642,6 +798,257 @@ namespace dragon {
 	Bool_t fIsSorted;
   };
 
+  /// Run totals accumulated by `mid2root` while converting a run
+  /*!
+   * Live times, surface barrier counts, run times and scaler sums otherwise
+   * need the \c t1 and \c t3 trees and the ODB dumps of every run to be read
+   * again. `mid2root` adds each head, tail, coincidence and scaler entry to a
+   * summary as it fills the trees (Fill()), and writes it as "summary" once the
+   * run is complete (Finish()). LiveTimeCalculator::Calculate() and
+   * BeamNorm::ReadSbCounts() use the summary of a file if Read() finds one,
+   * and scan the trees otherwise.
+   *
+   * The surface barrier hits are kept one by one (energy and time), so counts
+   * in any energy window are the same as from the tree; head and tail busy
+   * times are also kept per second of trigger time, for parts of the run
+   * starting and ending on whole seconds.
+   *
+   * Since version 2 the summary also holds a time series of the run, for
+   * dragon::RunQuery: the head, tail and coincidence triggers per second, with
+   * the tree entry of the first event in each second (so that part of a second
+   * is read from the tree directly), the trigger time of each surface barrier
+   * hit, the scaler counts of every read period and all EPICS readings. Files
+   * converted before then are summarized from their trees by Build().
+   */
+  class RunSummary: public TNamed {
+  public:
+	/// Empty summary, named "summary"
+	RunSummary();
+
+	/// Add the tree entry of event code \e code (the object bound to the tree at \e addr)
+	void Fill(Int_t code, const void* addr);
+	/// Calculate the run totals, once all entries have been added
+	Bool_t Finish(midas::Database* odbstop, Long64_t nhead, Long64_t ntail, Long64_t ncoinc);
+
+	/// Read the summary of a run file, if it matches the trees in the file
+	static RunSummary* Read(TFile* file);
+	/// Summarize a run file from its trees
+	static RunSummary* Build(TFile* file);
+	/// Get the summary of a run file with a time series, from the file, a summary file next to it, or by Build()
+	static RunSummary* Get(const char* filename);
+	/// Enable or disable the use of summaries (Read() returns 0 if disabled)
+	static void SetEnabled(Bool_t enabled) { fgEnabled = enabled; }
+	/// Check if summaries are used
+	static Bool_t IsEnabled() { return fgEnabled; }
+
+	/// Returns the run number
+	Int_t GetRunNumber() const { return fRunNumber; }
+	/// Returns the (computer clock) run start time, seconds since the epoch
+	Int_t GetRunStart() const { return fRunStart; }
+	/// Returns the (computer clock) run stop time, seconds since the epoch
+	Int_t GetRunStop() const { return fRunStop; }
+	/// Returns the number of \c t1, \c t3 or \c t5 entries ("head", "tail" or "coinc")
+	Long64_t GetEntries(const char* which) const;
+	/// Returns the trigger start time, as LiveTimeCalculator::CalculateRuntime()
+	Double_t GetTriggerStart(const char* which) const;
+	/// Returns the trigger stop time, as LiveTimeCalculator::CalculateRuntime()
+	Double_t GetTriggerStop(const char* which) const;
+	/// Returns the run time in seconds
+	Double_t GetRuntime(const char* which) const;
+	/// Returns the busy time of the whole run in seconds
+	Double_t GetBusytime(const char* which) const;
+	/// Returns the head or tail busy time in part of the run, in seconds
+	Double_t GetBusytime(const char* which, Double_t tbegin, Double_t tend) const;
+	/// Returns the live time fraction of the whole run
+	Double_t GetLivetime(const char* which) const;
+	/// Returns the number of tail events with a surface barrier energy in a window
+	Long64_t GetSbCounts(Int_t detector, Double_t low, Double_t high, Double_t time = -1) const;
+	/// Returns the run total of a scaler channel ("head", "tail" or "aux")
+	UInt_t GetScalerSum(const char* which, Int_t channel) const;
+
+	/// Check if the summary has the time series (version 2 and later)
+	Bool_t HasTimeSeries() const { return fHaveSeries; }
+	/// Returns the number of seconds of trigger time covered by the time series
+	Int_t GetNumSeconds() const;
+	/// Returns the number of head, tail or coincidence triggers in part of the run
+	Long64_t GetTriggers(const char* which, Double_t tbegin, Double_t tend) const;
+	/// Returns the \c t1, \c t3 or \c t5 entry of the first event in a second of trigger time
+	Long64_t GetFirstEntry(const char* which, Int_t second) const;
+	/// Returns the offset subtracted from `io32.tsc4.trig_time` to give the trigger time (microseconds)
+	Double_t GetTimeOffset(const char* which) const;
+	/// Returns the number of tail events with a surface barrier energy in a window, in part of the run
+	Long64_t GetSbCounts(Int_t detector, Double_t low, Double_t high, Double_t tbegin, Double_t tend) const;
+	/// Returns the counts of a scaler channel in part of the run
+	Double_t GetScalerSum(const char* which, Int_t channel, Double_t tbegin, Double_t tend) const;
+	/// Returns the EPICS readings of a channel in part of the run
+	Int_t GetEpicsReadings(Int_t channel, Double_t tbegin, Double_t tend,
+	                       std::vector<Double_t>& times, std::vector<Double_t>& values) const;
+
+  private:
+	/// Check if the numbers of entries match the trees of a run file
+	Bool_t Matches(TFile* file) const;
+	/// Returns the per-second triggers of "head", "tail" or "coinc" (0 if invalid)
+	const std::vector<Int_t>* GetTriggerSeries(const char* which, const char* func) const;
+
+  private:
+	/// Complete, i.e. Finish() succeeded
+	Bool_t fComplete;
+	/// Run number
+	Int_t fRunNumber;
+	/// Computer clock run start and stop times
+	Int_t fRunStart, fRunStop;
+	/// Head, tail and coincidence entries
+	Long64_t fEntries[3];
+	/// Head, tail and coincidence trigger start and stop times
+	Double_t fTriggerStart[3], fTriggerStop[3];
+	/// Head, tail and coincidence busy times, seconds
+	Double_t fBusytime[3];
+	/// Head busy time in each second after the trigger start
+	std::vector<Double_t> fHeadBusy;
+	/// Tail busy time in each second after the trigger start
+	std::vector<Double_t> fTailBusy;
+	/// Timestamp of the first tail event
+	UInt_t fTailStart;
+	/// Surface barrier of each hit
+	std::vector<Char_t> fSbDetector;
+	/// Surface barrier energy of each hit
+	std::vector<Double_t> fSbEnergy;
+	/// Seconds between the first tail event and each hit
+	std::vector<Int_t> fSbTime;
+	/// Last head, tail and aux scaler sums
+	UInt_t fScalerSum[3][dragon::Scaler::MAX_CHANNELS];
+
+	/// Time series filled, i.e. written by version 2 or later
+	Bool_t fHaveSeries;
+	/// Head, tail and coincidence offsets of `io32.tsc4.trig_time` (microseconds)
+	Double_t fTimeOffset[3];
+	/// Head triggers in each second after the trigger start
+	std::vector<Int_t> fHeadTriggers;
+	/// Tail triggers in each second after the trigger start
+	std::vector<Int_t> fTailTriggers;
+	/// Coincidences in each second after the (head) trigger start
+	std::vector<Int_t> fCoincTriggers;
+	/// \c t1 entry of the first event in each second, and the number of entries; empty if not in time order
+	std::vector<Long64_t> fHeadFirst;
+	/// \c t3 entry of the first event in each second, and the number of entries; empty if not in time order
+	std::vector<Long64_t> fTailFirst;
+	/// \c t5 entry of the first event in each second, and the number of entries; empty if not in time order
+	std::vector<Long64_t> fCoincFirst;
+	/// Trigger time of each surface barrier hit, seconds (microseconds until Finish())
+	std::vector<Double_t> fSbTrigger;
+	/// Head scaler counts of each read period, \c MAX_CHANNELS per period
+	std::vector<UInt_t> fHeadScalers;
+	/// Tail scaler counts of each read period, \c MAX_CHANNELS per period
+	std::vector<UInt_t> fTailScalers;
+	/// Aux scaler counts of each read period, \c MAX_CHANNELS per period
+	std::vector<UInt_t> fAuxScalers;
+	/// Computer clock time of each EPICS reading
+	std::vector<UInt_t> fEpicsTime;
+	/// Channel of each EPICS reading
+	std::vector<Int_t> fEpicsChannel;
+	/// Value of each EPICS reading
+	std::vector<Float_t> fEpicsValue;
+
+	/// Head and tail trigger times until Finish()
+	std::vector<Double_t> fTrigger[2]; //!
+	/// Head and tail busy times until Finish()
+	std::vector<UInt_t> fBusy[2]; //!
+	/// Coincidence (head) trigger times until Finish()
+	std::vector<Double_t> fCoincTrigger; //!
+	/// Use summaries?
+	static Bool_t fgEnabled; //!
+
+	ClassDef(RunSummary, 2);
+  };
+
+  /// Time-window queries over a range of runs
+  /*!
+   * Answers questions such as "tail triggers and live time per 10 minutes across
+   * runs 1000 - 1100" from the time series of the run summaries (RunSummary::Get(),
+   * which summarizes each run from its trees once if needed). Whole seconds of
+   * trigger time are added up from the summaries; only the partial seconds at each
+   * end of a window are read from the \c t1, \c t3 or \c t5 trees, so a query
+   * reads at most two seconds of events per run.
+   * \code
+   * dragon::RunQuery query(1000, 1100);
+   * for(Double_t t = query.GetStart(); t < query.GetStop(); t += 600) {
+   *   Long64_t n = query.GetTriggers("tail", t, t + 600);
+   *   Double_t live = query.GetLivetime("tail", t, t + 600);
+   *   ...
+   * }
+   * \endcode
+   * Windows are in seconds since the epoch, like the MIDAS run start time, and
+   * include their start but not their end. Within a run, trigger times are
+   * counted from the start of the run as in LiveTimeCalculator::CalculateSub(),
+   * and scaler and EPICS readings are placed on the computer clock, so different
+   * quantities line up to about a second. Scaler counts are known per read period
+   * only (one second, see Scaler::plot()): periods partly in the window count in
+   * proportion.
+   */
+  class RunQuery {
+  public:
+	/// Query runs \e runnumbers
+	RunQuery(const std::vector<Int_t>& runnumbers, const char* format = "$DH/rootfiles/run%d.root");
+	/// Query runs \e first to \e last, skipping runs without a file
+	RunQuery(Int_t first, Int_t last, const char* format = "$DH/rootfiles/run%d.root");
+	/// Close the run files
+	~RunQuery();
+
+	/// Returns the number of runs with a summary
+	Int_t GetNumRuns() const { return fRuns.size(); }
+	/// Returns the run number of run \e i
+	Int_t GetRunNumber(Int_t i) const { return fRuns.at(i).fSummary->GetRunNumber(); }
+	/// Returns the summary of run \e i
+	const RunSummary* GetSummary(Int_t i) const { return fRuns.at(i).fSummary; }
+	/// Returns the start time of the first run (seconds since the epoch)
+	Double_t GetStart() const;
+	/// Returns the stop time of the last run (seconds since the epoch)
+	Double_t GetStop() const;
+
+	/// Returns the number of head, tail or coincidence triggers in a window
+	Long64_t GetTriggers(const char* which, Double_t tbegin, Double_t tend);
+	/// Returns the head or tail busy time in a window, in seconds
+	Double_t GetBusytime(const char* which, Double_t tbegin, Double_t tend);
+	/// Returns the head, tail or coincidence run time in a window, in seconds
+	Double_t GetRuntime(const char* which, Double_t tbegin, Double_t tend) const;
+	/// Returns the head or tail live time fraction in a window
+	Double_t GetLivetime(const char* which, Double_t tbegin, Double_t tend);
+	/// Returns the number of tail events with a surface barrier energy in a window
+	Long64_t GetSbCounts(Int_t detector, Double_t low, Double_t high, Double_t tbegin, Double_t tend) const;
+	/// Returns the counts of a scaler channel ("head", "tail" or "aux") in a window
+	Double_t GetScalerSum(const char* which, Int_t channel, Double_t tbegin, Double_t tend) const;
+	/// Returns the EPICS readings of a channel in a window
+	Int_t GetEpicsReadings(Int_t channel, Double_t tbegin, Double_t tend,
+	                       std::vector<Double_t>& times, std::vector<Double_t>& values) const;
+	/// Returns the mean of the EPICS readings of a channel in a window
+	Double_t GetEpicsMean(Int_t channel, Double_t tbegin, Double_t tend) const;
+
+  private:
+	/// A run and its summary
+	struct Run_t {
+      TString fFileName;     ///< Run file
+      RunSummary* fSummary;  ///< Summary, owned
+      TFile* fFile;          ///< Run file, opened (and owned) when the trees are needed
+	};
+
+  private:
+	/// Load the summaries of runs
+	void Init(const std::vector<Int_t>& runnumbers, const char* format);
+	/// Triggers and busy time of a run in a window of trigger time
+	Bool_t Count(Run_t& run, Int_t indx, Double_t tbegin, Double_t tend, Long64_t& triggers, Double_t& busy);
+	/// Add the events in part of one second of trigger time, from the tree
+	Bool_t CountEdge(Run_t& run, Int_t indx, Int_t second, Double_t tbegin, Double_t tend,
+	                 Long64_t& triggers, Double_t& busy);
+	/// No copy
+	RunQuery(const RunQuery&);
+	/// No assign
+	RunQuery& operator= (const RunQuery&);
+
+  private:
+	/// Runs with a summary, in the order given
+	std::vector<Run_t> fRuns;
+  };
+
 
   /// Class to calculate resonance strength (omega-gamma) from yield & stopping power measurements.
   class ResonanceStrengthCalculator {
@@ -669,6 +1076,10 @@ namespace dragon {
 	Double_t GetResonanceEnergy() const { return fResonanceEnergy; }    // keV
 	/// Set the resonance energy in keV
 	void SetResonanceEnergy(Double_t mass) { fResonanceEnergy = mass; } // keV
+	/// Returns fMonteCarlo
+	Bool_t GetMonteCarlo() const { return fMonteCarlo; }
+	/// Propagate uncertainties by sampling (USample_t) instead of linearly
+	void SetMonteCarlo(Bool_t on) { fMonteCarlo = on; }
 	UDouble_t CalculateResonanceStrength(Int_t whichSb, Int_t type = kHiSingles, Bool_t print = kTRUE); // type: 1 = gamma sing., 3 = hi sing. 5 = coinc.
 	TGraph* PlotResonanceStrength(Int_t whichSb);
 
@@ -677,6 +1088,9 @@ namespace dragon {
 	static UDouble_t LambdaSquared(UDouble_t eres /*keV*/, Double_t mbeam /*amu*/, Double_t mtarget /*amu*/); // cm<sup>2</sup>
 	static UDouble_t CalculateResonanceStrength(UDouble_t yield, UDouble_t epsilon, UDouble_t wavelength,
                                                 Double_t mbeam, Double_t mtarget); // eV
+	static USample_t CalculateWavelength(const USample_t& eres /*keV*/, Double_t mbeam /*amu*/, Double_t mtarget /*amu*/); // cm
+	static USample_t CalculateResonanceStrength(const USample_t& yield, const USample_t& epsilon, const USample_t& wavelength,
+                                                Double_t mbeam, Double_t mtarget); // eV
 
   private:
 	BeamNorm* fBeamNorm;
@@ -684,6 +1098,7 @@ namespace dragon {
 	Double_t fBeamMass;
 	Double_t fTargetMass;
 	Double_t fResonanceEnergy;  ///\todo should have uncertainty
+	Bool_t fMonteCarlo;
   };
 
   /// Class to calculate cross sections from target data and yield.
@@ -703,8 +1118,15 @@ namespace dragon {
 	/// Print run-by-run cross sections
 	void Print();
 
+	/// Returns fMonteCarlo
+	Bool_t GetMonteCarlo() const { return fMonteCarlo; }
+	/// Propagate uncertainties by sampling (USample_t) instead of linearly
+	void SetMonteCarlo(Bool_t on) { fMonteCarlo = on; }
+
 	/// Calculate cross section in barns
 	static UDouble_t CalculateCrossSection(UDouble_t yield, UDouble_t pressure, Double_t length, Int_t nmol, Double_t temp = 300.);
+	/// Calculate cross section in barns (with sampled uncertainty)
+	static USample_t CalculateCrossSection(const USample_t& yield, const USample_t& pressure, Double_t length, Int_t nmol, Double_t temp = 300.);
 
   private:
 	/// Pointer to constructed beam norm class, takes no ownership
@@ -721,6 +1143,8 @@ namespace dragon {
 	UDouble_t fTotalCrossSection;
 	/// Cross section unit prefix
 	std::string fPrefix;
+	/// Propagate uncertainties by sampling
+	Bool_t fMonteCarlo;
   };
 
 
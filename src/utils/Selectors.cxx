@@ -2,7 +2,18 @@
 /// \file Selectors.cxx
 /// \brief Implements selector classes
 ///
+#include <memory>
+#include <vector>
+#include <typeinfo>
+#include <algorithm>
+#include <TClass.h>
+#include <TThread.h>
+#include <TSystem.h>
+#include <TTreeCache.h>
+#include <TMethodCall.h>
+#include <TChainElement.h>
 #include "midas/Database.hxx"
+#include "ErrorDragon.hxx"
 #include "Selectors.hxx"
 
 
@@ -94,6 +105,20 @@ void dragon::ASelector::Init(TTree*)
 	AbstractMethod("Init");
 }
 
+dragon::ASelector* dragon::ASelector::MakeWorker() const
+{
+	//! Create a worker for ProcessMT()
+	///
+	/// The default creates a new instance of the (most derived) class of this
+	/// selector through its dictionary, using the default constructor. Derived
+	/// classes which need constructor arguments should override this, and those
+	/// which cannot run in parallel should return 0.
+	///
+	/// \returns New selector owned by the caller, 0 if not possible
+	TClass* cl = TClass::GetClass(typeid(*this));
+	return cl ? static_cast<ASelector*>(cl->New()) : 0;
+}
+
 void dragon::HeadSelector::Init(TTree *tree)
 {
 	/// See ASelector::Init()
@@ -545,3 +570,257 @@ dragon::DsssdCalibrate::~DsssdCalibrate()
 		fDsssd5 = 0;
 	}
 }
+
+
+
+// =========== Function dragon::ProcessMT ============ //
+
+namespace {
+
+/// Range of (chain) entries to process
+struct EntryRange_t { Long64_t fFirst, fLast; };
+
+/// Worker of ProcessMT()
+struct Worker_t {
+	dragon::ASelector* fSelector; ///< selector (fSelector->fChain is fChain)
+	TChain* fChain;               ///< own copy of the input chain
+	std::vector<EntryRange_t>* fRanges; ///< ranges to process (shared)
+	size_t* fNext;                ///< next range (shared)
+	Long64_t fProcessed;          ///< number of processed entries
+};
+
+/// Make a chain over the files of a tree or chain, 0 if the tree is not from a file
+TChain* clone_chain(TTree* in)
+{
+	TChain* out = new TChain(in->GetName(), in->GetTitle());
+	if(in->InheritsFrom(TChain::Class())) {
+		TObjArray* files = static_cast<TChain*>(in)->GetListOfFiles();
+		for(Int_t i=0; i< files->GetEntries(); ++i) {
+			TChainElement* element = static_cast<TChainElement*>(files->At(i));
+			out->AddFile(element->GetTitle(), element->GetEntries(), element->GetName());
+		}
+	}
+	else if(in->GetCurrentFile() && in->GetDirectory() == in->GetCurrentFile()) {
+		out->AddFile(in->GetCurrentFile()->GetName(), in->GetEntries());
+	}
+	else {
+		delete out;
+		return 0;
+	}
+	out->SetDirectory(0);
+	return out;
+}
+
+/// Process entries [first, last) of a worker's chain
+Long64_t process_entries(dragon::ASelector* selector, TChain* chain, Long64_t first, Long64_t last)
+{
+	Long64_t n = 0;
+	for(Long64_t entry = first; entry < last; ++entry) {
+		Long64_t local = chain->LoadTree(entry); // (calls selector->Notify() on new files)
+		if(local < 0) break;
+		selector->Process(local);
+		++n;
+		if(selector->GetAbort() != TSelector::kContinue) break;
+	}
+	return n;
+}
+
+/// Thread function: take ranges until there are none left
+void* run_worker(void* input)
+{
+	Worker_t* worker = static_cast<Worker_t*>(input);
+	while(worker->fSelector->GetAbort() == TSelector::kContinue) {
+		size_t i;
+		TThread::Lock();
+		i = (*worker->fNext)++;
+		TThread::UnLock();
+		if(i >= worker->fRanges->size()) break;
+		const EntryRange_t& range = worker->fRanges->at(i);
+		worker->fProcessed += process_entries(worker->fSelector, worker->fChain, range.fFirst, range.fLast);
+	}
+	return 0;
+}
+
+/// Move the objects of a worker's output list into the master's, merging objects
+/// of the same name with their Merge(TCollection*) method
+void merge_output(TList* into, TList* from)
+{
+	while(from->GetSize()) {
+		TObject* obj = from->First();
+		from->Remove(obj);
+		TObject* target = into->FindObject(obj->GetName());
+		if(!target) {
+			into->Add(obj);
+			continue;
+		}
+		TMethodCall merge(target->IsA(), "Merge", "TCollection*");
+		if(merge.IsValid()) {
+			TList list;
+			list.Add(obj);
+			merge.SetParam((Long_t)&list);
+			merge.Execute(target);
+		}
+		else {
+			dragon::utils::Warning("ProcessMT", __FILE__, __LINE__)
+				<< "Output object \"" << obj->GetName() << "\" of class " << obj->ClassName()
+				<< " has no Merge() method, keeping only the first copy.";
+		}
+		delete obj;
+	}
+}
+
+/// Disable all branches of the chains except those read (during the learning
+/// phase of the read cache) in the first one
+void prune_branches(std::vector<Worker_t>& workers)
+{
+	TChain* chain = workers[0].fChain;
+	TFile* file = chain->GetCurrentFile();
+	TTreeCache* cache = file ? dynamic_cast<TTreeCache*>(file->GetCacheRead(chain->GetTree())) : 0;
+	if(!cache && file) cache = dynamic_cast<TTreeCache*>(file->GetCacheRead(chain));
+	const TObjArray* branches = cache ? cache->GetCachedBranches() : 0;
+	if(!branches || !branches->GetEntries()) return;
+
+	dragon::utils::Info("ProcessMT")
+		<< "Reading " << branches->GetEntries() << " of " << chain->GetNbranches() << " branches.";
+	for(size_t i=0; i< workers.size(); ++i) {
+		workers[i].fChain->SetBranchStatus("*", 0);
+		for(Int_t j=0; j< branches->GetEntries(); ++j)
+			workers[i].fChain->SetBranchStatus(branches->At(j)->GetName(), 1);
+	}
+}
+
+} // namespace
+
+Long64_t dragon::ProcessMT(TTree* tree, ASelector* selector, Int_t nthreads,
+													 Long64_t nlearn, Option_t* option)
+{
+	//! Process a tree or chain in parallel with copies of a selector
+	///
+	/// The entries are split into ranges on cluster boundaries, which are processed
+	/// by _nthreads_ workers made with ASelector::MakeWorker(). Each worker reads its
+	/// own copy of the input files. The selector protocol is the one used by PROOF:
+	/// Begin() and Terminate() are called for _selector_ only; Init(), SlaveBegin(),
+	/// Notify(), Process() and SlaveTerminate() for each worker. The output lists of
+	/// the workers are merged (by object name) into the output list of _selector_
+	/// before Terminate() is called.
+	///
+	/// If _nlearn_ is positive, the first _nlearn_ entries (at most the first file)
+	/// are processed before starting the other workers, recording which branches are
+	/// read (by the learning phase of TTreeCache); all other branches are then
+	/// disabled. This only helps selectors that read their branches individually,
+	/// e.g. `b_hi_dsssd_efront->GetEntry(entry)`, or that call GetEntry() for only
+	/// some of the entries in a way that is decided by other branches.
+	///
+	/// If the selector cannot make workers (or _nthreads_ is 1), the entries are
+	/// processed in the calling thread by _selector_ itself.
+	///
+	/// \param tree Tree or chain to process, must be read from file(s)
+	/// \param selector Selector
+	/// \param nthreads Number of threads, 0 for one per CPU
+	/// \param nlearn Number of entries for recording the used branches, 0 to read all
+	/// \param option Option passed to the selectors, see TSelector::GetOption()
+	/// \returns Number of processed entries, -1 for errors
+	std::auto_ptr<TChain> master (clone_chain(tree));
+	if(!master.get()) {
+		utils::Error("ProcessMT", __FILE__, __LINE__)
+			<< "TTree \"" << tree->GetName() << "\" is not read from a file.";
+		return -1;
+	}
+	if(nthreads <= 0) {
+		SysInfo_t info;
+		nthreads = gSystem->GetSysInfo(&info) == 0 && info.fCpus > 0 ? info.fCpus : 1;
+	}
+
+	// Split the entries into clusters, skipping the learning entries
+	std::vector<EntryRange_t> ranges;
+	const Long64_t nentries = master->GetEntries();
+	for(Int_t t=0; t< master->GetNtrees(); ++t) {
+		Long64_t offset = master->GetTreeOffset()[t];
+		if(master->LoadTree(offset) < 0 || master->GetTreeNumber() != t) continue;
+		if(t == 0) nlearn = std::min(std::max(nlearn, (Long64_t)0), master->GetTree()->GetEntries());
+		TTree::TClusterIterator clusters = master->GetTree()->GetClusterIterator(0);
+		Long64_t first;
+		while((first = clusters.Next()) < master->GetTree()->GetEntries()) {
+			EntryRange_t range = { std::max(offset + first, nlearn),
+														 std::min(offset + clusters.GetNextEntry(), nentries) };
+			if(range.fLast > range.fFirst) ranges.push_back(range);
+		}
+	}
+
+	// Make the workers, the first one is the selector itself if there are no others
+	size_t next = 0;
+	std::vector<Worker_t> workers;
+	for(Int_t i=0; i< nthreads; ++i) {
+		ASelector* sel = nthreads > 1 ? selector->MakeWorker() : 0;
+		if(!sel && i) break;
+		Worker_t worker = { sel ? sel : selector, i ? clone_chain(tree) : master.release(), &ranges, &next, 0 };
+		workers.push_back(worker);
+		if(!sel) break;
+	}
+	const Bool_t haveWorkers = workers[0].fSelector != selector;
+	if(!haveWorkers && nthreads > 1)
+		utils::Warning("ProcessMT", __FILE__, __LINE__)
+			<< "Selector of class " << selector->ClassName() << " cannot run in parallel, using one thread.";
+
+	selector->SetOption(option);
+	selector->Begin(tree);
+	for(size_t i=0; i< workers.size(); ++i) {
+		ASelector* sel = workers[i].fSelector;
+		TChain* chain = workers[i].fChain;
+		if(sel != selector) {
+			sel->SetOption(option);
+			sel->SetInputList(selector->GetInputList());
+		}
+		sel->Init(chain);
+		sel->SlaveBegin(chain);
+		chain->SetNotify(sel);
+	}
+
+	// Learning phase, in the first worker
+	if(nlearn > 0) {
+		Int_t learnEntries = TTreeCache::GetLearnEntries();
+		TTreeCache::SetLearnEntries((Int_t)nlearn);
+		workers[0].fChain->SetCacheSize(30000000);
+		workers[0].fProcessed += process_entries(workers[0].fSelector, workers[0].fChain, 0, nlearn);
+		prune_branches(workers);
+		TTreeCache::SetLearnEntries(learnEntries);
+	}
+
+	// Run in parallel
+	if(workers.size() == 1) {
+		run_worker(&workers[0]);
+	}
+	else {
+		std::vector<TThread*> threads;
+		for(size_t i=0; i< workers.size(); ++i) {
+			threads.push_back(new TThread(run_worker, &workers[i]));
+			threads.back()->Run();
+		}
+		for(size_t i=0; i< threads.size(); ++i) {
+			threads[i]->Join();
+			delete threads[i];
+		}
+	}
+
+	// Merge & clean up
+	Long64_t nprocessed = 0;
+	for(size_t i=0; i< workers.size(); ++i) {
+		ASelector* sel = workers[i].fSelector;
+		sel->SlaveTerminate();
+		if(sel != selector) {
+			merge_output(selector->GetOutputList(), sel->GetOutputList());
+			delete sel;
+		}
+		workers[i].fChain->SetNotify(0);
+		nprocessed += workers[i].fProcessed;
+	}
+	selector->Terminate();
+	for(size_t i=0; i< workers.size(); ++i) {
+		if(selector->fChain == workers[i].fChain) {
+			selector->fChain->ResetBranchAddresses();
+			selector->fChain = 0;
+		}
+		delete workers[i].fChain;
+	}
+	return nprocessed;
+}
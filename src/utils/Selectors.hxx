@@ -26,6 +26,12 @@ namespace midas { class Database; }
 namespace dragon {
 
 //! Generic selector class
+
+/// Besides the usual `TTree::Process()`, selectors can be run in parallel over a tree
+/// or chain with ProcessMT(). For this, derived classes should follow the PROOF
+/// conventions: create their output objects in SlaveBegin(), add them to fOutput, and
+/// retrieve them from fOutput in Terminate(); Process() must only modify data members
+/// of the selector.
 class ASelector : public TSelector {
 public :
 	TTree          *fChain;   //! <pointer to the analyzed TTree or TChain
@@ -45,6 +51,7 @@ public:
 	virtual TList  *GetOutputList() const { return fOutput; }
 	virtual void    SlaveTerminate() { }
 	virtual void    Terminate();
+	virtual ASelector* MakeWorker() const;
 
 	ClassDef(ASelector,0);
 };
@@ -659,6 +666,8 @@ public:
 	Bool_t Notify();
 	///
 	void Terminate();
+	/// Not parallelizable (output files follow the input files)
+	ASelector* MakeWorker() const { return 0; }
 
 private:
 	/// Constructor helper
@@ -667,6 +676,10 @@ private:
 	void ProcessEntry(TTree* tout, Dsssd* dsssd, vme::V792* adc);
 };
 
+/// Process a tree or chain in parallel with copies of a selector
+Long64_t ProcessMT(TTree* tree, ASelector* selector, Int_t nthreads = 0,
+									 Long64_t nlearn = 0, Option_t* option = "");
+
 } // namespace dragon
 
 
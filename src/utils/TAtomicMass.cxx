@@ -6,39 +6,38 @@
 #include <string>
 #include <sstream>
 #include <iostream>
+#include <cstring>
+#include <cstdlib>
 #include <algorithm>
 #include "TAtomicMass.h"
 
 
 namespace {
-	inline TAtomicMassTable::Nucleus_t make_nucleus_az(int Z, int A) {
-		TAtomicMassTable::Nucleus_t nuc;
-		nuc.fA = A;
-		nuc.fZ = Z;
-		nuc.fN = A-Z;
-		sprintf(nuc.fSymbol, "XX");
-
-		return nuc;
+	// Built-in table (kAmeEntries, kAmeZ, kAmeElements), generated from mass16.txt
+#include "AmeTable.inc"
+
+	const int kNumSymbols = 28 * 27;
+
+	/// Index of an element symbol ("n", "H", "He", ...) in the element table, -1 if not a symbol
+	/*! \note Must agree with symbol_index() in ame2table.awk */
+	inline int symbol_index(const char* sym) {
+		static const char first[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZn";
+		const char* c0 = sym[0] ? strchr(first, sym[0]) : 0;
+		if (!c0) return -1;
+		const int index = 27 * (c0 - first + 1);
+		if (!sym[1]) return index;
+		if (sym[1] < 'a' || sym[1] > 'z' || sym[2]) return -1;
+		return index + (sym[1] - 'a' + 1);
 	}
 
-	class MatchSymbol {
-		std::string fSymbol;
-	public:
-		MatchSymbol(const char* symbol): fSymbol(symbol) {
-			if(fSymbol == "n") fSymbol = "1n";
-			if(fSymbol == "p") fSymbol = "1H";
-			if(fSymbol == "d") fSymbol = "2H";
-			if(fSymbol == "t") fSymbol = "3H";
-			if(fSymbol == "a") fSymbol = "4He";
-		}
-		bool operator() (const std::pair<TAtomicMassTable::Nucleus_t,
-						 TAtomicMassTable::MassExcess_t>& element)
-		{
-			const TAtomicMassTable::Nucleus_t& nuc = element.first;
-			std::stringstream symbol;
-			symbol << nuc.fA << nuc.fSymbol;
-			return symbol.str() == fSymbol;
-		}
+	struct CompareEntry {
+		bool operator() (const TAtomicMassTable::Entry_t& lhs, const TAtomicMassTable::Entry_t& rhs) const
+			{ return TAtomicMassTable::CompareNucleus_t()(lhs.fNucleus, rhs.fNucleus); }
+	};
+
+	struct LessA {
+		bool operator() (const TAtomicMassTable::Entry_t& entry, int A) const
+			{ return entry.fNucleus.fA < A; }
 	}; }
 
 
@@ -50,16 +49,44 @@ bool TAtomicMassTable::CompareNucleus_t::operator()
 	return lhs.fZ < rhs.fZ;
 }
 
-TAtomicMassTable::TAtomicMassTable(const char* file)
+TAtomicMassTable::TAtomicMassTable(const char* file):
+	fEntries(kAmeEntries), fNumEntries(kAmeNumEntries),
+	fZ(kAmeZ), fNumZ(kAmeNumZ), fElements(kAmeElements)
 {
 	SetFile(file);
 }
 
-TAtomicMassTable::TAtomicMassTable()
+TAtomicMassTable::TAtomicMassTable():
+	fEntries(kAmeEntries), fNumEntries(kAmeNumEntries),
+	fZ(kAmeZ), fNumZ(kAmeNumZ), fElements(kAmeElements)
 {
-#ifdef AMEPP_DEFAULT_FILE
-	SetFile(AMEPP_DEFAULT_FILE);
+	;
+}
+
+TAtomicMassTable::TAtomicMassTable(const TAtomicMassTable& other):
+#ifdef USE_ROOT
+	TObject(other),
 #endif
+	fEntries(kAmeEntries), fNumEntries(kAmeNumEntries),
+	fZ(kAmeZ), fNumZ(kAmeNumZ), fElements(kAmeElements)
+{
+	*this = other;
+}
+
+TAtomicMassTable& TAtomicMassTable::operator= (const TAtomicMassTable& other)
+{
+	if(this == &other) return *this;
+	fOwnEntries = other.fOwnEntries;
+	if(other.fElements == kAmeElements) { // built-in: share it
+		fEntries = kAmeEntries;
+		fNumEntries = kAmeNumEntries;
+		fZ = kAmeZ;
+		fNumZ = kAmeNumZ;
+		fElements = kAmeElements;
+	}
+	else
+		Index();
+	return *this;
 }
 
 void TAtomicMassTable::SetFile(const char* filename)
@@ -67,47 +94,113 @@ void TAtomicMassTable::SetFile(const char* filename)
 	ParseFile(filename);
 }
 
+const TAtomicMassTable::Entry_t* TAtomicMassTable::Find(int Z, int A) const
+{
+	if(Z < 0 || Z >= fNumZ) return 0;
+	const ZRange_t& range = fZ[Z];
+	const int i = A - range.fMinA;
+	if(i >= 0 && i < range.fCount && fEntries[range.fFirst + i].fNucleus.fA == A)
+		return fEntries + range.fFirst + i;
+
+	// Not contiguous in A (only possible in a table read from a file)
+	const Entry_t* begin = fEntries + range.fFirst;
+	const Entry_t* end = begin + range.fCount;
+	const Entry_t* it = std::lower_bound(begin, end, A, LessA());
+	return (it != end && it->fNucleus.fA == A) ? it : 0;
+}
+
+const TAtomicMassTable::Entry_t* TAtomicMassTable::Find(const char* symbol) const
+{
+	if(!symbol) return 0;
+	if(!strcmp(symbol, "n")) return Find(0, 1);
+	if(!strcmp(symbol, "p")) return Find(1, 1);
+	if(!strcmp(symbol, "d")) return Find(1, 2);
+	if(!strcmp(symbol, "t")) return Find(1, 3);
+	if(!strcmp(symbol, "a")) return Find(2, 4);
+
+	// Mass number, as printed (no leading zeros), then the element
+	const char* p = symbol;
+	if(*p < '1' || *p > '9') return 0;
+	int A = 0;
+	for(; *p >= '0' && *p <= '9'; ++p) {
+		A = 10*A + (*p - '0');
+		if(A > 9999) return 0;
+	}
+	const int index = symbol_index(p);
+	if(index < 0 || fElements[index] < 0) return 0;
+	return Find(fElements[index], A);
+}
+
 const TAtomicMassTable::Nucleus_t* TAtomicMassTable::GetNucleus(int Z, int A) const
 {
-	Nucleus_t nuc = make_nucleus_az(Z, A);
-	Map_t::const_iterator it = fMassData.find(nuc);
-	return it == fMassData.end() ? 0 : &(it->first);
+	const Entry_t* entry = Find(Z, A);
+	return entry ? &entry->fNucleus : 0;
 }
 
 const TAtomicMassTable::MassExcess_t* TAtomicMassTable::GetMassExcess(int Z, int A) const
 {
-	Nucleus_t nuc = make_nucleus_az(Z, A);
-	Map_t::const_iterator it = fMassData.find(nuc);
-	return it == fMassData.end() ? 0 : &(it->second);
+	const Entry_t* entry = Find(Z, A);
+	return entry ? &entry->fMassExcess : 0;
 }
 
 const TAtomicMassTable::Nucleus_t* TAtomicMassTable::GetNucleus(const char* symbol) const
 {
-	Map_t::const_iterator it = std::find_if(fMassData.begin(), fMassData.end(), MatchSymbol(symbol));
-	return it == fMassData.end() ? 0 : &(it->first);
+	const Entry_t* entry = Find(symbol);
+	return entry ? &entry->fNucleus : 0;
 }
 
 const TAtomicMassTable::MassExcess_t* TAtomicMassTable::GetMassExcess(const char* symbol) const
 {
-	Map_t::const_iterator it = std::find_if(fMassData.begin(), fMassData.end(), MatchSymbol(symbol));
-	return it == fMassData.end() ? 0 : &(it->second);
+	const Entry_t* entry = Find(symbol);
+	return entry ? &entry->fMassExcess : 0;
 }
 
 
 void TAtomicMassTable::SetMassExcess(int Z, int A, double value, double error, bool extrapolated)
 {
-	Nucleus_t nuc = make_nucleus_az(Z, A);
-	Map_t::iterator it = fMassData.find(nuc);
-	if(it != fMassData.end()) {
-		it->second.fValue = value;
-		it->second.fError = error;
-		it->second.fExtrapolated = extrapolated;
+	if(!Find(Z, A)) return;
+	Own();
+	Entry_t* entry = &fOwnEntries[0] + (Find(Z, A) - fEntries);
+	entry->fMassExcess.fValue = value;
+	entry->fMassExcess.fError = error;
+	entry->fMassExcess.fExtrapolated = extrapolated;
+}
+
+void TAtomicMassTable::Own()
+{
+	if(fElements != kAmeElements) return; // already own
+	fOwnEntries.assign(fEntries, fEntries + fNumEntries);
+	Index();
+}
+
+void TAtomicMassTable::Index()
+{
+	fOwnZ.clear();
+	fOwnElements.assign(kNumSymbols, -1);
+	for(size_t i = 0; i< fOwnEntries.size(); ++i) {
+		const Nucleus_t& nuc = fOwnEntries[i].fNucleus;
+		if(nuc.fZ >= int(fOwnZ.size())) {
+			ZRange_t empty = { int(i), 0, 0 };
+			fOwnZ.resize(nuc.fZ + 1, empty);
+		}
+		ZRange_t& range = fOwnZ[nuc.fZ];
+		if(range.fCount++ == 0) {
+			range.fFirst = i;
+			range.fMinA = nuc.fA;
+		}
+		const int index = symbol_index(nuc.fSymbol);
+		if(index >= 0) fOwnElements[index] = nuc.fZ;
 	}
+	fEntries = fOwnEntries.empty() ? 0 : &fOwnEntries[0];
+	fNumEntries = fOwnEntries.size();
+	fZ = fOwnZ.empty() ? 0 : &fOwnZ[0];
+	fNumZ = fOwnZ.size();
+	fElements = &fOwnElements[0];
 }
 
 void TAtomicMassTable::ParseFile(const char* name)
 {
-	std::ifstream ffile(name);
+	std::ifstream ffile(name ? name : "");
 
 	if(!ffile.good()) {
 		if(name)
@@ -120,20 +213,34 @@ void TAtomicMassTable::ParseFile(const char* name)
 	const int num_headers = 39;
 	int linenum = 0;
 	std::string line;
+	std::vector<Entry_t> entries;
 	while(std::getline(ffile, line)) {
 		if(linenum++ < num_headers) // skip headers
 			continue;
-		Nucleus_t nuc;
-		MassExcess_t me;
-		if(ParseLine(line, &nuc, &me) == false) return;
-		std::pair<Map_t::iterator, bool> insrt = fMassData.insert(std::make_pair(nuc, me));
-		if(!insrt.second) {
+		Entry_t entry;
+		if(ParseLine(line, &entry.fNucleus, &entry.fMassExcess) == false) break;
+		if(entry.fNucleus.fZ < 0) break;
+		entries.push_back(entry);
+	}
+
+	// Sort by Z, A; for duplicates keep the first in the file
+	std::stable_sort(entries.begin(), entries.end(), CompareEntry());
+	std::vector<Entry_t>::iterator last = entries.begin();
+	for(std::vector<Entry_t>::iterator it = entries.begin(); it != entries.end(); ++it) {
+		if(it != entries.begin() && !CompareEntry()(*(last-1), *it)) {
+			const Nucleus_t& nuc = it->fNucleus;
+			const Nucleus_t& old = (last-1)->fNucleus;
 			std::cerr << "Error: duplicate nucleus! A, N, Z = "
 					  << nuc.fA << ", " << nuc.fZ << ", " << nuc.fN << " (old): "
-					  << insrt.first->first.fA << ", " << insrt.first->first.fZ << ", " << insrt.first->first.fN << "\n";
-			return;
+					  << old.fA << ", " << old.fZ << ", " << old.fN << "\n";
+			continue;
 		}
+		*last++ = *it;
 	}
+	entries.erase(last, entries.end());
+
+	fOwnEntries.swap(entries);
+	Index();
 }
 
 
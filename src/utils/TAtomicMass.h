@@ -5,7 +5,7 @@
 ///
 #ifndef T_ATOMIC_MASS_H
 #define T_ATOMIC_MASS_H
-#include <map>
+#include <vector>
 #include <memory>
 #include <fstream>
 #include <iostream>
@@ -15,6 +15,15 @@
 
 
 /// Class to extract and calculate atomic mass information from an AME file
+/*!
+ * The AME table the analysis is built with (<tt>src/utils/mass16.txt</tt>) is
+ * compiled in, as a constant array sorted by Z and A (generated by
+ * <tt>src/utils/ame2table.awk</tt>), so constructing a table costs nothing and
+ * the returned pointers stay valid for the life of the program. Nuclei are
+ * looked up directly by Z and A; symbols are split into A and the element, whose
+ * Z is found in a collision-free table indexed by its letters. SetFile() reads
+ * another AME table into a private copy, indexed the same way.
+ */
 class TAtomicMassTable
 #ifdef USE_ROOT
 	: public TObject
@@ -43,24 +52,39 @@ public:
 		bool fExtrapolated;
 	};
 
-	/// Functor for map comparison
+	/// Functor for ordering by Z, then A
 	struct CompareNucleus_t {
 		bool operator() (const Nucleus_t& lhs, const Nucleus_t& rhs) const;
 	};
 
-#ifndef DOXYGEN_SKIP
-private:
-
-	typedef std::map<Nucleus_t, MassExcess_t, CompareNucleus_t> Map_t;
+	/// One nucleus of the table
+	struct Entry_t {
+		/// Nucleus information
+		Nucleus_t fNucleus;
+		/// Mass excess information
+		MassExcess_t fMassExcess;
+	};
 
-#endif // DOXYGEN_SKIP
+	/// Entries with the same Z, for direct lookup by A
+	struct ZRange_t {
+		/// Index of the first entry
+		int fFirst;
+		/// Mass number of the first entry
+		int fMinA;
+		/// Number of entries
+		int fCount;
+	};
 
 public:
-	/// Empty constructor
+	/// Use the built-in table
 	TAtomicMassTable();
 	/// Construct and open AME file
 	TAtomicMassTable(const char* file);
-	/// Opens a new AME file
+	/// Copy, sharing the built-in table
+	TAtomicMassTable(const TAtomicMassTable& other);
+	/// Copy, sharing the built-in table
+	TAtomicMassTable& operator= (const TAtomicMassTable& other);
+	/// Opens a new AME file, replacing the current table
 	void SetFile(const char* filename);
 
 	/// Returns struct containing nucleas information w/ Z, A
@@ -133,16 +157,40 @@ public:
 	static double ElectronMass() { return 510.9989461; } // keV/c^2
 
 private:
-	/// Parses the file defined by <code>file</code> (default <code>AMEPP_DEFAULT_FILE=\"${DRAGONSYS}/src/utils/mass.mas12\"</code>).
+	/// Parses the file defined by <code>file</code>
 	void ParseFile(const char* = 0);
 	/// Parses line <code>line</code> of <code>file</code>
 	bool ParseLine(const std::string&, Nucleus_t*, MassExcess_t*) const;
+	/// Entry for Z, A, or 0 if not in the table
+	const Entry_t* Find(int Z, int A) const;
+	/// Entry for a symbol, e.g. "11Li", or 0 if not in the table
+	const Entry_t* Find(const char* symbol) const;
+	/// Switch to a private copy of the table, before changing it
+	void Own();
+	/// Build the Z ranges and element hash of fOwnEntries, and point to them
+	void Index();
 
 private:
-	Map_t fMassData;
+	/// The entries, sorted by Z then A (built in or fOwnEntries)
+	const Entry_t* fEntries; //!
+	/// Number of entries
+	int fNumEntries; //!
+	/// Entries of each Z, indexed by Z
+	const ZRange_t* fZ; //!
+	/// Length of fZ
+	int fNumZ; //!
+	/// Z of each element symbol, indexed by symbol_index() in TAtomicMass.cxx, -1 if none
+	const short* fElements; //!
+
+	/// Entries read with SetFile() or changed by SetMassExcess()
+	std::vector<Entry_t> fOwnEntries; //!
+	/// Z ranges of fOwnEntries
+	std::vector<ZRange_t> fOwnZ; //!
+	/// Element hash of fOwnEntries
+	std::vector<short> fOwnElements; //!
 
 #ifdef USE_ROOT
-	ClassDef(TAtomicMassTable, 1);
+	ClassDef(TAtomicMassTable, 2);
 #endif
 };
 
@@ -0,0 +1,238 @@
+///
+/// \file Thread.hxx
+/// \brief Minimal POSIX-thread wrappers: mutex, condition, thread and bounded queue,
+///  plus a lock-free single-producer/single-consumer ring.
+/// \details Everything is inline (no library objects); code using these
+///  classes must be compiled and linked with `-pthread`. The ring uses the GCC
+///  `__sync` builtins for its atomic operations.
+///
+#ifndef DRAGON_UTILS_THREAD_HXX
+#define DRAGON_UTILS_THREAD_HXX
+#ifndef __MAKECINT__
+#include <deque>
+#include <vector>
+#include <cassert>
+#include <pthread.h>
+
+namespace dragon { namespace utils {
+
+/// Wrapper for pthread_mutex_t
+class Mutex {
+public:
+	/// Initialize the mutex
+	Mutex()  { pthread_mutex_init(&fMutex, 0); }
+	/// Destroy the mutex
+	~Mutex() { pthread_mutex_destroy(&fMutex); }
+	/// Acquire the mutex
+	void Lock()   { pthread_mutex_lock(&fMutex); }
+	/// Release the mutex
+	void Unlock() { pthread_mutex_unlock(&fMutex); }
+	/// Returns the underlying pthread mutex
+	pthread_mutex_t* Get() { return &fMutex; }
+private:
+	Mutex(const Mutex&);
+	Mutex& operator= (const Mutex&);
+	pthread_mutex_t fMutex;
+};
+
+/// Holds a Mutex locked for the lifetime of the instance
+class ScopedLock {
+public:
+	/// Lock \e mutex
+	ScopedLock(Mutex& mutex): fMutex(mutex) { fMutex.Lock(); }
+	/// Unlock the mutex
+	~ScopedLock() { fMutex.Unlock(); }
+private:
+	ScopedLock(const ScopedLock&);
+	ScopedLock& operator= (const ScopedLock&);
+	Mutex& fMutex;
+};
+
+/// Wrapper for pthread_cond_t
+class Condition {
+public:
+	/// Initialize the condition variable
+	Condition()  { pthread_cond_init(&fCond, 0); }
+	/// Destroy the condition variable
+	~Condition() { pthread_cond_destroy(&fCond); }
+	/// Wait on the condition; \e mutex must be locked by the caller
+	void Wait(Mutex& mutex) { pthread_cond_wait(&fCond, mutex.Get()); }
+	/// Wake one waiting thread
+	void Signal()    { pthread_cond_signal(&fCond); }
+	/// Wake all waiting threads
+	void Broadcast() { pthread_cond_broadcast(&fCond); }
+private:
+	Condition(const Condition&);
+	Condition& operator= (const Condition&);
+	pthread_cond_t fCond;
+};
+
+/// Abstract thread, derived classes implement Run()
+class Thread {
+public:
+	/// Does not start the thread
+	Thread(): fStarted(false) { }
+	/// Empty; call Join() before destroying a started thread
+	virtual ~Thread() { }
+	/// Start executing Run() in a new thread
+	/*! \returns true if the thread was created */
+	bool Start()
+		{
+			assert(!fStarted);
+			fStarted = (pthread_create(&fThread, 0, Thread::Entry, this) == 0);
+			return fStarted;
+		}
+	/// Wait for Run() to return
+	void Join()
+		{
+			if (fStarted) pthread_join(fThread, 0);
+			fStarted = false;
+		}
+protected:
+	/// Thread body
+	virtual void Run() = 0;
+private:
+	/// Entry point passed to pthread_create()
+	static void* Entry(void* arg)
+		{ static_cast<Thread*>(arg)->Run(); return 0; }
+	Thread(const Thread&);
+	Thread& operator= (const Thread&);
+	pthread_t fThread;
+	bool fStarted;
+};
+
+/// Blocking first-in-first-out queue with a maximum size
+/*!
+ * Push() blocks while the queue is full and Pop() blocks while it is empty,
+ * so the queue can be used to connect producer and consumer threads with
+ * back-pressure. After Close(), Push() is refused and Pop() returns false
+ * once the remaining elements have been taken.
+ * \tparam T Element type; should be cheap to copy (typically a pointer).
+ */
+template <class T>
+class BoundedQueue {
+public:
+	/// Set maximum size
+	BoundedQueue(size_t capacity): fCapacity(capacity > 0 ? capacity : 1), fClosed(false) { }
+	/// Append an element, waiting for space
+	/*! \returns false if the queue has been closed (element not added) */
+	bool Push(const T& t)
+		{
+			ScopedLock lock(fMutex);
+			while (fQueue.size() >= fCapacity && !fClosed) fNotFull.Wait(fMutex);
+			if (fClosed) return false;
+			fQueue.push_back(t);
+			fNotEmpty.Signal();
+			return true;
+		}
+	/// Remove the first element, waiting for one to be available
+	/*! \returns false if the queue is closed and empty (\e t unchanged) */
+	bool Pop(T& t)
+		{
+			ScopedLock lock(fMutex);
+			while (fQueue.empty() && !fClosed) fNotEmpty.Wait(fMutex);
+			if (fQueue.empty()) return false;
+			t = fQueue.front();
+			fQueue.pop_front();
+			fNotFull.Signal();
+			return true;
+		}
+	/// Refuse further pushes and wake all waiting threads
+	void Close()
+		{
+			ScopedLock lock(fMutex);
+			fClosed = true;
+			fNotEmpty.Broadcast();
+			fNotFull.Broadcast();
+		}
+	/// Returns the current number of elements
+	size_t Size()
+		{
+			ScopedLock lock(fMutex);
+			return fQueue.size();
+		}
+private:
+	BoundedQueue(const BoundedQueue&);
+	BoundedQueue& operator= (const BoundedQueue&);
+	size_t fCapacity;
+	bool fClosed;
+	std::deque<T> fQueue;
+	Mutex fMutex;
+	Condition fNotEmpty;
+	Condition fNotFull;
+};
+
+/// Lock-free ring buffer with one producer and one consumer thread
+/*!
+ * Push() is only called from the producer thread and Pop() only from the
+ * consumer thread; neither ever blocks or takes a lock, so a slow consumer
+ * cannot stall the producer (and vice versa) other than by letting the ring
+ * fill up (or run empty). DropOldest() lets the producer discard the oldest
+ * element to make room: the consumer claims elements with a compare-and-swap
+ * on the read position, so exactly one of the two gets each element.
+ * \tparam T Element type; must be cheap and safe to copy while it is being
+ *  overwritten (a discarded copy is never used), so in practice a pointer or
+ *  plain integer.
+ */
+template <class T>
+class SpscRing {
+public:
+	/// Allocate space for at least \e capacity elements (rounded up to a power of 2)
+	SpscRing(size_t capacity): fRead(0), fWrite(0)
+		{
+			size_t n = 1;
+			while (n < capacity) n <<= 1;
+			fBuffer.resize(n);
+			fMask = n - 1;
+		}
+	/// Append an element (producer only)
+	/*! \returns false if the ring is full (element not added) */
+	bool Push(const T& t)
+		{
+			const size_t w = fWrite;
+			if (w - fRead > fMask) return false;
+			__sync_synchronize(); // slot is free before it is overwritten
+			fBuffer[w & fMask] = t;
+			__sync_synchronize(); // element is written before it is published
+			fWrite = w + 1;
+			return true;
+		}
+	/// Remove the oldest element (consumer only)
+	/*! \returns false if the ring is empty (\e t unchanged) */
+	bool Pop(T& t) { return Take(t); }
+	/// Remove the oldest element from the producer side, e.g. to make room
+	/*! \returns false if the ring is empty (\e t unchanged) */
+	bool DropOldest(T& t) { return Take(t); }
+	/// Returns the number of elements (approximate while the other thread is active)
+	size_t Size() const
+		{
+			const size_t r = fRead;
+			__sync_synchronize();
+			return fWrite - r;
+		}
+	/// Returns the maximum number of elements
+	size_t Capacity() const { return fMask + 1; }
+private:
+	/// Claim the element at the read position
+	bool Take(T& t)
+		{
+			while (1) {
+				const size_t r = fRead;
+				__sync_synchronize();
+				if (fWrite == r) return false;
+				T tmp = fBuffer[r & fMask];
+				if (__sync_bool_compare_and_swap(&fRead, r, r + 1)) { t = tmp; return true; }
+			}
+		}
+	SpscRing(const SpscRing&);
+	SpscRing& operator= (const SpscRing&);
+	std::vector<T> fBuffer;
+	size_t fMask;
+	volatile size_t fRead;  ///< Total number of elements removed
+	volatile size_t fWrite; ///< Total number of elements added
+};
+
+} } // namespace dragon namespace utils
+
+#endif // #ifndef __MAKECINT__
+#endif // #ifndef DRAGON_UTILS_THREAD_HXX
@@ -1,5 +1,10 @@
 #include <cmath>
+#include <vector>
 #include <iostream>
+#include <algorithm>
+#include <unistd.h>
+#include "IntTypes.h"
+#include "Thread.hxx"
 #include "Uncertainty.hxx"
 
 
@@ -257,6 +262,315 @@ UDouble_t UDouble_t::StdDev(long n, const UDouble_t* u)
 	return stddev;
 }
 
+
+namespace {
+
+int gNumSamples = 10000;
+int gNumThreads = 0;
+uint64_t gSeed = 0x2545f4914f6cdd1dULL;
+uint64_t gStream = 0; // increments for every array of samples drawn
+
+// Below this many samples per thread, drawing in the calling thread is faster
+const long kMinSamplesPerThread = 1 << 15;
+
+inline uint64_t mix64(uint64_t x)
+{
+	x ^= x >> 30; x *= 0xbf58476d1ce4e5b9ULL;
+	x ^= x >> 27; x *= 0x94d049bb133111ebULL;
+	return x ^ (x >> 31);
+}
+
+// Counter-based generator: uniform in (0, 1] from draw number i of a stream,
+// so samples can be drawn in any order (and by any thread) with the same result
+inline double uniform(uint64_t key, uint64_t i)
+{
+	return ((mix64(key + i*0x9e3779b97f4a7c15ULL) >> 11) + 1) * (1. / 9007199254740992.);
+}
+
+// Fill samples [begin, end) of a split gaussian, begin must be even
+void draw_split_gauss(uint64_t key, double nominal, double low, double high,
+                      long begin, long end, long n, double* out)
+{
+	for (long i = begin; i < end; i += 2) {
+		const double r   = ::sqrt(-2. * ::log(uniform(key, i)));
+		const double phi = 2. * M_PI * uniform(key, i + 1);
+		const double z0 = r * cos(phi), z1 = r * sin(phi);
+		out[i] = nominal + z0 * (z0 < 0 ? low : high);
+		if (i + 1 < n) out[i + 1] = nominal + z1 * (z1 < 0 ? low : high);
+	}
+}
+
+class DrawThread: public dragon::utils::Thread {
+public:
+	uint64_t fKey;
+	double fNominal, fLow, fHigh;
+	long fBegin, fEnd, fN;
+	double* fOut;
+protected:
+	void Run() { draw_split_gauss(fKey, fNominal, fLow, fHigh, fBegin, fEnd, fN, fOut); }
+};
+
+// Element-wise operations; the loops below are written so that the compiler
+// can vectorize them once the operation is inlined
+struct Add { double operator() (double x, double y) const { return x + y; } };
+struct Sub { double operator() (double x, double y) const { return x - y; } };
+struct Mul { double operator() (double x, double y) const { return x * y; } };
+struct Div { double operator() (double x, double y) const { return x / y; } };
+struct Pow { double operator() (double x, double y) const { return ::pow(x, y); } };
+
+// out[i] = op(a[i], b[i]), where an empty array stands for its nominal value
+template <class Op>
+void apply(const std::vector<double>& a, double na, const std::vector<double>& b, double nb,
+           std::vector<double>& out, Op op)
+{
+	if (a.empty() && b.empty()) {
+		out.clear();
+		return;
+	}
+	const size_t n = a.empty() ? b.size() : b.empty() ? a.size() : std::min(a.size(), b.size());
+	out.resize(n);
+	double* o = &out[0];
+	if (b.empty()) {
+		const double* x = &a[0];
+		for (size_t i = 0; i < n; ++i) o[i] = op(x[i], nb);
+	}
+	else if (a.empty()) {
+		const double* y = &b[0];
+		for (size_t i = 0; i < n; ++i) o[i] = op(na, y[i]);
+	}
+	else {
+		const double* x = &a[0];
+		const double* y = &b[0];
+		for (size_t i = 0; i < n; ++i) o[i] = op(x[i], y[i]);
+	}
+}
+
+// out[i] = f(a[i])
+template <class F>
+void apply(const std::vector<double>& a, std::vector<double>& out, F f)
+{
+	out.resize(a.size());
+	for (size_t i = 0; i < a.size(); ++i) out[i] = f(a[i]);
+}
+
+struct Log { double operator() (double x) const { return ::log(x); } };
+struct Exp { double operator() (double x) const { return ::exp(x); } };
+struct Abs { double operator() (double x) const { return fabs(x); } };
+
+double quantile(std::vector<double> samples, double p)
+{
+	if (samples.empty()) return 0;
+	const size_t k = std::min<size_t>(p * samples.size(), samples.size() - 1);
+	std::nth_element(samples.begin(), samples.begin() + k, samples.end());
+	return samples[k];
+}
+
+// Low and high errors from the 68.3% central interval around the median
+void central_interval(const std::vector<double>& samples, double& low, double& high)
+{
+	if (samples.empty()) {
+		low = high = 0;
+		return;
+	}
+	const double median = quantile(samples, 0.5);
+	low  = median - quantile(samples, 0.158655254);
+	high = quantile(samples, 0.841344746) - median;
+}
+
+}
+
+USample_t::USample_t(const UDouble_t& value):
+	fNominal(value.GetNominal())
+{
+	Draw(fNominal, value.GetErrLow(), value.GetErrHigh(), fStat);
+	Draw(fNominal, value.GetSysErrLow(), value.GetSysErrHigh(), fSys);
+}
+
+USample_t::USample_t(double nominal):
+	fNominal(nominal)
+{
+	UDouble_t value(nominal);
+	Draw(fNominal, value.GetErrLow(), value.GetErrHigh(), fStat);
+}
+
+void USample_t::Draw(double nominal, double low, double high, std::vector<double>& samples)
+{
+	if (low == 0 && high == 0) {
+		samples.clear();
+		return;
+	}
+	const long n = gNumSamples;
+	samples.resize(n);
+	const uint64_t key = mix64(gSeed ^ mix64(__sync_fetch_and_add(&gStream, 1)));
+
+	low = fabs(low);
+	high = fabs(high);
+	long nthreads = GetNumThreads();
+	nthreads = std::max(1L, std::min(nthreads, n / kMinSamplesPerThread));
+
+	// Even chunk boundaries, the generator makes samples in pairs
+	const long chunk = ((n + nthreads - 1) / nthreads + 1) & ~1L;
+	std::vector<DrawThread*> threads;
+	for (long begin = chunk; begin < n; begin += chunk) {
+		DrawThread* t = new DrawThread();
+		t->fKey = key;
+		t->fNominal = nominal;
+		t->fLow = low;
+		t->fHigh = high;
+		t->fBegin = begin;
+		t->fEnd = std::min(n, begin + chunk);
+		t->fN = n;
+		t->fOut = &samples[0];
+		if (t->Start()) {
+			threads.push_back(t);
+		}
+		else { // draw this chunk here instead
+			draw_split_gauss(key, nominal, low, high, t->fBegin, t->fEnd, n, &samples[0]);
+			delete t;
+		}
+	}
+	draw_split_gauss(key, nominal, low, high, 0, std::min(n, chunk), n, &samples[0]);
+	for (size_t i = 0; i < threads.size(); ++i) {
+		threads[i]->Join();
+		delete threads[i];
+	}
+}
+
+#define USAMPLE_BINARY_OPERATOR(OP, FUNCTOR)                           \
+	USample_t USample_t::operator OP (const USample_t& rhs) const        \
+	{                                                                    \
+		USample_t out;                                                     \
+		out.fNominal = fNominal OP rhs.fNominal;                           \
+		apply(fStat, fNominal, rhs.fStat, rhs.fNominal, out.fStat, FUNCTOR()); \
+		apply(fSys,  fNominal, rhs.fSys,  rhs.fNominal, out.fSys,  FUNCTOR()); \
+		return out;                                                        \
+	}                                                                    \
+	USample_t USample_t::operator OP (const double& rhs) const           \
+	{                                                                    \
+		static const std::vector<double> none;                             \
+		USample_t out;                                                     \
+		out.fNominal = fNominal OP rhs;                                    \
+		apply(fStat, fNominal, none, rhs, out.fStat, FUNCTOR());           \
+		apply(fSys,  fNominal, none, rhs, out.fSys,  FUNCTOR());           \
+		return out;                                                        \
+	}
+
+USAMPLE_BINARY_OPERATOR(+, Add)
+USAMPLE_BINARY_OPERATOR(-, Sub)
+USAMPLE_BINARY_OPERATOR(*, Mul)
+USAMPLE_BINARY_OPERATOR(/, Div)
+
+#undef USAMPLE_BINARY_OPERATOR
+
+USample_t USample_t::pow(const USample_t& z, double x)
+{
+	static const std::vector<double> none;
+	USample_t out;
+	out.fNominal = ::pow(z.fNominal, x);
+	apply(z.fStat, z.fNominal, none, x, out.fStat, Pow());
+	apply(z.fSys,  z.fNominal, none, x, out.fSys,  Pow());
+	return out;
+}
+
+USample_t USample_t::pow(double x, const USample_t& z)
+{
+	static const std::vector<double> none;
+	USample_t out;
+	out.fNominal = ::pow(x, z.fNominal);
+	apply(none, x, z.fStat, z.fNominal, out.fStat, Pow());
+	apply(none, x, z.fSys,  z.fNominal, out.fSys,  Pow());
+	return out;
+}
+
+USample_t USample_t::log(const USample_t& z)
+{
+	USample_t out;
+	out.fNominal = ::log(z.fNominal);
+	apply(z.fStat, out.fStat, Log());
+	apply(z.fSys,  out.fSys,  Log());
+	return out;
+}
+
+USample_t USample_t::exp(const USample_t& z)
+{
+	USample_t out;
+	out.fNominal = ::exp(z.fNominal);
+	apply(z.fStat, out.fStat, Exp());
+	apply(z.fSys,  out.fSys,  Exp());
+	return out;
+}
+
+USample_t USample_t::abs(const USample_t& z)
+{
+	USample_t out;
+	out.fNominal = fabs(z.fNominal);
+	apply(z.fStat, out.fStat, Abs());
+	apply(z.fSys,  out.fSys,  Abs());
+	return out;
+}
+
+double USample_t::GetQuantile(double p, bool sys) const
+{
+	/*!
+	 * \returns The nominal value if there are no samples of the kind asked for
+	 */
+	const std::vector<double>& samples = sys ? fSys : fStat;
+	return samples.empty() ? fNominal : quantile(samples, p);
+}
+
+UDouble_t USample_t::GetUDouble() const
+{
+	/*!
+	 * The errors are the distances of the 15.9% and 84.1% quantiles from the
+	 * median, which reproduces the errors of a value drawn from a UDouble_t and
+	 * keeps them positive when the distribution is shifted away from the nominal
+	 * value.
+	 */
+	double err[2], sys[2];
+	central_interval(fStat, err[0], err[1]);
+	central_interval(fSys,  sys[0], sys[1]);
+	return UDouble_t(fNominal, err[0], err[1], sys[0], sys[1]);
+}
+
+void USample_t::Print() const
+{
+	std::cout << *this << "\n";
+}
+
+std::ostream& operator<< (std::ostream& strm, const USample_t& us)
+{
+	return strm << us.GetUDouble();
+}
+
+int USample_t::GetNumSamples()
+{
+	return gNumSamples;
+}
+
+void USample_t::SetNumSamples(int n)
+{
+	gNumSamples = std::max(n, 2);
+}
+
+void USample_t::SetSeed(unsigned long seed)
+{
+	gSeed = mix64(seed);
+	gStream = 0;
+}
+
+int USample_t::GetNumThreads()
+{
+	/*! \returns The number of threads set, or the number of CPUs if it was set to 0 */
+	if (gNumThreads > 0) return gNumThreads;
+	const long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+	return ncpus > 0 ? ncpus : 1;
+}
+
+void USample_t::SetNumThreads(int n)
+{
+	gNumThreads = std::max(n, 0);
+}
+
 #ifdef USE_ROOT
 
 TGraphAsymmErrors* PlotUncertainties(Int_t npoints, const Double_t* x, const UDouble_t* y)
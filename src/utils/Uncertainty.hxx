@@ -19,6 +19,7 @@
 #ifndef __MAKECINT__
 #include <iostream>
 #endif
+#include <vector>
 
 class UDouble_t {
 public:
@@ -102,6 +103,95 @@ inline UDouble_t operator* (const double& lhs, const UDouble_t& rhs) { return  r
 inline UDouble_t operator/ (const double& lhs, const UDouble_t& rhs) { return  lhs * UDouble_t::pow(rhs, -1.); }
 
 
+/// Value with uncertainties propagated by Monte Carlo sampling
+/*!
+ * Holds the nominal value and two arrays of GetNumSamples() samples, one varying
+ * the statistical and one the systematic errors (empty if there is no error of
+ * that kind). Sample \e i of every value belongs to the same trial, so operations
+ * work element by element, and non-linear functions or values entering a
+ * calculation more than once (e.g. `x*x`) are handled correctly, where UDouble_t
+ * linearizes and treats every operand as independent.
+ *
+ * Constructing from a UDouble_t draws the samples from a split gaussian: the low
+ * error is the width below the nominal value and the high error the width above.
+ * GetUDouble() converts back, taking the errors from the quantiles of the samples.
+ * The operators and static functions are the same as for UDouble_t, so templated
+ * code can be written for either.
+ */
+class USample_t {
+public:
+	/// Draw samples from the errors of \e value
+	explicit USample_t(const UDouble_t& value);
+	/// Same as USample_t(UDouble_t(nominal))
+	explicit USample_t(double nominal = 0.);
+
+	USample_t operator+(const USample_t& rhs) const;
+	USample_t operator-(const USample_t& rhs) const;
+	USample_t operator*(const USample_t& rhs) const;
+	USample_t operator/(const USample_t& rhs) const;
+
+	USample_t operator+(const double& rhs) const;
+	USample_t operator-(const double& rhs) const;
+	USample_t operator*(const double& rhs) const;
+	USample_t operator/(const double& rhs) const;
+
+	USample_t& operator+= (const USample_t& rhs) { *this = *this + rhs; return *this; }
+	USample_t& operator-= (const USample_t& rhs) { *this = *this - rhs; return *this; }
+	USample_t& operator*= (const USample_t& rhs) { *this = *this * rhs; return *this; }
+	USample_t& operator/= (const USample_t& rhs) { *this = *this / rhs; return *this; }
+
+	USample_t& operator+= (const double& rhs) { *this = *this + rhs; return *this; }
+	USample_t& operator-= (const double& rhs) { *this = *this - rhs; return *this; }
+	USample_t& operator*= (const double& rhs) { *this = *this * rhs; return *this; }
+	USample_t& operator/= (const double& rhs) { *this = *this / rhs; return *this; }
+
+	USample_t& operator- () { (*this) *= -1; return *this; }
+
+	double GetNominal() const { return fNominal; }
+	/// Value at probability \e p (0 to 1) of the statistical (or systematic) samples
+	double GetQuantile(double p, bool sys = false) const;
+	/// Nominal value, with errors from the 68.3% central intervals of the samples
+	UDouble_t GetUDouble() const;
+
+	void Print() const;
+
+public:
+	static USample_t pow(const USample_t& z, double x);
+	static USample_t pow(double z, const USample_t& x);
+	static USample_t log(const USample_t& z);
+	static USample_t exp(const USample_t& z);
+	static USample_t sqrt(const USample_t& z) { return pow(z, 0.5); }
+	static USample_t abs(const USample_t& z);
+
+	/// Number of samples drawn by the constructors (default 10000)
+	static int GetNumSamples();
+	/// Change the number of samples, only for values constructed afterwards
+	static void SetNumSamples(int n);
+	/// Set the seed of the samples, so that a calculation can be repeated exactly
+	static void SetSeed(unsigned long seed);
+	/// Number of threads drawing samples (0: one per CPU)
+	static int GetNumThreads();
+	/// Change the number of threads drawing samples (0: one per CPU)
+	static void SetNumThreads(int n);
+
+private:
+	/// Fill \e samples from a split gaussian, or clear it if both errors are zero
+	static void Draw(double nominal, double low, double high, std::vector<double>& samples);
+
+private:
+	double fNominal;
+	std::vector<double> fStat; // samples varying the statistical errors
+	std::vector<double> fSys;  // samples varying the systematic errors
+};
+
+std::ostream& operator<< (std::ostream&, const USample_t&);
+
+inline USample_t operator+ (const double& lhs, const USample_t& rhs) { return  rhs + lhs; }
+inline USample_t operator- (const double& lhs, const USample_t& rhs) { USample_t rhs1(rhs); return -rhs1 + lhs; }
+inline USample_t operator* (const double& lhs, const USample_t& rhs) { return  rhs * lhs; }
+inline USample_t operator/ (const double& lhs, const USample_t& rhs) { return  lhs * USample_t::pow(rhs, -1.); }
+
+
 #ifdef USE_ROOT
 #include <TMath.h>
 #include <Rtypes.h>
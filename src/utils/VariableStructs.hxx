@@ -3,6 +3,7 @@
 ///\brief Defines some structs wrapping common groupings of variables.
 #ifndef DRAGON_VARIABLE_STRUCTS_HXX
 #define DRAGON_VARIABLE_STRUCTS_HXX
+#include "utils/Valid.hxx"
 
 
 namespace dragon { namespace utils {
@@ -303,6 +304,166 @@ struct TdcVariablesN<1, Order> {
 
 };
 
+//\\\\\\\\\\\\\\\\\\//
+// CALIBRATION PLAN //
+//\\\\\\\\\\\\\\\\\\//
+
+/// Flattened channel mapping and linear calibration for N channels
+/*!
+ * Built from AdcVariables<N> or TdcVariables<N> by sync(), which the detector
+ * classes call before each use: it compares the variables with the values the
+ * plan was built from, and rebuilds only if they differ, so variables written
+ * directly (e.g. <tt>variables.adc.slope[i]</tt> from a macro) still take effect.
+ * The comparison is one pass over the flat arrays, much cheaper than indexing the
+ * variables channel by channel on every event.
+ * The gather step reads raw values straight out of the module data arrays, and the
+ * calibration step does pedestal subtraction, zero suppression and the linear
+ * calibration in a single loop with no data-dependent branches, which the compiler
+ * can vectorize.
+ *
+ * Results are the same as dragon::utils::channel_map(), followed by
+ * pedestal_subtract(), zero_suppress1() and linear_calibrate(), as selected at build
+ * time. Channels outside the range of the module are read through
+ * <tt>get_data()</tt>, so they are reported as before.
+ */
+template <int N>
+class CalibrationPlan {
+public:
+	/// Empty plan (maps nothing, unit calibration)
+	CalibrationPlan(): fBuilt(false), fNch(0), fPedestal(false), fSuppress(false), fThreshold(0.)
+		{
+			for (int i = 0; i< N; ++i) {
+				fModule[i] = fChannel[i] = 0; fDirect[i] = false;
+				fPed[i] = 0.; fSlope[i] = 1.; fOffset[i] = 0.;
+			}
+		}
+	/// Build from adc variables
+	/*!
+	 * \param [in] v Adc variables (module, channel, pedestal, slope, offset)
+	 * \param [in] nch Number of channels in the adc modules
+	 * \param [in] pedestal Subtract pedestals?
+	 * \param [in] suppress Zero suppress (after pedestal subtraction)?
+	 * \param [in] threshold Zero suppression threshold
+	 */
+	void build(const AdcVariables<N>& v, int nch, bool pedestal, bool suppress = false, double threshold = 0.)
+		{
+			fBuilt = true; fNch = nch;
+			fPedestal = pedestal; fSuppress = suppress; fThreshold = threshold;
+			for (int i = 0; i< N; ++i) {
+				set_source(i, v.module[i], v.channel[i], nch);
+				fPed[i] = v.pedestal[i]; fSlope[i] = v.slope[i]; fOffset[i] = v.offset[i];
+			}
+		}
+	/// Build from tdc variables
+	/*! \param [in] v Tdc variables (module, channel, slope, offset) */
+	void build(const TdcVariables<N>& v)
+		{
+			fBuilt = true; fNch = 0;
+			fPedestal = false; fSuppress = false; fThreshold = 0.;
+			for (int i = 0; i< N; ++i) {
+				set_source(i, v.module[i], v.channel[i], 0);
+				fPed[i] = 0.; fSlope[i] = v.slope[i]; fOffset[i] = v.offset[i];
+			}
+		}
+	/// Build from adc variables, unless the plan was built from the same values
+	/*! Arguments as for build(); \returns true if the plan was rebuilt */
+	bool sync(const AdcVariables<N>& v, int nch, bool pedestal, bool suppress = false, double threshold = 0.)
+		{
+			// no early exit, so that the compiler can vectorize the comparison
+			bool changed = !fBuilt || fNch != nch || fPedestal != pedestal || fSuppress != suppress || fThreshold != threshold;
+			for (int i = 0; i< N; ++i)
+				changed |= (fModule[i] != v.module[i]) | (fChannel[i] != v.channel[i]) |
+					(fPed[i] != v.pedestal[i]) | (fSlope[i] != v.slope[i]) | (fOffset[i] != v.offset[i]);
+			if (changed) build(v, nch, pedestal, suppress, threshold);
+			return changed;
+		}
+	/// Build from tdc variables, unless the plan was built from the same values
+	/*! \returns true if the plan was rebuilt */
+	bool sync(const TdcVariables<N>& v)
+		{
+			bool changed = !fBuilt || fNch != 0 || fPedestal || fSuppress;
+			for (int i = 0; i< N; ++i)
+				changed |= (fModule[i] != v.module[i]) | (fChannel[i] != v.channel[i]) |
+					(fSlope[i] != v.slope[i]) | (fOffset[i] != v.offset[i]);
+			if (changed) build(v);
+			return changed;
+		}
+	/// Read raw values from a single module (must have a public \c data[] array)
+	template <class T, class M>
+	void gather(T* output, const M& module) const
+		{
+			for (int i = 0; i< N; ++i)
+				output[i] = fDirect[i] ? module.data[fChannel[i]] : module.get_data(fChannel[i]);
+		}
+	/// Read raw values from an array of modules (must have a public \c data[] array)
+	template <class T, class M>
+	void gather_modules(T* output, const M* modules) const
+		{
+			for (int i = 0; i< N; ++i) {
+				const M& module = modules[fModule[i]];
+				output[i] = fDirect[i] ? module.data[fChannel[i]] : module.get_data(fChannel[i]);
+			}
+		}
+	/// Calibrate an array of N values in place; invalid values are left untouched
+	template <class T>
+	void calibrate(T* values) const
+		{
+			const T none = dragon::NoData<T>::value();
+			for (int i = 0; i< N; ++i) {
+				const T raw = values[i];
+				T x = fPedestal ? raw - fPed[i] : raw;
+				// pedestal subtraction can land on the "no data" value, which is then left alone
+				const bool ok = (raw != none) && (x != none);
+				x = (fSuppress && x < fThreshold) ? 0 : x;
+				values[i] = ok ? fOffset[i] + x * fSlope[i] : none;
+			}
+		}
+	/// Calibrate as calibrate(), also listing the channels left with valid values
+	template <class T>
+	int calibrate_hits(T* values, int* hits) const
+		{
+			/*!
+			 * \param [in,out] values Array of N values, calibrated in place
+			 * \param [out] hits Filled with the indices of valid calibrated values, in
+			 *  ascending order; must have room for N
+			 * \returns The number of valid values
+			 */
+			const T none = dragon::NoData<T>::value();
+			int nhits = 0;
+			for (int i = 0; i< N; ++i) {
+				const T raw = values[i];
+				T x = fPedestal ? raw - fPed[i] : raw;
+				const bool ok = (raw != none) && (x != none);
+				x = (fSuppress && x < fThreshold) ? 0 : x;
+				values[i] = ok ? fOffset[i] + x * fSlope[i] : none;
+				hits[nhits] = i;
+				nhits += ok;
+			}
+			return nhits;
+		}
+
+private:
+	/// Set mapping for one channel
+	void set_source(int i, int module, int channel, int nch)
+		{
+			fModule[i]  = module;
+			fChannel[i] = channel;
+			fDirect[i]  = (channel >= 0 && channel < nch);
+		}
+
+	bool fBuilt;        ///< Built at least once?
+	int fNch;           ///< Number of channels in the modules (0 for tdc variables)
+	int fModule[N];     ///< Module index for each channel
+	int fChannel[N];    ///< Module channel for each channel
+	bool fDirect[N];    ///< Can fChannel be read directly from the \c data array?
+	double fPed[N];     ///< Pedestals
+	double fSlope[N];   ///< Slopes
+	double fOffset[N];  ///< Offsets
+	bool fPedestal;     ///< Subtract pedestals?
+	bool fSuppress;     ///< Zero suppress?
+	double fThreshold;  ///< Zero suppression threshold
+};
+
 } } // namespace dragon namespace utils
 
 
@@ -0,0 +1,102 @@
+#
+# Converts an AME mass table (e.g. mass16.txt) into the built-in table of
+# TAtomicMassTable. Usage: awk -f ame2table.awk mass16.txt > AmeTable.inc
+#
+# Fields are read from the same columns as TAtomicMassTable::ParseLine(), and
+# values are copied as text, so the compiled table holds the same numbers as
+# a table read with SetFile(). Entries are written sorted by Z, then A, with
+# the index by Z and the element symbol hash used for lookups.
+#
+
+function trim(s) {
+	gsub(/^[ \t]+|[ \t]+$/, "", s)
+	return s
+}
+
+# Text before the first '#' (marking an extrapolated value), or "0" if empty
+function number(s) {
+	if (index(s, "#")) s = substr(s, 1, index(s, "#") - 1)
+	s = trim(s)
+	return s == "" ? "0" : s
+}
+
+# Same as symbol_index() in TAtomicMass.cxx
+function symbol_index(sym,   c0, c1) {
+	c0 = index("ABCDEFGHIJKLMNOPQRSTUVWXYZn", substr(sym, 1, 1))
+	if (c0 == 0 || length(sym) > 2) return -1
+	if (length(sym) == 1) return 27 * c0
+	c1 = index("abcdefghijklmnopqrstuvwxyz", substr(sym, 2, 1))
+	return c1 == 0 ? -1 : 27 * c0 + c1
+}
+
+BEGIN { nheaders = 39; zmax = -1; amax = 0; stop = 0 }
+
+NR <= nheaders || stop { next }
+
+{
+	n = substr($0, 5, 5) + 0
+	z = substr($0, 10, 5) + 0
+	a = substr($0, 15, 5) + 0
+	if (a != z + n) {
+		printf("ame2table: line %d: A != N+Z : A, N, Z = %d, %d, %d\n", NR, a, z, n) > "/dev/stderr"
+		stop = 1
+		next
+	}
+	sym = substr($0, 21, 3)
+	gsub(/ /, "", sym)
+	me = substr($0, 29, 13)
+	err = substr($0, 42, 11)
+	extrapolated = index(me, "#") ? "true" : "false"
+	if ((z, a) in symbols) {
+		printf("ame2table: line %d: duplicate nucleus A, Z = %d, %d\n", NR, a, z) > "/dev/stderr"
+		failed = 1
+		exit 1
+	}
+	symbols[z, a] = sym
+	values[z, a] = number(me) ", " number(err) ", " extrapolated
+	element[z] = sym
+	if (z > zmax) zmax = z
+	if (a > amax) amax = a
+}
+
+END {
+	if (failed) exit 1
+	print "// Generated by ame2table.awk from " FILENAME ", do not edit"
+	print ""
+	print "const TAtomicMassTable::Entry_t kAmeEntries[] = {"
+	count = 0
+	for (z = 0; z <= zmax; ++z) {
+		first[z] = count
+		for (a = 0; a <= amax; ++a) {
+			if (!((z, a) in symbols)) continue
+			if (!(z in mina)) mina[z] = a
+			printf("\t{ { \"%s\", %d, %d, %d }, { %s } },\n", symbols[z, a], a, z, a - z, values[z, a])
+			++count
+		}
+		counts[z] = count - first[z]
+	}
+	print "};"
+	print ""
+	print "const int kAmeNumEntries = " count ";"
+	print ""
+	print "const TAtomicMassTable::ZRange_t kAmeZ[] = {"
+	for (z = 0; z <= zmax; ++z)
+		printf("\t{ %d, %d, %d },\n", first[z], (z in mina) ? mina[z] : 0, counts[z])
+	print "};"
+	print ""
+	print "const int kAmeNumZ = " (zmax + 1) ";"
+	print ""
+	for (i = 0; i < 28 * 27; ++i) hash[i] = -1
+	for (z = 0; z <= zmax; ++z)
+		if (z in element && symbol_index(element[z]) >= 0) hash[symbol_index(element[z])] = z
+	print "const short kAmeElements[28 * 27] = {"
+	line = ""
+	for (i = 0; i < 28 * 27; ++i) {
+		line = line sprintf("%4d,", hash[i])
+		if (i % 27 == 26) {
+			print "\t" line
+			line = ""
+		}
+	}
+	print "};"
+}
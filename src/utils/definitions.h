@@ -10,6 +10,7 @@
  *  Define event ID codes for the dragon system. *
  *************************************************/
 
+#define DRAGON_SONIK_EVENT         0 /*!< SONIK event ID, calculated from tail events (analysis only) */
 #define DRAGON_HEAD_EVENT          1 /*!< Dragon head event ID */
 #define DRAGON_HEAD_SCALER         2 /*!< Dragon head scaler ID */
 #define DRAGON_TAIL_EVENT          3 /*!< Dragon tail event ID */
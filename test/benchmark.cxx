@@ -0,0 +1,649 @@
+/// \file benchmark.cxx
+/// \brief Synthetic-data benchmarks of unpacking, queueing and conversion.
+///
+/// Generates a stream of DRAGON head (VTRH, TSCH, ADC0, TDC0) and tail (VTRT, TSCT,
+/// TLQ0, TLQ1, TLT0) events, laid out as the frontends write them, with configurable
+/// rate, coincidence fraction and module multiplicities. Then times:
+///  - vme::V792 and vme::V1190 unpacking of the head banks
+///  - midas::Event construction from the raw data, and copies
+///  - tstamp::Queue push/pop throughput at a given depth, for each engine
+///  - dragon::Head and dragon::Tail unpack() and calculate()
+///  - dragon::Coinc composition from head and tail events, and calculate()
+///  - end-to-end conversion of a MIDAS file written from the stream: reading,
+///    timestamp matching, unpacking and calculation through dragon::Unpacker
+///    (no ROOT output), also once the queue has filled (steady state), with each
+///    queue engine (checking that every head and tail event is filled once, as
+///    mid2root fills its trees), and optionally a full mid2root run on the same file
+///
+/// Each result is one line: a table by default, or one JSON object per line
+/// with <tt>--json</tt>, for tracking across releases. Results also give the heap
+/// allocations (calls to operator new) per operation, except for mid2root.
+/// Run <tt>benchmark --help</tt> for the options.
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include <new>
+#include <sys/time.h>
+#include <sys/stat.h>
+#include "utils/definitions.h"
+#include "utils/ErrorDragon.hxx"
+#include "midas/libMidasInterface/TMidasFile.h"
+#include "midas/Event.hxx"
+#include "midas/Database.hxx"
+#include "Defaults.hxx"
+#include "TStamp.hxx"
+#include "Unpack.hxx"
+#include "Dragon.hxx"
+#include "Vme.hxx"
+
+namespace {
+volatile unsigned long gAllocations = 0; ///< Calls to operator new so far
+}
+
+#if __cplusplus < 201103L
+void* operator new(size_t size) throw(std::bad_alloc)
+#else
+void* operator new(size_t size)
+#endif
+{
+	__sync_fetch_and_add(&gAllocations, 1);
+	void* p = malloc(size ? size : 1);
+	if (!p) throw std::bad_alloc();
+	return p;
+}
+
+void operator delete(void* p) throw()
+{
+	free(p);
+}
+
+namespace {
+
+const double kLatency = 2e3;  // tail readout latency w.r.t. head (us)
+const double kWindow  = 10.;  // coincidence window (us)
+
+/// Benchmark settings
+struct Options_t {
+	size_t fEvents;      ///< Number of generated events (before coincidence partners)
+	double fRate;        ///< Total trigger rate (Hz)
+	double fCoinc;       ///< Fraction of head events with a tail partner
+	int fAdcHits;        ///< Channels fired per ADC module
+	int fTdcHits;        ///< Measurements per TDC module
+	double fDepth;       ///< Queue depth for the queue benchmarks (events)
+	unsigned fSeed;      ///< Random seed
+	std::string fFile;   ///< MIDAS file written for the end-to-end benchmarks
+	std::string fMid2root; ///< mid2root executable, empty to skip
+	bool fJson;          ///< Machine-readable output
+	Options_t():
+		fEvents(200000), fRate(5e4), fCoinc(0.2), fAdcHits(16), fTdcHits(16),
+		fDepth(1e4), fSeed(1), fFile("/tmp/dragon_benchmark.mid"), fJson(false) { }
+};
+
+double now()
+{
+	timeval tv;
+	gettimeofday(&tv, 0);
+	return tv.tv_sec + tv.tv_usec*1e-6;
+}
+
+double uniform()
+{
+	return (rand() + 0.5) / (RAND_MAX + 1.);
+}
+
+/// Heap allocations so far
+unsigned long allocations()
+{
+	return gAllocations;
+}
+
+/// One benchmark result
+class Report {
+public:
+	Report(const Options_t& options): fJson(options.fJson)
+		{
+			if (fJson) {
+				printf("{\"benchmark\": \"config\", \"events\": %lu, \"rate\": %g, \"coinc\": %g, "
+							 "\"adc_hits\": %d, \"tdc_hits\": %d, \"depth\": %g, \"seed\": %u}\n",
+							 (unsigned long)options.fEvents, options.fRate, options.fCoinc,
+							 options.fAdcHits, options.fTdcHits, options.fDepth, options.fSeed);
+			}
+			else {
+				printf("%-22s %12s %12s %14s %10s %10s\n", "benchmark", "ops", "ns/op", "ops/s", "MB/s", "allocs/op");
+			}
+		}
+	/// Print a result: \e n operations on \e bytes of data in \e sec seconds, with \e allocs heap allocations (< 0 if not counted)
+	void operator() (const char* name, double n, double sec, double bytes = 0, double allocs = -1)
+		{
+			const double nsPerOp = n > 0 ? 1e9 * sec / n : 0;
+			const double opsPerSec = sec > 0 ? n / sec : 0;
+			const double mbPerSec = sec > 0 ? bytes / sec / (1024.*1024.) : 0;
+			const double allocsPerOp = allocs >= 0 && n > 0 ? allocs / n : -1;
+			if (fJson) {
+				printf("{\"benchmark\": \"%s\", \"ops\": %.0f, \"seconds\": %.6f, \"ns_per_op\": %.2f, "
+							 "\"ops_per_sec\": %.6g, \"mb_per_sec\": %.6g",
+							 name, n, sec, nsPerOp, opsPerSec, mbPerSec);
+				if (allocsPerOp >= 0) printf(", \"allocs_per_op\": %.4g", allocsPerOp);
+				printf("}\n");
+			}
+			else {
+				printf("%-22s %12.0f %12.2f %14.6g %10.4g", name, n, nsPerOp, opsPerSec, mbPerSec);
+				if (allocsPerOp >= 0) printf(" %10.4g", allocsPerOp);
+				printf("\n");
+			}
+			fflush(stdout);
+		}
+private:
+	bool fJson;
+};
+
+
+/// Builds the data of one MIDAS event, bank by bank (16-bit bank format)
+class EventBuilder {
+public:
+	EventBuilder() { Clear(); }
+	void Clear()
+		{ fData.assign(sizeof(TMidas_BANK_HEADER) / sizeof(uint32_t), 0); }
+	/// Append a TID_DWORD bank
+	void AddBank(const char* name, const std::vector<uint32_t>& words)
+		{
+			TMidas_BANK bank;
+			std::copy(name, name + 4, bank.fName);
+			bank.fType = 6; // TID_DWORD
+			bank.fDataSize = words.size() * sizeof(uint32_t);
+			const uint32_t* pbank = reinterpret_cast<const uint32_t*>(&bank);
+			fData.insert(fData.end(), pbank, pbank + sizeof(TMidas_BANK) / sizeof(uint32_t));
+			fData.insert(fData.end(), words.begin(), words.end());
+			if (words.size() % 2) fData.push_back(0); // banks are padded to 8 bytes
+		}
+	/// Append the complete event (header and data) to \e stream
+	void Write(uint16_t id, uint32_t serial, std::vector<char>& stream)
+		{
+			TMidas_BANK_HEADER* bkh = reinterpret_cast<TMidas_BANK_HEADER*>(&fData[0]);
+			bkh->fFlags = 1;
+			bkh->fDataSize = fData.size() * sizeof(uint32_t) - sizeof(TMidas_BANK_HEADER);
+			midas::Event::Header header;
+			header.fEventId = id;
+			header.fTriggerMask = 0;
+			header.fSerialNumber = serial;
+			header.fTimeStamp = 0;
+			header.fDataSize = fData.size() * sizeof(uint32_t);
+			const char* ph = reinterpret_cast<const char*>(&header);
+			const char* pd = reinterpret_cast<const char*>(&fData[0]);
+			stream.insert(stream.end(), ph, ph + sizeof(header));
+			stream.insert(stream.end(), pd, pd + header.fDataSize);
+		}
+private:
+	std::vector<uint32_t> fData;
+};
+
+/// Synthetic DRAGON event stream
+class Generator {
+public:
+	Generator(const Options_t& options): fOptions(options), fCount(0) { }
+
+	/// Generate the stream: BOR, head and tail events in arrival order, EOR
+	void Generate(std::vector<char>& stream, std::vector<size_t>& offsets);
+
+private:
+	struct Trigger_t {
+		double fArrival;
+		double fTime;
+		bool fHead;
+		bool operator< (const Trigger_t& other) const { return fArrival < other.fArrival; }
+	};
+
+	void Io32(uint64_t clock, std::vector<uint32_t>& words)
+		{
+			const uint32_t t = uint32_t(clock);
+			const uint32_t fields[9] = { 0xaaaa0020, fCount, t, t + 20, t + 400, 20, 380, 400, 1 };
+			words.assign(fields, fields + 9);
+		}
+	void Tsc(uint64_t clock, std::vector<uint32_t>& words)
+		{
+			words.clear();
+			words.push_back(0x01130215);                                   // version
+			words.push_back(0);                                            // write timestamp
+			words.push_back(0);                                            // routing
+			words.push_back(1 | ((uint32_t)((clock >> 28) & 0xff) << 16)); // nch, tsch
+			words.push_back((uint32_t)(clock >> 36));                      // rollover
+			words.push_back((uint32_t)(clock & 0x3fffffff));               // channel 0, tscl
+		}
+	/// V792 / V785: header, one data word per fired channel, footer
+	void Adc(std::vector<uint32_t>& words)
+		{
+			const int nch = std::min<int>(fOptions.fAdcHits, vme::V792::MAX_CHANNELS);
+			int channels[vme::V792::MAX_CHANNELS];
+			for (int i = 0; i< vme::V792::MAX_CHANNELS; ++i) channels[i] = i;
+			for (int i = 0; i< nch; ++i) std::swap(channels[i], channels[i + rand() % (vme::V792::MAX_CHANNELS - i)]);
+			words.clear();
+			words.push_back((uint32_t(vme::V792::HEADER_BITS) << 24) | (nch << 6));
+			for (int i = 0; i< nch; ++i)
+				words.push_back((uint32_t(vme::V792::DATA_BITS) << 24) | (channels[i] << 16) | (rand() & 0xfff));
+			words.push_back((uint32_t(vme::V792::FOOTER_BITS) << 24) | (fCount & 0xffffff));
+		}
+	/// V1190: global header, TDC header, measurements, TDC trailer, global trailer
+	void Tdc(std::vector<uint32_t>& words)
+		{
+			const uint32_t evid = fCount & 0xfff;
+			words.clear();
+			words.push_back((uint32_t(vme::V1190::GLOBAL_HEADER) << 27) | ((fCount & 0x3fffff) << 5));
+			words.push_back((uint32_t(vme::V1190::TDC_HEADER) << 27) | (evid << 12) | (fCount & 0xfff));
+			for (int i = 0; i< fOptions.fTdcHits; ++i) {
+				const uint32_t ch = rand() % vme::V1190::MAX_CHANNELS, trailing = i % 2;
+				words.push_back((uint32_t(vme::V1190::TDC_MEASUREMENT) << 27) | (trailing << 26) | (ch << 19) | (rand() & 0x7ffff));
+			}
+			words.push_back((uint32_t(vme::V1190::TDC_TRAILER) << 27) | (evid << 12) | ((fOptions.fTdcHits + 2) & 0xfff));
+			words.push_back((uint32_t(vme::V1190::GLOBAL_TRAILER) << 27) | (((fOptions.fTdcHits + 4) & 0xffff) << 5));
+		}
+	/// Begin/end of run event with a minimal ODB dump
+	void RunTransition(uint16_t id, std::vector<char>& stream)
+		{
+			const char* xml =
+				"<?xml version=\"1.0\" encoding=\"ISO-8859-1\"?>\n"
+				"<odb root=\"/\" filename=\"benchmark.xml\">\n"
+				"<dir name=\"Experiment\">\n"
+				"<dir name=\"Run Parameters\">\n"
+				"<key name=\"Comment\" type=\"STRING\" size=\"80\">Synthetic benchmark data</key>\n"
+				"</dir>\n"
+				"</dir>\n"
+				"<dir name=\"Runinfo\">\n"
+				"<key name=\"Run number\" type=\"INT\">1</key>\n"
+				"</dir>\n"
+				"</odb>\n";
+			midas::Event::Header header;
+			header.fEventId = id;
+			header.fTriggerMask = 0x494d; // "MI"
+			header.fSerialNumber = 1;     // run number
+			header.fTimeStamp = 0;
+			header.fDataSize = strlen(xml);
+			const char* ph = reinterpret_cast<const char*>(&header);
+			stream.insert(stream.end(), ph, ph + sizeof(header));
+			stream.insert(stream.end(), xml, xml + header.fDataSize);
+		}
+
+private:
+	const Options_t& fOptions;
+	uint32_t fCount;           ///< Triggers so far
+	EventBuilder fBuilder;
+	std::vector<uint32_t> fWords;
+};
+
+void Generator::Generate(std::vector<char>& stream, std::vector<size_t>& offsets)
+{
+	std::vector<Trigger_t> triggers;
+	double t = 1e3;
+	for (size_t i = 0; i< fOptions.fEvents; ++i) {
+		t += -log(uniform()) / fOptions.fRate * 1e6;
+		Trigger_t trig = { t, t, uniform() < 0.5 };
+		if (!trig.fHead) trig.fArrival += kLatency;
+		triggers.push_back(trig);
+		if (trig.fHead && uniform() < fOptions.fCoinc) {
+			const double t2 = t + uniform()*kWindow*0.5;
+			Trigger_t partner = { t2 + kLatency, t2, false };
+			triggers.push_back(partner);
+		}
+	}
+	std::stable_sort(triggers.begin(), triggers.end());
+
+	stream.clear();
+	offsets.clear();
+	RunTransition(MIDAS_BOR, stream);
+	for (size_t i = 0; i< triggers.size(); ++i) {
+		const uint64_t clock = (uint64_t)(triggers[i].fTime * DRAGON_TSC_FREQ);
+		fBuilder.Clear();
+		Io32(clock, fWords);
+		fBuilder.AddBank(triggers[i].fHead ? HEAD_IO32_BANK : TAIL_IO32_BANK, fWords);
+		Tsc(clock, fWords);
+		fBuilder.AddBank(triggers[i].fHead ? HEAD_TSC_BANK : TAIL_TSC_BANK, fWords);
+		if (triggers[i].fHead) {
+			Adc(fWords); fBuilder.AddBank(HEAD_ADC_BANK, fWords);
+			Tdc(fWords); fBuilder.AddBank(HEAD_TDC_BANK, fWords);
+		}
+		else {
+			Adc(fWords); fBuilder.AddBank(TAIL_ADC_BANK_0, fWords);
+			Adc(fWords); fBuilder.AddBank(TAIL_ADC_BANK_1, fWords);
+			Tdc(fWords); fBuilder.AddBank(TAIL_TDC_BANK, fWords);
+		}
+		offsets.push_back(stream.size());
+		fBuilder.Write(triggers[i].fHead ? DRAGON_HEAD_EVENT : DRAGON_TAIL_EVENT, fCount++, stream);
+	}
+	RunTransition(MIDAS_EOR, stream);
+}
+
+
+/// Queue owner counting handled events
+class Counter {
+public:
+	size_t fSingles, fCoinc;
+	Counter(): fSingles(0), fCoinc(0) { }
+	void Process(const midas::Event&) { ++fSingles; }
+	void Process(const midas::Event&, const midas::Event&) { ++fCoinc; }
+	void Process(tstamp::Diagnostics*) { }
+};
+
+const midas::Event::Header* header_at(const std::vector<char>& stream, size_t offset)
+{
+	return reinterpret_cast<const midas::Event::Header*>(&stream[offset]);
+}
+
+/// Construct the events of the stream, with their TSC and bank directory
+void construct(const std::vector<char>& stream, const std::vector<size_t>& offsets,
+							 std::vector<midas::Event>& events)
+{
+	events.resize(offsets.size());
+	for (size_t i = 0; i< offsets.size(); ++i) {
+		const midas::Event::Header* header = header_at(stream, offsets[i]);
+		const char* tsbank = header->fEventId == DRAGON_HEAD_EVENT ? HEAD_TSC_BANK : TAIL_TSC_BANK;
+		events[i].Reset(header, header + 1, header->fDataSize, tsbank, kWindow);
+	}
+}
+
+void bench_event(const std::vector<char>& stream, const std::vector<size_t>& offsets,
+								 std::vector<midas::Event>& events, Report& report)
+{
+	const double bytes = stream.size();
+	unsigned long a0 = allocations();
+	double t0 = now();
+	for (size_t i = 0; i< offsets.size(); ++i) {
+		const midas::Event::Header* header = header_at(stream, offsets[i]);
+		const char* tsbank = header->fEventId == DRAGON_HEAD_EVENT ? HEAD_TSC_BANK : TAIL_TSC_BANK;
+		midas::Event event(header, header + 1, header->fDataSize, tsbank, kWindow);
+	}
+	report("event_construct", offsets.size(), now() - t0, bytes, allocations() - a0);
+
+	construct(stream, offsets, events); // sizes the vector
+	a0 = allocations(); t0 = now();
+	construct(stream, offsets, events);
+	report("event_reset", offsets.size(), now() - t0, bytes, allocations() - a0);
+
+	midas::Event copy;
+	a0 = allocations(); t0 = now();
+	for (size_t i = 0; i< events.size(); ++i) copy = events[i];
+	report("event_copy", events.size(), now() - t0, bytes, allocations() - a0);
+}
+
+void bench_vme(const std::vector<midas::Event>& events, Report& report)
+{
+	vme::V792 v792;
+	vme::V1190 v1190;
+	unsigned long a0 = allocations();
+	double n = 0, t0 = now();
+	for (size_t i = 0; i< events.size(); ++i) {
+		if (events[i].GetEventId() != DRAGON_HEAD_EVENT) continue;
+		v792.reset();
+		v792.unpack(events[i], HEAD_ADC_BANK, false);
+		++n;
+	}
+	report("v792_unpack", n, now() - t0, 0, allocations() - a0);
+
+	a0 = allocations(); n = 0; t0 = now();
+	for (size_t i = 0; i< events.size(); ++i) {
+		if (events[i].GetEventId() != DRAGON_HEAD_EVENT) continue;
+		v1190.reset();
+		v1190.unpack(events[i], HEAD_TDC_BANK, false);
+		++n;
+	}
+	report("v1190_unpack", n, now() - t0, 0, allocations() - a0);
+}
+
+/// Unpack all events of one type, then calculate a sample of them repeatedly
+template <class T>
+void bench_detector(const std::vector<midas::Event>& events, uint16_t id,
+										const char* unpackName, const char* calcName, Report& report)
+{
+	std::auto_ptr<T> data(new T());
+	std::vector<T> sample;
+	const size_t nsample = 256;
+	sample.reserve(nsample);
+	for (size_t i = 0; i< events.size() && sample.size() < nsample; ++i) {
+		if (events[i].GetEventId() != id) continue;
+		data->reset();
+		data->unpack(events[i]);
+		sample.push_back(*data);
+	}
+
+	unsigned long a0 = allocations();
+	double n = 0, t0 = now();
+	for (size_t i = 0; i< events.size(); ++i) {
+		if (events[i].GetEventId() != id) continue;
+		data->reset();
+		data->unpack(events[i]);
+		++n;
+	}
+	report(unpackName, n, now() - t0, 0, allocations() - a0);
+	if (sample.empty()) return;
+
+	const size_t passes = std::max<size_t>(1, size_t(n) / sample.size());
+	a0 = allocations(); t0 = now();
+	for (size_t p = 0; p< passes; ++p)
+		for (size_t i = 0; i< sample.size(); ++i) sample[i].calculate();
+	report(calcName, double(passes) * sample.size(), now() - t0, 0, allocations() - a0);
+}
+
+/// Compose coincidences from unpacked head and tail events, as the timestamp matching does
+void bench_coinc(const std::vector<midas::Event>& events, Report& report)
+{
+	std::vector<dragon::Head> heads;
+	std::vector<dragon::Tail> tails;
+	const size_t nsample = 256;
+	for (size_t i = 0; i< events.size() && (heads.size() < nsample || tails.size() < nsample); ++i) {
+		if (events[i].GetEventId() == DRAGON_HEAD_EVENT && heads.size() < nsample) {
+			heads.push_back(dragon::Head());
+			heads.back().unpack(events[i]);
+		}
+		else if (events[i].GetEventId() == DRAGON_TAIL_EVENT && tails.size() < nsample) {
+			tails.push_back(dragon::Tail());
+			tails.back().unpack(events[i]);
+		}
+	}
+	if (heads.empty() || tails.empty()) return;
+
+	std::auto_ptr<dragon::Coinc> coinc(new dragon::Coinc());
+	for (size_t i = 0; i< nsample; ++i) // warm up
+		coinc->compose_event(heads[i % heads.size()], tails[i % tails.size()]);
+
+	const size_t n = std::max<size_t>(nsample, events.size());
+	const unsigned long a0 = allocations();
+	const double t0 = now();
+	for (size_t i = 0; i< n; ++i) {
+		coinc->reset();
+		coinc->compose_event(heads[i % heads.size()], tails[i % tails.size()]);
+		coinc->calculate();
+	}
+	report("coinc_compose", n, now() - t0, 0, allocations() - a0);
+}
+
+void bench_queue(const std::vector<midas::Event>& events, const Options_t& options, Report& report)
+{
+	const tstamp::Queue::Engine_t engines[] = { tstamp::Queue::kMultiSet, tstamp::Queue::kCalendar, tstamp::Queue::kMergeJoin };
+	const char* names[] = { "queue_multiset", "queue_calendar", "queue_mergejoin" };
+	for (int e = 0; e< 3; ++e) {
+		Counter counter;
+		std::auto_ptr<tstamp::Queue> queue (tstamp::NewOwnedQueue(options.fDepth / options.fRate * 1e6, &counter, engines[e]));
+		const unsigned long a0 = allocations();
+		const double t0 = now();
+		for (size_t i = 0; i< events.size(); ++i) queue->Push(events[i]);
+		queue->Flush();
+		report(names[e], events.size(), now() - t0, 0, allocations() - a0);
+		if (counter.fSingles != events.size())
+			fprintf(stderr, "%s: lost singles, %lu of %lu handled\n", names[e],
+							(unsigned long)counter.fSingles, (unsigned long)events.size());
+	}
+}
+
+/// Number of events of one code in a list
+size_t count_events(const std::vector<midas::Event>& events, uint16_t id)
+{
+	size_t n = 0;
+	for (size_t i = 0; i< events.size(); ++i) n += events[i].GetEventId() == id;
+	return n;
+}
+
+/// Heads, tails and coincidences filled, as mid2root fills its trees (once per code per call)
+struct Filled_t {
+	size_t fHead, fTail, fCoinc;
+	Filled_t(): fHead(0), fTail(0), fCoinc(0) { }
+	void operator() (const dragon::UnpackedCodes& codes)
+		{
+			fHead  += codes.Test(DRAGON_HEAD_EVENT);
+			fTail  += codes.Test(DRAGON_TAIL_EVENT);
+			fCoinc += codes.Test(DRAGON_COINC_EVENT);
+		}
+};
+
+/// Reading, timestamp matching, unpacking and calculation of the whole file, with one queue engine
+Filled_t bench_unpacker(const Options_t& options, tstamp::Queue::Engine_t engine, const char* const names[2],
+												double bytes, Report& report)
+{
+	dragon::Head head;
+	dragon::Tail tail;
+	dragon::Coinc coinc;
+	dragon::Epics epics;
+	dragon::Scaler schead, sctail, scaux;
+	dragon::RunParameters runpar;
+	tstamp::Diagnostics diag;
+	dragon::Unpacker unpack(&head, &tail, &coinc, &epics, &schead, &sctail, &scaux, &runpar, &diag);
+	dragon::utils::ChangeErrorIgnore quiet(5001); // minimal ODB: missing keys
+	Filled_t filled;
+
+	TMidasFile fin;
+	if (!fin.Open(options.fFile.c_str())) {
+		fprintf(stderr, "Cannot read \"%s\": %s\n", options.fFile.c_str(), fin.GetLastError());
+		return filled;
+	}
+	unpack.SetQueueEngine(engine);
+	// Queue as deep as for the queue benchmarks; once it has filled (twice over, to be
+	// sure), the events recycle storage and the rest of the run is the steady state
+	unpack.SetQueueTime(options.fDepth / options.fRate);
+	const double warmup = 2*options.fDepth;
+	double n = 0, t1 = 0;
+	unsigned long a1 = 0;
+	const unsigned long a0 = allocations();
+	const double t0 = now();
+	TMidasEvent event;
+	while (fin.ReadView(&event)) {
+		if (n == warmup) { a1 = allocations(); t1 = now(); }
+		filled(unpack.Unpack(event.GetEventHeader(), event.GetData()));
+		++n;
+	}
+	while (unpack.FlushQueueIterative()) filled(unpack.GetUnpacked());
+	const double t2 = now();
+	const unsigned long a2 = allocations();
+	report(names[0], n, t2 - t0, bytes, a2 - a0);
+	if (n > warmup)
+		report(names[1], n - warmup, t2 - t1, bytes * (n - warmup) / n, a2 - a1);
+	return filled;
+}
+
+/// Reading, timestamp matching, unpacking and calculation of the whole file, for
+/// each queue engine; checks that every head and tail event is filled once
+void bench_unpacker(const Options_t& options, const std::vector<midas::Event>& events,
+										double bytes, Report& report)
+{
+	const tstamp::Queue::Engine_t engines[] = { tstamp::Queue::kMultiSet, tstamp::Queue::kCalendar, tstamp::Queue::kMergeJoin };
+	const char* names[][2] = { { "unpacker_end_to_end", "unpacker_steady_state" },
+														 { "unpacker_calendar_end_to_end", "unpacker_calendar_steady_state" },
+														 { "unpacker_mergejoin_end_to_end", "unpacker_mergejoin_steady_state" } };
+	const size_t nhead = count_events(events, DRAGON_HEAD_EVENT), ntail = count_events(events, DRAGON_TAIL_EVENT);
+	for (int e = 0; e< 3; ++e) {
+		const Filled_t filled = bench_unpacker(options, engines[e], names[e], bytes, report);
+		if (filled.fHead != nhead || filled.fTail != ntail)
+			fprintf(stderr, "%s: lost events, %lu of %lu heads and %lu of %lu tails filled (%lu coincidences)\n",
+							names[e][0], (unsigned long)filled.fHead, (unsigned long)nhead,
+							(unsigned long)filled.fTail, (unsigned long)ntail, (unsigned long)filled.fCoinc);
+	}
+}
+
+/// Full mid2root conversion of the file
+void bench_mid2root(const Options_t& options, double nevents, double bytes, Report& report)
+{
+	const std::string out = options.fFile + ".root";
+	const std::string cmd = options.fMid2root + " " + options.fFile + " -o " + out + " --overwrite --quiet 3";
+	const double t0 = now();
+	const int status = system(cmd.c_str());
+	const double sec = now() - t0;
+	remove(out.c_str());
+	if (status != 0) {
+		fprintf(stderr, "\"%s\" failed (status %d)\n", cmd.c_str(), status);
+		return;
+	}
+	report("mid2root_end_to_end", nevents, sec, bytes);
+}
+
+int usage(const char* argv0)
+{
+	const Options_t defaults;
+	fprintf(stderr,
+					"usage: %s [-n <events>] [--rate <Hz>] [--coinc <fraction>] [--adc <hits>] [--tdc <hits>]\n"
+					"       [--depth <events>] [--seed <n>] [--file <path>] [--mid2root <executable>] [--json]\n\n"
+					"\t-n:         Number of triggers to generate (default: %lu)\n"
+					"\t--rate:     Total trigger rate, head and tail (default: %g Hz)\n"
+					"\t--coinc:    Fraction of head triggers with a tail partner (default: %g)\n"
+					"\t--adc:      Channels fired per ADC module (default: %d)\n"
+					"\t--tdc:      Measurements per TDC module (default: %d)\n"
+					"\t--depth:    Timestamp queue depth for the queue benchmarks (default: %g events)\n"
+					"\t--seed:     Random seed (default: %u)\n"
+					"\t--file:     MIDAS file to write for the end-to-end benchmarks (default: %s)\n"
+					"\t--mid2root: Also time a conversion of the file with this mid2root executable\n"
+					"\t--json:     Print one JSON object per result\n",
+					argv0, (unsigned long)defaults.fEvents, defaults.fRate, defaults.fCoinc, defaults.fAdcHits,
+					defaults.fTdcHits, defaults.fDepth, defaults.fSeed, defaults.fFile.c_str());
+	return 1;
+}
+
+} // namespace
+
+int main(int argc, char** argv)
+{
+	Options_t options;
+	for (int i = 1; i< argc; ++i) {
+		const std::string arg = argv[i];
+		const bool hasValue = i + 1 < argc;
+		if (arg == "--json") options.fJson = true;
+		else if (arg == "-n" && hasValue)         options.fEvents = atol(argv[++i]);
+		else if (arg == "--rate" && hasValue)     options.fRate = atof(argv[++i]);
+		else if (arg == "--coinc" && hasValue)    options.fCoinc = atof(argv[++i]);
+		else if (arg == "--adc" && hasValue)      options.fAdcHits = atoi(argv[++i]);
+		else if (arg == "--tdc" && hasValue)      options.fTdcHits = atoi(argv[++i]);
+		else if (arg == "--depth" && hasValue)    options.fDepth = atof(argv[++i]);
+		else if (arg == "--seed" && hasValue)     options.fSeed = atoi(argv[++i]);
+		else if (arg == "--file" && hasValue)     options.fFile = argv[++i];
+		else if (arg == "--mid2root" && hasValue) options.fMid2root = argv[++i];
+		else return usage(argv[0]);
+	}
+	if (options.fEvents == 0 || options.fRate <= 0 || options.fAdcHits < 0 || options.fTdcHits < 0)
+		return usage(argv[0]);
+	srand(options.fSeed);
+
+	std::vector<char> stream;
+	std::vector<size_t> offsets;
+	Generator(options).Generate(stream, offsets);
+
+	FILE* fout = fopen(options.fFile.c_str(), "wb");
+	if (!fout || fwrite(&stream[0], 1, stream.size(), fout) != stream.size()) {
+		fprintf(stderr, "Cannot write \"%s\"\n", options.fFile.c_str());
+		return 1;
+	}
+	fclose(fout);
+
+	Report report(options);
+	std::vector<midas::Event> events;
+	bench_event(stream, offsets, events, report);
+	bench_vme(events, report);
+	bench_detector<dragon::Head>(events, DRAGON_HEAD_EVENT, "head_unpack", "head_calculate", report);
+	bench_detector<dragon::Tail>(events, DRAGON_TAIL_EVENT, "tail_unpack", "tail_calculate", report);
+	bench_coinc(events, report);
+	bench_queue(events, options, report);
+	bench_unpacker(options, events, stream.size(), report);
+	if (!options.fMid2root.empty())
+		bench_mid2root(options, offsets.size() + 2, stream.size(), report);
+
+	remove(options.fFile.c_str());
+	return 0;
+}
@@ -0,0 +1,119 @@
+/// \file histshm.cxx
+/// \brief Stress test of dragon::utils::HistSegment.
+///
+/// A forked reader maps the segment read-only and copies histograms while the
+/// writer rewrites them (every cell of a write holds the same value, equal to the
+/// number of entries) and changes the table now and then. Every copy the reader
+/// gets must be consistent. Usage: <tt>histshm [seconds]</tt>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include <unistd.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include "utils/HistSegment.hxx"
+
+namespace {
+
+const char* const kName = "/dragon_histshm_test";
+const int kHists = 64;
+
+double now()
+{
+	timeval tv;
+	gettimeofday(&tv, 0);
+	return tv.tv_sec + tv.tv_usec*1e-6;
+}
+
+/// Table of \e n histograms, of 100 bins times the index (plus one)
+void layout(dragon::utils::HistSegment& shm, int n)
+{
+	shm.BeginLayout();
+	for (int i = 0; i< n; ++i) {
+		dragon::utils::HistSegment::Info_t info;
+		memset(&info, 0, sizeof(info));
+		snprintf(info.fPath, sizeof(info.fPath), "test:/hist%d", i);
+		snprintf(info.fTitle, sizeof(info.fTitle), "Histogram %d", i);
+		info.fDimension = 1;
+		info.fAxis[0].fBins = 100*(i + 1);
+		info.fAxis[0].fLow = 0;
+		info.fAxis[0].fHigh = 1;
+		info.fCells = info.fAxis[0].fBins + 2;
+		if (shm.Add(info) != i) {
+			fprintf(stderr, "Cannot add histogram %d\n", i);
+			exit(1);
+		}
+	}
+	shm.EndLayout();
+}
+
+/// Reader: returns the number of inconsistent copies
+int read(double seconds, unsigned long& nread, unsigned long& nbusy)
+{
+	dragon::utils::HistSegment shm;
+	if (!shm.Open(kName)) return 1;
+	int bad = 0;
+	dragon::utils::HistSegment::Info_t info;
+	std::vector<double> cells;
+	const double stop = now() + seconds;
+	while (now() < stop && shm.IsLive()) {
+		char path[64];
+		const int expected = rand() % kHists;
+		snprintf(path, sizeof(path), "test:/hist%d", expected);
+		const int index = shm.Find(path);
+		if (index != expected) {
+			++bad;
+			continue;
+		}
+		if (!shm.Read(index, info, cells, 10)) {
+			++nbusy;
+			continue;
+		}
+		++nread;
+		bool ok = strcmp(info.fPath, path) == 0 && info.fCells == 100*(index + 1) + 2u && cells.size() == info.fCells;
+		for (size_t i = 0; ok && i< cells.size(); ++i) ok = cells[i] == info.fEntries;
+		if (!ok) ++bad;
+	}
+	return bad;
+}
+
+} // namespace
+
+
+int main(int argc, char** argv)
+{
+	const double seconds = argc > 1 ? atof(argv[1]) : 2;
+	dragon::utils::HistSegment shm;
+	if (!shm.Create(kName, 8 << 20, 2*kHists)) return 1;
+	layout(shm, kHists);
+
+	const pid_t child = fork();
+	if (child == 0) {
+		unsigned long nread = 0, nbusy = 0;
+		const int bad = read(seconds, nread, nbusy);
+		printf("reader: %lu copies, %lu busy, %d inconsistent\n", nread, nbusy, bad);
+		fflush(stdout);
+		_exit(bad ? 1 : 0);
+	}
+
+	unsigned long nwrites = 0, nlayouts = 0;
+	const double stop = now() + seconds + 0.2;
+	while (now() < stop) {
+		if (++nwrites % 1000 == 0) {
+			layout(shm, kHists);
+			++nlayouts;
+		}
+		const int index = rand() % kHists;
+		const double entries = nwrites;
+		double* cells = shm.BeginWrite(index);
+		for (int i = 0; i< 100*(index + 1) + 2; ++i) cells[i] = entries;
+		shm.EndWrite(index, entries);
+	}
+	shm.Close();
+
+	int status = 1;
+	waitpid(child, &status, 0);
+	printf("writer: %lu writes, %lu layouts\n", nwrites, nlayouts);
+	return WIFEXITED(status) ? WEXITSTATUS(status) : 1;
+}
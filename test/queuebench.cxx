@@ -0,0 +1,179 @@
+/// \file queuebench.cxx
+/// \brief Benchmark of the tstamp::Queue storage engines.
+///
+/// Generates a synthetic stream of time-ordered head and tail events (with a
+/// configurable fraction of coincidences and a fixed readout latency between
+/// the two streams), then measures the push/pop throughput of each engine at
+/// several queue depths. Usage: <tt>queuebench [nevents]</tt>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <vector>
+#include <algorithm>
+#include <utility>
+#include <sys/time.h>
+#include "utils/definitions.h"
+#include "midas/Event.hxx"
+#include "TStamp.hxx"
+
+namespace {
+
+const double kRate      = 5e4;   // total event rate (Hz)
+const double kCoincFrac = 0.2;   // fraction of head events with a tail partner
+const double kLatency   = 2e3;   // tail readout latency w.r.t. head (us)
+const double kWindow    = 10.;   // coincidence window (us)
+
+double now()
+{
+	timeval tv;
+	gettimeofday(&tv, 0);
+	return tv.tv_sec + tv.tv_usec*1e-6;
+}
+
+double uniform()
+{
+	return (rand() + 0.5) / (RAND_MAX + 1.);
+}
+
+/// Make an event with a single TSC4 trigger-channel entry at \e clock
+midas::Event make_event(uint16_t id, uint32_t serial, uint64_t clock)
+{
+	uint32_t buf[16];
+	TMidas_BANK_HEADER* bkh = reinterpret_cast<TMidas_BANK_HEADER*>(buf);
+	TMidas_BANK* bk = reinterpret_cast<TMidas_BANK*>(bkh + 1);
+	uint32_t* tsc = reinterpret_cast<uint32_t*>(bk + 1);
+
+	tsc[0] = 0x01130215;                                         // version
+	tsc[1] = 0;                                                  // write timestamp
+	tsc[2] = 0;                                                  // routing
+	tsc[3] = 1 | ((uint32_t)((clock >> 28) & 0xff) << 16);       // nch, tsch
+	tsc[4] = (uint32_t)(clock >> 36);                            // rollover
+	tsc[5] = (uint32_t)(clock & 0x3fffffff);                     // channel 0, tscl
+
+	const char* name = (id == DRAGON_HEAD_EVENT) ? "TSCH" : "TSCT";
+	std::copy(name, name + 4, bk->fName);
+	bk->fType = 6; // TID_DWORD
+	bk->fDataSize = 6*sizeof(uint32_t);
+	bkh->fFlags = 1;
+	bkh->fDataSize = sizeof(TMidas_BANK) + 8*sizeof(uint32_t); // padded to 8 bytes
+
+	midas::Event::Header header;
+	header.fEventId = id;
+	header.fTriggerMask = 0;
+	header.fSerialNumber = serial;
+	header.fTimeStamp = 0;
+	header.fDataSize = sizeof(TMidas_BANK_HEADER) + bkh->fDataSize;
+
+	return midas::Event(&header, buf, header.fDataSize, name, kWindow);
+}
+
+/// Sort by arrival time
+struct CompareFirst {
+	bool operator() (const std::pair<double, midas::Event>& lhs,
+									 const std::pair<double, midas::Event>& rhs) const
+		{ return lhs.first < rhs.first; }
+};
+
+/// Arrival-ordered list of events
+void generate(std::vector<midas::Event>& events, size_t n)
+{
+	std::vector<std::pair<double, midas::Event> > stream;
+	stream.reserve(n);
+	double t = 1e3;
+	uint32_t serial = 0;
+	while (stream.size() < n) {
+		t += -log(uniform()) / kRate * 1e6;
+		bool isHead = uniform() < 0.5;
+		uint64_t clock = (uint64_t)(t * DRAGON_TSC_FREQ);
+		uint16_t id = isHead ? DRAGON_HEAD_EVENT : DRAGON_TAIL_EVENT;
+		double arrival = isHead ? t : t + kLatency;
+		stream.push_back(std::make_pair(arrival, make_event(id, serial++, clock)));
+
+		if (isHead && uniform() < kCoincFrac) {
+			double t2 = t + uniform()*kWindow*0.5;
+			uint64_t clock2 = (uint64_t)(t2 * DRAGON_TSC_FREQ);
+			stream.push_back(std::make_pair(t2 + kLatency, make_event(DRAGON_TAIL_EVENT, serial++, clock2)));
+		}
+	}
+	std::stable_sort(stream.begin(), stream.end(), CompareFirst());
+	events.clear();
+	events.reserve(stream.size());
+	for (size_t i = 0; i< stream.size(); ++i) events.push_back(stream[i].second);
+}
+
+/// Queue owner counting handled events
+class Counter {
+public:
+	size_t fSingles, fCoinc;
+	Counter(): fSingles(0), fCoinc(0) { }
+	void Process(const midas::Event&) { ++fSingles; }
+	void Process(const midas::Event&, const midas::Event&) { ++fCoinc; }
+	void Process(tstamp::Diagnostics*) { }
+};
+
+/// \returns Events per second; \e nsingles is 0 if a push handed on more than one
+/// event (dragon::Unpacker would fill only the last)
+double run(const std::vector<midas::Event>& events, tstamp::Queue::Engine_t engine,
+					 double depth, size_t& nsingles, size_t& ncoinc)
+{
+	Counter counter;
+	std::auto_ptr<tstamp::Queue> queue (tstamp::NewOwnedQueue(depth / kRate * 1e6, &counter, engine));
+
+	size_t multiple = 0;
+	double t0 = now();
+	for (size_t i = 0; i< events.size(); ++i) {
+		const size_t before = counter.fSingles;
+		queue->Push(events[i]);
+		multiple += counter.fSingles > before + 1;
+	}
+	queue->Flush();
+	double t1 = now();
+
+	nsingles = multiple ? 0 : counter.fSingles;
+	ncoinc = counter.fCoinc;
+	return events.size() / (t1 - t0);
+}
+
+} // namespace
+
+int main(int argc, char** argv)
+{
+	size_t nevents = argc > 1 ? atoi(argv[1]) : 400000;
+	std::vector<midas::Event> events;
+	generate(events, nevents);
+
+	// Expected number of matches once the queue covers the tail latency:
+	// every pair of events closer than the coincidence window, of which kMergeJoin
+	// only matches the head + tail ones
+	std::vector<std::pair<double, uint16_t> > times;
+	for (size_t i = 0; i< events.size(); ++i) times.push_back(std::make_pair(events[i].TriggerTime(), events[i].GetEventId()));
+	std::sort(times.begin(), times.end());
+	size_t expected = 0, expectedHT = 0;
+	for (size_t i = 0; i< times.size(); ++i) {
+		for (size_t j = i+1; j< times.size() && times[j].first - times[i].first < kWindow; ++j) {
+			++expected;
+			if (times[j].second != times[i].second) ++expectedHT;
+		}
+	}
+	printf("%lu events, %lu expected coincidence matches (%lu head + tail)\n",
+				 (unsigned long)events.size(), (unsigned long)expected, (unsigned long)expectedHT);
+
+	printf("%10s %14s %14s %14s %8s %10s %10s %10s\n", "depth", "multiset ev/s", "calendar ev/s", "mergejoin ev/s",
+				 "ratio", "coinc(ms)", "coinc(cal)", "coinc(mj)");
+	double depths[] = { 1e2, 1e3, 1e4, 1e5 };
+	for (size_t i = 0; i< sizeof(depths) / sizeof(double); ++i) {
+		size_t s0, c0, s1, c1, s2, c2;
+		double r0 = run(events, tstamp::Queue::kMultiSet, depths[i], s0, c0);
+		double r1 = run(events, tstamp::Queue::kCalendar, depths[i], s1, c1);
+		double r2 = run(events, tstamp::Queue::kMergeJoin, depths[i], s2, c2);
+		printf("%10.0f %14.4g %14.4g %14.4g %8.2f %10lu %10lu %10lu\n",
+					 depths[i], r0, r1, r2, r1/r0, (unsigned long)c0, (unsigned long)c1, (unsigned long)c2);
+		if (s0 != events.size() || s1 != events.size() || s2 != events.size()) {
+			fprintf(stderr, "Lost singles (or several per push) at depth %.0f: %lu/%lu/%lu\n",
+							depths[i], (unsigned long)s0, (unsigned long)s1, (unsigned long)s2);
+			return 1;
+		}
+	}
+	return 0;
+}